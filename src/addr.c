@@ -14,6 +14,7 @@
 #include "bio.h"
 #include "constants.h"
 #include "map.h"
+#include "mem.h"
 #include "uv.h"
 
 static const uint8_t hsk_ip4_mapped[12] = {
@@ -80,7 +81,7 @@ hsk_addr_init(hsk_addr_t *addr) {
 
 hsk_addr_t *
 hsk_addr_alloc(void) {
-  hsk_addr_t *addr = (hsk_addr_t *)malloc(sizeof(hsk_addr_t));
+  hsk_addr_t *addr = (hsk_addr_t *)hsk_malloc(sizeof(hsk_addr_t));
   if (addr)
     hsk_addr_init(addr);
   return addr;
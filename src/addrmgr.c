@@ -4,15 +4,23 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <math.h>
 
 #include "addr.h"
 #include "addrmgr.h"
+#include "bio.h"
 #include "constants.h"
 #include "error.h"
+#include "log.h"
 #include "map.h"
+#include "mem.h"
 #include "seeds.h"
 #include "timedata.h"
 #include "utils.h"
@@ -34,6 +42,21 @@ hsk_addrman_is_stale(const hsk_addrman_t *am, const hsk_addrentry_t *entry);
 static double
 hsk_addrentry_chance(const hsk_addrentry_t *entry, int64_t now);
 
+static void
+hsk_addrtable_init(hsk_addrtable_t *table);
+
+static void
+hsk_addrtable_uninit(hsk_addrtable_t *table);
+
+static bool
+hsk_addrman_place(hsk_addrman_t *am, hsk_addrentry_t *entry);
+
+static void
+hsk_addrman_unplace(hsk_addrman_t *am, hsk_addrentry_t *entry);
+
+static void
+hsk_addrman_promote(hsk_addrman_t *am, hsk_addrentry_t *entry);
+
 int
 hsk_addrman_init(hsk_addrman_t *am, const hsk_timedata_t *td) {
   if (!am || !td)
@@ -42,7 +65,7 @@ hsk_addrman_init(hsk_addrman_t *am, const hsk_timedata_t *td) {
   int rc = HSK_SUCCESS;
   hsk_addrentry_t *addrs = NULL;
 
-  addrs = (hsk_addrentry_t *)calloc(HSK_ADDR_MAX, sizeof(hsk_addrentry_t));
+  addrs = (hsk_addrentry_t *)hsk_calloc(HSK_ADDR_MAX, sizeof(hsk_addrentry_t));
 
   if (!addrs) {
     rc = HSK_ENOMEM;
@@ -52,8 +75,13 @@ hsk_addrman_init(hsk_addrman_t *am, const hsk_timedata_t *td) {
   am->td = (hsk_timedata_t *)td;
   am->addrs = addrs;
   am->size = 0;
-  hsk_map_init_map(&am->map, hsk_addr_hash, hsk_addr_equal, NULL);
-  hsk_map_init_map(&am->banned, hsk_addr_hash, hsk_addr_equal, free);
+  hsk_addr_map_init(&am->map);
+  hsk_map_init_map(&am->banned, hsk_addr_hash, hsk_addr_equal, hsk_free);
+  hsk_addrtable_init(&am->fresh);
+  hsk_addrtable_init(&am->tried);
+  memset(&am->seen, 0, sizeof(am->seen));
+  am->key = hsk_random();
+  memset(am->path, 0, sizeof(am->path));
 
   const char **seed;
   for (seed = hsk_seeds; *seed; seed++) {
@@ -66,7 +94,7 @@ hsk_addrman_init(hsk_addrman_t *am, const hsk_timedata_t *td) {
 
 fail:
   if (addrs) {
-    free(addrs);
+    hsk_free(addrs);
     am->addrs = NULL;
   }
 
@@ -78,14 +106,16 @@ hsk_addrman_uninit(hsk_addrman_t *am) {
   if (!am)
     return;
 
-  free(am->addrs);
-  hsk_map_uninit(&am->map);
+  hsk_free(am->addrs);
+  hsk_addr_map_uninit(&am->map);
   hsk_map_uninit(&am->banned);
+  hsk_addrtable_uninit(&am->fresh);
+  hsk_addrtable_uninit(&am->tried);
 }
 
 hsk_addrman_t *
 hsk_addrman_alloc(const hsk_timedata_t *td) {
-  hsk_addrman_t *am = malloc(sizeof(hsk_addrman_t));
+  hsk_addrman_t *am = hsk_malloc(sizeof(hsk_addrman_t));
   hsk_addrman_init(am, td);
   return am;
 }
@@ -96,23 +126,571 @@ hsk_addrman_free(hsk_addrman_t *am) {
     return;
 
   hsk_addrman_uninit(am);
-  free(am);
+  hsk_free(am);
+}
+
+/*
+ * Buckets
+ */
+
+static void
+hsk_addrtable_init(hsk_addrtable_t *table) {
+  int i;
+
+  for (i = 0; i < HSK_ADDRMAN_BUCKETS; i++) {
+    hsk_addrbucket_t *bucket = &table->buckets[i];
+    bucket->ids = NULL;
+    bucket->size = 0;
+    bucket->cap = 0;
+    bucket->pos = -1;
+    table->used[i] = 0;
+  }
+
+  table->used_count = 0;
+  table->count = 0;
+}
+
+static void
+hsk_addrtable_uninit(hsk_addrtable_t *table) {
+  int i;
+
+  for (i = 0; i < HSK_ADDRMAN_BUCKETS; i++) {
+    hsk_free(table->buckets[i].ids);
+    table->buckets[i].ids = NULL;
+  }
+
+  hsk_addrtable_init(table);
+}
+
+// Bucket for an address: its /16 (IPv4) or /32
+// (IPv6 and onion), keyed per process so remote
+// peers cannot aim for a bucket.
+static int32_t
+hsk_addrman_bucket(const hsk_addrman_t *am, const hsk_addrentry_t *entry) {
+  const hsk_addr_t *addr = &entry->addr;
+  uint8_t group[6];
+
+  group[0] = entry->tried ? 1 : 0;
+  group[1] = addr->type;
+
+  if (hsk_addr_is_ip4(addr)) {
+    group[2] = addr->ip[12];
+    group[3] = addr->ip[13];
+    group[4] = 0;
+    group[5] = 0;
+  } else {
+    memcpy(&group[2], addr->ip, 4);
+  }
+
+  uint32_t hash = hsk_map_murmur3(group, sizeof(group), am->key);
+
+  return (int32_t)(hash % HSK_ADDRMAN_BUCKETS);
+}
+
+static bool
+hsk_addrman_place(hsk_addrman_t *am, hsk_addrentry_t *entry) {
+  hsk_addrtable_t *table = entry->tried ? &am->tried : &am->fresh;
+  int32_t b = hsk_addrman_bucket(am, entry);
+  hsk_addrbucket_t *bucket = &table->buckets[b];
+
+  if (bucket->size == bucket->cap) {
+    int32_t cap = bucket->cap ? bucket->cap * 2 : 8;
+    int32_t *ids = hsk_realloc(bucket->ids, cap * sizeof(int32_t));
+
+    if (!ids) {
+      entry->bucket = -1;
+      entry->slot = -1;
+      return false;
+    }
+
+    bucket->ids = ids;
+    bucket->cap = cap;
+  }
+
+  if (bucket->size == 0) {
+    bucket->pos = table->used_count;
+    table->used[table->used_count++] = b;
+  }
+
+  entry->bucket = b;
+  entry->slot = bucket->size;
+
+  bucket->ids[bucket->size++] = (int32_t)(entry - am->addrs);
+
+  table->count += 1;
+
+  return true;
+}
+
+static void
+hsk_addrman_unplace(hsk_addrman_t *am, hsk_addrentry_t *entry) {
+  if (entry->bucket == -1)
+    return;
+
+  hsk_addrtable_t *table = entry->tried ? &am->tried : &am->fresh;
+  hsk_addrbucket_t *bucket = &table->buckets[entry->bucket];
+
+  assert(bucket->size > 0);
+  assert(bucket->ids[entry->slot] == (int32_t)(entry - am->addrs));
+
+  // Swap the last address into the hole.
+  int32_t last = bucket->ids[--bucket->size];
+
+  if (entry->slot != bucket->size) {
+    bucket->ids[entry->slot] = last;
+    am->addrs[last].slot = entry->slot;
+  }
+
+  if (bucket->size == 0) {
+    int32_t moved = table->used[--table->used_count];
+
+    if (bucket->pos != table->used_count) {
+      table->used[bucket->pos] = moved;
+      table->buckets[moved].pos = bucket->pos;
+    }
+
+    bucket->pos = -1;
+  }
+
+  table->count -= 1;
+
+  entry->bucket = -1;
+  entry->slot = -1;
+}
+
+// Move an address we connected to into the
+// tried table.
+static void
+hsk_addrman_promote(hsk_addrman_t *am, hsk_addrentry_t *entry) {
+  if (entry->tried || entry->removed)
+    return;
+
+  hsk_addrman_unplace(am, entry);
+  entry->tried = true;
+  hsk_addrman_place(am, entry);
+}
+
+/*
+ * Seen Filter
+ */
+
+static void
+hsk_addrman_seen_hash(
+  const hsk_addrman_t *am,
+  const hsk_addr_t *addr,
+  uint32_t *h1,
+  uint32_t *h2
+) {
+  uint8_t data[39];
+
+  data[0] = addr->type;
+  memcpy(&data[1], addr->ip, 36);
+  data[37] = addr->port & 0xff;
+  data[38] = addr->port >> 8;
+
+  *h1 = hsk_map_murmur3(data, sizeof(data), am->key);
+  *h2 = hsk_map_murmur3(data, sizeof(data), ~am->key) | 1;
+}
+
+// Whether the address went by recently, noting
+// it if not.
+static bool
+hsk_addrman_seen(hsk_addrman_t *am, const hsk_addr_t *addr, int64_t now) {
+  hsk_addrseen_t *seen = &am->seen;
+
+  if (seen->count >= HSK_ADDRMAN_SEEN_MAX
+      || now >= seen->time + HSK_ADDRMAN_SEEN_TIME) {
+    seen->cur ^= 1;
+    memset(seen->bits[seen->cur], 0, sizeof(seen->bits[0]));
+    seen->count = 0;
+    seen->time = now;
+  }
+
+  uint8_t *cur = seen->bits[seen->cur];
+  uint8_t *old = seen->bits[seen->cur ^ 1];
+  bool in_cur = true;
+  bool in_old = true;
+  uint32_t h1, h2;
+  int i;
+
+  hsk_addrman_seen_hash(am, addr, &h1, &h2);
+
+  for (i = 0; i < HSK_ADDRMAN_SEEN_HASHES; i++) {
+    uint32_t bit = (h1 + (uint32_t)i * h2) % HSK_ADDRMAN_SEEN_BITS;
+    uint8_t mask = 1 << (bit & 7);
+
+    if (!(cur[bit >> 3] & mask))
+      in_cur = false;
+
+    if (!(old[bit >> 3] & mask))
+      in_old = false;
+
+    cur[bit >> 3] |= mask;
+  }
+
+  if (!in_cur)
+    seen->count += 1;
+
+  return in_cur || in_old;
+}
+
+/*
+ * Persistence
+ */
+
+static void
+hsk_addrman_log(const hsk_addrman_t *am, const char *fmt, ...);
+
+static void
+write_addr(uint8_t **data, const hsk_addr_t *addr) {
+  write_u8(data, addr->type);
+  write_bytes(data, addr->ip, 36);
+  write_u16(data, addr->port);
+  write_bytes(data, addr->key, 33);
+}
+
+static bool
+read_addr(uint8_t **data, size_t *data_len, hsk_addr_t *addr) {
+  hsk_addr_init(addr);
+
+  if (!read_u8(data, data_len, &addr->type))
+    return false;
+
+  if (!read_bytes(data, data_len, addr->ip, 36))
+    return false;
+
+  if (!read_u16(data, data_len, &addr->port))
+    return false;
+
+  if (!read_bytes(data, data_len, addr->key, 33))
+    return false;
+
+  return true;
+}
+
+static bool
+hsk_addrman_read_entry(
+  hsk_addrman_t *am,
+  uint8_t **data,
+  size_t *data_len,
+  uint32_t version
+) {
+  hsk_addr_t addr;
+  uint64_t time, services;
+  int32_t attempts;
+  int64_t last_success, last_attempt;
+  uint32_t rtt = 0;
+
+  if (!read_addr(data, data_len, &addr))
+    return false;
+
+  if (!read_u64(data, data_len, &time)
+      || !read_u64(data, data_len, &services)
+      || !read_i32(data, data_len, &attempts)
+      || !read_i64(data, data_len, &last_success)
+      || !read_i64(data, data_len, &last_attempt)) {
+    return false;
+  }
+
+  if (version > 1 && !read_u32(data, data_len, &rtt))
+    return false;
+
+  hsk_addrentry_t *entry = hsk_addr_map_get(&am->map, &addr);
+
+  // Already known (a seed): keep what we learned.
+  if (entry) {
+    if (time > entry->time)
+      entry->time = time;
+
+    entry->services |= services;
+    entry->attempts = attempts;
+    entry->last_success = last_success;
+    entry->last_attempt = last_attempt;
+    entry->rtt = rtt;
+
+    if (last_success != 0)
+      hsk_addrman_promote(am, entry);
+
+    return true;
+  }
+
+  bool alloc = false;
+  entry = hsk_addrman_alloc_entry(am, &alloc);
+
+  // Full: drop the rest.
+  if (!entry)
+    return true;
+
+  hsk_addr_copy(&entry->addr, &addr);
+  entry->time = time;
+  entry->services = services;
+  entry->attempts = attempts;
+  entry->last_success = last_success;
+  entry->last_attempt = last_attempt;
+  entry->rtt = rtt;
+  entry->ref_count = 1;
+  entry->used = false;
+  entry->removed = false;
+  entry->tried = last_success != 0;
+
+  if (!hsk_addr_map_set(&am->map, &entry->addr, entry)) {
+    if (alloc)
+      am->size -= 1;
+    return true;
+  }
+
+  hsk_addrman_place(am, entry);
+
+  return true;
+}
+
+static bool
+hsk_addrman_read_ban(hsk_addrman_t *am, uint8_t **data, size_t *data_len) {
+  hsk_addr_t addr;
+  int64_t time;
+
+  if (!read_addr(data, data_len, &addr))
+    return false;
+
+  if (!read_i64(data, data_len, &time))
+    return false;
+
+  if (hsk_now() > time + HSK_BAN_TIME)
+    return true;
+
+  if (hsk_map_has(&am->banned, &addr))
+    return true;
+
+  hsk_banned_t *ban = hsk_malloc(sizeof(hsk_banned_t));
+
+  if (!ban)
+    return false;
+
+  hsk_addr_copy(&ban->addr, &addr);
+  ban->time = time;
+
+  if (!hsk_map_set(&am->banned, &ban->addr, ban))
+    hsk_free(ban);
+
+  return true;
+}
+
+int
+hsk_addrman_open(hsk_addrman_t *am, const char *prefix) {
+  if (!am || !prefix)
+    return HSK_EBADARGS;
+
+  if (strlen(prefix) + sizeof(HSK_ADDRMAN_FILE) + 5 > sizeof(am->path))
+    return HSK_EBADARGS;
+
+  if (mkdir(prefix, 0755) != 0 && errno != EEXIST)
+    return HSK_EFAILURE;
+
+  sprintf(am->path, "%s/%s", prefix, HSK_ADDRMAN_FILE);
+
+  FILE *file = fopen(am->path, "rb");
+
+  // Nothing saved yet.
+  if (!file)
+    return HSK_SUCCESS;
+
+  int rc = HSK_EENCODING;
+  uint8_t *raw = NULL;
+
+  if (fseek(file, 0, SEEK_END) != 0)
+    goto done;
+
+  long size = ftell(file);
+
+  if (size < HSK_ADDRMAN_HDR_SIZE || fseek(file, 0, SEEK_SET) != 0)
+    goto done;
+
+  raw = hsk_malloc((size_t)size);
+
+  if (!raw) {
+    rc = HSK_ENOMEM;
+    goto done;
+  }
+
+  if (fread(raw, 1, (size_t)size, file) != (size_t)size)
+    goto done;
+
+  uint8_t *data = raw;
+  size_t data_len = (size_t)size;
+  uint32_t magic, version, network, count, bans;
+
+  read_u32(&data, &data_len, &magic);
+  read_u32(&data, &data_len, &version);
+  read_u32(&data, &data_len, &network);
+  read_u32(&data, &data_len, &count);
+  read_u32(&data, &data_len, &bans);
+
+  if (magic != HSK_ADDRMAN_MAGIC
+      || version < 1
+      || version > HSK_ADDRMAN_VERSION
+      || network != HSK_MAGIC) {
+    goto done;
+  }
+
+  size_t rec_size = version == 1
+    ? HSK_ADDRMAN_REC_SIZE_V1
+    : HSK_ADDRMAN_REC_SIZE;
+
+  if ((size_t)count * rec_size
+      + (size_t)bans * HSK_ADDRMAN_BAN_SIZE != data_len) {
+    goto done;
+  }
+
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    if (!hsk_addrman_read_entry(am, &data, &data_len, version))
+      goto done;
+  }
+
+  for (i = 0; i < bans; i++) {
+    if (!hsk_addrman_read_ban(am, &data, &data_len))
+      goto done;
+  }
+
+  hsk_addrman_log(am, "loaded %u addrs and %u bans from %s\n",
+                  count, bans, am->path);
+
+  rc = HSK_SUCCESS;
+
+done:
+  if (raw)
+    hsk_free(raw);
+
+  fclose(file);
+
+  return rc;
+}
+
+int
+hsk_addrman_flush(const hsk_addrman_t *am) {
+  if (!am)
+    return HSK_EBADARGS;
+
+  // Opened without a prefix: memory only.
+  if (am->path[0] == '\0')
+    return HSK_SUCCESS;
+
+  uint32_t count = 0;
+  uint32_t bans = 0;
+  size_t i;
+
+  for (i = 0; i < am->size; i++) {
+    if (!am->addrs[i].removed)
+      count += 1;
+  }
+
+  bans = (uint32_t)am->banned.size;
+
+  size_t size = HSK_ADDRMAN_HDR_SIZE
+              + (size_t)count * HSK_ADDRMAN_REC_SIZE
+              + (size_t)bans * HSK_ADDRMAN_BAN_SIZE;
+
+  uint8_t *raw = hsk_malloc(size);
+
+  if (!raw)
+    return HSK_ENOMEM;
+
+  uint8_t *data = raw;
+
+  write_u32(&data, HSK_ADDRMAN_MAGIC);
+  write_u32(&data, HSK_ADDRMAN_VERSION);
+  write_u32(&data, HSK_MAGIC);
+  write_u32(&data, count);
+  write_u32(&data, bans);
+
+  for (i = 0; i < am->size; i++) {
+    const hsk_addrentry_t *entry = &am->addrs[i];
+
+    if (entry->removed)
+      continue;
+
+    write_addr(&data, &entry->addr);
+    write_u64(&data, entry->time);
+    write_u64(&data, entry->services);
+    write_i32(&data, entry->attempts);
+    write_i64(&data, entry->last_success);
+    write_i64(&data, entry->last_attempt);
+    write_u32(&data, entry->rtt);
+  }
+
+  hsk_map_iter_t it;
+
+  for (it = hsk_map_begin(&am->banned); it != hsk_map_end(&am->banned); it++) {
+    if (!hsk_map_exists(&am->banned, it))
+      continue;
+
+    const hsk_banned_t *ban = hsk_map_value(&am->banned, it);
+
+    write_addr(&data, &ban->addr);
+    write_i64(&data, ban->time);
+  }
+
+  assert((size_t)(data - raw) == size);
+
+  char tmp[sizeof(am->path) + 4];
+  sprintf(tmp, "%s.tmp", am->path);
+
+  int rc = HSK_EFAILURE;
+  FILE *file = fopen(tmp, "wb");
+
+  if (!file)
+    goto done;
+
+  if (fwrite(raw, 1, size, file) != size) {
+    fclose(file);
+    remove(tmp);
+    goto done;
+  }
+
+  if (fflush(file) != 0 || fclose(file) != 0) {
+    remove(tmp);
+    goto done;
+  }
+
+  if (rename(tmp, am->path) != 0) {
+    remove(tmp);
+    goto done;
+  }
+
+  rc = HSK_SUCCESS;
+
+done:
+  hsk_free(raw);
+  return rc;
 }
 
 hsk_addrentry_t *
 hsk_addrman_alloc_entry(hsk_addrman_t *am, bool *alloc) {
   if (am->size == HSK_ADDR_MAX) {
-    int i;
-    for (i = 0; i < HSK_MIN(am->size, 10); i++) {
-      int index = hsk_random() % am->size;
-      hsk_addrentry_t *entry = &am->addrs[index];
+    hsk_addrtable_t *table = &am->fresh;
+
+    *alloc = false;
+
+    if (table->used_count == 0)
+      return NULL;
+
+    // Make room in a random group of new
+    // addresses. Tried ones are never evicted.
+    int32_t b = table->used[hsk_random() % table->used_count];
+    hsk_addrbucket_t *bucket = &table->buckets[b];
+    int32_t i;
+
+    for (i = 0; i < bucket->size; i++) {
+      hsk_addrentry_t *entry = &am->addrs[bucket->ids[i]];
+
       if (hsk_addrman_is_stale(am, entry)) {
-        hsk_map_del(&am->map, &entry->addr);
-        *alloc = false;
+        hsk_addrman_unplace(am, entry);
+        hsk_addr_map_del(&am->map, &entry->addr);
         return entry;
       }
     }
-    *alloc = false;
+
     return NULL;
   }
 
@@ -120,6 +698,10 @@ hsk_addrman_alloc_entry(hsk_addrman_t *am, bool *alloc) {
 
   hsk_addrentry_t *entry = &am->addrs[am->size];
 
+  entry->tried = false;
+  entry->bucket = -1;
+  entry->slot = -1;
+
   am->size += 1;
 
   *alloc = true;
@@ -129,25 +711,21 @@ hsk_addrman_alloc_entry(hsk_addrman_t *am, bool *alloc) {
 
 static void
 hsk_addrman_log(const hsk_addrman_t *am, const char *fmt, ...) {
-  printf("addrman: ");
-
   va_list args;
   va_start(args, fmt);
-  vprintf(fmt, args);
+  hsk_log_vprintf("addrman: ", fmt, args);
   va_end(args);
 }
 
 const hsk_addrentry_t *
 hsk_addrman_get(const hsk_addrman_t *am, const hsk_addr_t *addr) {
-  return hsk_map_get(&am->map, addr);
+  return hsk_addr_map_get(&am->map, addr);
 }
 
 bool
 hsk_addrman_add_entry(hsk_addrman_t *am, const hsk_netaddr_t *na, bool src) {
-  hsk_addrentry_t *entry = hsk_map_get(&am->map, &na->addr);
-
+  hsk_addrentry_t *entry = hsk_addr_map_get(&am->map, &na->addr);
   char host[HSK_MAX_HOST];
-  hsk_addr_to_string(&na->addr, host, HSK_MAX_HOST, HSK_PORT);
 
   if (entry) {
     int penalty = 2 * 60 * 60;
@@ -192,6 +770,7 @@ hsk_addrman_add_entry(hsk_addrman_t *am, const hsk_netaddr_t *na, bool src) {
 
     entry->ref_count += 1;
 
+    hsk_addr_to_string(&na->addr, host, HSK_MAX_HOST, HSK_PORT);
     hsk_addrman_log(am, "saw existing addr: %s\n", host);
 
     return true;
@@ -209,16 +788,21 @@ hsk_addrman_add_entry(hsk_addrman_t *am, const hsk_netaddr_t *na, bool src) {
   entry->attempts = 0;
   entry->last_success = 0;
   entry->last_attempt = 0;
+  entry->rtt = 0;
   entry->ref_count = 1;
   entry->used = false;
   entry->removed = false;
+  entry->tried = false;
 
-  if (!hsk_map_set(&am->map, &entry->addr, entry)) {
+  if (!hsk_addr_map_set(&am->map, &entry->addr, entry)) {
     if (alloc)
       am->size -= 1;
     return false;
   }
 
+  hsk_addrman_place(am, entry);
+
+  hsk_addr_to_string(&na->addr, host, HSK_MAX_HOST, HSK_PORT);
   hsk_addrman_log(am, "added addr: %s\n", host);
 
   return true;
@@ -240,6 +824,32 @@ hsk_addrman_add_na(hsk_addrman_t *am, const hsk_netaddr_t *na) {
   return hsk_addrman_add_entry(am, na, true);
 }
 
+// Addresses from an addr message, minus the
+// ones seen lately. Returns how many were new
+// or updated.
+size_t
+hsk_addrman_add_nas(
+  hsk_addrman_t *am,
+  const hsk_netaddr_t *nas,
+  size_t count
+) {
+  int64_t now = hsk_timedata_now(am->td);
+  size_t added = 0;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    const hsk_netaddr_t *na = &nas[i];
+
+    if (hsk_addrman_seen(am, &na->addr, now))
+      continue;
+
+    if (hsk_addrman_add_entry(am, na, true))
+      added += 1;
+  }
+
+  return added;
+}
+
 bool
 hsk_addrman_add_sa(hsk_addrman_t *am, const struct sockaddr *sa) {
   hsk_netaddr_t na;
@@ -273,19 +883,21 @@ hsk_addrman_add_ip(
 
 bool
 hsk_addrman_remove_addr(hsk_addrman_t *am, const hsk_addr_t *addr) {
-  hsk_addrentry_t *entry = hsk_map_get(&am->map, addr);
+  hsk_addrentry_t *entry = hsk_addr_map_get(&am->map, addr);
 
   if (!entry)
     return false;
 
   entry->removed = true;
 
+  hsk_addrman_unplace(am, entry);
+
   return true;
 }
 
 bool
 hsk_addrman_mark_attempt(hsk_addrman_t *am, const hsk_addr_t *addr) {
-  hsk_addrentry_t *entry = hsk_map_get(&am->map, addr);
+  hsk_addrentry_t *entry = hsk_addr_map_get(&am->map, addr);
 
   if (!entry)
     return false;
@@ -298,7 +910,7 @@ hsk_addrman_mark_attempt(hsk_addrman_t *am, const hsk_addr_t *addr) {
 
 bool
 hsk_addrman_mark_success(hsk_addrman_t *am, const hsk_addr_t *addr) {
-  hsk_addrentry_t *entry = hsk_map_get(&am->map, addr);
+  hsk_addrentry_t *entry = hsk_addr_map_get(&am->map, addr);
 
   if (!entry)
     return false;
@@ -319,7 +931,7 @@ hsk_addrman_mark_ack(
   const hsk_addr_t *addr,
   uint64_t services
 ) {
-  hsk_addrentry_t *entry = hsk_map_get(&am->map, addr);
+  hsk_addrentry_t *entry = hsk_addr_map_get(&am->map, addr);
 
   if (!entry)
     return false;
@@ -333,6 +945,25 @@ hsk_addrman_mark_ack(
   entry->attempts = 0;
   entry->used = true;
 
+  hsk_addrman_promote(am, entry);
+
+  return true;
+}
+
+// Smoothed like a peer's proof latency (1/8
+// weight to the new sample).
+bool
+hsk_addrman_mark_rtt(hsk_addrman_t *am, const hsk_addr_t *addr, uint32_t rtt) {
+  hsk_addrentry_t *entry = hsk_addr_map_get(&am->map, addr);
+
+  if (!entry)
+    return false;
+
+  if (entry->rtt != 0)
+    rtt = (uint32_t)(((uint64_t)entry->rtt * 7 + rtt) / 8);
+
+  entry->rtt = rtt > 0 ? rtt : 1;
+
   return true;
 }
 
@@ -352,7 +983,7 @@ hsk_addrman_add_ban(hsk_addrman_t *am, const hsk_addr_t *addr) {
     return true;
   }
 
-  hsk_banned_t *ban = malloc(sizeof(hsk_banned_t));
+  hsk_banned_t *ban = hsk_malloc(sizeof(hsk_banned_t));
 
   if (!ban)
     return false;
@@ -361,7 +992,7 @@ hsk_addrman_add_ban(hsk_addrman_t *am, const hsk_addr_t *addr) {
   ban->time = now;
 
   if (!hsk_map_set(&am->banned, &ban->addr, ban)) {
-    free(ban);
+    hsk_free(ban);
     return false;
   }
 
@@ -379,42 +1010,43 @@ hsk_addrman_is_banned(hsk_addrman_t *am, const hsk_addr_t *addr) {
 
   if (now > entry->time + HSK_BAN_TIME) {
     hsk_map_del(&am->banned, &entry->addr);
-    free(entry);
+    hsk_free(entry);
     return false;
   }
 
   return true;
 }
 
+// Draw a candidate: a table (favoring tried),
+// then a non-empty bucket, then an address in
+// it. Each step is a single random pick.
 static const hsk_addrentry_t *
 hsk_addrman_search(const hsk_addrman_t *am) {
-  if (am->size == 0)
-    return NULL;
-
-  int64_t now = hsk_timedata_now(am->td);
+  const hsk_addrtable_t *table = &am->fresh;
 
-  double num = (double)(hsk_random() % (1 << 30));
-  double factor = 1;
+  if (am->tried.count > 0) {
+    if (am->fresh.count == 0 || hsk_random() % 100 < HSK_ADDRMAN_TRIED_BIAS)
+      table = &am->tried;
+  }
 
-  for (;;) {
-    int i = hsk_random() % am->size;
-    hsk_addrentry_t *entry = &am->addrs[i];
+  if (table->used_count == 0)
+    return NULL;
 
-    if (num < factor * hsk_addrentry_chance(entry, now) * (1 << 30))
-      return entry;
+  int32_t b = table->used[hsk_random() % table->used_count];
+  const hsk_addrbucket_t *bucket = &table->buckets[b];
 
-    factor *= 1.2;
-  }
+  assert(bucket->size > 0);
 
-  return NULL;
+  return &am->addrs[bucket->ids[hsk_random() % bucket->size]];
 }
 
 const hsk_addrentry_t *
 hsk_addrman_pick(hsk_addrman_t *am, const hsk_map_t *map) {
   int64_t now = hsk_timedata_now(am->td);
+  double factor = 1;
   int i;
 
-  for (i = 0; i < 100; i++) {
+  for (i = 0; i < 100; i++, factor *= 1.2) {
     const hsk_addrentry_t *entry = hsk_addrman_search(am);
 
     if (!entry)
@@ -423,6 +1055,11 @@ hsk_addrman_pick(hsk_addrman_t *am, const hsk_map_t *map) {
     if (entry->removed)
       continue;
 
+    double num = (double)(hsk_random() % (1 << 30));
+
+    if (num >= factor * hsk_addrentry_chance(entry, now) * (1 << 30))
+      continue;
+
     if (hsk_map_has(map, &entry->addr))
       continue;
 
@@ -466,6 +1103,43 @@ hsk_addrman_pick_addr(
   return true;
 }
 
+const hsk_addrentry_t *
+hsk_addrman_pick_fast(
+  hsk_addrman_t *am,
+  const hsk_map_t *map,
+  uint32_t below
+) {
+  const hsk_addrentry_t *best = NULL;
+  size_t i;
+
+  for (i = 0; i < am->size; i++) {
+    const hsk_addrentry_t *entry = &am->addrs[i];
+
+    if (entry->removed || entry->rtt == 0 || entry->rtt >= below)
+      continue;
+
+    if (best && entry->rtt >= best->rtt)
+      continue;
+
+    // Failed since it was measured.
+    if (entry->attempts > 0)
+      continue;
+
+    if (!(entry->services & 1))
+      continue;
+
+    if (hsk_map_has(map, &entry->addr))
+      continue;
+
+    if (hsk_addrman_is_banned(am, &entry->addr))
+      continue;
+
+    best = entry;
+  }
+
+  return best;
+}
+
 bool
 hsk_addrman_pick_sa(
   hsk_addrman_t *am,
@@ -11,6 +11,45 @@
 #include "timedata.h"
 #include "map.h"
 
+#define HSK_ADDRMAN_MAGIC 0x72646461
+#define HSK_ADDRMAN_VERSION 2
+#define HSK_ADDRMAN_FILE "peers.dat"
+
+// File header: magic, version, network magic,
+// address count and ban count.
+#define HSK_ADDRMAN_HDR_SIZE 20
+
+// Serialized address (type, ip, port, key).
+#define HSK_ADDRMAN_ADDR_SIZE 72
+
+// Address, time, services, attempts, last
+// success, last attempt and handshake time
+// (the last not in version 1 files).
+#define HSK_ADDRMAN_REC_SIZE (HSK_ADDRMAN_ADDR_SIZE + 40)
+#define HSK_ADDRMAN_REC_SIZE_V1 (HSK_ADDRMAN_ADDR_SIZE + 36)
+
+// Address and ban time.
+#define HSK_ADDRMAN_BAN_SIZE (HSK_ADDRMAN_ADDR_SIZE + 8)
+
+// Addresses are spread over buckets by network
+// group, in separate tables for new addresses
+// and ones we have connected to. Candidates are
+// drawn from the tried table this often (in
+// percent) when it is not empty.
+#define HSK_ADDRMAN_BUCKETS 64
+#define HSK_ADDRMAN_TRIED_BIAS 70
+
+// Gossiped addresses seen in the last few
+// minutes are dropped before the tables are
+// looked at (the same ones arrive from every
+// peer). Two bloom filters take turns, the
+// older cleared once the newer has this many
+// addresses or this many seconds behind it.
+#define HSK_ADDRMAN_SEEN_BITS (1 << 15)
+#define HSK_ADDRMAN_SEEN_HASHES 4
+#define HSK_ADDRMAN_SEEN_MAX 2000
+#define HSK_ADDRMAN_SEEN_TIME (10 * 60)
+
 typedef struct hsk_addrentry_s {
   hsk_addr_t addr;
   uint64_t time;
@@ -18,23 +57,63 @@ typedef struct hsk_addrentry_s {
   int32_t attempts;
   int64_t last_success;
   int64_t last_attempt;
+  // Average time (ms) from connecting to a
+  // finished handshake, 0 if never measured.
+  uint32_t rtt;
   int32_t ref_count;
   bool used;
   bool removed;
+  bool tried;
+  int32_t bucket;
+  int32_t slot;
 } hsk_addrentry_t;
 
+typedef struct hsk_addrbucket_s {
+  int32_t *ids;
+  int32_t size;
+  int32_t cap;
+  int32_t pos;
+} hsk_addrbucket_t;
+
+typedef struct hsk_addrtable_s {
+  hsk_addrbucket_t buckets[HSK_ADDRMAN_BUCKETS];
+  int32_t used[HSK_ADDRMAN_BUCKETS];
+  int32_t used_count;
+  int32_t count;
+} hsk_addrtable_t;
+
+typedef struct hsk_addrseen_s {
+  uint8_t bits[2][HSK_ADDRMAN_SEEN_BITS / 8];
+  int cur;
+  int count;
+  int64_t time;
+} hsk_addrseen_t;
+
 typedef struct hsk_banned_t {
   hsk_addr_t addr;
   uint16_t port;
   int64_t time;
 } hsk_banned_t;
 
+HSK_TMAP_INIT(
+  addr_map,
+  const hsk_addr_t *,
+  hsk_addrentry_t *,
+  hsk_addr_hash,
+  hsk_addr_equal
+)
+
 typedef struct hsk_addrman_s {
   hsk_timedata_t *td;
   size_t size;
   hsk_addrentry_t *addrs;
-  hsk_map_t map;
+  hsk_addr_map_t map;
   hsk_map_t banned;
+  hsk_addrtable_t fresh;
+  hsk_addrtable_t tried;
+  hsk_addrseen_t seen;
+  uint32_t key;
+  char path[1024];
 } hsk_addrman_t;
 
 int
@@ -49,6 +128,12 @@ hsk_addrman_alloc(const hsk_timedata_t *td);
 void
 hsk_addrman_free(hsk_addrman_t *am);
 
+int
+hsk_addrman_open(hsk_addrman_t *am, const char *prefix);
+
+int
+hsk_addrman_flush(const hsk_addrman_t *am);
+
 hsk_addrentry_t *
 hsk_addrman_alloc_entry(hsk_addrman_t *am, bool *alloc);
 
@@ -64,6 +149,13 @@ hsk_addrman_add_addr(hsk_addrman_t *am, const hsk_addr_t *addr);
 bool
 hsk_addrman_add_na(hsk_addrman_t *am, const hsk_netaddr_t *na);
 
+size_t
+hsk_addrman_add_nas(
+  hsk_addrman_t *am,
+  const hsk_netaddr_t *nas,
+  size_t count
+);
+
 bool
 hsk_addrman_add_sa(hsk_addrman_t *am, const struct sockaddr *sa);
 
@@ -91,6 +183,9 @@ hsk_addrman_mark_ack(
   uint64_t services
 );
 
+bool
+hsk_addrman_mark_rtt(hsk_addrman_t *am, const hsk_addr_t *addr, uint32_t rtt);
+
 void
 hsk_addrman_clear_banned(hsk_addrman_t *am);
 
@@ -110,6 +205,15 @@ hsk_addrman_pick_addr(
   hsk_addr_t *addr
 );
 
+// The quickest address to handshake with, under
+// `below` ms, whose last connection went well.
+const hsk_addrentry_t *
+hsk_addrman_pick_fast(
+  hsk_addrman_t *am,
+  const hsk_map_t *map,
+  uint32_t below
+);
+
 bool
 hsk_addrman_pick_sa(
   hsk_addrman_t *am,
@@ -0,0 +1,156 @@
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "affinity.h"
+#include "error.h"
+
+/*
+ * Affinity
+ */
+
+void
+hsk_affinity_init(hsk_affinity_t *aff) {
+  assert(aff);
+  aff->count = 0;
+}
+
+static bool
+read_cpu(const char **str, int *cpu) {
+  const char *s = *str;
+  long n = 0;
+
+  if (!isdigit((unsigned char)*s))
+    return false;
+
+  while (isdigit((unsigned char)*s)) {
+    n = n * 10 + (*s - '0');
+
+    if (n >= HSK_AFFINITY_MAX)
+      return false;
+
+    s++;
+  }
+
+  *cpu = (int)n;
+  *str = s;
+
+  return true;
+}
+
+// A list such as `0-7,16-23`: CPUs are handed
+// out in that order. Empty clears it.
+bool
+hsk_affinity_parse(hsk_affinity_t *aff, const char *list) {
+  assert(aff && list);
+
+  hsk_affinity_t out;
+  const char *s = list;
+
+  hsk_affinity_init(&out);
+
+  while (*s) {
+    int lo, hi;
+
+    if (!read_cpu(&s, &lo))
+      return false;
+
+    hi = lo;
+
+    if (*s == '-') {
+      s++;
+
+      if (!read_cpu(&s, &hi) || hi < lo)
+        return false;
+    }
+
+    for (; lo <= hi; lo++) {
+      if (out.count == HSK_AFFINITY_MAX)
+        return false;
+
+      out.cpus[out.count++] = lo;
+    }
+
+    if (*s == ',')
+      s++;
+    else if (*s != '\0')
+      return false;
+  }
+
+  *aff = out;
+
+  return true;
+}
+
+// The CPU for the `index`th thread, wrapping
+// around; -1 if there is no list.
+int
+hsk_affinity_get(const hsk_affinity_t *aff, int index) {
+  if (!aff || aff->count == 0 || index < 0)
+    return -1;
+
+  return aff->cpus[index % aff->count];
+}
+
+// Pins the calling thread.
+int
+hsk_affinity_pin(int cpu) {
+  if (cpu < 0)
+    return HSK_SUCCESS;
+
+#ifdef __linux__
+  cpu_set_t set;
+
+  if (cpu >= CPU_SETSIZE)
+    return HSK_EBADARGS;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    return HSK_EFAILURE;
+
+  return HSK_SUCCESS;
+#else
+  return HSK_EFAILURE;
+#endif
+}
+
+// The one CPU the calling thread is pinned to,
+// or -1.
+int
+hsk_affinity_current(void) {
+#ifdef __linux__
+  cpu_set_t set;
+  int cpu;
+
+  CPU_ZERO(&set);
+
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    return -1;
+
+  if (CPU_COUNT(&set) != 1)
+    return -1;
+
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set))
+      return cpu;
+  }
+#endif
+
+  return -1;
+}
@@ -0,0 +1,42 @@
+#ifndef _HSK_AFFINITY_H
+#define _HSK_AFFINITY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// CPUs to pin threads to, in the order they
+// start (see hsk_affinity_get). A thread pins
+// itself before touching its own buffers, so
+// that (first touch) its pages come from its
+// own NUMA node.
+#define HSK_AFFINITY_MAX 1024
+
+/*
+ * Types
+ */
+
+typedef struct hsk_affinity_s {
+  int cpus[HSK_AFFINITY_MAX];
+  int count;
+} hsk_affinity_t;
+
+/*
+ * Affinity
+ */
+
+void
+hsk_affinity_init(hsk_affinity_t *aff);
+
+bool
+hsk_affinity_parse(hsk_affinity_t *aff, const char *list);
+
+int
+hsk_affinity_get(const hsk_affinity_t *aff, int index);
+
+int
+hsk_affinity_pin(int cpu);
+
+int
+hsk_affinity_current(void);
+#endif
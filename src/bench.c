@@ -0,0 +1,808 @@
+#include "config.h"
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "chain.h"
+#include "constants.h"
+#include "cuckoo.h"
+#include "dns.h"
+#include "error.h"
+#include "fixture.h"
+#include "hash.h"
+#include "header.h"
+#include "mem.h"
+#include "proof.h"
+#include "resource.h"
+#include "timedata.h"
+#include "utils.h"
+
+// Runs a file of raw serialized headers (as
+// read by hnsd --import-headers) through the
+// sync path on one thread, a headers message
+// at a time: decode, proof of work, then the
+// chain. Each stage is timed on its own.
+//
+// With --ops, it times single operations of
+// the hot paths instead, on made-up inputs,
+// and counts what they allocate.
+
+#define HSK_BENCH_BATCH 2000
+
+// How long each operation runs, by default.
+#define HSK_BENCH_OPS_MS 500
+
+// Names in the tree proofs are checked
+// against.
+#define HSK_BENCH_NAMES 10000
+
+// Tries at a cuckoo key with a cycle.
+#define HSK_BENCH_KEYS 2000
+
+extern char *optarg;
+extern int optind;
+
+typedef struct hsk_bench_s {
+  size_t batch;
+  uint64_t limit;
+  bool pow;
+  bool inline_pow;
+  hsk_timedata_t td;
+  hsk_chain_t chain;
+  hsk_header_t *headers;
+  uint64_t count;
+  uint64_t added;
+  uint64_t checked;
+  uint64_t decode_us;
+  uint64_t pow_us;
+  uint64_t add_us;
+} hsk_bench_t;
+
+typedef struct hsk_bench_ops_s {
+  uint64_t ms;
+  hsk_header_t *headers;
+  size_t header_count;
+  size_t header_index;
+  hsk_cuckoo_t cuckoo;
+  bool solved;
+  uint8_t cuckoo_key[32];
+  uint32_t cuckoo_sol[254];
+  hsk_fixture_tree_t tree;
+  uint8_t key[32];
+  uint8_t nx_key[32];
+  hsk_proof_t proof;
+  hsk_proof_t nx_proof;
+  hsk_resource_t *res;
+  hsk_dns_msg_t *msg;
+  uint8_t *wire;
+  size_t wire_len;
+} hsk_bench_ops_t;
+
+typedef bool (*hsk_bench_op_t)(hsk_bench_ops_t *ops);
+
+// Every allocation goes through these (see
+// hsk_mem_set_allocator), so an operation's
+// allocations can be counted.
+static uint64_t hsk_bench_allocs = 0;
+
+static void *
+hsk_bench_malloc(size_t size) {
+  hsk_bench_allocs += 1;
+  return malloc(size);
+}
+
+static void *
+hsk_bench_calloc(size_t count, size_t size) {
+  hsk_bench_allocs += 1;
+  return calloc(count, size);
+}
+
+static void *
+hsk_bench_realloc(void *ptr, size_t size) {
+  hsk_bench_allocs += 1;
+  return realloc(ptr, size);
+}
+
+static const hsk_allocator_t hsk_bench_allocator = {
+  .malloc = hsk_bench_malloc,
+  .calloc = hsk_bench_calloc,
+  .realloc = hsk_bench_realloc,
+  .free = free
+};
+
+// A delegated name: two nameservers (one with
+// glue), a DS and a TXT record.
+static const uint8_t hsk_bench_resource[] = ""
+  "\x00\x00\x38\x00"
+  "\x09\x05\x03" "ns1" "\x07" "example" "\x00"
+  "\x09\x06\x03" "ns2" "\x07" "example" "\x00"
+  "\x0a\x00\x00\x01\x2e\x20\x01"
+  "\x10\x12\x34\x08\x02\x20"
+  "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10"
+  "\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f\x20"
+  "\x0d\x0b" "hello world";
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint8_t *
+read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+
+  if (!file)
+    return NULL;
+
+  uint8_t *data = NULL;
+  long len;
+
+  if (fseek(file, 0, SEEK_END) != 0
+      || (len = ftell(file)) < 0
+      || fseek(file, 0, SEEK_SET) != 0) {
+    goto done;
+  }
+
+  data = hsk_malloc(len > 0 ? (size_t)len : 1);
+
+  if (!data)
+    goto done;
+
+  if (fread(data, 1, (size_t)len, file) != (size_t)len) {
+    hsk_free(data);
+    data = NULL;
+    goto done;
+  }
+
+  *size = (size_t)len;
+
+done:
+  fclose(file);
+  return data;
+}
+
+// One message's worth: returns the number of
+// headers decoded, or -1 on a bad header.
+static int
+hsk_bench_decode(hsk_bench_t *b, uint8_t **data, size_t *data_len) {
+  uint64_t start = now_us();
+  size_t i;
+
+  for (i = 0; i < b->batch && *data_len > 0; i++) {
+    if (b->limit && b->count + i == b->limit)
+      break;
+
+    hsk_header_t *hdr = &b->headers[i];
+
+    hsk_header_init(hdr);
+
+    if (!hsk_header_read(data, data_len, hdr))
+      return -1;
+
+    hsk_header_cache(hdr);
+  }
+
+  b->decode_us += now_us() - start;
+
+  return (int)i;
+}
+
+// As the pool's workers do: headers below the
+// checkpoints are left to the chain.
+static int
+hsk_bench_pow(hsk_bench_t *b, size_t count) {
+  uint64_t start = now_us();
+  hsk_entry_t *prev = hsk_chain_get(&b->chain, b->headers[0].prev_block);
+  int64_t height = prev ? (int64_t)prev->height + 1 : -1;
+  size_t i;
+
+  for (i = 0; i < count; i++, height += height != -1) {
+    if (height != -1 && hsk_chain_below_checkpoint(&b->chain, height))
+      continue;
+
+    int rc = hsk_header_verify_pow(&b->headers[i]);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "header %llu failed verification: %s\n",
+              (unsigned long long)(b->count + i), hsk_strerror(rc));
+      return rc;
+    }
+
+    b->checked += 1;
+  }
+
+  b->pow_us += now_us() - start;
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_bench_add(hsk_bench_t *b, size_t count) {
+  uint64_t start = now_us();
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    const hsk_header_t *hdr = &b->headers[i];
+    int rc;
+
+    if (b->inline_pow)
+      rc = hsk_chain_add(&b->chain, hdr);
+    else
+      rc = hsk_chain_add_verified(&b->chain, hdr, 0);
+
+    if (rc == HSK_EDUPLICATE)
+      continue;
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "header %llu not added: %s\n",
+              (unsigned long long)(b->count + i), hsk_strerror(rc));
+      return rc;
+    }
+
+    b->added += 1;
+  }
+
+  b->add_us += now_us() - start;
+
+  return HSK_SUCCESS;
+}
+
+static void
+print_stage(const char *name, uint64_t us, uint64_t count) {
+  printf("  %-8s %10.3fs %10.2fus/header\n",
+         name,
+         (double)us / 1e6,
+         count ? (double)us / (double)count : 0.0);
+}
+
+static void
+hsk_bench_print(const hsk_bench_t *b, uint64_t us) {
+  struct rusage ru;
+
+  memset(&ru, 0, sizeof(ru));
+  getrusage(RUSAGE_SELF, &ru);
+
+  printf("headers: %llu read, %llu added, %llu proofs checked\n",
+         (unsigned long long)b->count,
+         (unsigned long long)b->added,
+         (unsigned long long)b->checked);
+  printf("total: %.3fs (%.0f headers/sec)\n",
+         (double)us / 1e6,
+         us ? (double)b->count * 1e6 / (double)us : 0.0);
+  print_stage("decode", b->decode_us, b->count);
+  print_stage("pow", b->pow_us, b->checked);
+  print_stage("add", b->add_us, b->count);
+  printf("tip: %lld %s\n",
+         (long long)b->chain.height,
+         hsk_hex_encode32(b->chain.tip->hash));
+  printf("memory: %zu chain bytes, %ld KiB peak rss\n",
+         hsk_mem_get(HSK_MEM_CHAIN), ru.ru_maxrss);
+}
+
+static int
+hsk_bench_run(hsk_bench_t *b, uint8_t *data, size_t data_len) {
+  uint64_t start = now_us();
+
+  while (data_len > 0 && (!b->limit || b->count < b->limit)) {
+    int count = hsk_bench_decode(b, &data, &data_len);
+
+    if (count < 0) {
+      fprintf(stderr, "bad header after %llu\n",
+              (unsigned long long)b->count);
+      return 1;
+    }
+
+    if (b->pow && !b->inline_pow) {
+      if (hsk_bench_pow(b, (size_t)count) != HSK_SUCCESS)
+        return 1;
+    }
+
+    if (hsk_bench_add(b, (size_t)count) != HSK_SUCCESS)
+      return 1;
+
+    b->count += (uint64_t)count;
+  }
+
+  hsk_bench_print(b, now_us() - start);
+
+  return 0;
+}
+
+/*
+ * Operations
+ */
+
+static bool
+hsk_bench_op_pow(hsk_bench_ops_t *ops) {
+  const hsk_header_t *hdr = &ops->headers[ops->header_index++];
+
+  if (ops->header_index == ops->header_count)
+    ops->header_index = 0;
+
+  return hsk_header_verify_pow(hdr) == HSK_SUCCESS;
+}
+
+static bool
+hsk_bench_op_cuckoo(hsk_bench_ops_t *ops) {
+  return hsk_cuckoo_verify(&ops->cuckoo, ops->cuckoo_key,
+                           ops->cuckoo_sol) == HSK_EPOWOK;
+}
+
+static bool
+hsk_bench_op_proof(hsk_bench_ops_t *ops) {
+  bool exists;
+  uint8_t *data;
+  size_t data_len;
+
+  int rc = hsk_proof_verify(ops->tree.root, ops->key, &ops->proof,
+                            &exists, &data, &data_len);
+
+  if (rc != HSK_EPROOFOK || !exists)
+    return false;
+
+  hsk_free(data);
+
+  return true;
+}
+
+static bool
+hsk_bench_op_proof_nx(hsk_bench_ops_t *ops) {
+  bool exists;
+  uint8_t *data;
+  size_t data_len;
+
+  int rc = hsk_proof_verify(ops->tree.root, ops->nx_key, &ops->nx_proof,
+                            &exists, &data, &data_len);
+
+  return rc == HSK_EPROOFOK && !exists;
+}
+
+static bool
+hsk_bench_op_decode(hsk_bench_ops_t *ops) {
+  hsk_dns_msg_t *msg;
+
+  if (!hsk_dns_msg_decode(ops->wire, ops->wire_len, &msg))
+    return false;
+
+  hsk_dns_msg_free(msg);
+
+  return true;
+}
+
+static bool
+hsk_bench_op_encode(hsk_bench_ops_t *ops) {
+  uint8_t *wire;
+  size_t wire_len;
+
+  if (!hsk_dns_msg_encode(ops->msg, &wire, &wire_len))
+    return false;
+
+  hsk_free(wire);
+
+  return true;
+}
+
+static bool
+hsk_bench_op_to_dns(hsk_bench_ops_t *ops) {
+  hsk_dns_msg_t *msg = hsk_resource_to_dns(ops->res, "example.",
+                                           HSK_DNS_A, false);
+
+  if (!msg)
+    return false;
+
+  hsk_dns_msg_free(msg);
+
+  return true;
+}
+
+// Runs the operation in growing batches until
+// the time is up.
+static bool
+hsk_bench_op(hsk_bench_ops_t *ops, const char *name, hsk_bench_op_t op) {
+  uint64_t allocs = hsk_bench_allocs;
+  uint64_t start = now_ns();
+  uint64_t limit = ops->ms * 1000000;
+  uint64_t elapsed = 0;
+  uint64_t count = 0;
+  uint64_t batch = 1;
+
+  while (elapsed < limit) {
+    for (uint64_t i = 0; i < batch; i++) {
+      if (!op(ops)) {
+        fprintf(stderr, "%s failed\n", name);
+        return false;
+      }
+    }
+
+    count += batch;
+
+    if (batch < 65536)
+      batch *= 2;
+
+    elapsed = now_ns() - start;
+  }
+
+  printf("  %-12s %12.1f ns/op %8.2f allocs/op %10llu ops\n",
+         name,
+         (double)elapsed / (double)count,
+         (double)(hsk_bench_allocs - allocs) / (double)count,
+         (unsigned long long)count);
+
+  return true;
+}
+
+// Headers with a valid proof of work: from the
+// file if there is one, or else mined (the
+// graphs of regtest and simnet are small).
+static bool
+hsk_bench_ops_headers(hsk_bench_ops_t *ops, uint8_t *data, size_t data_len) {
+  ops->headers = hsk_malloc(HSK_BENCH_BATCH * sizeof(hsk_header_t));
+
+  if (!ops->headers)
+    return false;
+
+  while (data && data_len > 0 && ops->header_count < HSK_BENCH_BATCH) {
+    hsk_header_t *hdr = &ops->headers[ops->header_count];
+
+    hsk_header_init(hdr);
+
+    if (!hsk_header_read(&data, &data_len, hdr))
+      return false;
+
+    if (hsk_header_verify_pow(hdr) == HSK_SUCCESS)
+      ops->header_count += 1;
+  }
+
+  if (ops->header_count > 0)
+    return true;
+
+  hsk_header_t hdr;
+  uint8_t raw[512];
+  uint8_t *p = &raw[0];
+
+  hsk_header_init(&hdr);
+  hdr.bits = HSK_BITS;
+  hdr.time = 1;
+
+  if (!hsk_fixture_mine(&hdr, 10000))
+    return true;
+
+  int size = hsk_header_write(&hdr, &p);
+
+  // Read back, as a header off the wire is.
+  p = &raw[0];
+  hsk_header_init(&ops->headers[0]);
+
+  if (!hsk_header_decode(p, (size_t)size, &ops->headers[0]))
+    return false;
+
+  ops->header_count = 1;
+
+  return true;
+}
+
+// A cycle in a graph of at most 2^16 nodes:
+// checking one costs the same at any size.
+static void
+hsk_bench_ops_cuckoo(hsk_bench_ops_t *ops) {
+  int bits = HSK_CUCKOO_BITS < 16 ? HSK_CUCKOO_BITS : 16;
+
+  if (hsk_cuckoo_init(&ops->cuckoo, bits, HSK_CUCKOO_SIZE,
+                      HSK_CUCKOO_PERC, HSK_CUCKOO_LEGACY) != HSK_SUCCESS) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < HSK_BENCH_KEYS; i++) {
+    hsk_hash_blake2b((uint8_t *)&i, sizeof(i), ops->cuckoo_key);
+
+    if (hsk_fixture_solve(&ops->cuckoo, ops->cuckoo_key, ops->cuckoo_sol)) {
+      ops->solved = true;
+      break;
+    }
+  }
+}
+
+static bool
+hsk_bench_ops_tree(hsk_bench_ops_t *ops) {
+  const uint8_t *res = (const uint8_t *)hsk_bench_resource;
+  size_t res_len = sizeof(hsk_bench_resource) - 1;
+  char name[64];
+
+  for (int i = 0; i < HSK_BENCH_NAMES; i++) {
+    sprintf(name, "name%d", i);
+
+    if (!hsk_fixture_tree_insert_name(&ops->tree, name, res, res_len))
+      return false;
+  }
+
+  if (!hsk_fixture_tree_commit(&ops->tree))
+    return false;
+
+  hsk_hash_name("name0", ops->key);
+  hsk_hash_name("missing", ops->nx_key);
+
+  return hsk_fixture_tree_prove(&ops->tree, ops->key, &ops->proof)
+      && hsk_fixture_tree_prove(&ops->tree, ops->nx_key, &ops->nx_proof);
+}
+
+static bool
+hsk_bench_ops_dns(hsk_bench_ops_t *ops) {
+  const uint8_t *res = (const uint8_t *)hsk_bench_resource;
+  size_t res_len = sizeof(hsk_bench_resource) - 1;
+
+  if (!hsk_resource_decode(res, res_len, &ops->res))
+    return false;
+
+  ops->msg = hsk_resource_to_dns(ops->res, "example.", HSK_DNS_A, false);
+
+  if (!ops->msg)
+    return false;
+
+  return hsk_dns_msg_encode(ops->msg, &ops->wire, &ops->wire_len);
+}
+
+static int
+hsk_bench_ops(hsk_bench_ops_t *ops, uint8_t *data, size_t data_len) {
+  int rc = 1;
+
+  hsk_fixture_tree_init(&ops->tree);
+  hsk_proof_init(&ops->proof);
+  hsk_proof_init(&ops->nx_proof);
+
+  if (!hsk_bench_ops_headers(ops, data, data_len)) {
+    fprintf(stderr, "bad headers\n");
+    goto done;
+  }
+
+  hsk_bench_ops_cuckoo(ops);
+
+  if (!hsk_bench_ops_tree(ops) || !hsk_bench_ops_dns(ops)) {
+    fprintf(stderr, "ENOMEM\n");
+    goto done;
+  }
+
+  printf("operations (%llums each, %d names in the tree, "
+         "%zu byte reply):\n",
+         (unsigned long long)ops->ms, HSK_BENCH_NAMES, ops->wire_len);
+
+  if (ops->header_count > 0) {
+    if (!hsk_bench_op(ops, "pow", hsk_bench_op_pow))
+      goto done;
+  } else {
+    printf("  %-12s skipped (no headers given)\n", "pow");
+  }
+
+  if (ops->solved) {
+    if (!hsk_bench_op(ops, "cuckoo", hsk_bench_op_cuckoo))
+      goto done;
+  } else {
+    printf("  %-12s skipped (no cycle found)\n", "cuckoo");
+  }
+
+  if (!hsk_bench_op(ops, "proof", hsk_bench_op_proof)
+      || !hsk_bench_op(ops, "proof-nx", hsk_bench_op_proof_nx)
+      || !hsk_bench_op(ops, "dns-decode", hsk_bench_op_decode)
+      || !hsk_bench_op(ops, "dns-encode", hsk_bench_op_encode)
+      || !hsk_bench_op(ops, "to-dns", hsk_bench_op_to_dns)) {
+    goto done;
+  }
+
+  rc = 0;
+
+done:
+  hsk_free(ops->headers);
+  hsk_fixture_tree_uninit(&ops->tree);
+  hsk_proof_uninit(&ops->proof);
+  hsk_proof_uninit(&ops->nx_proof);
+
+  if (ops->res)
+    hsk_resource_free(ops->res);
+
+  if (ops->msg)
+    hsk_dns_msg_free(ops->msg);
+
+  hsk_free(ops->wire);
+
+  return rc;
+}
+
+static void
+help(int r) {
+  fprintf(stderr,
+    "\n"
+    "hnsd-bench 0.0.0\n"
+    "  Copyright (c) 2018, Christopher Jeffrey <chjj@handshake.org>\n"
+    "\n"
+    "Usage: hnsd-bench [options] <headers>\n"
+    "       hnsd-bench --ops [options] [headers]\n"
+    "\n"
+    "  Adds a file of raw serialized headers to an empty chain in memory\n"
+    "  and prints the time spent decoding, checking proofs of work and\n"
+    "  adding to the chain, with the peak memory used.\n"
+    "\n"
+    "  With --ops, times single operations instead (proof of work,\n"
+    "  cuckoo cycles, name proofs, DNS messages and resources) and prints\n"
+    "  ns/op and allocations/op. Proofs of work are checked on the\n"
+    "  headers given, or on a mined one (regtest and simnet).\n"
+    "\n"
+    "  -b, --batch <n>\n"
+    "    Headers per stage pass, like a headers message (default: %d).\n"
+    "\n"
+    "  -c, --count <n>\n"
+    "    Stop after this many headers.\n"
+    "\n"
+    "  -n, --no-pow\n"
+    "    Skip proof of work checks.\n"
+    "\n"
+    "  -i, --inline\n"
+    "    Check proofs of work inside hsk_chain_add, as one stage.\n"
+    "\n"
+    "  -o, --ops\n"
+    "    Time single operations.\n"
+    "\n"
+    "  -t, --time <ms>\n"
+    "    How long to run each operation (default: %d).\n"
+    "\n"
+    "  -h, --help\n"
+    "    This help message.\n"
+    "\n",
+    HSK_BENCH_BATCH,
+    HSK_BENCH_OPS_MS
+  );
+
+  exit(r);
+}
+
+static const struct option longopts[] = {
+  { "batch", required_argument, NULL, 'b' },
+  { "count", required_argument, NULL, 'c' },
+  { "no-pow", no_argument, NULL, 'n' },
+  { "inline", no_argument, NULL, 'i' },
+  { "ops", no_argument, NULL, 'o' },
+  { "time", required_argument, NULL, 't' },
+  { "help", no_argument, NULL, 'h' },
+  { NULL, 0, NULL, 0 }
+};
+
+int
+main(int argc, char **argv) {
+  hsk_bench_t b;
+  hsk_bench_ops_t ops;
+  bool run_ops = false;
+
+  if (!hsk_mem_set_allocator(&hsk_bench_allocator)) {
+    fprintf(stderr, "could not set allocator\n");
+    return 1;
+  }
+
+  memset(&b, 0, sizeof(b));
+  memset(&ops, 0, sizeof(ops));
+
+  b.batch = HSK_BENCH_BATCH;
+  b.pow = true;
+  ops.ms = HSK_BENCH_OPS_MS;
+
+  for (;;) {
+    int o = getopt_long(argc, argv, "b:c:niot:h", longopts, NULL);
+
+    if (o == -1)
+      break;
+
+    switch (o) {
+      case 'b': {
+        long long n = atoll(optarg);
+        if (n < 1 || n > 1000000)
+          help(1);
+        b.batch = (size_t)n;
+        break;
+      }
+
+      case 'c': {
+        long long n = atoll(optarg);
+        if (n < 1)
+          help(1);
+        b.limit = (uint64_t)n;
+        break;
+      }
+
+      case 'n': {
+        b.pow = false;
+        break;
+      }
+
+      case 'i': {
+        b.inline_pow = true;
+        break;
+      }
+
+      case 'o': {
+        run_ops = true;
+        break;
+      }
+
+      case 't': {
+        long long n = atoll(optarg);
+        if (n < 1)
+          help(1);
+        ops.ms = (uint64_t)n;
+        break;
+      }
+
+      case 'h': {
+        help(0);
+        break;
+      }
+
+      default: {
+        help(1);
+        break;
+      }
+    }
+  }
+
+  if (run_ops ? optind < argc - 1 : optind != argc - 1)
+    help(1);
+
+  if (!b.pow && b.inline_pow)
+    help(1);
+
+  size_t data_len = 0;
+  uint8_t *data = NULL;
+
+  if (optind < argc) {
+    data = read_file(argv[optind], &data_len);
+
+    if (!data) {
+      fprintf(stderr, "could not read headers: %s\n", argv[optind]);
+      return 1;
+    }
+  }
+
+  int rc = 1;
+
+  if (run_ops) {
+    rc = hsk_bench_ops(&ops, data, data_len);
+    hsk_free(data);
+    return rc;
+  }
+
+  hsk_timedata_init(&b.td);
+
+  if (hsk_chain_init(&b.chain, &b.td) != HSK_SUCCESS) {
+    fprintf(stderr, "ENOMEM\n");
+    goto done;
+  }
+
+  b.headers = hsk_malloc(b.batch * sizeof(hsk_header_t));
+
+  if (!b.headers) {
+    fprintf(stderr, "ENOMEM\n");
+    goto done;
+  }
+
+  rc = hsk_bench_run(&b, data, data_len);
+
+done:
+  hsk_free(b.headers);
+  hsk_chain_uninit(&b.chain);
+  hsk_timedata_uninit(&b.td);
+  hsk_free(data);
+
+  return rc;
+}
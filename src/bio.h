@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "mem.h"
+
 static inline bool
 read_u8(uint8_t **data, size_t *len, uint8_t *out) {
   if (*len < 1)
@@ -189,13 +191,13 @@ alloc_bytes(uint8_t **data, size_t *len, uint8_t **out, size_t size) {
   if (*len < size)
     return false;
 
-  uint8_t *o = malloc(size);
+  uint8_t *o = hsk_malloc(size);
 
   if (o == NULL)
     return false;
 
   if (!read_bytes(data, len, o, size)) {
-    free(o);
+    hsk_free(o);
     return false;
   }
 
@@ -252,13 +254,13 @@ alloc_ascii(uint8_t **data, size_t *len, char **out, size_t size) {
   if (*len < size)
     return false;
 
-  char *o = malloc(size + 1);
+  char *o = hsk_malloc(size + 1);
 
   if (o == NULL)
     return false;
 
   if (!read_ascii(data, len, o, size)) {
-    free(o);
+    hsk_free(o);
     return false;
   }
 
@@ -491,7 +493,7 @@ read_varsize(uint8_t **data, size_t *data_len, size_t *value) {
   return true;
 }
 
-static inline bool
+static inline size_t
 size_varint(uint64_t value) {
   if (value < 0xfd)
     return 1;
@@ -621,6 +623,14 @@ write_varbytes(uint8_t **data, const uint8_t *bytes, size_t size) {
   return s;
 }
 
+/*
+ * Unchecked reads
+ *
+ * For fixed-size runs of fields: bounds-check
+ * the whole run once with slice_bytes, then
+ * read each field at its known offset.
+ */
+
 static inline uint8_t
 get_u8(const uint8_t *data) {
   return data[0];
@@ -25,6 +25,14 @@
 #include "blake2b.h"
 #include "blake2b-impl.h"
 
+// An AVX2 compression function is built in on
+// x86-64 and picked at run time when the CPU
+// (and OS) support it.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HSK_BLAKE2B_AVX2
+#include <immintrin.h>
+#endif
+
 static const uint64_t hsk_blake2b_IV[8] = {
   0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
   0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
@@ -187,7 +195,7 @@ hsk_blake2b_init_key(
   } while (0)
 
 static void
-hsk_blake2b_compress(
+hsk_blake2b_compress_ref(
   hsk_blake2b_ctx *ctx,
   const uint8_t block[HSK_BLAKE2B_BLOCKBYTES]
 ) {
@@ -230,6 +238,108 @@ hsk_blake2b_compress(
 #undef G
 #undef ROUND
 
+#ifdef HSK_BLAKE2B_AVX2
+
+// One row of the state per register: each G
+// step runs on all four columns (then all four
+// diagonals) at once.
+#define ROTR32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define ROTR24(x) _mm256_shuffle_epi8((x), r24)
+#define ROTR16(x) _mm256_shuffle_epi8((x), r16)
+#define ROTR63(x) \
+  _mm256_or_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define LOAD(s, i, j, k, l) \
+  _mm256_set_epi64x(m[(s)[l]], m[(s)[k]], m[(s)[j]], m[(s)[i]])
+
+#define G(x, y)                                         \
+  do {                                                  \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), (x));  \
+    d = ROTR32(_mm256_xor_si256(d, a));                 \
+    c = _mm256_add_epi64(c, d);                         \
+    b = ROTR24(_mm256_xor_si256(b, c));                 \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), (y));  \
+    d = ROTR16(_mm256_xor_si256(d, a));                 \
+    c = _mm256_add_epi64(c, d);                         \
+    b = ROTR63(_mm256_xor_si256(b, c));                 \
+  } while (0)
+
+__attribute__((target("avx2")))
+static void
+hsk_blake2b_compress_avx2(
+  hsk_blake2b_ctx *ctx,
+  const uint8_t block[HSK_BLAKE2B_BLOCKBYTES]
+) {
+  const __m256i r24 = _mm256_setr_epi8(
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  const __m256i r16 = _mm256_setr_epi8(
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+  uint64_t m[16];
+  size_t i;
+
+  for (i = 0; i < 16; i++)
+    m[i] = load64(block + i * sizeof(m[i]));
+
+  const __m256i h0 = _mm256_loadu_si256((const __m256i *)&ctx->h[0]);
+  const __m256i h1 = _mm256_loadu_si256((const __m256i *)&ctx->h[4]);
+
+  __m256i a = h0;
+  __m256i b = h1;
+  __m256i c = _mm256_loadu_si256((const __m256i *)&hsk_blake2b_IV[0]);
+  __m256i d = _mm256_xor_si256(
+    _mm256_loadu_si256((const __m256i *)&hsk_blake2b_IV[4]),
+    _mm256_set_epi64x(ctx->f[1], ctx->f[0], ctx->t[1], ctx->t[0]));
+
+  for (i = 0; i < 12; i++) {
+    const uint8_t *s = hsk_blake2b_sigma[i];
+
+    G(LOAD(s, 0, 2, 4, 6), LOAD(s, 1, 3, 5, 7));
+
+    // Diagonalize.
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));
+
+    G(LOAD(s, 8, 10, 12, 14), LOAD(s, 9, 11, 13, 15));
+
+    // Undiagonalize.
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));
+  }
+
+  a = _mm256_xor_si256(h0, _mm256_xor_si256(a, c));
+  b = _mm256_xor_si256(h1, _mm256_xor_si256(b, d));
+
+  _mm256_storeu_si256((__m256i *)&ctx->h[0], a);
+  _mm256_storeu_si256((__m256i *)&ctx->h[4], b);
+}
+
+#undef ROTR32
+#undef ROTR24
+#undef ROTR16
+#undef ROTR63
+#undef LOAD
+#undef G
+
+#endif // HSK_BLAKE2B_AVX2
+
+static void
+hsk_blake2b_compress(
+  hsk_blake2b_ctx *ctx,
+  const uint8_t block[HSK_BLAKE2B_BLOCKBYTES]
+) {
+#ifdef HSK_BLAKE2B_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    hsk_blake2b_compress_avx2(ctx, block);
+    return;
+  }
+#endif
+  hsk_blake2b_compress_ref(ctx, block);
+}
+
 int
 hsk_blake2b_update(hsk_blake2b_ctx *ctx, const void *pin, size_t inlen) {
   const unsigned char * in = (const unsigned char *)pin;
@@ -21,6 +21,7 @@
 #include "ec.h"
 #include "error.h"
 #include "hash.h"
+#include "mem.h"
 #include "sha256.h"
 #include "utils.h"
 
@@ -50,6 +51,22 @@ static const char brontide_prologue[] = "hns";
 
 #define BRONTIDE_MAX_MESSAGE (HSK_MAX_MESSAGE + 9)
 
+// Frames are received in place: the socket
+// reads into the buffer behind the bytes
+// already there, and each part is decrypted
+// and handed on where it landed. Buffers
+// grown past the keep size for a large frame
+// shrink back once it is consumed.
+//
+// The room offered a read adapts, between the
+// read size and the keep size: doubled when a
+// read fills at least half of it (the socket
+// had more, as while syncing headers), halved
+// when reads use less than an eighth.
+#define BRONTIDE_READ_SIZE (8 << 10)
+#define BRONTIDE_READ_MIN 1024
+#define BRONTIDE_KEEP_SIZE (64 << 10)
+
 /*
  * Cipher State
  */
@@ -150,6 +167,17 @@ hsk_cs_verify(const hsk_cs_t *cs, const uint8_t *tag) {
   return hsk_aead_verify(cs->tag, tag);
 }
 
+// Moves on as hsk_cs_decrypt would, for a
+// message opened elsewhere.
+static void
+hsk_cs_skip(hsk_cs_t *cs) {
+  cs->nonce += 1;
+  hsk_cs_update(cs);
+
+  if (cs->nonce == BRONTIDE_ROTATION_INTERVAL)
+    hsk_cs_rotate_key(cs);
+}
+
 /*
  * Brontide
  */
@@ -173,6 +201,10 @@ hsk_brontide_init(hsk_brontide_t *b, const hsk_ec_t *ec) {
   memset(b->local_ephemeral, 0, 32);
   memset(b->remote_static, 0, 33);
   memset(b->remote_ephemeral, 0, 33);
+  b->has_ephemeral_pub = false;
+  memset(b->local_ephemeral_pub, 0, 33);
+  b->has_static_pub = false;
+  memset(b->local_static_pub, 0, 33);
 
   // Brontide
   hsk_cs_init(&b->send_cipher);
@@ -185,12 +217,18 @@ hsk_brontide_init(hsk_brontide_t *b, const hsk_ec_t *ec) {
   b->write_arg = NULL;
   b->read_cb = NULL;
   b->read_arg = NULL;
+  b->offload_cb = NULL;
+  b->offload_arg = NULL;
+  b->offload_size = 0;
 
   b->state = BRONTIDE_ACT_NONE;
   b->has_size = false;
   b->msg = NULL;
+  b->msg_start = 0;
   b->msg_pos = 0;
   b->msg_len = 0;
+  b->msg_size = 0;
+  b->read_size = BRONTIDE_READ_SIZE;
 }
 
 void
@@ -200,9 +238,11 @@ hsk_brontide_uninit(hsk_brontide_t *b) {
   hsk_brontide_destroy(b);
 
   if (b->msg) {
-    free(b->msg);
+    hsk_free(b->msg);
     b->msg = NULL;
   }
+
+  b->msg_size = 0;
 }
 
 /*
@@ -337,13 +377,25 @@ hsk_brontide_destroy(hsk_brontide_t *b) {
   b->state = BRONTIDE_ACT_NONE;
 }
 
+// Our ephemeral key, made now unless one was
+// set. Either way it is used once.
+static void
+hsk_brontide_gen_ephemeral(hsk_brontide_t *b, uint8_t *pub) {
+  if (b->has_ephemeral_pub) {
+    memcpy(pub, b->local_ephemeral_pub, 33);
+    b->has_ephemeral_pub = false;
+    return;
+  }
+
+  assert(hsk_ec_create_privkey(b->ec, b->local_ephemeral));
+  assert(hsk_ec_create_pubkey(b->ec, b->local_ephemeral, pub));
+}
+
 void
 hsk_brontide_gen_act_one(hsk_brontide_t *b, uint8_t *act1) {
   // e
-  assert(hsk_ec_create_privkey(b->ec, b->local_ephemeral));
-
   uint8_t ephemeral[33];
-  assert(hsk_ec_create_pubkey(b->ec, b->local_ephemeral, ephemeral));
+  hsk_brontide_gen_ephemeral(b, ephemeral);
   hsk_brontide_mix_hash(b, ephemeral, 33);
 
   // ec
@@ -388,10 +440,8 @@ hsk_brontide_recv_act_one(hsk_brontide_t *b, const uint8_t *act1) {
 void
 hsk_brontide_gen_act_two(hsk_brontide_t *b, uint8_t *act2) {
   // e
-  assert(hsk_ec_create_privkey(b->ec, b->local_ephemeral));
-
   uint8_t ephemeral[33];
-  assert(hsk_ec_create_pubkey(b->ec, b->local_ephemeral, ephemeral));
+  hsk_brontide_gen_ephemeral(b, ephemeral);
   hsk_brontide_mix_hash(b, ephemeral, 33);
 
   // ee
@@ -436,7 +486,10 @@ hsk_brontide_recv_act_two(hsk_brontide_t *b, const uint8_t *act2) {
 void
 hsk_brontide_gen_act_three(hsk_brontide_t *b, uint8_t *act3) {
   uint8_t our_pubkey[33];
-  assert(hsk_ec_create_pubkey(b->ec, b->local_static, our_pubkey));
+  if (b->has_static_pub)
+    memcpy(our_pubkey, b->local_static_pub, 33);
+  else
+    assert(hsk_ec_create_pubkey(b->ec, b->local_static, our_pubkey));
   hsk_brontide_encrypt(b, our_pubkey, our_pubkey, 33);
   uint8_t tag1[16];
   memcpy(tag1, b->cs.tag, 16);
@@ -529,6 +582,74 @@ hsk_brontide_connect(
   return HSK_SUCCESS;
 }
 
+// Keys worked out before the handshake: the
+// public half of our static key, and a fresh
+// ephemeral key pair. Either may be NULL.
+void
+hsk_brontide_set_keys(
+  hsk_brontide_t *b,
+  const uint8_t *static_pub,
+  const uint8_t *ephemeral,
+  const uint8_t *ephemeral_pub
+) {
+  assert(b);
+
+  b->has_static_pub = static_pub != NULL;
+
+  if (static_pub)
+    memcpy(b->local_static_pub, static_pub, 33);
+
+  b->has_ephemeral_pub = ephemeral != NULL;
+
+  if (ephemeral) {
+    assert(ephemeral_pub);
+    memcpy(b->local_ephemeral, ephemeral, 32);
+    memcpy(b->local_ephemeral_pub, ephemeral_pub, 33);
+  }
+}
+
+// Keep the part being received contiguous, with
+// room behind it for the next read. The bytes
+// held are always less than one part, so any
+// move here is of a partial frame.
+static bool
+hsk_brontide_make_room(hsk_brontide_t *b) {
+  size_t pending = b->msg_pos - b->msg_start;
+  size_t size = b->msg_len;
+
+  assert(pending < b->msg_len);
+
+  if (size < b->read_size)
+    size = b->read_size;
+
+  bool grow = size > b->msg_size;
+  bool shrink = b->msg_size > BRONTIDE_KEEP_SIZE && size <= BRONTIDE_KEEP_SIZE;
+
+  if (pending == 0
+      || grow
+      || shrink
+      || b->msg_start + b->msg_len > b->msg_size
+      || b->msg_size - b->msg_pos < BRONTIDE_READ_MIN) {
+    if (pending > 0)
+      memmove(b->msg, &b->msg[b->msg_start], pending);
+
+    b->msg_start = 0;
+    b->msg_pos = pending;
+  }
+
+  if (grow || shrink) {
+    uint8_t *msg = hsk_realloc(b->msg, size);
+
+    if (!msg)
+      return false;
+
+    b->msg = msg;
+    b->msg_size = size;
+  }
+
+  return true;
+}
+
 int
 hsk_brontide_on_connect(hsk_brontide_t *b) {
   size_t size;
@@ -557,20 +678,26 @@ hsk_brontide_on_connect(hsk_brontide_t *b) {
 
   assert(size != 0);
 
-  uint8_t *msg = realloc(b->msg, size);
-
-  if (!msg)
-    return HSK_ENOMEM;
-
-  b->msg = msg;
+  b->msg_start = 0;
   b->msg_pos = 0;
   b->msg_len = size;
 
+  if (!hsk_brontide_make_room(b))
+    return HSK_ENOMEM;
+
   return HSK_SUCCESS;
 }
 
 int
 hsk_brontide_write(hsk_brontide_t *b, uint8_t *data, size_t data_len) {
+  // Note: takes ownership of `data`.
+  int r = hsk_brontide_send(b, data, data_len);
+  hsk_free(data);
+  return r;
+}
+
+int
+hsk_brontide_send(hsk_brontide_t *b, const uint8_t *data, size_t data_len) {
   assert(b->write_cb);
 
   int r = HSK_SUCCESS;
@@ -578,30 +705,31 @@ hsk_brontide_write(hsk_brontide_t *b, uint8_t *data, size_t data_len) {
   if (b->state != BRONTIDE_ACT_DONE)
     goto done;
 
-  uint8_t len[4];
-
-  set_u32(&len[0], (uint32_t)data_len);
-
-  hsk_cs_encrypt(&b->send_cipher, NULL, len, len, 4);
-
-  r = b->write_cb(b->write_arg, len, 4, false);
+  // Encrypt the whole frame (length, tag, body,
+  // tag) into one buffer so it goes out in a
+  // single write.
+  size_t size = BRONTIDE_HEADER_SIZE + data_len + BRONTIDE_MAC_SIZE;
+  uint8_t *frame = hsk_malloc(size);
 
-  if (r != 0)
+  if (!frame) {
+    r = HSK_ENOMEM;
     goto done;
+  }
 
-  r = b->write_cb(b->write_arg, b->send_cipher.tag, 16, false);
+  uint8_t *len = &frame[0];
+  uint8_t *body = &frame[BRONTIDE_HEADER_SIZE];
 
-  if (r != 0)
-    goto done;
+  set_u32(len, (uint32_t)data_len);
 
-  hsk_cs_encrypt(&b->send_cipher, NULL, data, data, data_len);
+  hsk_cs_encrypt(&b->send_cipher, NULL, len, len, BRONTIDE_LENGTH_SIZE);
 
-  r = b->write_cb(b->write_arg, data, data_len, true);
+  memcpy(&frame[BRONTIDE_LENGTH_SIZE], b->send_cipher.tag, BRONTIDE_MAC_SIZE);
 
-  if (r != 0)
-    goto done;
+  hsk_cs_encrypt(&b->send_cipher, NULL, data, body, data_len);
+
+  memcpy(&body[data_len], b->send_cipher.tag, BRONTIDE_MAC_SIZE);
 
-  r = b->write_cb(b->write_arg, b->send_cipher.tag, 16, false);
+  r = b->write_cb(b->write_arg, frame, size, true);
 
 done:
   if (r != HSK_SUCCESS)
@@ -610,25 +738,43 @@ done:
   return r;
 }
 
+void
+hsk_brontide_read_buf(hsk_brontide_t *b, uint8_t **data, size_t *data_len) {
+  if (!b->msg) {
+    *data = NULL;
+    *data_len = 0;
+    return;
+  }
+
+  *data = &b->msg[b->msg_pos];
+  *data_len = b->msg_size - b->msg_pos;
+}
+
 int
-hsk_brontide_on_read(hsk_brontide_t *b, const uint8_t *data, size_t data_len) {
+hsk_brontide_on_recv(hsk_brontide_t *b, size_t data_len) {
   if (b->state == BRONTIDE_ACT_NONE)
     return HSK_SUCCESS;
 
   assert(b->msg);
+  assert(data_len <= b->msg_size - b->msg_pos);
 
-  while (b->msg_pos + data_len >= b->msg_len) {
-    assert(b->msg_pos < b->msg_len);
+  size_t room = b->msg_size - b->msg_pos;
 
-    size_t need = b->msg_len - b->msg_pos;
-
-    memcpy(&b->msg[b->msg_pos], data, need);
+  if (data_len == room && room >= b->read_size / 2) {
+    if (b->read_size < BRONTIDE_KEEP_SIZE)
+      b->read_size *= 2;
+  } else if (data_len < b->read_size / 8) {
+    if (b->read_size > BRONTIDE_READ_SIZE)
+      b->read_size /= 2;
+  }
 
-    data += need;
-    data_len -= need;
+  b->msg_pos += data_len;
 
+  while (b->msg_pos - b->msg_start >= b->msg_len) {
+    uint8_t *part = &b->msg[b->msg_start];
     size_t msg_len;
-    int r = hsk_brontide_parse(b, b->msg, b->msg_len, &msg_len);
+
+    int r = hsk_brontide_parse(b, part, b->msg_len, &msg_len);
 
     if (r != HSK_SUCCESS) {
       hsk_brontide_destroy(b);
@@ -640,20 +786,44 @@ hsk_brontide_on_read(hsk_brontide_t *b, const uint8_t *data, size_t data_len) {
 
     assert(msg_len != 0);
 
-    uint8_t *msg = realloc(b->msg, msg_len);
-
-    if (!msg) {
-      hsk_brontide_destroy(b);
-      return HSK_ENOMEM;
-    }
-
-    b->msg = msg;
-    b->msg_pos = 0;
+    b->msg_start += b->msg_len;
     b->msg_len = msg_len;
   }
 
-  memcpy(&b->msg[b->msg_pos], data, data_len);
-  b->msg_pos += data_len;
+  if (!hsk_brontide_make_room(b)) {
+    hsk_brontide_destroy(b);
+    return HSK_ENOMEM;
+  }
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_brontide_on_read(hsk_brontide_t *b, const uint8_t *data, size_t data_len) {
+  while (data_len > 0) {
+    if (b->state == BRONTIDE_ACT_NONE)
+      return HSK_SUCCESS;
+
+    uint8_t *buf;
+    size_t buf_len;
+
+    hsk_brontide_read_buf(b, &buf, &buf_len);
+
+    assert(buf_len > 0);
+
+    if (buf_len > data_len)
+      buf_len = data_len;
+
+    memcpy(buf, data, buf_len);
+
+    int r = hsk_brontide_on_recv(b, buf_len);
+
+    if (r != HSK_SUCCESS)
+      return r;
+
+    data += buf_len;
+    data_len -= buf_len;
+  }
 
   return HSK_SUCCESS;
 }
@@ -765,6 +935,23 @@ hsk_brontide_parse(
     return HSK_SUCCESS;
   }
 
+  if (b->offload_cb && data_len >= b->offload_size) {
+    hsk_cs_t cs;
+
+    memcpy(&cs, &b->recv_cipher, sizeof(hsk_cs_t));
+    hsk_cs_skip(&b->recv_cipher);
+
+    b->has_size = false;
+
+    r = b->offload_cb(b->offload_arg, &cs, data, data_len);
+
+    if (r != HSK_SUCCESS)
+      return r;
+
+    *msg_len = BRONTIDE_HEADER_SIZE;
+    return HSK_SUCCESS;
+  }
+
   uint8_t *payload = &data[0];
   size_t payload_len = data_len - 16;
   uint8_t *tag = &data[payload_len];
@@ -780,3 +967,17 @@ hsk_brontide_parse(
   *msg_len = BRONTIDE_HEADER_SIZE;
   return HSK_SUCCESS;
 }
+
+bool
+hsk_brontide_open(hsk_cs_t *cs, uint8_t *data, size_t data_len) {
+  assert(cs && data);
+
+  if (data_len < 16)
+    return false;
+
+  size_t payload_len = data_len - 16;
+
+  hsk_cs_decrypt(cs, NULL, data, data, payload_len);
+
+  return hsk_cs_verify(cs, &data[payload_len]);
+}
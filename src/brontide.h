@@ -37,6 +37,17 @@ typedef void (*hsk_brontide_read_cb)(
   size_t data_len
 );
 
+// Given a frame still sealed (payload and tag,
+// only good until the call returns) and the
+// cipher state to open it with (see
+// hsk_brontide_open).
+typedef int (*hsk_brontide_offload_cb)(
+  const void *arg,
+  const hsk_cs_t *cs,
+  const uint8_t *data,
+  size_t data_len
+);
+
 typedef struct hsk_brontide_s {
   // Cipher state
   hsk_cs_t cs;
@@ -53,6 +64,12 @@ typedef struct hsk_brontide_s {
   uint8_t local_ephemeral[32];
   uint8_t remote_static[33];
   uint8_t remote_ephemeral[33];
+  // Given ahead of time (hsk_brontide_set_keys),
+  // leaving only the ECDHs to the handshake.
+  bool has_ephemeral_pub;
+  uint8_t local_ephemeral_pub[33];
+  bool has_static_pub;
+  uint8_t local_static_pub[33];
 
   // Brontide
   hsk_cs_t send_cipher;
@@ -65,12 +82,20 @@ typedef struct hsk_brontide_s {
   void *write_arg;
   hsk_brontide_read_cb read_cb;
   void *read_arg;
+  // Frames this big or bigger are handed to
+  // offload_cb rather than opened here.
+  hsk_brontide_offload_cb offload_cb;
+  void *offload_arg;
+  size_t offload_size;
 
   int state;
   bool has_size;
   uint8_t *msg;
+  size_t msg_start;
   size_t msg_pos;
   size_t msg_len;
+  size_t msg_size;
+  size_t read_size;
 } hsk_brontide_t;
 
 void
@@ -196,12 +221,29 @@ hsk_brontide_connect(
   const uint8_t *their_key
 );
 
+void
+hsk_brontide_set_keys(
+  hsk_brontide_t *b,
+  const uint8_t *static_pub,
+  const uint8_t *ephemeral,
+  const uint8_t *ephemeral_pub
+);
+
 int
 hsk_brontide_on_connect(hsk_brontide_t *b);
 
 int
 hsk_brontide_write(hsk_brontide_t *b, uint8_t *data, size_t data_len);
 
+int
+hsk_brontide_send(hsk_brontide_t *b, const uint8_t *data, size_t data_len);
+
+void
+hsk_brontide_read_buf(hsk_brontide_t *b, uint8_t **data, size_t *data_len);
+
+int
+hsk_brontide_on_recv(hsk_brontide_t *b, size_t data_len);
+
 int
 hsk_brontide_on_read(hsk_brontide_t *b, const uint8_t *data, size_t data_len);
 
@@ -212,4 +254,10 @@ hsk_brontide_parse(
   size_t data_len,
   size_t *msg_len
 );
+
+// Opens an offloaded frame in place, on any
+// thread. The payload is the first
+// data_len - 16 bytes.
+bool
+hsk_brontide_open(hsk_cs_t *cs, uint8_t *data, size_t data_len);
 #endif
@@ -1,199 +1,2140 @@
 #include "config.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "bio.h"
 #include "cache.h"
 #include "dns.h"
 #include "error.h"
+#include "log.h"
 #include "map.h"
+#include "mem.h"
 #include "req.h"
 #include "resource.h"
+#include "sig0.h"
 #include "utils.h"
 
+static uint32_t
+hsk_cache_wire_key_hash(const void *key);
+
+static bool
+hsk_cache_wire_key_equal(const void *a, const void *b);
+
+static void
+hsk_cache_wire_free(hsk_cache_wire_t *cw);
+
+static void
+hsk_cache_evict(hsk_cache_t *c);
+
+static void
+hsk_cache_evict_wires(hsk_cache_t *c);
+
+static void
+hsk_cache_nx_remove(hsk_cache_t *c, hsk_cache_nx_t *nx);
+
+static void
+hsk_cache_ref_free(hsk_cache_ref_t *ref);
+
+static void
+hsk_cache_key_rehash(hsk_cache_key_t *ck);
+
+static bool
+hsk_cache_wire_insert(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  uint8_t *data,
+  size_t data_len
+);
+
+/*
+ * Shared Data
+ */
+
+// Encoded messages and replies are counted, so
+// that a message cached from its reply and the
+// reply itself hold the same bytes.
+typedef struct hsk_cache_data_s {
+  size_t refs;
+  uint8_t bytes[];
+} hsk_cache_data_t;
+
+static uint8_t *
+hsk_cache_data_alloc(size_t len) {
+  hsk_cache_data_t *cd = hsk_malloc(sizeof(hsk_cache_data_t) + len);
+
+  if (!cd)
+    return NULL;
+
+  cd->refs = 1;
+
+  return cd->bytes;
+}
+
+static uint8_t *
+hsk_cache_data_copy(const uint8_t *data, size_t len) {
+  uint8_t *bytes = hsk_cache_data_alloc(len);
+
+  if (bytes)
+    memcpy(bytes, data, len);
+
+  return bytes;
+}
+
+static hsk_cache_data_t *
+hsk_cache_data(uint8_t *bytes) {
+  return (hsk_cache_data_t *)(bytes - offsetof(hsk_cache_data_t, bytes));
+}
+
+static uint8_t *
+hsk_cache_data_ref(uint8_t *bytes) {
+  hsk_cache_data(bytes)->refs += 1;
+  return bytes;
+}
+
+static void
+hsk_cache_data_unref(uint8_t *bytes) {
+  if (!bytes)
+    return;
+
+  hsk_cache_data_t *cd = hsk_cache_data(bytes);
+
+  if (--cd->refs == 0)
+    hsk_free(cd);
+}
+
+/*
+ * Cache
+ */
+
 void
 hsk_cache_init(hsk_cache_t *c) {
   assert(c);
-  hsk_map_init_map(&c->map,
-    hsk_cache_key_hash,
-    hsk_cache_key_equal,
-    (hsk_map_free_func)hsk_cache_item_free);
+  hsk_cache_map_init(&c->map);
+  c->head = NULL;
+  c->tail = NULL;
+  c->size = 0;
+  hsk_map_init_map(&c->wires,
+    hsk_cache_wire_key_hash,
+    hsk_cache_wire_key_equal,
+    (hsk_map_free_func)hsk_cache_wire_free);
+  c->wire_head = NULL;
+  c->wire_tail = NULL;
+  c->wire_size = 0;
+  hsk_map_init_str_map(&c->nxs, hsk_free);
+  c->nx_head = NULL;
+  c->nx_tail = NULL;
+  c->nx_count = 0;
+  hsk_map_init_str_map(&c->refs, (hsk_map_free_func)hsk_cache_ref_free);
+  c->ref_head = NULL;
+  c->ref_tail = NULL;
+  c->ref_count = 0;
+  c->max_size = HSK_CACHE_SIZE;
+  c->min_ttl = HSK_CACHE_MIN_TTL;
+  c->max_ttl = HSK_CACHE_MAX_TTL;
+  c->neg_ttl = HSK_CACHE_NEG_TTL;
+  c->stale = HSK_CACHE_STALE;
+  memset(&c->sketch, 0, sizeof(hsk_cache_sketch_t));
+  c->rejected = 0;
+  memset(c->root, 0, 32);
+  c->epoch = 0;
 }
 
 void
 hsk_cache_uninit(hsk_cache_t *c) {
   assert(c);
-  hsk_map_uninit(&c->map);
+
+  hsk_cache_item_t *ci, *next;
+
+  for (ci = c->head; ci; ci = next) {
+    next = ci->next;
+    hsk_cache_item_free(ci);
+  }
+
+  hsk_mem_sub(HSK_MEM_CACHE, c->size + c->wire_size);
+
+  hsk_cache_map_uninit(&c->map);
+  c->head = NULL;
+  c->tail = NULL;
+  c->size = 0;
+  hsk_map_uninit(&c->wires);
+  c->wire_head = NULL;
+  c->wire_tail = NULL;
+  c->wire_size = 0;
+  hsk_map_uninit(&c->nxs);
+  c->nx_head = NULL;
+  c->nx_tail = NULL;
+  c->nx_count = 0;
+  hsk_map_uninit(&c->refs);
+  c->ref_head = NULL;
+  c->ref_tail = NULL;
+  c->ref_count = 0;
 }
 
 hsk_cache_t *
 hsk_cache_alloc(void) {
-  hsk_cache_t *c = malloc(sizeof(hsk_cache_t));
+  hsk_cache_t *c = hsk_malloc(sizeof(hsk_cache_t));
   if (c)
     hsk_cache_init(c);
   return c;
 }
 
-void
-hsk_cache_free(hsk_cache_t *c) {
-  assert(c);
-  hsk_cache_uninit(c);
-  free(c);
+void
+hsk_cache_free(hsk_cache_t *c) {
+  assert(c);
+  hsk_cache_uninit(c);
+  hsk_free(c);
+}
+
+bool
+hsk_cache_set_size(hsk_cache_t *c, size_t max_size) {
+  assert(c);
+
+  if (max_size == 0)
+    return false;
+
+  c->max_size = max_size;
+
+  hsk_cache_evict(c);
+  hsk_cache_evict_wires(c);
+
+  return true;
+}
+
+// Called with the current tree root before each
+// use. A new root starts a new epoch; caches
+// never told one stay in the first.
+void
+hsk_cache_set_root(hsk_cache_t *c, const uint8_t *root) {
+  assert(c && root);
+
+  if (memcmp(c->root, root, 32) == 0)
+    return;
+
+  memcpy(c->root, root, 32);
+  c->epoch += 1;
+}
+
+// Applies to entries inserted from now on.
+bool
+hsk_cache_set_ttl(
+  hsk_cache_t *c,
+  uint32_t min_ttl,
+  uint32_t max_ttl,
+  uint32_t neg_ttl
+) {
+  assert(c);
+
+  if (min_ttl > max_ttl)
+    return false;
+
+  c->min_ttl = min_ttl;
+  c->max_ttl = max_ttl;
+  c->neg_ttl = neg_ttl;
+
+  return true;
+}
+
+static void
+hsk_cache_log(const hsk_cache_t *c, const char *fmt, ...) {
+  assert(c);
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("cache: ", fmt, args);
+  va_end(args);
+}
+
+/*
+ * LRU
+ */
+
+static size_t
+hsk_cache_item_size(const hsk_cache_item_t *ci) {
+  return sizeof(hsk_cache_item_t) + ci->key.name_len + 1 + ci->msg_len;
+}
+
+// An item with a copy of the key, its name
+// stored right after the item.
+static hsk_cache_item_t *
+hsk_cache_item_create(const hsk_cache_key_t *ck) {
+  size_t size = sizeof(hsk_cache_item_t) + ck->name_len + 1;
+  hsk_cache_item_t *ci = hsk_malloc(size);
+
+  if (!ci)
+    return NULL;
+
+  hsk_cache_item_init(ci);
+
+  ci->key = *ck;
+  ci->key.name = (uint8_t *)&ci[1];
+
+  memcpy(ci->key.name, ck->name, ck->name_len);
+  ci->key.name[ck->name_len] = '\0';
+
+  return ci;
+}
+
+static void
+hsk_cache_unlink(hsk_cache_t *c, hsk_cache_item_t *ci) {
+  if (ci->prev)
+    ci->prev->next = ci->next;
+  else
+    c->head = ci->next;
+
+  if (ci->next)
+    ci->next->prev = ci->prev;
+  else
+    c->tail = ci->prev;
+
+  ci->prev = NULL;
+  ci->next = NULL;
+}
+
+static void
+hsk_cache_push(hsk_cache_t *c, hsk_cache_item_t *ci) {
+  ci->prev = NULL;
+  ci->next = c->head;
+
+  if (c->head)
+    c->head->prev = ci;
+  else
+    c->tail = ci;
+
+  c->head = ci;
+}
+
+static void
+hsk_cache_remove(hsk_cache_t *c, hsk_cache_item_t *ci) {
+  hsk_cache_unlink(c, ci);
+  c->size -= hsk_cache_item_size(ci);
+  hsk_mem_sub(HSK_MEM_CACHE, hsk_cache_item_size(ci));
+  hsk_cache_map_del(&c->map, &ci->key);
+  hsk_cache_item_free(ci);
+}
+
+// Over the memory budget, the cache is the
+// first to give way.
+static void
+hsk_cache_evict(hsk_cache_t *c) {
+  while ((c->size > c->max_size || hsk_mem_over() > 0) && c->tail)
+    hsk_cache_remove(c, c->tail);
+}
+
+/*
+ * Admission
+ */
+
+// Row i uses h1 + i * h2 (double hashing), h2
+// being a remix of the key hash.
+static uint32_t
+hsk_cache_sketch_index(uint32_t hash, int row) {
+  uint32_t h2 = (hash >> 16 | hash << 16) * 0x9e3779b1;
+  return (hash + (uint32_t)row * (h2 | 1)) & (HSK_CACHE_SKETCH_WIDTH - 1);
+}
+
+static void
+hsk_cache_sketch_age(hsk_cache_sketch_t *sk) {
+  int i, j;
+
+  for (i = 0; i < HSK_CACHE_SKETCH_ROWS; i++) {
+    for (j = 0; j < HSK_CACHE_SKETCH_WIDTH; j++)
+      sk->rows[i][j] >>= 1;
+  }
+
+  sk->samples /= 2;
+}
+
+static void
+hsk_cache_sketch_add(hsk_cache_sketch_t *sk, uint32_t hash) {
+  bool added = false;
+  int i;
+
+  for (i = 0; i < HSK_CACHE_SKETCH_ROWS; i++) {
+    uint8_t *ctr = &sk->rows[i][hsk_cache_sketch_index(hash, i)];
+
+    if (*ctr < 15) {
+      *ctr += 1;
+      added = true;
+    }
+  }
+
+  if (added && ++sk->samples >= HSK_CACHE_SKETCH_WIDTH * 10)
+    hsk_cache_sketch_age(sk);
+}
+
+static uint8_t
+hsk_cache_sketch_get(const hsk_cache_sketch_t *sk, uint32_t hash) {
+  uint8_t min = 15;
+  int i;
+
+  for (i = 0; i < HSK_CACHE_SKETCH_ROWS; i++) {
+    uint8_t ctr = sk->rows[i][hsk_cache_sketch_index(hash, i)];
+
+    if (ctr < min)
+      min = ctr;
+  }
+
+  return min;
+}
+
+// Room is made by evicting from the tail, so
+// that is who the newcomer competes with.
+static bool
+hsk_cache_admit(hsk_cache_t *c, const hsk_cache_key_t *ck, size_t size) {
+  if (c->size + size <= c->max_size || !c->tail)
+    return true;
+
+  uint8_t freq = hsk_cache_sketch_get(&c->sketch, ck->hash);
+  uint8_t victim = hsk_cache_sketch_get(&c->sketch, c->tail->key.hash);
+
+  return freq > victim;
+}
+
+/*
+ * Root Epochs
+ */
+
+// An entry from an older epoch is carried into
+// this one if its TLD's resource, proven under
+// the current root, has not changed since.
+static bool
+hsk_cache_current(hsk_cache_t *c, const char *name, uint32_t *epoch) {
+  if (*epoch == c->epoch)
+    return true;
+
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  hsk_dns_label_get(name, -1, tld);
+  hsk_to_lower(tld);
+
+  const hsk_cache_ref_t *ref = hsk_map_get(&c->refs, tld);
+
+  if (!ref || memcmp(ref->root, c->root, 32) != 0)
+    return false;
+
+  if (ref->since > *epoch)
+    return false;
+
+  *epoch = c->epoch;
+
+  return true;
+}
+
+static size_t
+hsk_cache_wire_size(const hsk_cache_wire_t *cw) {
+  return sizeof(hsk_cache_wire_t)
+       + cw->wire_len
+       + cw->ttls_len * sizeof(uint16_t);
+}
+
+static void
+hsk_cache_wire_unlink(hsk_cache_t *c, hsk_cache_wire_t *cw) {
+  if (cw->prev)
+    cw->prev->next = cw->next;
+  else
+    c->wire_head = cw->next;
+
+  if (cw->next)
+    cw->next->prev = cw->prev;
+  else
+    c->wire_tail = cw->prev;
+
+  cw->prev = NULL;
+  cw->next = NULL;
+}
+
+static void
+hsk_cache_wire_push(hsk_cache_t *c, hsk_cache_wire_t *cw) {
+  cw->prev = NULL;
+  cw->next = c->wire_head;
+
+  if (c->wire_head)
+    c->wire_head->prev = cw;
+  else
+    c->wire_tail = cw;
+
+  c->wire_head = cw;
+}
+
+static void
+hsk_cache_wire_remove(hsk_cache_t *c, hsk_cache_wire_t *cw) {
+  hsk_cache_wire_unlink(c, cw);
+  c->wire_size -= hsk_cache_wire_size(cw);
+  hsk_mem_sub(HSK_MEM_CACHE, hsk_cache_wire_size(cw));
+  hsk_map_del(&c->wires, &cw->key);
+  hsk_cache_wire_free(cw);
+}
+
+static void
+hsk_cache_evict_wires(hsk_cache_t *c) {
+  while ((c->wire_size > c->max_size || hsk_mem_over() > 0) && c->wire_tail)
+    hsk_cache_wire_remove(c, c->wire_tail);
+}
+
+/*
+ * TTL
+ */
+
+static uint32_t
+hsk_cache_rrs_ttl(const hsk_dns_rrs_t *rrs, uint32_t ttl) {
+  for (size_t i = 0; i < rrs->size; i++) {
+    const hsk_dns_rr_t *rr = rrs->items[i];
+
+    if (rr->ttl < ttl)
+      ttl = rr->ttl;
+
+    // RFC 2308: negative answers live for the
+    // lesser of the SOA TTL and its minimum.
+    if (rr->type == HSK_DNS_SOA) {
+      const hsk_dns_soa_rd_t *rd = rr->rd;
+      if (rd->minttl < ttl)
+        ttl = rd->minttl;
+    }
+  }
+
+  return ttl;
+}
+
+static bool
+hsk_cache_is_negative(const hsk_dns_msg_t *msg) {
+  if (msg->code == HSK_DNS_NXDOMAIN)
+    return true;
+
+  if (msg->an.size > 0)
+    return false;
+
+  for (size_t i = 0; i < msg->ns.size; i++) {
+    if (msg->ns.items[i]->type == HSK_DNS_SOA)
+      return true;
+  }
+
+  return false;
+}
+
+static uint32_t
+hsk_cache_msg_ttl(const hsk_cache_t *c, const hsk_dns_msg_t *msg) {
+  uint32_t ttl = c->max_ttl;
+
+  ttl = hsk_cache_rrs_ttl(&msg->an, ttl);
+  ttl = hsk_cache_rrs_ttl(&msg->ns, ttl);
+  ttl = hsk_cache_rrs_ttl(&msg->ar, ttl);
+
+  if (hsk_cache_is_negative(msg) && ttl < c->neg_ttl)
+    ttl = c->neg_ttl;
+
+  if (ttl < c->min_ttl)
+    ttl = c->min_ttl;
+
+  if (ttl > c->max_ttl)
+    ttl = c->max_ttl;
+
+  return ttl;
+}
+
+static uint32_t
+hsk_cache_age_ttl(uint32_t ttl, int64_t age) {
+  if (age <= 0)
+    return ttl;
+
+  if ((int64_t)ttl <= age)
+    return 0;
+
+  return ttl - (uint32_t)age;
+}
+
+static void
+hsk_cache_age_rrs(hsk_dns_rrs_t *rrs, int64_t age) {
+  for (size_t i = 0; i < rrs->size; i++) {
+    hsk_dns_rr_t *rr = rrs->items[i];
+    rr->ttl = hsk_cache_age_ttl(rr->ttl, age);
+  }
+}
+
+static void
+hsk_cache_stale_rrs(hsk_dns_rrs_t *rrs) {
+  for (size_t i = 0; i < rrs->size; i++) {
+    hsk_dns_rr_t *rr = rrs->items[i];
+    if (rr->ttl > HSK_CACHE_STALE_TTL)
+      rr->ttl = HSK_CACHE_STALE_TTL;
+  }
+}
+
+static bool
+hsk_cache_skip_name(const uint8_t *data, size_t len, size_t *pos) {
+  size_t p = *pos;
+
+  for (;;) {
+    if (p >= len)
+      return false;
+
+    uint8_t c = data[p];
+
+    if ((c & 0xc0) == 0xc0) {
+      if (p + 2 > len)
+        return false;
+      *pos = p + 2;
+      return true;
+    }
+
+    if (c & 0xc0)
+      return false;
+
+    p += 1 + c;
+
+    if (c == 0) {
+      *pos = p;
+      return true;
+    }
+  }
+}
+
+// Find the TTL field of every record in a
+// reply (skipping OPT, whose TTL holds flags).
+static bool
+hsk_cache_wire_index(hsk_cache_wire_t *cw) {
+  const uint8_t *data = cw->wire;
+  size_t len = cw->wire_len;
+
+  if (len < 12 || len > 0xffff)
+    return false;
+
+  size_t qdcount = get_u16be(&data[4]);
+  size_t rrcount = (size_t)get_u16be(&data[6])
+                 + get_u16be(&data[8])
+                 + get_u16be(&data[10]);
+  size_t pos = 12;
+
+  cw->ttls = NULL;
+  cw->ttls_len = 0;
+
+  if (rrcount > 0) {
+    cw->ttls = hsk_malloc(rrcount * sizeof(uint16_t));
+
+    if (!cw->ttls)
+      return false;
+  }
+
+  for (size_t i = 0; i < qdcount; i++) {
+    if (!hsk_cache_skip_name(data, len, &pos) || pos + 4 > len)
+      goto fail;
+    pos += 4;
+  }
+
+  for (size_t i = 0; i < rrcount; i++) {
+    if (!hsk_cache_skip_name(data, len, &pos) || pos + 10 > len)
+      goto fail;
+
+    uint16_t type = get_u16be(&data[pos]);
+    size_t rd_len = get_u16be(&data[pos + 8]);
+
+    if (type != HSK_DNS_OPT)
+      cw->ttls[cw->ttls_len++] = (uint16_t)(pos + 4);
+
+    pos += 10 + rd_len;
+
+    if (pos > len)
+      goto fail;
+  }
+
+  return true;
+
+fail:
+  hsk_free(cw->ttls);
+  cw->ttls = NULL;
+  cw->ttls_len = 0;
+  return false;
+}
+
+/*
+ * Messages
+ */
+
+// Expired entries are only returned when
+// `stale` is set, and dropped once past the
+// stale window.
+static hsk_cache_item_t *
+hsk_cache_lookup(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  bool stale
+) {
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+
+  if (!hsk_cache_key_set(&ck, name, type))
+    return NULL;
+
+  hsk_cache_sketch_add(&c->sketch, ck.hash);
+
+  hsk_cache_item_t *cache = hsk_cache_map_get(&c->map, &ck);
+
+  if (!cache)
+    return NULL;
+
+  int64_t now = hsk_now();
+
+  if (now >= cache->expires + c->stale) {
+    hsk_cache_remove(c, cache);
+    return NULL;
+  }
+
+  if (now >= cache->expires && !stale)
+    return NULL;
+
+  // Stale answers may be from an older root
+  // anyway.
+  if (!stale && !hsk_cache_current(c, (char *)cache->key.name, &cache->epoch))
+    return NULL;
+
+  hsk_cache_unlink(c, cache);
+  hsk_cache_push(c, cache);
+
+  return cache;
+}
+
+// Takes a reference to shared data, fetched
+// at `time`.
+static bool
+hsk_cache_insert_shared(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  uint8_t *data,
+  size_t data_len,
+  int64_t time,
+  uint32_t ttl
+) {
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+
+  if (!hsk_cache_key_set(&ck, name, type)) {
+    hsk_cache_data_unref(data);
+    return false;
+  }
+
+  hsk_cache_item_t *cache = hsk_cache_map_get(&c->map, &ck);
+
+  // A fresh entry is only replaced by its
+  // refresh.
+  if (cache) {
+    if (hsk_now() < cache->expires
+        && !cache->refreshing
+        && hsk_cache_current(c, (char *)cache->key.name, &cache->epoch)) {
+      hsk_cache_data_unref(data);
+      return true;
+    }
+
+    hsk_cache_remove(c, cache);
+
+    cache = NULL;
+  } else {
+    // Only newcomers are filtered; what was
+    // already cached keeps its place.
+    size_t size = sizeof(hsk_cache_item_t) + ck.name_len + 1 + data_len;
+
+    if (!hsk_cache_admit(c, &ck, size)) {
+      c->rejected += 1;
+      hsk_cache_data_unref(data);
+      return true;
+    }
+  }
+
+  hsk_cache_item_t *item = hsk_cache_item_create(&ck);
+
+  if (!item) {
+    hsk_cache_data_unref(data);
+    return false;
+  }
+
+  item->msg = data;
+  item->msg_len = data_len;
+  item->time = time;
+  item->expires = item->time + ttl;
+  item->epoch = c->epoch;
+
+  if (!hsk_cache_map_set(&c->map, &item->key, item)) {
+    hsk_cache_item_free(item);
+    return false;
+  }
+
+  hsk_cache_push(c, item);
+  c->size += hsk_cache_item_size(item);
+  hsk_mem_add(HSK_MEM_CACHE, hsk_cache_item_size(item));
+
+  hsk_cache_evict(c);
+
+  return true;
+}
+
+bool
+hsk_cache_insert_data(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  uint8_t *wire,
+  size_t wire_len,
+  uint32_t ttl
+) {
+  assert(c && wire);
+
+  uint8_t *data = hsk_cache_data_copy(wire, wire_len);
+
+  hsk_free(wire);
+
+  if (!data)
+    return false;
+
+  return hsk_cache_insert_shared(c, name, type, data, wire_len,
+                                 hsk_now(), ttl);
+}
+
+bool
+hsk_cache_insert(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  const hsk_dns_msg_t *msg
+) {
+  // Will yield something less
+  // due to label compression.
+  uint8_t *data = hsk_cache_data_alloc(hsk_dns_msg_size(msg));
+
+  if (!data) {
+    hsk_cache_log(c, "could not encode cache\n");
+    return false;
+  }
+
+  uint8_t *buf = data;
+  size_t data_len = hsk_dns_msg_write(msg, &buf);
+  uint32_t ttl = hsk_cache_msg_ttl(c, msg);
+
+  if (!hsk_cache_insert_shared(c, req->name, req->type,
+                               data, data_len, hsk_now(), ttl)) {
+    hsk_cache_log(c, "could not insert cache\n");
+    return false;
+  }
+
+  return true;
+}
+
+// From a reply encoded whole from the message,
+// (see hsk_dns_msg_reply) which decodes back to
+// it, so the message isn't encoded again. The
+// reply is cached too, sharing the same bytes.
+// Replies missing records are refused.
+bool
+hsk_cache_insert_encoded(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  const hsk_dns_msg_t *msg,
+  const uint8_t *wire,
+  size_t wire_len
+) {
+  assert(c && req && msg && wire);
+
+  if (wire_len < 12)
+    return false;
+
+  if (get_u16be(&wire[2]) & HSK_DNS_TC)
+    return false;
+
+  size_t arcount = msg->ar.size + (msg->edns.enabled ? 1 : 0);
+
+  if (get_u16be(&wire[6]) != msg->an.size
+      || get_u16be(&wire[8]) != msg->ns.size
+      || get_u16be(&wire[10]) != arcount) {
+    return false;
+  }
+
+  uint8_t *data = hsk_cache_data_copy(wire, wire_len);
+
+  if (!data)
+    return false;
+
+  uint32_t ttl = hsk_cache_msg_ttl(c, msg);
+
+  hsk_cache_data_ref(data);
+
+  if (!hsk_cache_insert_shared(c, req->name, req->type,
+                               data, wire_len, hsk_now(), ttl)) {
+    hsk_cache_log(c, "could not insert cache\n");
+    hsk_cache_data_unref(data);
+    return false;
+  }
+
+  hsk_cache_wire_insert(c, req, data, wire_len);
+
+  return true;
+}
+
+// An entry from elsewhere (see
+// hsk_cache_get_entry), aged from when it
+// was first fetched.
+bool
+hsk_cache_insert_entry(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  const uint8_t *wire,
+  size_t wire_len,
+  int64_t time,
+  int64_t expires
+) {
+  assert(c && name && wire);
+
+  if (expires <= time || expires - time > UINT32_MAX)
+    return false;
+
+  uint8_t *data = hsk_cache_data_copy(wire, wire_len);
+
+  if (!data)
+    return false;
+
+  return hsk_cache_insert_shared(c, name, type, data, wire_len,
+                                 time, (uint32_t)(expires - time));
+}
+
+bool
+hsk_cache_get_data(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(c && name && wire);
+
+  hsk_cache_item_t *cache = hsk_cache_lookup(c, name, type, false);
+
+  if (!cache)
+    return false;
+
+  *wire = cache->msg;
+  *wire_len = cache->msg_len;
+
+  return true;
+}
+
+// The encoded message, with when it was
+// fetched and when it expires. Not counted as
+// a lookup.
+bool
+hsk_cache_get_entry(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  uint8_t **wire,
+  size_t *wire_len,
+  int64_t *time,
+  int64_t *expires
+) {
+  assert(c && name && wire && wire_len && time && expires);
+
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+
+  if (!hsk_cache_key_set(&ck, name, type))
+    return false;
+
+  hsk_cache_item_t *cache = hsk_cache_map_get(&c->map, &ck);
+
+  if (!cache || hsk_now() >= cache->expires)
+    return false;
+
+  *wire = cache->msg;
+  *wire_len = cache->msg_len;
+  *time = cache->time;
+  *expires = cache->expires;
+
+  return true;
+}
+
+// TTLs are counted down by the time spent
+// in the cache.
+hsk_dns_msg_t *
+hsk_cache_get(hsk_cache_t *c, const hsk_dns_req_t *req) {
+  hsk_dns_msg_t *msg;
+
+  assert(c && req);
+
+  hsk_cache_item_t *cache = hsk_cache_lookup(c, req->name, req->type, false);
+
+  if (!cache)
+    return NULL;
+
+  hsk_cache_log(c, "cache hit for: %s\n", req->name);
+
+  if (!hsk_dns_msg_decode(cache->msg, cache->msg_len, &msg)) {
+    hsk_cache_log(c, "could not deserialize cached item\n");
+    return NULL;
+  }
+
+  int64_t age = hsk_now() - cache->time;
+
+  hsk_cache_age_rrs(&msg->an, age);
+  hsk_cache_age_rrs(&msg->ns, age);
+  hsk_cache_age_rrs(&msg->ar, age);
+
+  return msg;
+}
+
+// Fresh if possible, otherwise expired (within
+// the stale window) with TTLs capped.
+hsk_dns_msg_t *
+hsk_cache_get_stale(hsk_cache_t *c, const hsk_dns_req_t *req) {
+  hsk_dns_msg_t *msg;
+
+  assert(c && req);
+
+  hsk_cache_item_t *cache = hsk_cache_lookup(c, req->name, req->type, true);
+
+  if (!cache)
+    return NULL;
+
+  if (hsk_now() < cache->expires
+      && hsk_cache_current(c, (char *)cache->key.name, &cache->epoch)) {
+    return hsk_cache_get(c, req);
+  }
+
+  hsk_cache_log(c, "stale hit for: %s\n", req->name);
+
+  if (!hsk_dns_msg_decode(cache->msg, cache->msg_len, &msg)) {
+    hsk_cache_log(c, "could not deserialize cached item\n");
+    return NULL;
+  }
+
+  hsk_cache_stale_rrs(&msg->an);
+  hsk_cache_stale_rrs(&msg->ns);
+  hsk_cache_stale_rrs(&msg->ar);
+
+  return msg;
+}
+
+// Counts a hit on a fresh entry. Returns true
+// (once per entry) when a popular entry is
+// close enough to expiry to fetch again. The
+// refreshed reply replaces it on insert.
+bool
+hsk_cache_should_refresh(hsk_cache_t *c, const hsk_dns_req_t *req) {
+  assert(c && req);
+
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+
+  if (!hsk_cache_key_set(&ck, req->name, req->type))
+    return false;
+
+  hsk_cache_item_t *cache = hsk_cache_map_get(&c->map, &ck);
+
+  if (!cache || cache->refreshing)
+    return false;
+
+  int64_t now = hsk_now();
+
+  if (now >= cache->expires)
+    return false;
+
+  cache->hits += 1;
+
+  if (cache->hits < HSK_CACHE_REFRESH_HITS)
+    return false;
+
+  int64_t life = cache->expires - cache->time;
+  int64_t left = cache->expires - now;
+
+  if (left * HSK_CACHE_REFRESH_FRACTION > life)
+    return false;
+
+  cache->refreshing = true;
+
+  return true;
+}
+
+/*
+ * Negative Cache
+ */
+
+static void
+hsk_cache_nx_unlink(hsk_cache_t *c, hsk_cache_nx_t *nx) {
+  if (nx->prev)
+    nx->prev->next = nx->next;
+  else
+    c->nx_head = nx->next;
+
+  if (nx->next)
+    nx->next->prev = nx->prev;
+  else
+    c->nx_tail = nx->prev;
+
+  nx->prev = NULL;
+  nx->next = NULL;
+}
+
+static void
+hsk_cache_nx_push(hsk_cache_t *c, hsk_cache_nx_t *nx) {
+  nx->prev = NULL;
+  nx->next = c->nx_head;
+
+  if (c->nx_head)
+    c->nx_head->prev = nx;
+  else
+    c->nx_tail = nx;
+
+  c->nx_head = nx;
+}
+
+static void
+hsk_cache_nx_remove(hsk_cache_t *c, hsk_cache_nx_t *nx) {
+  hsk_cache_nx_unlink(c, nx);
+  c->nx_count -= 1;
+  hsk_map_del(&c->nxs, nx->tld);
+  hsk_free(nx);
+}
+
+// The TLD is checked by the caller.
+static bool
+hsk_cache_put_nx(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  int64_t expires
+) {
+  size_t len = strlen(tld);
+  hsk_cache_nx_t *nx = hsk_map_get(&c->nxs, tld);
+
+  if (nx) {
+    memcpy(nx->root, root, 32);
+    nx->expires = expires;
+    hsk_cache_nx_unlink(c, nx);
+    hsk_cache_nx_push(c, nx);
+    return true;
+  }
+
+  nx = hsk_malloc(sizeof(hsk_cache_nx_t));
+
+  if (!nx)
+    return false;
+
+  memcpy(nx->tld, tld, len + 1);
+  hsk_to_lower(nx->tld);
+  memcpy(nx->root, root, 32);
+  nx->expires = expires;
+  nx->prev = NULL;
+  nx->next = NULL;
+
+  if (!hsk_map_set(&c->nxs, nx->tld, nx)) {
+    hsk_free(nx);
+    return false;
+  }
+
+  hsk_cache_nx_push(c, nx);
+  c->nx_count += 1;
+
+  while (c->nx_count > HSK_CACHE_NX_MAX)
+    hsk_cache_nx_remove(c, c->nx_tail);
+
+  return true;
+}
+
+// Lives as long as the NXDOMAIN it was
+// learned from.
+bool
+hsk_cache_insert_nx(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  const hsk_dns_msg_t *msg
+) {
+  assert(c && tld && root && msg);
+
+  size_t len = strlen(tld);
+
+  if (len == 0 || len > HSK_DNS_MAX_LABEL)
+    return false;
+
+  int64_t expires = hsk_now() + hsk_cache_msg_ttl(c, msg);
+
+  return hsk_cache_put_nx(c, tld, root, expires);
+}
+
+// Only for the tree root it was proven under.
+bool
+hsk_cache_has_nx(hsk_cache_t *c, const char *tld, const uint8_t *root) {
+  assert(c && tld && root);
+
+  hsk_cache_nx_t *nx = hsk_map_get(&c->nxs, tld);
+
+  if (!nx)
+    return false;
+
+  if (hsk_now() >= nx->expires || memcmp(nx->root, root, 32) != 0) {
+    hsk_cache_nx_remove(c, nx);
+    return false;
+  }
+
+  hsk_cache_nx_unlink(c, nx);
+  hsk_cache_nx_push(c, nx);
+
+  return true;
+}
+
+/*
+ * Referral Cache
+ */
+
+static void
+hsk_cache_ref_free(hsk_cache_ref_t *ref) {
+  if (ref->data)
+    hsk_free(ref->data);
+  hsk_free(ref);
+}
+
+static void
+hsk_cache_ref_unlink(hsk_cache_t *c, hsk_cache_ref_t *ref) {
+  if (ref->prev)
+    ref->prev->next = ref->next;
+  else
+    c->ref_head = ref->next;
+
+  if (ref->next)
+    ref->next->prev = ref->prev;
+  else
+    c->ref_tail = ref->prev;
+
+  ref->prev = NULL;
+  ref->next = NULL;
+}
+
+static void
+hsk_cache_ref_push(hsk_cache_t *c, hsk_cache_ref_t *ref) {
+  ref->prev = NULL;
+  ref->next = c->ref_head;
+
+  if (c->ref_head)
+    c->ref_head->prev = ref;
+  else
+    c->ref_tail = ref;
+
+  c->ref_head = ref;
+}
+
+static void
+hsk_cache_ref_remove(hsk_cache_t *c, hsk_cache_ref_t *ref) {
+  hsk_cache_ref_unlink(c, ref);
+  c->ref_count -= 1;
+  hsk_map_del(&c->refs, ref->tld);
+  hsk_cache_ref_free(ref);
+}
+
+// The TLD is checked by the caller.
+static bool
+hsk_cache_put_ref(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  int64_t expires
+) {
+  size_t len = strlen(tld);
+  hsk_cache_ref_t *ref = hsk_map_get(&c->refs, tld);
+  uint32_t since = c->epoch;
+
+  if (ref) {
+    if (ref->data_len == data_len
+        && (data_len == 0 || memcmp(ref->data, data, data_len) == 0)) {
+      since = ref->since;
+    }
+
+    hsk_cache_ref_remove(c, ref);
+  }
+
+  ref = hsk_malloc(sizeof(hsk_cache_ref_t));
+
+  if (!ref)
+    return false;
+
+  ref->data = NULL;
+  ref->data_len = data_len;
+
+  if (data_len > 0) {
+    ref->data = hsk_malloc(data_len);
+
+    if (!ref->data) {
+      hsk_free(ref);
+      return false;
+    }
+
+    memcpy(ref->data, data, data_len);
+  }
+
+  memcpy(ref->tld, tld, len + 1);
+  hsk_to_lower(ref->tld);
+  memcpy(ref->root, root, 32);
+  ref->expires = expires;
+  ref->since = since;
+  ref->prev = NULL;
+  ref->next = NULL;
+
+  if (!hsk_map_set(&c->refs, ref->tld, ref)) {
+    hsk_cache_ref_free(ref);
+    return false;
+  }
+
+  hsk_cache_ref_push(c, ref);
+  c->ref_count += 1;
+
+  while (c->ref_count > HSK_CACHE_REF_MAX)
+    hsk_cache_ref_remove(c, c->ref_tail);
+
+  return true;
+}
+
+// Replaces any older resource for the TLD.
+// The TTL is the resource's own.
+bool
+hsk_cache_insert_ref(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  uint32_t ttl
+) {
+  assert(c && tld && root);
+  assert(data || data_len == 0);
+
+  size_t len = strlen(tld);
+
+  if (len == 0 || len > HSK_DNS_MAX_LABEL)
+    return false;
+
+  if (ttl < c->min_ttl)
+    ttl = c->min_ttl;
+
+  if (ttl > c->max_ttl)
+    ttl = c->max_ttl;
+
+  if (ttl == 0)
+    return false;
+
+  int64_t expires = hsk_now() + ttl;
+
+  return hsk_cache_put_ref(c, tld, root, data, data_len, expires);
+}
+
+// Returns a copy of the resource (NULL for an
+// ICANN TLD). Only for the tree root it was
+// proven under.
+bool
+hsk_cache_get_ref(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  uint8_t **data,
+  size_t *data_len
+) {
+  assert(c && tld && root && data && data_len);
+
+  hsk_cache_ref_t *ref = hsk_map_get(&c->refs, tld);
+
+  if (!ref)
+    return false;
+
+  if (hsk_now() >= ref->expires || memcmp(ref->root, root, 32) != 0) {
+    hsk_cache_ref_remove(c, ref);
+    return false;
+  }
+
+  uint8_t *copy = NULL;
+
+  if (ref->data_len > 0) {
+    copy = hsk_malloc(ref->data_len);
+
+    if (!copy)
+      return false;
+
+    memcpy(copy, ref->data, ref->data_len);
+  }
+
+  hsk_cache_ref_unlink(c, ref);
+  hsk_cache_ref_push(c, ref);
+
+  *data = copy;
+  *data_len = ref->data_len;
+
+  return true;
+}
+
+// Each Handshake resource proven under the
+// root and not yet expired, most recently used
+// first (ICANN TLDs carry no data and are left
+// out). The data is the cache's own.
+void
+hsk_cache_each_ref(
+  hsk_cache_t *c,
+  const uint8_t *root,
+  hsk_cache_ref_func func,
+  void *arg
+) {
+  assert(c && root && func);
+
+  int64_t now = hsk_now();
+
+  for (hsk_cache_ref_t *ref = c->ref_head; ref; ref = ref->next) {
+    if (ref->data_len == 0 || now >= ref->expires)
+      continue;
+
+    if (memcmp(ref->root, root, 32) != 0)
+      continue;
+
+    func(ref->tld, ref->data, ref->data_len, arg);
+  }
+}
+
+/*
+ * Wire Cache
+ */
+
+static void
+hsk_cache_wire_key_set(hsk_cache_wire_key_t *wk, const hsk_dns_req_t *req) {
+  memset(wk, 0, sizeof(hsk_cache_wire_key_t));
+
+  // Not lowercased: the question is echoed as
+  // it was asked.
+  wk->name_len = strlen(req->name);
+  memcpy(wk->name, req->name, wk->name_len);
+  wk->type = req->type;
+  wk->class = req->class;
+  wk->max_size = (uint16_t)req->max_size;
+  wk->flags = (req->rd ? 1 : 0)
+            | (req->cd ? 2 : 0)
+            | (req->edns ? 4 : 0)
+            | (req->dnssec ? 8 : 0)
+            | (req->ad ? 16 : 0);
+}
+
+static uint32_t
+hsk_cache_wire_key_hash(const void *key) {
+  const hsk_cache_wire_key_t *wk = (const hsk_cache_wire_key_t *)key;
+  uint32_t tweak = ((uint32_t)wk->type << 16) | wk->class;
+  uint32_t seed = ((uint32_t)wk->max_size << 8) | wk->flags;
+  return hsk_map_tweak3((uint8_t *)wk->name, wk->name_len, seed, tweak);
+}
+
+static bool
+hsk_cache_wire_key_equal(const void *a, const void *b) {
+  const hsk_cache_wire_key_t *x = (const hsk_cache_wire_key_t *)a;
+  const hsk_cache_wire_key_t *y = (const hsk_cache_wire_key_t *)b;
+
+  return x->name_len == y->name_len
+      && x->type == y->type
+      && x->class == y->class
+      && x->max_size == y->max_size
+      && x->flags == y->flags
+      && memcmp(x->name, y->name, x->name_len) == 0;
+}
+
+static void
+hsk_cache_wire_free(hsk_cache_wire_t *cw) {
+  assert(cw);
+  hsk_free(cw->ttls);
+  hsk_cache_data_unref(cw->wire);
+  hsk_free(cw);
+}
+
+// Takes a reference to shared data.
+static hsk_cache_wire_t *
+hsk_cache_wire_wrap(
+  const hsk_cache_wire_key_t *wk,
+  uint8_t *data,
+  size_t data_len
+) {
+  hsk_cache_wire_t *cw = hsk_malloc(sizeof(hsk_cache_wire_t));
+
+  if (!cw) {
+    hsk_cache_data_unref(data);
+    return NULL;
+  }
+
+  memcpy(&cw->key, wk, sizeof(hsk_cache_wire_key_t));
+  cw->wire = data;
+  cw->wire_len = data_len;
+  cw->time = hsk_now();
+  cw->expires = 0;
+  cw->epoch = 0;
+  cw->prev = NULL;
+  cw->next = NULL;
+
+  if (!hsk_cache_wire_index(cw)) {
+    hsk_cache_data_unref(cw->wire);
+    hsk_free(cw);
+    return NULL;
+  }
+
+  return cw;
+}
+
+static hsk_cache_wire_t *
+hsk_cache_wire_create(
+  const hsk_cache_wire_key_t *wk,
+  const uint8_t *wire,
+  size_t wire_len
+) {
+  uint8_t *data = hsk_cache_data_copy(wire, wire_len);
+
+  if (!data)
+    return NULL;
+
+  return hsk_cache_wire_wrap(wk, data, wire_len);
 }
 
-static void
-hsk_cache_log(const hsk_cache_t *c, const char *fmt, ...) {
-  assert(c);
-  printf("cache: ");
+static bool
+hsk_cache_wire_add(hsk_cache_t *c, hsk_cache_wire_t *cw) {
+  if (!hsk_map_set(&c->wires, &cw->key, cw)) {
+    hsk_cache_wire_free(cw);
+    return false;
+  }
 
-  va_list args;
-  va_start(args, fmt);
-  vprintf(fmt, args);
-  va_end(args);
-}
+  hsk_cache_wire_push(c, cw);
+  c->wire_size += hsk_cache_wire_size(cw);
+  hsk_mem_add(HSK_MEM_CACHE, hsk_cache_wire_size(cw));
 
-static void
-hsk_cache_prune(hsk_cache_t *c) {
-  assert(c);
-  hsk_map_clear(&c->map);
+  hsk_cache_evict_wires(c);
+
+  return true;
 }
 
+// Stored alongside (and expiring with) the
+// cached message it was built from. The wire
+// may come from an aged copy of the message,
+// so it keeps its own time.
 bool
-hsk_cache_insert_data(
+hsk_cache_insert_wire(
   hsk_cache_t *c,
-  const char *name,
-  uint16_t type,
-  uint8_t *wire,
+  const hsk_dns_req_t *req,
+  const uint8_t *wire,
   size_t wire_len
 ) {
-  assert(c);
+  assert(c && req && wire);
+
+  if (wire_len < 2)
+    return false;
 
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
   hsk_cache_key_t ck;
   hsk_cache_key_init(&ck);
+  ck.name = buf;
 
-  if (!hsk_cache_key_set(&ck, name, type))
+  if (!hsk_cache_key_set(&ck, req->name, req->type))
     return false;
 
-  hsk_cache_item_t *cache = hsk_map_get(&c->map, &ck);
+  hsk_cache_item_t *item = hsk_cache_map_get(&c->map, &ck);
 
-  if (cache) {
-    if (hsk_now() < cache->time + 6 * 60 * 60)
-      return true;
+  if (!item)
+    return false;
 
-    hsk_map_del(&c->map, &ck);
-    hsk_cache_item_free(cache);
+  hsk_cache_wire_key_t wk;
+  hsk_cache_wire_key_set(&wk, req);
 
-    cache = NULL;
-  }
+  hsk_cache_wire_t *cw = hsk_map_get(&c->wires, &wk);
 
-  if (c->map.size >= HSK_CACHE_LIMIT)
-    hsk_cache_prune(c);
+  if (cw) {
+    if (hsk_cache_current(c, cw->key.name, &cw->epoch))
+      return true;
+    hsk_cache_wire_remove(c, cw);
+  }
 
-  hsk_cache_item_t *item = hsk_cache_item_alloc();
+  cw = hsk_cache_wire_create(&wk, wire, wire_len);
 
-  if (!item)
+  if (!cw)
     return false;
 
-  memcpy(&item->key, &ck, sizeof(hsk_cache_key_t));
+  cw->expires = item->expires;
+  cw->epoch = item->epoch;
+
+  return hsk_cache_wire_add(c, cw);
+}
+
+// As above, taking a reference to shared data.
+static bool
+hsk_cache_wire_insert(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  uint8_t *data,
+  size_t data_len
+) {
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+
+  hsk_cache_item_t *item = NULL;
 
-  item->msg = wire;
-  item->msg_len = wire_len;
-  item->time = hsk_now();
+  if (hsk_cache_key_set(&ck, req->name, req->type))
+    item = hsk_cache_map_get(&c->map, &ck);
 
-  if (!hsk_map_set(&c->map, &item->key, item)) {
-    free(item->msg);
-    free(item);
+  hsk_cache_wire_key_t wk;
+  hsk_cache_wire_key_set(&wk, req);
+
+  if (!item || hsk_map_has(&c->wires, &wk)) {
+    hsk_cache_data_unref(data);
     return false;
   }
 
-  return true;
+  hsk_cache_wire_t *cw = hsk_cache_wire_wrap(&wk, data, data_len);
+
+  if (!cw)
+    return false;
+
+  cw->expires = item->expires;
+  cw->epoch = item->epoch;
+
+  return hsk_cache_wire_add(c, cw);
 }
 
+// A reply with no message behind it (from the
+// recursive resolver). It lives for the lowest
+// TTL in it; replies that failed are skipped.
 bool
-hsk_cache_insert(
+hsk_cache_insert_reply(
   hsk_cache_t *c,
   const hsk_dns_req_t *req,
-  const hsk_dns_msg_t *msg
+  const uint8_t *wire,
+  size_t wire_len
 ) {
-  uint8_t *wire;
-  size_t wire_len;
+  assert(c && req && wire);
 
-  if (!hsk_dns_msg_encode(msg, &wire, &wire_len)) {
-    hsk_cache_log(c, "could not encode cache\n");
+  if (wire_len < 12)
+    return false;
+
+  uint8_t code = wire[3] & 0x0f;
+
+  if (code != HSK_DNS_NOERROR && code != HSK_DNS_NXDOMAIN)
     return false;
+
+  hsk_cache_wire_key_t wk;
+  hsk_cache_wire_key_set(&wk, req);
+
+  hsk_cache_wire_t *cw = hsk_map_get(&c->wires, &wk);
+
+  if (cw) {
+    if (hsk_now() < cw->expires)
+      return true;
+    hsk_cache_wire_remove(c, cw);
   }
 
-  if (!hsk_cache_insert_data(c, req->name, req->type, wire, wire_len)) {
-    hsk_cache_log(c, "could not insert cache\n");
+  cw = hsk_cache_wire_create(&wk, wire, wire_len);
+
+  if (!cw)
+    return false;
+
+  uint32_t ttl = cw->ttls_len > 0 ? c->max_ttl : c->neg_ttl;
+
+  for (size_t i = 0; i < cw->ttls_len; i++) {
+    uint32_t rr_ttl = get_u32be(&cw->wire[cw->ttls[i]]);
+
+    if (rr_ttl < ttl)
+      ttl = rr_ttl;
+  }
+
+  bool negative = code == HSK_DNS_NXDOMAIN || get_u16be(&wire[6]) == 0;
+
+  if (negative && ttl < c->neg_ttl)
+    ttl = c->neg_ttl;
+
+  if (ttl < c->min_ttl)
+    ttl = c->min_ttl;
+
+  if (ttl > c->max_ttl)
+    ttl = c->max_ttl;
+
+  if (ttl == 0) {
+    hsk_cache_wire_free(cw);
     return false;
   }
 
-  return true;
+  cw->expires = cw->time + ttl;
+  cw->epoch = c->epoch;
+
+  return hsk_cache_wire_add(c, cw);
 }
 
+// Returns a copy carrying the request's ID.
 bool
-hsk_cache_get_data(
+hsk_cache_get_wire(
   hsk_cache_t *c,
-  const char *name,
-  uint16_t type,
+  const hsk_dns_req_t *req,
   uint8_t **wire,
   size_t *wire_len
 ) {
-  assert(c && name && wire);
+  assert(c && req && wire && wire_len);
+
+  hsk_cache_wire_key_t wk;
+  hsk_cache_wire_key_set(&wk, req);
+
+  hsk_cache_wire_t *cw = hsk_map_get(&c->wires, &wk);
+
+  if (!cw)
+    return false;
+
+  int64_t now = hsk_now();
+
+  if (now >= cw->expires || !hsk_cache_current(c, cw->key.name, &cw->epoch)) {
+    hsk_cache_wire_remove(c, cw);
+    return false;
+  }
+
+  // Room for a signature, to be added in place.
+  uint8_t *data = hsk_malloc(cw->wire_len + HSK_SIG0_RR_SIZE);
+
+  if (!data)
+    return false;
+
+  memcpy(data, cw->wire, cw->wire_len);
+
+  data[0] = (uint8_t)(req->id >> 8);
+  data[1] = (uint8_t)req->id;
+
+  for (size_t i = 0; i < cw->ttls_len; i++) {
+    uint8_t *field = &data[cw->ttls[i]];
+    set_u32be(field, hsk_cache_age_ttl(get_u32be(field), now - cw->time));
+  }
+
+  hsk_cache_wire_unlink(c, cw);
+  hsk_cache_wire_push(c, cw);
+
+  *wire = data;
+  *wire_len = cw->wire_len;
+
+  return true;
+}
+
+/*
+ * Purging
+ */
+
+static bool
+hsk_cache_under(const char *name, const char *tld) {
+  char label[HSK_DNS_MAX_LABEL + 1];
+
+  hsk_dns_label_get(name, -1, label);
+
+  return strcasecmp(label, tld) == 0;
+}
+
+// Everything cached under a TLD, in every tier
+// (the next lookup fetches a fresh proof).
+// Returns how many entries were dropped.
+size_t
+hsk_cache_purge(hsk_cache_t *c, const char *tld) {
+  assert(c && tld);
+
+  char lower[HSK_DNS_MAX_LABEL + 1];
+  size_t count = 0;
+
+  if (strlen(tld) > HSK_DNS_MAX_LABEL)
+    return 0;
+
+  strcpy(lower, tld);
+  hsk_to_lower(lower);
+
+  hsk_cache_item_t *ci = c->head;
+
+  while (ci) {
+    hsk_cache_item_t *next = ci->next;
+
+    if (hsk_cache_under((const char *)ci->key.name, lower)) {
+      hsk_cache_remove(c, ci);
+      count += 1;
+    }
+
+    ci = next;
+  }
+
+  hsk_cache_wire_t *cw = c->wire_head;
+
+  while (cw) {
+    hsk_cache_wire_t *next = cw->next;
+
+    // Names in replies keep the asker's case.
+    if (hsk_cache_under(cw->key.name, lower)) {
+      hsk_cache_wire_remove(c, cw);
+      count += 1;
+    }
+
+    cw = next;
+  }
+
+  hsk_cache_nx_t *nx = hsk_map_get(&c->nxs, lower);
+
+  if (nx) {
+    hsk_cache_nx_remove(c, nx);
+    count += 1;
+  }
+
+  hsk_cache_ref_t *ref = hsk_map_get(&c->refs, lower);
+
+  if (ref) {
+    hsk_cache_ref_remove(c, ref);
+    count += 1;
+  }
+
+  return count;
+}
+
+/*
+ * Persistence
+ */
+
+// Tiers are saved least recently used first,
+// so that reading them back keeps the order:
+//   items: name, type, ref, time, expires, msg
+//   refs: tld, root, expires, data
+//   nxs: tld, root, expires
+// each after a count, all little endian. Times
+// are absolute. Finalized replies are left out
+// (the first hit on a message rebuilds one), as
+// are messages and resources not (yet) proven
+// under the current root: epochs start over
+// when the file is read.
+
+static bool
+hsk_cache_item_saved(const hsk_cache_t *c, const hsk_cache_item_t *ci) {
+  return ci->epoch == c->epoch;
+}
+
+static bool
+hsk_cache_ref_saved(const hsk_cache_t *c, const hsk_cache_ref_t *ref) {
+  return c->epoch == 0 || memcmp(ref->root, c->root, 32) == 0;
+}
+
+size_t
+hsk_cache_write_size(const hsk_cache_t *c) {
+  assert(c);
+
+  size_t size = 12;
+  const hsk_cache_item_t *ci;
+  const hsk_cache_ref_t *ref;
+  const hsk_cache_nx_t *nx;
+
+  for (ci = c->head; ci; ci = ci->next) {
+    if (hsk_cache_item_saved(c, ci))
+      size += 24 + ci->key.name_len + ci->msg_len;
+  }
+
+  for (ref = c->ref_head; ref; ref = ref->next) {
+    if (hsk_cache_ref_saved(c, ref))
+      size += 43 + strlen(ref->tld) + ref->data_len;
+  }
+
+  for (nx = c->nx_head; nx; nx = nx->next)
+    size += 41 + strlen(nx->tld);
+
+  return size;
+}
+
+size_t
+hsk_cache_write(const hsk_cache_t *c, uint8_t **data) {
+  assert(c && data && *data);
+
+  uint8_t *start = *data;
+  const hsk_cache_item_t *ci;
+  const hsk_cache_ref_t *ref;
+  const hsk_cache_nx_t *nx;
+  uint32_t count = 0;
+
+  for (ci = c->head; ci; ci = ci->next)
+    count += hsk_cache_item_saved(c, ci);
+
+  write_u32(data, count);
+
+  for (ci = c->tail; ci; ci = ci->prev) {
+    if (!hsk_cache_item_saved(c, ci))
+      continue;
+
+    write_u8(data, ci->key.name_len);
+    write_bytes(data, ci->key.name, ci->key.name_len);
+    write_u16(data, ci->key.type);
+    write_u8(data, ci->key.ref);
+    write_i64(data, ci->time);
+    write_i64(data, ci->expires);
+    write_u32(data, ci->msg_len);
+    write_bytes(data, ci->msg, ci->msg_len);
+  }
+
+  count = 0;
+
+  for (ref = c->ref_head; ref; ref = ref->next)
+    count += hsk_cache_ref_saved(c, ref);
+
+  write_u32(data, count);
+
+  for (ref = c->ref_tail; ref; ref = ref->prev) {
+    if (!hsk_cache_ref_saved(c, ref))
+      continue;
+
+    size_t len = strlen(ref->tld);
+
+    assert(ref->data_len <= 0xffff);
+
+    write_u8(data, len);
+    write_bytes(data, (uint8_t *)ref->tld, len);
+    write_bytes(data, ref->root, 32);
+    write_i64(data, ref->expires);
+    write_u16(data, ref->data_len);
+    write_bytes(data, ref->data, ref->data_len);
+  }
+
+  write_u32(data, c->nx_count);
+
+  for (nx = c->nx_tail; nx; nx = nx->prev) {
+    size_t len = strlen(nx->tld);
+
+    write_u8(data, len);
+    write_bytes(data, (uint8_t *)nx->tld, len);
+    write_bytes(data, nx->root, 32);
+    write_i64(data, nx->expires);
+  }
+
+  return *data - start;
+}
+
+static bool
+hsk_cache_read_tld(uint8_t **data, size_t *data_len, char *tld) {
+  uint8_t len;
+
+  if (!read_u8(data, data_len, &len))
+    return false;
 
+  if (len == 0 || len > HSK_DNS_MAX_LABEL)
+    return false;
+
+  if (!read_bytes(data, data_len, (uint8_t *)tld, len))
+    return false;
+
+  tld[len] = '\0';
+
+  return strlen(tld) == len && !hsk_dns_name_dirty(tld);
+}
+
+static bool
+hsk_cache_read_item(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_cache_pick_func pick,
+  void *arg
+) {
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
   hsk_cache_key_t ck;
+  uint8_t name_len, ref;
+  uint16_t type;
+  int64_t time, expires;
+  uint32_t msg_len;
+
   hsk_cache_key_init(&ck);
+  ck.name = buf;
 
-  if (!hsk_cache_key_set(&ck, name, type))
+  if (!read_u8(data, data_len, &name_len) || name_len > HSK_DNS_MAX_NAME)
     return false;
 
-  hsk_cache_item_t *cache = hsk_map_get(&c->map, &ck);
+  if (!read_bytes(data, data_len, ck.name, name_len))
+    return false;
 
-  if (!cache)
+  ck.name[name_len] = '\0';
+
+  if (!read_u16(data, data_len, &type)
+      || !read_u8(data, data_len, &ref)
+      || !read_i64(data, data_len, &time)
+      || !read_i64(data, data_len, &expires)
+      || !read_u32(data, data_len, &msg_len)) {
+    return false;
+  }
+
+  if (*data_len < msg_len)
+    return false;
+
+  const uint8_t *msg = *data;
+
+  *data += msg_len;
+  *data_len -= msg_len;
+
+  if (strlen((char *)ck.name) != name_len)
+    return false;
+
+  if (!hsk_dns_name_verify((char *)ck.name))
+    return false;
+
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  hsk_dns_label_get((char *)ck.name, -1, tld);
+
+  ck.name_len = name_len;
+  ck.type = type;
+  ck.ref = ref != 0;
+  hsk_cache_key_rehash(&ck);
+
+  hsk_cache_t *c = pick(tld, arg);
+
+  // Past the stale window, or already known.
+  if (!c || hsk_now() >= expires + c->stale)
+    return true;
+
+  if (hsk_cache_map_get(&c->map, &ck))
+    return true;
+
+  hsk_cache_item_t *item = hsk_cache_item_create(&ck);
+
+  if (!item)
+    return false;
+
+  item->msg = hsk_cache_data_copy(msg, msg_len);
+
+  if (!item->msg) {
+    hsk_cache_item_free(item);
     return false;
+  }
+
+  item->msg_len = msg_len;
+  item->time = time;
+  item->expires = expires;
 
-  if (hsk_now() >= cache->time + 6 * 60 * 60) {
-    hsk_map_del(&c->map, &ck);
-    hsk_cache_item_free(cache);
+  if (!hsk_cache_map_set(&c->map, &item->key, item)) {
+    hsk_cache_item_free(item);
     return false;
   }
 
-  *wire = cache->msg;
-  *wire_len = cache->msg_len;
+  hsk_cache_push(c, item);
+  c->size += hsk_cache_item_size(item);
+  hsk_mem_add(HSK_MEM_CACHE, hsk_cache_item_size(item));
+
+  hsk_cache_evict(c);
 
   return true;
 }
 
-hsk_dns_msg_t *
-hsk_cache_get(hsk_cache_t *c, const hsk_dns_req_t *req) {
-  uint8_t *data;
-  size_t data_len;
-  hsk_dns_msg_t *msg;
+static bool
+hsk_cache_read_ref(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_cache_pick_func pick,
+  void *arg
+) {
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  uint8_t root[32];
+  int64_t expires;
+  uint16_t len;
+
+  if (!hsk_cache_read_tld(data, data_len, tld)
+      || !read_bytes(data, data_len, root, 32)
+      || !read_i64(data, data_len, &expires)
+      || !read_u16(data, data_len, &len)) {
+    return false;
+  }
 
-  if (!hsk_cache_get_data(c, req->name, req->type, &data, &data_len))
-    return NULL;
+  if (*data_len < len)
+    return false;
 
-  hsk_cache_log(c, "cache hit for: %s\n", req->name);
+  const uint8_t *res = *data;
 
-  if (!hsk_dns_msg_decode(data, data_len, &msg)) {
-    hsk_cache_log(c, "could not deserialize cached item\n");
-    return NULL;
+  *data += len;
+  *data_len -= len;
+
+  hsk_cache_t *c = pick(tld, arg);
+
+  if (!c || hsk_now() >= expires || hsk_map_get(&c->refs, tld))
+    return true;
+
+  return hsk_cache_put_ref(c, tld, root, res, len, expires);
+}
+
+static bool
+hsk_cache_read_nx(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_cache_pick_func pick,
+  void *arg
+) {
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  uint8_t root[32];
+  int64_t expires;
+
+  if (!hsk_cache_read_tld(data, data_len, tld)
+      || !read_bytes(data, data_len, root, 32)
+      || !read_i64(data, data_len, &expires)) {
+    return false;
   }
 
-  return msg;
+  hsk_cache_t *c = pick(tld, arg);
+
+  if (!c || hsk_now() >= expires || hsk_map_get(&c->nxs, tld))
+    return true;
+
+  return hsk_cache_put_nx(c, tld, root, expires);
+}
+
+// Entries go to whichever cache `pick` returns
+// for their TLD (none: dropped). Those expired
+// (or past the stale window) are skipped, as
+// are any already cached.
+bool
+hsk_cache_read(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_cache_pick_func pick,
+  void *arg
+) {
+  assert(data && data_len && pick);
+
+  uint32_t count, i;
+
+  if (!read_u32(data, data_len, &count))
+    return false;
+
+  for (i = 0; i < count; i++) {
+    if (!hsk_cache_read_item(data, data_len, pick, arg))
+      return false;
+  }
+
+  if (!read_u32(data, data_len, &count))
+    return false;
+
+  for (i = 0; i < count; i++) {
+    if (!hsk_cache_read_ref(data, data_len, pick, arg))
+      return false;
+  }
+
+  if (!read_u32(data, data_len, &count))
+    return false;
+
+  for (i = 0; i < count; i++) {
+    if (!hsk_cache_read_nx(data, data_len, pick, arg))
+      return false;
+  }
+
+  return true;
 }
 
 void
 hsk_cache_key_init(hsk_cache_key_t *ck) {
   assert(ck);
-  memset(&ck->name[0], 0, sizeof(ck->name));
+  ck->name = NULL;
   ck->name_len = 0;
   ck->ref = false;
   ck->type = 0;
+  ck->hash = 0;
 }
 
 void
@@ -201,11 +2142,15 @@ hsk_cache_key_uninit(hsk_cache_key_t *ck) {
   assert(ck);
 }
 
+// With room for any name.
 hsk_cache_key_t *
 hsk_cache_key_alloc(void) {
-  hsk_cache_key_t *ck = malloc(sizeof(hsk_cache_key_t));
-  if (ck)
+  hsk_cache_key_t *ck = hsk_malloc(sizeof(hsk_cache_key_t) + HSK_DNS_MAX_NAME + 1);
+  if (ck) {
     hsk_cache_key_init(ck);
+    ck->name = (uint8_t *)&ck[1];
+    ck->name[0] = '\0';
+  }
   return ck;
 }
 
@@ -213,17 +2158,15 @@ void
 hsk_cache_key_free(hsk_cache_key_t *ck) {
   assert(ck);
   hsk_cache_key_uninit(ck);
-  free(ck);
+  hsk_free(ck);
 }
 
 uint32_t
 hsk_cache_key_hash(const void *key) {
   hsk_cache_key_t *ck = (hsk_cache_key_t *)key;
   assert(ck);
-  // Ignore type if referral.
-  if (ck->ref)
-    return hsk_map_tweak3(ck->name, ck->name_len, 2, 1);
-  return hsk_map_tweak3(ck->name, ck->name_len, 1, ck->type);
+  // Computed by hsk_cache_key_set.
+  return ck->hash;
 }
 
 bool
@@ -233,6 +2176,10 @@ hsk_cache_key_equal(const void *a, const void *b) {
   hsk_cache_key_t *x = (hsk_cache_key_t *)a;
   hsk_cache_key_t *y = (hsk_cache_key_t *)b;
 
+  // Most mismatches stop here.
+  if (x->hash != y->hash)
+    return false;
+
   if (x->ref != y->ref)
     return false;
 
@@ -251,17 +2198,25 @@ hsk_cache_key_equal(const void *a, const void *b) {
   return true;
 }
 
+static void
+hsk_cache_key_rehash(hsk_cache_key_t *ck) {
+  // Ignore type if referral.
+  if (ck->ref)
+    ck->hash = hsk_map_tweak3(ck->name, ck->name_len, 2, 1);
+  else
+    ck->hash = hsk_map_tweak3(ck->name, ck->name_len, 1, ck->type);
+}
+
 bool
 hsk_cache_key_set(hsk_cache_key_t *ck, const char *name, uint16_t type) {
-  assert(ck);
+  assert(ck && ck->name);
 
-  if (!hsk_dns_name_verify(name))
-    return false;
+  char lower[HSK_DNS_MAX_NAME + 1];
 
-  if (hsk_dns_name_dirty(name))
+  if (!hsk_dns_name_lower_verify(name, lower))
     return false;
 
-  int labels = hsk_dns_label_count(name);
+  int labels = hsk_dns_label_count(lower);
   bool ref = false;
 
   switch (labels) {
@@ -304,11 +2259,12 @@ hsk_cache_key_set(hsk_cache_key_t *ck, const char *name, uint16_t type) {
   if (ref)
     labels = 1;
 
-  ck->name_len = hsk_dns_label_from(name, -labels, (char *)ck->name);
-  hsk_to_lower((char *)ck->name);
+  ck->name_len = hsk_dns_label_from(lower, -labels, (char *)ck->name);
   ck->ref = ref;
   ck->type = type;
 
+  hsk_cache_key_rehash(ck);
+
   return true;
 }
 
@@ -319,13 +2275,19 @@ hsk_cache_item_init(hsk_cache_item_t *ci) {
   ci->msg = NULL;
   ci->msg_len = 0;
   ci->time = 0;
+  ci->expires = 0;
+  ci->hits = 0;
+  ci->refreshing = false;
+  ci->epoch = 0;
+  ci->prev = NULL;
+  ci->next = NULL;
 }
 
 void
 hsk_cache_item_uninit(hsk_cache_item_t *ci) {
   assert(ci);
   if (ci->msg) {
-    free(ci->msg);
+    hsk_cache_data_unref(ci->msg);
     ci->msg = NULL;
     ci->msg_len = 0;
   }
@@ -333,7 +2295,7 @@ hsk_cache_item_uninit(hsk_cache_item_t *ci) {
 
 hsk_cache_item_t *
 hsk_cache_item_alloc(void) {
-  hsk_cache_item_t *ci = malloc(sizeof(hsk_cache_item_t));
+  hsk_cache_item_t *ci = hsk_malloc(sizeof(hsk_cache_item_t));
   if (ci)
     hsk_cache_item_init(ci);
   return ci;
@@ -343,5 +2305,5 @@ void
 hsk_cache_item_free(hsk_cache_item_t *ci) {
   assert(ci);
   hsk_cache_item_uninit(ci);
-  free(ci);
+  hsk_free(ci);
 }
@@ -9,26 +9,193 @@
 #include "map.h"
 #include "req.h"
 
-#define HSK_CACHE_LIMIT 2000
+// Memory budget (in bytes) for each tier. The
+// least recently used entries are evicted once
+// a tier grows past it.
+#define HSK_CACHE_SIZE (8 << 20)
 
-typedef struct hsk_cache_s {
-  hsk_map_t map;
-} hsk_cache_t;
+// Entries live for the lowest TTL in the reply
+// (the SOA minimum for negative answers, which
+// get a floor of their own), clamped to these
+// bounds in seconds.
+#define HSK_CACHE_MIN_TTL 0
+#define HSK_CACHE_MAX_TTL (6 * 60 * 60)
+#define HSK_CACHE_NEG_TTL 60
+
+// Expired entries are kept this long (seconds)
+// and served with a short TTL when a name
+// cannot be resolved (RFC 8767).
+#define HSK_CACHE_STALE (24 * 60 * 60)
+#define HSK_CACHE_STALE_TTL 30
+
+// Entries hit this many times are refreshed
+// once within the last 1/N of their lifetime.
+#define HSK_CACHE_REFRESH_HITS 2
+#define HSK_CACHE_REFRESH_FRACTION 10
+
+// TLDs proven not to exist (and not in the
+// ICANN zone) under a tree root. Any name and
+// type below them is answered NXDOMAIN.
+#define HSK_CACHE_NX_MAX 4096
+
+// Resources of TLDs that do exist, so that any
+// name and type below one (a referral, mostly)
+// is answered without another proof.
+#define HSK_CACHE_REF_MAX 4096
+
+// Messages and replies are tagged with the root
+// epoch they were built in (see
+// hsk_cache_set_root). After the root moves, an
+// older entry is only served once its TLD's
+// resource has been proven again and found
+// unchanged; until then lookups miss.
 
+// Admission filter: a count-min sketch of
+// lookup frequencies (ROWS rows of WIDTH
+// counters, saturating at 15). Once the tier is
+// full, a new entry only displaces the least
+// recently used one if it has been asked for
+// more often. Counters are halved every
+// WIDTH * 10 lookups so that old popularity
+// fades.
+#define HSK_CACHE_SKETCH_ROWS 4
+#define HSK_CACHE_SKETCH_WIDTH 4096
+
+// Where a saved entry goes, by its TLD.
+typedef struct hsk_cache_s *(*hsk_cache_pick_func)(
+  const char *tld,
+  void *arg
+);
+
+// Given each resource (see hsk_cache_each_ref).
+typedef void (*hsk_cache_ref_func)(
+  const char *tld,
+  const uint8_t *data,
+  size_t data_len,
+  void *arg
+);
+
+// The name (lowercased, NUL terminated) is not
+// part of the key: lookups point it at a buffer
+// of their own (HSK_DNS_MAX_NAME + 1 bytes) and
+// entries keep it in the same allocation as
+// the item.
 typedef struct hsk_cache_key_s {
-  uint8_t name[HSK_DNS_MAX_NAME + 1];
-  size_t name_len;
+  uint8_t *name;
+  uint8_t name_len;
   uint16_t type;
   bool ref;
+  uint32_t hash;
 } hsk_cache_key_t;
 
+typedef struct hsk_cache_wire_key_s {
+  char name[HSK_DNS_MAX_NAME + 1];
+  size_t name_len;
+  uint16_t type;
+  uint16_t class;
+  uint16_t max_size;
+  uint8_t flags;
+} hsk_cache_wire_key_t;
+
+typedef struct hsk_cache_wire_s {
+  hsk_cache_wire_key_t key;
+  uint8_t *wire;
+  size_t wire_len;
+  uint16_t *ttls;
+  size_t ttls_len;
+  int64_t time;
+  int64_t expires;
+  uint32_t epoch;
+  struct hsk_cache_wire_s *prev;
+  struct hsk_cache_wire_s *next;
+} hsk_cache_wire_t;
+
+typedef struct hsk_cache_nx_s {
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  uint8_t root[32];
+  int64_t expires;
+  struct hsk_cache_nx_s *prev;
+  struct hsk_cache_nx_s *next;
+} hsk_cache_nx_t;
+
+// An empty resource stands for an ICANN TLD.
+// It has been the same since epoch `since`.
+typedef struct hsk_cache_ref_s {
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  uint8_t root[32];
+  uint8_t *data;
+  size_t data_len;
+  int64_t expires;
+  uint32_t since;
+  struct hsk_cache_ref_s *prev;
+  struct hsk_cache_ref_s *next;
+} hsk_cache_ref_t;
+
 typedef struct hsk_cache_item_s {
   hsk_cache_key_t key;
   uint8_t *msg;
   size_t msg_len;
   int64_t time;
+  int64_t expires;
+  uint32_t hits;
+  bool refreshing;
+  uint32_t epoch;
+  struct hsk_cache_item_s *prev;
+  struct hsk_cache_item_s *next;
 } hsk_cache_item_t;
 
+bool
+hsk_cache_key_equal(const void *a, const void *b);
+
+// Keys carry their hash (see hsk_cache_key_set).
+#define hsk_cache_key_hash_of(ck) ((ck)->hash)
+
+HSK_TMAP_INIT(
+  cache_map,
+  const hsk_cache_key_t *,
+  hsk_cache_item_t *,
+  hsk_cache_key_hash_of,
+  hsk_cache_key_equal
+)
+
+// Messages by name, plus finalized replies
+// (before SIG(0)) keyed by everything in a
+// query that shapes the reply. Only the ID
+// and TTLs differ between hits on the latter.
+// Lists run from most to least recently used.
+typedef struct hsk_cache_sketch_s {
+  uint8_t rows[HSK_CACHE_SKETCH_ROWS][HSK_CACHE_SKETCH_WIDTH];
+  uint32_t samples;
+} hsk_cache_sketch_t;
+
+typedef struct hsk_cache_s {
+  hsk_cache_map_t map;
+  hsk_cache_item_t *head;
+  hsk_cache_item_t *tail;
+  size_t size;
+  hsk_map_t wires;
+  hsk_cache_wire_t *wire_head;
+  hsk_cache_wire_t *wire_tail;
+  size_t wire_size;
+  hsk_map_t nxs;
+  hsk_cache_nx_t *nx_head;
+  hsk_cache_nx_t *nx_tail;
+  size_t nx_count;
+  hsk_map_t refs;
+  hsk_cache_ref_t *ref_head;
+  hsk_cache_ref_t *ref_tail;
+  size_t ref_count;
+  size_t max_size;
+  uint32_t min_ttl;
+  uint32_t max_ttl;
+  uint32_t neg_ttl;
+  uint32_t stale;
+  hsk_cache_sketch_t sketch;
+  uint64_t rejected;
+  uint8_t root[32];
+  uint32_t epoch;
+} hsk_cache_t;
+
 void
 hsk_cache_init(hsk_cache_t *c);
 
@@ -41,13 +208,39 @@ hsk_cache_alloc(void);
 void
 hsk_cache_free(hsk_cache_t *c);
 
+bool
+hsk_cache_set_size(hsk_cache_t *c, size_t max_size);
+
+void
+hsk_cache_set_root(hsk_cache_t *c, const uint8_t *root);
+
+bool
+hsk_cache_set_ttl(
+  hsk_cache_t *c,
+  uint32_t min_ttl,
+  uint32_t max_ttl,
+  uint32_t neg_ttl
+);
+
 bool
 hsk_cache_insert_data(
   hsk_cache_t *c,
   const char *name,
   uint16_t type,
   uint8_t *wire,
-  size_t wire_len
+  size_t wire_len,
+  uint32_t ttl
+);
+
+bool
+hsk_cache_insert_entry(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  const uint8_t *wire,
+  size_t wire_len,
+  int64_t time,
+  int64_t expires
 );
 
 bool
@@ -57,6 +250,15 @@ hsk_cache_insert(
   const hsk_dns_msg_t *msg
 );
 
+bool
+hsk_cache_insert_encoded(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  const hsk_dns_msg_t *msg,
+  const uint8_t *wire,
+  size_t wire_len
+);
+
 bool
 hsk_cache_get_data(
   hsk_cache_t *c,
@@ -66,9 +268,105 @@ hsk_cache_get_data(
   size_t *wire_len
 );
 
+bool
+hsk_cache_get_entry(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  uint8_t **wire,
+  size_t *wire_len,
+  int64_t *time,
+  int64_t *expires
+);
+
 hsk_dns_msg_t *
 hsk_cache_get(hsk_cache_t *c, const hsk_dns_req_t *req);
 
+hsk_dns_msg_t *
+hsk_cache_get_stale(hsk_cache_t *c, const hsk_dns_req_t *req);
+
+bool
+hsk_cache_should_refresh(hsk_cache_t *c, const hsk_dns_req_t *req);
+
+bool
+hsk_cache_insert_nx(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  const hsk_dns_msg_t *msg
+);
+
+bool
+hsk_cache_has_nx(hsk_cache_t *c, const char *tld, const uint8_t *root);
+
+bool
+hsk_cache_insert_ref(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  uint32_t ttl
+);
+
+bool
+hsk_cache_get_ref(
+  hsk_cache_t *c,
+  const char *tld,
+  const uint8_t *root,
+  uint8_t **data,
+  size_t *data_len
+);
+
+void
+hsk_cache_each_ref(
+  hsk_cache_t *c,
+  const uint8_t *root,
+  hsk_cache_ref_func func,
+  void *arg
+);
+
+bool
+hsk_cache_insert_wire(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  const uint8_t *wire,
+  size_t wire_len
+);
+
+bool
+hsk_cache_insert_reply(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  const uint8_t *wire,
+  size_t wire_len
+);
+
+bool
+hsk_cache_get_wire(
+  hsk_cache_t *c,
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+);
+
+size_t
+hsk_cache_purge(hsk_cache_t *c, const char *tld);
+
+size_t
+hsk_cache_write_size(const hsk_cache_t *c);
+
+size_t
+hsk_cache_write(const hsk_cache_t *c, uint8_t **data);
+
+bool
+hsk_cache_read(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_cache_pick_func pick,
+  void *arg
+);
+
 void
 hsk_cache_key_init(hsk_cache_key_t *ck);
 
@@ -84,9 +382,6 @@ hsk_cache_key_free(hsk_cache_key_t *ck);
 uint32_t
 hsk_cache_key_hash(const void *key);
 
-bool
-hsk_cache_key_equal(const void *a, const void *b);
-
 bool
 hsk_cache_key_set(hsk_cache_key_t *ck, const char *name, uint16_t type);
 
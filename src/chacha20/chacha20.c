@@ -26,6 +26,13 @@
 
 #include "chacha20.h"
 
+// Eight blocks at a time with AVX2 on x86-64,
+// when the CPU has it.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HSK_CHACHA20_AVX2
+#include <immintrin.h>
+#endif
+
 #define ROTL32(v, n) ((v) << (n)) | ((v) >> (32 - (n)))
 
 #define READLE(p)                   \
@@ -159,6 +166,124 @@ hsk_chacha20_block(hsk_chacha20_ctx *ctx, uint32_t output[16]) {
   }
 }
 
+#ifdef HSK_CHACHA20_AVX2
+
+#define VROTL(v, n) \
+  _mm256_or_si256(_mm256_slli_epi32((v), (n)), _mm256_srli_epi32((v), 32 - (n)))
+
+#define VQUARTERROUND(a, b, c, d)                          \
+  a = _mm256_add_epi32(a, b);                              \
+  d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16);  \
+  c = _mm256_add_epi32(c, d);                              \
+  b = VROTL(_mm256_xor_si256(b, c), 12);                   \
+  a = _mm256_add_epi32(a, b);                              \
+  d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);   \
+  c = _mm256_add_epi32(c, d);                              \
+  b = VROTL(_mm256_xor_si256(b, c), 7);
+
+// Rows of eight lanes (one word of each block)
+// back into eight blocks of eight words.
+#define VTRANSPOSE(a0, a1, a2, a3, a4, a5, a6, a7) do { \
+  __m256i t0 = _mm256_unpacklo_epi32(a0, a1);           \
+  __m256i t1 = _mm256_unpackhi_epi32(a0, a1);           \
+  __m256i t2 = _mm256_unpacklo_epi32(a2, a3);           \
+  __m256i t3 = _mm256_unpackhi_epi32(a2, a3);           \
+  __m256i t4 = _mm256_unpacklo_epi32(a4, a5);           \
+  __m256i t5 = _mm256_unpackhi_epi32(a4, a5);           \
+  __m256i t6 = _mm256_unpacklo_epi32(a6, a7);           \
+  __m256i t7 = _mm256_unpackhi_epi32(a6, a7);           \
+  __m256i u0 = _mm256_unpacklo_epi64(t0, t2);           \
+  __m256i u1 = _mm256_unpackhi_epi64(t0, t2);           \
+  __m256i u2 = _mm256_unpacklo_epi64(t1, t3);           \
+  __m256i u3 = _mm256_unpackhi_epi64(t1, t3);           \
+  __m256i u4 = _mm256_unpacklo_epi64(t4, t6);           \
+  __m256i u5 = _mm256_unpackhi_epi64(t4, t6);           \
+  __m256i u6 = _mm256_unpacklo_epi64(t5, t7);           \
+  __m256i u7 = _mm256_unpackhi_epi64(t5, t7);           \
+  a0 = _mm256_permute2x128_si256(u0, u4, 0x20);         \
+  a1 = _mm256_permute2x128_si256(u1, u5, 0x20);         \
+  a2 = _mm256_permute2x128_si256(u2, u6, 0x20);         \
+  a3 = _mm256_permute2x128_si256(u3, u7, 0x20);         \
+  a4 = _mm256_permute2x128_si256(u0, u4, 0x31);         \
+  a5 = _mm256_permute2x128_si256(u1, u5, 0x31);         \
+  a6 = _mm256_permute2x128_si256(u2, u6, 0x31);         \
+  a7 = _mm256_permute2x128_si256(u3, u7, 0x31);         \
+} while (0)
+
+#define VXOR(off, v)                                        \
+  _mm256_storeu_si256((__m256i *)(out + (off)),             \
+    _mm256_xor_si256((v),                                   \
+      _mm256_loadu_si256((const __m256i *)(in + (off)))))
+
+// Encrypts 512 bytes, counting on from the
+// current block.
+__attribute__((target("avx2")))
+static void
+hsk_chacha20_blocks8(hsk_chacha20_ctx *ctx, const uint8_t *in, uint8_t *out) {
+  const __m256i rot16 = _mm256_setr_epi8(
+    2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+    2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+  const __m256i rot8 = _mm256_setr_epi8(
+    3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+    3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+  const uint32_t *s = ctx->schedule;
+  uint32_t c12[8], c13[8];
+  __m256i x[16], o[16];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    c12[i] = s[12] + i;
+    c13[i] = s[13];
+
+    if (ctx->nonce_size == 8 && c12[i] < s[12])
+      c13[i] += 1;
+  }
+
+  for (i = 0; i < 16; i++)
+    o[i] = _mm256_set1_epi32(s[i]);
+
+  o[12] = _mm256_loadu_si256((const __m256i *)c12);
+  o[13] = _mm256_loadu_si256((const __m256i *)c13);
+
+  for (i = 0; i < 16; i++)
+    x[i] = o[i];
+
+  for (i = 0; i < 10; i++) {
+    VQUARTERROUND(x[0], x[4], x[8], x[12])
+    VQUARTERROUND(x[1], x[5], x[9], x[13])
+    VQUARTERROUND(x[2], x[6], x[10], x[14])
+    VQUARTERROUND(x[3], x[7], x[11], x[15])
+    VQUARTERROUND(x[0], x[5], x[10], x[15])
+    VQUARTERROUND(x[1], x[6], x[11], x[12])
+    VQUARTERROUND(x[2], x[7], x[8], x[13])
+    VQUARTERROUND(x[3], x[4], x[9], x[14])
+  }
+
+  for (i = 0; i < 16; i++)
+    x[i] = _mm256_add_epi32(x[i], o[i]);
+
+  VTRANSPOSE(x[0], x[1], x[2], x[3], x[4], x[5], x[6], x[7]);
+  VTRANSPOSE(x[8], x[9], x[10], x[11], x[12], x[13], x[14], x[15]);
+
+  for (i = 0; i < 8; i++) {
+    VXOR(i * 64, x[i]);
+    VXOR(i * 64 + 32, x[i + 8]);
+  }
+
+  // Move the counter past the eight blocks.
+  ctx->schedule[12] = s[12] + 8;
+
+  if (ctx->nonce_size == 8 && ctx->schedule[12] < 8)
+    ctx->schedule[13] += 1;
+}
+
+#undef VROTL
+#undef VQUARTERROUND
+#undef VTRANSPOSE
+#undef VXOR
+
+#endif // HSK_CHACHA20_AVX2
+
 static inline
 void hsk_chacha20_xor(
   uint8_t *keystream,
@@ -190,6 +315,17 @@ hsk_chacha20_encrypt(
       length -= amount;
     }
 
+#ifdef HSK_CHACHA20_AVX2
+    if (length >= 512 && __builtin_cpu_supports("avx2")) {
+      do {
+        hsk_chacha20_blocks8(ctx, in, out);
+        in += 512;
+        out += 512;
+        length -= 512;
+      } while (length >= 512);
+    }
+#endif
+
     while (length) {
       size_t amount = MIN(length, sizeof(ctx->keystream));
       hsk_chacha20_block(ctx, ctx->keystream);
@@ -8,15 +8,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "bn.h"
+#include "bio.h"
 #include "chain.h"
+#include "checkpoints.h"
 #include "constants.h"
+#include "entry.h"
 #include "error.h"
 #include "header.h"
+#include "log.h"
 #include "map.h"
+#include "mem.h"
 #include "msg.h"
+#include "orphan.h"
+#include "store.h"
 #include "timedata.h"
+#include "u256.h"
 #include "utils.h"
+#include "uv.h"
 
 /*
  * Prototypes
@@ -29,12 +37,34 @@ static int
 hsk_chain_insert(
   hsk_chain_t *chain,
   hsk_header_t *hdr,
-  const hsk_header_t *prev
+  const hsk_entry_t *prev
 );
 
 static void
 hsk_chain_maybe_sync(hsk_chain_t *chain);
 
+static void
+hsk_chain_publish(hsk_chain_t *chain);
+
+static int64_t
+hsk_chain_calc_mtp(const hsk_chain_t *chain, const hsk_entry_t *prev);
+
+static void
+hsk_chain_reset_window(hsk_chain_t *chain);
+
+static void
+hsk_chain_push_window(hsk_chain_t *chain);
+
+static void
+hsk_chain_log(const hsk_chain_t *chain, const char *fmt, ...);
+
+// Per-header lines, compiled out
+// with --disable-debug-log.
+#define hsk_chain_debug(chain, ...) do { \
+  if (hsk_log_enabled(HSK_LOG_DEBUG))    \
+    hsk_chain_log((chain), __VA_ARGS__); \
+} while (0)
+
 /*
  * Helpers
  */
@@ -53,6 +83,129 @@ qsort_cmp(const void *a, const void *b) {
   return 0;
 }
 
+static hsk_entry_t *
+hsk_chain_slot(const hsk_chain_t *chain, uint32_t height) {
+  size_t i = height / HSK_CHAIN_CHUNK;
+
+  if (i >= chain->chunks_size || !chain->chunks[i])
+    return NULL;
+
+  return &chain->chunks[i][height % HSK_CHAIN_CHUNK];
+}
+
+static bool
+hsk_chain_reserve(hsk_chain_t *chain, uint32_t height) {
+  size_t i = height / HSK_CHAIN_CHUNK;
+
+  if (i >= chain->chunks_size) {
+    size_t size = chain->chunks_size ? chain->chunks_size * 2 : 64;
+
+    while (size <= i)
+      size *= 2;
+
+    hsk_entry_t **chunks = hsk_realloc(chain->chunks, size * sizeof(hsk_entry_t *));
+
+    if (!chunks)
+      return false;
+
+    memset(&chunks[chain->chunks_size], 0,
+           (size - chain->chunks_size) * sizeof(hsk_entry_t *));
+
+    chain->chunks = chunks;
+    chain->chunks_size = size;
+  }
+
+  for (; !chain->chunks[i]; i--) {
+    chain->chunks[i] = hsk_malloc(HSK_CHAIN_CHUNK * sizeof(hsk_entry_t));
+
+    if (!chain->chunks[i])
+      return false;
+
+    hsk_mem_add(HSK_MEM_CHAIN, HSK_CHAIN_CHUNK * sizeof(hsk_entry_t));
+
+    if (i == 0)
+      break;
+  }
+
+  return true;
+}
+
+static bool
+hsk_chain_is_main(const hsk_chain_t *chain, const hsk_entry_t *entry) {
+  if ((int64_t)entry->height > chain->height)
+    return false;
+
+  return hsk_chain_slot(chain, entry->height) == entry;
+}
+
+static hsk_entry_t *
+hsk_chain_get_prev(const hsk_chain_t *chain, const hsk_entry_t *entry) {
+  if (entry->height == 0)
+    return NULL;
+
+  if (hsk_chain_is_main(chain, entry))
+    return hsk_chain_slot(chain, entry->height - 1);
+
+  return hsk_hmap_get(&chain->hashes, entry->prev_block);
+}
+
+static const uint8_t *
+hsk_chain_get_checkpoint(uint32_t height) {
+  const hsk_checkpoint_t *c;
+
+  for (c = hsk_checkpoints; c->hash; c++) {
+    if (c->height == height)
+      return c->hash;
+  }
+
+  return NULL;
+}
+
+static uint32_t
+hsk_chain_prev_checkpoint(uint32_t height) {
+  const hsk_checkpoint_t *c;
+  uint32_t prev = 0;
+
+  for (c = hsk_checkpoints; c->hash; c++) {
+    if (c->height < height && c->height > prev)
+      prev = c->height;
+  }
+
+  return prev;
+}
+
+// Skip list heights (as in bitcoind): every
+// entry links back to one further ancestor so
+// that ancestor lookups off the main chain
+// take a logarithmic number of steps.
+static uint32_t
+hsk_chain_invert_lowest_one(uint32_t n) {
+  return n & (n - 1);
+}
+
+static uint32_t
+hsk_chain_skip_height(uint32_t height) {
+  if (height < 2)
+    return 0;
+
+  if (height & 1) {
+    uint32_t h = hsk_chain_invert_lowest_one(height - 1);
+    return hsk_chain_invert_lowest_one(h) + 1;
+  }
+
+  return hsk_chain_invert_lowest_one(height);
+}
+
+// Point the hash map at a new copy of an entry.
+// Keys are not copied by the map, so the old
+// key has to be removed first.
+static void
+hsk_chain_move(hsk_chain_t *chain, hsk_entry_t *from, hsk_entry_t *to) {
+  memcpy((void *)to, (void *)from, sizeof(hsk_entry_t));
+  hsk_hmap_del(&chain->hashes, from->hash);
+  assert(hsk_hmap_set(&chain->hashes, to->hash, (void *)to));
+}
+
 /*
  * Chain
  */
@@ -67,11 +220,30 @@ hsk_chain_init(hsk_chain_t *chain, const hsk_timedata_t *td) {
   chain->genesis = NULL;
   chain->synced = false;
   chain->td = (hsk_timedata_t *)td;
-
-  hsk_map_init_hash_map(&chain->hashes, free);
-  hsk_map_init_int_map(&chain->heights, NULL);
-  hsk_map_init_hash_map(&chain->orphans, free);
-  hsk_map_init_hash_map(&chain->prevs, NULL);
+  chain->chunks = NULL;
+  chain->chunks_size = 0;
+  chain->times_size = 0;
+  hsk_u256_from_int(&chain->targets, 0);
+  chain->targets_hi = 0;
+  chain->store = NULL;
+  memset(chain->views, 0, sizeof(chain->views));
+  memset(chain->view_seqs, 0, sizeof(chain->view_seqs));
+  chain->view = NULL;
+  chain->view_pos = 0;
+  chain->locator_count = 0;
+  chain->locator_height = -1;
+  memset(chain->locator_tip, 0, 32);
+  chain->added = 0;
+  chain->pow_count = 0;
+  chain->pow_time = 0;
+  chain->check_time = 0;
+  chain->progress_time = 0;
+  chain->progress_height = 0;
+  chain->progress_rate = 0;
+  chain->sync_start = hsk_now();
+
+  hsk_hmap_init(&chain->hashes, NULL);
+  hsk_orphans_init(&chain->orphans);
 
   return hsk_chain_init_genesis(chain);
 }
@@ -81,32 +253,35 @@ hsk_chain_init_genesis(hsk_chain_t *chain) {
   if (!chain)
     return HSK_EBADARGS;
 
-  hsk_header_t *tip = hsk_header_alloc();
-
-  if (!tip)
-    return HSK_ENOMEM;
+  hsk_header_t hdr;
+  hsk_header_init(&hdr);
 
   uint8_t *data = (uint8_t *)HSK_GENESIS;
   size_t size = sizeof(HSK_GENESIS) - 1;
 
-  assert(hsk_header_decode(data, size, tip));
-  assert(hsk_header_calc_work(tip, NULL));
+  assert(hsk_header_decode(data, size, &hdr));
 
-  if (!hsk_map_set(&chain->hashes, hsk_header_cache(tip), tip)) {
-    free(tip);
+  if (!hsk_chain_reserve(chain, 0))
     return HSK_ENOMEM;
-  }
 
-  if (!hsk_map_set(&chain->heights, &tip->height, tip)) {
-    hsk_map_del(&chain->hashes, hsk_header_cache(tip));
-    free(tip);
+  hsk_entry_t *tip = hsk_chain_slot(chain, 0);
+
+  hsk_entry_from_header(tip, &hdr);
+  tip->height = 0;
+
+  assert(hsk_entry_calc_work(tip, NULL));
+
+  if (!hsk_hmap_set(&chain->hashes, tip->hash, (void *)tip))
     return HSK_ENOMEM;
-  }
 
   chain->height = tip->height;
   chain->tip = tip;
   chain->genesis = tip;
 
+  tip->mtp = (int64_t)tip->time;
+
+  hsk_chain_reset_window(chain);
+
   hsk_chain_maybe_sync(chain);
 
   return HSK_SUCCESS;
@@ -117,10 +292,44 @@ hsk_chain_uninit(hsk_chain_t *chain) {
   if (!chain)
     return;
 
-  hsk_map_uninit(&chain->heights);
-  hsk_map_uninit(&chain->hashes);
-  hsk_map_uninit(&chain->prevs);
-  hsk_map_uninit(&chain->orphans);
+  // Alternate chain entries live on the heap,
+  // everything else is owned by the chunks.
+  hsk_map_iter_t i;
+
+  hsk_hmap_settle(&chain->hashes);
+
+  for (i = hsk_hmap_begin(&chain->hashes);
+       i < hsk_hmap_end(&chain->hashes); i++) {
+    if (!hsk_hmap_exists(&chain->hashes, i))
+      continue;
+
+    hsk_entry_t *entry = hsk_hmap_value(&chain->hashes, i);
+
+    if (!hsk_chain_is_main(chain, entry))
+      hsk_free(entry);
+  }
+
+  hsk_hmap_uninit(&chain->hashes);
+  hsk_orphans_uninit(&chain->orphans);
+
+  size_t c;
+  for (c = 0; c < chain->chunks_size; c++) {
+    if (!chain->chunks[c])
+      continue;
+
+    hsk_mem_sub(HSK_MEM_CHAIN, HSK_CHAIN_CHUNK * sizeof(hsk_entry_t));
+    hsk_free(chain->chunks[c]);
+  }
+
+  hsk_free(chain->chunks);
+
+  chain->chunks = NULL;
+  chain->chunks_size = 0;
+
+  if (chain->store) {
+    hsk_store_free(chain->store);
+    chain->store = NULL;
+  }
 
   chain->tip = NULL;
   chain->genesis = NULL;
@@ -128,13 +337,13 @@ hsk_chain_uninit(hsk_chain_t *chain) {
 
 hsk_chain_t *
 hsk_chain_alloc(const hsk_timedata_t *td) {
-  hsk_chain_t *chain = malloc(sizeof(hsk_chain_t));
+  hsk_chain_t *chain = hsk_malloc(sizeof(hsk_chain_t));
 
   if (!chain)
     return NULL;
 
   if (hsk_chain_init(chain, td) != HSK_SUCCESS) {
-    free(chain);
+    hsk_free(chain);
     return NULL;
   }
 
@@ -147,46 +356,283 @@ hsk_chain_free(hsk_chain_t *chain) {
     return;
 
   hsk_chain_uninit(chain);
-  free(chain);
+  hsk_free(chain);
+}
+
+static int
+hsk_chain_replay(hsk_chain_t *chain) {
+  hsk_store_t *store = chain->store;
+  hsk_entry_t *prev = chain->tip;
+  uint32_t height;
+
+  assert(store && prev);
+
+  if (!hsk_hmap_reserve(&chain->hashes, store->height + 1))
+    return HSK_ENOMEM;
+
+  for (height = prev->height + 1; height <= store->height; height++) {
+    hsk_entry_t entry;
+
+    if (!hsk_store_read(store, height, &entry)
+        || memcmp(entry.prev_block, prev->hash, 32) != 0) {
+      hsk_chain_log(chain, "header store corrupt at height %u\n", height);
+      break;
+    }
+
+    assert(hsk_entry_calc_work(&entry, prev));
+
+    const hsk_entry_t *skip = hsk_chain_slot(chain,
+      hsk_chain_skip_height(height));
+
+    memcpy(entry.skip, skip->hash, 32);
+
+    if (!hsk_chain_reserve(chain, height))
+      return HSK_ENOMEM;
+
+    hsk_entry_t *slot = hsk_chain_slot(chain, height);
+
+    memcpy((void *)slot, (void *)&entry, sizeof(hsk_entry_t));
+
+    if (!hsk_hmap_set(&chain->hashes, slot->hash, (void *)slot))
+      return HSK_ENOMEM;
+
+    chain->height = height;
+    chain->tip = slot;
+
+    hsk_chain_push_window(chain);
+
+    prev = slot;
+  }
+
+  // Roll the tip back if the tail was torn.
+  if (prev->height != store->height || memcmp(prev->hash, store->tip, 32) != 0) {
+    if (!hsk_store_set_tip(store, prev->height, prev->hash))
+      return HSK_EFAILURE;
+  }
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_chain_open(hsk_chain_t *chain, const char *prefix) {
+  if (!chain || !prefix)
+    return HSK_EBADARGS;
+
+  assert(!chain->store);
+  assert(chain->tip == chain->genesis);
+
+  hsk_store_t *store = hsk_store_alloc();
+
+  if (!store)
+    return HSK_ENOMEM;
+
+  int rc = hsk_store_open(store, prefix);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_store_free(store);
+    return rc;
+  }
+
+  chain->store = store;
+
+  if (store->height == 0) {
+    if (!hsk_store_write(store, chain->genesis)
+        || !hsk_store_set_tip(store, 0, chain->genesis->hash)) {
+      return HSK_EFAILURE;
+    }
+    return HSK_SUCCESS;
+  }
+
+  rc = hsk_chain_replay(chain);
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  hsk_chain_log(chain, "loaded %u headers from disk\n", (uint32_t)chain->height);
+
+  hsk_chain_maybe_sync(chain);
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_chain_write(hsk_chain_t *chain, const hsk_entry_t *entry) {
+  if (!chain->store)
+    return;
+
+  if (!hsk_store_write(chain->store, entry))
+    hsk_chain_log(chain, "could not write header to store\n");
 }
 
 static void
 hsk_chain_log(const hsk_chain_t *chain, const char *fmt, ...) {
-  printf("chain (%u): ", (uint32_t)chain->height);
+  char prefix[32];
+  sprintf(prefix, "chain (%u): ", (uint32_t)chain->height);
 
   va_list args;
   va_start(args, fmt);
-  vprintf(fmt, args);
+  hsk_log_vprintf(prefix, fmt, args);
   va_end(args);
 }
 
 bool
 hsk_chain_has(const hsk_chain_t *chain, const uint8_t *hash) {
-  return hsk_map_has(&chain->hashes, hash);
+  return hsk_hmap_has(&chain->hashes, hash);
 }
 
-hsk_header_t *
+hsk_entry_t *
 hsk_chain_get(const hsk_chain_t *chain, const uint8_t *hash) {
-  return hsk_map_get(&chain->hashes, hash);
+  return hsk_hmap_get(&chain->hashes, hash);
 }
 
-hsk_header_t *
+hsk_entry_t *
 hsk_chain_get_by_height(const hsk_chain_t *chain, uint32_t height) {
-  return hsk_map_get(&chain->heights, &height);
+  if ((int64_t)height > chain->height)
+    return NULL;
+
+  return hsk_chain_slot(chain, height);
 }
 
 bool
 hsk_chain_has_orphan(const hsk_chain_t *chain, const uint8_t *hash) {
-  return hsk_map_has(&chain->orphans, hash);
+  return hsk_orphans_has(&chain->orphans, hash);
 }
 
 hsk_header_t *
 hsk_chain_get_orphan(const hsk_chain_t *chain, const uint8_t *hash) {
-  return hsk_map_get(&chain->orphans, hash);
+  return hsk_orphans_get(&chain->orphans, hash);
 }
 
+// Only for the chain's own thread: others go
+// through hsk_chain_get_view.
 const uint8_t *
 hsk_chain_safe_root(const hsk_chain_t *chain) {
+  assert(chain->view);
+  return chain->view->safe_root;
+}
+
+hsk_entry_t *
+hsk_chain_get_ancestor(
+  const hsk_chain_t *chain,
+  const hsk_entry_t *entry,
+  uint32_t height
+) {
+  assert(height >= 0);
+  assert(height <= entry->height);
+
+  hsk_entry_t *e = (hsk_entry_t *)entry;
+
+  while (e->height != height) {
+    // Everything below a main chain
+    // entry is a plain array lookup.
+    if (hsk_chain_is_main(chain, e))
+      return hsk_chain_slot(chain, height);
+
+    uint32_t skip = hsk_chain_skip_height(e->height);
+    uint32_t skip_prev = hsk_chain_skip_height(e->height - 1);
+
+    // Only follow the skip pointer if it does
+    // not overshoot, and if the previous entry's
+    // pointer would not be clearly better.
+    if (skip == height
+        || (skip > height
+            && !(skip_prev + 2 < skip && skip_prev >= height))) {
+      e = hsk_hmap_get(&chain->hashes, e->skip);
+    } else {
+      e = hsk_chain_get_prev(chain, e);
+    }
+
+    assert(e);
+  }
+
+  return e;
+}
+
+bool
+hsk_chain_below_checkpoint(const hsk_chain_t *chain, uint32_t height) {
+  assert(chain);
+
+  if (!HSK_USE_CHECKPOINTS)
+    return false;
+
+  return height <= HSK_LAST_CHECKPOINT;
+}
+
+static void
+hsk_chain_rewind(hsk_chain_t *chain, uint32_t height) {
+  assert((int64_t)height <= chain->height);
+
+  while (chain->height > (int64_t)height) {
+    hsk_entry_t *entry = chain->tip;
+
+    hsk_hmap_del(&chain->hashes, entry->hash);
+
+    chain->height -= 1;
+    chain->tip = hsk_chain_slot(chain, (uint32_t)chain->height);
+  }
+
+  hsk_chain_reset_window(chain);
+
+  if (chain->store) {
+    if (!hsk_store_set_tip(chain->store, height, chain->tip->hash))
+      hsk_chain_log(chain, "could not write tip to store\n");
+  }
+
+  hsk_chain_log(chain, "rewound to height %u\n", height);
+
+  hsk_chain_publish(chain);
+}
+
+static bool
+hsk_chain_has_work(const hsk_chain_t *chain) {
+  return memcmp(chain->tip->work, HSK_CHAINWORK, 32) >= 0;
+}
+
+static bool
+hsk_chain_is_synced(const hsk_chain_t *chain) {
+  int64_t now = hsk_timedata_now(chain->td);
+
+  if (now < HSK_LAUNCH_DATE)
+    return true;
+
+  if (HSK_USE_CHECKPOINTS) {
+    if (chain->height < HSK_LAST_CHECKPOINT)
+      return false;
+  }
+
+  if (((int64_t)chain->tip->time) < now - HSK_MAX_TIP_AGE)
+    return false;
+
+  return hsk_chain_has_work(chain);
+}
+
+// Called whenever the tip moves.
+static void
+hsk_chain_maybe_sync(hsk_chain_t *chain) {
+  if (!chain->synced && hsk_chain_is_synced(chain)) {
+    hsk_chain_log(chain,
+      "chain is fully synced (%lu headers in %lds)\n",
+      chain->added, (long)(hsk_now() - chain->sync_start));
+    chain->synced = true;
+  }
+
+  hsk_chain_publish(chain);
+}
+
+// Writes the next view while readers copy the
+// current one, then swaps it in. Each view has
+// a sequence number, odd while it is written.
+static void
+hsk_chain_publish(hsk_chain_t *chain) {
+  const hsk_chain_view_t *cur = chain->view;
+
+  if (cur
+      && cur->height == chain->height
+      && cur->synced == chain->synced
+      && memcmp(cur->tip, chain->tip->hash, 32) == 0) {
+    return;
+  }
+
   // The tree is committed on an interval.
   // Mainnet is 72 blocks, meaning at height 72,
   // the name set of the past 72 blocks are
@@ -201,133 +647,348 @@ hsk_chain_safe_root(const hsk_chain_t *chain) {
   uint32_t mod = (uint32_t)chain->height % interval;
   uint32_t height = (uint32_t)chain->height - mod;
 
-  hsk_header_t *prev = hsk_chain_get_by_height(chain, height);
+  hsk_entry_t *prev = hsk_chain_get_by_height(chain, height);
   assert(prev);
 
-  hsk_chain_log(chain,
-    "using safe height of %u for resolution\n",
-    height);
+  size_t pos = (chain->view_pos + 1) % HSK_CHAIN_VIEWS;
+  hsk_chain_view_t *view = &chain->views[pos];
+  uint32_t *seq = &chain->view_seqs[pos];
 
-  return prev->name_root;
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  view->height = chain->height;
+  memcpy(view->tip, chain->tip->hash, 32);
+  view->safe_height = height;
+  memcpy(view->safe_root, prev->name_root, 32);
+  view->synced = chain->synced;
+
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&chain->view, view, __ATOMIC_RELEASE);
+
+  chain->view_pos = pos;
+
+  if (!cur || cur->safe_height != height) {
+    hsk_chain_log(chain,
+      "using safe height of %u for resolution\n",
+      height);
+  }
 }
 
-static hsk_header_t *
-hsk_chain_resolve_orphan(hsk_chain_t *chain, const uint8_t *hash) {
-  hsk_header_t *orphan = hsk_map_get(&chain->prevs, hash);
+// Safe from any thread. Retries only if the
+// chain laps the views while we copy.
+void
+hsk_chain_get_view(const hsk_chain_t *chain, hsk_chain_view_t *view) {
+  assert(chain && view);
 
-  if (!orphan)
-    return NULL;
+  for (;;) {
+    const hsk_chain_view_t *cur = __atomic_load_n(&chain->view,
+                                                  __ATOMIC_ACQUIRE);
+    const uint32_t *seq = &chain->view_seqs[cur - chain->views];
+    uint32_t start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+
+    if (start & 1)
+      continue;
 
-  hsk_map_del(&chain->prevs, orphan->prev_block);
-  hsk_map_del(&chain->orphans, hsk_header_cache(orphan));
+    memcpy(view, cur, sizeof(hsk_chain_view_t));
 
-  return orphan;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(seq, __ATOMIC_RELAXED) == start)
+      return;
+  }
 }
 
-hsk_header_t *
-hsk_chain_get_ancestor(
+bool
+hsk_chain_synced(const hsk_chain_t *chain) {
+  return chain->synced;
+}
+
+/*
+ * Progress
+ */
+
+// Proofs of work checked elsewhere (e.g. on
+// the pool's worker threads), in nanoseconds.
+void
+hsk_chain_count_pow(hsk_chain_t *chain, uint64_t count, uint64_t time) {
+  assert(chain);
+
+  chain->pow_count += count;
+  chain->pow_time += time;
+}
+
+void
+hsk_chain_get_progress(const hsk_chain_t *chain, hsk_chain_progress_t *p) {
+  assert(chain && p);
+
+  int64_t now = hsk_timedata_now(chain->td);
+  int64_t estimate = 0;
+
+  if (now > HSK_LAUNCH_DATE)
+    estimate = (now - HSK_LAUNCH_DATE) / HSK_TARGET_SPACING;
+
+  if (estimate < chain->height)
+    estimate = chain->height;
+
+  p->height = chain->height;
+  p->estimate = estimate;
+  p->headers = chain->added;
+  p->rate = chain->progress_rate;
+  p->remaining = -1;
+
+  if (chain->synced)
+    p->remaining = 0;
+  else if (p->rate > 0)
+    p->remaining = (estimate - chain->height) / (int64_t)p->rate;
+
+  p->pow_count = chain->pow_count;
+  p->pow_time = chain->pow_time / 1000;
+  p->check_time = chain->check_time / 1000;
+}
+
+// Measures the rate since the last call, and
+// logs a summary while syncing. The pool calls
+// it every ten seconds.
+void
+hsk_chain_log_progress(hsk_chain_t *chain) {
+  assert(chain);
+
+  int64_t now = hsk_now();
+
+  if (chain->progress_time && now > chain->progress_time) {
+    int64_t added = chain->height - chain->progress_height;
+
+    if (added < 0)
+      added = 0;
+
+    chain->progress_rate = (uint64_t)added / (now - chain->progress_time);
+  }
+
+  chain->progress_time = now;
+  chain->progress_height = chain->height;
+
+  if (chain->synced)
+    return;
+
+  hsk_chain_progress_t p;
+  hsk_chain_get_progress(chain, &p);
+
+  uint64_t checks = p.pow_time + p.check_time;
+  uint64_t pow = checks > 0 ? p.pow_time * 100 / checks : 0;
+
+  if (p.remaining < 0) {
+    hsk_chain_log(chain,
+      "sync: height %ld of ~%ld, %lu headers/s, pow %lu%% of checks\n",
+      (long)p.height, (long)p.estimate, p.rate, pow);
+  } else {
+    hsk_chain_log(chain,
+      "sync: height %ld of ~%ld, %lu headers/s, ~%lds left, "
+      "pow %lu%% of checks\n",
+      (long)p.height, (long)p.estimate, p.rate, (long)p.remaining, pow);
+  }
+}
+
+// Built once per tip: every hash but the genesis
+// moves when the tip does, so it is rebuilt
+// rather than updated.
+static void
+hsk_chain_build_locator(hsk_chain_t *chain) {
+  const int max = HSK_CHAIN_LOCATOR;
+  int i = 0;
+  hsk_entry_t *tip = chain->tip;
+  int64_t height = chain->height;
+  int64_t step = 1;
+
+  memcpy(chain->locator[i++], tip->hash, 32);
+
+  while (height > 0) {
+    height -= step;
+
+    if (height < 0)
+      height = 0;
+
+    if (i > 10)
+      step *= 2;
+
+    // Always end with genesis.
+    if (i == max - 1)
+      height = 0;
+
+    hsk_entry_t *entry = hsk_chain_get_by_height(chain, (uint32_t)height);
+    assert(entry);
+
+    memcpy(chain->locator[i++], entry->hash, 32);
+  }
+
+  chain->locator_count = i;
+  chain->locator_height = chain->height;
+  memcpy(chain->locator_tip, tip->hash, 32);
+}
+
+void
+hsk_chain_get_locator(hsk_chain_t *chain, hsk_getheaders_msg_t *msg) {
+  assert(chain && msg);
+
+  assert(sizeof(msg->hashes) == sizeof(chain->locator));
+
+  if (chain->locator_count == 0
+      || chain->locator_height != chain->height
+      || memcmp(chain->locator_tip, chain->tip->hash, 32) != 0) {
+    hsk_chain_build_locator(chain);
+  }
+
+  memcpy(msg->hashes, chain->locator, chain->locator_count * 32);
+  msg->hash_count = chain->locator_count;
+}
+
+// The tip and the blocks just below it: enough
+// for a peer a few blocks ahead of us.
+void
+hsk_chain_get_tip_locator(
   const hsk_chain_t *chain,
-  const hsk_header_t *hdr,
-  uint32_t height
+  hsk_getheaders_msg_t *msg,
+  int count
 ) {
-  assert(height >= 0);
-  assert(height <= hdr->height);
+  assert(chain && msg);
+
+  const int max = sizeof(msg->hashes) / sizeof(msg->hashes[0]);
+  int64_t height = chain->height;
+  int i = 0;
+
+  assert(count > 0 && count <= max);
+
+  while (i < count && height >= 0) {
+    hsk_entry_t *entry = hsk_chain_get_by_height(chain, (uint32_t)height);
+    assert(entry);
+
+    memcpy(msg->hashes[i++], entry->hash, 32);
+
+    height -= 1;
+  }
+
+  msg->hash_count = i;
+}
+
+static void
+hsk_chain_window_target(const hsk_entry_t *entry, hsk_u256_t *n) {
+  uint8_t target[32];
+  assert(hsk_pow_to_target(entry->bits, target));
+  hsk_u256_from_array(n, target);
+}
 
-  hsk_header_t *h = (hsk_header_t *)hdr;
+// Recompute the median time and target windows
+// for the current tip (genesis, reorg, rewind).
+static void
+hsk_chain_reset_window(hsk_chain_t *chain) {
+  const hsk_entry_t *entry = chain->tip;
+  size_t size = 0;
 
-  while (h->height != height) {
-    h = hsk_map_get(&chain->hashes, h->prev_block);
-    assert(h);
+  while (entry && size < HSK_MEDIAN_TIMESPAN) {
+    chain->times[size++] = (int64_t)entry->time;
+    entry = hsk_chain_get_prev(chain, entry);
   }
 
-  return h;
-}
+  qsort((void *)chain->times, size, sizeof(int64_t), qsort_cmp);
 
-static bool
-hsk_chain_has_work(const hsk_chain_t *chain) {
-  return memcmp(chain->tip->work, HSK_CHAINWORK, 32) >= 0;
-}
+  chain->times_size = size;
 
-static void
-hsk_chain_maybe_sync(hsk_chain_t *chain) {
-  if (chain->synced)
-    return;
+  hsk_u256_from_int(&chain->targets, 0);
+  chain->targets_hi = 0;
 
-  int64_t now = hsk_timedata_now(chain->td);
+  entry = chain->tip;
 
-  if (now < HSK_LAUNCH_DATE) {
-    hsk_chain_log(chain, "chain is fully synced\n");
-    chain->synced = true;
-    return;
+  int64_t i;
+  for (i = 0; entry && i < HSK_TARGET_WINDOW; i++) {
+    hsk_u256_t target_n;
+    hsk_chain_window_target(entry, &target_n);
+    chain->targets_hi += hsk_u256_add(&chain->targets, &chain->targets,
+                                      &target_n);
+    entry = hsk_chain_get_prev(chain, entry);
   }
+}
 
-  if (HSK_USE_CHECKPOINTS) {
-    if (chain->height < HSK_LAST_CHECKPOINT)
-      return;
-  }
+// Slide both windows forward by one after
+// the tip has been extended, and compute the
+// new tip's median time past along the way.
+static void
+hsk_chain_push_window(hsk_chain_t *chain) {
+  hsk_entry_t *tip = chain->tip;
+  int64_t *times = chain->times;
+  size_t size = chain->times_size;
+  size_t i;
 
-  if (((int64_t)chain->tip->time) < now - HSK_MAX_TIP_AGE)
-    return;
+  assert(tip->height > 0);
 
-  if (!hsk_chain_has_work(chain))
-    return;
+  if (size == HSK_MEDIAN_TIMESPAN) {
+    const hsk_entry_t *old = hsk_chain_slot(chain,
+      tip->height - HSK_MEDIAN_TIMESPAN);
 
-  hsk_chain_log(chain, "chain is fully synced\n");
-  chain->synced = true;
-}
+    assert(old);
 
-bool
-hsk_chain_synced(const hsk_chain_t *chain) {
-  return chain->synced;
-}
+    for (i = 0; i < size; i++) {
+      if (times[i] == (int64_t)old->time)
+        break;
+    }
 
-void
-hsk_chain_get_locator(const hsk_chain_t *chain, hsk_getheaders_msg_t *msg) {
-  assert(chain && msg);
+    assert(i < size);
 
-  int i = 0;
-  hsk_header_t *tip = chain->tip;
-  int64_t height = chain->height;
-  int64_t step = 1;
+    memmove(&times[i], &times[i + 1], (size - i - 1) * sizeof(int64_t));
+    size -= 1;
+  }
 
-  hsk_header_hash(tip, msg->hashes[i++]);
+  for (i = size; i > 0 && times[i - 1] > (int64_t)tip->time; i--)
+    times[i] = times[i - 1];
 
-  while (height > 0) {
-    height -= step;
+  times[i] = (int64_t)tip->time;
+  size += 1;
 
-    if (height < 0)
-      height = 0;
+  chain->times_size = size;
 
-    if (i > 10)
-      step *= 2;
+  tip->mtp = times[size >> 1];
 
-    if (i == sizeof(msg->hashes) - 1)
-      height = 0;
+  hsk_u256_t target_n;
+  hsk_chain_window_target(tip, &target_n);
+  chain->targets_hi += hsk_u256_add(&chain->targets, &chain->targets,
+                                    &target_n);
+
+  if (tip->height >= HSK_TARGET_WINDOW) {
+    const hsk_entry_t *old = hsk_chain_slot(chain,
+      tip->height - HSK_TARGET_WINDOW);
 
-    hsk_header_t *hdr = hsk_chain_get_by_height(chain, (uint32_t)height);
-    assert(hdr);
+    assert(old);
 
-    hsk_header_hash(hdr, msg->hashes[i++]);
+    hsk_chain_window_target(old, &target_n);
+    chain->targets_hi -= hsk_u256_sub(&chain->targets, &chain->targets,
+                                      &target_n);
   }
+}
 
-  msg->hash_count = i;
+static int64_t
+hsk_chain_get_mtp(const hsk_chain_t *chain, const hsk_entry_t *prev) {
+  assert(chain);
+
+  if (!prev)
+    return 0;
+
+  return prev->mtp;
 }
 
 static int64_t
-hsk_chain_get_mtp(const hsk_chain_t *chain, const hsk_header_t *prev) {
+hsk_chain_calc_mtp(const hsk_chain_t *chain, const hsk_entry_t *prev) {
   assert(chain);
 
   if (!prev)
     return 0;
 
-  int timespan = 11;
-  int64_t median[11];
+  int timespan = HSK_MEDIAN_TIMESPAN;
+  int64_t median[HSK_MEDIAN_TIMESPAN];
   size_t size = 0;
   int i;
 
   for (i = 0; i < timespan && prev; i++) {
     median[i] = (int64_t)prev->time;
-    prev = hsk_map_get(&chain->hashes, prev->prev_block);
+    prev = hsk_chain_get_prev(chain, prev);
     size += 1;
   }
 
@@ -337,7 +998,7 @@ hsk_chain_get_mtp(const hsk_chain_t *chain, const hsk_header_t *prev) {
 }
 
 static uint32_t
-hsk_chain_retarget(const hsk_chain_t *chain, const hsk_header_t *prev) {
+hsk_chain_retarget(const hsk_chain_t *chain, const hsk_entry_t *prev) {
   assert(chain);
 
   uint32_t bits = HSK_BITS;
@@ -351,29 +1012,37 @@ hsk_chain_retarget(const hsk_chain_t *chain, const hsk_header_t *prev) {
   if (!prev)
     return bits;
 
-  hsk_bn_t target_bn;
-  hsk_bn_init(&target_bn);
+  if ((int64_t)prev->height < window + 1)
+    return bits;
 
-  hsk_header_t *last = (hsk_header_t *)prev;
-  hsk_header_t *first = last;
+  hsk_u256_t target_n;
+  uint64_t target_hi;
 
-  int64_t i;
-  for (i = 0; first && i < window; i++) {
-    uint8_t diff[32];
-    assert(hsk_pow_to_target(first->bits, diff));
-    hsk_bn_t diff_bn;
-    hsk_bn_from_array(&diff_bn, diff, 32);
-    hsk_bn_add(&target_bn, &diff_bn, &target_bn);
-    first = hsk_map_get(&chain->hashes, first->prev_block);
-  }
+  const hsk_entry_t *last = prev;
+  const hsk_entry_t *first = hsk_chain_get_ancestor(chain, last,
+    last->height - (uint32_t)window);
 
-  if (!first || first->height < 1)
-    return bits;
+  if (last == chain->tip) {
+    // Usual case: the tip's window is kept
+    // up to date as the chain grows.
+    target_n = chain->targets;
+    target_hi = chain->targets_hi;
+  } else {
+    const hsk_entry_t *entry = last;
+
+    hsk_u256_from_int(&target_n, 0);
+    target_hi = 0;
 
-  hsk_bn_t window_bn;
-  hsk_bn_from_int(&window_bn, (uint64_t)window);
+    int64_t i;
+    for (i = 0; i < window; i++) {
+      hsk_u256_t diff_n;
+      hsk_chain_window_target(entry, &diff_n);
+      target_hi += hsk_u256_add(&target_n, &target_n, &diff_n);
+      entry = hsk_chain_get_prev(chain, entry);
+    }
+  }
 
-  hsk_bn_div(&target_bn, &window_bn, &target_bn);
+  hsk_u256_div_u32(&target_n, &target_n, target_hi, (uint32_t)window);
 
   int64_t start = hsk_chain_get_mtp(chain, first);
   int64_t end = hsk_chain_get_mtp(chain, last);
@@ -386,23 +1055,19 @@ hsk_chain_retarget(const hsk_chain_t *chain, const hsk_header_t *prev) {
   if (actual > max)
     actual = max;
 
-  hsk_bn_t actual_bn;
-  hsk_bn_from_int(&actual_bn, (uint64_t)actual);
+  hsk_u256_div_u32(&target_n, &target_n, 0, (uint32_t)timespan);
 
-  hsk_bn_t timespan_bn;
-  hsk_bn_from_int(&timespan_bn, (uint64_t)timespan);
-
-  hsk_bn_div(&target_bn, &timespan_bn, &target_bn);
-  hsk_bn_mul(&target_bn, &actual_bn, &target_bn);
+  if (hsk_u256_mul_u32(&target_n, &target_n, (uint32_t)actual) != 0)
+    return bits;
 
-  hsk_bn_t limit_bn;
-  hsk_bn_from_array(&limit_bn, limit, 32);
+  hsk_u256_t limit_n;
+  hsk_u256_from_array(&limit_n, limit);
 
-  if (hsk_bn_cmp(&target_bn, &limit_bn) > 0)
+  if (hsk_u256_cmp(&target_n, &limit_n) > 0)
     return bits;
 
   uint8_t target[32];
-  hsk_bn_to_array(&target_bn, target, 32);
+  hsk_u256_to_array(&target_n, target);
 
   uint32_t cmpct;
 
@@ -415,7 +1080,7 @@ static uint32_t
 hsk_chain_get_target(
   const hsk_chain_t *chain,
   int64_t time,
-  const hsk_header_t *prev
+  const hsk_entry_t *prev
 ) {
   assert(chain);
 
@@ -437,99 +1102,153 @@ hsk_chain_get_target(
   return hsk_chain_retarget(chain, prev);
 }
 
-static hsk_header_t *
+static hsk_entry_t *
 hsk_chain_find_fork(
   const hsk_chain_t *chain,
-  hsk_header_t *fork,
-  hsk_header_t *longer
+  hsk_entry_t *fork,
+  hsk_entry_t *longer
 ) {
   assert(chain && fork && longer);
+  assert(hsk_chain_is_main(chain, fork));
 
-  while (!hsk_header_equal(fork, longer)) {
-    while (longer->height > fork->height) {
-      longer = hsk_map_get(&chain->hashes, longer->prev_block);
-      if (!longer)
-        return NULL;
-    }
+  // The fork point is the highest ancestor of
+  // `longer` on the main chain. Everything below
+  // it is on the main chain as well, so we can
+  // binary search over skip list lookups.
+  uint32_t lo = 0;
+  uint32_t hi = longer->height;
+
+  if (hi > fork->height)
+    hi = fork->height;
 
-    if (hsk_header_equal(fork, longer))
-      return fork;
+  hsk_entry_t *entry = hsk_chain_get_ancestor(chain, longer, hi);
 
-    fork = hsk_map_get(&chain->hashes, fork->prev_block);
+  if (hsk_chain_is_main(chain, entry))
+    return entry;
 
-    if (!fork)
-      return NULL;
+  // Invariant: `lo` is on the main chain, `hi` is not.
+  while (hi - lo > 1) {
+    uint32_t mid = lo + ((hi - lo) >> 1);
+
+    entry = hsk_chain_get_ancestor(chain, longer, mid);
+
+    if (hsk_chain_is_main(chain, entry))
+      lo = mid;
+    else
+      hi = mid;
   }
 
-  return fork;
+  return hsk_chain_slot(chain, lo);
 }
 
-static void
-hsk_chain_reorganize(hsk_chain_t *chain, hsk_header_t *competitor) {
+static int
+hsk_chain_reorganize(hsk_chain_t *chain, hsk_entry_t *competitor) {
   assert(chain && competitor);
 
-  hsk_header_t *tip = chain->tip;
-  hsk_header_t *fork = hsk_chain_find_fork(chain, tip, competitor);
+  hsk_entry_t *tip = chain->tip;
+  hsk_entry_t *fork = hsk_chain_find_fork(chain, tip, competitor);
 
   assert(fork);
 
-  // Blocks to disconnect.
-  hsk_header_t *disconnect = NULL;
-  hsk_header_t *entry = tip;
-  hsk_header_t *tail = NULL;
-  while (!hsk_header_equal(entry, fork)) {
-    assert(!entry->next);
+  // Blocks to connect (alternate chain
+  // entries, collected backwards).
+  size_t count = competitor->height - fork->height;
+  hsk_entry_t **connect = hsk_malloc((count + 1) * sizeof(hsk_entry_t *));
 
-    if (!disconnect)
-      disconnect = entry;
-
-    if (tail)
-      tail->next = entry;
+  if (!connect)
+    return HSK_ENOMEM;
 
-    tail = entry;
+  hsk_entry_t *entry = competitor;
+  size_t i = count;
 
-    entry = hsk_map_get(&chain->hashes, entry->prev_block);
+  while (!hsk_entry_equal(entry, fork)) {
+    assert(i > 0);
+    assert(!hsk_chain_is_main(chain, entry));
+    connect[--i] = entry;
+    entry = hsk_chain_get_prev(chain, entry);
     assert(entry);
   }
 
-  // Blocks to connect.
-  entry = competitor;
-  hsk_header_t *connect = NULL;
-  while (!hsk_header_equal(entry, fork)) {
-    assert(!entry->next);
+  assert(i == 0);
 
-    // Build the list backwards.
-    if (connect)
-      entry->next = connect;
+  // Blocks to disconnect (allocated up
+  // front so we cannot fail half way).
+  size_t total = tip->height - fork->height;
+  hsk_entry_t **disconnect = hsk_calloc(total + 1, sizeof(hsk_entry_t *));
+  bool ok = disconnect != NULL;
 
-    connect = entry;
+  for (i = 0; ok && i < total; i++) {
+    disconnect[i] = hsk_malloc(sizeof(hsk_entry_t));
+    ok = disconnect[i] != NULL;
+  }
 
-    entry = hsk_map_get(&chain->hashes, entry->prev_block);
-    assert(entry);
+  if (!ok || !hsk_chain_reserve(chain, competitor->height + 1)) {
+    if (disconnect) {
+      for (i = 0; i < total; i++)
+        hsk_free(disconnect[i]);
+    }
+    hsk_free(disconnect);
+    hsk_free(connect);
+    return HSK_ENOMEM;
   }
 
-  // Disconnect blocks.
-  hsk_header_t *c, *n;
-  for (c = disconnect; c; c = n) {
-    n = c->next;
-    c->next = NULL;
-    hsk_map_del(&chain->heights, &c->height);
+  // Disconnect blocks: move them off of
+  // the main chain onto the heap.
+  for (i = 0; i < total; i++) {
+    hsk_entry_t *slot = hsk_chain_slot(chain, tip->height - i);
+    hsk_chain_move(chain, slot, disconnect[i]);
   }
 
-  // Connect blocks (backwards, save last).
-  for (c = connect; c; c = n) {
-    n = c->next;
-    c->next = NULL;
+  hsk_free(disconnect);
 
-    if (!n) // halt on last
-      break;
+  chain->height = fork->height;
+  chain->tip = fork;
+
+  // Connect blocks.
+  for (i = 0; i < count; i++) {
+    hsk_entry_t *alt = connect[i];
+    hsk_entry_t *slot = hsk_chain_slot(chain, alt->height);
 
-    assert(hsk_map_set(&chain->heights, &c->height, (void *)c));
+    hsk_chain_move(chain, alt, slot);
+    hsk_free(alt);
+
+    chain->height = slot->height;
+    chain->tip = slot;
+
+    hsk_chain_write(chain, slot);
   }
+
+  hsk_free(connect);
+
+  hsk_chain_reset_window(chain);
+
+  return HSK_SUCCESS;
 }
 
-int
-hsk_chain_add(hsk_chain_t *chain, const hsk_header_t *h) {
+static int
+hsk_chain_insert_timed(
+  hsk_chain_t *chain,
+  hsk_header_t *hdr,
+  const hsk_entry_t *prev
+) {
+  uint64_t start = uv_hrtime();
+  int rc = hsk_chain_insert(chain, hdr, prev);
+
+  chain->check_time += uv_hrtime() - start;
+
+  if (rc == HSK_SUCCESS)
+    chain->added += 1;
+
+  return rc;
+}
+
+static int
+hsk_chain_add_header(
+  hsk_chain_t *chain,
+  const hsk_header_t *h,
+  bool verify,
+  uint64_t source
+) {
   if (!chain || !h)
     return HSK_EBADARGS;
 
@@ -543,80 +1262,84 @@ hsk_chain_add(hsk_chain_t *chain, const hsk_header_t *h) {
 
   const uint8_t *hash = hsk_header_cache(hdr);
 
-  hsk_chain_log(chain, "adding block: %s\n", hsk_hex_encode32(hash));
+  hsk_chain_debug(chain, "adding block: %s\n", hsk_hex_encode32(hash));
 
   int64_t now = hsk_timedata_now(chain->td);
 
   if (hdr->time > now + 2 * 60 * 60) {
-    hsk_chain_log(chain, "  rejected: time-too-new\n");
+    hsk_chain_debug(chain, "  rejected: time-too-new\n");
     rc = HSK_ETIMETOONEW;
     goto fail;
   }
 
-  if (hsk_map_has(&chain->hashes, hash)) {
-    hsk_chain_log(chain, "  rejected: duplicate\n");
+  if (hsk_hmap_has(&chain->hashes, hash)) {
+    hsk_chain_debug(chain, "  rejected: duplicate\n");
     rc = HSK_EDUPLICATE;
     goto fail;
   }
 
-  if (hsk_map_has(&chain->orphans, hash)) {
-    hsk_chain_log(chain, "  rejected: duplicate-orphan\n");
+  if (hsk_orphans_has(&chain->orphans, hash)) {
+    hsk_chain_debug(chain, "  rejected: duplicate-orphan\n");
     rc = HSK_EDUPLICATEORPHAN;
     goto fail;
   }
 
-  rc = hsk_header_verify_pow(hdr);
+  hsk_entry_t *prev = hsk_chain_get(chain, hdr->prev_block);
 
-  if (rc != HSK_SUCCESS) {
-    hsk_chain_log(chain, "  rejected: pow error: %s\n", hsk_strerror(rc));
-    goto fail;
-  }
+  // Headers below the last checkpoint are bound
+  // by the checkpoint hashes instead of their
+  // proof of work (see hsk_chain_insert).
+  if (prev && hsk_chain_below_checkpoint(chain, prev->height + 1))
+    verify = false;
 
-  hsk_header_t *prev = hsk_chain_get(chain, hdr->prev_block);
+  if (verify) {
+    uint64_t start = uv_hrtime();
 
-  if (!prev) {
-    hsk_chain_log(chain, "  stored as orphan\n");
+    rc = hsk_header_verify_pow(hdr);
 
-    if (chain->orphans.size > 10000) {
-      hsk_chain_log(chain, "clearing orphans: %d\n", chain->orphans.size);
-      hsk_map_clear(&chain->prevs);
-      hsk_map_clear(&chain->orphans);
-    }
+    hsk_chain_count_pow(chain, 1, uv_hrtime() - start);
 
-    if (!hsk_map_set(&chain->orphans, hash, (void *)hdr)) {
-      rc = HSK_ENOMEM;
+    if (rc != HSK_SUCCESS) {
+      hsk_chain_debug(chain, "  rejected: pow error: %s\n", hsk_strerror(rc));
       goto fail;
     }
+  }
 
-    if (!hsk_map_set(&chain->prevs, hdr->prev_block, (void *)hdr)) {
-      hsk_map_del(&chain->orphans, hash);
-      rc = HSK_ENOMEM;
+  if (!prev) {
+    hsk_chain_debug(chain, "  stored as orphan\n");
+
+    rc = hsk_orphans_add(&chain->orphans, hdr, source);
+
+    if (rc != HSK_SUCCESS)
       goto fail;
-    }
 
     return HSK_EORPHAN;
   }
 
-  rc = hsk_chain_insert(chain, hdr, prev);
+  rc = hsk_chain_insert_timed(chain, hdr, prev);
 
   if (rc != HSK_SUCCESS)
     goto fail;
 
   for (;;) {
-    prev = hdr;
-    hdr = hsk_chain_resolve_orphan(chain, hash);
+    prev = hsk_chain_get(chain, hash);
+    assert(prev);
+
+    hsk_free(hdr);
+
+    hdr = hsk_orphans_resolve(&chain->orphans, prev->hash);
 
     if (!hdr)
       break;
 
     hash = hsk_header_cache(hdr);
 
-    rc = hsk_chain_insert(chain, hdr, prev);
+    rc = hsk_chain_insert_timed(chain, hdr, prev);
 
-    hsk_chain_log(chain, "resolved orphan: %s\n", hsk_hex_encode32(hash));
+    hsk_chain_debug(chain, "resolved orphan: %s\n", hsk_hex_encode32(hash));
 
     if (rc != HSK_SUCCESS) {
-      free(hdr);
+      hsk_free(hdr);
       return rc;
     }
   }
@@ -625,65 +1348,388 @@ hsk_chain_add(hsk_chain_t *chain, const hsk_header_t *h) {
 
 fail:
   if (hdr)
-    free(hdr);
+    hsk_free(hdr);
 
   return rc;
 }
 
+int
+hsk_chain_add(hsk_chain_t *chain, const hsk_header_t *h) {
+  return hsk_chain_add_header(chain, h, true, 0);
+}
+
+int
+hsk_chain_add_verified(
+  hsk_chain_t *chain,
+  const hsk_header_t *h,
+  uint64_t source
+) {
+  // The caller has already checked the proof
+  // of work (e.g. on the pool's worker threads).
+  // `source` is charged for any orphans.
+  return hsk_chain_add_header(chain, h, false, source);
+}
+
 static int
 hsk_chain_insert(
   hsk_chain_t *chain,
   hsk_header_t *hdr,
-  const hsk_header_t *prev
+  const hsk_entry_t *prev
 ) {
-  const uint8_t *hash = hsk_header_cache(hdr);
+  uint32_t height = prev->height + 1;
+
+  if (hsk_chain_below_checkpoint(chain, height)) {
+    if (prev != chain->tip) {
+      hsk_chain_debug(chain, "  rejected: bad-fork-prior-to-checkpoint\n");
+      return HSK_ECHECKPOINT;
+    }
+
+    const uint8_t *expect = hsk_chain_get_checkpoint(height);
+
+    // Nothing we accepted since the previous
+    // checkpoint had its proof of work checked.
+    if (expect && memcmp(hsk_header_cache(hdr), expect, 32) != 0) {
+      hsk_chain_debug(chain, "  rejected: checkpoint-mismatch\n");
+      hsk_chain_rewind(chain, hsk_chain_prev_checkpoint(height));
+      return HSK_ECHECKPOINT;
+    }
+  }
+
   int64_t mtp = hsk_chain_get_mtp(chain, prev);
 
   if ((int64_t)hdr->time <= mtp) {
-    hsk_chain_log(chain, "  rejected: time-too-old\n");
+    hsk_chain_debug(chain, "  rejected: time-too-old\n");
     return HSK_ETIMETOOOLD;
   }
 
   uint32_t bits = hsk_chain_get_target(chain, hdr->time, prev);
 
   if (hdr->bits != bits) {
-    hsk_chain_log(chain,
+    hsk_chain_debug(chain,
       "  rejected: bad-diffbits: %x != %x\n",
       hdr->bits, bits);
     return HSK_EBADDIFFBITS;
   }
 
-  hdr->height = prev->height + 1;
+  hsk_entry_t entry;
+  hsk_entry_from_header(&entry, hdr);
+
+  entry.height = height;
+
+  assert(hsk_entry_calc_work(&entry, prev));
+
+  const hsk_entry_t *skip = hsk_chain_get_ancestor(chain, prev,
+    hsk_chain_skip_height(height));
+
+  memcpy(entry.skip, skip->hash, 32);
+
+  if (memcmp(entry.work, chain->tip->work, 32) <= 0) {
+    hsk_entry_t *alt = hsk_entry_clone(&entry);
+
+    if (alt)
+      alt->mtp = hsk_chain_calc_mtp(chain, alt);
 
-  assert(hsk_header_calc_work(hdr, prev));
+    if (!alt)
+      return HSK_ENOMEM;
 
-  if (memcmp(hdr->work, chain->tip->work, 32) <= 0) {
-    if (!hsk_map_set(&chain->hashes, hash, (void *)hdr))
+    if (!hsk_hmap_set(&chain->hashes, alt->hash, (void *)alt)) {
+      hsk_free(alt);
       return HSK_ENOMEM;
+    }
 
-    hsk_chain_log(chain, "  stored on alternate chain\n");
+    hsk_chain_debug(chain, "  stored on alternate chain\n");
   } else {
-    if (memcmp(hdr->prev_block, hsk_header_cache(chain->tip), 32) != 0) {
-      hsk_chain_log(chain, "  reorganizing...\n");
-      hsk_chain_reorganize(chain, hdr);
+    if (memcmp(entry.prev_block, chain->tip->hash, 32) != 0) {
+      hsk_chain_debug(chain, "  reorganizing...\n");
+
+      // Note: this frees `prev`.
+      int rc = hsk_chain_reorganize(chain, (hsk_entry_t *)prev);
+
+      if (rc != HSK_SUCCESS)
+        return rc;
     }
 
-    if (!hsk_map_set(&chain->hashes, hash, (void *)hdr))
+    assert(memcmp(entry.prev_block, chain->tip->hash, 32) == 0);
+
+    if (!hsk_chain_reserve(chain, entry.height))
       return HSK_ENOMEM;
 
-    if (!hsk_map_set(&chain->heights, &hdr->height, (void *)hdr)) {
-      hsk_map_del(&chain->hashes, hash);
+    hsk_entry_t *tip = hsk_chain_slot(chain, entry.height);
+
+    memcpy((void *)tip, (void *)&entry, sizeof(hsk_entry_t));
+
+    if (!hsk_hmap_set(&chain->hashes, tip->hash, (void *)tip))
       return HSK_ENOMEM;
-    }
 
-    chain->height = hdr->height;
-    chain->tip = hdr;
+    chain->height = tip->height;
+    chain->tip = tip;
 
-    hsk_chain_log(chain, "  added to main chain\n");
-    hsk_chain_log(chain, "  new height: %u\n", (uint32_t)chain->height);
+    hsk_chain_push_window(chain);
+
+    if (chain->store) {
+      hsk_chain_write(chain, tip);
+
+      if (!hsk_store_set_tip(chain->store, tip->height, tip->hash))
+        hsk_chain_log(chain, "could not write tip to store\n");
+    }
+
+    hsk_chain_debug(chain, "  added to main chain\n");
+    hsk_chain_debug(chain, "  new height: %u\n", (uint32_t)chain->height);
 
     hsk_chain_maybe_sync(chain);
   }
 
   return HSK_SUCCESS;
 }
+
+/*
+ * Snapshot
+ */
+
+static bool
+hsk_snapshot_read(FILE *file, uint8_t *data, size_t size) {
+  return fread(data, 1, size, file) == size;
+}
+
+static bool
+hsk_snapshot_write(FILE *file, const uint8_t *data, size_t size) {
+  return fwrite(data, 1, size, file) == size;
+}
+
+int
+hsk_chain_export(const hsk_chain_t *chain, const char *path) {
+  if (!chain || !path)
+    return HSK_EBADARGS;
+
+  char tmp[1024];
+
+  if (strlen(path) + 5 > sizeof(tmp))
+    return HSK_EBADARGS;
+
+  sprintf(tmp, "%s.tmp", path);
+
+  FILE *file = fopen(tmp, "wb");
+
+  if (!file)
+    return HSK_EFAILURE;
+
+  uint8_t raw[HSK_SNAPSHOT_HDR_SIZE];
+  uint8_t *data = raw;
+  size_t i;
+
+  memset(raw, 0, sizeof(raw));
+
+  write_u32(&data, HSK_SNAPSHOT_MAGIC);
+  write_u32(&data, HSK_SNAPSHOT_VERSION);
+  write_u32(&data, HSK_MAGIC);
+  write_u32(&data, (uint32_t)chain->height);
+  write_bytes(&data, chain->tip->hash, 32);
+  write_bytes(&data, chain->tip->work, 32);
+  write_u32(&data, (uint32_t)chain->times_size);
+
+  for (i = 0; i < HSK_MEDIAN_TIMESPAN; i++)
+    write_u64(&data, i < chain->times_size ? (uint64_t)chain->times[i] : 0);
+
+  if (!hsk_snapshot_write(file, raw, sizeof(raw)))
+    goto fail;
+
+  uint32_t height;
+  for (height = 0; height <= (uint32_t)chain->height; height++) {
+    uint8_t rec[HSK_ENTRY_SIZE];
+    hsk_entry_encode(hsk_chain_slot(chain, height), rec);
+
+    if (!hsk_snapshot_write(file, rec, sizeof(rec)))
+      goto fail;
+  }
+
+  if (fflush(file) != 0 || fclose(file) != 0) {
+    remove(tmp);
+    return HSK_EFAILURE;
+  }
+
+  if (rename(tmp, path) != 0) {
+    remove(tmp);
+    return HSK_EFAILURE;
+  }
+
+  hsk_chain_log(chain, "exported %u headers to %s\n",
+                (uint32_t)chain->height, path);
+
+  return HSK_SUCCESS;
+
+fail:
+  fclose(file);
+  remove(tmp);
+  return HSK_EFAILURE;
+}
+
+int
+hsk_chain_import(hsk_chain_t *chain, const char *path) {
+  if (!chain || !path)
+    return HSK_EBADARGS;
+
+  FILE *file = fopen(path, "rb");
+
+  if (!file)
+    return HSK_EFAILURE;
+
+  uint8_t raw[HSK_SNAPSHOT_HDR_SIZE];
+
+  if (!hsk_snapshot_read(file, raw, sizeof(raw))) {
+    fclose(file);
+    return HSK_EENCODING;
+  }
+
+  uint8_t *data = raw;
+  size_t data_len = sizeof(raw);
+  uint32_t magic, version, network, height, times_size;
+  uint8_t tip[32];
+  uint8_t work[32];
+  int64_t times[HSK_MEDIAN_TIMESPAN];
+  size_t i;
+
+  read_u32(&data, &data_len, &magic);
+  read_u32(&data, &data_len, &version);
+  read_u32(&data, &data_len, &network);
+  read_u32(&data, &data_len, &height);
+  read_bytes(&data, &data_len, tip, 32);
+  read_bytes(&data, &data_len, work, 32);
+  read_u32(&data, &data_len, &times_size);
+
+  for (i = 0; i < HSK_MEDIAN_TIMESPAN; i++)
+    read_u64(&data, &data_len, (uint64_t *)&times[i]);
+
+  if (magic != HSK_SNAPSHOT_MAGIC
+      || version != HSK_SNAPSHOT_VERSION
+      || network != HSK_MAGIC
+      || times_size > HSK_MEDIAN_TIMESPAN) {
+    fclose(file);
+    return HSK_EENCODING;
+  }
+
+  if ((int64_t)height <= chain->height) {
+    hsk_chain_log(chain, "snapshot is not ahead of us (height=%u)\n", height);
+    fclose(file);
+    return HSK_SUCCESS;
+  }
+
+  uint32_t start = (uint32_t)chain->height;
+  int rc = HSK_SUCCESS;
+  uint32_t h;
+
+  // Everything we already have must match, after
+  // that each header has to connect to the last
+  // one and carry the difficulty we would expect.
+  // Proofs of work are not checked: the snapshot
+  // is trusted as far as its tip hash and work.
+  for (h = 0; h <= height; h++) {
+    uint8_t rec[HSK_ENTRY_SIZE];
+    hsk_entry_t entry;
+
+    if (!hsk_snapshot_read(file, rec, sizeof(rec))) {
+      rc = HSK_EENCODING;
+      goto fail;
+    }
+
+    hsk_entry_init(&entry);
+
+    if (!hsk_entry_decode(rec, sizeof(rec), &entry)) {
+      rc = HSK_EENCODING;
+      goto fail;
+    }
+
+    entry.height = h;
+
+    if (h <= start) {
+      if (memcmp(entry.hash, hsk_chain_slot(chain, h)->hash, 32) != 0) {
+        hsk_chain_log(chain, "snapshot diverges at height %u\n", h);
+        rc = HSK_EHASHMISMATCH;
+        goto fail;
+      }
+      continue;
+    }
+
+    hsk_entry_t *prev = chain->tip;
+
+    if (memcmp(entry.prev_block, prev->hash, 32) != 0) {
+      hsk_chain_log(chain, "snapshot breaks at height %u\n", h);
+      rc = HSK_EHASHMISMATCH;
+      goto fail;
+    }
+
+    if ((int64_t)entry.time <= prev->mtp) {
+      rc = HSK_ETIMETOOOLD;
+      goto fail;
+    }
+
+    if (entry.bits != hsk_chain_get_target(chain, entry.time, prev)) {
+      rc = HSK_EBADDIFFBITS;
+      goto fail;
+    }
+
+    assert(hsk_entry_calc_work(&entry, prev));
+
+    const hsk_entry_t *skip = hsk_chain_slot(chain, hsk_chain_skip_height(h));
+
+    memcpy(entry.skip, skip->hash, 32);
+
+    if (hsk_chain_has(chain, entry.hash)) {
+      rc = HSK_EDUPLICATE;
+      goto fail;
+    }
+
+    if (!hsk_chain_reserve(chain, h)) {
+      rc = HSK_ENOMEM;
+      goto fail;
+    }
+
+    hsk_entry_t *slot = hsk_chain_slot(chain, h);
+
+    memcpy((void *)slot, (void *)&entry, sizeof(hsk_entry_t));
+
+    if (!hsk_hmap_set(&chain->hashes, slot->hash, (void *)slot)) {
+      rc = HSK_ENOMEM;
+      goto fail;
+    }
+
+    chain->height = h;
+    chain->tip = slot;
+
+    hsk_chain_push_window(chain);
+  }
+
+  fclose(file);
+  file = NULL;
+
+  if (memcmp(chain->tip->hash, tip, 32) != 0
+      || memcmp(chain->tip->work, work, 32) != 0
+      || chain->times_size != times_size
+      || memcmp(chain->times, times, times_size * sizeof(int64_t)) != 0) {
+    hsk_chain_log(chain, "snapshot tip does not match its headers\n");
+    rc = HSK_EHASHMISMATCH;
+    goto fail;
+  }
+
+  if (chain->store) {
+    for (h = start + 1; h <= height; h++)
+      hsk_chain_write(chain, hsk_chain_slot(chain, h));
+
+    if (!hsk_store_set_tip(chain->store, height, chain->tip->hash))
+      hsk_chain_log(chain, "could not write tip to store\n");
+  }
+
+  hsk_chain_log(chain, "imported %u headers from %s\n", height - start, path);
+
+  hsk_chain_maybe_sync(chain);
+
+  return HSK_SUCCESS;
+
+fail:
+  if (file)
+    fclose(file);
+
+  if (chain->height > (int64_t)start)
+    hsk_chain_rewind(chain, start);
+
+  return rc;
+}
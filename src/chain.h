@@ -6,23 +6,112 @@
 #include <stdbool.h>
 
 #include "map.h"
+#include "entry.h"
 #include "header.h"
+#include "hmap.h"
+#include "orphan.h"
+#include "store.h"
 #include "timedata.h"
+#include "u256.h"
+
+/*
+ * Defs
+ */
+
+// Main chain entries are kept in fixed-size
+// chunks so that growing the chain never moves
+// an entry (the hash map points into them).
+#define HSK_CHAIN_CHUNK 4096
+#define HSK_MEDIAN_TIMESPAN 11
+
+// Snapshot header: magic, version, network magic,
+// tip height, tip hash, chainwork and the median
+// time window, padded to 192 bytes. It is followed
+// by every main chain entry, indexed by height.
+#define HSK_SNAPSHOT_MAGIC 0x736b7368
+#define HSK_SNAPSHOT_VERSION 1
+#define HSK_SNAPSHOT_HDR_SIZE 192
+
+// Views of the tip kept for other threads. A
+// reader only retries if this many are
+// published while it copies one.
+#define HSK_CHAIN_VIEWS 4
+
+// Hashes in a getheaders locator.
+#define HSK_CHAIN_LOCATOR 64
 
 /*
  * Types
  */
 
+// How far the sync has come, and how fast.
+// The network's height is estimated from the
+// launch date and the target spacing. Rate is
+// headers per second over the last interval
+// (see hsk_chain_log_progress), and remaining
+// the seconds left at that rate (-1 unknown).
+// Check times are in microseconds: proof of
+// work (here or as reported) and contextual
+// checks (time, bits, work and storage).
+typedef struct hsk_chain_progress_s {
+  int64_t height;
+  int64_t estimate;
+  uint64_t headers;
+  uint64_t rate;
+  int64_t remaining;
+  uint64_t pow_count;
+  uint64_t pow_time;
+  uint64_t check_time;
+} hsk_chain_progress_t;
+
+// The tip as other threads see it. Published
+// whole, after every change to the main chain.
+typedef struct hsk_chain_view_s {
+  int64_t height;
+  uint8_t tip[32];
+  uint32_t safe_height;
+  uint8_t safe_root[32];
+  bool synced;
+} hsk_chain_view_t;
+
 typedef struct hsk_chain_s {
   int64_t height;
-  hsk_header_t *tip;
-  hsk_header_t *genesis;
+  hsk_entry_t *tip;
+  hsk_entry_t *genesis;
   bool synced;
   hsk_timedata_t *td;
-  hsk_map_t hashes;
-  hsk_map_t heights;
-  hsk_map_t orphans;
-  hsk_map_t prevs;
+  hsk_entry_t **chunks;
+  size_t chunks_size;
+  int64_t times[HSK_MEDIAN_TIMESPAN];
+  size_t times_size;
+  // Sum of the tip's target window, with what
+  // overflows 256 bits (a limit near 2^255, as
+  // on simnet, can add up past it).
+  hsk_u256_t targets;
+  uint64_t targets_hi;
+  hsk_hmap_t hashes;
+  hsk_orphans_t orphans;
+  hsk_store_t *store;
+  hsk_chain_view_t views[HSK_CHAIN_VIEWS];
+  uint32_t view_seqs[HSK_CHAIN_VIEWS];
+  hsk_chain_view_t *view;
+  size_t view_pos;
+  // The last locator built, and the tip it was
+  // built for.
+  uint8_t locator[HSK_CHAIN_LOCATOR][32];
+  int locator_count;
+  int64_t locator_height;
+  uint8_t locator_tip[32];
+  // Sync progress, with times in nanoseconds
+  // (see hsk_chain_progress_t).
+  uint64_t added;
+  uint64_t pow_count;
+  uint64_t pow_time;
+  uint64_t check_time;
+  int64_t progress_time;
+  int64_t progress_height;
+  uint64_t progress_rate;
+  int64_t sync_start;
 } hsk_chain_t;
 
 /*
@@ -41,13 +130,22 @@ hsk_chain_alloc(const hsk_timedata_t *td);
 void
 hsk_chain_free(hsk_chain_t *chain);
 
+int
+hsk_chain_open(hsk_chain_t *chain, const char *prefix);
+
+int
+hsk_chain_export(const hsk_chain_t *chain, const char *path);
+
+int
+hsk_chain_import(hsk_chain_t *chain, const char *path);
+
 bool
 hsk_chain_has(const hsk_chain_t *chain, const uint8_t *hash);
 
-hsk_header_t *
+hsk_entry_t *
 hsk_chain_get(const hsk_chain_t *chain, const uint8_t *hash);
 
-hsk_header_t *
+hsk_entry_t *
 hsk_chain_get_by_height(const hsk_chain_t *chain, uint32_t height);
 
 bool
@@ -59,16 +157,38 @@ hsk_chain_get_orphan(const hsk_chain_t *chain, const uint8_t *hash);
 const uint8_t *
 hsk_chain_safe_root(const hsk_chain_t *chain);
 
-hsk_header_t *
+hsk_entry_t *
 hsk_chain_get_ancestor(
   const hsk_chain_t *chain,
-  const hsk_header_t *hdr,
+  const hsk_entry_t *entry,
   uint32_t height
 );
 
+bool
+hsk_chain_below_checkpoint(const hsk_chain_t *chain, uint32_t height);
+
 bool
 hsk_chain_synced(const hsk_chain_t *chain);
 
+void
+hsk_chain_get_view(const hsk_chain_t *chain, hsk_chain_view_t *view);
+
+void
+hsk_chain_count_pow(hsk_chain_t *chain, uint64_t count, uint64_t time);
+
+void
+hsk_chain_get_progress(const hsk_chain_t *chain, hsk_chain_progress_t *p);
+
+void
+hsk_chain_log_progress(hsk_chain_t *chain);
+
 int
 hsk_chain_add(hsk_chain_t *chain, const hsk_header_t *h);
+
+int
+hsk_chain_add_verified(
+  hsk_chain_t *chain,
+  const hsk_header_t *h,
+  uint64_t source
+);
 #endif
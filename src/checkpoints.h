@@ -0,0 +1,71 @@
+#ifndef _HSK_CHECKPOINTS_H
+#define _HSK_CHECKPOINTS_H
+
+#include <stdint.h>
+
+#include "constants.h"
+
+/*
+ * Types
+ */
+
+typedef struct hsk_checkpoint_s {
+  uint32_t height;
+  const uint8_t *hash;
+} hsk_checkpoint_t;
+
+// Sorted by height, terminated by a NULL hash.
+// The highest entry must match the network's
+// HSK_LAST_CHECKPOINT. Hashes are raw bytes.
+
+#if HSK_NETWORK == HSK_MAIN
+
+/*
+ * Main
+ */
+
+static const hsk_checkpoint_t hsk_checkpoints[] = {
+  { 0, NULL }
+};
+
+#elif HSK_NETWORK == HSK_TESTNET
+
+/*
+ * Testnet
+ */
+
+static const hsk_checkpoint_t hsk_checkpoints[] = {
+  { 0, NULL }
+};
+
+#elif HSK_NETWORK == HSK_REGTEST
+
+/*
+ * Regtest
+ */
+
+static const hsk_checkpoint_t hsk_checkpoints[] = {
+  { 0, NULL }
+};
+
+#elif HSK_NETWORK == HSK_SIMNET
+
+/*
+ * Simnet
+ */
+
+static const hsk_checkpoint_t hsk_checkpoints[] = {
+  { 0, NULL }
+};
+
+#else
+
+/*
+ * Bad Network
+ */
+
+#error "Invalid network."
+
+#endif
+
+#endif
@@ -16,6 +16,14 @@
 #define HSK_USER_AGENT "/hnsd:0.0.0/"
 #define HSK_PROTO_VERSION 1
 #define HSK_SERVICES 0
+
+// Peer answers batched proof requests
+// (getproofs). Not part of the hsd protocol.
+#define HSK_SERVICE_PROOFS (1 << 8)
+
+// Peer answers getmultiproof, sending nodes
+// shared by the proofs once.
+#define HSK_SERVICE_MULTIPROOF (1 << 9)
 #define HSK_MAX_DATA_SIZE 654
 #define HSK_MAX_VALUE_SIZE 512
 
@@ -0,0 +1,1055 @@
+#include "config.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "chain.h"
+#include "ctl.h"
+#include "dns.h"
+#include "error.h"
+#include "log.h"
+#include "mem.h"
+#include "ns.h"
+#include "pool.h"
+#include "utils.h"
+#include "uv.h"
+
+// Commands answered on the pool's loop.
+#define HSK_CTL_POOL 0
+#define HSK_CTL_PEERS 1
+
+typedef struct hsk_ctl_buf_s {
+  char *data;
+  size_t len;
+  size_t size;
+  bool failed;
+} hsk_ctl_buf_t;
+
+// Lines are handled one at a time: while one
+// is away on the pool's loop, the rest wait in
+// the buffer (and reading stops once it fills).
+// At EOF, what was sent is answered before the
+// connection closes.
+typedef struct hsk_ctl_conn_s {
+  hsk_ctl_t *ctl;
+  uv_pipe_t socket;
+  uv_shutdown_t shutdown;
+  char buf[HSK_CTL_LINE];
+  size_t buf_len;
+  int refs;
+  bool busy;
+  bool reading;
+  bool eof;
+  bool closing;
+  struct hsk_ctl_conn_s *prev;
+  struct hsk_ctl_conn_s *next;
+} hsk_ctl_conn_t;
+
+// Holds a reference to its connection until
+// the reply is back.
+typedef struct hsk_ctl_job_s {
+  hsk_ctl_conn_t *conn;
+  int cmd;
+  hsk_ctl_buf_t out;
+  struct hsk_ctl_job_s *next;
+} hsk_ctl_job_t;
+
+typedef struct hsk_ctl_write_s {
+  uv_write_t req;
+  hsk_ctl_conn_t *conn;
+  char *data;
+} hsk_ctl_write_t;
+
+/*
+ * Prototypes
+ */
+
+static void
+after_close(uv_handle_t *handle);
+
+static void
+after_connection(uv_stream_t *server, int status);
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf);
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void
+after_conn_write(uv_write_t *req, int status);
+
+static void
+after_conn_shutdown(uv_shutdown_t *req, int status);
+
+static void
+after_conn_close(uv_handle_t *handle);
+
+static void
+after_pool_async(uv_async_t *handle);
+
+static void
+after_done_async(uv_async_t *handle);
+
+static void
+hsk_ctl_conn_drain(hsk_ctl_conn_t *conn);
+
+/*
+ * Control Socket
+ */
+
+int
+hsk_ctl_init(
+  hsk_ctl_t *ctl,
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool,
+  const hsk_ns_t *ns
+) {
+  if (!ctl || !loop || !pool || !ns)
+    return HSK_EBADARGS;
+
+  ctl->loop = (uv_loop_t *)loop;
+  ctl->pool = (hsk_pool_t *)pool;
+  ctl->ns = (hsk_ns_t *)ns;
+  ctl->open = false;
+  memset(ctl->path, 0, sizeof(ctl->path));
+  ctl->dev = 0;
+  ctl->ino = 0;
+  ctl->conns = NULL;
+  ctl->conn_count = 0;
+  ctl->remote = pool->loop != loop;
+  ctl->async = false;
+  ctl->todo = NULL;
+  ctl->done = NULL;
+
+  if (uv_mutex_init(&ctl->lock) != 0)
+    return HSK_EFAILURE;
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_ctl_uninit(hsk_ctl_t *ctl) {
+  if (!ctl)
+    return;
+
+  assert(!ctl->open && !ctl->async);
+
+  uv_mutex_destroy(&ctl->lock);
+}
+
+hsk_ctl_t *
+hsk_ctl_alloc(
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool,
+  const hsk_ns_t *ns
+) {
+  hsk_ctl_t *ctl = hsk_malloc(sizeof(hsk_ctl_t));
+
+  if (!ctl)
+    return NULL;
+
+  if (hsk_ctl_init(ctl, loop, pool, ns) != HSK_SUCCESS) {
+    hsk_free(ctl);
+    return NULL;
+  }
+
+  return ctl;
+}
+
+void
+hsk_ctl_free(hsk_ctl_t *ctl) {
+  if (!ctl)
+    return;
+
+  hsk_ctl_uninit(ctl);
+  hsk_free(ctl);
+}
+
+// Before the pool's loop starts running on a
+// thread of its own.
+int
+hsk_ctl_open(hsk_ctl_t *ctl, const char *path) {
+  if (!ctl || !path)
+    return HSK_EBADARGS;
+
+  if (strlen(path) >= sizeof(ctl->path))
+    return HSK_EBADARGS;
+
+  strcpy(ctl->path, path);
+
+  if (ctl->remote) {
+    uv_loop_t *pool_loop = ctl->pool->loop;
+
+    if (uv_async_init(pool_loop, &ctl->pool_async, after_pool_async) != 0)
+      return HSK_EFAILURE;
+
+    if (uv_async_init(ctl->loop, &ctl->done_async, after_done_async) != 0) {
+      uv_close((uv_handle_t *)&ctl->pool_async, after_close);
+      return HSK_EFAILURE;
+    }
+
+    ctl->pool_async.data = (void *)ctl;
+    ctl->done_async.data = (void *)ctl;
+    ctl->async = true;
+
+    // Do not keep the loops alive by themselves.
+    uv_unref((uv_handle_t *)&ctl->pool_async);
+    uv_unref((uv_handle_t *)&ctl->done_async);
+  }
+
+  struct sockaddr_un un;
+
+  if (strlen(path) >= sizeof(un.sun_path))
+    return HSK_EBADARGS;
+
+  memset(&un, 0, sizeof(un));
+  un.sun_family = AF_UNIX;
+  strcpy(un.sun_path, path);
+
+  // Bound by hand rather than with uv_pipe_bind,
+  // which unlinks on close: after a handoff,
+  // the path is the new process's.
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return HSK_EFAILURE;
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  // Left behind by an unclean exit.
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0) {
+    hsk_log_printf("ctl: could not bind %s: %s\n", path, strerror(errno));
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  struct stat st;
+
+  // Purging and logging are for the owner.
+  if (chmod(path, S_IRUSR | S_IWUSR) != 0 || stat(path, &st) != 0) {
+    unlink(path);
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  ctl->dev = (uint64_t)st.st_dev;
+  ctl->ino = (uint64_t)st.st_ino;
+
+  if (uv_pipe_init(ctl->loop, &ctl->pipe, 0) != 0) {
+    unlink(path);
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  ctl->pipe.data = (void *)ctl;
+  ctl->open = true;
+
+  if (uv_pipe_open(&ctl->pipe, fd) != 0) {
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  int rc = uv_listen((uv_stream_t *)&ctl->pipe, HSK_CTL_MAX, after_connection);
+
+  if (rc != 0) {
+    hsk_log_printf("ctl: could not listen: %s\n", uv_strerror(rc));
+    return HSK_EFAILURE;
+  }
+
+  hsk_log_printf("ctl: listening on %s\n", path);
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_ctl_conn_unref(hsk_ctl_conn_t *conn) {
+  assert(conn->refs > 0);
+
+  conn->refs -= 1;
+
+  if (conn->refs == 0)
+    hsk_free(conn);
+}
+
+static void
+hsk_ctl_conn_close(hsk_ctl_conn_t *conn) {
+  hsk_ctl_t *ctl = conn->ctl;
+
+  if (conn->closing)
+    return;
+
+  conn->closing = true;
+
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    ctl->conns = (void *)conn->next;
+
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  conn->prev = NULL;
+  conn->next = NULL;
+  ctl->conn_count -= 1;
+
+  uv_close((uv_handle_t *)&conn->socket, after_conn_close);
+}
+
+static void
+hsk_ctl_free_jobs(hsk_ctl_job_t *job) {
+  while (job) {
+    hsk_ctl_job_t *next = job->next;
+    hsk_free(job->out.data);
+    hsk_ctl_conn_unref(job->conn);
+    hsk_free(job);
+    job = next;
+  }
+}
+
+// Once the pool's loop has stopped.
+int
+hsk_ctl_close(hsk_ctl_t *ctl) {
+  if (!ctl)
+    return HSK_EBADARGS;
+
+  while (ctl->conns)
+    hsk_ctl_conn_close((hsk_ctl_conn_t *)ctl->conns);
+
+  if (ctl->open) {
+    struct stat st;
+
+    uv_close((uv_handle_t *)&ctl->pipe, after_close);
+    ctl->open = false;
+
+    if (stat(ctl->path, &st) == 0
+        && (uint64_t)st.st_dev == ctl->dev
+        && (uint64_t)st.st_ino == ctl->ino) {
+      unlink(ctl->path);
+    }
+  }
+
+  if (ctl->async) {
+    uv_close((uv_handle_t *)&ctl->pool_async, after_close);
+    uv_close((uv_handle_t *)&ctl->done_async, after_close);
+    ctl->async = false;
+  }
+
+  hsk_ctl_free_jobs((hsk_ctl_job_t *)ctl->todo);
+  hsk_ctl_free_jobs((hsk_ctl_job_t *)ctl->done);
+
+  ctl->todo = NULL;
+  ctl->done = NULL;
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_ctl_destroy(hsk_ctl_t *ctl) {
+  if (!ctl)
+    return HSK_EBADARGS;
+
+  int rc = hsk_ctl_close(ctl);
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  hsk_ctl_free(ctl);
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * Replies
+ */
+
+static void
+hsk_ctl_buf_init(hsk_ctl_buf_t *out) {
+  out->data = NULL;
+  out->len = 0;
+  out->size = 0;
+  out->failed = false;
+}
+
+static void
+hsk_ctl_printf(hsk_ctl_buf_t *out, const char *fmt, ...) {
+  while (!out->failed) {
+    size_t room = out->size - out->len;
+    char *pos = out->data ? &out->data[out->len] : NULL;
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(pos, room, fmt, args);
+    va_end(args);
+
+    if (len < 0) {
+      out->failed = true;
+      break;
+    }
+
+    if ((size_t)len < room) {
+      out->len += len;
+      break;
+    }
+
+    size_t size = out->size > 0 ? out->size : 256;
+
+    while (size < out->len + len + 1)
+      size *= 2;
+
+    char *data = hsk_realloc(out->data, size);
+
+    if (!data) {
+      out->failed = true;
+      break;
+    }
+
+    out->data = data;
+    out->size = size;
+  }
+}
+
+// Takes the reply.
+static void
+hsk_ctl_conn_send(hsk_ctl_conn_t *conn, hsk_ctl_buf_t *out) {
+  if (conn->closing || out->failed || out->len == 0) {
+    hsk_free(out->data);
+    if (out->failed)
+      hsk_ctl_conn_close(conn);
+    return;
+  }
+
+  hsk_ctl_write_t *wr = hsk_malloc(sizeof(hsk_ctl_write_t));
+
+  if (!wr) {
+    hsk_free(out->data);
+    hsk_ctl_conn_close(conn);
+    return;
+  }
+
+  wr->req.data = (void *)wr;
+  wr->conn = conn;
+  wr->data = out->data;
+
+  uv_buf_t buf = uv_buf_init(out->data, out->len);
+  uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+  if (uv_write(&wr->req, stream, &buf, 1, after_conn_write) != 0) {
+    hsk_free(wr->data);
+    hsk_free(wr);
+    hsk_ctl_conn_close(conn);
+    return;
+  }
+
+  conn->refs += 1;
+}
+
+static void
+hsk_ctl_error(hsk_ctl_conn_t *conn, const char *msg) {
+  hsk_ctl_buf_t out;
+  hsk_ctl_buf_init(&out);
+  hsk_ctl_printf(&out, "error %s\n", msg);
+  hsk_ctl_conn_send(conn, &out);
+}
+
+static const char *
+hsk_ctl_state(int state) {
+  switch (state) {
+    case HSK_STATE_CONNECTING:
+      return "connecting";
+    case HSK_STATE_CONNECTED:
+      return "connected";
+    case HSK_STATE_READING:
+      return "reading";
+    case HSK_STATE_HANDSHAKE:
+      return "ready";
+    case HSK_STATE_DISCONNECTING:
+      return "disconnecting";
+    default:
+      return "disconnected";
+  }
+}
+
+// On the pool's loop.
+static void
+hsk_ctl_pool_reply(hsk_pool_t *pool, int cmd, hsk_ctl_buf_t *out) {
+  if (cmd == HSK_CTL_PEERS) {
+    hsk_peer_info_t *peers = NULL;
+    int count = 0;
+
+    if (pool->size > 0) {
+      peers = hsk_malloc(pool->size * sizeof(hsk_peer_info_t));
+
+      if (!peers) {
+        hsk_ctl_printf(out, "error %s\n", hsk_strerror(HSK_ENOMEM));
+        return;
+      }
+
+      count = hsk_pool_get_peers(pool, peers, pool->size);
+    }
+
+    int i;
+
+    for (i = 0; i < count; i++) {
+      const hsk_peer_info_t *p = &peers[i];
+
+      hsk_ctl_printf(out,
+        "peer %lu %s %s height %ld ping %ldms handshake %ums "
+        "proof-rtt %lums proofs %d fails %d requests %d bytes-in %lu "
+        "bytes-out %lu\n",
+        p->id, p->host, hsk_ctl_state(p->state), (long)p->height,
+        (long)p->min_ping, p->handshake_rtt, p->proof_rtt, p->proofs,
+        p->proof_fails,
+        p->requests, p->stats.bytes_in, p->stats.bytes_out);
+    }
+
+    hsk_free(peers);
+  } else {
+    hsk_pool_stats_t stats;
+    hsk_pool_get_stats(pool, &stats);
+
+    hsk_ctl_printf(out, "peers %d\n", stats.peers);
+    hsk_ctl_printf(out, "ready %d\n", stats.ready);
+    hsk_ctl_printf(out, "pending %d\n", stats.pending);
+    hsk_ctl_printf(out, "inflight %d\n", stats.inflight);
+    hsk_ctl_printf(out, "height %ld\n", (long)stats.height);
+    hsk_ctl_printf(out, "connects %lu\n", stats.connects);
+    hsk_ctl_printf(out, "handshakes %lu\n", stats.handshakes);
+    hsk_ctl_printf(out, "disconnects %lu\n", stats.disconnects);
+    hsk_ctl_printf(out, "bytes-in %lu\n", stats.bytes_in);
+    hsk_ctl_printf(out, "bytes-out %lu\n", stats.bytes_out);
+    hsk_ctl_printf(out, "headers %lu\n", stats.headers);
+    hsk_ctl_printf(out, "proofs %lu\n", stats.proofs);
+    hsk_ctl_printf(out, "timeouts %lu\n", stats.timeouts);
+    hsk_ctl_printf(out, "watched %d\n", stats.watched);
+    hsk_ctl_printf(out, "watch-hits %lu\n", stats.watch_hits);
+
+    hsk_chain_progress_t p;
+    hsk_chain_get_progress(&pool->chain, &p);
+
+    hsk_ctl_printf(out, "sync-estimate %ld\n", (long)p.estimate);
+    hsk_ctl_printf(out, "sync-headers %lu\n", p.headers);
+    hsk_ctl_printf(out, "sync-rate %lu\n", p.rate);
+    hsk_ctl_printf(out, "sync-remaining %ld\n", (long)p.remaining);
+    hsk_ctl_printf(out, "pow-checks %lu\n", p.pow_count);
+    hsk_ctl_printf(out, "pow-time-us %lu\n", p.pow_time);
+    hsk_ctl_printf(out, "check-time-us %lu\n", p.check_time);
+  }
+
+  hsk_ctl_printf(out, "ok\n");
+}
+
+static void
+hsk_ctl_pool_cmd(hsk_ctl_conn_t *conn, int cmd) {
+  hsk_ctl_t *ctl = conn->ctl;
+
+  if (!ctl->remote) {
+    hsk_ctl_buf_t out;
+    hsk_ctl_buf_init(&out);
+    hsk_ctl_pool_reply(ctl->pool, cmd, &out);
+    hsk_ctl_conn_send(conn, &out);
+    return;
+  }
+
+  hsk_ctl_job_t *job = hsk_malloc(sizeof(hsk_ctl_job_t));
+
+  if (!job) {
+    hsk_ctl_error(conn, hsk_strerror(HSK_ENOMEM));
+    return;
+  }
+
+  job->conn = conn;
+  job->cmd = cmd;
+  hsk_ctl_buf_init(&job->out);
+
+  conn->refs += 1;
+  conn->busy = true;
+
+  uv_mutex_lock(&ctl->lock);
+  job->next = (hsk_ctl_job_t *)ctl->todo;
+  ctl->todo = (void *)job;
+  uv_mutex_unlock(&ctl->lock);
+
+  uv_async_send(&ctl->pool_async);
+}
+
+static void
+hsk_ctl_status(hsk_ctl_t *ctl, hsk_ctl_buf_t *out) {
+  hsk_chain_view_t view;
+  char hex[65];
+
+  hsk_chain_get_view(&ctl->pool->chain, &view);
+
+  hsk_ctl_printf(out, "height %ld\n", (long)view.height);
+  hsk_hex_encode(view.tip, 32, hex);
+  hsk_ctl_printf(out, "tip %s\n", hex);
+  hsk_ctl_printf(out, "safe-height %u\n", view.safe_height);
+  hsk_hex_encode(view.safe_root, 32, hex);
+  hsk_ctl_printf(out, "safe-root %s\n", hex);
+  hsk_ctl_printf(out, "synced %s\n", view.synced ? "true" : "false");
+  hsk_ctl_printf(out, "ok\n");
+}
+
+static void
+hsk_ctl_cache(hsk_ctl_t *ctl, hsk_ctl_buf_t *out) {
+  hsk_ns_cache_info_t info;
+  hsk_ns_stats_t stats;
+
+  hsk_ns_get_cache_info(ctl->ns, &info);
+  hsk_ns_get_stats(ctl->ns, &stats);
+
+  hsk_ctl_printf(out, "items %zu\n", info.items);
+  hsk_ctl_printf(out, "item-bytes %zu\n", info.item_bytes);
+  hsk_ctl_printf(out, "replies %zu\n", info.replies);
+  hsk_ctl_printf(out, "reply-bytes %zu\n", info.reply_bytes);
+  hsk_ctl_printf(out, "negative %zu\n", info.nxs);
+  hsk_ctl_printf(out, "referrals %zu\n", info.refs);
+  hsk_ctl_printf(out, "max-bytes %zu\n", info.max_bytes);
+  hsk_ctl_printf(out, "rejected %lu\n", info.rejected);
+  hsk_ctl_printf(out, "queries %lu\n", stats.queries);
+  hsk_ctl_printf(out, "cached %lu\n", stats.cached);
+  hsk_ctl_printf(out, "lookups %lu\n", stats.lookups);
+  hsk_ctl_printf(out, "stale %lu\n", stats.stale);
+  hsk_ctl_printf(out, "servfails %lu\n", stats.servfails);
+  hsk_ctl_printf(out, "drops %lu\n", stats.drops);
+  hsk_ctl_printf(out, "ok\n");
+}
+
+// Proofs are tracked under a lock: no need
+// for the pool's loop.
+static int
+hsk_ctl_top(hsk_ctl_t *ctl, const char *what, int max, hsk_ctl_buf_t *out) {
+  hsk_top_item_t *items = hsk_malloc(max * sizeof(hsk_top_item_t));
+  int count;
+
+  if (!items)
+    return HSK_ENOMEM;
+
+  if (strcmp(what, "names") == 0)
+    count = hsk_ns_get_top(ctl->ns, false, items, max);
+  else if (strcmp(what, "tlds") == 0)
+    count = hsk_ns_get_top(ctl->ns, true, items, max);
+  else if (strcmp(what, "proofs") == 0)
+    count = hsk_pool_get_hot(ctl->pool, items, max);
+  else
+    count = -1;
+
+  if (count < 0) {
+    hsk_free(items);
+    return HSK_EBADARGS;
+  }
+
+  int i;
+
+  for (i = 0; i < count; i++) {
+    hsk_ctl_printf(out, "top %s count %lu error %lu\n",
+                   items[i].key, items[i].count, items[i].error);
+  }
+
+  hsk_ctl_printf(out, "ok\n");
+
+  hsk_free(items);
+
+  return HSK_SUCCESS;
+}
+
+// Splits on whitespace. Returns -1 past max.
+static int
+hsk_ctl_split(char *line, char **argv, int max) {
+  int argc = 0;
+  char *s = line;
+
+  for (;;) {
+    while (isspace((unsigned char)*s))
+      *s++ = '\0';
+
+    if (*s == '\0')
+      break;
+
+    if (argc == max)
+      return -1;
+
+    argv[argc++] = s;
+
+    while (*s && !isspace((unsigned char)*s))
+      s += 1;
+  }
+
+  return argc;
+}
+
+static void
+hsk_ctl_run(hsk_ctl_conn_t *conn, char *line) {
+  hsk_ctl_t *ctl = conn->ctl;
+  hsk_ctl_buf_t out;
+  char *argv[3];
+  int argc = hsk_ctl_split(line, argv, 3);
+
+  if (argc == 0)
+    return;
+
+  if (argc < 0) {
+    hsk_ctl_error(conn, "too many arguments");
+    return;
+  }
+
+  const char *cmd = argv[0];
+
+  hsk_ctl_buf_init(&out);
+
+  if (strcmp(cmd, "status") == 0 && argc == 1) {
+    hsk_ctl_status(ctl, &out);
+  } else if (strcmp(cmd, "pool") == 0 && argc == 1) {
+    hsk_ctl_pool_cmd(conn, HSK_CTL_POOL);
+    return;
+  } else if (strcmp(cmd, "peers") == 0 && argc == 1) {
+    hsk_ctl_pool_cmd(conn, HSK_CTL_PEERS);
+    return;
+  } else if (strcmp(cmd, "cache") == 0 && argc == 1) {
+    hsk_ctl_cache(ctl, &out);
+  } else if (strcmp(cmd, "purge") == 0 && argc == 2) {
+    size_t count;
+    int rc = hsk_ns_purge(ctl->ns, argv[1], &count);
+
+    if (rc != HSK_SUCCESS) {
+      hsk_ctl_error(conn, "invalid name");
+      return;
+    }
+
+    hsk_ctl_printf(&out, "purged %zu\n", count);
+    hsk_ctl_printf(&out, "ok\n");
+  } else if (strcmp(cmd, "prefetch") == 0 && (argc == 2 || argc == 3)) {
+    uint16_t type = HSK_DNS_A;
+
+    if (argc == 3 && !hsk_dns_type_from_string(argv[2], &type)) {
+      hsk_ctl_error(conn, "invalid type");
+      return;
+    }
+
+    int rc = hsk_ns_prefetch(ctl->ns, argv[1], type);
+
+    if (rc != HSK_SUCCESS) {
+      if (rc == HSK_EBADARGS)
+        hsk_ctl_error(conn, "invalid name");
+      else
+        hsk_ctl_error(conn, hsk_strerror(rc));
+      return;
+    }
+
+    hsk_ctl_printf(&out, "ok\n");
+  } else if (strcmp(cmd, "prefetch-list") == 0 && argc == 2) {
+    size_t count;
+    int rc = hsk_ns_prefetch_list(ctl->ns, argv[1], &count);
+
+    if (rc != HSK_SUCCESS) {
+      hsk_ctl_error(conn, "could not read list");
+      return;
+    }
+
+    hsk_ctl_printf(&out, "queued %zu\n", count);
+    hsk_ctl_printf(&out, "ok\n");
+  } else if (strcmp(cmd, "top") == 0 && (argc == 2 || argc == 3)) {
+    int max = HSK_CTL_TOP;
+
+    if (argc == 3) {
+      char *end;
+      long n = strtol(argv[2], &end, 10);
+
+      if (*end != '\0' || n <= 0 || n > HSK_CTL_TOP_MAX) {
+        hsk_ctl_error(conn, "invalid count");
+        return;
+      }
+
+      max = (int)n;
+    }
+
+    int rc = hsk_ctl_top(ctl, argv[1], max, &out);
+
+    if (rc != HSK_SUCCESS) {
+      if (rc == HSK_EBADARGS)
+        hsk_ctl_error(conn, "expected names, tlds or proofs");
+      else
+        hsk_ctl_error(conn, hsk_strerror(rc));
+      return;
+    }
+  } else if (strcmp(cmd, "log") == 0 && argc == 2) {
+    if (!hsk_log_set_level(argv[1])) {
+      hsk_ctl_error(conn, "invalid level");
+      return;
+    }
+
+    hsk_ctl_printf(&out, "ok\n");
+  } else if (strcmp(cmd, "help") == 0 && argc == 1) {
+    hsk_ctl_printf(&out,
+      "status\n"
+      "pool\n"
+      "peers\n"
+      "cache\n"
+      "purge <name>\n"
+      "prefetch <name> [type]\n"
+      "prefetch-list <file>\n"
+      "top <names|tlds|proofs> [count]\n"
+      "log <error|info|debug>\n"
+      "ok\n");
+  } else {
+    hsk_ctl_error(conn, "unknown command (try help)");
+    return;
+  }
+
+  hsk_ctl_conn_send(conn, &out);
+}
+
+/*
+ * Connections
+ */
+
+static void
+hsk_ctl_conn_drain(hsk_ctl_conn_t *conn) {
+  size_t pos = 0;
+
+  while (!conn->busy && !conn->closing) {
+    char *start = &conn->buf[pos];
+    char *end = memchr(start, '\n', conn->buf_len - pos);
+
+    if (!end)
+      break;
+
+    *end = '\0';
+    pos = (end - conn->buf) + 1;
+
+    hsk_ctl_run(conn, start);
+  }
+
+  if (conn->closing)
+    return;
+
+  if (pos > 0) {
+    memmove(&conn->buf[0], &conn->buf[pos], conn->buf_len - pos);
+    conn->buf_len -= pos;
+  }
+
+  // Once the last reply is written.
+  if (conn->eof) {
+    if (!conn->busy) {
+      uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+      if (uv_shutdown(&conn->shutdown, stream, after_conn_shutdown) != 0)
+        hsk_ctl_conn_close(conn);
+      else
+        conn->refs += 1;
+    }
+    return;
+  }
+
+  if (conn->buf_len == sizeof(conn->buf)) {
+    // Longer than any command.
+    if (!conn->busy) {
+      hsk_ctl_conn_close(conn);
+      return;
+    }
+
+    if (conn->reading) {
+      uv_read_stop((uv_stream_t *)&conn->socket);
+      conn->reading = false;
+    }
+
+    return;
+  }
+
+  if (!conn->reading) {
+    uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+    if (uv_read_start(stream, alloc_conn, after_conn_read) != 0) {
+      hsk_ctl_conn_close(conn);
+      return;
+    }
+
+    conn->reading = true;
+  }
+}
+
+static void
+after_connection(uv_stream_t *server, int status) {
+  hsk_ctl_t *ctl = (hsk_ctl_t *)server->data;
+
+  if (status < 0) {
+    hsk_log_printf("ctl: connection error: %s\n", uv_strerror(status));
+    return;
+  }
+
+  hsk_ctl_conn_t *conn = hsk_malloc(sizeof(hsk_ctl_conn_t));
+
+  if (!conn)
+    return;
+
+  conn->ctl = ctl;
+  conn->buf_len = 0;
+  conn->refs = 1;
+  conn->busy = false;
+  conn->reading = false;
+  conn->eof = false;
+  conn->closing = false;
+  conn->prev = NULL;
+  conn->next = (hsk_ctl_conn_t *)ctl->conns;
+
+  if (uv_pipe_init(ctl->loop, &conn->socket, 0) != 0) {
+    hsk_free(conn);
+    return;
+  }
+
+  conn->socket.data = (void *)conn;
+
+  if (conn->next)
+    conn->next->prev = conn;
+
+  ctl->conns = (void *)conn;
+  ctl->conn_count += 1;
+
+  if (uv_accept(server, (uv_stream_t *)&conn->socket) != 0) {
+    hsk_ctl_conn_close(conn);
+    return;
+  }
+
+  if (ctl->conn_count > HSK_CTL_MAX) {
+    hsk_ctl_conn_close(conn);
+    return;
+  }
+
+  hsk_ctl_conn_drain(conn);
+}
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
+  hsk_ctl_conn_t *conn = (hsk_ctl_conn_t *)handle->data;
+
+  buf->base = &conn->buf[conn->buf_len];
+  buf->len = sizeof(conn->buf) - conn->buf_len;
+}
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  hsk_ctl_conn_t *conn = (hsk_ctl_conn_t *)stream->data;
+
+  if (nread == UV_EOF) {
+    uv_read_stop(stream);
+    conn->reading = false;
+    conn->eof = true;
+    hsk_ctl_conn_drain(conn);
+    return;
+  }
+
+  if (nread < 0) {
+    hsk_ctl_conn_close(conn);
+    return;
+  }
+
+  if (nread == 0)
+    return;
+
+  conn->buf_len += nread;
+
+  hsk_ctl_conn_drain(conn);
+}
+
+static void
+after_conn_write(uv_write_t *req, int status) {
+  hsk_ctl_write_t *wr = (hsk_ctl_write_t *)req->data;
+  hsk_ctl_conn_t *conn = wr->conn;
+
+  hsk_free(wr->data);
+  hsk_free(wr);
+
+  if (status != 0)
+    hsk_ctl_conn_close(conn);
+
+  hsk_ctl_conn_unref(conn);
+}
+
+static void
+after_conn_shutdown(uv_shutdown_t *req, int status) {
+  hsk_ctl_conn_t *conn = (hsk_ctl_conn_t *)req->handle->data;
+
+  hsk_ctl_conn_close(conn);
+  hsk_ctl_conn_unref(conn);
+}
+
+static void
+after_conn_close(uv_handle_t *handle) {
+  hsk_ctl_conn_unref((hsk_ctl_conn_t *)handle->data);
+}
+
+static void
+after_close(uv_handle_t *handle) {}
+
+/*
+ * Pool Jobs
+ */
+
+static void
+after_pool_async(uv_async_t *handle) {
+  hsk_ctl_t *ctl = (hsk_ctl_t *)handle->data;
+
+  uv_mutex_lock(&ctl->lock);
+  hsk_ctl_job_t *job = (hsk_ctl_job_t *)ctl->todo;
+  ctl->todo = NULL;
+  uv_mutex_unlock(&ctl->lock);
+
+  if (!job)
+    return;
+
+  while (job) {
+    hsk_ctl_job_t *next = job->next;
+
+    hsk_ctl_pool_reply(ctl->pool, job->cmd, &job->out);
+
+    uv_mutex_lock(&ctl->lock);
+    job->next = (hsk_ctl_job_t *)ctl->done;
+    ctl->done = (void *)job;
+    uv_mutex_unlock(&ctl->lock);
+
+    job = next;
+  }
+
+  uv_async_send(&ctl->done_async);
+}
+
+static void
+after_done_async(uv_async_t *handle) {
+  hsk_ctl_t *ctl = (hsk_ctl_t *)handle->data;
+
+  uv_mutex_lock(&ctl->lock);
+  hsk_ctl_job_t *job = (hsk_ctl_job_t *)ctl->done;
+  ctl->done = NULL;
+  uv_mutex_unlock(&ctl->lock);
+
+  while (job) {
+    hsk_ctl_job_t *next = job->next;
+    hsk_ctl_conn_t *conn = job->conn;
+
+    conn->busy = false;
+
+    hsk_ctl_conn_send(conn, &job->out);
+
+    if (!conn->closing)
+      hsk_ctl_conn_drain(conn);
+
+    hsk_ctl_conn_unref(conn);
+    hsk_free(job);
+
+    job = next;
+  }
+}
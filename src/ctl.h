@@ -0,0 +1,103 @@
+#ifndef _HSK_CTL_H
+#define _HSK_CTL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ns.h"
+#include "pool.h"
+#include "uv.h"
+
+// A local control socket (unix domain, owner
+// only). One command per line:
+//   status             chain tip and sync state
+//   pool               pool counters
+//   peers              one line per peer
+//   cache              root cache usage and stats
+//   purge <name>       drop what is cached under
+//                      the name's TLD
+//   prefetch <name> [type]
+//                      resolve it into the cache
+//   prefetch-list <file>
+//                      queue a list of names (see
+//                      hsk_ns_prefetch_list)
+//   top <names|tlds|proofs> [count]
+//                      the most queried names,
+//                      TLDs or proven names,
+//                      with counts and error
+//                      bounds (see top.h)
+//   log <level>        error, info or debug
+//   help
+// Replies are `key value` lines (or one line
+// per peer) ending in `ok`, or a single
+// `error <message>` line. Commands on one
+// connection are answered in order.
+#define HSK_CTL_LINE 1024
+#define HSK_CTL_MAX 16
+
+// Entries `top` lists by default, and at most.
+#define HSK_CTL_TOP 20
+#define HSK_CTL_TOP_MAX 128
+
+/*
+ * Types
+ */
+
+typedef struct hsk_ctl_s {
+  uv_loop_t *loop;
+  hsk_pool_t *pool;
+  hsk_ns_t *ns;
+  uv_pipe_t pipe;
+  bool open;
+  char path[1024];
+  // Ours to unlink, unless replaced since.
+  uint64_t dev;
+  uint64_t ino;
+  void *conns;
+  int conn_count;
+  // Pool commands run on the pool's loop when
+  // it is another (see --sync-thread).
+  bool remote;
+  uv_mutex_t lock;
+  uv_async_t pool_async;
+  uv_async_t done_async;
+  bool async;
+  void *todo;
+  void *done;
+} hsk_ctl_t;
+
+/*
+ * Control Socket
+ */
+
+int
+hsk_ctl_init(
+  hsk_ctl_t *ctl,
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool,
+  const hsk_ns_t *ns
+);
+
+void
+hsk_ctl_uninit(hsk_ctl_t *ctl);
+
+hsk_ctl_t *
+hsk_ctl_alloc(
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool,
+  const hsk_ns_t *ns
+);
+
+void
+hsk_ctl_free(hsk_ctl_t *ctl);
+
+int
+hsk_ctl_open(hsk_ctl_t *ctl, const char *path);
+
+int
+hsk_ctl_close(hsk_ctl_t *ctl);
+
+int
+hsk_ctl_destroy(hsk_ctl_t *ctl);
+#endif
@@ -4,12 +4,50 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "blake2b.h"
+#include "constants.h"
 #include "cuckoo.h"
 #include "error.h"
 #include "siphash.h"
 
+// Partners of an endpoint with no or several.
+#define HSK_CUCKOO_NONE -1
+#define HSK_CUCKOO_MANY -2
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HSK_CUCKOO_INLINE inline __attribute__((always_inline))
+#else
+#define HSK_CUCKOO_INLINE inline
+#endif
+
+// The network's parameters, as hsk_cuckoo_init
+// would set them, and the table's size: the
+// power of two at least twice the endpoints.
+#define HSK_CUCKOO_NET_NODES (1ull << HSK_CUCKOO_BITS)
+#define HSK_CUCKOO_NET_MASK ((uint32_t)((HSK_CUCKOO_NET_NODES >> 1) - 1))
+#define HSK_CUCKOO_NET_EASINESS \
+  (((uint64_t)HSK_CUCKOO_PERC * HSK_CUCKOO_NET_NODES) / 100)
+#define HSK_CUCKOO_NET_EDGES (HSK_CUCKOO_SIZE * 2)
+#define HSK_CUCKOO_NET_SLOTS                \
+  (HSK_CUCKOO_NET_EDGES * 2 <= 4 ? 4 :      \
+   HSK_CUCKOO_NET_EDGES * 2 <= 8 ? 8 :      \
+   HSK_CUCKOO_NET_EDGES * 2 <= 16 ? 16 :    \
+   HSK_CUCKOO_NET_EDGES * 2 <= 32 ? 32 :    \
+   HSK_CUCKOO_NET_EDGES * 2 <= 64 ? 64 :    \
+   HSK_CUCKOO_NET_EDGES * 2 <= 128 ? 128 :  \
+   HSK_CUCKOO_NET_EDGES * 2 <= 256 ? 256 :  \
+   HSK_CUCKOO_NET_EDGES * 2 <= 512 ? 512 : 1024)
+
+#if HSK_CUCKOO_BITS < 1 || HSK_CUCKOO_BITS > 32
+#error "HSK_CUCKOO_BITS out of range"
+#endif
+
+#if HSK_CUCKOO_SIZE < 4 || HSK_CUCKOO_SIZE > 254 || (HSK_CUCKOO_SIZE & 1)
+#error "HSK_CUCKOO_SIZE out of range"
+#endif
+
 int
 hsk_cuckoo_init(
   hsk_cuckoo_t *ctx,
@@ -97,76 +135,155 @@ hsk_cuckoo_sipnode(
   return (node << 1) | uorv;
 }
 
-int
-hsk_cuckoo_verify(
-  const hsk_cuckoo_t *ctx,
+// The checks of a cycle, over buffers of the
+// caller's. Inlined into each caller, so that
+// with the network's parameters as constants
+// the loops have fixed bounds and the masks
+// fold in.
+static HSK_CUCKOO_INLINE int
+hsk_cuckoo_check(
   const uint8_t *key,
-  const uint32_t *nonces
+  const uint32_t *nonces,
+  uint32_t size,
+  uint32_t mask,
+  uint64_t easiness,
+  bool legacy,
+  uint32_t *uvs,
+  uint16_t *table,
+  uint32_t slots,
+  int32_t *partner
 ) {
-  if (ctx == NULL || key == NULL || nonces == NULL)
-    return HSK_EBADARGS;
+  uint32_t edges = size * 2;
 
-  assert(ctx->size != 0);
-
-  uint32_t uvs[ctx->size * 2];
-
-  uint32_t xor0 = 0;
-  uint32_t xor1 = 0;
-
-  for (int n = 0; n < ctx->size; n++) {
-    if (nonces[n] >= ctx->easiness)
+  for (uint32_t n = 0; n < size; n++) {
+    if (nonces[n] >= easiness)
       return HSK_EPOWTOOBIG;
 
     if (n > 0 && nonces[n] <= nonces[n - 1])
       return HSK_EPOWTOOSMALL;
 
-    uint32_t x = hsk_cuckoo_sipnode(ctx, key, nonces[n], 0);
-    uint32_t y = hsk_cuckoo_sipnode(ctx, key, nonces[n], 1);
+    uvs[2 * n] = nonces[n] << 1;
+    uvs[2 * n + 1] = (nonces[n] << 1) | 1;
+  }
 
-    uvs[2 * n] = x;
-    uvs[2 * n + 1] = y;
+  // Hash every endpoint in one go.
+  if (legacy) {
+    for (uint32_t k = 0; k < edges; k++)
+      uvs[k] = hsk_siphash32(uvs[k], key);
+  } else {
+    hsk_siphash32k256_many(uvs, edges, key, uvs);
+  }
+
+  uint32_t xor0 = 0;
+  uint32_t xor1 = 0;
 
-    xor0 ^= x;
-    xor1 ^= y;
+  // Even and odd endpoints, two at a time.
+  for (uint32_t k = 0; k < edges; k += 2) {
+    uvs[k] = (uvs[k] & mask) << 1;
+    uvs[k + 1] = ((uvs[k + 1] & mask) << 1) | 1;
+    xor0 ^= uvs[k];
+    xor1 ^= uvs[k + 1];
   }
 
   if (xor0 | xor1)
     return HSK_EPOWNONMATCHING;
 
-  uint32_t n = 0;
-  uint32_t i = 0;
+  // Pair up endpoints sharing a node through a
+  // small open-addressed table. Each is left
+  // with its partner, or with none or too many.
+  memset(table, 0, slots * sizeof(uint16_t));
 
-  do {
-    uint32_t j = i;
-    uint32_t k = j;
+  for (uint32_t k = 0; k < edges; k++) {
+    uint32_t h = (uvs[k] >> 1) & (slots - 1);
 
-    for (;;) {
-      k = (k + 2) % (2 * ctx->size);
+    while (table[h] != 0 && uvs[table[h] - 1] != uvs[k])
+      h = (h + 1) & (slots - 1);
 
-      if (k == i)
-        break;
+    if (table[h] == 0) {
+      table[h] = k + 1;
+      partner[k] = HSK_CUCKOO_NONE;
+      continue;
+    }
 
-      if (uvs[k] == uvs[i]) {
-        if (j != i)
-          return HSK_EPOWBRANCH;
+    uint32_t f = table[h] - 1;
 
-        j = k;
-      }
+    if (partner[f] == HSK_CUCKOO_NONE) {
+      partner[f] = k;
+      partner[k] = f;
+      continue;
     }
 
-    if (j == i)
+    if (partner[f] != HSK_CUCKOO_MANY)
+      partner[partner[f]] = HSK_CUCKOO_MANY;
+
+    partner[f] = HSK_CUCKOO_MANY;
+    partner[k] = HSK_CUCKOO_MANY;
+  }
+
+  uint32_t n = 0;
+  uint32_t i = 0;
+
+  do {
+    int32_t j = partner[i];
+
+    if (j == HSK_CUCKOO_MANY)
+      return HSK_EPOWBRANCH;
+
+    if (j == HSK_CUCKOO_NONE)
       return HSK_EPOWDEADEND;
 
-    i = j ^ 1;
+    i = (uint32_t)j ^ 1;
     n += 1;
   } while (i != 0);
 
-  if (n != ctx->size)
+  if (n != size)
     return HSK_EPOWSHORTCYCLE;
 
   return HSK_EPOWOK;
 }
 
+int
+hsk_cuckoo_verify(
+  const hsk_cuckoo_t *ctx,
+  const uint8_t *key,
+  const uint32_t *nonces
+) {
+  if (ctx == NULL || key == NULL || nonces == NULL)
+    return HSK_EBADARGS;
+
+  assert(ctx->size != 0);
+
+  uint32_t edges = ctx->size * 2;
+  uint32_t slots = 4;
+
+  while (slots < edges * 2)
+    slots <<= 1;
+
+  uint32_t uvs[edges];
+  uint16_t table[slots];
+  int32_t partner[edges];
+
+  return hsk_cuckoo_check(key, nonces, ctx->size, ctx->mask, ctx->easiness,
+                          ctx->legacy, uvs, table, slots, partner);
+}
+
+// hsk_cuckoo_verify for the network built for
+// (constants.h), without a context: its sizes,
+// mask and easiness are known here.
+int
+hsk_cuckoo_verify_network(const uint8_t *key, const uint32_t *nonces) {
+  if (key == NULL || nonces == NULL)
+    return HSK_EBADARGS;
+
+  uint32_t uvs[HSK_CUCKOO_NET_EDGES];
+  uint16_t table[HSK_CUCKOO_NET_SLOTS];
+  int32_t partner[HSK_CUCKOO_NET_EDGES];
+
+  return hsk_cuckoo_check(key, nonces, HSK_CUCKOO_SIZE, HSK_CUCKOO_NET_MASK,
+                          HSK_CUCKOO_NET_EASINESS, HSK_CUCKOO_LEGACY,
+                          uvs, table, HSK_CUCKOO_NET_SLOTS, partner);
+}
+
 int
 hsk_cuckoo_verify_header(
   const hsk_cuckoo_t *ctx,
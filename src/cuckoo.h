@@ -45,6 +45,9 @@ hsk_cuckoo_verify(
   const uint32_t *nonces
 );
 
+int
+hsk_cuckoo_verify_network(const uint8_t *key, const uint32_t *nonces);
+
 int
 hsk_cuckoo_verify_header(
   const hsk_cuckoo_t *ctx,
@@ -8,21 +8,48 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <ctype.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <getopt.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "affinity.h"
+#include "ctl.h"
+#include "doq.h"
+#include "handoff.h"
 #include "hsk.h"
+#include "ipc.h"
+#include "mem.h"
 #include "pool.h"
+#include "req.h"
 #include "ns.h"
+#include "orphan.h"
 #include "rs.h"
+#include "shm.h"
 #include "uv.h"
 
 extern char *optarg;
 extern int optind, opterr, optopt;
 
+// Where SIGUSR2 writes traced queries.
+static const char *trace_file = NULL;
+
+// Stopped for a new process (see --handoff).
+static bool handed_off = false;
+
+// The sync thread's, from --cpus.
+static int pool_cpu = -1;
+
+// Every query to either server, when set.
+static hsk_capture_t *capture = NULL;
+
+// What SIGHUP reads again.
+static const char *config_file = NULL;
+
 typedef struct hsk_options_s {
   char *config;
   char config_[256];
@@ -30,16 +57,116 @@ typedef struct hsk_options_s {
   struct sockaddr_storage _ns_host;
   struct sockaddr *rs_host;
   struct sockaddr_storage _rs_host;
+  struct sockaddr *doq_host;
+  struct sockaddr_storage _doq_host;
+  char *doq_cert;
+  char doq_cert_[256];
+  char *doq_key;
+  char doq_key_[256];
   struct sockaddr *ns_ip;
   struct sockaddr_storage _ns_ip;
+  bool has_ip;
   char *rs_config;
   char rs_config_[256];
   uint8_t identity_key_[32];
   uint8_t *identity_key;
   char *seeds;
+  char *full_node;
+  char full_node_[256];
   int pool_size;
+  int pool_race;
+  int pool_grow;
+  int64_t proof_timeout;
+  int proof_retries;
+  int pending_max;
+  size_t proof_cache;
+  int proof_hedge;
+  bool proof_workers;
+  bool peer_replace;
+  uint64_t send_delay;
+  size_t send_bytes;
+  size_t read_offload;
+  size_t orphan_size;
+  size_t mem_budget;
+  size_t cache_size;
+  uint32_t min_ttl;
+  uint32_t max_ttl;
+  uint32_t neg_ttl;
+  int ns_workers;
+  int ns_signers;
+  bool minimal;
+  bool any_hinfo;
+  bool unsigned_errors;
+  size_t udp_size;
+  int udp_rcvbuf;
+  int udp_sndbuf;
+  int rs_workers;
+  uint32_t ns_rate;
+  uint32_t rs_rate;
+  uint32_t trace_rate;
+  char *trace_file;
+  char trace_file_[256];
+  bool profile;
+  bool sync_thread;
+  char *cpus;
+  char cpus_[256];
+  char *prefix;
+  char prefix_[256];
+  char *snapshot;
+  char snapshot_[256];
+  char *export;
+  char export_[256];
+  char *import;
+  char import_[256];
+  char *control;
+  char control_[256];
+  char *query_socket;
+  char query_socket_[256];
+  char *handoff;
+  char handoff_[256];
+  char *shared_cache;
+  char shared_cache_[256];
+  size_t shared_cache_size;
+  char *prefetch;
+  char prefetch_[256];
+  char *watch;
+  char watch_[256];
+  char *capture;
+  char capture_[256];
 } hsk_options_t;
 
+// Options the config file may set, read again
+// on SIGHUP and applied without a restart.
+typedef struct hsk_config_s {
+  int pool_size;
+  size_t cache_size;
+  char *seeds;
+  char *rs_config;
+  char rs_config_[256];
+} hsk_config_t;
+
+// What a reload on the default loop touches.
+// The resolver is replaced (unbound contexts
+// cannot be configured again), the old one
+// freed once its handles have closed.
+typedef struct hsk_reload_s {
+  hsk_options_t *opt;
+  uv_loop_t *loop;
+  hsk_ns_t *ns;
+  hsk_rs_t **rs;
+  hsk_rs_t *old;
+  hsk_handoff_t *handoff;
+  const hsk_affinity_t *affinity;
+  char *rs_config;
+  char rs_config_[256];
+  time_t rs_mtime;
+  uv_timer_t timer;
+} hsk_reload_t;
+
+// The command line values, which the file
+// overrides. Never changed after startup.
+static hsk_config_t base_config;
+
 static void
 hsk_options_init(hsk_options_t *opt) {
   opt->config = NULL;
@@ -47,15 +174,82 @@ hsk_options_init(hsk_options_t *opt) {
   opt->ns_host = (struct sockaddr *)&opt->_ns_host;
   opt->rs_host = (struct sockaddr *)&opt->_rs_host;
   opt->ns_ip = (struct sockaddr *)&opt->_ns_ip;
+  opt->doq_host = NULL;
+  opt->doq_cert = NULL;
+  memset(opt->doq_cert_, 0, sizeof(opt->doq_cert_));
+  opt->doq_key = NULL;
+  memset(opt->doq_key_, 0, sizeof(opt->doq_key_));
   assert(hsk_sa_from_string(opt->ns_host, HSK_NS_IP, HSK_NS_PORT));
   assert(hsk_sa_from_string(opt->rs_host, HSK_RS_IP, HSK_RS_PORT));
   assert(hsk_sa_from_string(opt->ns_ip, HSK_RS_A, 0));
+  opt->has_ip = false;
   opt->rs_config = NULL;
   memset(opt->rs_config_, 0, sizeof(opt->config_));
   memset(opt->identity_key_, 0, sizeof(opt->identity_key_));
   opt->identity_key = NULL;
   opt->seeds = NULL;
   opt->pool_size = HSK_POOL_SIZE;
+  opt->pool_race = HSK_POOL_RACE;
+  opt->pool_grow = 0;
+  opt->full_node = NULL;
+  memset(opt->full_node_, 0, sizeof(opt->full_node_));
+  opt->proof_timeout = HSK_PROOF_TIMEOUT;
+  opt->proof_retries = HSK_PROOF_RETRIES;
+  opt->pending_max = HSK_PENDING_MAX;
+  opt->proof_cache = HSK_PROOF_CACHE_SIZE;
+  opt->proof_hedge = HSK_HEDGE_PERCENTILE;
+  opt->proof_workers = true;
+  opt->peer_replace = true;
+  opt->send_delay = HSK_SEND_DELAY;
+  opt->send_bytes = HSK_SEND_BYTES;
+  opt->read_offload = 0;
+  opt->orphan_size = HSK_ORPHAN_MAX_BYTES;
+  opt->mem_budget = 0;
+  opt->cache_size = HSK_CACHE_SIZE;
+  opt->min_ttl = HSK_CACHE_MIN_TTL;
+  opt->max_ttl = HSK_CACHE_MAX_TTL;
+  opt->neg_ttl = HSK_CACHE_NEG_TTL;
+  opt->ns_workers = 0;
+  opt->minimal = false;
+  opt->any_hinfo = false;
+  opt->unsigned_errors = false;
+  opt->udp_size = HSK_DNS_SAFE_EDNS;
+  opt->udp_rcvbuf = HSK_UDP_SOCKET_BUFFER;
+  opt->udp_sndbuf = HSK_UDP_SOCKET_BUFFER;
+  opt->ns_signers = 0;
+  opt->rs_workers = 0;
+  opt->ns_rate = 0;
+  opt->rs_rate = 0;
+  opt->trace_rate = HSK_TRACE_RATE;
+  opt->trace_file = NULL;
+  memset(opt->trace_file_, 0, sizeof(opt->trace_file_));
+  opt->profile = false;
+  opt->sync_thread = false;
+  opt->cpus = NULL;
+  memset(opt->cpus_, 0, sizeof(opt->cpus_));
+  opt->prefix = NULL;
+  memset(opt->prefix_, 0, sizeof(opt->prefix_));
+  opt->snapshot = NULL;
+  memset(opt->snapshot_, 0, sizeof(opt->snapshot_));
+  opt->export = NULL;
+  memset(opt->export_, 0, sizeof(opt->export_));
+  opt->import = NULL;
+  memset(opt->import_, 0, sizeof(opt->import_));
+  opt->control = NULL;
+  memset(opt->control_, 0, sizeof(opt->control_));
+  opt->query_socket = NULL;
+  memset(opt->query_socket_, 0, sizeof(opt->query_socket_));
+  opt->handoff = NULL;
+  memset(opt->handoff_, 0, sizeof(opt->handoff_));
+  opt->shared_cache = NULL;
+  memset(opt->shared_cache_, 0, sizeof(opt->shared_cache_));
+  opt->shared_cache_size = HSK_SHM_SIZE;
+  opt->prefetch = NULL;
+  memset(opt->prefetch_, 0, sizeof(opt->prefetch_));
+  opt->watch = NULL;
+  memset(opt->watch_, 0, sizeof(opt->watch_));
+  opt->capture = NULL;
+  memset(opt->capture_, 0, sizeof(opt->capture_));
 }
 
 static void
@@ -100,364 +294,2200 @@ daemonize(const char *logfile) {
   return true;
 }
 
+// Each on the loop that owns what it logs.
 static void
-help(int r) {
-  fprintf(stderr,
-    "\n"
-    "hnsd 0.0.0\n"
-    "  Copyright (c) 2018, Christopher Jeffrey <chjj@handshake.org>\n"
-    "\n"
-    "Usage: hnsd [options]\n"
-    "\n"
-    "  -c, --config <config>\n"
-    "    Path to config file.\n"
-    "\n"
-    "  -n, --ns-host <ip[:port]>\n"
-    "    IP address and port for root nameserver, e.g. 127.0.0.1:5369.\n"
-    "\n"
-    "  -r, --rs-host <ip[:port]>\n"
-    "    IP address and port for recursive nameserver, e.g. 127.0.0.1:53.\n"
-    "\n"
-    "  -i, --ns-ip <ip>\n"
-    "    Public IP for NS records in the root zone.\n"
-    "\n"
-    "  -u, --rs-config <config>\n"
-    "    Path to unbound config file.\n"
-    "\n"
-    "  -p, --pool-size <size>\n"
-    "    Size of peer pool.\n"
-    "\n"
-    "  -k, --identity-key <hex-string>\n"
-    "    Identity key for signing DNS responses as well as P2P messages.\n"
-    "\n"
-    "  -s, --seeds <seed1,seed2,...>\n"
-    "    Extra seeds to connect to on the P2P network.\n"
-    "    Example:\n"
-    "      -s aorsxa4ylaacshipyjkfbvzfkh3jhh4yowtoqdt64nzemqtiw2whk@127.0.0.1\n"
-    "\n"
-    "  -l, --log-file <filename>\n"
-    "    Redirect output to a log file.\n"
-    "\n"
-    "  -d, --daemonize\n"
-    "    Fork and background the process.\n"
-    "\n"
-    "  -h, --help\n"
-    "    This help message.\n"
-    "\n"
-  );
+after_pool_signal(uv_signal_t *handle, int signum) {
+  hsk_pool_t *pool = (hsk_pool_t *)handle->data;
+  hsk_pool_log_stats(pool);
+}
 
-  exit(r);
+static void
+after_stats_signal(uv_signal_t *handle, int signum) {
+  hsk_ns_t *ns = (hsk_ns_t *)handle->data;
+  hsk_ns_log_stats(ns);
+  hsk_prof_log();
+  hsk_mem_log();
 }
 
 static void
-parse_arg(int argc, char **argv, hsk_options_t *opt) {
-  const static char *optstring = "c:n:r:i:u:p:k:s:l:dh";
-
-  const static struct option longopts[] = {
-    { "config", required_argument, NULL, 'c' },
-    { "ns-host", required_argument, NULL, 'n' },
-    { "rs-host", required_argument, NULL, 'r' },
-    { "ns-ip", required_argument, NULL, 'i' },
-    { "rs-config", required_argument, NULL, 'u' },
-    { "pool-size", required_argument, NULL, 'p' },
-    { "identity-key", required_argument, NULL, 'k' },
-    { "seeds", required_argument, NULL, 's' },
-    { "log-file", required_argument, NULL, 'l' },
-    { "daemonize", no_argument, NULL, 'd' },
-    { "help", no_argument, NULL, 'h' }
-  };
+after_pool_stop(uv_async_t *handle) {
+  uv_stop(handle->loop);
+}
 
-  int longopt_idx = -1;
-  bool has_ip = false;
-  char *logfile = NULL;
-  bool background = false;
+static void
+run_pool(void *arg) {
+  uv_loop_t *loop = (uv_loop_t *)arg;
 
-  optind = 1;
+  if (hsk_affinity_pin(pool_cpu) != HSK_SUCCESS)
+    fprintf(stderr, "could not pin sync thread to cpu %d\n", pool_cpu);
 
-  for (;;) {
-    int o = getopt_long(argc, argv, optstring, longopts, &longopt_idx);
+  uv_run(loop, UV_RUN_DEFAULT);
+}
 
-    if (o == -1)
-      break;
+// Built once on first use, and independent of
+// everything else: done on a thread of their
+// own while the chain loads.
+static void
+warm_up(void *arg) {
+  uint64_t *elapsed = (uint64_t *)arg;
+  uint64_t start = uv_hrtime();
 
-    switch (o) {
-      case 'h': {
-        return help(0);
-      }
+  hsk_ec_shared();
+  hsk_dnssec_load();
+  hsk_icann_load();
 
-      case 'c': {
-        if (strlen(optarg) > 255)
-          return help(1);
-        strcpy(&opt->config_[0], optarg);
-        opt->config = &opt->config_[0];
-        break;
-      }
+  *elapsed = uv_hrtime() - start;
+}
 
-      case 'n': {
-        if (!hsk_sa_from_string(opt->ns_host, optarg, HSK_NS_PORT))
-          return help(1);
-        break;
-      }
+static void
+noop_work(uv_work_t *req) {}
 
-      case 'r': {
-        if (!hsk_sa_from_string(opt->rs_host, optarg, HSK_RS_PORT))
-          return help(1);
-        break;
-      }
+static void
+after_noop_work(uv_work_t *req, int status) {}
 
-      case 'i': {
-        if (!hsk_sa_from_string(opt->ns_ip, optarg, 0))
-          return help(1);
-        has_ip = true;
-        break;
-      }
+// Threads inherit their creator's CPUs: the
+// threadpool (signers, proof checks) starts
+// now, so that it is not pinned along with
+// the main loop.
+static void
+start_threadpool(uv_loop_t *loop) {
+  static uv_work_t req;
+  uv_queue_work(loop, &req, noop_work, after_noop_work);
+}
 
-      case 'u': {
-        if (strlen(optarg) > 255)
-          return help(1);
-        strcpy(&opt->rs_config_[0], optarg);
-        opt->rs_config = &opt->rs_config_[0];
-        break;
-      }
+static double
+ms_since(uint64_t start) {
+  return (double)(uv_hrtime() - start) / 1000000.0;
+}
 
-      case 'p': {
-        int size = atoi(optarg);
+// The cache goes out first: the new process
+// loads it before opening on the sockets.
+static int
+collect_sockets(void *arg, int *fds, int max) {
+  hsk_reload_t *reload = (hsk_reload_t *)arg;
+  int count;
 
-        if (size <= 0 || size > 1000)
-          return help(1);
+  if (hsk_ns_save(reload->ns) != HSK_SUCCESS)
+    fprintf(stderr, "handoff: failed saving cache\n");
 
-        opt->pool_size = size;
+  count = hsk_ns_get_fds(reload->ns, fds, max);
 
-        break;
-      }
+  if (*reload->rs)
+    count += hsk_rs_get_fds(*reload->rs, fds + count, max - count);
 
-      case 'k': {
-        if (hsk_hex_decode_size(optarg) != 32)
-          return help(1);
+  return count;
+}
 
-        if (!hsk_hex_decode(optarg, &opt->identity_key_[0]))
-          return help(1);
+static void
+after_handoff(void *arg) {
+  hsk_reload_t *reload = (hsk_reload_t *)arg;
 
-        opt->identity_key = &opt->identity_key_[0];
+  handed_off = true;
 
-        break;
-      }
+  uv_stop(reload->loop);
+}
 
-      case 's': {
-        if (opt->seeds)
-          free(opt->seeds);
+static void
+after_trace_signal(uv_signal_t *handle, int signum) {
+  hsk_ns_t *ns = (hsk_ns_t *)handle->data;
+  int rc = hsk_ns_dump_trace(ns, trace_file);
 
-        opt->seeds = strdup(optarg);
+  if (rc != HSK_SUCCESS)
+    fprintf(stderr, "failed dumping trace: %s\n", hsk_strerror(rc));
+}
 
-        if (!opt->seeds) {
-          printf("ENOMEM\n");
-          exit(1);
-          return;
-        }
+/*
+ * Options
+ */
 
-        break;
-      }
+// Tunables without a short option.
+#define HSK_OPT_POOL_RACE 256
+#define HSK_OPT_PROOF_TIMEOUT 257
+#define HSK_OPT_PROOF_RETRIES 258
+#define HSK_OPT_PENDING_MAX 259
+#define HSK_OPT_PROOF_CACHE 260
+#define HSK_OPT_PROOF_HEDGE 261
+#define HSK_OPT_NO_PROOF_WORKERS 262
+#define HSK_OPT_SEND_DELAY 263
+#define HSK_OPT_SEND_BYTES 264
+#define HSK_OPT_ORPHAN_SIZE 265
+#define HSK_OPT_CACHE_MIN_TTL 266
+#define HSK_OPT_CACHE_MAX_TTL 267
+#define HSK_OPT_CACHE_NEG_TTL 268
+#define HSK_OPT_CONTROL 269
+#define HSK_OPT_PREFETCH 270
+#define HSK_OPT_MINIMAL 271
+#define HSK_OPT_UDP_SIZE 272
+#define HSK_OPT_WATCH 273
+#define HSK_OPT_CAPTURE 274
+#define HSK_OPT_MEMORY_BUDGET 275
+#define HSK_OPT_ANY_HINFO 276
+#define HSK_OPT_IMPORT_HEADERS 277
+#define HSK_OPT_POOL_GROW 278
+#define HSK_OPT_NO_PEER_REPLACE 279
+#define HSK_OPT_HANDOFF 280
+#define HSK_OPT_CPUS 281
+#define HSK_OPT_SHARED_CACHE 282
+#define HSK_OPT_DOQ_HOST 283
+#define HSK_OPT_DOQ_CERT 284
+#define HSK_OPT_DOQ_KEY 285
+#define HSK_OPT_QUERY_SOCKET 286
+#define HSK_OPT_UDP_RCVBUF 287
+#define HSK_OPT_UDP_SNDBUF 288
+#define HSK_OPT_FULL_NODE 289
+#define HSK_OPT_READ_OFFLOAD 290
+#define HSK_OPT_SHARED_CACHE_SIZE 291
+#define HSK_OPT_UNSIGNED_ERRORS 292
+
+static const char *optstring =
+  "c:n:r:i:u:p:k:C:w:S:W:L:R:T:t:Pys:x:b:e:l:v:dh";
+
+static const struct option longopts[] = {
+  { "config", required_argument, NULL, 'c' },
+  { "ns-host", required_argument, NULL, 'n' },
+  { "rs-host", required_argument, NULL, 'r' },
+  { "ns-ip", required_argument, NULL, 'i' },
+  { "rs-config", required_argument, NULL, 'u' },
+  { "pool-size", required_argument, NULL, 'p' },
+  { "pool-race", required_argument, NULL, HSK_OPT_POOL_RACE },
+  { "pool-grow", required_argument, NULL, HSK_OPT_POOL_GROW },
+  { "full-node", required_argument, NULL, HSK_OPT_FULL_NODE },
+  { "proof-timeout", required_argument, NULL, HSK_OPT_PROOF_TIMEOUT },
+  { "proof-retries", required_argument, NULL, HSK_OPT_PROOF_RETRIES },
+  { "pending-max", required_argument, NULL, HSK_OPT_PENDING_MAX },
+  { "proof-cache", required_argument, NULL, HSK_OPT_PROOF_CACHE },
+  { "proof-hedge", required_argument, NULL, HSK_OPT_PROOF_HEDGE },
+  { "no-proof-workers", no_argument, NULL, HSK_OPT_NO_PROOF_WORKERS },
+  { "no-peer-replace", no_argument, NULL, HSK_OPT_NO_PEER_REPLACE },
+  { "send-delay", required_argument, NULL, HSK_OPT_SEND_DELAY },
+  { "send-bytes", required_argument, NULL, HSK_OPT_SEND_BYTES },
+  { "read-offload", required_argument, NULL, HSK_OPT_READ_OFFLOAD },
+  { "orphan-size", required_argument, NULL, HSK_OPT_ORPHAN_SIZE },
+  { "memory-budget", required_argument, NULL, HSK_OPT_MEMORY_BUDGET },
+  { "identity-key", required_argument, NULL, 'k' },
+  { "cache-size", required_argument, NULL, 'C' },
+  { "cache-min-ttl", required_argument, NULL, HSK_OPT_CACHE_MIN_TTL },
+  { "cache-max-ttl", required_argument, NULL, HSK_OPT_CACHE_MAX_TTL },
+  { "cache-neg-ttl", required_argument, NULL, HSK_OPT_CACHE_NEG_TTL },
+  { "ns-workers", required_argument, NULL, 'w' },
+  { "ns-signers", required_argument, NULL, 'S' },
+  { "minimal-responses", no_argument, NULL, HSK_OPT_MINIMAL },
+  { "any-hinfo", no_argument, NULL, HSK_OPT_ANY_HINFO },
+  { "unsigned-errors", no_argument, NULL, HSK_OPT_UNSIGNED_ERRORS },
+  { "udp-size", required_argument, NULL, HSK_OPT_UDP_SIZE },
+  { "udp-rcvbuf", required_argument, NULL, HSK_OPT_UDP_RCVBUF },
+  { "udp-sndbuf", required_argument, NULL, HSK_OPT_UDP_SNDBUF },
+  { "rs-workers", required_argument, NULL, 'W' },
+  { "ns-rate-limit", required_argument, NULL, 'L' },
+  { "rs-rate-limit", required_argument, NULL, 'R' },
+  { "doq-host", required_argument, NULL, HSK_OPT_DOQ_HOST },
+  { "doq-cert", required_argument, NULL, HSK_OPT_DOQ_CERT },
+  { "doq-key", required_argument, NULL, HSK_OPT_DOQ_KEY },
+  { "trace-file", required_argument, NULL, 'T' },
+  { "trace-rate", required_argument, NULL, 't' },
+  { "capture", required_argument, NULL, HSK_OPT_CAPTURE },
+  { "profile", no_argument, NULL, 'P' },
+  { "sync-thread", no_argument, NULL, 'y' },
+  { "cpus", required_argument, NULL, HSK_OPT_CPUS },
+  { "seeds", required_argument, NULL, 's' },
+  { "prefix", required_argument, NULL, 'x' },
+  { "bootstrap", required_argument, NULL, 'b' },
+  { "export", required_argument, NULL, 'e' },
+  { "import-headers", required_argument, NULL, HSK_OPT_IMPORT_HEADERS },
+  { "control", required_argument, NULL, HSK_OPT_CONTROL },
+  { "query-socket", required_argument, NULL, HSK_OPT_QUERY_SOCKET },
+  { "handoff", required_argument, NULL, HSK_OPT_HANDOFF },
+  { "shared-cache", required_argument, NULL, HSK_OPT_SHARED_CACHE },
+  { "shared-cache-size", required_argument, NULL, HSK_OPT_SHARED_CACHE_SIZE },
+  { "prefetch", required_argument, NULL, HSK_OPT_PREFETCH },
+  { "watch", required_argument, NULL, HSK_OPT_WATCH },
+  { "log-file", required_argument, NULL, 'l' },
+  { "log-level", required_argument, NULL, 'v' },
+  { "daemonize", no_argument, NULL, 'd' },
+  { "help", no_argument, NULL, 'h' },
+  { NULL, 0, NULL, 0 }
+};
+
+// Options a config file may set: all but the
+// ones that only make sense at the shell.
+static const struct option *
+find_option(const char *name) {
+  const struct option *o;
+
+  for (o = &longopts[0]; o->name; o++) {
+    if (strcmp(o->name, name) != 0)
+      continue;
+
+    switch (o->val) {
+      case 'c':
+      case 'l':
+      case 'd':
+      case 'h':
+        return NULL;
+    }
 
-      case 'l': {
-        if (logfile)
-          free(logfile);
+    return o;
+  }
 
-        logfile = strdup(optarg);
+  return NULL;
+}
 
-        if (!logfile) {
-          printf("ENOMEM\n");
-          exit(1);
-          return;
-        }
+// Shared by the command line and the config
+// file (value is empty for flags).
+static bool
+set_option(hsk_options_t *opt, int code, const char *value) {
+  switch (code) {
+    case 'n': {
+      if (!hsk_sa_from_string(opt->ns_host, value, HSK_NS_PORT))
+        return false;
+      return true;
+    }
 
-        break;
-      }
+    case 'r': {
+      if (!hsk_sa_from_string(opt->rs_host, value, HSK_RS_PORT))
+        return false;
+      return true;
+    }
 
-      case 'd': {
-        background = true;
-        break;
-      }
+    case HSK_OPT_DOQ_HOST: {
+      opt->doq_host = (struct sockaddr *)&opt->_doq_host;
+      if (!hsk_sa_from_string(opt->doq_host, value, HSK_DOQ_PORT))
+        return false;
+      return true;
+    }
 
-      case '?': {
-        return help(1);
-      }
+    case HSK_OPT_DOQ_CERT: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->doq_cert_[0], value);
+      opt->doq_cert = &opt->doq_cert_[0];
+      return true;
     }
-  }
 
-  if (optind < argc)
-    return help(1);
+    case HSK_OPT_DOQ_KEY: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->doq_key_[0], value);
+      opt->doq_key = &opt->doq_key_[0];
+      return true;
+    }
 
-  if (!has_ip)
-    hsk_sa_copy(opt->ns_ip, opt->ns_host);
+    case 'i': {
+      if (!hsk_sa_from_string(opt->ns_ip, value, 0))
+        return false;
+      opt->has_ip = true;
+      return true;
+    }
 
-  if (background)
-    daemonize(logfile);
-  else if (logfile)
-    set_logfile(logfile);
+    case 'u': {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->rs_config_[0], value);
+      opt->rs_config = &opt->rs_config_[0];
+      return true;
+    }
 
-  if (logfile)
-    free(logfile);
-}
+    case 'p': {
+      int size = atoi(value);
 
-static bool
-print_identity(const uint8_t *key) {
-  hsk_ec_t *ec = hsk_ec_alloc();
+      if (size <= 0 || size > 1000)
+        return false;
 
-  if (!ec)
-    return false;
+      opt->pool_size = size;
 
-  uint8_t pub[33];
+      return true;
+    }
 
-  if (!hsk_ec_create_pubkey(ec, key, pub)) {
-    hsk_ec_free(ec);
-    return false;
-  }
+    case 'k': {
+      if (hsk_hex_decode_size(value) != 32)
+        return false;
 
-  hsk_ec_free(ec);
+      if (!hsk_hex_decode(value, &opt->identity_key_[0]))
+        return false;
 
-  size_t size = hsk_base32_encode_size(pub, 33, false);
-  assert(size <= 54);
+      opt->identity_key = &opt->identity_key_[0];
 
-  char b32[54];
-  hsk_base32_encode(pub, 33, b32, false);
+      return true;
+    }
 
-  printf("starting with identity key of: %s\n", b32);
+    case 'C': {
+      long long size = atoll(value);
 
-  return true;
-}
+      if (size <= 0)
+        return false;
 
-/*
- * Main
- */
+      opt->cache_size = (size_t)size;
 
-int
-main(int argc, char **argv) {
-  hsk_options_t opt;
-  hsk_options_init(&opt);
+      return true;
+    }
 
-  parse_arg(argc, argv, &opt);
+    case 'w': {
+      int count = atoi(value);
 
-  int rc = HSK_SUCCESS;
-  uv_loop_t *loop = NULL;
-  hsk_pool_t *pool = NULL;
-  hsk_ns_t *ns = NULL;
-  hsk_rs_t *rs = NULL;
+      if (count < 0 || count > HSK_NS_WORKERS_MAX)
+        return false;
 
-  if (opt.identity_key) {
-    if (!print_identity(opt.identity_key)) {
-      fprintf(stderr, "invalid identity key\n");
-      rc = HSK_EFAILURE;
-      goto done;
-    }
-  }
+      opt->ns_workers = count;
 
-  loop = uv_default_loop();
+      return true;
+    }
 
-  if (!loop) {
-    fprintf(stderr, "failed initializing loop\n");
-    rc = HSK_EFAILURE;
-    goto done;
-  }
+    case 'S': {
+      int count = atoi(value);
 
-  pool = hsk_pool_alloc(loop);
+      if (count < 0 || count > HSK_NS_SIGNERS_MAX)
+        return false;
 
-  if (!pool) {
-    fprintf(stderr, "failed initializing pool\n");
-    rc = HSK_ENOMEM;
-    goto done;
-  }
+      opt->ns_signers = count;
 
-  if (opt.identity_key) {
-    if (!hsk_pool_set_key(pool, opt.identity_key)) {
-      fprintf(stderr, "failed setting identity key\n");
-      rc = HSK_EFAILURE;
-      goto done;
+      return true;
     }
-  }
 
-  if (!hsk_pool_set_size(pool, opt.pool_size)) {
-    fprintf(stderr, "failed setting pool size\n");
-    rc = HSK_EFAILURE;
-    goto done;
-  }
+    case 'W': {
+      int count = atoi(value);
 
-  if (!hsk_pool_set_seeds(pool, opt.seeds)) {
-    fprintf(stderr, "failed adding seeds\n");
-    rc = HSK_EFAILURE;
-    goto done;
-  }
+      if (count < 0 || count > HSK_RS_WORKERS_MAX)
+        return false;
 
-  ns = hsk_ns_alloc(loop, pool);
+      opt->rs_workers = count;
 
-  if (!ns) {
-    fprintf(stderr, "failed initializing ns\n");
-    rc = HSK_ENOMEM;
-    goto done;
-  }
+      return true;
+    }
 
-  if (!hsk_ns_set_ip(ns, opt.ns_ip)) {
-    fprintf(stderr, "failed setting ip\n");
-    rc = HSK_EFAILURE;
-    goto done;
-  }
+    case 'L': {
+      long long rate = atoll(value);
 
-  if (opt.identity_key) {
-    if (!hsk_ns_set_key(ns, opt.identity_key)) {
-      fprintf(stderr, "failed setting identity key\n");
-      rc = HSK_EFAILURE;
-      goto done;
+      if (rate < 0 || rate > UINT32_MAX)
+        return false;
+
+      opt->ns_rate = (uint32_t)rate;
+
+      return true;
     }
-  }
 
-  rs = hsk_rs_alloc(loop, opt.ns_host);
+    case 'R': {
+      long long rate = atoll(value);
 
-  if (!rs) {
-    fprintf(stderr, "failed initializing rns\n");
-    rc = HSK_ENOMEM;
-    goto done;
-  }
+      if (rate < 0 || rate > UINT32_MAX)
+        return false;
 
-  if (opt.rs_config) {
-    if (!hsk_rs_set_config(rs, opt.rs_config)) {
-      fprintf(stderr, "failed setting rs config\n");
-      rc = HSK_EFAILURE;
-      goto done;
+      opt->rs_rate = (uint32_t)rate;
+
+      return true;
     }
-  }
 
-  if (opt.identity_key) {
-    if (!hsk_rs_set_key(rs, opt.identity_key)) {
-      fprintf(stderr, "failed setting identity key\n");
-      rc = HSK_EFAILURE;
-      goto done;
+    case 'T': {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->trace_file_[0], value);
+      opt->trace_file = &opt->trace_file_[0];
+      return true;
     }
-  }
 
+    case 't': {
+      long long rate = atoll(value);
+
+      if (rate < 1 || rate > UINT32_MAX)
+        return false;
+
+      opt->trace_rate = (uint32_t)rate;
+
+      return true;
+    }
+
+    case 'P': {
+      opt->profile = true;
+      return true;
+    }
+
+    case 'y': {
+      opt->sync_thread = true;
+      return true;
+    }
+
+    case HSK_OPT_CPUS: {
+      hsk_affinity_t aff;
+      if (strlen(value) > 255 || !hsk_affinity_parse(&aff, value))
+        return false;
+      strcpy(&opt->cpus_[0], value);
+      opt->cpus = &opt->cpus_[0];
+      return true;
+    }
+
+    case 's': {
+      if (opt->seeds)
+        hsk_free(opt->seeds);
+
+      opt->seeds = hsk_strdup(value);
+
+      if (!opt->seeds) {
+        printf("ENOMEM\n");
+        exit(1);
+        return false;
+      }
+
+      return true;
+    }
+
+    case 'x': {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->prefix_[0], value);
+      opt->prefix = &opt->prefix_[0];
+      return true;
+    }
+
+    case 'b': {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->snapshot_[0], value);
+      opt->snapshot = &opt->snapshot_[0];
+      return true;
+    }
+
+    case 'e': {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->export_[0], value);
+      opt->export = &opt->export_[0];
+      return true;
+    }
+
+    case HSK_OPT_IMPORT_HEADERS: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->import_[0], value);
+      opt->import = &opt->import_[0];
+      return true;
+    }
+
+    case 'v': {
+      if (!hsk_log_set_level(value))
+        return false;
+      return true;
+    }
+
+    case HSK_OPT_CONTROL: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->control_[0], value);
+      opt->control = &opt->control_[0];
+      return true;
+    }
+
+    case HSK_OPT_QUERY_SOCKET: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->query_socket_[0], value);
+      opt->query_socket = &opt->query_socket_[0];
+      return true;
+    }
+
+    case HSK_OPT_HANDOFF: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->handoff_[0], value);
+      opt->handoff = &opt->handoff_[0];
+      return true;
+    }
+
+    case HSK_OPT_SHARED_CACHE: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->shared_cache_[0], value);
+      opt->shared_cache = &opt->shared_cache_[0];
+      return true;
+    }
+
+    case HSK_OPT_SHARED_CACHE_SIZE: {
+      long long mib = atoll(value);
+
+      if (mib < 1 || mib > 65536)
+        return false;
+
+      opt->shared_cache_size = (size_t)mib << 20;
+
+      return true;
+    }
+
+    case HSK_OPT_PREFETCH: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->prefetch_[0], value);
+      opt->prefetch = &opt->prefetch_[0];
+      return true;
+    }
+
+    case HSK_OPT_WATCH: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->watch_[0], value);
+      opt->watch = &opt->watch_[0];
+      return true;
+    }
+
+    case HSK_OPT_CAPTURE: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->capture_[0], value);
+      opt->capture = &opt->capture_[0];
+      return true;
+    }
+
+    case HSK_OPT_POOL_RACE: {
+      int race = atoi(value);
+
+      if (race < 0 || race > HSK_POOL_RACE_MAX)
+        return false;
+
+      opt->pool_race = race;
+
+      return true;
+    }
+
+    case HSK_OPT_POOL_GROW: {
+      int grow = atoi(value);
+
+      if (grow < 0 || grow > 1000)
+        return false;
+
+      opt->pool_grow = grow;
+
+      return true;
+    }
+
+    case HSK_OPT_FULL_NODE: {
+      if (strlen(value) > 255)
+        return false;
+      strcpy(&opt->full_node_[0], value);
+      opt->full_node = &opt->full_node_[0];
+      return true;
+    }
+
+    case HSK_OPT_PROOF_TIMEOUT: {
+      long long timeout = atoll(value);
+
+      if (timeout <= 0 || timeout > 3600)
+        return false;
+
+      opt->proof_timeout = (int64_t)timeout;
+
+      return true;
+    }
+
+    case HSK_OPT_PROOF_RETRIES: {
+      int retries = atoi(value);
+
+      if (retries < 0 || retries > 100)
+        return false;
+
+      opt->proof_retries = retries;
+
+      return true;
+    }
+
+    case HSK_OPT_PENDING_MAX: {
+      long long max = atoll(value);
+
+      if (max <= 0 || max > 1000000)
+        return false;
+
+      opt->pending_max = (int)max;
+
+      return true;
+    }
+
+    case HSK_OPT_PROOF_CACHE: {
+      long long size = atoll(value);
+
+      if (size <= 0)
+        return false;
+
+      opt->proof_cache = (size_t)size;
+
+      return true;
+    }
+
+    case HSK_OPT_PROOF_HEDGE: {
+      int percentile = atoi(value);
+
+      if (percentile < 0 || percentile > 100)
+        return false;
+
+      opt->proof_hedge = percentile;
+
+      return true;
+    }
+
+    case HSK_OPT_NO_PROOF_WORKERS: {
+      opt->proof_workers = false;
+      return true;
+    }
+
+    case HSK_OPT_NO_PEER_REPLACE: {
+      opt->peer_replace = false;
+      return true;
+    }
+
+    case HSK_OPT_MINIMAL: {
+      opt->minimal = true;
+      return true;
+    }
+
+    case HSK_OPT_ANY_HINFO: {
+      opt->any_hinfo = true;
+      return true;
+    }
+
+    case HSK_OPT_UNSIGNED_ERRORS: {
+      opt->unsigned_errors = true;
+      return true;
+    }
+
+    case HSK_OPT_UDP_SIZE: {
+      int size = atoi(value);
+
+      if (size < HSK_DNS_MAX_UDP || size > HSK_DNS_MAX_EDNS)
+        return false;
+
+      opt->udp_size = (size_t)size;
+
+      return true;
+    }
+
+    case HSK_OPT_UDP_RCVBUF:
+    case HSK_OPT_UDP_SNDBUF: {
+      long long size = atoll(value);
+
+      if (size < 0 || size > (1 << 30))
+        return false;
+
+      if (code == HSK_OPT_UDP_RCVBUF)
+        opt->udp_rcvbuf = (int)size;
+      else
+        opt->udp_sndbuf = (int)size;
+
+      return true;
+    }
+
+    case HSK_OPT_SEND_DELAY: {
+      long long delay = atoll(value);
+
+      if (delay < 0 || delay > 60000)
+        return false;
+
+      opt->send_delay = (uint64_t)delay;
+
+      return true;
+    }
+
+    case HSK_OPT_SEND_BYTES: {
+      long long size = atoll(value);
+
+      if (size <= 0)
+        return false;
+
+      opt->send_bytes = (size_t)size;
+
+      return true;
+    }
+
+    case HSK_OPT_READ_OFFLOAD: {
+      long long size = atoll(value);
+
+      if (size < 0 || (size > 0 && size < HSK_OFFLOAD_MIN))
+        return false;
+
+      opt->read_offload = (size_t)size;
+
+      return true;
+    }
+
+    case HSK_OPT_ORPHAN_SIZE: {
+      long long size = atoll(value);
+
+      if (size <= 0)
+        return false;
+
+      opt->orphan_size = (size_t)size;
+
+      return true;
+    }
+
+    case HSK_OPT_MEMORY_BUDGET: {
+      long long size = atoll(value);
+
+      if (size <= 0)
+        return false;
+
+      opt->mem_budget = (size_t)size;
+
+      return true;
+    }
+
+    case HSK_OPT_CACHE_MIN_TTL:
+    case HSK_OPT_CACHE_MAX_TTL:
+    case HSK_OPT_CACHE_NEG_TTL: {
+      long long ttl = atoll(value);
+
+      if (ttl < 0 || ttl > UINT32_MAX)
+        return false;
+
+      if (code == HSK_OPT_CACHE_MIN_TTL)
+        opt->min_ttl = (uint32_t)ttl;
+      else if (code == HSK_OPT_CACHE_MAX_TTL)
+        opt->max_ttl = (uint32_t)ttl;
+      else
+        opt->neg_ttl = (uint32_t)ttl;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Config
+ */
+
+static void
+hsk_config_init(hsk_config_t *conf) {
+  conf->pool_size = HSK_POOL_SIZE;
+  conf->cache_size = HSK_CACHE_SIZE;
+  conf->seeds = NULL;
+  conf->rs_config = NULL;
+  memset(conf->rs_config_, 0, sizeof(conf->rs_config_));
+}
+
+static void
+hsk_config_uninit(hsk_config_t *conf) {
+  if (conf->seeds)
+    hsk_free(conf->seeds);
+  conf->seeds = NULL;
+}
+
+static bool
+hsk_config_copy(hsk_config_t *conf, const hsk_config_t *from) {
+  hsk_config_uninit(conf);
+
+  conf->pool_size = from->pool_size;
+  conf->cache_size = from->cache_size;
+  conf->rs_config = NULL;
+  memcpy(conf->rs_config_, from->rs_config_, sizeof(conf->rs_config_));
+
+  if (from->rs_config)
+    conf->rs_config = &conf->rs_config_[0];
+
+  if (from->seeds) {
+    conf->seeds = hsk_strdup(from->seeds);
+    if (!conf->seeds)
+      return false;
+  }
+
+  return true;
+}
+
+static bool
+hsk_config_set(hsk_config_t *conf, const char *key, const char *value) {
+  if (strcmp(key, "pool-size") == 0) {
+    int size = atoi(value);
+
+    if (size <= 0 || size > 1000)
+      return false;
+
+    conf->pool_size = size;
+
+    return true;
+  }
+
+  if (strcmp(key, "cache-size") == 0) {
+    long long size = atoll(value);
+
+    if (size <= 0)
+      return false;
+
+    conf->cache_size = (size_t)size;
+
+    return true;
+  }
+
+  if (strcmp(key, "seeds") == 0) {
+    char *seeds = hsk_strdup(value);
+
+    if (!seeds)
+      return false;
+
+    if (conf->seeds)
+      hsk_free(conf->seeds);
+
+    conf->seeds = seeds;
+
+    return true;
+  }
+
+  if (strcmp(key, "rs-config") == 0) {
+    if (strlen(value) > 255)
+      return false;
+
+    strcpy(&conf->rs_config_[0], value);
+    conf->rs_config = &conf->rs_config_[0];
+
+    return true;
+  }
+
+  return false;
+}
+
+typedef bool (*hsk_config_set_func)(
+  void *arg,
+  const char *key,
+  const char *value
+);
+
+// One option per line, named as on the command
+// line: `pool-size 16` (or `pool-size = 16`).
+// Blank lines and anything after a # are
+// skipped.
+static bool
+hsk_config_parse(const char *path, hsk_config_set_func set, void *arg) {
+  FILE *file = fopen(path, "r");
+
+  if (!file) {
+    fprintf(stderr, "could not open config file: %s\n", path);
+    return false;
+  }
+
+  char line[1024];
+  int num = 0;
+  bool ret = true;
+
+  while (fgets(line, sizeof(line), file)) {
+    char *key = line;
+    char *value;
+    char *end;
+
+    num += 1;
+
+    if ((end = strchr(line, '#')))
+      *end = '\0';
+
+    end = line + strlen(line);
+
+    while (end > line && isspace((unsigned char)end[-1]))
+      *--end = '\0';
+
+    while (isspace((unsigned char)*key))
+      key += 1;
+
+    if (*key == '\0')
+      continue;
+
+    value = key;
+
+    while (*value && !isspace((unsigned char)*value) && *value != '=')
+      value += 1;
+
+    if (*value)
+      *value++ = '\0';
+
+    while (isspace((unsigned char)*value) || *value == '=')
+      value += 1;
+
+    if (!set(arg, key, value)) {
+      fprintf(stderr, "invalid config option (%s:%d): %s\n", path, num, key);
+      ret = false;
+      break;
+    }
+  }
+
+  fclose(file);
+
+  return ret;
+}
+
+// Anything else is read at startup only, and
+// skipped on a reload.
+static bool
+reload_option(void *arg, const char *key, const char *value) {
+  hsk_config_t *conf = (hsk_config_t *)arg;
+
+  if (strcmp(key, "pool-size") == 0
+      || strcmp(key, "cache-size") == 0
+      || strcmp(key, "seeds") == 0
+      || strcmp(key, "rs-config") == 0) {
+    return hsk_config_set(conf, key, value);
+  }
+
+  return find_option(key) != NULL;
+}
+
+// Starts from the command line.
+static bool
+hsk_config_read(hsk_config_t *conf, const char *path) {
+  if (!hsk_config_copy(conf, &base_config))
+    return false;
+
+  return hsk_config_parse(path, reload_option, (void *)conf);
+}
+
+static bool
+startup_option(void *arg, const char *key, const char *value) {
+  hsk_options_t *opt = (hsk_options_t *)arg;
+  const struct option *o = find_option(key);
+
+  if (!o)
+    return false;
+
+  if ((o->has_arg == no_argument) != (*value == '\0'))
+    return false;
+
+  return set_option(opt, o->val, value);
+}
+
+static void
+help(int r) {
+  fprintf(stderr,
+    "\n"
+    "hnsd 0.0.0\n"
+    "  Copyright (c) 2018, Christopher Jeffrey <chjj@handshake.org>\n"
+    "\n"
+    "Usage: hnsd [options]\n"
+    "\n"
+    "  -c, --config <config>\n"
+    "    Path to config file: any long option below but --config,\n"
+    "    --log-file, --daemonize and --help, one per line (e.g.\n"
+    "    `pool-size 16`). It wins over the command line. On SIGHUP,\n"
+    "    pool-size, seeds, cache-size and rs-config are read again.\n"
+    "\n"
+    "  -n, --ns-host <ip[:port]>\n"
+    "    IP address and port for root nameserver, e.g. 127.0.0.1:5369.\n"
+    "\n"
+    "  -r, --rs-host <ip[:port]>\n"
+    "    IP address and port for recursive nameserver, e.g. 127.0.0.1:53.\n"
+    "\n"
+    "  -i, --ns-ip <ip>\n"
+    "    Public IP for NS records in the root zone.\n"
+    "\n"
+    "  -u, --rs-config <config>\n"
+    "    Path to unbound config file.\n"
+    "\n"
+    "  -p, --pool-size <size>\n"
+    "    Size of peer pool (default: 32).\n"
+    "\n"
+    "  --pool-race <count>\n"
+    "    Extra connection attempts raced while short of peers (default: 4).\n"
+    "\n"
+    "  --pool-grow <count>\n"
+    "    Peers to add on top of the pool size while proof requests back\n"
+    "    up, dropped again once idle (default: 0).\n"
+    "\n"
+    "  --full-node <key@host:port>\n"
+    "    A trusted full node close by, kept connected and asked for\n"
+    "    proofs first (they are still checked against our own chain).\n"
+    "\n"
+    "  --proof-timeout <seconds>\n"
+    "    Time a peer gets to answer a proof request (default: 5).\n"
+    "\n"
+    "  --proof-retries <count>\n"
+    "    Other peers a timed out request is sent to (default: 2).\n"
+    "\n"
+    "  --pending-max <count>\n"
+    "    Names waiting for a peer before lookups fail (default: 1000).\n"
+    "\n"
+    "  --proof-cache <count>\n"
+    "    Verified proofs kept for the current tree root (default: 4096).\n"
+    "\n"
+    "  --proof-hedge <percentile>\n"
+    "    Ask a second peer once a proof is slower than this percentile\n"
+    "    of recent ones (default: 95, 0 to disable).\n"
+    "\n"
+    "  --no-proof-workers\n"
+    "    Verify proofs and make handshake keys on the event loop rather\n"
+    "    than the thread pool.\n"
+    "\n"
+    "  --no-peer-replace\n"
+    "    Keep peers until they fail rather than swapping the slowest for\n"
+    "    known peers that handshake faster.\n"
+    "\n"
+    "  --send-delay <ms>\n"
+    "    Time to hold outbound P2P messages for (default: 0).\n"
+    "\n"
+    "  --send-bytes <bytes>\n"
+    "    Queued bytes that flush a peer right away (default: 65536).\n"
+    "\n"
+    "  --read-offload <bytes>\n"
+    "    Decrypt and decode P2P frames this big or bigger on the thread\n"
+    "    pool (at least 16384; default: 0, for none).\n"
+    "\n"
+    "  --orphan-size <bytes>\n"
+    "    Memory for out of order headers, a quarter of it at most\n"
+    "    for each peer (default: 4194304).\n"
+    "\n"
+    "  --memory-budget <bytes>\n"
+    "    Bound what the chain, caches, orphans, requests and peers hold\n"
+    "    together; over it, caches are evicted first, then orphans,\n"
+    "    then idle peers. Also sizes unbound's caches (default: none).\n"
+    "\n"
+    "  -k, --identity-key <hex-string>\n"
+    "    Identity key for signing DNS responses as well as P2P messages.\n"
+    "\n"
+    "  -C, --cache-size <bytes>\n"
+    "    Memory budget for cached root zone responses (default: 8388608).\n"
+    "\n"
+    "  --cache-min-ttl <seconds>\n"
+    "  --cache-max-ttl <seconds>\n"
+    "    Bounds on how long root zone responses are cached (default:\n"
+    "    0 and 21600).\n"
+    "\n"
+    "  --cache-neg-ttl <seconds>\n"
+    "    How long negative responses are cached (default: 60).\n"
+    "\n"
+    "  -w, --ns-workers <count>\n"
+    "    Extra threads answering root queries, each with its own socket\n"
+    "    (SO_REUSEPORT) (default: 0).\n"
+    "\n"
+    "  -S, --ns-signers <count>\n"
+    "    Threads building and signing root replies off the event loop\n"
+    "    (sets UV_THREADPOOL_SIZE) (default: 0, sign on the loop).\n"
+    "\n"
+    "  --udp-size <bytes>\n"
+    "    Largest UDP reply either nameserver sends, and the EDNS buffer\n"
+    "    size used (512-4096, default: 1232, to avoid fragmentation).\n"
+    "\n"
+    "  --udp-rcvbuf <bytes>\n"
+    "    Kernel receive buffer of each nameserver UDP socket, holding\n"
+    "    bursts until they are read (default: 1048576, 0 for the system\n"
+    "    default). Past net.core.rmem_max only with CAP_NET_ADMIN.\n"
+    "\n"
+    "  --udp-sndbuf <bytes>\n"
+    "    Same, for replies on their way out (default: 1048576).\n"
+    "\n"
+    "  --minimal-responses\n"
+    "    Leave optional additional data (addresses for MX, SRV and CNAME\n"
+    "    targets, out-of-zone glue) out of root answers.\n"
+    "\n"
+    "  --any-hinfo\n"
+    "    Answer ANY queries for a TLD with a signed HINFO record rather\n"
+    "    than one of its RRsets (RFC 8482).\n"
+    "\n"
+    "  --unsigned-errors\n"
+    "    Send SERVFAIL and NOTIMP without SIG(0), so that failing under\n"
+    "    load costs no signature.\n"
+    "\n"
+    "  -W, --rs-workers <count>\n"
+    "    Extra threads answering recursive queries, each with its own\n"
+    "    unbound context and socket (SO_REUSEPORT) (default: 0).\n"
+    "\n"
+    "  -L, --ns-rate-limit <qps>\n"
+    "    UDP queries per second allowed from each source prefix (/24 or\n"
+    "    /56) by the root nameserver (default: 0, no limit). Queries with\n"
+    "    a valid DNS cookie (RFC 7873) from us are not limited.\n"
+    "    With workers, each thread keeps its own table and gets an even\n"
+    "    share of the rate, so a prefix whose queries all land on one\n"
+    "    thread is held to less than this.\n"
+    "\n"
+    "  -R, --rs-rate-limit <qps>\n"
+    "    Same, for the recursive nameserver (default: 0, no limit).\n"
+    "\n"
+    "  --doq-host <ip[:port]>\n"
+    "    Also serve the recursive nameserver over QUIC (RFC 9250) here,\n"
+    "    e.g. 0.0.0.0:853. Needs ./configure --enable-quic.\n"
+    "\n"
+    "  --doq-cert <file>\n"
+    "    PEM certificate chain for --doq-host.\n"
+    "\n"
+    "  --doq-key <file>\n"
+    "    PEM private key for --doq-host.\n"
+    "\n"
+    "  -T, --trace-file <file>\n"
+    "    Trace a sample of root queries; SIGUSR2 appends the latest\n"
+    "    to this file.\n"
+    "\n"
+    "  -t, --trace-rate <n>\n"
+    "    Trace one in every n root queries (default: 100).\n"
+    "\n"
+    "  --capture <file>\n"
+    "    Record every query to either nameserver, as it arrived, for\n"
+    "    hnsd-replay (truncates the file; stops at 1 GiB).\n"
+    "\n"
+    "  -P, --profile\n"
+    "    Time event loop callbacks and log loop stalls.\n"
+    "\n"
+    "  -y, --sync-thread\n"
+    "    Sync headers and fetch proofs on a thread of their own, apart\n"
+    "    from the one serving DNS.\n"
+    "\n"
+    "  --cpus <list>\n"
+    "    CPUs to pin threads to, in order: the main loop, ns workers,\n"
+    "    rs workers, then the sync thread (example: 0-7,16-23).\n"
+    "\n"
+    "  -s, --seeds <seed1,seed2,...>\n"
+    "    Extra seeds to connect to on the P2P network.\n"
+    "    Example:\n"
+    "      -s aorsxa4ylaacshipyjkfbvzfkh3jhh4yowtoqdt64nzemqtiw2whk@127.0.0.1\n"
+    "\n"
+    "  -x, --prefix <dir>\n"
+    "    Directory to store the header chain, known peers and the\n"
+    "    nameserver cache in (enables persistence).\n"
+    "\n"
+    "  -b, --bootstrap <file>\n"
+    "    Import headers from a snapshot before syncing.\n"
+    "\n"
+    "  -e, --export <file>\n"
+    "    Write a snapshot of the stored header chain and exit.\n"
+    "\n"
+    "  --import-headers <file>\n"
+    "    Add raw serialized headers to the stored header chain, checking\n"
+    "    each proof of work, and exit.\n"
+    "\n"
+    "  --control <path>\n"
+    "    Unix socket to listen on for status queries, cache purges and\n"
+    "    prefetches, and log level changes (send `help` for the rest).\n"
+    "\n"
+    "  --query-socket <path>\n"
+    "    Unix socket answering batches of names for programs on this\n"
+    "    host, in a binary protocol (see src/ipc.h).\n"
+    "\n"
+    "  --handoff <path>\n"
+    "    Unix socket for restarts: a new hnsd started with the same path\n"
+    "    takes over the DNS sockets of the one listening there, which\n"
+    "    writes out its cache first and exits once the new one is up.\n"
+    "\n"
+    "  --shared-cache <path>\n"
+    "    File to map as a second cache of answers, shared with every\n"
+    "    hnsd on the host given the same path (created if missing).\n"
+    "    Also holds the resources of TLDs, so that on disk it serves as\n"
+    "    a warm tier for names the memory cache has no room for.\n"
+    "\n"
+    "  --shared-cache-size <MiB>\n"
+    "    Size of the shared cache file when created (default: 64).\n"
+    "\n"
+    "  --prefetch <file>\n"
+    "    Names to resolve into the cache once synced, one per line,\n"
+    "    optionally followed by a type (default: A).\n"
+    "\n"
+    "  --watch <file>\n"
+    "    Names (TLDs) to keep verified, one per line: their proofs are\n"
+    "    fetched every time the tree root moves and kept under the\n"
+    "    prefix, so lookups for them never wait on a peer.\n"
+    "\n"
+    "  -l, --log-file <filename>\n"
+    "    Redirect output to a log file.\n"
+    "\n"
+    "  -v, --log-level <error|info|debug>\n"
+    "    Most verbose lines to write (default: info). Debug lines are\n"
+    "    per query and per header.\n"
+    "\n"
+    "  -d, --daemonize\n"
+    "    Fork and background the process.\n"
+    "\n"
+    "  -h, --help\n"
+    "    This help message.\n"
+    "\n"
+    "  Send SIGUSR1 to print peer, pool and nameserver statistics\n"
+    "  (and loop timings, with --profile).\n"
+    "  Send SIGUSR2 to write out traced queries (see --trace-file).\n"
+    "  Send SIGHUP to apply changes to the config file (see --config).\n"
+    "\n"
+  );
+
+  exit(r);
+}
+
+static void
+parse_arg(int argc, char **argv, hsk_options_t *opt) {
+  int longopt_idx = -1;
+  char *logfile = NULL;
+  bool background = false;
+
+  optind = 1;
+
+  for (;;) {
+    int o = getopt_long(argc, argv, optstring, longopts, &longopt_idx);
+
+    if (o == -1)
+      break;
+
+    switch (o) {
+      case 'h': {
+        return help(0);
+      }
+
+      case 'c': {
+        if (strlen(optarg) > 255)
+          return help(1);
+        strcpy(&opt->config_[0], optarg);
+        opt->config = &opt->config_[0];
+        break;
+      }
+
+      case 'l': {
+        if (logfile)
+          hsk_free(logfile);
+
+        logfile = hsk_strdup(optarg);
+
+        if (!logfile) {
+          printf("ENOMEM\n");
+          exit(1);
+          return;
+        }
+
+        break;
+      }
+
+      case 'd': {
+        background = true;
+        break;
+      }
+
+      case '?': {
+        return help(1);
+      }
+
+      default: {
+        if (!set_option(opt, o, optarg ? optarg : ""))
+          return help(1);
+        break;
+      }
+    }
+  }
+
+  if (optind < argc)
+    return help(1);
+
+  if (background)
+    daemonize(logfile);
+  else if (logfile)
+    set_logfile(logfile);
+
+  if (logfile)
+    hsk_free(logfile);
+}
+
+static void
+after_reload_timer(uv_timer_t *timer);
+
+static bool
+print_identity(const uint8_t *key) {
+  hsk_ec_t *ec = hsk_ec_shared();
+
+  if (!ec)
+    return false;
+
+  uint8_t pub[33];
+
+  if (!hsk_ec_create_pubkey(ec, key, pub))
+    return false;
+
+  size_t size = hsk_base32_encode_size(pub, 33, false);
+  assert(size <= 54);
+
+  char b32[54];
+  hsk_base32_encode(pub, 33, b32, false);
+
+  printf("starting with identity key of: %s\n", b32);
+
+  return true;
+}
+
+// The file wins over the command line.
+static bool
+load_config(hsk_options_t *opt) {
+  base_config.pool_size = opt->pool_size;
+  base_config.cache_size = opt->cache_size;
+  base_config.seeds = NULL;
+  base_config.rs_config = NULL;
+  memcpy(base_config.rs_config_, opt->rs_config_, sizeof(opt->rs_config_));
+
+  if (opt->rs_config)
+    base_config.rs_config = &base_config.rs_config_[0];
+
+  if (opt->seeds) {
+    base_config.seeds = hsk_strdup(opt->seeds);
+    if (!base_config.seeds)
+      return false;
+  }
+
+  config_file = opt->config;
+
+  return hsk_config_parse(config_file, startup_option, (void *)opt);
+}
+
+static time_t
+file_mtime(const char *path) {
+  struct stat st;
+
+  if (!path || stat(path, &st) != 0)
+    return 0;
+
+  return st.st_mtime;
+}
+
+static int
+open_rs(hsk_reload_t *reload) {
+  const hsk_options_t *opt = reload->opt;
+  hsk_rs_t *rs = hsk_rs_alloc(reload->loop, opt->ns_host);
+
+  if (!rs) {
+    fprintf(stderr, "failed initializing rns\n");
+    return HSK_ENOMEM;
+  }
+
+  *reload->rs = rs;
+
+  if (opt->rs_config) {
+    if (!hsk_rs_set_config(rs, opt->rs_config)) {
+      fprintf(stderr, "failed setting rs config\n");
+      return HSK_EFAILURE;
+    }
+  }
+
+  if (opt->identity_key) {
+    if (!hsk_rs_set_key(rs, opt->identity_key)) {
+      fprintf(stderr, "failed setting identity key\n");
+      return HSK_EFAILURE;
+    }
+  }
+
+  if (!hsk_rs_set_workers(rs, opt->rs_workers)) {
+    fprintf(stderr, "failed setting rs workers\n");
+    return HSK_EFAILURE;
+  }
+
+  if (!hsk_rs_set_rate_limit(rs, opt->rs_rate)) {
+    fprintf(stderr, "failed setting rs rate limit\n");
+    return HSK_EFAILURE;
+  }
+
+  if (!hsk_rs_set_unsigned_errors(rs, opt->unsigned_errors)) {
+    fprintf(stderr, "failed setting rs unsigned errors\n");
+    return HSK_EFAILURE;
+  }
+
+  if (!hsk_rs_set_udp_buffers(rs, opt->udp_rcvbuf, opt->udp_sndbuf)) {
+    fprintf(stderr, "failed setting rs udp buffers\n");
+    return HSK_EFAILURE;
+  }
+
+  if (!hsk_rs_set_capture(rs, capture)) {
+    fprintf(stderr, "failed setting rs capture\n");
+    return HSK_EFAILURE;
+  }
+
+  if (!hsk_rs_set_handoff(rs, reload->handoff)) {
+    fprintf(stderr, "failed setting rs handoff\n");
+    return HSK_EFAILURE;
+  }
+
+  if (opt->doq_host) {
+    if (!opt->doq_cert || !opt->doq_key) {
+      fprintf(stderr, "--doq-host needs --doq-cert and --doq-key\n");
+      return HSK_EFAILURE;
+    }
+
+    if (!hsk_doq_supported()) {
+      fprintf(stderr, "built without dns over quic (--enable-quic)\n");
+      return HSK_EFAILURE;
+    }
+
+    if (!hsk_rs_set_doq(rs, opt->doq_host, opt->doq_cert, opt->doq_key)) {
+      fprintf(stderr, "failed setting rs doq\n");
+      return HSK_EFAILURE;
+    }
+  }
+
+  // After the main loop's and the ns workers'.
+  if (!hsk_rs_set_affinity(rs, reload->affinity, 1 + opt->ns_workers)) {
+    fprintf(stderr, "failed setting rs cpus\n");
+    return HSK_EFAILURE;
+  }
+
+  // Skip SIG(0) on the resolver's own queries.
+  struct sockaddr_storage local;
+
+  if (hsk_ns_get_local(reload->ns, (struct sockaddr *)&local)) {
+    if (!hsk_rs_set_stub(rs, (struct sockaddr *)&local)) {
+      fprintf(stderr, "failed setting rs stub\n");
+      return HSK_EFAILURE;
+    }
+  }
+
+  reload->rs_mtime = file_mtime(opt->rs_config);
+
+  int rc = hsk_rs_open(rs, opt->rs_host);
+
+  if (rc != HSK_SUCCESS) {
+    fprintf(stderr, "failed opening rns: %s\n", hsk_strerror(rc));
+    return rc;
+  }
+
+  return HSK_SUCCESS;
+}
+
+// Closing now, freeing on the next iteration:
+// by then the handles have closed and the
+// ports are free to bind again.
+static void
+restart_rs(hsk_reload_t *reload, const char *config) {
+  reload->rs_config = NULL;
+
+  if (config) {
+    strcpy(&reload->rs_config_[0], config);
+    reload->rs_config = &reload->rs_config_[0];
+  }
+
+  if (*reload->rs) {
+    hsk_rs_close(*reload->rs);
+    reload->old = *reload->rs;
+    *reload->rs = NULL;
+  }
+
+  uv_timer_start(&reload->timer, after_reload_timer, 0, 0);
+}
+
+static void
+after_reload_timer(uv_timer_t *timer) {
+  hsk_reload_t *reload = (hsk_reload_t *)timer->data;
+  hsk_options_t *opt = reload->opt;
+  char config[256];
+  bool had_config = opt->rs_config != NULL;
+
+  if (reload->old) {
+    hsk_rs_free(reload->old);
+    reload->old = NULL;
+  }
+
+  strcpy(config, opt->rs_config_);
+
+  opt->rs_config = NULL;
+  memset(opt->rs_config_, 0, sizeof(opt->rs_config_));
+
+  if (reload->rs_config) {
+    strcpy(&opt->rs_config_[0], reload->rs_config);
+    opt->rs_config = &opt->rs_config_[0];
+  }
+
+  if (open_rs(reload) == HSK_SUCCESS) {
+    printf("restarted rns (rs-config: %s)\n",
+           opt->rs_config ? opt->rs_config : "none");
+    return;
+  }
+
+  bool same = had_config == (opt->rs_config != NULL)
+           && strcmp(config, opt->rs_config_) == 0;
+
+  opt->rs_config = NULL;
+  strcpy(&opt->rs_config_[0], config);
+
+  if (had_config)
+    opt->rs_config = &opt->rs_config_[0];
+
+  // Back to what worked before, once.
+  if (same) {
+    fprintf(stderr, "rns is down: restart hnsd\n");
+    if (*reload->rs) {
+      hsk_rs_close(*reload->rs);
+      reload->old = *reload->rs;
+      *reload->rs = NULL;
+    }
+    return;
+  }
+
+  fprintf(stderr, "falling back to the previous rs config\n");
+
+  restart_rs(reload, opt->rs_config);
+}
+
+// Runs on the pool's loop. A smaller pool
+// takes effect as peers drop off.
+static void
+after_pool_reload(uv_signal_t *handle, int signum) {
+  hsk_pool_t *pool = (hsk_pool_t *)handle->data;
+  hsk_config_t conf;
+
+  hsk_config_init(&conf);
+
+  if (hsk_config_read(&conf, config_file)) {
+    if (!hsk_pool_set_size(pool, conf.pool_size))
+      fprintf(stderr, "failed setting pool size\n");
+
+    if (!hsk_pool_set_seeds(pool, conf.seeds))
+      fprintf(stderr, "failed adding seeds\n");
+  }
+
+  hsk_config_uninit(&conf);
+}
+
+// The resolver restarts (dropping unbound's
+// cache) only if its config file was changed.
+static void
+after_reload(uv_signal_t *handle, int signum) {
+  hsk_reload_t *reload = (hsk_reload_t *)handle->data;
+  const hsk_options_t *opt = reload->opt;
+  hsk_config_t conf;
+
+  hsk_config_init(&conf);
+
+  if (!hsk_config_read(&conf, config_file))
+    goto done;
+
+  if (!hsk_ns_set_cache_size(reload->ns, conf.cache_size))
+    fprintf(stderr, "failed setting cache size\n");
+
+  const char *prev = opt->rs_config ? opt->rs_config : "";
+  const char *next = conf.rs_config ? conf.rs_config : "";
+
+  if (strcmp(prev, next) == 0 && file_mtime(conf.rs_config) == reload->rs_mtime)
+    goto done;
+
+  if (reload->old || uv_is_active((uv_handle_t *)&reload->timer)) {
+    fprintf(stderr, "rns is already restarting\n");
+    goto done;
+  }
+
+  if (conf.rs_config && !hsk_rs_check_config(conf.rs_config)) {
+    fprintf(stderr, "invalid rs config: %s\n", conf.rs_config);
+    goto done;
+  }
+
+  restart_rs(reload, conf.rs_config);
+
+done:
+  hsk_config_uninit(&conf);
+}
+
+/*
+ * Main
+ */
+
+int
+main(int argc, char **argv) {
+  hsk_options_t opt;
+  hsk_options_init(&opt);
+
+  parse_arg(argc, argv, &opt);
+
+  if (opt.config && !load_config(&opt))
+    return HSK_EFAILURE;
+
+  if (!opt.has_ip)
+    hsk_sa_copy(opt.ns_ip, opt.ns_host);
+
+  // After daemonizing: the writer is a thread.
+  if (!hsk_log_open()) {
+    fprintf(stderr, "failed starting log writer\n");
+    return HSK_EFAILURE;
+  }
+
+  int rc = HSK_SUCCESS;
+  uint64_t start = uv_hrtime();
+  uint64_t mark;
+  double pool_ms = 0, ns_ms = 0, rs_ms = 0;
+  uv_thread_t warm_thread;
+  uint64_t warm_time = 0;
+  bool warming = false;
+  uv_loop_t *loop = NULL;
+  uv_loop_t pool_loop_;
+  uv_loop_t *pool_loop = NULL;
+  uv_thread_t pool_thread;
+  uv_async_t pool_stop;
+  bool pool_running = false;
+  hsk_pool_t *pool = NULL;
+  hsk_ns_t *ns = NULL;
+  hsk_rs_t *rs = NULL;
+  hsk_ctl_t *ctl = NULL;
+  hsk_ipc_t *ipc = NULL;
+  hsk_handoff_t handoff;
+  bool handing = false;
+  hsk_affinity_t affinity;
+  hsk_shm_t shm;
+  uv_signal_t pool_signal;
+  uv_signal_t stats_signal;
+  uv_signal_t trace_signal;
+  uv_signal_t pool_reload_signal;
+  uv_signal_t reload_signal;
+  hsk_reload_t reload;
+  bool reloading = false;
+  hsk_capture_t capture_;
+
+  // Not fatal: all of it is built on first use
+  // otherwise.
+  if (uv_thread_create(&warm_thread, warm_up, (void *)&warm_time) == 0)
+    warming = true;
+
+  if (opt.identity_key) {
+    if (!print_identity(opt.identity_key)) {
+      fprintf(stderr, "invalid identity key\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+  }
+
+  hsk_mem_set_budget(opt.mem_budget);
+
+  if (!hsk_dns_req_set_udp_size(opt.udp_size)) {
+    fprintf(stderr, "failed setting udp size\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  loop = uv_default_loop();
+
+  if (!loop) {
+    fprintf(stderr, "failed initializing loop\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  hsk_affinity_init(&affinity);
+  hsk_shm_init(&shm);
+
+  // Checked already by set_option.
+  if (opt.cpus)
+    assert(hsk_affinity_parse(&affinity, opt.cpus));
+
+  // Sockets from systemd, if started by it.
+  hsk_handoff_init(&handoff, loop);
+  hsk_handoff_inherit(&handoff);
+  handing = true;
+
+  // DNS is then served on the default loop
+  // alone, and answers come back through a
+  // pool client.
+  if (opt.sync_thread) {
+    if (uv_loop_init(&pool_loop_) != 0) {
+      fprintf(stderr, "failed initializing pool loop\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+    pool_loop = &pool_loop_;
+  } else {
+    pool_loop = loop;
+  }
+
+  pool = hsk_pool_alloc(pool_loop);
+
+  if (!pool) {
+    fprintf(stderr, "failed initializing pool\n");
+    rc = HSK_ENOMEM;
+    goto done;
+  }
+
+  if (opt.identity_key) {
+    if (!hsk_pool_set_key(pool, opt.identity_key)) {
+      fprintf(stderr, "failed setting identity key\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+  }
+
+  if (!hsk_pool_set_size(pool, opt.pool_size)) {
+    fprintf(stderr, "failed setting pool size\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_race(pool, opt.pool_race)) {
+    fprintf(stderr, "failed setting pool race\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_grow(pool, opt.pool_grow)) {
+    fprintf(stderr, "failed setting pool grow\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_timeout(pool, opt.proof_timeout, opt.proof_retries)) {
+    fprintf(stderr, "failed setting proof timeout\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_pending(pool, opt.pending_max)) {
+    fprintf(stderr, "failed setting pending limit\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_proof_cache(pool, opt.proof_cache)) {
+    fprintf(stderr, "failed setting proof cache size\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_hedge(pool, opt.proof_hedge)) {
+    fprintf(stderr, "failed setting proof hedge\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_workers(pool, opt.proof_workers)) {
+    fprintf(stderr, "failed setting proof workers\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_replace(pool, opt.peer_replace)) {
+    fprintf(stderr, "failed setting peer replace\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_flush(pool, opt.send_delay, opt.send_bytes)) {
+    fprintf(stderr, "failed setting send buffers\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_offload(pool, opt.read_offload)) {
+    fprintf(stderr, "failed setting read offload\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_orphans_set_size(&pool->chain.orphans, opt.orphan_size)) {
+    fprintf(stderr, "failed setting orphan size\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_seeds(pool, opt.seeds)) {
+    fprintf(stderr, "failed adding seeds\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_node(pool, opt.full_node)) {
+    fprintf(stderr, "failed setting full node\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_prefix(pool, opt.prefix)) {
+    fprintf(stderr, "failed setting prefix\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_pool_set_snapshot(pool, opt.snapshot)) {
+    fprintf(stderr, "failed setting snapshot\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (opt.watch) {
+    int count;
+
+    rc = hsk_pool_watch_list(pool, opt.watch, &count);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed reading watchlist: %s\n", hsk_strerror(rc));
+      goto done;
+    }
+  }
+
+  if (opt.export) {
+    if (!opt.prefix) {
+      fprintf(stderr, "exporting a snapshot requires a prefix\n");
+      rc = HSK_EBADARGS;
+      goto done;
+    }
+
+    rc = hsk_chain_open(&pool->chain, opt.prefix);
+
+    if (rc == HSK_SUCCESS)
+      rc = hsk_chain_export(&pool->chain, opt.export);
+
+    if (rc != HSK_SUCCESS)
+      fprintf(stderr, "failed exporting snapshot: %s\n", hsk_strerror(rc));
+
+    goto done;
+  }
+
+  if (opt.import) {
+    if (!opt.prefix) {
+      fprintf(stderr, "importing headers requires a prefix\n");
+      rc = HSK_EBADARGS;
+      goto done;
+    }
+
+    rc = hsk_chain_open(&pool->chain, opt.prefix);
+
+    if (rc == HSK_SUCCESS)
+      rc = hsk_pool_import_headers(pool, opt.import);
+
+    if (rc != HSK_SUCCESS)
+      fprintf(stderr, "failed importing headers: %s\n", hsk_strerror(rc));
+
+    goto done;
+  }
+
+  ns = hsk_ns_alloc(loop, pool);
+
+  if (!ns) {
+    fprintf(stderr, "failed initializing ns\n");
+    rc = HSK_ENOMEM;
+    goto done;
+  }
+
+  if (!hsk_ns_set_ip(ns, opt.ns_ip)) {
+    fprintf(stderr, "failed setting ip\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (opt.identity_key) {
+    if (!hsk_ns_set_key(ns, opt.identity_key)) {
+      fprintf(stderr, "failed setting identity key\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+  }
+
+  if (!hsk_ns_set_workers(ns, opt.ns_workers)) {
+    fprintf(stderr, "failed setting ns workers\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (opt.ns_signers > 0) {
+    char size[16];
+
+    // Read once, on the first queued work.
+    sprintf(size, "%d", opt.ns_signers);
+    setenv("UV_THREADPOOL_SIZE", size, 1);
+
+    if (!hsk_ns_set_offload(ns, true)) {
+      fprintf(stderr, "failed setting ns signers\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+  }
+
+  if (!hsk_ns_set_minimal(ns, opt.minimal)) {
+    fprintf(stderr, "failed setting minimal responses\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_any_hinfo(ns, opt.any_hinfo)) {
+    fprintf(stderr, "failed setting any hinfo\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_unsigned_errors(ns, opt.unsigned_errors)) {
+    fprintf(stderr, "failed setting unsigned errors\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_rate_limit(ns, opt.ns_rate)) {
+    fprintf(stderr, "failed setting ns rate limit\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_udp_buffers(ns, opt.udp_rcvbuf, opt.udp_sndbuf)) {
+    fprintf(stderr, "failed setting ns udp buffers\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_cache_size(ns, opt.cache_size)) {
+    fprintf(stderr, "failed setting cache size\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_ttl(ns, opt.min_ttl, opt.max_ttl, opt.neg_ttl)) {
+    fprintf(stderr, "failed setting cache ttl\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_affinity(ns, &affinity, 1)) {
+    fprintf(stderr, "failed setting ns cpus\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (!hsk_ns_set_handoff(ns, &handoff)) {
+    fprintf(stderr, "failed setting ns handoff\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (opt.shared_cache) {
+    rc = hsk_shm_open(&shm, opt.shared_cache, opt.shared_cache_size);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed opening shared cache: %s\n", hsk_strerror(rc));
+      goto done;
+    }
+
+    if (!hsk_ns_set_shared_cache(ns, &shm)) {
+      fprintf(stderr, "failed setting shared cache\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+  }
+
+  if (!hsk_ns_set_prefix(ns, opt.prefix)) {
+    fprintf(stderr, "failed setting cache prefix\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  if (opt.trace_file) {
+    if (!hsk_ns_set_trace(ns, opt.trace_rate)) {
+      fprintf(stderr, "failed setting trace rate\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+
+    trace_file = opt.trace_file;
+  }
+
+  if (opt.capture) {
+    if (hsk_capture_init(&capture_) != HSK_SUCCESS) {
+      fprintf(stderr, "failed initializing capture\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+
+    capture = &capture_;
+    rc = hsk_capture_open(capture, opt.capture);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed opening capture: %s\n", hsk_strerror(rc));
+      goto done;
+    }
+
+    if (!hsk_ns_set_capture(ns, capture)) {
+      fprintf(stderr, "failed setting ns capture\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+  }
+
+  // Before the chain and caches are allocated,
+  // so that they are local to its node.
+  if (opt.cpus) {
+    int cpu = hsk_affinity_get(&affinity, 0);
+
+    start_threadpool(loop);
+
+    if (hsk_affinity_pin(cpu) != HSK_SUCCESS) {
+      fprintf(stderr, "failed pinning to cpu %d\n", cpu);
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+
+    pool_cpu = hsk_affinity_get(&affinity,
+                                1 + opt.ns_workers + opt.rs_workers);
+  }
+
+  mark = uv_hrtime();
   rc = hsk_pool_open(pool);
+  pool_ms = ms_since(mark);
 
   if (rc != HSK_SUCCESS) {
     fprintf(stderr, "failed opening pool: %s\n", hsk_strerror(rc));
     goto done;
   }
 
+  if (warming) {
+    uv_thread_join(&warm_thread);
+    warming = false;
+  }
+
+  // As late as can be, for a fresher cache: the
+  // old process serves until we are up.
+  if (opt.handoff) {
+    rc = hsk_handoff_receive(&handoff, opt.handoff);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed receiving handoff: %s\n", hsk_strerror(rc));
+      goto done;
+    }
+  }
+
+  mark = uv_hrtime();
   rc = hsk_ns_open(ns, opt.ns_host);
+  ns_ms = ms_since(mark);
 
   if (rc != HSK_SUCCESS) {
     fprintf(stderr, "failed opening ns: %s\n", hsk_strerror(rc));
     goto done;
   }
 
-  rc = hsk_rs_open(rs, opt.rs_host);
+  reload.opt = &opt;
+  reload.loop = loop;
+  reload.ns = ns;
+  reload.rs = &rs;
+  reload.old = NULL;
+  reload.handoff = &handoff;
+  reload.affinity = &affinity;
+  reload.rs_config = NULL;
+  memset(reload.rs_config_, 0, sizeof(reload.rs_config_));
+  reload.rs_mtime = 0;
+
+  if (uv_timer_init(loop, &reload.timer) != 0) {
+    fprintf(stderr, "failed initializing loop\n");
+    rc = HSK_EFAILURE;
+    goto done;
+  }
+
+  reload.timer.data = (void *)&reload;
+  reloading = true;
 
-  if (rc != HSK_SUCCESS) {
-    fprintf(stderr, "failed opening rns: %s\n", hsk_strerror(rc));
+  mark = uv_hrtime();
+  rc = open_rs(&reload);
+  rs_ms = ms_since(mark);
+
+  if (rc != HSK_SUCCESS)
     goto done;
+
+  // Does not keep the loop alive by itself.
+  if (uv_signal_init(pool_loop, &pool_signal) == 0) {
+    pool_signal.data = (void *)pool;
+    if (uv_signal_start(&pool_signal, after_pool_signal, SIGUSR1) == 0)
+      uv_unref((uv_handle_t *)&pool_signal);
+  }
+
+  if (uv_signal_init(loop, &stats_signal) == 0) {
+    stats_signal.data = (void *)ns;
+    if (uv_signal_start(&stats_signal, after_stats_signal, SIGUSR1) == 0)
+      uv_unref((uv_handle_t *)&stats_signal);
+  }
+
+  if (config_file && uv_signal_init(pool_loop, &pool_reload_signal) == 0) {
+    pool_reload_signal.data = (void *)pool;
+    if (uv_signal_start(&pool_reload_signal, after_pool_reload, SIGHUP) == 0)
+      uv_unref((uv_handle_t *)&pool_reload_signal);
+  }
+
+  if (config_file && uv_signal_init(loop, &reload_signal) == 0) {
+    reload_signal.data = (void *)&reload;
+    if (uv_signal_start(&reload_signal, after_reload, SIGHUP) == 0)
+      uv_unref((uv_handle_t *)&reload_signal);
+  }
+
+  if (trace_file && uv_signal_init(loop, &trace_signal) == 0) {
+    trace_signal.data = (void *)ns;
+    if (uv_signal_start(&trace_signal, after_trace_signal, SIGUSR2) == 0)
+      uv_unref((uv_handle_t *)&trace_signal);
+  }
+
+  // Waits for the chain to sync by itself.
+  if (opt.prefetch) {
+    size_t count;
+
+    rc = hsk_ns_prefetch_list(ns, opt.prefetch, &count);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed reading prefetch list: %s\n",
+              hsk_strerror(rc));
+      goto done;
+    }
+  }
+
+  // Before the sync thread starts: the control
+  // socket hooks into the pool's loop.
+  if (opt.control) {
+    ctl = hsk_ctl_alloc(loop, pool, ns);
+
+    if (!ctl) {
+      fprintf(stderr, "failed initializing control socket\n");
+      rc = HSK_ENOMEM;
+      goto done;
+    }
+
+    rc = hsk_ctl_open(ctl, opt.control);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed opening control socket: %s\n",
+              hsk_strerror(rc));
+      goto done;
+    }
+  }
+
+  if (opt.query_socket) {
+    ipc = hsk_ipc_alloc(loop, ns);
+
+    if (!ipc) {
+      fprintf(stderr, "failed initializing query socket\n");
+      rc = HSK_ENOMEM;
+      goto done;
+    }
+
+    rc = hsk_ipc_open(ipc, opt.query_socket);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed opening query socket: %s\n",
+              hsk_strerror(rc));
+      goto done;
+    }
+  }
+
+  if (opt.profile) {
+    rc = hsk_prof_open(loop);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed starting profiler: %s\n", hsk_strerror(rc));
+      goto done;
+    }
+  }
+
+  if (pool_loop != loop) {
+    if (uv_async_init(pool_loop, &pool_stop, after_pool_stop) != 0) {
+      fprintf(stderr, "failed initializing pool loop\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+
+    if (uv_thread_create(&pool_thread, run_pool, (void *)pool_loop) != 0) {
+      fprintf(stderr, "failed starting sync thread\n");
+      rc = HSK_EFAILURE;
+      goto done;
+    }
+
+    pool_running = true;
+  }
+
+  printf("startup: pool %.1fms, ns %.1fms, rs %.1fms, warm-up %.1fms "
+         "alongside, ready in %.1fms\n",
+         pool_ms, ns_ms, rs_ms, (double)warm_time / 1000000.0,
+         ms_since(start));
+
+  // Not fatal: the old process is gone already.
+  if (hsk_handoff_ready(&handoff) != HSK_SUCCESS)
+    fprintf(stderr, "handoff: could not reach the old process\n");
+
+  if (opt.handoff) {
+    rc = hsk_handoff_open(&handoff, opt.handoff,
+                          collect_sockets, after_handoff, &reload);
+
+    if (rc != HSK_SUCCESS) {
+      fprintf(stderr, "failed opening handoff socket: %s\n",
+              hsk_strerror(rc));
+      goto done;
+    }
   }
 
   printf("starting event loop...\n");
 
   rc = uv_run(loop, UV_RUN_DEFAULT);
 
+  // Stopped with handles still open.
+  if (handed_off)
+    rc = HSK_SUCCESS;
+
   if (rc != 0) {
     fprintf(stderr, "failed running event loop: %s\n", uv_strerror(rc));
     rc = HSK_EFAILURE;
@@ -465,17 +2495,61 @@ main(int argc, char **argv) {
   }
 
 done:
+  if (warming)
+    uv_thread_join(&warm_thread);
+
+  // Nothing may answer while the servers close.
+  if (pool_running) {
+    uv_async_send(&pool_stop);
+    uv_thread_join(&pool_thread);
+  }
+
+  if (ctl)
+    hsk_ctl_destroy(ctl);
+
+  if (ipc)
+    hsk_ipc_destroy(ipc);
+
+  // An old process waiting on us carries on.
+  if (handing) {
+    hsk_handoff_close(&handoff);
+    hsk_handoff_uninit(&handoff);
+  }
+
   if (rs)
     hsk_rs_destroy(rs);
 
+  if (reloading) {
+    if (reload.old)
+      hsk_rs_free(reload.old);
+    uv_close((uv_handle_t *)&reload.timer, NULL);
+  }
+
   if (ns)
     hsk_ns_destroy(ns);
 
+  hsk_shm_close(&shm);
+
   if (pool)
     hsk_pool_destroy(pool);
 
+  if (capture) {
+    fprintf(stderr, "captured %llu queries (%llu dropped)\n",
+            (unsigned long long)capture->count,
+            (unsigned long long)capture->dropped);
+    hsk_capture_uninit(capture);
+    capture = NULL;
+  }
+
+  hsk_prof_close();
+
+  if (pool_loop && pool_loop != loop)
+    uv_loop_close(pool_loop);
+
   if (loop)
     uv_loop_close(loop);
 
+  hsk_log_close();
+
   return rc;
 }
@@ -12,20 +12,147 @@
 #include "dns.h"
 #include "ecc.h"
 #include "map.h"
+#include "mem.h"
 #include "sha256.h"
 #include "utils.h"
+#include "uv.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HSK_DNS_SSE2
+#endif
 
 typedef struct hsk_dns_raw_rr_s {
   uint8_t *data;
   size_t size;
+  size_t rd;
 } hsk_dns_raw_rr_t;
 
+// Keyed by the signature hash: it covers the
+// canonical RRset as well as the key tag,
+// signer and validity window.
+typedef struct hsk_dns_sig_entry_s {
+  bool used;
+  uint8_t hash[32];
+  uint8_t sig[64];
+} hsk_dns_sig_entry_t;
+
+static hsk_dns_sig_entry_t hsk_dns_sig_cache[HSK_DNS_SIG_CACHE];
+static uv_mutex_t hsk_dns_sig_lock;
+static uv_once_t hsk_dns_sig_once = UV_ONCE_INIT;
+
 static int
 raw_rr_cmp(const void *a, const void *b);
 
 static bool
 raw_rr_equal(const hsk_dns_raw_rr_t *a, const hsk_dns_raw_rr_t *b);
 
+static size_t
+hsk_dns_rd_struct_size(uint16_t type);
+
+static bool
+hsk_dns_rr_read_msg(
+  uint8_t **data,
+  size_t *data_len,
+  const hsk_dns_dmp_t *dmp,
+  hsk_dns_rr_t *rr,
+  hsk_dns_msg_t *msg
+);
+
+static void
+hsk_dns_cmp_rollback(hsk_dns_cmp_t *cmp, size_t count);
+
+/*
+ * Arena
+ */
+
+#define HSK_DNS_ARENA_ALIGN 8
+
+static void
+hsk_dns_arena_unref(hsk_dns_arena_t *arena) {
+  assert(arena && arena->refs > 0);
+
+  arena->refs -= 1;
+
+  if (arena->refs == 0) {
+    hsk_mem_sub(HSK_MEM_DNS, sizeof(hsk_dns_arena_t));
+    hsk_free(arena);
+  }
+}
+
+static bool
+hsk_dns_arena_owns(const hsk_dns_arena_t *arena, const void *ptr) {
+  const uint8_t *p = (const uint8_t *)ptr;
+  return p >= arena->data && p < arena->data + arena->used;
+}
+
+// Carve `size` bytes out of the message's
+// current block, starting a new one when it
+// runs out. The caller gets a ref on the
+// block the memory came from.
+static void *
+hsk_dns_arena_alloc(
+  hsk_dns_msg_t *msg,
+  size_t size,
+  hsk_dns_arena_t **block
+) {
+  size = (size + HSK_DNS_ARENA_ALIGN - 1) & ~(HSK_DNS_ARENA_ALIGN - 1);
+
+  if (size > HSK_DNS_ARENA_SIZE)
+    return NULL;
+
+  hsk_dns_arena_t *arena = msg->arena;
+
+  if (!arena || HSK_DNS_ARENA_SIZE - arena->used < size) {
+    hsk_dns_arena_t *next = hsk_malloc(sizeof(hsk_dns_arena_t));
+
+    if (!next)
+      return NULL;
+
+    hsk_mem_add(HSK_MEM_DNS, sizeof(hsk_dns_arena_t));
+
+    next->refs = 1;
+    next->used = 0;
+
+    if (arena)
+      hsk_dns_arena_unref(arena);
+
+    msg->arena = next;
+    arena = next;
+  }
+
+  void *ptr = &arena->data[arena->used];
+
+  arena->used += size;
+  arena->refs += 1;
+
+  *block = arena;
+
+  return ptr;
+}
+
+// Record data for an arena record: from the
+// same block when it fits, malloc otherwise.
+static void *
+hsk_dns_arena_rd_alloc(hsk_dns_msg_t *msg, hsk_dns_rr_t *rr) {
+  hsk_dns_arena_t *arena = rr->arena;
+  size_t size = hsk_dns_rd_struct_size(rr->type);
+
+  if (arena && arena == msg->arena) {
+    size_t need = (size + HSK_DNS_ARENA_ALIGN - 1)
+                & ~(HSK_DNS_ARENA_ALIGN - 1);
+
+    if (HSK_DNS_ARENA_SIZE - arena->used >= need) {
+      void *rd = &arena->data[arena->used];
+      arena->used += need;
+      hsk_dns_rd_init(rd, rr->type);
+      return rd;
+    }
+  }
+
+  return hsk_dns_rd_alloc(rr->type);
+}
+
 /*
  * Message
  */
@@ -48,6 +175,7 @@ hsk_dns_msg_init(hsk_dns_msg_t *msg) {
   msg->edns.code = 0;
   msg->edns.rd_len = 0;
   msg->edns.rd = NULL;
+  msg->arena = NULL;
 }
 
 void
@@ -60,15 +188,20 @@ hsk_dns_msg_uninit(hsk_dns_msg_t *msg) {
   hsk_dns_rrs_uninit(&msg->ar);
 
   if (msg->edns.rd) {
-    free(msg->edns.rd);
+    hsk_free(msg->edns.rd);
     msg->edns.rd_len = 0;
     msg->edns.rd = NULL;
   }
+
+  if (msg->arena) {
+    hsk_dns_arena_unref(msg->arena);
+    msg->arena = NULL;
+  }
 }
 
 hsk_dns_msg_t *
 hsk_dns_msg_alloc(void) {
-  hsk_dns_msg_t *msg = malloc(sizeof(hsk_dns_msg_t));
+  hsk_dns_msg_t *msg = hsk_malloc(sizeof(hsk_dns_msg_t));
   if (msg)
     hsk_dns_msg_init(msg);
   return msg;
@@ -78,7 +211,57 @@ void
 hsk_dns_msg_free(hsk_dns_msg_t *msg) {
   assert(msg);
   hsk_dns_msg_uninit(msg);
-  free(msg);
+  hsk_free(msg);
+}
+
+hsk_dns_qs_t *
+hsk_dns_msg_qs_alloc(hsk_dns_msg_t *msg) {
+  assert(msg);
+
+  hsk_dns_arena_t *arena;
+  hsk_dns_qs_t *qs = hsk_dns_arena_alloc(msg, sizeof(hsk_dns_qs_t), &arena);
+
+  if (!qs)
+    return NULL;
+
+  hsk_dns_qs_init(qs);
+  qs->arena = arena;
+
+  return qs;
+}
+
+hsk_dns_rr_t *
+hsk_dns_msg_rr_alloc(hsk_dns_msg_t *msg) {
+  assert(msg);
+
+  hsk_dns_arena_t *arena;
+  hsk_dns_rr_t *rr = hsk_dns_arena_alloc(msg, sizeof(hsk_dns_rr_t), &arena);
+
+  if (!rr)
+    return NULL;
+
+  hsk_dns_rr_init(rr);
+  rr->arena = arena;
+
+  return rr;
+}
+
+hsk_dns_rr_t *
+hsk_dns_msg_rr_create(hsk_dns_msg_t *msg, uint16_t type) {
+  hsk_dns_rr_t *rr = hsk_dns_msg_rr_alloc(msg);
+
+  if (!rr)
+    return NULL;
+
+  rr->type = type;
+  rr->rd = hsk_dns_arena_rd_alloc(msg, rr);
+
+  if (!rr->rd) {
+    hsk_dns_rr_free(rr);
+    return NULL;
+  }
+
+  return rr;
 }
 
 bool
@@ -98,31 +281,75 @@ hsk_dns_msg_decode(const uint8_t *data, size_t data_len, hsk_dns_msg_t **msg) {
   return true;
 }
 
+static int
+hsk_dns_msg_has_opt(const hsk_dns_msg_t *msg) {
+  return msg->edns.enabled || msg->code > 0x0f;
+}
+
+static uint16_t
+hsk_dns_msg_flags(const hsk_dns_msg_t *msg) {
+  uint16_t flags = msg->flags;
+
+  flags &= ~(0x0f << 11);
+  flags &= ~0x0f;
+  flags |= ((uint16_t)(msg->opcode & 0x0f)) << 11;
+  flags |= msg->code & 0x0f;
+
+  return flags;
+}
+
+// The OPT record to write, if any. Its rdata
+// points into the message.
+static bool
+hsk_dns_msg_opt(
+  const hsk_dns_msg_t *msg,
+  hsk_dns_rr_t *rr,
+  hsk_dns_opt_rd_t *rd
+) {
+  bool enabled = msg->edns.enabled;
+  uint16_t ecode = msg->edns.code;
+
+  if (msg->code > 0x0f) {
+    enabled = true;
+    ecode = msg->code >> 4;
+  }
+
+  if (!enabled)
+    return false;
+
+  hsk_dns_rr_init(rr);
+  rr->type = HSK_DNS_OPT;
+  rr->ttl = 0;
+  rr->ttl |= ((uint32_t)ecode) << 24;
+  rr->ttl |= ((uint32_t)msg->edns.version) << 16;
+  rr->ttl |= (uint32_t)msg->edns.flags;
+  rr->class = msg->edns.size;
+  rr->rd = (void *)rd;
+  rd->rd_len = msg->edns.rd_len;
+  rd->rd = msg->edns.rd;
+
+  return true;
+}
+
 int
 hsk_dns_msg_write(const hsk_dns_msg_t *msg, uint8_t **data) {
   int size = 0;
-  uint16_t flags = msg->flags;
+  uint16_t flags = hsk_dns_msg_flags(msg);
 
   hsk_dns_cmp_t cmp_;
   hsk_dns_cmp_t *cmp = NULL;
 
   if (data) {
     cmp = &cmp_;
-    hsk_map_init_str_map(&cmp->map, NULL);
-    cmp->msg = *data;
+    hsk_dns_cmp_init(cmp, *data);
   }
 
-  flags &= ~(0x0f << 11);
-  flags &= ~0x0f;
-  flags |= ((uint16_t)(msg->opcode & 0x0f)) << 11;
-  flags |= msg->code & 0x0f;
-
   size += write_u16be(data, msg->id);
   size += write_u16be(data, flags);
   size += write_u16be(data, msg->qd.size);
   size += write_u16be(data, msg->an.size);
   size += write_u16be(data, msg->ns.size);
-  size += write_u16be(data, msg->ar.size + (msg->edns.enabled ? 1 : 0));
+  size += write_u16be(data, msg->ar.size + hsk_dns_msg_has_opt(msg));
 
   int i;
 
@@ -138,31 +365,11 @@ hsk_dns_msg_write(const hsk_dns_msg_t *msg, uint8_t **data) {
   for (i = 0; i < msg->ar.size; i++)
     size += hsk_dns_rr_write(msg->ar.items[i], data, cmp);
 
-  bool enabled = msg->edns.enabled;
-  uint16_t ecode = msg->edns.code;
-
-  if (msg->code > 0x0f) {
-    enabled = true;
-    ecode = msg->code >> 4;
-  }
+  hsk_dns_rr_t rr;
+  hsk_dns_opt_rd_t rd;
 
-  if (enabled) {
-    hsk_dns_rr_t rr = { .type = HSK_DNS_OPT };
-    hsk_dns_opt_rd_t rd;
-    strcpy(rr.name, ".");
-    rr.ttl = 0;
-    rr.ttl |= ((uint32_t)ecode) << 24;
-    rr.ttl |= ((uint32_t)msg->edns.version) << 16;
-    rr.ttl |= (uint32_t)msg->edns.flags;
-    rr.class = msg->edns.size;
-    rr.rd = (void *)&rd;
-    rd.rd_len = msg->edns.rd_len;
-    rd.rd = msg->edns.rd;
+  if (hsk_dns_msg_opt(msg, &rr, &rd))
     size += hsk_dns_rr_write(&rr, data, cmp);
-  }
-
-  if (cmp)
-    hsk_map_uninit(&cmp->map);
 
   return size;
 }
@@ -175,7 +382,7 @@ hsk_dns_msg_size(const hsk_dns_msg_t *msg) {
 bool
 hsk_dns_msg_encode(const hsk_dns_msg_t *msg, uint8_t **data, size_t *data_len) {
   int size = hsk_dns_msg_size(msg);
-  uint8_t *buf = malloc(size);
+  uint8_t *buf = hsk_malloc(size);
 
   if (!buf)
     return false;
@@ -192,6 +399,159 @@ hsk_dns_msg_encode(const hsk_dns_msg_t *msg, uint8_t **data, size_t *data_len) {
   return true;
 }
 
+// Into a buffer of the caller's (pooled, or on
+// the stack). The size without compression
+// bounds what is written: nothing is if that
+// does not fit in `cap`.
+bool
+hsk_dns_msg_encode_into(
+  const hsk_dns_msg_t *msg,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+) {
+  assert(msg && data && data_len);
+
+  if ((size_t)hsk_dns_msg_size(msg) > cap)
+    return false;
+
+  *data_len = (size_t)hsk_dns_msg_write(msg, &data);
+
+  return true;
+}
+
+// Records that must be kept or dropped as one:
+// an RRset and the RRSIGs covering it.
+static bool
+hsk_dns_rr_same_set(const hsk_dns_rr_t *a, const hsk_dns_rr_t *b) {
+  uint16_t at = a->type;
+  uint16_t bt = b->type;
+
+  if (at == HSK_DNS_RRSIG)
+    at = ((hsk_dns_rrsig_rd_t *)a->rd)->type_covered;
+
+  if (bt == HSK_DNS_RRSIG)
+    bt = ((hsk_dns_rrsig_rd_t *)b->rd)->type_covered;
+
+  return at == bt && a->class == b->class && strcasecmp(a->name, b->name) == 0;
+}
+
+// Encode no more than `max` bytes, leaving out
+// whole RRsets (with their RRSIGs) from the
+// first one that does not fit on. TC is set
+// if that happens before the additional
+// section. Room for the OPT record is always
+// kept. Messages that fit even uncompressed
+// are written exactly as hsk_dns_msg_encode
+// would; otherwise RRSIGs move up next to the
+// RRsets they cover.
+bool
+hsk_dns_msg_encode_max(
+  const hsk_dns_msg_t *msg,
+  size_t max,
+  uint8_t **data,
+  size_t *data_len
+) {
+  assert(msg && data && data_len);
+
+  size_t size = (size_t)hsk_dns_msg_size(msg);
+
+  if (size <= max)
+    return hsk_dns_msg_encode(msg, data, data_len);
+
+  hsk_dns_rr_t opt;
+  hsk_dns_opt_rd_t opt_rd;
+  bool has_opt = hsk_dns_msg_opt(msg, &opt, &opt_rd);
+  size_t opt_size = has_opt ? (size_t)hsk_dns_rr_size(&opt) : 0;
+
+  if (max < 12 + opt_size)
+    return false;
+
+  size_t budget = max - opt_size;
+  uint8_t *buf = hsk_malloc(size);
+
+  if (!buf)
+    return false;
+
+  hsk_dns_cmp_t cmp;
+  hsk_dns_cmp_init(&cmp, buf);
+
+  const hsk_dns_rrs_t *sections[4] = { &msg->qd, &msg->an, &msg->ns, &msg->ar };
+  uint16_t counts[4] = { 0, 0, 0, 0 };
+  uint16_t flags = hsk_dns_msg_flags(msg);
+  uint8_t *b = buf + 12;
+  bool full = false;
+  int s;
+
+  for (s = 0; s < 4 && !full; s++) {
+    const hsk_dns_rrs_t *rrs = sections[s];
+    bool done[255];
+    int i, j;
+
+    memset(done, 0, sizeof(done));
+
+    for (i = 0; i < rrs->size; i++) {
+      if (done[i])
+        continue;
+
+      uint8_t *start = b;
+      size_t count = cmp.count;
+
+      if (s == 0) {
+        hsk_dns_qs_write(rrs->items[i], &b, &cmp);
+      } else {
+        for (j = i; j < rrs->size; j++) {
+          if (!done[j] && hsk_dns_rr_same_set(rrs->items[i], rrs->items[j]))
+            hsk_dns_rr_write(rrs->items[j], &b, &cmp);
+        }
+      }
+
+      if ((size_t)(b - buf) > budget) {
+        b = start;
+        hsk_dns_cmp_rollback(&cmp, count);
+        full = true;
+
+        if (s < 3)
+          flags |= HSK_DNS_TC;
+
+        break;
+      }
+
+      if (s == 0) {
+        done[i] = true;
+        counts[s] += 1;
+        continue;
+      }
+
+      for (j = i; j < rrs->size; j++) {
+        if (!done[j] && hsk_dns_rr_same_set(rrs->items[i], rrs->items[j])) {
+          done[j] = true;
+          counts[s] += 1;
+        }
+      }
+    }
+  }
+
+  if (has_opt) {
+    hsk_dns_rr_write(&opt, &b, &cmp);
+    counts[3] += 1;
+  }
+
+  uint8_t *h = buf;
+
+  write_u16be(&h, msg->id);
+  write_u16be(&h, flags);
+  write_u16be(&h, counts[0]);
+  write_u16be(&h, counts[1]);
+  write_u16be(&h, counts[2]);
+  write_u16be(&h, counts[3]);
+
+  *data = buf;
+  *data_len = b - buf;
+
+  return true;
+}
+
 bool
 hsk_dns_msg_truncate(uint8_t *msg, size_t msg_len, size_t max, size_t *len) {
   if (msg_len < 12)
@@ -334,23 +694,17 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
   dmp.msg = *data;
   dmp.msg_len = *data_len;
 
-  if (!read_u16be(data, data_len, &id))
-    return false;
-
-  if (!read_u16be(data, data_len, &flags))
-    return false;
-
-  if (!read_u16be(data, data_len, &qdcount))
-    return false;
-
-  if (!read_u16be(data, data_len, &ancount))
-    return false;
+  uint8_t *hdr;
 
-  if (!read_u16be(data, data_len, &nscount))
+  if (!slice_bytes(data, data_len, &hdr, 12))
     return false;
 
-  if (!read_u16be(data, data_len, &arcount))
-    return false;
+  id = get_u16be(hdr);
+  flags = get_u16be(hdr + 2);
+  qdcount = get_u16be(hdr + 4);
+  ancount = get_u16be(hdr + 6);
+  nscount = get_u16be(hdr + 8);
+  arcount = get_u16be(hdr + 10);
 
   msg->id = id;
   msg->opcode = (flags >> 11) & 0x0f;
@@ -363,13 +717,15 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_qs_t *qs = hsk_dns_qs_alloc();
+    hsk_dns_qs_t *qs = hsk_dns_msg_qs_alloc(msg);
 
     if (!qs)
       goto fail;
 
-    if (!hsk_dns_qs_read(data, data_len, &dmp, qs))
+    if (!hsk_dns_qs_read(data, data_len, &dmp, qs)) {
+      hsk_dns_qs_free(qs);
       goto fail;
+    }
 
     hsk_dns_rrs_push(&msg->qd, qs);
   }
@@ -378,13 +734,15 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_alloc();
+    hsk_dns_rr_t *rr = hsk_dns_msg_rr_alloc(msg);
 
     if (!rr)
       goto fail;
 
-    if (!hsk_dns_rr_read(data, data_len, &dmp, rr))
+    if (!hsk_dns_rr_read_msg(data, data_len, &dmp, rr, msg)) {
+      hsk_dns_rr_free(rr);
       goto fail;
+    }
 
     hsk_dns_rrs_push(&msg->an, rr);
   }
@@ -393,13 +751,15 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_alloc();
+    hsk_dns_rr_t *rr = hsk_dns_msg_rr_alloc(msg);
 
     if (!rr)
       goto fail;
 
-    if (!hsk_dns_rr_read(data, data_len, &dmp, rr))
+    if (!hsk_dns_rr_read_msg(data, data_len, &dmp, rr, msg)) {
+      hsk_dns_rr_free(rr);
       goto fail;
+    }
 
     hsk_dns_rrs_push(&msg->ns, rr);
   }
@@ -408,19 +768,21 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_alloc();
+    hsk_dns_rr_t *rr = hsk_dns_msg_rr_alloc(msg);
 
     if (!rr)
       goto fail;
 
-    if (!hsk_dns_rr_read(data, data_len, &dmp, rr))
+    if (!hsk_dns_rr_read_msg(data, data_len, &dmp, rr, msg)) {
+      hsk_dns_rr_free(rr);
       goto fail;
+    }
 
     if (rr->type == HSK_DNS_OPT) {
       hsk_dns_opt_rd_t *opt = (hsk_dns_opt_rd_t *)rr->rd;
 
       if (msg->edns.rd)
-        free(msg->edns.rd);
+        hsk_free(msg->edns.rd);
 
       msg->edns.enabled = true;
       msg->edns.code = (rr->ttl >> 24) & 0xff;
@@ -431,8 +793,10 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
       msg->edns.rd = opt->rd;
       msg->code |= msg->edns.code << 4;
 
-      free(rr->rd);
-      free(rr);
+      opt->rd_len = 0;
+      opt->rd = NULL;
+
+      hsk_dns_rr_free(rr);
 
       continue;
     }
@@ -443,10 +807,7 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
   return true;
 
 fail:
-  hsk_dns_rrs_uninit(&msg->qd);
-  hsk_dns_rrs_uninit(&msg->an);
-  hsk_dns_rrs_uninit(&msg->ns);
-  hsk_dns_rrs_uninit(&msg->ar);
+  hsk_dns_msg_uninit(msg);
   hsk_dns_msg_init(msg);
   return false;
 }
@@ -455,10 +816,16 @@ fail:
  * RRSet
  */
 
+// Slots past `size` are left uninitialized:
+// clearing all 255 of them, four times per
+// message, costs more than the rest of init.
 void
 hsk_dns_rrs_init(hsk_dns_rrs_t *rrs) {
-  memset(rrs->items, 0, sizeof(hsk_dns_rr_t *) * 255);
   rrs->size = 0;
+#ifdef HSK_LOW_MEMORY
+  rrs->cap = 0;
+  rrs->items = NULL;
+#endif
 }
 
 void
@@ -473,11 +840,43 @@ hsk_dns_rrs_uninit(hsk_dns_rrs_t *rrs) {
   }
 
   rrs->size = 0;
+
+#ifdef HSK_LOW_MEMORY
+  hsk_free(rrs->items);
+  rrs->cap = 0;
+  rrs->items = NULL;
+#endif
+}
+
+// Room for one more record.
+static bool
+hsk_dns_rrs_reserve(hsk_dns_rrs_t *rrs) {
+  if (rrs->size == 255)
+    return false;
+
+#ifdef HSK_LOW_MEMORY
+  if (rrs->size == rrs->cap) {
+    size_t cap = rrs->cap ? rrs->cap * 2 : 4;
+
+    if (cap > 255)
+      cap = 255;
+
+    hsk_dns_rr_t **items = hsk_realloc(rrs->items, cap * sizeof(hsk_dns_rr_t *));
+
+    if (!items)
+      return false;
+
+    rrs->items = items;
+    rrs->cap = cap;
+  }
+#endif
+
+  return true;
 }
 
 hsk_dns_rrs_t *
 hsk_dns_rrs_alloc(void) {
-  hsk_dns_rrs_t *rrs = malloc(sizeof(hsk_dns_rrs_t));
+  hsk_dns_rrs_t *rrs = hsk_malloc(sizeof(hsk_dns_rrs_t));
   if (rrs)
     hsk_dns_rrs_init(rrs);
   return rrs;
@@ -487,23 +886,23 @@ void
 hsk_dns_rrs_free(hsk_dns_rrs_t *rrs) {
   assert(rrs);
   hsk_dns_rrs_uninit(rrs);
-  free(rrs);
+  hsk_free(rrs);
 }
 
 size_t
 hsk_dns_rrs_unshift(hsk_dns_rrs_t *rrs, hsk_dns_rr_t *rr) {
-  if (rrs->size == 255)
+  if (!hsk_dns_rrs_reserve(rrs))
     return 0;
 
   assert(rrs->size < 255);
 
   int i;
-  for (i = 1; i < rrs->size + 1; i++) {
+  for (i = rrs->size; i > 0; i--) {
     assert(rrs->items[i - 1]);
     rrs->items[i] = rrs->items[i - 1];
   }
 
-  rrs->items[i] = rr;
+  rrs->items[0] = rr;
   rrs->size += 1;
 
   return rrs->size;
@@ -531,12 +930,11 @@ hsk_dns_rrs_shift(hsk_dns_rrs_t *rrs) {
 
 size_t
 hsk_dns_rrs_push(hsk_dns_rrs_t *rrs, hsk_dns_rr_t *rr) {
-  if (rrs->size == 255)
+  if (!hsk_dns_rrs_reserve(rrs))
     return 0;
 
   assert(rrs->size < 255);
 
-  assert(!rrs->items[rrs->size]);
   rrs->items[rrs->size] = rr;
   rrs->size += 1;
 
@@ -599,6 +997,7 @@ hsk_dns_qs_init(hsk_dns_qs_t *qs) {
   qs->class = HSK_DNS_IN;
   qs->ttl = 0;
   qs->rd = NULL;
+  qs->arena = NULL;
 }
 
 void
@@ -608,7 +1007,7 @@ hsk_dns_qs_uninit(hsk_dns_qs_t *qs) {
 
 hsk_dns_qs_t *
 hsk_dns_qs_alloc(void) {
-  hsk_dns_qs_t *qs = malloc(sizeof(hsk_dns_qs_t));
+  hsk_dns_qs_t *qs = hsk_malloc(sizeof(hsk_dns_qs_t));
   if (qs)
     hsk_dns_qs_init(qs);
   return qs;
@@ -617,7 +1016,11 @@ hsk_dns_qs_alloc(void) {
 void
 hsk_dns_qs_free(hsk_dns_qs_t *qs) {
   assert(qs);
-  free(qs);
+
+  if (qs->arena)
+    hsk_dns_arena_unref(qs->arena);
+  else
+    hsk_free(qs);
 }
 
 void
@@ -647,12 +1050,14 @@ hsk_dns_qs_read(
   if (!hsk_dns_name_read(data, data_len, dmp, qs->name))
     return false;
 
-  if (!read_u16be(data, data_len, &qs->type))
-    return false;
+  uint8_t *p;
 
-  if (!read_u16be(data, data_len, &qs->class))
+  if (!slice_bytes(data, data_len, &p, 4))
     return false;
 
+  qs->type = get_u16be(p);
+  qs->class = get_u16be(p + 2);
+
   return true;
 }
 
@@ -670,6 +1075,7 @@ hsk_dns_rr_init(hsk_dns_rr_t *rr) {
   rr->class = HSK_DNS_IN;
   rr->ttl = 0;
   rr->rd = NULL;
+  rr->arena = NULL;
 }
 
 void
@@ -677,14 +1083,17 @@ hsk_dns_rr_uninit(hsk_dns_rr_t *rr) {
   assert(rr);
 
   if (rr->rd) {
-    hsk_dns_rd_free(rr->rd, rr->type);
+    if (rr->arena && hsk_dns_arena_owns(rr->arena, rr->rd))
+      hsk_dns_rd_uninit(rr->rd, rr->type);
+    else
+      hsk_dns_rd_free(rr->rd, rr->type);
     rr->rd = NULL;
   }
 }
 
 hsk_dns_rr_t *
 hsk_dns_rr_alloc(void) {
-  hsk_dns_rr_t *rr = malloc(sizeof(hsk_dns_rr_t));
+  hsk_dns_rr_t *rr = hsk_malloc(sizeof(hsk_dns_rr_t));
   if (rr)
     hsk_dns_rr_init(rr);
   return rr;
@@ -700,7 +1109,7 @@ hsk_dns_rr_create(uint16_t type) {
   void *rd = hsk_dns_rd_alloc(type);
 
   if (!rd) {
-    free(rr);
+    hsk_free(rr);
     return NULL;
   }
 
@@ -714,8 +1123,13 @@ hsk_dns_rr_create(uint16_t type) {
 void
 hsk_dns_rr_free(hsk_dns_rr_t *rr) {
   assert(rr);
+
   hsk_dns_rr_uninit(rr);
-  free(rr);
+
+  if (rr->arena)
+    hsk_dns_arena_unref(rr->arena);
+  else
+    hsk_free(rr);
 }
 
 bool
@@ -776,47 +1190,48 @@ hsk_dns_rr_size(const hsk_dns_rr_t *rr) {
   return hsk_dns_rr_write(rr, NULL, NULL);
 }
 
-bool
-hsk_dns_rr_read(
+static bool
+hsk_dns_rr_read_msg(
   uint8_t **data,
   size_t *data_len,
   const hsk_dns_dmp_t *dmp,
-  hsk_dns_rr_t *rr
+  hsk_dns_rr_t *rr,
+  hsk_dns_msg_t *msg
 ) {
   if (!hsk_dns_name_read(data, data_len, dmp, rr->name))
     return false;
 
-  if (!read_u16be(data, data_len, &rr->type))
-    return false;
-
-  if (!read_u16be(data, data_len, &rr->class))
-    return false;
+  uint8_t *p;
 
-  if (!read_u32be(data, data_len, &rr->ttl))
+  // Type, class, TTL and length.
+  if (!slice_bytes(data, data_len, &p, 10))
     return false;
 
-  uint16_t len;
+  rr->type = get_u16be(p);
+  rr->class = get_u16be(p + 2);
+  rr->ttl = get_u32be(p + 4);
 
-  if (!read_u16be(data, data_len, &len))
-    return false;
+  uint16_t len = get_u16be(p + 8);
 
   if (*data_len < len)
     return false;
 
-  void *rd = hsk_dns_rd_alloc(rr->type);
+  void *rd = msg
+    ? hsk_dns_arena_rd_alloc(msg, rr)
+    : hsk_dns_rd_alloc(rr->type);
 
   if (!rd)
     return false;
 
+  // Owned by the record from here on, whether
+  // the read succeeds or not.
+  rr->rd = rd;
+
   uint8_t *rdata = *data;
   size_t rdlen = (size_t)len;
 
-  if (!hsk_dns_rd_read(&rdata, &rdlen, dmp, rd, rr->type)) {
-    free(rd);
+  if (!hsk_dns_rd_read(&rdata, &rdlen, dmp, rd, rr->type))
     return false;
-  }
-
-  rr->rd = rd;
 
   *data += len;
   *data_len -= len;
@@ -825,12 +1240,22 @@ hsk_dns_rr_read(
 }
 
 bool
-hsk_dns_rr_encode(const hsk_dns_rr_t *rr, uint8_t **data, size_t *data_len) {
-  if (!rr || !data)
+hsk_dns_rr_read(
+  uint8_t **data,
+  size_t *data_len,
+  const hsk_dns_dmp_t *dmp,
+  hsk_dns_rr_t *rr
+) {
+  return hsk_dns_rr_read_msg(data, data_len, dmp, rr, NULL);
+}
+
+bool
+hsk_dns_rr_encode(const hsk_dns_rr_t *rr, uint8_t **data, size_t *data_len) {
+  if (!rr || !data)
     return false;
 
   size_t size = hsk_dns_rr_size(rr);
-  uint8_t *raw = malloc(size);
+  uint8_t *raw = hsk_malloc(size);
 
   if (!raw)
     return false;
@@ -844,6 +1269,28 @@ hsk_dns_rr_encode(const hsk_dns_rr_t *rr, uint8_t **data, size_t *data_len) {
   return true;
 }
 
+bool
+hsk_dns_rr_encode_into(
+  const hsk_dns_rr_t *rr,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+) {
+  if (!rr || !data || !data_len)
+    return false;
+
+  size_t size = hsk_dns_rr_size(rr);
+
+  if (size > cap)
+    return false;
+
+  hsk_dns_rr_write(rr, &data, NULL);
+
+  *data_len = size;
+
+  return true;
+}
+
 bool
 hsk_dns_rr_decode(const uint8_t *data, size_t data_len, hsk_dns_rr_t **out) {
   if (!data || !out)
@@ -872,19 +1319,24 @@ hsk_dns_rr_clone(const hsk_dns_rr_t *rr) {
   if (!rr)
     return NULL;
 
-  uint8_t *raw;
+  // Most records fit on the stack.
+  uint8_t buf[512];
+  uint8_t *raw = buf;
   size_t size;
   hsk_dns_rr_t *copy;
 
-  if (!hsk_dns_rr_encode(rr, &raw, &size))
-    return NULL;
-
-  if (!hsk_dns_rr_decode(raw, size, &copy)) {
-    free(raw);
-    return NULL;
+  if (!hsk_dns_rr_encode_into(rr, buf, sizeof(buf), &size)) {
+    if (!hsk_dns_rr_encode(rr, &raw, &size))
+      return NULL;
   }
 
-  free(raw);
+  bool ret = hsk_dns_rr_decode(raw, size, &copy);
+
+  if (raw != buf)
+    hsk_free(raw);
+
+  if (!ret)
+    return NULL;
 
   return copy;
 }
@@ -1113,7 +1565,7 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     case HSK_DNS_DS: {
       hsk_dns_ds_rd_t *r = (hsk_dns_ds_rd_t *)rd;
       if (r->digest) {
-        free(r->digest);
+        hsk_free(r->digest);
         r->digest = NULL;
       }
       break;
@@ -1122,7 +1574,7 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     case HSK_DNS_TLSA: {
       hsk_dns_tlsa_rd_t *r = (hsk_dns_tlsa_rd_t *)rd;
       if (r->certificate) {
-        free(r->certificate);
+        hsk_free(r->certificate);
         r->certificate = NULL;
       }
       break;
@@ -1130,7 +1582,7 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     case HSK_DNS_SSHFP: {
       hsk_dns_sshfp_rd_t *r = (hsk_dns_sshfp_rd_t *)rd;
       if (r->fingerprint) {
-        free(r->fingerprint);
+        hsk_free(r->fingerprint);
         r->fingerprint = NULL;
       }
       break;
@@ -1138,13 +1590,13 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     case HSK_DNS_OPENPGPKEY: {
       hsk_dns_openpgpkey_rd_t *r = (hsk_dns_openpgpkey_rd_t *)rd;
       if (r->pubkey)
-        free(r->pubkey);
+        hsk_free(r->pubkey);
       break;
     }
     case HSK_DNS_OPT: {
       hsk_dns_opt_rd_t *r = (hsk_dns_opt_rd_t *)rd;
       if (r->rd) {
-        free(r->rd);
+        hsk_free(r->rd);
         r->rd = NULL;
       }
       break;
@@ -1152,7 +1604,7 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     case HSK_DNS_DNSKEY: {
       hsk_dns_dnskey_rd_t *r = (hsk_dns_dnskey_rd_t *)rd;
       if (r->pubkey) {
-        free(r->pubkey);
+        hsk_free(r->pubkey);
         r->pubkey = NULL;
       }
       break;
@@ -1160,7 +1612,7 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     case HSK_DNS_RRSIG: {
       hsk_dns_rrsig_rd_t *r = (hsk_dns_rrsig_rd_t *)rd;
       if (r->signature) {
-        free(r->signature);
+        hsk_free(r->signature);
         r->signature = NULL;
       }
       break;
@@ -1174,7 +1626,7 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     case HSK_DNS_NSEC: {
       hsk_dns_nsec_rd_t *r = (hsk_dns_nsec_rd_t *)rd;
       if (r->type_map) {
-        free(r->type_map);
+        hsk_free(r->type_map);
         r->type_map = NULL;
       }
       break;
@@ -1182,7 +1634,7 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
     default: {
       hsk_dns_unknown_rd_t *r = (hsk_dns_unknown_rd_t *)rd;
       if (r->rd) {
-        free(r->rd);
+        hsk_free(r->rd);
         r->rd = NULL;
       }
       break;
@@ -1190,101 +1642,60 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
   }
 }
 
-void *
-hsk_dns_rd_alloc(uint16_t type) {
-  void *rd;
-
+static size_t
+hsk_dns_rd_struct_size(uint16_t type) {
   switch (type) {
-    case HSK_DNS_SOA: {
-      rd = malloc(sizeof(hsk_dns_soa_rd_t));
-      break;
-    }
-    case HSK_DNS_A: {
-      rd = malloc(sizeof(hsk_dns_a_rd_t));
-      break;
-    }
-    case HSK_DNS_AAAA: {
-      rd = malloc(sizeof(hsk_dns_aaaa_rd_t));
-      break;
-    }
-    case HSK_DNS_LOC: {
-      rd = malloc(sizeof(hsk_dns_loc_rd_t));
-      break;
-    }
-    case HSK_DNS_CNAME: {
-      rd = malloc(sizeof(hsk_dns_cname_rd_t));
-      break;
-    }
-    case HSK_DNS_DNAME: {
-      rd = malloc(sizeof(hsk_dns_dname_rd_t));
-      break;
-    }
-    case HSK_DNS_NS: {
-      rd = malloc(sizeof(hsk_dns_ns_rd_t));
-      break;
-    }
-    case HSK_DNS_MX: {
-      rd = malloc(sizeof(hsk_dns_mx_rd_t));
-      break;
-    }
-    case HSK_DNS_PTR: {
-      rd = malloc(sizeof(hsk_dns_ptr_rd_t));
-      break;
-    }
-    case HSK_DNS_SRV: {
-      rd = malloc(sizeof(hsk_dns_srv_rd_t));
-      break;
-    }
-    case HSK_DNS_TXT: {
-      rd = malloc(sizeof(hsk_dns_txt_rd_t));
-      break;
-    }
-    case HSK_DNS_DS: {
-      rd = malloc(sizeof(hsk_dns_ds_rd_t));
-      break;
-    }
+    case HSK_DNS_SOA:
+      return sizeof(hsk_dns_soa_rd_t);
+    case HSK_DNS_A:
+      return sizeof(hsk_dns_a_rd_t);
+    case HSK_DNS_AAAA:
+      return sizeof(hsk_dns_aaaa_rd_t);
+    case HSK_DNS_LOC:
+      return sizeof(hsk_dns_loc_rd_t);
+    case HSK_DNS_CNAME:
+      return sizeof(hsk_dns_cname_rd_t);
+    case HSK_DNS_DNAME:
+      return sizeof(hsk_dns_dname_rd_t);
+    case HSK_DNS_NS:
+      return sizeof(hsk_dns_ns_rd_t);
+    case HSK_DNS_MX:
+      return sizeof(hsk_dns_mx_rd_t);
+    case HSK_DNS_PTR:
+      return sizeof(hsk_dns_ptr_rd_t);
+    case HSK_DNS_SRV:
+      return sizeof(hsk_dns_srv_rd_t);
+    case HSK_DNS_TXT:
+      return sizeof(hsk_dns_txt_rd_t);
+    case HSK_DNS_DS:
+      return sizeof(hsk_dns_ds_rd_t);
     case HSK_DNS_SMIMEA:
-    case HSK_DNS_TLSA: {
-      rd = malloc(sizeof(hsk_dns_tlsa_rd_t));
-      break;
-    }
-    case HSK_DNS_SSHFP: {
-      rd = malloc(sizeof(hsk_dns_sshfp_rd_t));
-      break;
-    }
-    case HSK_DNS_OPENPGPKEY: {
-      rd = malloc(sizeof(hsk_dns_openpgpkey_rd_t));
-      break;
-    }
-    case HSK_DNS_OPT: {
-      rd = malloc(sizeof(hsk_dns_opt_rd_t));
-      break;
-    }
-    case HSK_DNS_DNSKEY: {
-      rd = malloc(sizeof(hsk_dns_dnskey_rd_t));
-      break;
-    }
-    case HSK_DNS_RRSIG: {
-      rd = malloc(sizeof(hsk_dns_rrsig_rd_t));
-      break;
-    }
-    case HSK_DNS_URI: {
-      rd = malloc(sizeof(hsk_dns_uri_rd_t));
-      break;
-    }
-    case HSK_DNS_RP: {
-      rd = malloc(sizeof(hsk_dns_rp_rd_t));
-      break;
-    }
-    case HSK_DNS_NSEC: {
-      rd = malloc(sizeof(hsk_dns_nsec_rd_t));
-      break;
-    }
-    default: {
-      rd = malloc(sizeof(hsk_dns_unknown_rd_t));
-      break;
-    }
+    case HSK_DNS_TLSA:
+      return sizeof(hsk_dns_tlsa_rd_t);
+    case HSK_DNS_SSHFP:
+      return sizeof(hsk_dns_sshfp_rd_t);
+    case HSK_DNS_OPENPGPKEY:
+      return sizeof(hsk_dns_openpgpkey_rd_t);
+    case HSK_DNS_OPT:
+      return sizeof(hsk_dns_opt_rd_t);
+    case HSK_DNS_DNSKEY:
+      return sizeof(hsk_dns_dnskey_rd_t);
+    case HSK_DNS_RRSIG:
+      return sizeof(hsk_dns_rrsig_rd_t);
+    case HSK_DNS_URI:
+      return sizeof(hsk_dns_uri_rd_t);
+    case HSK_DNS_RP:
+      return sizeof(hsk_dns_rp_rd_t);
+    case HSK_DNS_NSEC:
+      return sizeof(hsk_dns_nsec_rd_t);
+    default:
+      return sizeof(hsk_dns_unknown_rd_t);
   }
+}
+
+void *
+hsk_dns_rd_alloc(uint16_t type) {
+  void *rd = hsk_malloc(hsk_dns_rd_struct_size(type));
 
   if (rd)
     hsk_dns_rd_init(rd, type);
@@ -1296,7 +1707,7 @@ void
 hsk_dns_rd_free(void *rd, uint16_t type) {
   assert(rd);
   hsk_dns_rd_uninit(rd, type);
-  free(rd);
+  hsk_free(rd);
 }
 
 int
@@ -1538,20 +1949,16 @@ hsk_dns_rd_read(
       if (!hsk_dns_name_read(data, data_len, dmp, r->mbox))
         return false;
 
-      if (!read_u32be(data, data_len, &r->serial))
-        return false;
-
-      if (!read_u32be(data, data_len, &r->refresh))
-        return false;
-
-      if (!read_u32be(data, data_len, &r->retry))
-        return false;
+      uint8_t *p;
 
-      if (!read_u32be(data, data_len, &r->expire))
+      if (!slice_bytes(data, data_len, &p, 20))
         return false;
 
-      if (!read_u32be(data, data_len, &r->minttl))
-        return false;
+      r->serial = get_u32be(p);
+      r->refresh = get_u32be(p + 4);
+      r->retry = get_u32be(p + 8);
+      r->expire = get_u32be(p + 12);
+      r->minttl = get_u32be(p + 16);
 
       break;
     }
@@ -1573,27 +1980,18 @@ hsk_dns_rd_read(
     }
     case HSK_DNS_LOC: {
       hsk_dns_loc_rd_t *r = (hsk_dns_loc_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u8(data, data_len, &r->version))
+      if (!slice_bytes(data, data_len, &p, 16))
         return false;
 
-      if (!read_u8(data, data_len, &r->size))
-        return false;
-
-      if (!read_u8(data, data_len, &r->horiz_pre))
-        return false;
-
-      if (!read_u8(data, data_len, &r->vert_pre))
-        return false;
-
-      if (!read_u32be(data, data_len, &r->latitude))
-        return false;
-
-      if (!read_u32be(data, data_len, &r->longitude))
-        return false;
-
-      if (!read_u32be(data, data_len, &r->altitude))
-        return false;
+      r->version = p[0];
+      r->size = p[1];
+      r->horiz_pre = p[2];
+      r->vert_pre = p[3];
+      r->latitude = get_u32be(p + 4);
+      r->longitude = get_u32be(p + 8);
+      r->altitude = get_u32be(p + 12);
 
       break;
     }
@@ -1642,15 +2040,14 @@ hsk_dns_rd_read(
     }
     case HSK_DNS_SRV: {
       hsk_dns_srv_rd_t *r = (hsk_dns_srv_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u16be(data, data_len, &r->priority))
-        return false;
-
-      if (!read_u16be(data, data_len, &r->weight))
+      if (!slice_bytes(data, data_len, &p, 6))
         return false;
 
-      if (!read_u16be(data, data_len, &r->port))
-        return false;
+      r->priority = get_u16be(p);
+      r->weight = get_u16be(p + 2);
+      r->port = get_u16be(p + 4);
 
       if (!hsk_dns_name_read(data, data_len, dmp, r->target))
         return false;
@@ -1683,15 +2080,14 @@ fail_txt:
     }
     case HSK_DNS_DS: {
       hsk_dns_ds_rd_t *r = (hsk_dns_ds_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u16be(data, data_len, &r->key_tag))
-        return false;
-
-      if (!read_u8(data, data_len, &r->algorithm))
+      if (!slice_bytes(data, data_len, &p, 4))
         return false;
 
-      if (!read_u8(data, data_len, &r->digest_type))
-        return false;
+      r->key_tag = get_u16be(p);
+      r->algorithm = p[2];
+      r->digest_type = p[3];
 
       r->digest_len = *data_len;
 
@@ -1703,15 +2099,14 @@ fail_txt:
     case HSK_DNS_SMIMEA:
     case HSK_DNS_TLSA: {
       hsk_dns_tlsa_rd_t *r = (hsk_dns_tlsa_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u8(data, data_len, &r->usage))
-        return false;
-
-      if (!read_u8(data, data_len, &r->selector))
+      if (!slice_bytes(data, data_len, &p, 3))
         return false;
 
-      if (!read_u8(data, data_len, &r->matching_type))
-        return false;
+      r->usage = p[0];
+      r->selector = p[1];
+      r->matching_type = p[2];
 
       r->certificate_len = *data_len;
 
@@ -1722,12 +2117,13 @@ fail_txt:
     }
     case HSK_DNS_SSHFP: {
       hsk_dns_sshfp_rd_t *r = (hsk_dns_sshfp_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u8(data, data_len, &r->algorithm))
+      if (!slice_bytes(data, data_len, &p, 2))
         return false;
 
-      if (!read_u8(data, data_len, &r->digest_type))
-        return false;
+      r->algorithm = p[0];
+      r->digest_type = p[1];
 
       r->fingerprint_len = *data_len;
 
@@ -1758,15 +2154,14 @@ fail_txt:
     }
     case HSK_DNS_DNSKEY: {
       hsk_dns_dnskey_rd_t *r = (hsk_dns_dnskey_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u16be(data, data_len, &r->flags))
-        return false;
-
-      if (!read_u8(data, data_len, &r->protocol))
+      if (!slice_bytes(data, data_len, &p, 4))
         return false;
 
-      if (!read_u8(data, data_len, &r->algorithm))
-        return false;
+      r->flags = get_u16be(p);
+      r->protocol = p[2];
+      r->algorithm = p[3];
 
       r->pubkey_len = *data_len;
 
@@ -1777,27 +2172,18 @@ fail_txt:
     }
     case HSK_DNS_RRSIG: {
       hsk_dns_rrsig_rd_t *r = (hsk_dns_rrsig_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u16be(data, data_len, &r->type_covered))
-        return false;
-
-      if (!read_u8(data, data_len, &r->algorithm))
-        return false;
-
-      if (!read_u8(data, data_len, &r->labels))
-        return false;
-
-      if (!read_u32be(data, data_len, &r->orig_ttl))
-        return false;
-
-      if (!read_u32be(data, data_len, &r->expiration))
+      if (!slice_bytes(data, data_len, &p, 18))
         return false;
 
-      if (!read_u32be(data, data_len, &r->inception))
-        return false;
-
-      if (!read_u16be(data, data_len, &r->key_tag))
-        return false;
+      r->type_covered = get_u16be(p);
+      r->algorithm = p[2];
+      r->labels = p[3];
+      r->orig_ttl = get_u32be(p + 4);
+      r->expiration = get_u32be(p + 8);
+      r->inception = get_u32be(p + 12);
+      r->key_tag = get_u16be(p + 16);
 
       if (!hsk_dns_name_read(data, data_len, dmp, r->signer_name))
         return false;
@@ -1811,15 +2197,14 @@ fail_txt:
     }
     case HSK_DNS_URI: {
       hsk_dns_uri_rd_t *r = (hsk_dns_uri_rd_t *)rd;
+      uint8_t *p;
 
-      if (!read_u16be(data, data_len, &r->priority))
-        return false;
-
-      if (!read_u16be(data, data_len, &r->weight))
+      if (!slice_bytes(data, data_len, &p, 5))
         return false;
 
-      if (!read_u8(data, data_len, &r->data_len))
-        return false;
+      r->priority = get_u16be(p);
+      r->weight = get_u16be(p + 2);
+      r->data_len = p[4];
 
       if (!read_bytes(data, data_len, r->data, r->data_len))
         return false;
@@ -1876,7 +2261,7 @@ hsk_dns_rd_encode(
     return false;
 
   size_t size = hsk_dns_rd_size(rd, type);
-  uint8_t *raw = malloc(size);
+  uint8_t *raw = hsk_malloc(size);
 
   if (!raw)
     return false;
@@ -1890,6 +2275,29 @@ hsk_dns_rd_encode(
   return true;
 }
 
+bool
+hsk_dns_rd_encode_into(
+  const void *rd,
+  uint16_t type,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+) {
+  if (!rd || !data || !data_len)
+    return false;
+
+  size_t size = hsk_dns_rd_size(rd, type);
+
+  if (size > cap)
+    return false;
+
+  hsk_dns_rd_write(rd, type, &data, NULL);
+
+  *data_len = size;
+
+  return true;
+}
+
 bool
 hsk_dns_rd_decode(
   const uint8_t *data,
@@ -1945,7 +2353,7 @@ hsk_dns_txts_uninit(hsk_dns_txts_t *txts) {
 
 hsk_dns_txts_t *
 hsk_dns_txts_alloc(void) {
-  hsk_dns_txts_t *txts = malloc(sizeof(hsk_dns_txts_t));
+  hsk_dns_txts_t *txts = hsk_malloc(sizeof(hsk_dns_txts_t));
   if (txts)
     hsk_dns_txts_init(txts);
   return txts;
@@ -1955,7 +2363,7 @@ void
 hsk_dns_txts_free(hsk_dns_txts_t *txts) {
   assert(txts);
   hsk_dns_txts_uninit(txts);
-  free(txts);
+  hsk_free(txts);
 }
 
 size_t
@@ -2072,7 +2480,7 @@ hsk_dns_txt_uninit(hsk_dns_txt_t *txt) {
 
 hsk_dns_txt_t *
 hsk_dns_txt_alloc(void) {
-  hsk_dns_txt_t *txt = malloc(sizeof(hsk_dns_txt_t));
+  hsk_dns_txt_t *txt = hsk_malloc(sizeof(hsk_dns_txt_t));
   if (txt)
     hsk_dns_txt_init(txt);
   return txt;
@@ -2082,7 +2490,7 @@ void
 hsk_dns_txt_free(hsk_dns_txt_t *txt) {
   assert(txt);
   hsk_dns_txt_uninit(txt);
-  free(txt);
+  hsk_free(txt);
 }
 
 /*
@@ -2205,6 +2613,195 @@ hsk_dns_name_parse(
   return noff;
 }
 
+/*
+ * Compression
+ */
+
+void
+hsk_dns_cmp_init(hsk_dns_cmp_t *cmp, uint8_t *msg) {
+  assert(cmp);
+  cmp->msg = msg;
+  cmp->count = 0;
+  memset(cmp->slots, 0, sizeof(cmp->slots));
+}
+
+// Clears only the slots in use, so one table
+// can be reused across messages cheaply.
+void
+hsk_dns_cmp_reset(hsk_dns_cmp_t *cmp, uint8_t *msg) {
+  assert(cmp);
+
+  size_t i;
+  for (i = 0; i < cmp->count; i++)
+    cmp->slots[cmp->used[i]].off = 0;
+
+  cmp->msg = msg;
+  cmp->count = 0;
+}
+
+// Forget everything indexed since `count`.
+// Only the newest entries are ever dropped,
+// so no probe sequence is broken.
+static void
+hsk_dns_cmp_rollback(hsk_dns_cmp_t *cmp, size_t count) {
+  while (cmp->count > count) {
+    cmp->count -= 1;
+    cmp->slots[cmp->used[cmp->count]].off = 0;
+  }
+}
+
+// Wire form of a name character (see below).
+static inline uint8_t
+hsk_dns_cmp_char(char ch) {
+  if (ch == -1)
+    return 0x00;
+
+  if (ch == -2)
+    return '.';
+
+  return (uint8_t)ch;
+}
+
+// Does the name written at `off` spell out the
+// presentation form suffix `name`? Only names
+// whose every byte is already in the message
+// are ever indexed, and they are only ever
+// compressed into pointers to earlier offsets.
+static bool
+hsk_dns_cmp_equal(const hsk_dns_cmp_t *cmp, size_t off, const char *name) {
+  const uint8_t *msg = cmp->msg;
+  const char *s = name;
+
+  for (;;) {
+    uint8_t c = msg[off];
+
+    if ((c & 0xc0) == 0xc0) {
+      size_t ptr = ((size_t)(c & 0x3f) << 8) | msg[off + 1];
+
+      if (ptr >= off)
+        return false;
+
+      off = ptr;
+      continue;
+    }
+
+    if (c == 0)
+      return *s == '\0';
+
+    size_t i;
+    for (i = 0; i < c; i++) {
+      if (s[i] == '.' || s[i] == '\0')
+        return false;
+
+      if (hsk_dns_cmp_char(s[i]) != msg[off + 1 + i])
+        return false;
+    }
+
+    if (s[c] != '.')
+      return false;
+
+    s += c + 1;
+    off += 1 + c;
+  }
+}
+
+static size_t
+hsk_dns_cmp_get(const hsk_dns_cmp_t *cmp, uint32_t hash, const char *name) {
+  size_t mask = HSK_DNS_CMP_SLOTS - 1;
+  size_t i = hash & mask;
+
+  for (;;) {
+    const hsk_dns_cmp_entry_t *e = &cmp->slots[i];
+
+    if (e->off == 0)
+      return 0;
+
+    if (e->hash == hash && hsk_dns_cmp_equal(cmp, e->off, name))
+      return e->off;
+
+    i = (i + 1) & mask;
+  }
+}
+
+static void
+hsk_dns_cmp_put(hsk_dns_cmp_t *cmp, uint32_t hash, size_t off) {
+  size_t mask = HSK_DNS_CMP_SLOTS - 1;
+  size_t i = hash & mask;
+
+  // Offsets are past the header, so never 0.
+  assert(off > 0);
+
+  if (cmp->count == HSK_DNS_CMP_LIMIT)
+    return;
+
+  while (cmp->slots[i].off != 0)
+    i = (i + 1) & mask;
+
+  cmp->slots[i].hash = hash;
+  cmp->slots[i].off = (uint16_t)off;
+  cmp->used[cmp->count++] = (uint16_t)i;
+}
+
+// FNV-1a over each label, chained from the
+// right, so that the hash of every suffix of
+// a name comes out of one pass.
+static int
+hsk_dns_cmp_hash(const char *name, uint32_t *hashes) {
+  int begins[HSK_DNS_MAX_LABELS];
+  int count = 0;
+  int begin = 0;
+  int i;
+
+  for (i = 0; name[i]; i++) {
+    if (name[i] != '.')
+      continue;
+
+    if (count == HSK_DNS_MAX_LABELS)
+      return -1;
+
+    begins[count++] = begin;
+    begin = i + 1;
+  }
+
+  uint32_t hash = 2166136261;
+  int j;
+
+  for (j = count - 1; j >= 0; j--) {
+    const char *s = &name[begins[j]];
+
+    for (; *s != '.'; s++) {
+      hash ^= (uint8_t)*s;
+      hash *= 16777619;
+    }
+
+    hash ^= '.';
+    hash *= 16777619;
+
+    hashes[j] = hash;
+  }
+
+  return count;
+}
+
+static void
+hsk_dns_cmp_index(
+  hsk_dns_cmp_t *cmp,
+  const uint32_t *hashes,
+  const int *offsets,
+  int count
+) {
+  if (!cmp)
+    return;
+
+  int i;
+  for (i = 0; i < count; i++) {
+    // Pointers only have 14 bits.
+    if (offsets[i] >= (1 << 14))
+      break;
+    hsk_dns_cmp_put(cmp, hashes[i], offsets[i]);
+  }
+}
+
 static bool
 hsk_dns_name_serialize(
   const char *name,
@@ -2221,6 +2818,20 @@ hsk_dns_name_serialize(
   int i;
   char *s;
 
+  // Suffix hashes, and the offsets this name's
+  // own suffixes get. Those are only indexed
+  // once the whole name has been written.
+  uint32_t hashes[HSK_DNS_MAX_LABELS];
+  int offsets[HSK_DNS_MAX_LABELS];
+  int labels = 0;
+  int label = 0;
+
+  if (cmp && data && strcmp(name, ".") != 0)
+    labels = hsk_dns_cmp_hash(name, hashes);
+
+  if (labels < 0)
+    cmp = NULL;
+
   for (s = (char *)name, i = 0; *s; s++, i++) {
     if (name[i] == '.') {
       if (i > 0 && name[i - 1] == '.') {
@@ -2243,24 +2854,20 @@ hsk_dns_name_serialize(
         data[off] = size;
       }
 
-      if (cmp) {
-        char *sub = (char *)&name[begin];
-        if (strcmp(sub, ".") != 0) {
-          size_t p = (size_t)hsk_map_get(&cmp->map, sub);
-          if (p == 0) {
-            size_t o = (size_t)(&data[off] - cmp->msg);
-            if (o < (2 << 13))
-              hsk_map_set(&cmp->map, sub, (void *)o);
-          } else {
-            if (ptr == -1) {
-              ptr = p;
-              pos = off;
-              i += strlen(s);
-              break;
-            }
-          }
-        }
-      }
+      if (cmp && label < labels) {
+        const char *sub = &name[begin];
+        size_t p = hsk_dns_cmp_get(cmp, hashes[label], sub);
+
+        if (p != 0) {
+          ptr = p;
+          pos = off;
+          i += strlen(s);
+          break;
+        }
+
+        offsets[label] = (int)(&data[off] - cmp->msg);
+        label += 1;
+      }
 
       off += 1;
 
@@ -2316,6 +2923,8 @@ hsk_dns_name_serialize(
     off += 2;
     *len = off;
 
+    hsk_dns_cmp_index(cmp, hashes, offsets, label);
+
     return true;
   }
 
@@ -2331,6 +2940,8 @@ hsk_dns_name_serialize(
 
   *len = off;
 
+  hsk_dns_cmp_index(cmp, hashes, offsets, label);
+
   return true;
 }
 
@@ -2386,7 +2997,7 @@ hsk_dns_name_alloc(
   if (size == -1)
     return false;
 
-  char *n = malloc(size + 1);
+  char *n = hsk_malloc(size + 1);
 
   if (!n)
     return false;
@@ -2398,31 +3009,160 @@ hsk_dns_name_alloc(
   return true;
 }
 
+static inline bool
+hsk_dns_char_dirty(uint8_t c) {
+  switch (c) {
+    case 0x28 /*(*/:
+    case 0x29 /*)*/:
+    case 0x3b /*;*/:
+    case 0x20 /* */:
+    case 0x40 /*@*/:
+    case 0x22 /*"*/:
+    case 0x5c /*\\*/:
+      return true;
+  }
+
+  return c < 0x20 || c > 0x7e;
+}
+
+static inline int
+hsk_dns_ctz(uint32_t x) {
+#if defined(__GNUC__)
+  return __builtin_ctz(x);
+#else
+  int n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    n += 1;
+  }
+  return n;
+#endif
+}
+
+// Scan up to 16 bytes of a name (no NULs):
+// copies them, lowercased, to `out` if given,
+// sets `dirty` on any byte hsk_dns_name_dirty
+// refuses, and returns a bit per dot.
+static inline uint32_t
+hsk_dns_name_scan(const uint8_t *s, size_t n, uint8_t *out, bool *dirty) {
+  assert(n <= 16);
+
+#ifdef HSK_DNS_SSE2
+  if (n == 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+
+    if (out) {
+      __m128i up = _mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1))
+      );
+      __m128i lo = _mm_or_si128(v, _mm_and_si128(up, _mm_set1_epi8(0x20)));
+      _mm_storeu_si128((__m128i *)out, lo);
+    }
+
+    // Signed: 0x80 and up are negative too.
+    __m128i bad = _mm_cmplt_epi8(v, _mm_set1_epi8(0x21));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x28)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x29)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x3b)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x40)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x22)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x5c)));
+
+    if (_mm_movemask_epi8(bad) != 0)
+      *dirty = true;
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+  }
+#endif
+
+  uint32_t dots = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    uint8_t c = s[i];
+
+    if (out)
+      out[i] = (c >= 'A' && c <= 'Z') ? c + 0x20 : c;
+
+    if (hsk_dns_char_dirty(c))
+      *dirty = true;
+
+    if (c == '.')
+      dots |= (uint32_t)1 << i;
+  }
+
+  return dots;
+}
+
 bool
 hsk_dns_name_dirty(const char *name) {
-  char *s = (char *)name;
+  const uint8_t *s = (const uint8_t *)name;
+  size_t len = strlen(name);
+  bool dirty = false;
+  size_t i;
 
-  while (*s) {
-    uint8_t c = (uint8_t)*s;
+  for (i = 0; i < len && !dirty; i += 16) {
+    size_t n = len - i < 16 ? len - i : 16;
+    hsk_dns_name_scan(&s[i], n, NULL, &dirty);
+  }
 
-    switch (c) {
-      case 0x28 /*(*/:
-      case 0x29 /*)*/:
-      case 0x3b /*;*/:
-      case 0x20 /* */:
-      case 0x40 /*@*/:
-      case 0x22 /*"*/:
-      case 0x5c /*\\*/:
-        return true;
-    }
+  return dirty;
+}
 
-    if (c < 0x20 || c > 0x7e)
-      return true;
+// hsk_dns_name_verify and hsk_dns_name_dirty
+// in one pass, also writing the name out
+// lowercased (`out` needs room for 256).
+bool
+hsk_dns_name_lower_verify(const char *name, char *out) {
+  if (name == NULL)
+    return false;
 
-    s += 1;
+  const uint8_t *s = (const uint8_t *)name;
+  size_t len = strlen(name);
+
+  // Room for the dot verify would add.
+  if (len > 0 && name[len - 1] == '.') {
+    if (len > HSK_DNS_MAX_NAME)
+      return false;
+  } else {
+    if (len >= HSK_DNS_MAX_NAME)
+      return false;
   }
 
-  return false;
+  bool dirty = false;
+  int prev = -1;
+  size_t i;
+
+  for (i = 0; i < len; i += 16) {
+    size_t n = len - i < 16 ? len - i : 16;
+    uint32_t dots = hsk_dns_name_scan(&s[i], n, (uint8_t *)&out[i], &dirty);
+
+    while (dots) {
+      int pos = (int)i + hsk_dns_ctz(dots);
+
+      // No empty labels (but a leading dot).
+      if (pos > 0 && pos == prev + 1)
+        return false;
+
+      if (pos - prev - 1 > HSK_DNS_MAX_LABEL)
+        return false;
+
+      prev = pos;
+      dots &= dots - 1;
+    }
+  }
+
+  if (dirty)
+    return false;
+
+  if ((int)len - prev - 1 > HSK_DNS_MAX_LABEL)
+    return false;
+
+  out[len] = '\0';
+
+  return true;
 }
 
 void
@@ -2533,9 +3273,28 @@ hsk_dns_name_cmp(const char *a, const char *b) {
     blen -= 1;
 
   size_t len = alen < blen ? alen : blen;
+  size_t i = 0;
+
+#ifdef HSK_DNS_SSE2
+  // Skip the common prefix 16 bytes at a time.
+  for (; i + 16 <= len; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)&a[i]);
+    __m128i y = _mm_loadu_si128((const __m128i *)&b[i]);
+    __m128i lo = _mm_set1_epi8('A' - 1);
+    __m128i hi = _mm_set1_epi8('Z' + 1);
+    __m128i bit = _mm_set1_epi8(0x20);
+
+    x = _mm_or_si128(x, _mm_and_si128(bit,
+      _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi))));
+    y = _mm_or_si128(y, _mm_and_si128(bit,
+      _mm_and_si128(_mm_cmpgt_epi8(y, lo), _mm_cmplt_epi8(y, hi))));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+      break;
+  }
+#endif
 
-  int i;
-  for (i = 0; i < len; i++) {
+  for (; i < len; i++) {
     uint8_t x = (uint8_t)a[i];
     uint8_t y = (uint8_t)b[i];
 
@@ -2565,28 +3324,33 @@ hsk_dns_name_cmp(const char *a, const char *b) {
  * Labels
  */
 
+// A label starts at every byte that is not a
+// dot but follows one (or the start).
 int
 hsk_dns_label_split(const char *name, uint8_t *labels, size_t size) {
-  char *s = (char *)name;
-  bool dot = true;
+  const uint8_t *s = (const uint8_t *)name;
+  size_t len = strlen(name);
+  uint32_t carry = 1;
+  bool dirty = false;
   int count = 0;
-  int i;
+  size_t i;
 
   if (!labels)
     size = HSK_DNS_MAX_LABELS;
 
-  for (i = 0; *s && count < size; s++, i++) {
-    if (*s == '.') {
-      dot = true;
-      continue;
-    }
+  for (i = 0; i < len && count < size; i += 16) {
+    size_t n = len - i < 16 ? len - i : 16;
+    uint32_t all = ((uint32_t)1 << n) - 1;
+    uint32_t dots = hsk_dns_name_scan(&s[i], n, NULL, &dirty);
+    uint32_t starts = ~dots & all & ((dots << 1) | carry);
 
-    if (dot) {
+    carry = (dots >> (n - 1)) & 1;
+
+    while (starts && count < size) {
       if (labels)
-        labels[count] = i;
+        labels[count] = (uint8_t)(i + hsk_dns_ctz(starts));
       count += 1;
-      dot = false;
-      continue;
+      starts &= starts - 1;
     }
   }
 
@@ -2898,7 +3662,7 @@ hsk_dns_dnskey_keytag(const hsk_dns_dnskey_rd_t *rd) {
   tag += (tag >> 16) & 0xffff;
   tag &= 0xffff;
 
-  free(data);
+  hsk_free(data);
 
   return tag;
 }
@@ -2924,6 +3688,26 @@ hsk_dns_rrsig_tbs(hsk_dns_rrsig_rd_t *rrsig, uint8_t **data, size_t *data_len) {
   return ret;
 }
 
+// As above, into HSK_DNS_RRSIG_TBS_MAX bytes
+// of the caller's.
+bool
+hsk_dns_rrsig_tbs_into(
+  const hsk_dns_rrsig_rd_t *rrsig,
+  uint8_t *data,
+  size_t *data_len
+) {
+  assert(rrsig && data && data_len);
+
+  hsk_dns_rrsig_rd_t rd = *rrsig;
+
+  hsk_to_lower(rd.signer_name);
+  rd.signature = NULL;
+  rd.signature_len = 0;
+
+  return hsk_dns_rd_encode_into(&rd, HSK_DNS_RRSIG, data,
+                                HSK_DNS_RRSIG_TBS_MAX, data_len);
+}
+
 hsk_dns_rr_t *
 hsk_dns_dnskey_create(const char *zone, const uint8_t *priv, bool ksk) {
   hsk_dns_rr_t *key = hsk_dns_rr_create(HSK_DNS_DNSKEY);
@@ -2933,7 +3717,7 @@ hsk_dns_dnskey_create(const char *zone, const uint8_t *priv, bool ksk) {
 
   hsk_dns_dnskey_rd_t *dnskey = key->rd;
 
-  uint8_t *pubkey = malloc(64);
+  uint8_t *pubkey = hsk_malloc(64);
 
   if (!pubkey) {
     hsk_dns_rr_free(key);
@@ -2941,7 +3725,7 @@ hsk_dns_dnskey_create(const char *zone, const uint8_t *priv, bool ksk) {
   }
 
   if (!hsk_ecc_make_pubkey(priv, pubkey)) {
-    free(pubkey);
+    hsk_free(pubkey);
     hsk_dns_rr_free(key);
     return NULL;
   }
@@ -2982,7 +3766,7 @@ hsk_dns_ds_create(const hsk_dns_rr_t *key) {
     return NULL;
   }
 
-  uint8_t *digest = malloc(32);
+  uint8_t *digest = hsk_malloc(32);
 
   if (!digest) {
     hsk_dns_rr_free(ds);
@@ -3018,19 +3802,57 @@ hsk_dns_ds_create(const hsk_dns_rr_t *key) {
   hsk_sha256_update(&ctx, data, size);
   hsk_sha256_final(&ctx, digest);
 
-  free(data);
+  hsk_free(data);
 
   return ds;
 }
 
+bool
+hsk_dns_sign_ctx_init(
+  hsk_dns_sign_ctx_t *ctx,
+  const hsk_dns_rr_t *key,
+  const uint8_t *priv
+) {
+  if (!ctx || !key || !priv)
+    return false;
+
+  if (key->type != HSK_DNS_DNSKEY)
+    return false;
+
+  const hsk_dns_dnskey_rd_t *dnskey = (hsk_dns_dnskey_rd_t *)key->rd;
+
+  long key_tag = hsk_dns_dnskey_keytag(dnskey);
+
+  if (key_tag == -1)
+    return false;
+
+  ctx->key = key;
+  ctx->priv = priv;
+  ctx->key_tag = key_tag;
+  ctx->algorithm = dnskey->algorithm;
+  ctx->class = key->class;
+  ctx->ttl = key->ttl;
+
+  strcpy(ctx->signer_name, key->name);
+  hsk_to_lower(ctx->signer_name);
+
+  int len = hsk_dns_name_pack(ctx->signer_name, ctx->signer);
+
+  if (len <= 0)
+    return false;
+
+  ctx->signer_len = len;
+
+  return true;
+}
+
 bool
 hsk_dns_sign_type(
   hsk_dns_rrs_t *rrs,
   uint16_t type,
-  const hsk_dns_rr_t *key,
-  const uint8_t *priv
+  const hsk_dns_sign_ctx_t *ctx
 ) {
-  if (!rrs || rrs->size >= 255 || !key || !priv)
+  if (!rrs || rrs->size >= 255 || !ctx)
     return false;
 
   hsk_dns_rrs_t *rrset = hsk_dns_rrs_alloc();
@@ -3045,9 +3867,11 @@ hsk_dns_sign_type(
       assert(hsk_dns_rrs_push(rrset, rr));
   }
 
-  hsk_dns_rr_t *sig = hsk_dns_sign_rrset(rrset, key, priv);
+  hsk_dns_rr_t *sig = hsk_dns_sign_rrset(rrset, ctx);
 
-  free(rrset);
+  // The records are only borrowed.
+  rrset->size = 0;
+  hsk_dns_rrs_free(rrset);
 
   if (!sig)
     return false;
@@ -3057,22 +3881,52 @@ hsk_dns_sign_type(
   return true;
 }
 
-hsk_dns_rr_t *
-hsk_dns_sign_rrset(
-  hsk_dns_rrs_t *rrset,
-  const hsk_dns_rr_t *key,
-  const uint8_t *priv
-) {
-  if (!rrset || !key || !priv)
-    return NULL;
+static void
+hsk_dns_sig_init(void) {
+  assert(uv_mutex_init(&hsk_dns_sig_lock) == 0);
+}
 
-  if (rrset->size == 0)
-    return NULL;
+static hsk_dns_sig_entry_t *
+hsk_dns_sig_entry(const uint8_t *hash) {
+  uint32_t index = get_u32(hash) % HSK_DNS_SIG_CACHE;
+  return &hsk_dns_sig_cache[index];
+}
 
-  if (key->type != HSK_DNS_DNSKEY)
-    return NULL;
+static bool
+hsk_dns_sig_get(const uint8_t *hash, uint8_t *sig) {
+  uv_once(&hsk_dns_sig_once, hsk_dns_sig_init);
+  uv_mutex_lock(&hsk_dns_sig_lock);
 
-  hsk_dns_dnskey_rd_t *dnskey = (hsk_dns_dnskey_rd_t *)key->rd;
+  hsk_dns_sig_entry_t *entry = hsk_dns_sig_entry(hash);
+  bool found = entry->used && memcmp(entry->hash, hash, 32) == 0;
+
+  if (found)
+    memcpy(sig, entry->sig, 64);
+
+  uv_mutex_unlock(&hsk_dns_sig_lock);
+
+  return found;
+}
+
+static void
+hsk_dns_sig_put(const uint8_t *hash, const uint8_t *sig) {
+  uv_once(&hsk_dns_sig_once, hsk_dns_sig_init);
+  uv_mutex_lock(&hsk_dns_sig_lock);
+
+  hsk_dns_sig_entry_t *entry = hsk_dns_sig_entry(hash);
+
+  entry->used = true;
+  memcpy(entry->hash, hash, 32);
+  memcpy(entry->sig, sig, 64);
+
+  uv_mutex_unlock(&hsk_dns_sig_lock);
+}
+
+// An RRSIG for the set, not yet signed.
+static hsk_dns_rr_t *
+hsk_dns_rrsig_create(hsk_dns_rrs_t *rrset, const hsk_dns_sign_ctx_t *ctx) {
+  if (rrset->size == 0)
+    return NULL;
 
   hsk_dns_rr_t *sig = hsk_dns_rr_create(HSK_DNS_RRSIG);
 
@@ -3081,27 +3935,129 @@ hsk_dns_sign_rrset(
 
   hsk_dns_rrsig_rd_t *rrsig = sig->rd;
 
-  long key_tag = hsk_dns_dnskey_keytag(dnskey);
-
-  if (key_tag == -1) {
-    hsk_dns_rr_free(sig);
-    return NULL;
-  }
-
   strcpy(sig->name, rrset->items[0]->name);
   hsk_to_lower(sig->name);
   sig->type = HSK_DNS_RRSIG;
-  sig->class = key->class;
-  sig->ttl = key->ttl;
+  sig->class = ctx->class;
+  sig->ttl = ctx->ttl;
 
-  rrsig->key_tag = key_tag;
-  strcpy(rrsig->signer_name, key->name);
-  hsk_to_lower(rrsig->signer_name);
-  rrsig->algorithm = dnskey->algorithm;
-  rrsig->inception = hsk_now() - (14 * 24 * 60 * 60);
-  rrsig->expiration = hsk_now() + (14 * 24 * 60 * 60);
+  rrsig->key_tag = ctx->key_tag;
+  strcpy(rrsig->signer_name, ctx->signer_name);
+  rrsig->algorithm = ctx->algorithm;
+
+  int64_t now = hsk_now();
+  now -= now % HSK_DNS_SIG_BUCKET;
+
+  rrsig->inception = now - HSK_DNS_SIG_WINDOW;
+  rrsig->expiration = now + HSK_DNS_SIG_WINDOW;
+
+  return sig;
+}
+
+static bool
+hsk_dns_sighash_tbs(
+  hsk_dns_rrs_t *rrset,
+  uint32_t orig_ttl,
+  const uint8_t *tbs,
+  size_t tbs_len,
+  uint8_t *hash
+);
+
+// The RRSIG's rdata less the signature, with
+// the key's part copied from its context.
+static size_t
+hsk_dns_rrsig_tbs_ctx(
+  const hsk_dns_rrsig_rd_t *rrsig,
+  const hsk_dns_sign_ctx_t *ctx,
+  uint8_t *data
+) {
+  uint8_t *start = data;
+
+  write_u16be(&data, rrsig->type_covered);
+  write_u8(&data, rrsig->algorithm);
+  write_u8(&data, rrsig->labels);
+  write_u32be(&data, rrsig->orig_ttl);
+  write_u32be(&data, rrsig->expiration);
+  write_u32be(&data, rrsig->inception);
+  write_u16be(&data, rrsig->key_tag);
+  write_bytes(&data, ctx->signer, ctx->signer_len);
+
+  return data - start;
+}
+
+// Fill in what the RRSIG covers and hash it
+// for signing (without a context, the key's
+// part is encoded from the RRSIG itself).
+static bool
+hsk_dns_rrsig_prepare(
+  hsk_dns_rrs_t *rrset,
+  hsk_dns_rr_t *sig,
+  const hsk_dns_sign_ctx_t *ctx,
+  uint8_t *hash
+) {
+  hsk_dns_rrsig_rd_t *rrsig = (hsk_dns_rrsig_rd_t *)sig->rd;
 
-  if (!hsk_dns_sign_rrsig(rrset, sig, priv)) {
+  rrsig->orig_ttl = rrset->items[0]->ttl;
+  rrsig->type_covered = rrset->items[0]->type;
+  rrsig->labels = hsk_dns_label_count(rrset->items[0]->name);
+  rrsig->signature_len = 0;
+  rrsig->signature = NULL;
+
+  if (!ctx)
+    return hsk_dns_sighash(rrset, sig, hash);
+
+  uint8_t tbs[HSK_DNS_RRSIG_TBS_MAX];
+  size_t size = hsk_dns_rrsig_tbs_ctx(rrsig, ctx, tbs);
+
+  // Hash with sha256.
+  return hsk_dns_sighash_tbs(rrset, rrsig->orig_ttl, tbs, size, hash);
+}
+
+static bool
+hsk_dns_rrsig_set(hsk_dns_rr_t *sig, const uint8_t *signature) {
+  hsk_dns_rrsig_rd_t *rrsig = (hsk_dns_rrsig_rd_t *)sig->rd;
+  uint8_t *sigbuf = hsk_malloc(64);
+
+  if (!sigbuf)
+    return false;
+
+  memcpy(sigbuf, signature, 64);
+
+  rrsig->signature_len = 64;
+  rrsig->signature = sigbuf;
+
+  return true;
+}
+
+// Sign the hash (unless cached) into the RRSIG.
+static bool
+hsk_dns_rrsig_sign(hsk_dns_rr_t *sig, const uint8_t *hash, const uint8_t *priv) {
+  uint8_t signature[64];
+
+  if (!hsk_dns_sig_get(hash, signature)) {
+    // Sign with secp256r1.
+    if (!hsk_ecc_sign(priv, hash, signature))
+      return false;
+
+    hsk_dns_sig_put(hash, signature);
+  }
+
+  return hsk_dns_rrsig_set(sig, signature);
+}
+
+hsk_dns_rr_t *
+hsk_dns_sign_rrset(hsk_dns_rrs_t *rrset, const hsk_dns_sign_ctx_t *ctx) {
+  if (!rrset || !ctx)
+    return NULL;
+
+  hsk_dns_rr_t *sig = hsk_dns_rrsig_create(rrset, ctx);
+  uint8_t hash[32];
+
+  if (!sig)
+    return NULL;
+
+  if (!hsk_dns_rrsig_prepare(rrset, sig, ctx, hash)
+      || !hsk_dns_rrsig_sign(sig, hash, ctx->priv)) {
     hsk_dns_rr_free(sig);
     return NULL;
   }
@@ -3124,35 +4080,134 @@ hsk_dns_sign_rrsig(
   if (!priv)
     return false;
 
-  hsk_dns_rrsig_rd_t *rrsig = (hsk_dns_rrsig_rd_t *)sig->rd;
+  uint8_t hash[32];
 
-  rrsig->orig_ttl = rrset->items[0]->ttl;
-  rrsig->type_covered = rrset->items[0]->type;
-  rrsig->labels = hsk_dns_label_count(rrset->items[0]->name);
-  rrsig->signature_len = 0;
-  rrsig->signature = NULL;
+  if (!hsk_dns_rrsig_prepare(rrset, sig, NULL, hash))
+    return false;
 
-  uint8_t hash[32];
+  return hsk_dns_rrsig_sign(sig, hash, priv);
+}
 
-  // Hash with sha256.
-  if (!hsk_dns_sighash(rrset, sig, hash))
+void
+hsk_dns_signer_init(hsk_dns_signer_t *signer, const hsk_dns_sign_ctx_t *ctx) {
+  assert(signer && ctx);
+  signer->ctx = ctx;
+  signer->size = 0;
+}
+
+// Like hsk_dns_sign_type, and the RRSIG takes
+// its place in `rrs` now, but it is only signed
+// by hsk_dns_signer_finish (unless cached).
+bool
+hsk_dns_signer_add(hsk_dns_signer_t *signer, hsk_dns_rrs_t *rrs, uint16_t type) {
+  if (!rrs || rrs->size >= 255)
     return false;
 
-  uint8_t *sigbuf = malloc(64);
+  if (signer->size == HSK_DNS_SIGNER_MAX)
+    return hsk_dns_sign_type(rrs, type, signer->ctx);
 
-  if (!sigbuf)
+  hsk_dns_rrs_t *rrset = hsk_dns_rrs_alloc();
+
+  if (!rrset)
     return false;
 
-  // Sign with secp256r1.
-  if (!hsk_ecc_sign(priv, hash, sigbuf)) {
-    free(sigbuf);
+  int i;
+  for (i = 0; i < rrs->size; i++) {
+    hsk_dns_rr_t *rr = rrs->items[i];
+    if (rr->type == type)
+      assert(hsk_dns_rrs_push(rrset, rr));
+  }
+
+  hsk_dns_rr_t *sig = hsk_dns_rrsig_create(rrset, signer->ctx);
+  uint8_t *hash = signer->hashes[signer->size];
+  uint8_t signature[64];
+  bool ret = false;
+
+  if (!sig)
+    goto done;
+
+  if (!hsk_dns_rrsig_prepare(rrset, sig, signer->ctx, hash))
+    goto done;
+
+  if (hsk_dns_sig_get(hash, signature)) {
+    if (!hsk_dns_rrsig_set(sig, signature))
+      goto done;
+  } else {
+    signer->sections[signer->size] = rrs;
+    signer->sigs[signer->size] = sig;
+    signer->size += 1;
+  }
+
+  assert(hsk_dns_rrs_push(rrs, sig));
+  sig = NULL;
+  ret = true;
+
+done:
+  if (sig)
+    hsk_dns_rr_free(sig);
+
+  // The records are only borrowed.
+  rrset->size = 0;
+  hsk_dns_rrs_free(rrset);
+
+  return ret;
+}
+
+// An RRSIG that could not be signed leaves
+// its section.
+static void
+hsk_dns_signer_drop(hsk_dns_rrs_t *rrs, hsk_dns_rr_t *sig) {
+  int i, j;
+
+  for (i = 0; i < rrs->size; i++) {
+    if (rrs->items[i] != sig)
+      continue;
+
+    for (j = i; j < rrs->size - 1; j++)
+      rrs->items[j] = rrs->items[j + 1];
+
+    rrs->items[rrs->size - 1] = NULL;
+    rrs->size -= 1;
+
+    hsk_dns_rr_free(sig);
+
+    return;
+  }
+}
+
+// Sign what was added, as one batch.
+bool
+hsk_dns_signer_finish(hsk_dns_signer_t *signer) {
+  uint8_t signatures[HSK_DNS_SIGNER_MAX][64];
+  size_t count = signer->size;
+  bool ret = true;
+  size_t i;
+
+  signer->size = 0;
+
+  if (count == 0)
+    return true;
+
+  if (!hsk_ecc_sign_batch(signer->ctx->priv,
+                          (const uint8_t (*)[32])signer->hashes,
+                          signatures, count)) {
+    for (i = 0; i < count; i++)
+      hsk_dns_signer_drop(signer->sections[i], signer->sigs[i]);
     return false;
   }
 
-  rrsig->signature_len = 64;
-  rrsig->signature = sigbuf;
+  for (i = 0; i < count; i++) {
+    hsk_dns_rr_t *sig = signer->sigs[i];
 
-  return true;
+    hsk_dns_sig_put(signer->hashes[i], signatures[i]);
+
+    if (!hsk_dns_rrsig_set(sig, signatures[i])) {
+      hsk_dns_signer_drop(signer->sections[i], sig);
+      ret = false;
+    }
+  }
+
+  return ret;
 }
 
 bool
@@ -3168,85 +4223,133 @@ hsk_dns_sighash(hsk_dns_rrs_t *rrset, hsk_dns_rr_t *sig, uint8_t *hash) {
 
   hsk_dns_rrsig_rd_t *rrsig = (hsk_dns_rrsig_rd_t *)sig->rd;
 
-  hsk_dns_raw_rr_t *records =
-    calloc(rrset->size, sizeof(hsk_dns_raw_rr_t));
+  uint8_t tbs[HSK_DNS_RRSIG_TBS_MAX];
+  size_t size;
 
-  if (!records)
+  if (!hsk_dns_rrsig_tbs_into(rrsig, tbs, &size))
     return false;
 
-  int i, j;
-  uint8_t *data;
-  size_t size;
-  bool ret = true;
+  return hsk_dns_sighash_tbs(rrset, rrsig->orig_ttl, tbs, size, hash);
+}
 
-  for (i = 0; i < rrset->size; i++) {
-    hsk_dns_rr_t *item = rrset->items[i];
-    hsk_dns_rr_t *rr = hsk_dns_rr_clone(item);
+// The RRSIG's rdata (tbs), then the records.
+static bool
+hsk_dns_sighash_tbs(
+  hsk_dns_rrs_t *rrset,
+  uint32_t orig_ttl,
+  const uint8_t *tbs,
+  size_t tbs_len,
+  uint8_t *hash
+) {
+  // Every record, in canonical form, goes into
+  // one buffer. Lowercasing never changes the
+  // size, so the plain sizes bound it.
+  hsk_dns_raw_rr_t records[255];
+  uint8_t stack[2048];
+  uint8_t *buf = stack;
+  size_t total = 0;
+  int i;
 
-    if (!rr)
-      goto fail;
+  for (i = 0; i < rrset->size; i++)
+    total += hsk_dns_rr_size(rrset->items[i]);
 
-    hsk_to_lower(rr->name);
+  if (total > sizeof(stack)) {
+    buf = hsk_malloc(total);
 
-    rr->ttl = rrsig->orig_ttl;
+    if (!buf)
+      return false;
+  }
 
-    switch (rr->type) {
+  uint8_t *data = buf;
+
+  for (i = 0; i < rrset->size; i++) {
+    const hsk_dns_rr_t *item = rrset->items[i];
+
+    // Shallow copies: only names are changed,
+    // and only these are written.
+    hsk_dns_rr_t rr = *item;
+    union {
+      hsk_dns_ns_rd_t ns;
+      hsk_dns_cname_rd_t cname;
+      hsk_dns_soa_rd_t soa;
+      hsk_dns_ptr_rd_t ptr;
+      hsk_dns_mx_rd_t mx;
+      hsk_dns_rrsig_rd_t rrsig;
+      hsk_dns_srv_rd_t srv;
+      hsk_dns_dname_rd_t dname;
+    } rd;
+
+    hsk_to_lower(rr.name);
+
+    rr.ttl = orig_ttl;
+
+    switch (rr.type) {
       case HSK_DNS_NS:
-        hsk_to_lower(((hsk_dns_ns_rd_t *)rr->rd)->ns);
+        rd.ns = *(hsk_dns_ns_rd_t *)item->rd;
+        hsk_to_lower(rd.ns.ns);
+        rr.rd = &rd;
         break;
       case HSK_DNS_CNAME:
-        hsk_to_lower(((hsk_dns_cname_rd_t *)rr->rd)->target);
+        rd.cname = *(hsk_dns_cname_rd_t *)item->rd;
+        hsk_to_lower(rd.cname.target);
+        rr.rd = &rd;
         break;
       case HSK_DNS_SOA:
-        hsk_to_lower(((hsk_dns_soa_rd_t *)rr->rd)->ns);
-        hsk_to_lower(((hsk_dns_soa_rd_t *)rr->rd)->mbox);
+        rd.soa = *(hsk_dns_soa_rd_t *)item->rd;
+        hsk_to_lower(rd.soa.ns);
+        hsk_to_lower(rd.soa.mbox);
+        rr.rd = &rd;
         break;
       case HSK_DNS_PTR:
-        hsk_to_lower(((hsk_dns_ptr_rd_t *)rr->rd)->ptr);
+        rd.ptr = *(hsk_dns_ptr_rd_t *)item->rd;
+        hsk_to_lower(rd.ptr.ptr);
+        rr.rd = &rd;
         break;
       case HSK_DNS_MX:
-        hsk_to_lower(((hsk_dns_mx_rd_t *)rr->rd)->mx);
+        rd.mx = *(hsk_dns_mx_rd_t *)item->rd;
+        hsk_to_lower(rd.mx.mx);
+        rr.rd = &rd;
         break;
       case HSK_DNS_SIG:
       case HSK_DNS_RRSIG:
-        hsk_to_lower(((hsk_dns_rrsig_rd_t *)rr->rd)->signer_name);
+        rd.rrsig = *(hsk_dns_rrsig_rd_t *)item->rd;
+        hsk_to_lower(rd.rrsig.signer_name);
+        rr.rd = &rd;
         break;
       case HSK_DNS_SRV:
-        hsk_to_lower(((hsk_dns_srv_rd_t *)rr->rd)->target);
+        rd.srv = *(hsk_dns_srv_rd_t *)item->rd;
+        hsk_to_lower(rd.srv.target);
+        rr.rd = &rd;
         break;
       case HSK_DNS_DNAME:
-        hsk_to_lower(((hsk_dns_dname_rd_t *)rr->rd)->target);
+        rd.dname = *(hsk_dns_dname_rd_t *)item->rd;
+        hsk_to_lower(rd.dname.target);
+        rr.rd = &rd;
         break;
     }
 
-    if (!hsk_dns_rr_encode(rr, &data, &size)) {
-      hsk_dns_rr_free(rr);
-      goto fail;
-    }
-
-    hsk_dns_rr_free(rr);
-
     hsk_dns_raw_rr_t *raw = &records[i];
 
-    raw->size = size;
+    // Name, then type, class, TTL and length.
     raw->data = data;
+    raw->rd = hsk_dns_name_write(rr.name, NULL, NULL) + 10;
+    raw->size = hsk_dns_rr_write(&rr, &data, NULL);
+
+    assert(raw->rd <= raw->size);
   }
 
-  qsort((void *)records, rrset->size, sizeof(hsk_dns_raw_rr_t), raw_rr_cmp);
+  assert((size_t)(data - buf) <= total);
 
-  if (!hsk_dns_rrsig_tbs(rrsig, &data, &size))
-    goto fail;
+  qsort((void *)records, rrset->size, sizeof(hsk_dns_raw_rr_t), raw_rr_cmp);
 
   hsk_sha256_ctx ctx;
   hsk_sha256_init(&ctx);
-  hsk_sha256_update(&ctx, data, size);
-
-  free(data);
+  hsk_sha256_update(&ctx, tbs, tbs_len);
 
   hsk_dns_raw_rr_t *last = NULL;
 
-  for (j = 0; j < rrset->size; j++) {
-    hsk_dns_raw_rr_t *raw = &records[j];
+  for (i = 0; i < rrset->size; i++) {
+    hsk_dns_raw_rr_t *raw = &records[i];
 
     if (last && raw_rr_equal(raw, last))
       continue;
@@ -3258,22 +4361,10 @@ hsk_dns_sighash(hsk_dns_rrs_t *rrset, hsk_dns_rr_t *sig, uint8_t *hash) {
 
   hsk_sha256_final(&ctx, hash);
 
-  goto done;
-
-fail:
-  ret = false;
-
-done:
-  for (j = 0; j < i; j++) {
-    hsk_dns_raw_rr_t *raw = &records[j];
-
-    if (raw->data)
-      free(raw->data);
-  }
-
-  free(records);
+  if (buf != stack)
+    hsk_free(buf);
 
-  return ret;
+  return true;
 }
 
 bool
@@ -3328,14 +4419,15 @@ hsk_dns_rrs_clean(hsk_dns_rrs_t *rrs, uint16_t type) {
     }
   }
 
-  hsk_dns_rrs_init(rrs);
+  rrs->size = 0;
 
   for (i = 0; i < tmp->size; i++) {
     hsk_dns_rr_t *rr = tmp->items[i];
     assert(hsk_dns_rrs_push(rrs, rr));
   }
 
-  free(tmp);
+  tmp->size = 0;
+  hsk_dns_rrs_free(tmp);
 
   return true;
 }
@@ -3344,28 +4436,63 @@ hsk_dns_rrs_clean(hsk_dns_rrs_t *rrs, uint16_t type) {
  * Helpers
  */
 
-static int
-raw_rr_cmp(const void *a, const void *b) {
-  assert(a && b);
+typedef struct hsk_dns_type_name_s {
+  const char *name;
+  uint16_t type;
+} hsk_dns_type_name_t;
+
+static const hsk_dns_type_name_t hsk_dns_type_names[] = {
+  { "A", HSK_DNS_A },
+  { "NS", HSK_DNS_NS },
+  { "CNAME", HSK_DNS_CNAME },
+  { "SOA", HSK_DNS_SOA },
+  { "PTR", HSK_DNS_PTR },
+  { "MX", HSK_DNS_MX },
+  { "TXT", HSK_DNS_TXT },
+  { "AAAA", HSK_DNS_AAAA },
+  { "SRV", HSK_DNS_SRV },
+  { "DS", HSK_DNS_DS },
+  { "TLSA", HSK_DNS_TLSA },
+  { "SMIMEA", HSK_DNS_SMIMEA },
+  { "OPENPGPKEY", HSK_DNS_OPENPGPKEY }
+};
+
+// A mnemonic (any case) or a number.
+bool
+hsk_dns_type_from_string(const char *name, uint16_t *type) {
+  size_t count = sizeof(hsk_dns_type_names) / sizeof(hsk_dns_type_names[0]);
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    if (strcasecmp(name, hsk_dns_type_names[i].name) == 0) {
+      *type = hsk_dns_type_names[i].type;
+      return true;
+    }
+  }
+
+  char *end;
+  unsigned long num = strtoul(name, &end, 10);
+
+  if (*name == '\0' || *end != '\0' || num == 0 || num > 0xffff)
+    return false;
 
-  hsk_dns_raw_rr_t *x = (hsk_dns_raw_rr_t *)a;
-  hsk_dns_raw_rr_t *y = (hsk_dns_raw_rr_t *)b;
+  *type = (uint16_t)num;
 
-  uint8_t *xd = x->data;
-  size_t xs = x->size;
-  uint8_t *yd = y->data;
-  size_t ys = y->size;
+  return true;
+}
 
-  assert(hsk_dns_name_parse(&xd, &xs, NULL, NULL) != -1);
-  assert(hsk_dns_name_parse(&yd, &ys, NULL, NULL) != -1);
+static int
+raw_rr_cmp(const void *a, const void *b) {
+  assert(a && b);
 
-  assert(xs >= 10);
-  assert(ys >= 10);
+  const hsk_dns_raw_rr_t *x = (const hsk_dns_raw_rr_t *)a;
+  const hsk_dns_raw_rr_t *y = (const hsk_dns_raw_rr_t *)b;
 
-  xd += 10;
-  xs -= 10;
-  yd += 10;
-  ys -= 10;
+  // Canonical order only looks at the rdata.
+  const uint8_t *xd = x->data + x->rd;
+  size_t xs = x->size - x->rd;
+  const uint8_t *yd = y->data + y->rd;
+  size_t ys = y->size - y->rd;
 
   size_t s = xs < ys ? xs : ys;
 
@@ -6,19 +6,41 @@
 #include <stdlib.h>
 #include "map.h"
 
+// Bytes per message arena block.
+#define HSK_DNS_ARENA_SIZE 4096
+
+// The records (and their rdata structs) of a
+// decoded message are carved out of blocks
+// like this one. Every record holds a ref on
+// its block so it can still be freed, or moved
+// to another message, on its own.
+typedef struct hsk_dns_arena_s {
+  size_t refs;
+  size_t used;
+  uint8_t data[HSK_DNS_ARENA_SIZE];
+} hsk_dns_arena_t;
+
 typedef struct hsk_dns_rr_s {
   char name[256];
   uint16_t type;
   uint16_t class;
   uint32_t ttl;
   void *rd;
+  hsk_dns_arena_t *arena;
 } hsk_dns_rr_t;
 
 typedef hsk_dns_rr_t hsk_dns_qs_t;
 
+// Up to 255 records. Low-memory builds grow
+// the list as records are added.
 typedef struct hsk_dns_rrs_s {
   size_t size;
+#ifdef HSK_LOW_MEMORY
+  size_t cap;
+  hsk_dns_rr_t **items;
+#else
   hsk_dns_rr_t *items[255];
+#endif
 } hsk_dns_rrs_t;
 
 typedef struct hsk_dns_msg_s {
@@ -39,6 +61,7 @@ typedef struct hsk_dns_msg_s {
     size_t rd_len;
     uint8_t *rd;
   } edns;
+  hsk_dns_arena_t *arena;
 } hsk_dns_msg_t;
 
 typedef struct hsk_dns_txt_s {
@@ -190,9 +213,23 @@ typedef struct {
   uint8_t *type_map;
 } hsk_dns_nsec_rd_t;
 
+// Name compression: suffixes already written
+// to the message, by hash and offset. Slots
+// are a power of two; past the load limit,
+// names are still written, just uncompressed.
+#define HSK_DNS_CMP_SLOTS 512
+#define HSK_DNS_CMP_LIMIT 384
+
+typedef struct {
+  uint32_t hash;
+  uint16_t off;
+} hsk_dns_cmp_entry_t;
+
 typedef struct {
-  hsk_map_t map;
   uint8_t *msg;
+  size_t count;
+  uint16_t used[HSK_DNS_CMP_LIMIT];
+  hsk_dns_cmp_entry_t slots[HSK_DNS_CMP_SLOTS];
 } hsk_dns_cmp_t;
 
 typedef struct {
@@ -200,6 +237,33 @@ typedef struct {
   size_t msg_len;
 } hsk_dns_dmp_t;
 
+// A key to sign with, and what its RRSIGs
+// take from it, worked out once: the key tag
+// and the signer's name, lowercased (and in
+// wire form, for hashing).
+typedef struct {
+  const hsk_dns_rr_t *key;
+  const uint8_t *priv;
+  uint16_t key_tag;
+  uint8_t algorithm;
+  uint16_t class;
+  uint32_t ttl;
+  char signer_name[256];
+  uint8_t signer[256];
+  size_t signer_len;
+} hsk_dns_sign_ctx_t;
+
+// RRSIGs of one response, signed together.
+#define HSK_DNS_SIGNER_MAX 16
+
+typedef struct {
+  const hsk_dns_sign_ctx_t *ctx;
+  size_t size;
+  hsk_dns_rrs_t *sections[HSK_DNS_SIGNER_MAX];
+  hsk_dns_rr_t *sigs[HSK_DNS_SIGNER_MAX];
+  uint8_t hashes[HSK_DNS_SIGNER_MAX][32];
+} hsk_dns_signer_t;
+
 // Constants
 #define HSK_DNS_MAX_NAME 255
 #define HSK_DNS_MAX_LABEL 63
@@ -207,9 +271,23 @@ typedef struct {
 #define HSK_DNS_MAX_LABELS 128
 #define HSK_DNS_MAX_UDP 512
 #define HSK_DNS_STD_EDNS 1280
+#define HSK_DNS_SAFE_EDNS 1232
 #define HSK_DNS_MAX_EDNS 4096
 #define HSK_DNS_MAX_TCP 65535
 
+// RRSIG rdata less the signature: the fixed
+// fields and the signer's name (in wire form,
+// a byte longer, and the root label).
+#define HSK_DNS_RRSIG_TBS_MAX (18 + HSK_DNS_MAX_NAME + 2)
+
+// Signatures are valid for two weeks either
+// side of the hour they were made in, so that
+// an RRset signed twice in that hour hashes
+// the same and the cached signature is reused.
+#define HSK_DNS_SIG_WINDOW (14 * 24 * 60 * 60)
+#define HSK_DNS_SIG_BUCKET (60 * 60)
+#define HSK_DNS_SIG_CACHE 4096
+
 // Opcodes
 #define HSK_DNS_QUERY 0
 #define HSK_DNS_IQUERY 1
@@ -383,6 +461,21 @@ hsk_dns_msg_alloc(void);
 void
 hsk_dns_msg_free(hsk_dns_msg_t *msg);
 
+void
+hsk_dns_cmp_init(hsk_dns_cmp_t *cmp, uint8_t *msg);
+
+void
+hsk_dns_cmp_reset(hsk_dns_cmp_t *cmp, uint8_t *msg);
+
+hsk_dns_qs_t *
+hsk_dns_msg_qs_alloc(hsk_dns_msg_t *msg);
+
+hsk_dns_rr_t *
+hsk_dns_msg_rr_alloc(hsk_dns_msg_t *msg);
+
+hsk_dns_rr_t *
+hsk_dns_msg_rr_create(hsk_dns_msg_t *msg, uint16_t type);
+
 bool
 hsk_dns_msg_decode(const uint8_t *data, size_t data_len, hsk_dns_msg_t **msg);
 
@@ -395,6 +488,22 @@ hsk_dns_msg_size(const hsk_dns_msg_t *msg);
 bool
 hsk_dns_msg_encode(const hsk_dns_msg_t *msg, uint8_t **data, size_t *data_len);
 
+bool
+hsk_dns_msg_encode_into(
+  const hsk_dns_msg_t *msg,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+);
+
+bool
+hsk_dns_msg_encode_max(
+  const hsk_dns_msg_t *msg,
+  size_t max,
+  uint8_t **data,
+  size_t *data_len
+);
+
 bool
 hsk_dns_msg_truncate(uint8_t *msg, size_t msg_len, size_t max, size_t *len);
 
@@ -492,6 +601,14 @@ hsk_dns_rr_read(
 bool
 hsk_dns_rr_encode(const hsk_dns_rr_t *rr, uint8_t **data, size_t *data_len);
 
+bool
+hsk_dns_rr_encode_into(
+  const hsk_dns_rr_t *rr,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+);
+
 bool
 hsk_dns_rr_decode(const uint8_t *data, size_t data_len, hsk_dns_rr_t **out);
 
@@ -538,6 +655,15 @@ hsk_dns_rd_encode(
   size_t *data_len
 );
 
+bool
+hsk_dns_rd_encode_into(
+  const void *rd,
+  uint16_t type,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+);
+
 bool
 hsk_dns_rd_decode(
   const uint8_t *data,
@@ -634,6 +760,9 @@ hsk_dns_name_sanitize(const char *name, char *out);
 bool
 hsk_dns_name_verify(const char *name);
 
+bool
+hsk_dns_name_lower_verify(const char *name, char *out);
+
 bool
 hsk_dns_name_is_fqdn(const char *name);
 
@@ -704,26 +833,35 @@ hsk_dns_dnskey_keytag(const hsk_dns_dnskey_rd_t *rd);
 bool
 hsk_dns_rrsig_tbs(hsk_dns_rrsig_rd_t *rrsig, uint8_t **data, size_t *data_len);
 
+bool
+hsk_dns_rrsig_tbs_into(
+  const hsk_dns_rrsig_rd_t *rrsig,
+  uint8_t *data,
+  size_t *data_len
+);
+
 hsk_dns_rr_t *
 hsk_dns_dnskey_create(const char *zone, const uint8_t *priv, bool ksk);
 
 hsk_dns_rr_t *
 hsk_dns_ds_create(const hsk_dns_rr_t *key);
 
+bool
+hsk_dns_sign_ctx_init(
+  hsk_dns_sign_ctx_t *ctx,
+  const hsk_dns_rr_t *key,
+  const uint8_t *priv
+);
+
 bool
 hsk_dns_sign_type(
   hsk_dns_rrs_t *rrs,
   uint16_t type,
-  const hsk_dns_rr_t *key,
-  const uint8_t *priv
+  const hsk_dns_sign_ctx_t *ctx
 );
 
 hsk_dns_rr_t *
-hsk_dns_sign_rrset(
-  hsk_dns_rrs_t *rrset,
-  const hsk_dns_rr_t *key,
-  const uint8_t *priv
-);
+hsk_dns_sign_rrset(hsk_dns_rrs_t *rrset, const hsk_dns_sign_ctx_t *ctx);
 
 bool
 hsk_dns_sign_rrsig(
@@ -735,10 +873,22 @@ hsk_dns_sign_rrsig(
 bool
 hsk_dns_sighash(hsk_dns_rrs_t *rrset, hsk_dns_rr_t *sig, uint8_t *hash);
 
+void
+hsk_dns_signer_init(hsk_dns_signer_t *signer, const hsk_dns_sign_ctx_t *ctx);
+
+bool
+hsk_dns_signer_add(hsk_dns_signer_t *signer, hsk_dns_rrs_t *rrs, uint16_t type);
+
+bool
+hsk_dns_signer_finish(hsk_dns_signer_t *signer);
+
 bool
 hsk_dns_msg_clean(hsk_dns_msg_t *msg, uint16_t type);
 
 bool
 hsk_dns_rrs_clean(hsk_dns_rrs_t *rrs, uint16_t type);
 
+bool
+hsk_dns_type_from_string(const char *name, uint16_t *type);
+
 #endif
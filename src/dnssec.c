@@ -4,60 +4,70 @@
 
 #include "dns.h"
 #include "dnssec.h"
+#include "uv.h"
 
 static hsk_dns_rr_t *ksk_key = NULL;
 static hsk_dns_rr_t *zsk_key = NULL;
 static hsk_dns_rr_t *ksk_ds = NULL;
+static hsk_dns_sign_ctx_t ksk_ctx;
+static hsk_dns_sign_ctx_t zsk_ctx;
+static uv_once_t hsk_dnssec_once = UV_ONCE_INIT;
 
-const hsk_dns_rr_t *
-hsk_dnssec_get_ksk(void) {
-  if (ksk_key)
-    return (const hsk_dns_rr_t *)ksk_key;
+static void
+hsk_dnssec_build(void) {
+  ksk_key = hsk_dns_dnskey_create(".", &hsk_dnssec_ksk[0], true);
+  assert(ksk_key);
 
-  const uint8_t *ksk = &hsk_dnssec_ksk[0];
+  zsk_key = hsk_dns_dnskey_create(".", &hsk_dnssec_zsk[0], false);
+  assert(zsk_key);
 
-  ksk_key = hsk_dns_dnskey_create(".", ksk, true);
-  assert(ksk_key);
+  ksk_ds = hsk_dns_ds_create(ksk_key);
+  assert(ksk_ds);
 
+  assert(hsk_dns_sign_ctx_init(&ksk_ctx, ksk_key, &hsk_dnssec_ksk[0]));
+  assert(hsk_dns_sign_ctx_init(&zsk_ctx, zsk_key, &hsk_dnssec_zsk[0]));
+}
+
+// The keys (and what signing with them
+// takes) are decoded once, by whichever
+// thread gets here first (the others wait).
+void
+hsk_dnssec_load(void) {
+  uv_once(&hsk_dnssec_once, hsk_dnssec_build);
+}
+
+const hsk_dns_rr_t *
+hsk_dnssec_get_ksk(void) {
+  hsk_dnssec_load();
   return (const hsk_dns_rr_t *)ksk_key;
 }
 
 const hsk_dns_rr_t *
 hsk_dnssec_get_zsk(void) {
-  if (zsk_key)
-    return (const hsk_dns_rr_t *)zsk_key;
-
-  const uint8_t *zsk = &hsk_dnssec_zsk[0];
-
-  zsk_key = hsk_dns_dnskey_create(".", zsk, false);
-  assert(zsk_key);
-
+  hsk_dnssec_load();
   return (const hsk_dns_rr_t *)zsk_key;
 }
 
 const hsk_dns_rr_t *
 hsk_dnssec_get_ds(void) {
-  if (ksk_ds)
-    return (const hsk_dns_rr_t *)ksk_ds;
-
-  ksk_ds = hsk_dns_ds_create(hsk_dnssec_get_ksk());
-  assert(ksk_ds);
-
+  hsk_dnssec_load();
   return (const hsk_dns_rr_t *)ksk_ds;
 }
 
 bool
 hsk_dnssec_sign_ksk(hsk_dns_rrs_t *rrs, uint16_t type) {
-  const uint8_t *priv = &hsk_dnssec_ksk[0];
-  const hsk_dns_rr_t *key = hsk_dnssec_get_ksk();
-
-  return hsk_dns_sign_type(rrs, type, key, priv);
+  hsk_dnssec_load();
+  return hsk_dns_sign_type(rrs, type, &ksk_ctx);
 }
 
 bool
 hsk_dnssec_sign_zsk(hsk_dns_rrs_t *rrs, uint16_t type) {
-  const uint8_t *priv = &hsk_dnssec_zsk[0];
-  const hsk_dns_rr_t *key = hsk_dnssec_get_zsk();
+  hsk_dnssec_load();
+  return hsk_dns_sign_type(rrs, type, &zsk_ctx);
+}
 
-  return hsk_dns_sign_type(rrs, type, key, priv);
+void
+hsk_dnssec_signer_zsk(hsk_dns_signer_t *signer) {
+  hsk_dnssec_load();
+  hsk_dns_signer_init(signer, &zsk_ctx);
 }
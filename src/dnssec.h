@@ -16,6 +16,9 @@ static const uint8_t hsk_dnssec_zsk[] = ""
   "\x54\x27\x6f\xf8\x60\x4a\x34\x94\xc5\xc7\x6d\x66\x51\xf1\x4b\x28"
   "\x9c\x72\x53\xba\x63\x6b\xe4\xbf\xd7\x96\x93\x08\xf4\x8d\xa4\x7d";
 
+void
+hsk_dnssec_load(void);
+
 const hsk_dns_rr_t *
 hsk_dnssec_get_ksk(void);
 
@@ -31,4 +34,7 @@ hsk_dnssec_sign_ksk(hsk_dns_rrs_t *rrs, uint16_t type);
 bool
 hsk_dnssec_sign_zsk(hsk_dns_rrs_t *rrs, uint16_t type);
 
+void
+hsk_dnssec_signer_zsk(hsk_dns_signer_t *signer);
+
 #endif
@@ -0,0 +1,1405 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "doq.h"
+#include "error.h"
+#include "mem.h"
+#include "uv.h"
+
+#ifdef HSK_QUIC
+
+#include <gnutls/gnutls.h>
+#include <ngtcp2/ngtcp2.h>
+#include <ngtcp2/ngtcp2_crypto.h>
+#include <ngtcp2/ngtcp2_crypto_gnutls.h>
+
+#include "addr.h"
+#include "bio.h"
+#include "constants.h"
+#include "log.h"
+#include "map.h"
+#include "random.h"
+#include "sha256.h"
+#include "udp.h"
+
+// Ours are the longest QUIC allows, so that
+// every one keys the map as it is. Others
+// (the client's first) are zero padded.
+#define HSK_DOQ_CIDLEN 20
+
+// Ours in use per connection: the pool
+// ngtcp2 keeps (8), the client's first and
+// some slack.
+#define HSK_DOQ_CIDS 16
+
+#define HSK_DOQ_PACKET 1452
+#define HSK_DOQ_HANDSHAKE 10000
+
+// Tickets seen in 0-RTT within the replay
+// window. Once every one is live, early data
+// is refused rather than one forgotten.
+#define HSK_DOQ_REPLAY 4096
+
+// As in the ngtcp2 examples: TLS 1.3 alone,
+// with the ciphers QUIC defines.
+static const char *hsk_doq_priority =
+  "%DISABLE_TLS13_COMPAT_MODE:NORMAL:-VERS-ALL:+VERS-TLS1.3:"
+  "-CIPHER-ALL:+AES-128-GCM:+AES-256-GCM:+CHACHA20-POLY1305:+AES-128-CCM:"
+  "-GROUP-ALL:+GROUP-X25519:+GROUP-SECP256R1:+GROUP-SECP384R1:"
+  "+GROUP-SECP521R1";
+
+/*
+ * Types
+ */
+
+typedef struct hsk_doq_replay_s {
+  uint8_t hash[32];
+  time_t expires;
+} hsk_doq_replay_t;
+
+typedef struct hsk_doq_conn_s {
+  hsk_doq_t *doq;
+  ngtcp2_conn *conn;
+  ngtcp2_crypto_conn_ref ref;
+  gnutls_session_t session;
+  bool has_session;
+  uv_timer_t timer;
+  struct sockaddr_storage addr;
+  uint8_t cids[HSK_DOQ_CIDS][HSK_DOQ_CIDLEN];
+  bool cid_used[HSK_DOQ_CIDS];
+  struct hsk_doq_stream_s *streams;
+  // Answers not yet handed to ngtcp2.
+  struct hsk_doq_stream_s *send_head;
+  struct hsk_doq_stream_s *send_tail;
+  bool reading;
+  bool draining;
+  bool closing;
+  struct hsk_doq_conn_s *prev;
+  struct hsk_doq_conn_s *next;
+} hsk_doq_conn_t;
+
+struct hsk_doq_stream_s {
+  // Unset once the stream or its connection
+  // is gone.
+  hsk_doq_conn_t *conn;
+  int64_t id;
+  int refs;
+  uint8_t prefix[2];
+  size_t prefix_len;
+  uint8_t *query;
+  size_t query_size;
+  size_t query_len;
+  bool received;
+  // Kept until the stream closes, for
+  // retransmits.
+  uint8_t *reply;
+  size_t reply_len;
+  size_t reply_sent;
+  bool queued;
+  bool blocked;
+  struct hsk_doq_stream_s *prev;
+  struct hsk_doq_stream_s *next;
+  struct hsk_doq_stream_s *send_next;
+};
+
+struct hsk_doq_s {
+  uv_loop_t *loop;
+  hsk_udp_t udp;
+  bool bound;
+  struct sockaddr_storage local;
+  hsk_doq_query_cb callback;
+  void *arg;
+  gnutls_certificate_credentials_t cred;
+  bool has_cred;
+  gnutls_datum_t ticket_key;
+  bool has_ticket_key;
+  gnutls_anti_replay_t anti_replay;
+  bool has_anti_replay;
+  hsk_doq_replay_t replay[HSK_DOQ_REPLAY];
+  size_t replay_pos;
+  // Connections by every CID of ours.
+  hsk_map_t cids;
+  hsk_doq_conn_t *conns;
+  int conn_count;
+  uint8_t packet[HSK_DOQ_PACKET];
+};
+
+/*
+ * Prototypes
+ */
+
+static void
+hsk_doq_log(hsk_doq_t *doq, const char *fmt, ...);
+
+static int
+hsk_doq_conn_write(hsk_doq_conn_t *conn);
+
+static void
+hsk_doq_conn_close(hsk_doq_conn_t *conn);
+
+static void
+after_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+);
+
+static void
+after_conn_timer(uv_timer_t *timer);
+
+static void
+after_conn_close(uv_handle_t *handle);
+
+/*
+ * Helpers
+ */
+
+static ngtcp2_tstamp
+hsk_doq_now(void) {
+  return uv_hrtime();
+}
+
+static socklen_t
+hsk_doq_addr_len(const struct sockaddr *addr) {
+  if (addr->sa_family == AF_INET6)
+    return sizeof(struct sockaddr_in6);
+  return sizeof(struct sockaddr_in);
+}
+
+static void
+hsk_doq_path(
+  const hsk_doq_t *doq,
+  const struct sockaddr *addr,
+  ngtcp2_path *path
+) {
+  const struct sockaddr *local = (const struct sockaddr *)&doq->local;
+
+  path->local.addr = (ngtcp2_sockaddr *)local;
+  path->local.addrlen = hsk_doq_addr_len(local);
+  path->remote.addr = (ngtcp2_sockaddr *)addr;
+  path->remote.addrlen = hsk_doq_addr_len(addr);
+  path->user_data = NULL;
+}
+
+static void
+hsk_doq_output(
+  hsk_doq_t *doq,
+  const struct sockaddr *addr,
+  const uint8_t *data,
+  size_t data_len
+) {
+  uint8_t *buf = hsk_malloc(data_len);
+
+  if (!buf)
+    return;
+
+  memcpy(buf, data, data_len);
+
+  hsk_udp_send(&doq->udp, buf, data_len, addr, true);
+}
+
+static hsk_doq_conn_t *
+hsk_doq_find(hsk_doq_t *doq, const uint8_t *cid, size_t cid_len) {
+  uint8_t key[HSK_DOQ_CIDLEN];
+
+  if (cid_len > HSK_DOQ_CIDLEN)
+    return NULL;
+
+  memset(key, 0, sizeof(key));
+  memcpy(key, cid, cid_len);
+
+  return hsk_map_get(&doq->cids, key);
+}
+
+// Gnutls asks for each ticket used in 0-RTT
+// within the replay window.
+static int
+hsk_doq_replay_add(
+  void *ptr,
+  time_t expires,
+  const gnutls_datum_t *key,
+  const gnutls_datum_t *data
+) {
+  hsk_doq_t *doq = (hsk_doq_t *)ptr;
+  time_t now = time(NULL);
+  uint8_t hash[32];
+  hsk_sha256_ctx ctx;
+  size_t i;
+
+  (void)data;
+
+  hsk_sha256_init(&ctx);
+  hsk_sha256_update(&ctx, key->data, key->size);
+  hsk_sha256_final(&ctx, hash);
+
+  for (i = 0; i < HSK_DOQ_REPLAY; i++) {
+    const hsk_doq_replay_t *r = &doq->replay[i];
+
+    if (r->expires > now && memcmp(r->hash, hash, 32) == 0)
+      return GNUTLS_E_DB_ENTRY_EXISTS;
+  }
+
+  hsk_doq_replay_t *r = &doq->replay[doq->replay_pos];
+
+  if (r->expires > now)
+    return GNUTLS_E_DB_ERROR;
+
+  memcpy(r->hash, hash, 32);
+  r->expires = expires;
+
+  doq->replay_pos = (doq->replay_pos + 1) % HSK_DOQ_REPLAY;
+
+  return 0;
+}
+
+/*
+ * Streams
+ */
+
+static hsk_doq_stream_t *
+hsk_doq_stream_alloc(hsk_doq_conn_t *conn, int64_t id) {
+  hsk_doq_stream_t *stream = hsk_malloc(sizeof(hsk_doq_stream_t));
+
+  if (!stream)
+    return NULL;
+
+  memset(stream, 0, sizeof(hsk_doq_stream_t));
+
+  stream->conn = conn;
+  stream->id = id;
+  stream->refs = 1;
+  stream->next = conn->streams;
+
+  if (conn->streams)
+    conn->streams->prev = stream;
+
+  conn->streams = stream;
+
+  return stream;
+}
+
+static void
+hsk_doq_stream_queue(hsk_doq_stream_t *stream) {
+  hsk_doq_conn_t *conn = stream->conn;
+
+  assert(!stream->queued);
+
+  stream->queued = true;
+  stream->send_next = NULL;
+
+  if (conn->send_tail)
+    conn->send_tail->send_next = stream;
+  else
+    conn->send_head = stream;
+
+  conn->send_tail = stream;
+}
+
+static void
+hsk_doq_stream_dequeue(hsk_doq_stream_t *stream) {
+  hsk_doq_conn_t *conn = stream->conn;
+  hsk_doq_stream_t *prev = NULL;
+  hsk_doq_stream_t *s;
+
+  if (!stream->queued)
+    return;
+
+  for (s = conn->send_head; s && s != stream; s = s->send_next)
+    prev = s;
+
+  assert(s);
+
+  if (prev)
+    prev->send_next = stream->send_next;
+  else
+    conn->send_head = stream->send_next;
+
+  if (conn->send_tail == stream)
+    conn->send_tail = prev;
+
+  stream->send_next = NULL;
+  stream->queued = false;
+}
+
+// Drops the connection's reference. A query
+// still being resolved keeps the rest.
+static void
+hsk_doq_stream_detach(hsk_doq_stream_t *stream) {
+  hsk_doq_conn_t *conn = stream->conn;
+
+  assert(conn);
+
+  hsk_doq_stream_dequeue(stream);
+
+  if (stream->prev)
+    stream->prev->next = stream->next;
+  else
+    conn->streams = stream->next;
+
+  if (stream->next)
+    stream->next->prev = stream->prev;
+
+  stream->prev = NULL;
+  stream->next = NULL;
+  stream->conn = NULL;
+
+  hsk_free(stream->query);
+  stream->query = NULL;
+
+  hsk_free(stream->reply);
+  stream->reply = NULL;
+
+  hsk_doq_stream_unref(stream);
+}
+
+// Returns a stream error code. One message per
+// stream, length prefixed as over TCP, with a
+// message ID of zero.
+static uint64_t
+hsk_doq_stream_read(
+  hsk_doq_stream_t *stream,
+  const uint8_t *data,
+  size_t data_len,
+  bool fin
+) {
+  hsk_doq_conn_t *conn = stream->conn;
+  hsk_doq_t *doq = conn->doq;
+
+  if (stream->received)
+    return data_len > 0 ? HSK_DOQ_PROTOCOL_ERROR : HSK_DOQ_NO_ERROR;
+
+  while (data_len > 0 && stream->prefix_len < 2) {
+    stream->prefix[stream->prefix_len++] = *data;
+    data += 1;
+    data_len -= 1;
+  }
+
+  if (stream->prefix_len < 2)
+    return fin ? HSK_DOQ_PROTOCOL_ERROR : HSK_DOQ_NO_ERROR;
+
+  if (!stream->query) {
+    size_t size = get_u16be(stream->prefix);
+
+    if (size < 2 || size > HSK_DOQ_QUERY)
+      return HSK_DOQ_PROTOCOL_ERROR;
+
+    stream->query = hsk_malloc(size);
+
+    if (!stream->query)
+      return HSK_DOQ_INTERNAL_ERROR;
+
+    stream->query_size = size;
+    stream->query_len = 0;
+  }
+
+  if (data_len > stream->query_size - stream->query_len)
+    return HSK_DOQ_PROTOCOL_ERROR;
+
+  memcpy(&stream->query[stream->query_len], data, data_len);
+  stream->query_len += data_len;
+
+  if (stream->query_len < stream->query_size)
+    return fin ? HSK_DOQ_PROTOCOL_ERROR : HSK_DOQ_NO_ERROR;
+
+  if (get_u16be(stream->query) != 0)
+    return HSK_DOQ_PROTOCOL_ERROR;
+
+  stream->received = true;
+
+  // May be answered right away (from the
+  // cache), in which case it is written once
+  // the packet has been read.
+  doq->callback(doq->arg, stream, stream->query, stream->query_size,
+                (struct sockaddr *)&conn->addr);
+
+  hsk_free(stream->query);
+  stream->query = NULL;
+
+  return HSK_DOQ_NO_ERROR;
+}
+
+/*
+ * QUIC Callbacks
+ */
+
+static ngtcp2_conn *
+get_conn(ngtcp2_crypto_conn_ref *ref) {
+  hsk_doq_conn_t *conn = (hsk_doq_conn_t *)ref->user_data;
+  return conn->conn;
+}
+
+static void
+rand_cb(uint8_t *dest, size_t dest_len, const ngtcp2_rand_ctx *rand_ctx) {
+  (void)rand_ctx;
+  assert(hsk_randombytes(dest, dest_len));
+}
+
+static bool
+hsk_doq_conn_add_cid(hsk_doq_conn_t *conn, const uint8_t *cid, size_t len) {
+  hsk_doq_t *doq = conn->doq;
+  int i;
+
+  if (len > HSK_DOQ_CIDLEN)
+    return false;
+
+  for (i = 0; i < HSK_DOQ_CIDS; i++) {
+    if (!conn->cid_used[i])
+      break;
+  }
+
+  if (i == HSK_DOQ_CIDS)
+    return false;
+
+  uint8_t *key = conn->cids[i];
+
+  memset(key, 0, HSK_DOQ_CIDLEN);
+  memcpy(key, cid, len);
+
+  if (hsk_map_has(&doq->cids, key))
+    return false;
+
+  if (!hsk_map_set(&doq->cids, key, (void *)conn))
+    return false;
+
+  conn->cid_used[i] = true;
+
+  return true;
+}
+
+static void
+hsk_doq_conn_remove_cid(hsk_doq_conn_t *conn, const uint8_t *cid, size_t len) {
+  uint8_t key[HSK_DOQ_CIDLEN];
+  int i;
+
+  if (len > HSK_DOQ_CIDLEN)
+    return;
+
+  memset(key, 0, sizeof(key));
+  memcpy(key, cid, len);
+
+  for (i = 0; i < HSK_DOQ_CIDS; i++) {
+    if (!conn->cid_used[i])
+      continue;
+
+    if (memcmp(conn->cids[i], key, HSK_DOQ_CIDLEN) == 0) {
+      hsk_map_del(&conn->doq->cids, conn->cids[i]);
+      conn->cid_used[i] = false;
+      return;
+    }
+  }
+}
+
+static int
+get_new_connection_id(
+  ngtcp2_conn *qc,
+  ngtcp2_cid *cid,
+  uint8_t *token,
+  size_t cid_len,
+  void *user_data
+) {
+  hsk_doq_conn_t *conn = (hsk_doq_conn_t *)user_data;
+  uint8_t data[HSK_DOQ_CIDLEN];
+
+  (void)qc;
+
+  if (cid_len != HSK_DOQ_CIDLEN)
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+
+  if (!hsk_randombytes(data, cid_len))
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+
+  if (!hsk_doq_conn_add_cid(conn, data, cid_len))
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+
+  if (!hsk_randombytes(token, NGTCP2_STATELESS_RESET_TOKENLEN))
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+
+  ngtcp2_cid_init(cid, data, cid_len);
+
+  return 0;
+}
+
+static int
+remove_connection_id(ngtcp2_conn *qc, const ngtcp2_cid *cid, void *user_data) {
+  hsk_doq_conn_t *conn = (hsk_doq_conn_t *)user_data;
+
+  (void)qc;
+
+  hsk_doq_conn_remove_cid(conn, cid->data, cid->datalen);
+
+  return 0;
+}
+
+static int
+recv_stream_data(
+  ngtcp2_conn *qc,
+  uint32_t flags,
+  int64_t stream_id,
+  uint64_t offset,
+  const uint8_t *data,
+  size_t data_len,
+  void *user_data,
+  void *stream_user_data
+) {
+  hsk_doq_conn_t *conn = (hsk_doq_conn_t *)user_data;
+  hsk_doq_stream_t *stream = (hsk_doq_stream_t *)stream_user_data;
+  bool fin = (flags & NGTCP2_STREAM_DATA_FLAG_FIN) != 0;
+
+  (void)offset;
+
+  ngtcp2_conn_extend_max_stream_offset(qc, stream_id, data_len);
+  ngtcp2_conn_extend_max_offset(qc, data_len);
+
+  if (!stream) {
+    stream = hsk_doq_stream_alloc(conn, stream_id);
+
+    if (!stream)
+      return NGTCP2_ERR_CALLBACK_FAILURE;
+
+    ngtcp2_conn_set_stream_user_data(qc, stream_id, stream);
+  }
+
+  uint64_t code = hsk_doq_stream_read(stream, data, data_len, fin);
+
+  if (code != HSK_DOQ_NO_ERROR)
+    ngtcp2_conn_shutdown_stream(qc, 0, stream_id, code);
+
+  return 0;
+}
+
+static int
+extend_max_stream_data(
+  ngtcp2_conn *qc,
+  int64_t stream_id,
+  uint64_t max_data,
+  void *user_data,
+  void *stream_user_data
+) {
+  hsk_doq_stream_t *stream = (hsk_doq_stream_t *)stream_user_data;
+
+  (void)qc;
+  (void)stream_id;
+  (void)max_data;
+  (void)user_data;
+
+  if (stream && stream->blocked) {
+    stream->blocked = false;
+    hsk_doq_stream_queue(stream);
+  }
+
+  return 0;
+}
+
+static int
+stream_close(
+  ngtcp2_conn *qc,
+  uint32_t flags,
+  int64_t stream_id,
+  uint64_t app_error_code,
+  void *user_data,
+  void *stream_user_data
+) {
+  hsk_doq_stream_t *stream = (hsk_doq_stream_t *)stream_user_data;
+
+  (void)flags;
+  (void)app_error_code;
+  (void)user_data;
+
+  if (ngtcp2_is_bidi_stream(stream_id))
+    ngtcp2_conn_extend_max_streams_bidi(qc, 1);
+
+  if (stream)
+    hsk_doq_stream_detach(stream);
+
+  return 0;
+}
+
+/*
+ * Connections
+ */
+
+static bool
+hsk_doq_conn_tls(hsk_doq_conn_t *conn) {
+  hsk_doq_t *doq = conn->doq;
+  unsigned int flags = GNUTLS_SERVER
+                     | GNUTLS_ENABLE_EARLY_DATA
+                     | GNUTLS_NO_END_OF_EARLY_DATA;
+
+  if (gnutls_init(&conn->session, flags) != 0)
+    return false;
+
+  conn->has_session = true;
+
+  if (gnutls_priority_set_direct(conn->session, hsk_doq_priority, NULL) != 0)
+    return false;
+
+  if (ngtcp2_crypto_gnutls_configure_server_session(conn->session) != 0)
+    return false;
+
+  // Resumption, and with it 0-RTT.
+  if (gnutls_session_ticket_enable_server(conn->session,
+                                          &doq->ticket_key) != 0) {
+    return false;
+  }
+
+  gnutls_anti_replay_enable(conn->session, doq->anti_replay);
+  gnutls_record_set_max_early_data_size(conn->session, 0xffffffffu);
+
+  conn->ref.get_conn = get_conn;
+  conn->ref.user_data = (void *)conn;
+
+  gnutls_session_set_ptr(conn->session, &conn->ref);
+
+  if (gnutls_credentials_set(conn->session, GNUTLS_CRD_CERTIFICATE,
+                             doq->cred) != 0) {
+    return false;
+  }
+
+  gnutls_datum_t alpn = {
+    (unsigned char *)HSK_DOQ_ALPN,
+    sizeof(HSK_DOQ_ALPN) - 1
+  };
+
+  if (gnutls_alpn_set_protocols(conn->session, &alpn, 1,
+                                GNUTLS_ALPN_MANDATORY) != 0) {
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+hsk_doq_conn_quic(
+  hsk_doq_conn_t *conn,
+  const ngtcp2_pkt_hd *hd,
+  const struct sockaddr *addr
+) {
+  hsk_doq_t *doq = conn->doq;
+  uint8_t data[HSK_DOQ_CIDLEN];
+  ngtcp2_cid scid;
+
+  if (!hsk_randombytes(data, sizeof(data)))
+    return false;
+
+  ngtcp2_cid_init(&scid, data, sizeof(data));
+
+  // The client's first packets are sent to
+  // the CID it made up.
+  if (!hsk_doq_conn_add_cid(conn, hd->dcid.data, hd->dcid.datalen))
+    return false;
+
+  if (!hsk_doq_conn_add_cid(conn, scid.data, scid.datalen))
+    return false;
+
+  ngtcp2_callbacks callbacks;
+  memset(&callbacks, 0, sizeof(callbacks));
+
+  callbacks.recv_client_initial = ngtcp2_crypto_recv_client_initial_cb;
+  callbacks.recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb;
+  callbacks.encrypt = ngtcp2_crypto_encrypt_cb;
+  callbacks.decrypt = ngtcp2_crypto_decrypt_cb;
+  callbacks.hp_mask = ngtcp2_crypto_hp_mask_cb;
+  callbacks.update_key = ngtcp2_crypto_update_key_cb;
+  callbacks.delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb;
+  callbacks.delete_crypto_cipher_ctx =
+    ngtcp2_crypto_delete_crypto_cipher_ctx_cb;
+  callbacks.get_path_challenge_data =
+    ngtcp2_crypto_get_path_challenge_data_cb;
+  callbacks.version_negotiation = ngtcp2_crypto_version_negotiation_cb;
+  callbacks.rand = rand_cb;
+  callbacks.get_new_connection_id = get_new_connection_id;
+  callbacks.remove_connection_id = remove_connection_id;
+  callbacks.recv_stream_data = recv_stream_data;
+  callbacks.extend_max_stream_data = extend_max_stream_data;
+  callbacks.stream_close = stream_close;
+
+  ngtcp2_settings settings;
+  ngtcp2_settings_default(&settings);
+
+  settings.initial_ts = hsk_doq_now();
+  settings.handshake_timeout = HSK_DOQ_HANDSHAKE * NGTCP2_MILLISECONDS;
+  settings.no_pmtud = 1;
+
+  // Queries in, one at most per stream.
+  ngtcp2_transport_params params;
+  ngtcp2_transport_params_default(&params);
+
+  params.initial_max_streams_bidi = HSK_DOQ_STREAMS;
+  params.initial_max_streams_uni = 0;
+  params.initial_max_stream_data_bidi_remote = 2 + HSK_DOQ_QUERY;
+  params.initial_max_data = (2 + HSK_DOQ_QUERY) * HSK_DOQ_STREAMS;
+  params.max_idle_timeout = HSK_DOQ_TIMEOUT * NGTCP2_MILLISECONDS;
+  params.original_dcid = hd->dcid;
+  params.original_dcid_present = 1;
+
+  ngtcp2_path path;
+  hsk_doq_path(doq, addr, &path);
+
+  int rv = ngtcp2_conn_server_new(&conn->conn, &hd->scid, &scid, &path,
+                                  hd->version, &callbacks, &settings,
+                                  &params, NULL, (void *)conn);
+
+  if (rv != 0) {
+    conn->conn = NULL;
+    return false;
+  }
+
+  ngtcp2_conn_set_tls_native_handle(conn->conn, conn->session);
+
+  return true;
+}
+
+static hsk_doq_conn_t *
+hsk_doq_conn_alloc(
+  hsk_doq_t *doq,
+  const ngtcp2_pkt_hd *hd,
+  const struct sockaddr *addr
+) {
+  if (doq->conn_count >= HSK_DOQ_MAX) {
+    hsk_doq_log(doq, "too many quic connections\n");
+    return NULL;
+  }
+
+  hsk_doq_conn_t *conn = hsk_malloc(sizeof(hsk_doq_conn_t));
+
+  if (!conn)
+    return NULL;
+
+  memset(conn, 0, sizeof(hsk_doq_conn_t));
+
+  conn->doq = doq;
+  memcpy(&conn->addr, addr, hsk_doq_addr_len(addr));
+
+  if (uv_timer_init(doq->loop, &conn->timer) != 0) {
+    hsk_free(conn);
+    return NULL;
+  }
+
+  conn->timer.data = (void *)conn;
+  conn->next = doq->conns;
+
+  if (doq->conns)
+    doq->conns->prev = conn;
+
+  doq->conns = conn;
+  doq->conn_count += 1;
+
+  if (!hsk_doq_conn_tls(conn) || !hsk_doq_conn_quic(conn, hd, addr)) {
+    hsk_doq_log(doq, "could not set up quic connection\n");
+    hsk_doq_conn_close(conn);
+    return NULL;
+  }
+
+  return conn;
+}
+
+// Freed once its timer has closed. Streams
+// still waiting on answers outlive it.
+static void
+hsk_doq_conn_close(hsk_doq_conn_t *conn) {
+  hsk_doq_t *doq = conn->doq;
+  int i;
+
+  if (conn->closing)
+    return;
+
+  conn->closing = true;
+
+  while (conn->streams)
+    hsk_doq_stream_detach(conn->streams);
+
+  for (i = 0; i < HSK_DOQ_CIDS; i++) {
+    if (conn->cid_used[i]) {
+      hsk_map_del(&doq->cids, conn->cids[i]);
+      conn->cid_used[i] = false;
+    }
+  }
+
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    doq->conns = conn->next;
+
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  conn->prev = NULL;
+  conn->next = NULL;
+  doq->conn_count -= 1;
+
+  if (conn->conn) {
+    ngtcp2_conn_del(conn->conn);
+    conn->conn = NULL;
+  }
+
+  if (conn->has_session) {
+    gnutls_deinit(conn->session);
+    conn->has_session = false;
+  }
+
+  uv_close((uv_handle_t *)&conn->timer, after_conn_close);
+}
+
+// Waits out three PTOs for stray packets,
+// then closes.
+static void
+hsk_doq_conn_drain(hsk_doq_conn_t *conn) {
+  uint64_t timeout = ngtcp2_conn_get_pto(conn->conn) * 3 / NGTCP2_MILLISECONDS;
+
+  conn->draining = true;
+
+  uv_timer_start(&conn->timer, after_conn_timer, timeout, 0);
+}
+
+static void
+hsk_doq_conn_fail(hsk_doq_conn_t *conn, int rv) {
+  hsk_doq_t *doq = conn->doq;
+
+  switch (rv) {
+    case NGTCP2_ERR_DRAINING: {
+      hsk_doq_conn_drain(conn);
+      return;
+    }
+    case NGTCP2_ERR_DROP_CONN:
+    case NGTCP2_ERR_IDLE_CLOSE: {
+      hsk_doq_conn_close(conn);
+      return;
+    }
+  }
+
+  ngtcp2_ccerr ccerr;
+  ngtcp2_ccerr_default(&ccerr);
+
+  if (rv == NGTCP2_ERR_CRYPTO) {
+    uint8_t alert = ngtcp2_conn_get_tls_alert(conn->conn);
+    ngtcp2_ccerr_set_tls_alert(&ccerr, alert, NULL, 0);
+  } else {
+    ngtcp2_ccerr_set_liberr(&ccerr, rv, NULL, 0);
+  }
+
+  ngtcp2_path_storage ps;
+  ngtcp2_pkt_info pi;
+
+  ngtcp2_path_storage_zero(&ps);
+
+  ngtcp2_ssize n = ngtcp2_conn_write_connection_close(
+    conn->conn, &ps.path, &pi, doq->packet, sizeof(doq->packet),
+    &ccerr, hsk_doq_now());
+
+  if (n > 0) {
+    hsk_doq_output(doq, (struct sockaddr *)ps.path.remote.addr,
+                   doq->packet, (size_t)n);
+  }
+
+  hsk_doq_conn_drain(conn);
+}
+
+static void
+hsk_doq_conn_schedule(hsk_doq_conn_t *conn) {
+  ngtcp2_tstamp expiry = ngtcp2_conn_get_expiry(conn->conn);
+  ngtcp2_tstamp now = hsk_doq_now();
+  uint64_t timeout = 0;
+
+  if (expiry > now)
+    timeout = (expiry - now + NGTCP2_MILLISECONDS - 1) / NGTCP2_MILLISECONDS;
+
+  uv_timer_start(&conn->timer, after_conn_timer, timeout, 0);
+}
+
+// Queued answers go out first, each with its
+// FIN, then whatever else ngtcp2 has to send
+// (acks, handshake, retransmits).
+static int
+hsk_doq_conn_write(hsk_doq_conn_t *conn) {
+  hsk_doq_t *doq = conn->doq;
+  ngtcp2_tstamp now = hsk_doq_now();
+  ngtcp2_path_storage ps;
+  ngtcp2_pkt_info pi;
+
+  if (conn->closing || conn->draining)
+    return HSK_SUCCESS;
+
+  ngtcp2_path_storage_zero(&ps);
+
+  for (;;) {
+    hsk_doq_stream_t *stream = conn->send_head;
+    uint32_t flags = NGTCP2_WRITE_STREAM_FLAG_MORE;
+    int64_t stream_id = -1;
+    ngtcp2_ssize written = -1;
+    ngtcp2_vec vec;
+    size_t vec_count = 0;
+
+    if (stream) {
+      stream_id = stream->id;
+      vec.base = &stream->reply[stream->reply_sent];
+      vec.len = stream->reply_len - stream->reply_sent;
+      vec_count = 1;
+      flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
+    }
+
+    ngtcp2_ssize n = ngtcp2_conn_writev_stream(
+      conn->conn, &ps.path, &pi, doq->packet, sizeof(doq->packet),
+      &written, flags, stream_id, vec_count ? &vec : NULL, vec_count, now);
+
+    if (stream && written >= 0) {
+      stream->reply_sent += (size_t)written;
+
+      if (stream->reply_sent == stream->reply_len)
+        hsk_doq_stream_dequeue(stream);
+    }
+
+    if (n < 0) {
+      switch (n) {
+        case NGTCP2_ERR_WRITE_MORE: {
+          continue;
+        }
+        case NGTCP2_ERR_STREAM_DATA_BLOCKED: {
+          // Until extend_max_stream_data.
+          hsk_doq_stream_dequeue(stream);
+          stream->blocked = true;
+          continue;
+        }
+        case NGTCP2_ERR_STREAM_SHUT_WR:
+        case NGTCP2_ERR_STREAM_NOT_FOUND: {
+          hsk_doq_stream_dequeue(stream);
+          continue;
+        }
+      }
+
+      hsk_doq_conn_fail(conn, (int)n);
+
+      return HSK_EFAILURE;
+    }
+
+    if (n == 0)
+      break;
+
+    hsk_doq_output(doq, (struct sockaddr *)ps.path.remote.addr,
+                   doq->packet, (size_t)n);
+  }
+
+  ngtcp2_conn_update_pkt_tx_time(conn->conn, now);
+
+  hsk_doq_conn_schedule(conn);
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_doq_conn_read(
+  hsk_doq_conn_t *conn,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  ngtcp2_path path;
+  ngtcp2_pkt_info pi;
+
+  memset(&pi, 0, sizeof(pi));
+
+  // Queries are answered to where the latest
+  // packet came from.
+  memcpy(&conn->addr, addr, hsk_doq_addr_len(addr));
+
+  hsk_doq_path(conn->doq, addr, &path);
+
+  conn->reading = true;
+
+  int rv = ngtcp2_conn_read_pkt(conn->conn, &path, &pi, data, data_len,
+                                hsk_doq_now());
+
+  conn->reading = false;
+
+  if (rv != 0) {
+    hsk_doq_conn_fail(conn, rv);
+    return;
+  }
+
+  hsk_doq_conn_write(conn);
+}
+
+// We speak QUIC v1 only.
+static void
+hsk_doq_negotiate(
+  hsk_doq_t *doq,
+  const ngtcp2_version_cid *vc,
+  const struct sockaddr *addr
+) {
+  uint32_t versions[1] = { NGTCP2_PROTO_VER_V1 };
+  uint8_t unused;
+
+  if (!hsk_randombytes(&unused, 1))
+    return;
+
+  ngtcp2_ssize n = ngtcp2_pkt_write_version_negotiation(
+    doq->packet, sizeof(doq->packet), unused,
+    vc->scid, vc->scidlen, vc->dcid, vc->dcidlen, versions, 1);
+
+  if (n > 0)
+    hsk_doq_output(doq, addr, doq->packet, (size_t)n);
+}
+
+static void
+hsk_doq_log(hsk_doq_t *doq, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("doq: ", fmt, args);
+  va_end(args);
+}
+
+/*
+ * DoQ
+ */
+
+bool
+hsk_doq_supported(void) {
+  return true;
+}
+
+hsk_doq_t *
+hsk_doq_alloc(const uv_loop_t *loop, hsk_doq_query_cb callback, void *arg) {
+  if (!loop || !callback)
+    return NULL;
+
+  hsk_doq_t *doq = hsk_malloc(sizeof(hsk_doq_t));
+
+  if (!doq)
+    return NULL;
+
+  memset(doq, 0, sizeof(hsk_doq_t));
+
+  doq->loop = (uv_loop_t *)loop;
+  doq->callback = callback;
+  doq->arg = arg;
+
+  hsk_udp_init(&doq->udp, doq->loop, after_recv, (void *)doq);
+  hsk_map_init_hash160_map(&doq->cids, NULL);
+
+  return doq;
+}
+
+void
+hsk_doq_free(hsk_doq_t *doq) {
+  if (!doq)
+    return;
+
+  assert(!doq->conns);
+
+  hsk_map_uninit(&doq->cids);
+  hsk_udp_uninit(&doq->udp);
+  hsk_free(doq);
+}
+
+int
+hsk_doq_open(
+  hsk_doq_t *doq,
+  const struct sockaddr *addr,
+  const char *cert,
+  const char *key,
+  int fd
+) {
+  if (!doq || !addr || !cert || !key || doq->bound)
+    return HSK_EBADARGS;
+
+  if (gnutls_certificate_allocate_credentials(&doq->cred) != 0)
+    return HSK_ENOMEM;
+
+  doq->has_cred = true;
+
+  if (gnutls_certificate_set_x509_key_file(doq->cred, cert, key,
+                                           GNUTLS_X509_FMT_PEM) != 0) {
+    hsk_doq_log(doq, "could not load certificate: %s\n", cert);
+    return HSK_EFAILURE;
+  }
+
+  if (gnutls_session_ticket_key_generate(&doq->ticket_key) != 0)
+    return HSK_EFAILURE;
+
+  doq->has_ticket_key = true;
+
+  if (gnutls_anti_replay_init(&doq->anti_replay) != 0)
+    return HSK_ENOMEM;
+
+  doq->has_anti_replay = true;
+
+  gnutls_anti_replay_set_add_function(doq->anti_replay, hsk_doq_replay_add);
+  gnutls_anti_replay_set_ptr(doq->anti_replay, (void *)doq);
+
+  int rc;
+
+  if (fd != -1)
+    rc = hsk_udp_open_fd(&doq->udp, fd);
+  else
+    rc = hsk_udp_open(&doq->udp, addr, false);
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  doq->bound = true;
+
+  socklen_t len = sizeof(doq->local);
+
+  if (getsockname(doq->udp.fd, (struct sockaddr *)&doq->local, &len) != 0)
+    return HSK_EFAILURE;
+
+  char host[HSK_MAX_HOST];
+  assert(hsk_sa_to_string(addr, host, HSK_MAX_HOST, HSK_DOQ_PORT));
+
+  hsk_doq_log(doq, "dns over quic listening on: %s\n", host);
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_doq_get_fd(const hsk_doq_t *doq) {
+  assert(doq);
+
+  if (!doq->bound)
+    return -1;
+
+  return doq->udp.fd;
+}
+
+// Each client is told (with DOQ_NO_ERROR)
+// rather than left to time out.
+int
+hsk_doq_close(hsk_doq_t *doq) {
+  if (!doq)
+    return HSK_EBADARGS;
+
+  while (doq->conns) {
+    hsk_doq_conn_t *conn = doq->conns;
+
+    if (!conn->draining) {
+      ngtcp2_ccerr ccerr;
+      ngtcp2_path_storage ps;
+      ngtcp2_pkt_info pi;
+
+      ngtcp2_ccerr_default(&ccerr);
+      ngtcp2_ccerr_set_application_error(&ccerr, HSK_DOQ_NO_ERROR, NULL, 0);
+      ngtcp2_path_storage_zero(&ps);
+
+      ngtcp2_ssize n = ngtcp2_conn_write_connection_close(
+        conn->conn, &ps.path, &pi, doq->packet, sizeof(doq->packet),
+        &ccerr, hsk_doq_now());
+
+      if (n > 0) {
+        hsk_doq_output(doq, (struct sockaddr *)ps.path.remote.addr,
+                       doq->packet, (size_t)n);
+      }
+    }
+
+    hsk_doq_conn_close(conn);
+  }
+
+  if (doq->bound) {
+    hsk_udp_flush(&doq->udp);
+    hsk_udp_close(&doq->udp);
+    doq->bound = false;
+  }
+
+  if (doq->has_anti_replay) {
+    gnutls_anti_replay_deinit(doq->anti_replay);
+    doq->has_anti_replay = false;
+  }
+
+  if (doq->has_ticket_key) {
+    gnutls_memset(doq->ticket_key.data, 0, doq->ticket_key.size);
+    gnutls_free(doq->ticket_key.data);
+    doq->has_ticket_key = false;
+  }
+
+  if (doq->has_cred) {
+    gnutls_certificate_free_credentials(doq->cred);
+    doq->has_cred = false;
+  }
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_doq_stream_ref(hsk_doq_stream_t *stream) {
+  assert(stream && stream->refs > 0);
+  stream->refs += 1;
+}
+
+void
+hsk_doq_stream_unref(hsk_doq_stream_t *stream) {
+  assert(stream && stream->refs > 0);
+
+  stream->refs -= 1;
+
+  if (stream->refs > 0)
+    return;
+
+  assert(!stream->conn);
+
+  hsk_free(stream->query);
+  hsk_free(stream->reply);
+  hsk_free(stream);
+}
+
+// Takes `data`, as hsk_udp_send does.
+int
+hsk_doq_send(hsk_doq_stream_t *stream, uint8_t *data, size_t data_len) {
+  assert(stream && data);
+
+  hsk_doq_conn_t *conn = stream->conn;
+
+  if (!conn || conn->draining || stream->reply || data_len > 0xffff) {
+    hsk_free(data);
+    return HSK_EFAILURE;
+  }
+
+  uint8_t *reply = hsk_malloc(2 + data_len);
+
+  if (!reply) {
+    hsk_free(data);
+    return HSK_ENOMEM;
+  }
+
+  set_u16be(reply, (uint16_t)data_len);
+  memcpy(&reply[2], data, data_len);
+  hsk_free(data);
+
+  stream->reply = reply;
+  stream->reply_len = 2 + data_len;
+  stream->reply_sent = 0;
+
+  hsk_doq_stream_queue(stream);
+
+  if (!conn->reading)
+    hsk_doq_conn_write(conn);
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * UV behavior
+ */
+
+static void
+after_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  hsk_doq_t *doq = (hsk_doq_t *)arg;
+  ngtcp2_version_cid vc;
+
+  int rv = ngtcp2_pkt_decode_version_cid(&vc, data, data_len, HSK_DOQ_CIDLEN);
+
+  if (rv == NGTCP2_ERR_VERSION_NEGOTIATION) {
+    hsk_doq_negotiate(doq, &vc, addr);
+    return;
+  }
+
+  if (rv != 0)
+    return;
+
+  hsk_doq_conn_t *conn = hsk_doq_find(doq, vc.dcid, vc.dcidlen);
+
+  if (!conn) {
+    ngtcp2_pkt_hd hd;
+
+    // Only a client's first packet starts one.
+    if (ngtcp2_accept(&hd, data, data_len) != 0)
+      return;
+
+    conn = hsk_doq_conn_alloc(doq, &hd, addr);
+
+    if (!conn)
+      return;
+  }
+
+  if (conn->draining)
+    return;
+
+  hsk_doq_conn_read(conn, data, data_len, addr);
+}
+
+static void
+after_conn_timer(uv_timer_t *timer) {
+  hsk_doq_conn_t *conn = (hsk_doq_conn_t *)timer->data;
+
+  if (conn->draining) {
+    hsk_doq_conn_close(conn);
+    return;
+  }
+
+  int rv = ngtcp2_conn_handle_expiry(conn->conn, hsk_doq_now());
+
+  if (rv != 0) {
+    hsk_doq_conn_fail(conn, rv);
+    return;
+  }
+
+  hsk_doq_conn_write(conn);
+}
+
+static void
+after_conn_close(uv_handle_t *handle) {
+  hsk_free(handle->data);
+}
+
+#else /* HSK_QUIC */
+
+bool
+hsk_doq_supported(void) {
+  return false;
+}
+
+hsk_doq_t *
+hsk_doq_alloc(const uv_loop_t *loop, hsk_doq_query_cb callback, void *arg) {
+  return NULL;
+}
+
+void
+hsk_doq_free(hsk_doq_t *doq) {}
+
+int
+hsk_doq_open(
+  hsk_doq_t *doq,
+  const struct sockaddr *addr,
+  const char *cert,
+  const char *key,
+  int fd
+) {
+  return HSK_EFAILURE;
+}
+
+int
+hsk_doq_get_fd(const hsk_doq_t *doq) {
+  return -1;
+}
+
+int
+hsk_doq_close(hsk_doq_t *doq) {
+  return HSK_SUCCESS;
+}
+
+void
+hsk_doq_stream_ref(hsk_doq_stream_t *stream) {}
+
+void
+hsk_doq_stream_unref(hsk_doq_stream_t *stream) {}
+
+int
+hsk_doq_send(hsk_doq_stream_t *stream, uint8_t *data, size_t data_len) {
+  hsk_free(data);
+  return HSK_EFAILURE;
+}
+
+#endif /* HSK_QUIC */
@@ -0,0 +1,96 @@
+#ifndef _HSK_DOQ_H
+#define _HSK_DOQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "uv.h"
+
+// DNS over QUIC (RFC 9250) for the recursive
+// server. Each query is a bidirectional
+// stream: a length-prefixed message in, one
+// back, then FIN. Streams never wait on each
+// other, and a client resuming a session may
+// send queries in its first flight (0-RTT).
+//
+// Only built with --enable-quic (ngtcp2 and
+// GnuTLS). Otherwise hsk_doq_alloc fails.
+#define HSK_DOQ_PORT 853
+#define HSK_DOQ_ALPN "doq"
+
+// Open connections, and streams each.
+#define HSK_DOQ_MAX 256
+#define HSK_DOQ_STREAMS 64
+
+// Idle connections are kept this long (ms).
+#define HSK_DOQ_TIMEOUT 30000
+
+// Largest query accepted.
+#define HSK_DOQ_QUERY 4096
+
+// Error codes (RFC 9250, section 4.3).
+#define HSK_DOQ_NO_ERROR 0x0
+#define HSK_DOQ_INTERNAL_ERROR 0x1
+#define HSK_DOQ_PROTOCOL_ERROR 0x2
+#define HSK_DOQ_REQUEST_CANCELLED 0x3
+#define HSK_DOQ_EXCESSIVE_LOAD 0x4
+
+/*
+ * Types
+ */
+
+typedef struct hsk_doq_s hsk_doq_t;
+
+// A query waiting on its answer. Held by the
+// request until answered (hsk_doq_send) and
+// let go (hsk_doq_stream_unref), even past
+// its connection.
+typedef struct hsk_doq_stream_s hsk_doq_stream_t;
+
+typedef void (*hsk_doq_query_cb)(
+  void *arg,
+  hsk_doq_stream_t *stream,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+);
+
+/*
+ * DoQ
+ */
+
+bool
+hsk_doq_supported(void);
+
+hsk_doq_t *
+hsk_doq_alloc(const uv_loop_t *loop, hsk_doq_query_cb callback, void *arg);
+
+void
+hsk_doq_free(hsk_doq_t *doq);
+
+int
+hsk_doq_open(
+  hsk_doq_t *doq,
+  const struct sockaddr *addr,
+  const char *cert,
+  const char *key,
+  int fd
+);
+
+int
+hsk_doq_get_fd(const hsk_doq_t *doq);
+
+int
+hsk_doq_close(hsk_doq_t *doq);
+
+void
+hsk_doq_stream_ref(hsk_doq_stream_t *stream);
+
+void
+hsk_doq_stream_unref(hsk_doq_stream_t *stream);
+
+int
+hsk_doq_send(hsk_doq_stream_t *stream, uint8_t *data, size_t data_len);
+#endif
@@ -10,6 +10,10 @@
 #include "hash.h"
 #include "random.h"
 #include "secp256k1.h"
+#include "uv.h"
+
+static hsk_ec_t *hsk_ec_shared_ctx = NULL;
+static uv_once_t hsk_ec_shared_once = UV_ONCE_INIT;
 
 hsk_ec_t *
 hsk_ec_alloc(void) {
@@ -17,6 +21,22 @@ hsk_ec_alloc(void) {
     HSK_SECP256K1_CONTEXT_SIGN | HSK_SECP256K1_CONTEXT_VERIFY);
 }
 
+static void
+hsk_ec_shared_init(void) {
+  hsk_ec_shared_ctx = hsk_ec_alloc();
+}
+
+// Building the tables of a context is the
+// expensive part, and nothing writes to one
+// afterwards: the process can make do with a
+// single one, shared between threads. It lives
+// as long as the process and is never freed.
+hsk_ec_t *
+hsk_ec_shared(void) {
+  uv_once(&hsk_ec_shared_once, hsk_ec_shared_init);
+  return hsk_ec_shared_ctx;
+}
+
 hsk_ec_t *
 hsk_ec_clone(const hsk_ec_t *ec) {
   assert(ec);
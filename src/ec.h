@@ -14,6 +14,9 @@ typedef hsk_secp256k1_context hsk_ec_t;
 hsk_ec_t *
 hsk_ec_alloc(void);
 
+hsk_ec_t *
+hsk_ec_shared(void);
+
 hsk_ec_t *
 hsk_ec_clone(const hsk_ec_t *ec);
 
@@ -28,14 +28,24 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "ecc.h"
+#include "hash.h"
+#include "uv.h"
 
 #define NUM_ECC_DIGITS (HSK_ECC_BYTES / 8)
 #define MAX_TRIES 16
 
+// Signatures made together by
+// hsk_ecc_sign_batch.
+#define ECC_BATCH 16
+
+// 4-bit windows of a scalar.
+#define NUM_ECC_WINDOWS (HSK_ECC_BYTES * 2)
+
 typedef unsigned int uint;
 
 #if defined(__SIZEOF_INT128__) \
@@ -169,10 +179,36 @@ typedef struct ecc_point_s {
    0xFFFFFFFFFFFFFFFF, \
    0xFFFFFFFFFFFFFFFF}
 
+// floor(2^(2 * bits) / n) - 2^bits, for
+// Barrett reduction modulo the curve order.
+#define CURVE_MU_16    \
+  {0x8A5CF2EA993B2A87, \
+   0x0000000200000003}
+
+#define CURVE_MU_24       \
+  {0xEB94364E4B2DD7CFull, \
+   0x00000000662107C9ull, \
+   0x0000000000000000ull}
+
+#define CURVE_MU_32       \
+  {0x012FFD85EEDF9BFEull, \
+   0x43190552DF1A6C21ull, \
+   0xFFFFFFFEFFFFFFFFull, \
+   0x00000000FFFFFFFFull}
+
+#define CURVE_MU_48    \
+  {0x1313E695333AD68D, \
+   0xA7E5F24DB74F5885, \
+   0x389CB27E0BC8D220, \
+   0x0000000000000000, \
+   0x0000000000000000, \
+   0x0000000000000000}
+
 static uint64_t curve_p[NUM_ECC_DIGITS] = CONCAT(CURVE_P_, HSK_ECC_CURVE);
 static uint64_t curve_b[NUM_ECC_DIGITS] = CONCAT(CURVE_B_, HSK_ECC_CURVE);
 static ecc_point_t curve_g = CONCAT(CURVE_G_, HSK_ECC_CURVE);
 static uint64_t curve_n[NUM_ECC_DIGITS] = CONCAT(CURVE_N_, HSK_ECC_CURVE);
+static uint64_t curve_mu[NUM_ECC_DIGITS] = CONCAT(CURVE_MU_, HSK_ECC_CURVE);
 
 #if (defined(_WIN32) || defined(_WIN64))
 // Windows
@@ -1116,6 +1152,181 @@ ecc_point_mult(
   vli_set(result->y, Ry[0]);
 }
 
+// Fixed-base multiplication: k * G is the sum
+// of one precomputed j * 16^i * G per window,
+// with no doublings. Table reads and the choice
+// of sums do not depend on the scalar's bits.
+
+static ecc_point_t ecc_g_table[NUM_ECC_WINDOWS][15];
+static uv_once_t ecc_g_once = UV_ONCE_INIT;
+
+// (X1, Y1, Z1) += (x2, y2), for points neither
+// equal nor opposite.
+static void
+ecc_point_add_mixed(
+  uint64_t *X1,
+  uint64_t *Y1,
+  uint64_t *Z1,
+  uint64_t *x2,
+  uint64_t *y2
+) {
+  uint64_t u2[NUM_ECC_DIGITS];
+  uint64_t s2[NUM_ECC_DIGITS];
+  uint64_t t1[NUM_ECC_DIGITS];
+  uint64_t t2[NUM_ECC_DIGITS];
+
+  vli_mod_sqr_fast(t1, Z1); // t1 = z1^2
+  vli_mod_mult_fast(u2, x2, t1); // u2 = x2*z1^2
+  vli_mod_mult_fast(t1, t1, Z1); // t1 = z1^3
+  vli_mod_mult_fast(s2, y2, t1); // s2 = y2*z1^3
+  vli_mod_sub(u2, u2, X1, curve_p); // u2 = u2 - x1 = H
+  vli_mod_sub(s2, s2, Y1, curve_p); // s2 = s2 - y1 = R
+  vli_mod_mult_fast(Z1, Z1, u2); // z3 = z1*H
+
+  vli_mod_sqr_fast(t1, u2); // t1 = H^2
+  vli_mod_mult_fast(t2, t1, u2); // t2 = H^3
+  vli_mod_mult_fast(t1, t1, X1); // t1 = x1*H^2 = V
+
+  vli_mod_sqr_fast(X1, s2); // x3 = R^2
+  vli_mod_sub(X1, X1, t2, curve_p); // x3 = R^2 - H^3
+  vli_mod_sub(X1, X1, t1, curve_p);
+  vli_mod_sub(X1, X1, t1, curve_p); // x3 = R^2 - H^3 - 2V
+
+  vli_mod_sub(t1, t1, X1, curve_p); // t1 = V - x3
+  vli_mod_mult_fast(t1, t1, s2); // t1 = R*(V - x3)
+  vli_mod_mult_fast(t2, t2, Y1); // t2 = y1*H^3
+  vli_mod_sub(Y1, t1, t2, curve_p); // y3 = R*(V - x3) - y1*H^3
+}
+
+static void
+ecc_point_normalize(
+  ecc_point_t *result,
+  uint64_t *X1,
+  uint64_t *Y1,
+  uint64_t *Z1
+) {
+  vli_mod_inv(Z1, Z1, curve_p);
+  apply_z(X1, Y1, Z1);
+  vli_set(result->x, X1);
+  vli_set(result->y, Y1);
+}
+
+static void
+ecc_g_table_init(void) {
+  uint64_t X[NUM_ECC_DIGITS];
+  uint64_t Y[NUM_ECC_DIGITS];
+  uint64_t Z[NUM_ECC_DIGITS];
+  ecc_point_t base = curve_g;
+  int i, j;
+
+  for (i = 0; i < NUM_ECC_WINDOWS; i++) {
+    ecc_point_t *row = ecc_g_table[i];
+
+    row[0] = base;
+
+    for (j = 1; j < 15; j++) {
+      vli_set(X, row[j - 1].x);
+      vli_set(Y, row[j - 1].y);
+      vli_clear(Z);
+      Z[0] = 1;
+
+      if (j == 1)
+        ecc_point_double_jacobian(X, Y, Z);
+      else
+        ecc_point_add_mixed(X, Y, Z, base.x, base.y);
+
+      ecc_point_normalize(&row[j], X, Y, Z);
+    }
+
+    // 16 * base = 2 * (8 * base)
+    vli_set(X, row[7].x);
+    vli_set(Y, row[7].y);
+    vli_clear(Z);
+    Z[0] = 1;
+
+    ecc_point_double_jacobian(X, Y, Z);
+    ecc_point_normalize(&base, X, Y, Z);
+  }
+}
+
+static void
+vli_cmov(uint64_t *dest, uint64_t *src, uint64_t mask) {
+  uint i;
+  for (i = 0; i < NUM_ECC_DIGITS; i++)
+    dest[i] ^= (dest[i] ^ src[i]) & mask;
+}
+
+// Scalar in [1, n-1]. The partial sums stay
+// below each window's multiples of G, so the
+// addition never meets equal points. The sum
+// is left in Jacobian coordinates.
+static void
+ecc_point_mult_g_jacobian(
+  uint64_t *X,
+  uint64_t *Y,
+  uint64_t *Z,
+  uint64_t *scalar
+) {
+  uint64_t tx[NUM_ECC_DIGITS];
+  uint64_t ty[NUM_ECC_DIGITS];
+  uint64_t tz[NUM_ECC_DIGITS];
+  uint64_t one[NUM_ECC_DIGITS] = {1};
+  ecc_point_t point;
+
+  // Set once the sum holds a point.
+  uint64_t started = 0;
+  int i, j;
+
+  uv_once(&ecc_g_once, ecc_g_table_init);
+
+  memset(&point, 0, sizeof(ecc_point_t));
+
+  vli_clear(X);
+  vli_clear(Y);
+  vli_clear(Z);
+
+  for (i = 0; i < NUM_ECC_WINDOWS; i++) {
+    uint32_t d = (scalar[i / 16] >> ((i % 16) * 4)) & 15;
+    uint64_t nonzero = (uint64_t)0 - (uint64_t)((0 - d) >> 31);
+
+    // A zero window reads 1 * 16^i * G, which
+    // is then left out.
+    d |= (d - 1) >> 31;
+
+    for (j = 0; j < 15; j++) {
+      uint64_t mask = (uint64_t)0 - (uint64_t)(((d ^ (j + 1)) - 1) >> 31);
+      vli_cmov(point.x, ecc_g_table[i][j].x, mask);
+      vli_cmov(point.y, ecc_g_table[i][j].y, mask);
+    }
+
+    vli_set(tx, X);
+    vli_set(ty, Y);
+    vli_set(tz, Z);
+
+    ecc_point_add_mixed(tx, ty, tz, point.x, point.y);
+
+    vli_cmov(tx, point.x, ~started);
+    vli_cmov(ty, point.y, ~started);
+    vli_cmov(tz, one, ~started);
+
+    vli_cmov(X, tx, nonzero);
+    vli_cmov(Y, ty, nonzero);
+    vli_cmov(Z, tz, nonzero);
+
+    started |= nonzero;
+  }
+}
+
+static void
+ecc_point_mult_g(ecc_point_t *result, uint64_t *scalar) {
+  uint64_t X[NUM_ECC_DIGITS];
+  uint64_t Y[NUM_ECC_DIGITS];
+  uint64_t Z[NUM_ECC_DIGITS];
+
+  ecc_point_mult_g_jacobian(X, Y, Z, scalar);
+  ecc_point_normalize(result, X, Y, Z);
+}
+
 static void
 ecc_bytes2native(
   uint64_t native[NUM_ECC_DIGITS],
@@ -1218,7 +1429,7 @@ hsk_ecc_make_key(
     if (vli_cmp(curve_n, private) != 1)
       vli_sub(private, private, curve_n);
 
-    ecc_point_mult(&public, &curve_g, private, NULL);
+    ecc_point_mult_g(&public, private);
   } while (ecc_point_is_zero(&public));
 
   ecc_native2bytes(private_key, private);
@@ -1244,7 +1455,7 @@ hsk_ecc_make_pubkey(
   if (vli_cmp(curve_n, private) != 1)
     vli_sub(private, private, curve_n);
 
-  ecc_point_mult(&public, &curve_g, private, NULL);
+  ecc_point_mult_g(&public, private);
 
   if (ecc_point_is_zero(&public))
     return 0;
@@ -1271,7 +1482,7 @@ hsk_ecc_make_pubkey_compressed(
   if (vli_cmp(curve_n, private) != 1)
     vli_sub(private, private, curve_n);
 
-  ecc_point_mult(&public, &curve_g, private, NULL);
+  ecc_point_mult_g(&public, private);
 
   if (ecc_point_is_zero(&public))
     return 0;
@@ -1310,90 +1521,139 @@ hsk_ecc_ecdh(
  * -------- ECDSA code --------
  */
 
-// Computes result = (left * right) % mod.
+// Computes result = (left * right) % n.
+//
+// Barrett reduction: with x = hi * 2^bits + lo
+// and mu = 2^bits + m, q = hi + (hi * m >> bits)
+// falls at most three short of x / n, so x - q * n
+// needs at most three more subtractions.
 static void
-vli_mod_mult(
-  uint64_t *result,
-  uint64_t *left,
-  uint64_t *right,
-  uint64_t *mod
-) {
+vli_mod_mult_n(uint64_t *result, uint64_t *left, uint64_t *right) {
   uint64_t product[2 * NUM_ECC_DIGITS];
-  uint64_t mod_multiple[2 * NUM_ECC_DIGITS];
-  uint digit_shift, bit_shift;
-  uint product_bits;
-  uint mod_bits = vli_num_bits(mod);
+  uint64_t tmp[2 * NUM_ECC_DIGITS];
+  uint64_t q[NUM_ECC_DIGITS];
+  uint64_t *hi = product + NUM_ECC_DIGITS;
 
   vli_mult(product, left, right);
 
-  product_bits = vli_num_bits(product + NUM_ECC_DIGITS);
+  // q = hi * mu >> bits (q has a carry bit).
+  vli_mult(tmp, hi, curve_mu);
 
-  if (product_bits)
-    product_bits += NUM_ECC_DIGITS * 64;
-  else
-    product_bits = vli_num_bits(product);
+  uint64_t carry = vli_add(q, hi, tmp + NUM_ECC_DIGITS);
 
-  if (product_bits < mod_bits) {
-    // product < mod.
-    vli_set(result, product);
-    return;
-  }
+  // r = x - q * n, of which only the low
+  // word past the curve size can be set.
+  vli_mult(tmp, q, curve_n);
 
-  // Shift mod by (left_bits - mod_bits).
-  // This multiplies mod by the largest power
-  // of two possible while still resulting in
-  // a number less than left.
-  vli_clear(mod_multiple);
-  vli_clear(mod_multiple + NUM_ECC_DIGITS);
-  digit_shift = (product_bits - mod_bits) / 64;
-  bit_shift = (product_bits - mod_bits) % 64;
-
-  if (bit_shift) {
-    mod_multiple[digit_shift + NUM_ECC_DIGITS] =
-      vli_lshift(mod_multiple + digit_shift, mod, bit_shift);
-  } else {
-    vli_set(mod_multiple + digit_shift, mod);
+  uint64_t top = hi[0] - tmp[NUM_ECC_DIGITS];
+
+  if (carry)
+    top -= curve_n[0];
+
+  top -= vli_sub(result, product, tmp);
+
+  while (top != 0 || vli_cmp(result, curve_n) >= 0)
+    top -= vli_sub(result, result, curve_n);
+}
+
+static uint
+umax(uint a, uint b) {
+  return (a > b ? a : b);
+}
+
+/* Deterministic nonces (RFC 6979) */
+
+#define ECC_HMAC_BYTES 32
+
+typedef struct ecc_drbg_s {
+  uint8_t k[ECC_HMAC_BYTES];
+  uint8_t v[ECC_HMAC_BYTES];
+} ecc_drbg_t;
+
+static void
+ecc_drbg_hmac(ecc_drbg_t *drbg, const uint8_t *data, size_t len, uint8_t *out) {
+  hsk_hash_sha256_hmac(data, len, drbg->k, ECC_HMAC_BYTES, out);
+}
+
+// K = HMAC_K(V || sep [|| x || h]), V = HMAC_K(V)
+static void
+ecc_drbg_update(
+  ecc_drbg_t *drbg,
+  uint8_t sep,
+  const uint8_t *x,
+  const uint8_t *h
+) {
+  uint8_t buf[ECC_HMAC_BYTES + 1 + HSK_ECC_BYTES * 2];
+  size_t len = ECC_HMAC_BYTES + 1;
+
+  memcpy(buf, drbg->v, ECC_HMAC_BYTES);
+  buf[ECC_HMAC_BYTES] = sep;
+
+  if (x) {
+    memcpy(buf + len, x, HSK_ECC_BYTES);
+    len += HSK_ECC_BYTES;
+    memcpy(buf + len, h, HSK_ECC_BYTES);
+    len += HSK_ECC_BYTES;
   }
 
-  // Subtract all multiples of mod to get the remainder.
-  vli_clear(result);
+  ecc_drbg_hmac(drbg, buf, len, drbg->k);
+  ecc_drbg_hmac(drbg, drbg->v, ECC_HMAC_BYTES, drbg->v);
 
-  // Use result as a temp var to store 1 (for subtraction)
-  result[0] = 1;
+  memset(buf, 0, sizeof(buf));
+}
 
-  while (product_bits > NUM_ECC_DIGITS * 64
-         || vli_cmp(mod_multiple, mod) >= 0) {
-    int cmp = vli_cmp(mod_multiple + NUM_ECC_DIGITS,
-                        product + NUM_ECC_DIGITS);
+// The hash is as wide as the curve order, so
+// bits2int is plain decoding and bits2octets a
+// single reduction. Wider curves take several
+// blocks of output per candidate.
+static void
+ecc_drbg_init(
+  ecc_drbg_t *drbg,
+  const uint8_t private_key[HSK_ECC_BYTES],
+  const uint8_t hash[HSK_ECC_BYTES]
+) {
+  uint64_t e[NUM_ECC_DIGITS];
+  uint8_t h[HSK_ECC_BYTES];
 
-    if (cmp < 0 || (cmp == 0 && vli_cmp(mod_multiple, product) <= 0)) {
-      if (vli_sub(product, product, mod_multiple)) {
-        // borrow
-        vli_sub(product + NUM_ECC_DIGITS,
-                product + NUM_ECC_DIGITS, result);
-      }
+  ecc_bytes2native(e, hash);
 
-      vli_sub(product + NUM_ECC_DIGITS,
-              product + NUM_ECC_DIGITS,
-              mod_multiple + NUM_ECC_DIGITS);
-    }
+  if (vli_cmp(curve_n, e) != 1)
+    vli_sub(e, e, curve_n);
+
+  ecc_native2bytes(h, e);
 
-    uint64_t carry = (mod_multiple[NUM_ECC_DIGITS] & 0x01) << 63;
+  memset(drbg->v, 0x01, ECC_HMAC_BYTES);
+  memset(drbg->k, 0x00, ECC_HMAC_BYTES);
 
-    vli_rshift1(mod_multiple + NUM_ECC_DIGITS);
-    vli_rshift1(mod_multiple);
+  ecc_drbg_update(drbg, 0x00, private_key, h);
+  ecc_drbg_update(drbg, 0x01, private_key, h);
+}
+
+static void
+ecc_drbg_generate(ecc_drbg_t *drbg, uint64_t *k) {
+  uint8_t t[HSK_ECC_BYTES];
+  size_t len = 0;
 
-    mod_multiple[NUM_ECC_DIGITS - 1] |= carry;
+  while (len < HSK_ECC_BYTES) {
+    size_t size = HSK_ECC_BYTES - len;
 
-    product_bits -= 1;
+    if (size > ECC_HMAC_BYTES)
+      size = ECC_HMAC_BYTES;
+
+    ecc_drbg_hmac(drbg, drbg->v, ECC_HMAC_BYTES, drbg->v);
+    memcpy(t + len, drbg->v, size);
+
+    len += size;
   }
 
-  vli_set(result, product);
+  ecc_bytes2native(k, t);
+
+  memset(t, 0, sizeof(t));
 }
 
-static uint
-umax(uint a, uint b) {
-  return (a > b ? a : b);
+static void
+ecc_drbg_reseed(ecc_drbg_t *drbg) {
+  ecc_drbg_update(drbg, 0x00, NULL, NULL);
 }
 
 int
@@ -1406,39 +1666,217 @@ hsk_ecc_sign(
   uint64_t tmp[NUM_ECC_DIGITS];
   uint64_t s[NUM_ECC_DIGITS];
   ecc_point_t p;
+  ecc_drbg_t drbg;
   unsigned tries = 0;
 
-  do {
-    if (!get_rand_num(k) || (tries++ >= MAX_TRIES))
+  // The same key and hash always pick the same
+  // nonce, so identical data signs identically.
+  ecc_drbg_init(&drbg, private_key, hash);
+
+  for (;;) {
+    if (tries++ >= MAX_TRIES) {
+      memset(&drbg, 0, sizeof(drbg));
       return 0;
+    }
 
-    if (vli_is_zero(k))
-      continue;
+    if (tries > 1)
+      ecc_drbg_reseed(&drbg);
+
+    ecc_drbg_generate(&drbg, k);
 
-    if (vli_cmp(curve_n, k) != 1)
-      vli_sub(k, k, curve_n);
+    if (vli_is_zero(k) || vli_cmp(curve_n, k) != 1)
+      continue;
 
     // tmp = k * G
-    ecc_point_mult(&p, &curve_g, k, NULL);
+    ecc_point_mult_g(&p, k);
 
     // r = x1 (mod n)
     if (vli_cmp(curve_n, p.x) != 1)
       vli_sub(p.x, p.x, curve_n);
-  } while (vli_is_zero(p.x));
+
+    if (!vli_is_zero(p.x))
+      break;
+  }
+
+  memset(&drbg, 0, sizeof(drbg));
 
   ecc_native2bytes(signature, p.x);
 
   ecc_bytes2native(tmp, private_key);
-  vli_mod_mult(s, p.x, tmp, curve_n); // s = r*d
+  vli_mod_mult_n(s, p.x, tmp); // s = r*d
   ecc_bytes2native(tmp, hash);
   vli_mod_add(s, tmp, s, curve_n); // s = e + r*d
   vli_mod_inv(k, k, curve_n); // k = 1 / k
-  vli_mod_mult(s, s, k, curve_n); // s = (e + r*d) / k
+  vli_mod_mult_n(s, s, k); // s = (e + r*d) / k
   ecc_native2bytes(signature + HSK_ECC_BYTES, s);
 
   return 1;
 }
 
+// Montgomery's trick: vals[i] = 1 / vals[i]
+// for one inversion and 3 * (count - 1)
+// products. None may be zero.
+static void
+vli_mod_inv_batch(
+  uint64_t (*vals)[NUM_ECC_DIGITS],
+  size_t count,
+  uint64_t *mod,
+  void (*mult)(uint64_t *, uint64_t *, uint64_t *)
+) {
+  uint64_t acc[ECC_BATCH][NUM_ECC_DIGITS];
+  uint64_t inv[NUM_ECC_DIGITS];
+  uint64_t tmp[NUM_ECC_DIGITS];
+  size_t i;
+
+  assert(count > 0 && count <= ECC_BATCH);
+
+  vli_set(acc[0], vals[0]);
+
+  for (i = 1; i < count; i++)
+    mult(acc[i], acc[i - 1], vals[i]);
+
+  vli_mod_inv(inv, acc[count - 1], mod);
+
+  for (i = count - 1; i > 0; i--) {
+    mult(tmp, inv, acc[i - 1]);
+    mult(inv, inv, vals[i]);
+    vli_set(vals[i], tmp);
+  }
+
+  vli_set(vals[0], inv);
+}
+
+// Up to ECC_BATCH signatures. Returns a bitmask
+// of the ones left to hsk_ecc_sign.
+static uint32_t
+ecc_sign_batch(
+  uint64_t *d,
+  const uint8_t hashes[][HSK_ECC_BYTES],
+  uint8_t signatures[][HSK_ECC_BYTES * 2],
+  size_t count,
+  const uint8_t private_key[HSK_ECC_BYTES]
+) {
+  uint64_t k[ECC_BATCH][NUM_ECC_DIGITS];
+  uint64_t X[ECC_BATCH][NUM_ECC_DIGITS];
+  uint64_t Y[NUM_ECC_DIGITS];
+  uint64_t Z[ECC_BATCH][NUM_ECC_DIGITS];
+  uint64_t r[ECC_BATCH][NUM_ECC_DIGITS];
+  uint64_t s[NUM_ECC_DIGITS];
+  uint64_t e[NUM_ECC_DIGITS];
+  uint64_t t[NUM_ECC_DIGITS];
+  size_t map[ECC_BATCH];
+  uint32_t retry = 0;
+  ecc_drbg_t drbg;
+  size_t n = 0;
+  size_t i;
+
+  // First nonces, as hsk_ecc_sign draws them.
+  // The rare one that needs another draw is
+  // left to it.
+  for (i = 0; i < count; i++) {
+    ecc_drbg_init(&drbg, private_key, hashes[i]);
+    ecc_drbg_generate(&drbg, k[n]);
+
+    if (vli_is_zero(k[n]) || vli_cmp(curve_n, k[n]) != 1) {
+      retry |= (uint32_t)1 << i;
+      continue;
+    }
+
+    ecc_point_mult_g_jacobian(X[n], Y, Z[n], k[n]);
+
+    map[n] = i;
+    n += 1;
+  }
+
+  memset(&drbg, 0, sizeof(drbg));
+
+  if (n == 0)
+    return retry;
+
+  // r = X / Z^2 (mod n)
+  vli_mod_inv_batch(Z, n, curve_p, vli_mod_mult_fast);
+
+  size_t m = 0;
+
+  for (i = 0; i < n; i++) {
+    vli_mod_sqr_fast(t, Z[i]);
+    vli_mod_mult_fast(r[m], X[i], t);
+
+    if (vli_cmp(curve_n, r[m]) != 1)
+      vli_sub(r[m], r[m], curve_n);
+
+    if (vli_is_zero(r[m])) {
+      retry |= (uint32_t)1 << map[i];
+      continue;
+    }
+
+    vli_set(k[m], k[i]);
+    map[m] = map[i];
+    m += 1;
+  }
+
+  if (m > 0)
+    vli_mod_inv_batch(k, m, curve_n, vli_mod_mult_n);
+
+  for (i = 0; i < m; i++) {
+    uint8_t *sig = signatures[map[i]];
+
+    ecc_bytes2native(e, hashes[map[i]]);
+    vli_mod_mult_n(s, r[i], d); // s = r*d
+    vli_mod_add(s, e, s, curve_n); // s = e + r*d
+    vli_mod_mult_n(s, s, k[i]); // s = (e + r*d) / k
+
+    ecc_native2bytes(sig, r[i]);
+    ecc_native2bytes(sig + HSK_ECC_BYTES, s);
+  }
+
+  memset(k, 0, sizeof(k));
+
+  return retry;
+}
+
+// Several hashes signed with one key. The nonce
+// points are normalized and the nonces inverted
+// together, so a batch pays for two inversions
+// rather than two per signature. Signatures are
+// those of hsk_ecc_sign.
+int
+hsk_ecc_sign_batch(
+  const uint8_t private_key[HSK_ECC_BYTES],
+  const uint8_t hashes[][HSK_ECC_BYTES],
+  uint8_t signatures[][HSK_ECC_BYTES * 2],
+  size_t count
+) {
+  uint64_t d[NUM_ECC_DIGITS];
+  size_t i, j;
+
+  ecc_bytes2native(d, private_key);
+
+  for (i = 0; i < count; i += ECC_BATCH) {
+    size_t size = count - i;
+
+    if (size > ECC_BATCH)
+      size = ECC_BATCH;
+
+    uint32_t retry = ecc_sign_batch(d, &hashes[i], &signatures[i],
+                                    size, private_key);
+
+    for (j = 0; j < size; j++) {
+      if (!(retry & ((uint32_t)1 << j)))
+        continue;
+
+      if (!hsk_ecc_sign(private_key, hashes[i + j], signatures[i + j])) {
+        memset(d, 0, sizeof(d));
+        return 0;
+      }
+    }
+  }
+
+  memset(d, 0, sizeof(d));
+
+  return 1;
+}
+
 int
 hsk_ecc_verify(
   const uint8_t public_key[HSK_ECC_BYTES + 1],
@@ -1471,8 +1909,8 @@ hsk_ecc_verify(
   // Calculate u1 and u2.
   vli_mod_inv(z, s, curve_n); // Z = s^-1
   ecc_bytes2native(u1, hash);
-  vli_mod_mult(u1, u1, z, curve_n); // u1 = e/s
-  vli_mod_mult(u2, r, z, curve_n); // u2 = r/s
+  vli_mod_mult_n(u1, u1, z); // u1 = e/s
+  vli_mod_mult_n(u2, r, z); // u2 = r/s
 
   // Calculate sum = G + Q.
   vli_set(sum.x, public.x);
@@ -29,6 +29,7 @@
 #ifndef _HSK_ECC_H
 #define _HSK_ECC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define HSK_SECP128R1 16
@@ -81,6 +82,14 @@ hsk_ecc_sign(
   uint8_t signature[HSK_ECC_BYTES * 2]
 );
 
+int
+hsk_ecc_sign_batch(
+  const uint8_t private_key[HSK_ECC_BYTES],
+  const uint8_t hashes[][HSK_ECC_BYTES],
+  uint8_t signatures[][HSK_ECC_BYTES * 2],
+  size_t count
+);
+
 int
 hsk_ecc_verify(
   const uint8_t public_key[HSK_ECC_BYTES + 1],
@@ -0,0 +1,131 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bio.h"
+#include "entry.h"
+#include "header.h"
+#include "mem.h"
+#include "u256.h"
+
+void
+hsk_entry_init(hsk_entry_t *entry) {
+  if (!entry)
+    return;
+
+  memset(entry->hash, 0, 32);
+  memset(entry->prev_block, 0, 32);
+  memset(entry->name_root, 0, 32);
+  entry->time = 0;
+  entry->bits = 0;
+  entry->height = 0;
+  memset(entry->work, 0, 32);
+  entry->mtp = 0;
+  memset(entry->skip, 0, 32);
+}
+
+hsk_entry_t *
+hsk_entry_alloc(void) {
+  hsk_entry_t *entry = hsk_malloc(sizeof(hsk_entry_t));
+  hsk_entry_init(entry);
+  return entry;
+}
+
+hsk_entry_t *
+hsk_entry_clone(const hsk_entry_t *entry) {
+  if (!entry)
+    return NULL;
+
+  hsk_entry_t *copy = hsk_malloc(sizeof(hsk_entry_t));
+
+  if (!copy)
+    return NULL;
+
+  memcpy((void *)copy, (void *)entry, sizeof(hsk_entry_t));
+
+  return copy;
+}
+
+void
+hsk_entry_from_header(hsk_entry_t *entry, hsk_header_t *hdr) {
+  assert(entry && hdr);
+
+  memcpy(entry->hash, hsk_header_cache(hdr), 32);
+  memcpy(entry->prev_block, hdr->prev_block, 32);
+  memcpy(entry->name_root, hdr->name_root, 32);
+  entry->time = hdr->time;
+  entry->bits = hdr->bits;
+  entry->height = hdr->height;
+  memcpy(entry->work, hdr->work, 32);
+  entry->mtp = 0;
+  memset(entry->skip, 0, 32);
+}
+
+bool
+hsk_entry_calc_work(hsk_entry_t *entry, const hsk_entry_t *prev) {
+  if (!prev)
+    return hsk_pow_to_proof(entry->bits, entry->work);
+
+  uint8_t proof[32];
+
+  if (!hsk_pow_to_proof(entry->bits, proof))
+    return false;
+
+  hsk_u256_t work_n, proof_n;
+  hsk_u256_from_array(&work_n, prev->work);
+  hsk_u256_from_array(&proof_n, proof);
+  hsk_u256_add(&work_n, &work_n, &proof_n);
+  hsk_u256_to_array(&work_n, entry->work);
+
+  return true;
+}
+
+bool
+hsk_entry_equal(const hsk_entry_t *a, const hsk_entry_t *b) {
+  return memcmp(a->hash, b->hash, 32) == 0;
+}
+
+bool
+hsk_entry_read(uint8_t **data, size_t *data_len, hsk_entry_t *entry) {
+  if (!read_bytes(data, data_len, entry->hash, 32))
+    return false;
+
+  if (!read_bytes(data, data_len, entry->prev_block, 32))
+    return false;
+
+  if (!read_bytes(data, data_len, entry->name_root, 32))
+    return false;
+
+  if (!read_u64(data, data_len, &entry->time))
+    return false;
+
+  if (!read_u32(data, data_len, &entry->bits))
+    return false;
+
+  return true;
+}
+
+bool
+hsk_entry_decode(const uint8_t *data, size_t data_len, hsk_entry_t *entry) {
+  return hsk_entry_read((uint8_t **)&data, &data_len, entry);
+}
+
+int
+hsk_entry_write(const hsk_entry_t *entry, uint8_t **data) {
+  int s = 0;
+  s += write_bytes(data, entry->hash, 32);
+  s += write_bytes(data, entry->prev_block, 32);
+  s += write_bytes(data, entry->name_root, 32);
+  s += write_u64(data, entry->time);
+  s += write_u32(data, entry->bits);
+  return s;
+}
+
+int
+hsk_entry_encode(const hsk_entry_t *entry, uint8_t *data) {
+  return hsk_entry_write(entry, &data);
+}
@@ -0,0 +1,69 @@
+#ifndef _HSK_ENTRY_H
+#define _HSK_ENTRY_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "header.h"
+
+/*
+ * Defs
+ */
+
+#define HSK_ENTRY_SIZE 108
+
+/*
+ * Types
+ */
+
+// An accepted header. Once a header has passed
+// validation the chain only needs these fields,
+// so the cuckoo solution, nonce and the other
+// commitments are dropped.
+typedef struct hsk_entry_s {
+  uint8_t hash[32];
+  uint8_t prev_block[32];
+  uint8_t name_root[32];
+  uint64_t time;
+  uint32_t bits;
+  uint32_t height;
+  uint8_t work[32];
+  int64_t mtp;
+  uint8_t skip[32];
+} hsk_entry_t;
+
+/*
+ * Entry
+ */
+
+void
+hsk_entry_init(hsk_entry_t *entry);
+
+hsk_entry_t *
+hsk_entry_alloc(void);
+
+hsk_entry_t *
+hsk_entry_clone(const hsk_entry_t *entry);
+
+void
+hsk_entry_from_header(hsk_entry_t *entry, hsk_header_t *hdr);
+
+bool
+hsk_entry_calc_work(hsk_entry_t *entry, const hsk_entry_t *prev);
+
+bool
+hsk_entry_equal(const hsk_entry_t *a, const hsk_entry_t *b);
+
+bool
+hsk_entry_read(uint8_t **data, size_t *data_len, hsk_entry_t *entry);
+
+bool
+hsk_entry_decode(const uint8_t *data, size_t data_len, hsk_entry_t *entry);
+
+int
+hsk_entry_write(const hsk_entry_t *entry, uint8_t **data);
+
+int
+hsk_entry_encode(const hsk_entry_t *entry, uint8_t *data);
+#endif
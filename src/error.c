@@ -45,6 +45,8 @@ static const char *errstrs[] = {
   "EACTTHREE",
   "EBADSIZE",
   "EBADTAG",
+  "ECHECKPOINT",
+  "EBUSY",
   "EUNKNOWN"
 };
 
@@ -55,8 +55,14 @@
 #define HSK_EBADSIZE 37
 #define HSK_EBADTAG 38
 
+// Checkpoints
+#define HSK_ECHECKPOINT 39
+
+// Pool
+#define HSK_EBUSY 40
+
 // Max
-#define HSK_MAXERROR 39
+#define HSK_MAXERROR 41
 
 const char *
 hsk_strerror(int code);
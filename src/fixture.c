@@ -0,0 +1,561 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bio.h"
+#include "blake2b.h"
+#include "constants.h"
+#include "cuckoo.h"
+#include "error.h"
+#include "fixture.h"
+#include "hash.h"
+#include "header.h"
+#include "mem.h"
+#include "proof.h"
+
+#define HSK_HAS_BIT(m, i) (((m)[(i) >> 3] >> (7 - ((i) & 7))) & 1)
+
+static const uint8_t hsk_fixture_skip[1] = {0x02};
+static const uint8_t hsk_fixture_internal[1] = {0x01};
+static const uint8_t hsk_fixture_leaf[1] = {0x00};
+
+/*
+ * Proof of Work
+ */
+
+// Follows a node's edges to the root of its
+// tree in the graph. Ids are node + 1.
+static int
+hsk_fixture_path(const uint32_t *cuckoo, uint32_t u, uint32_t *us) {
+  int nu = 0;
+
+  for (; u != 0; u = cuckoo[u]) {
+    if (++nu >= HSK_FIXTURE_MAX_PATH)
+      return -1;
+
+    us[nu] = u;
+  }
+
+  return nu;
+}
+
+// The nonces of a cycle's edges, in order.
+static bool
+hsk_fixture_recover(
+  const hsk_cuckoo_t *ctx,
+  const uint8_t *key,
+  const uint32_t *us,
+  int nu,
+  const uint32_t *vs,
+  int nv,
+  uint32_t *sol
+) {
+  uint32_t edges[254][2];
+  size_t count = 0;
+  size_t found = 0;
+
+  edges[count][0] = us[0];
+  edges[count][1] = vs[0];
+  count += 1;
+
+  while (nu--) {
+    edges[count][0] = us[(nu + 1) & ~1];
+    edges[count][1] = us[nu | 1];
+    count += 1;
+  }
+
+  while (nv--) {
+    edges[count][0] = vs[nv | 1];
+    edges[count][1] = vs[(nv + 1) & ~1];
+    count += 1;
+  }
+
+  assert(count == ctx->size);
+
+  for (uint64_t nonce = 0; nonce < ctx->easiness; nonce++) {
+    uint32_t u = hsk_cuckoo_sipnode(ctx, key, (uint32_t)nonce, 0) + 1;
+    uint32_t v = hsk_cuckoo_sipnode(ctx, key, (uint32_t)nonce, 1) + 1;
+
+    for (size_t i = 0; i < count; i++) {
+      if (edges[i][0] == u && edges[i][1] == v) {
+        sol[found++] = (uint32_t)nonce;
+        edges[i][0] = 0;
+        break;
+      }
+    }
+
+    if (found == count)
+      break;
+  }
+
+  return found == count;
+}
+
+// A cycle of the context's size in the graph
+// of `key`, found by following paths (as in
+// the reference simple miner). Most graphs
+// have none.
+bool
+hsk_fixture_solve(
+  const hsk_cuckoo_t *ctx,
+  const uint8_t *key,
+  uint32_t *sol
+) {
+  assert(ctx && key && sol);
+
+  if (ctx->nodes > (1ull << HSK_FIXTURE_SOLVE_BITS))
+    return false;
+
+  uint32_t *cuckoo = hsk_calloc(ctx->nodes + 1, sizeof(uint32_t));
+  uint32_t *us = hsk_malloc(HSK_FIXTURE_MAX_PATH * sizeof(uint32_t));
+  uint32_t *vs = hsk_malloc(HSK_FIXTURE_MAX_PATH * sizeof(uint32_t));
+  bool solved = false;
+
+  if (!cuckoo || !us || !vs)
+    goto done;
+
+  for (uint64_t nonce = 0; nonce < ctx->easiness; nonce++) {
+    uint32_t u0 = hsk_cuckoo_sipnode(ctx, key, (uint32_t)nonce, 0) + 1;
+    uint32_t v0 = hsk_cuckoo_sipnode(ctx, key, (uint32_t)nonce, 1) + 1;
+    uint32_t u = cuckoo[u0];
+    uint32_t v = cuckoo[v0];
+
+    us[0] = u0;
+    vs[0] = v0;
+
+    // A duplicate edge.
+    if (u == v0 || v == u0)
+      continue;
+
+    int nu = hsk_fixture_path(cuckoo, u, us);
+    int nv = hsk_fixture_path(cuckoo, v, vs);
+
+    if (nu < 0 || nv < 0)
+      goto done;
+
+    if (us[nu] == vs[nv]) {
+      int min = nu < nv ? nu : nv;
+
+      for (nu -= min, nv -= min; us[nu] != vs[nv]; nu++, nv++)
+        ;
+
+      if ((uint32_t)(nu + nv + 1) != ctx->size)
+        continue;
+
+      solved = hsk_fixture_recover(ctx, key, us, nu, vs, nv, sol)
+            && hsk_cuckoo_verify(ctx, key, sol) == HSK_EPOWOK;
+
+      goto done;
+    }
+
+    if (nu < nv) {
+      while (nu--)
+        cuckoo[us[nu + 1]] = us[nu];
+      cuckoo[u0] = v0;
+    } else {
+      while (nv--)
+        cuckoo[vs[nv + 1]] = vs[nv];
+      cuckoo[v0] = u0;
+    }
+  }
+
+done:
+  hsk_free(cuckoo);
+  hsk_free(us);
+  hsk_free(vs);
+  return solved;
+}
+
+// Bumps the nonce until the header has a
+// proof of work for this network. Only the
+// small graphs of regtest and simnet can be
+// solved.
+bool
+hsk_fixture_mine(hsk_header_t *hdr, uint32_t tries) {
+  assert(hdr);
+
+  hsk_cuckoo_t ctx;
+  uint8_t target[32];
+
+  if (hsk_cuckoo_init(&ctx, HSK_CUCKOO_BITS, HSK_CUCKOO_SIZE,
+                      HSK_CUCKOO_PERC, HSK_CUCKOO_LEGACY) != HSK_SUCCESS) {
+    return false;
+  }
+
+  if (ctx.nodes > (1ull << HSK_FIXTURE_SOLVE_BITS))
+    return false;
+
+  if (!hsk_pow_to_target(hdr->bits, target))
+    return false;
+
+  hdr->cache = false;
+  hdr->prepared = false;
+  hdr->sol_size = HSK_CUCKOO_SIZE;
+
+  for (uint32_t i = 0; i < tries; i++) {
+    uint8_t key[32];
+    uint8_t hash[32];
+    uint8_t *nonce = &hdr->nonce[0];
+
+    write_u32(&nonce, i);
+
+    hsk_header_hash_pre(hdr, key);
+
+    if (!hsk_fixture_solve(&ctx, key, hdr->sol))
+      continue;
+
+    hsk_header_hash_sol(hdr, hash);
+
+    if (memcmp(hash, target, 32) <= 0)
+      return true;
+  }
+
+  return false;
+}
+
+/*
+ * Tree
+ */
+
+static void
+hsk_fixture_hash_internal(
+  const uint8_t *prefix,
+  uint16_t prefix_size,
+  const uint8_t *left,
+  const uint8_t *right,
+  uint8_t *out
+) {
+  hsk_blake2b_ctx ctx;
+  assert(hsk_blake2b_init(&ctx, 32) == 0);
+
+  if (prefix_size == 0) {
+    hsk_blake2b_update(&ctx, hsk_fixture_internal, 1);
+  } else {
+    uint8_t size[2];
+    uint8_t *p = &size[0];
+    write_u16(&p, prefix_size);
+
+    hsk_blake2b_update(&ctx, hsk_fixture_skip, 1);
+    hsk_blake2b_update(&ctx, size, 2);
+    hsk_blake2b_update(&ctx, prefix, ((size_t)prefix_size + 7) / 8);
+  }
+
+  hsk_blake2b_update(&ctx, left, 32);
+  hsk_blake2b_update(&ctx, right, 32);
+
+  assert(hsk_blake2b_final(&ctx, out, 32) == 0);
+}
+
+static void
+hsk_fixture_hash_leaf(const uint8_t *key, const uint8_t *hash, uint8_t *out) {
+  hsk_blake2b_ctx ctx;
+  assert(hsk_blake2b_init(&ctx, 32) == 0);
+  hsk_blake2b_update(&ctx, hsk_fixture_leaf, 1);
+  hsk_blake2b_update(&ctx, key, 32);
+  hsk_blake2b_update(&ctx, hash, 32);
+  assert(hsk_blake2b_final(&ctx, out, 32) == 0);
+}
+
+// Bits [start, start + size) of `key`, from
+// bit 0 of `out` (the rest zeroed).
+static void
+hsk_fixture_bits(const uint8_t *key, int start, int size, uint8_t *out) {
+  memset(out, 0x00, 32);
+
+  for (int i = 0; i < size; i++) {
+    if (HSK_HAS_BIT(key, start + i))
+      out[i >> 3] |= 0x80 >> (i & 7);
+  }
+}
+
+// Whether `key` continues with the node's
+// prefix.
+static bool
+hsk_fixture_has(const hsk_fixture_node_t *node, const uint8_t *key) {
+  for (int i = 0; i < node->prefix_size; i++) {
+    if (HSK_HAS_BIT(node->prefix, i) != HSK_HAS_BIT(key, node->depth + i))
+      return false;
+  }
+
+  return true;
+}
+
+void
+hsk_fixture_tree_init(hsk_fixture_tree_t *tree) {
+  assert(tree);
+  tree->leaves = NULL;
+  tree->leaf_count = 0;
+  tree->leaf_cap = 0;
+  tree->nodes = NULL;
+  tree->node_count = 0;
+  memset(tree->root, 0x00, 32);
+}
+
+void
+hsk_fixture_tree_uninit(hsk_fixture_tree_t *tree) {
+  assert(tree);
+
+  for (size_t i = 0; i < tree->leaf_count; i++)
+    hsk_free(tree->leaves[i].value);
+
+  hsk_free(tree->leaves);
+  hsk_free(tree->nodes);
+
+  hsk_fixture_tree_init(tree);
+}
+
+// A later value for the same key replaces an
+// earlier one (on commit).
+bool
+hsk_fixture_tree_insert(
+  hsk_fixture_tree_t *tree,
+  const uint8_t *key,
+  const uint8_t *value,
+  size_t value_size
+) {
+  assert(tree && key && (value || value_size == 0));
+
+  if (value_size > HSK_MAX_DATA_SIZE)
+    return false;
+
+  if (tree->leaf_count == tree->leaf_cap) {
+    size_t cap = tree->leaf_cap ? tree->leaf_cap * 2 : 64;
+    hsk_fixture_leaf_t *leaves =
+      hsk_realloc(tree->leaves, cap * sizeof(hsk_fixture_leaf_t));
+
+    if (!leaves)
+      return false;
+
+    tree->leaves = leaves;
+    tree->leaf_cap = cap;
+  }
+
+  hsk_fixture_leaf_t *leaf = &tree->leaves[tree->leaf_count];
+
+  leaf->value = hsk_malloc(value_size > 0 ? value_size : 1);
+
+  if (!leaf->value)
+    return false;
+
+  if (value_size > 0)
+    memcpy(leaf->value, value, value_size);
+
+  memcpy(leaf->key, key, 32);
+  hsk_hash_blake2b(value, value_size, leaf->hash);
+  leaf->value_size = value_size;
+  leaf->seq = tree->leaf_count;
+
+  tree->leaf_count += 1;
+
+  return true;
+}
+
+// As the chain keeps it: the name, then the
+// resource (the rest of the name state is not
+// looked at).
+bool
+hsk_fixture_tree_insert_name(
+  hsk_fixture_tree_t *tree,
+  const char *name,
+  const uint8_t *res,
+  size_t res_size
+) {
+  assert(tree && name && (res || res_size == 0));
+
+  size_t name_size = strlen(name);
+
+  if (name_size == 0 || name_size > 63)
+    return false;
+
+  if (1 + name_size + 2 + res_size > HSK_MAX_DATA_SIZE)
+    return false;
+
+  uint8_t value[HSK_MAX_DATA_SIZE];
+  uint8_t *data = &value[0];
+  size_t size = 0;
+
+  size += write_u8(&data, (uint8_t)name_size);
+  size += write_bytes(&data, (const uint8_t *)name, name_size);
+  size += write_u16(&data, (uint16_t)res_size);
+  size += write_bytes(&data, res, res_size);
+
+  uint8_t key[32];
+  hsk_hash_name(name, key);
+
+  return hsk_fixture_tree_insert(tree, key, value, size);
+}
+
+static int
+hsk_fixture_leaf_cmp(const void *a, const void *b) {
+  const hsk_fixture_leaf_t *x = a;
+  const hsk_fixture_leaf_t *y = b;
+  int cmp = memcmp(x->key, y->key, 32);
+
+  if (cmp != 0)
+    return cmp;
+
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Leaves [lo, hi) below `depth`, all sharing
+// the bits before it.
+static size_t
+hsk_fixture_build(hsk_fixture_tree_t *tree, size_t lo, size_t hi, int depth) {
+  size_t index = tree->node_count++;
+  hsk_fixture_node_t *node = &tree->nodes[index];
+
+  memset(node, 0x00, sizeof(*node));
+  node->depth = (uint16_t)depth;
+
+  if (hi - lo == 1) {
+    const hsk_fixture_leaf_t *leaf = &tree->leaves[lo];
+
+    node->leaf = true;
+    node->index = lo;
+
+    hsk_fixture_hash_leaf(leaf->key, leaf->hash, node->hash);
+
+    return index;
+  }
+
+  // Sorted: the first and last keys share what
+  // all of them do.
+  const uint8_t *first = tree->leaves[lo].key;
+  const uint8_t *last = tree->leaves[hi - 1].key;
+  int bit = depth;
+
+  while (HSK_HAS_BIT(first, bit) == HSK_HAS_BIT(last, bit))
+    bit += 1;
+
+  size_t mid = lo;
+
+  while (!HSK_HAS_BIT(tree->leaves[mid].key, bit))
+    mid += 1;
+
+  node->prefix_size = (uint16_t)(bit - depth);
+  hsk_fixture_bits(first, depth, node->prefix_size, node->prefix);
+
+  size_t left = hsk_fixture_build(tree, lo, mid, bit + 1);
+  size_t right = hsk_fixture_build(tree, mid, hi, bit + 1);
+
+  node = &tree->nodes[index];
+  node->left = left;
+  node->right = right;
+
+  hsk_fixture_hash_internal(node->prefix, node->prefix_size,
+                            tree->nodes[left].hash,
+                            tree->nodes[right].hash,
+                            node->hash);
+
+  return index;
+}
+
+bool
+hsk_fixture_tree_commit(hsk_fixture_tree_t *tree) {
+  assert(tree);
+
+  qsort(tree->leaves, tree->leaf_count,
+        sizeof(hsk_fixture_leaf_t), hsk_fixture_leaf_cmp);
+
+  // Keep the last of each key.
+  size_t count = 0;
+
+  for (size_t i = 0; i < tree->leaf_count; i++) {
+    if (i + 1 < tree->leaf_count
+        && memcmp(tree->leaves[i].key, tree->leaves[i + 1].key, 32) == 0) {
+      hsk_free(tree->leaves[i].value);
+      continue;
+    }
+
+    tree->leaves[count] = tree->leaves[i];
+    tree->leaves[count].seq = count;
+    count += 1;
+  }
+
+  tree->leaf_count = count;
+
+  hsk_free(tree->nodes);
+  tree->nodes = NULL;
+  tree->node_count = 0;
+
+  if (count == 0) {
+    memset(tree->root, 0x00, 32);
+    return true;
+  }
+
+  tree->nodes = hsk_malloc((count * 2 - 1) * sizeof(hsk_fixture_node_t));
+
+  if (!tree->nodes)
+    return false;
+
+  hsk_fixture_build(tree, 0, count, 0);
+
+  memcpy(tree->root, tree->nodes[0].hash, 32);
+
+  return true;
+}
+
+// Of existence or not, against the committed
+// root. The proof owns its memory.
+bool
+hsk_fixture_tree_prove(
+  const hsk_fixture_tree_t *tree,
+  const uint8_t *key,
+  hsk_proof_t *proof
+) {
+  assert(tree && key && proof);
+
+  hsk_proof_node_t nodes[256];
+  hsk_proof_t tmp;
+
+  hsk_proof_init(&tmp);
+  tmp.nodes = &nodes[0];
+
+  if (tree->node_count == 0)
+    return hsk_proof_copy(proof, &tmp);
+
+  const hsk_fixture_node_t *node = &tree->nodes[0];
+
+  while (!node->leaf) {
+    if (!hsk_fixture_has(node, key)) {
+      tmp.type = HSK_PROOF_SHORT;
+      tmp.depth = node->depth;
+      tmp.prefix = (uint8_t *)node->prefix;
+      tmp.prefix_size = node->prefix_size;
+      tmp.left = (uint8_t *)tree->nodes[node->left].hash;
+      tmp.right = (uint8_t *)tree->nodes[node->right].hash;
+      return hsk_proof_copy(proof, &tmp);
+    }
+
+    int bit = node->depth + node->prefix_size;
+    size_t next = HSK_HAS_BIT(key, bit) ? node->right : node->left;
+    size_t sibling = next == node->right ? node->left : node->right;
+    hsk_proof_node_t *item = &nodes[tmp.node_count++];
+
+    memcpy(item->prefix, node->prefix, 32);
+    item->prefix_size = node->prefix_size;
+    memcpy(item->node, tree->nodes[sibling].hash, 32);
+
+    node = &tree->nodes[next];
+  }
+
+  const hsk_fixture_leaf_t *leaf = &tree->leaves[node->index];
+
+  tmp.depth = node->depth;
+
+  if (memcmp(leaf->key, key, 32) == 0) {
+    tmp.type = HSK_PROOF_EXISTS;
+    tmp.value = leaf->value;
+    tmp.value_size = (uint16_t)leaf->value_size;
+  } else {
+    tmp.type = HSK_PROOF_COLLISION;
+    tmp.nx_key = (uint8_t *)leaf->key;
+    tmp.nx_hash = (uint8_t *)leaf->hash;
+  }
+
+  return hsk_proof_copy(proof, &tmp);
+}
@@ -0,0 +1,107 @@
+#ifndef _HSK_FIXTURE_H
+#define _HSK_FIXTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cuckoo.h"
+#include "header.h"
+#include "proof.h"
+
+// Made-up chains and name trees for the tools
+// (hnsd-bench and hnsd-peer), built at startup.
+
+// Largest graph the solver takes on: one of
+// 2^20 nodes is 4 MiB and a few milliseconds.
+#define HSK_FIXTURE_SOLVE_BITS 20
+
+// Paths followed by the solver.
+#define HSK_FIXTURE_MAX_PATH 8192
+
+/*
+ * Types
+ */
+
+typedef struct hsk_fixture_leaf_s {
+  uint8_t key[32];
+  uint8_t hash[32];
+  uint8_t *value;
+  size_t value_size;
+  size_t seq;
+} hsk_fixture_leaf_t;
+
+// A leaf, or an internal node with a prefix
+// (bits of the keys below it, from `depth`).
+typedef struct hsk_fixture_node_s {
+  bool leaf;
+  size_t index;
+  uint16_t depth;
+  uint16_t prefix_size;
+  uint8_t prefix[32];
+  size_t left;
+  size_t right;
+  uint8_t hash[32];
+} hsk_fixture_node_t;
+
+// An urkel radix tree held in full: insert,
+// commit for the root, then prove against it.
+typedef struct hsk_fixture_tree_s {
+  hsk_fixture_leaf_t *leaves;
+  size_t leaf_count;
+  size_t leaf_cap;
+  hsk_fixture_node_t *nodes;
+  size_t node_count;
+  uint8_t root[32];
+} hsk_fixture_tree_t;
+
+/*
+ * Proof of Work
+ */
+
+bool
+hsk_fixture_solve(
+  const hsk_cuckoo_t *ctx,
+  const uint8_t *key,
+  uint32_t *sol
+);
+
+bool
+hsk_fixture_mine(hsk_header_t *hdr, uint32_t tries);
+
+/*
+ * Tree
+ */
+
+void
+hsk_fixture_tree_init(hsk_fixture_tree_t *tree);
+
+void
+hsk_fixture_tree_uninit(hsk_fixture_tree_t *tree);
+
+bool
+hsk_fixture_tree_insert(
+  hsk_fixture_tree_t *tree,
+  const uint8_t *key,
+  const uint8_t *value,
+  size_t value_size
+);
+
+bool
+hsk_fixture_tree_insert_name(
+  hsk_fixture_tree_t *tree,
+  const char *name,
+  const uint8_t *res,
+  size_t res_size
+);
+
+bool
+hsk_fixture_tree_commit(hsk_fixture_tree_t *tree);
+
+bool
+hsk_fixture_tree_prove(
+  const hsk_fixture_tree_t *tree,
+  const uint8_t *key,
+  hsk_proof_t *proof
+);
+#endif
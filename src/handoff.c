@@ -0,0 +1,646 @@
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "handoff.h"
+#include "log.h"
+#include "mem.h"
+#include "uv.h"
+
+// Sent along with the sockets.
+#define HSK_HANDOFF_MAGIC "hnsd"
+#define HSK_HANDOFF_MAGIC_LEN 4
+
+// Where systemd puts the first one.
+#define HSK_HANDOFF_SYSTEMD_START 3
+
+typedef union hsk_handoff_ctrl_u {
+  struct cmsghdr hdr;
+  char buf[CMSG_SPACE(sizeof(int) * HSK_HANDOFF_MAX)];
+} hsk_handoff_ctrl_t;
+
+/*
+ * Prototypes
+ */
+
+static void
+after_connection(uv_stream_t *server, int status);
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf);
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void
+after_conn_close(uv_handle_t *handle);
+
+static void
+after_reject_close(uv_handle_t *handle);
+
+static void
+after_close(uv_handle_t *handle);
+
+/*
+ * Helpers
+ */
+
+static bool
+hsk_handoff_unix_addr(struct sockaddr_un *un, const char *path) {
+  if (strlen(path) >= sizeof(un->sun_path))
+    return false;
+
+  memset(un, 0, sizeof(*un));
+  un->sun_family = AF_UNIX;
+  strcpy(un->sun_path, path);
+
+  return true;
+}
+
+static void
+hsk_handoff_cloexec(int fd) {
+  int flags = fcntl(fd, F_GETFD, 0);
+
+  if (flags != -1)
+    fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+static void
+hsk_handoff_add(hsk_handoff_t *handoff, int fd) {
+  if (handoff->fd_count == HSK_HANDOFF_MAX) {
+    close(fd);
+    return;
+  }
+
+  hsk_handoff_cloexec(fd);
+
+  handoff->fds[handoff->fd_count++] = fd;
+}
+
+static bool
+hsk_handoff_match(int fd, const struct sockaddr *addr, int type) {
+  struct sockaddr_storage ss;
+  socklen_t ss_len = sizeof(ss);
+  int value;
+  socklen_t value_len = sizeof(value);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &value, &value_len) != 0)
+    return false;
+
+  if (value != type)
+    return false;
+
+  // Listening, not a stray connection.
+  if (type == SOCK_STREAM) {
+    value_len = sizeof(value);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &value, &value_len) != 0)
+      return false;
+
+    if (!value)
+      return false;
+  }
+
+  if (getsockname(fd, (struct sockaddr *)&ss, &ss_len) != 0)
+    return false;
+
+  if (ss.ss_family != addr->sa_family)
+    return false;
+
+  if (addr->sa_family == AF_INET) {
+    const struct sockaddr_in *a = (const struct sockaddr_in *)&ss;
+    const struct sockaddr_in *b = (const struct sockaddr_in *)addr;
+
+    return a->sin_port == b->sin_port
+        && memcmp(&a->sin_addr, &b->sin_addr, sizeof(a->sin_addr)) == 0;
+  }
+
+  if (addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)&ss;
+    const struct sockaddr_in6 *b = (const struct sockaddr_in6 *)addr;
+
+    return a->sin6_port == b->sin6_port
+        && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+  }
+
+  return false;
+}
+
+static int
+hsk_handoff_send(int fd, const int *fds, int count) {
+  char magic[] = HSK_HANDOFF_MAGIC;
+  hsk_handoff_ctrl_t ctrl;
+  struct iovec iov;
+  struct msghdr msg;
+
+  assert(count > 0 && count <= HSK_HANDOFF_MAX);
+
+  memset(&ctrl, 0, sizeof(ctrl));
+  memset(&msg, 0, sizeof(msg));
+
+  iov.iov_base = magic;
+  iov.iov_len = HSK_HANDOFF_MAGIC_LEN;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+  ssize_t n;
+
+  do {
+    n = sendmsg(fd, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n != HSK_HANDOFF_MAGIC_LEN)
+    return HSK_EFAILURE;
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_handoff_recv(hsk_handoff_t *handoff, int fd) {
+  char magic[HSK_HANDOFF_MAGIC_LEN];
+  hsk_handoff_ctrl_t ctrl;
+  struct iovec iov;
+  struct msghdr msg;
+  int flags = 0;
+
+  memset(&ctrl, 0, sizeof(ctrl));
+  memset(&msg, 0, sizeof(msg));
+
+  iov.iov_base = magic;
+  iov.iov_len = sizeof(magic);
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.buf;
+  msg.msg_controllen = sizeof(ctrl.buf);
+
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+  ssize_t n;
+
+  do {
+    n = recvmsg(fd, &msg, flags);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return errno == EAGAIN ? HSK_ETIMEOUT : HSK_EFAILURE;
+
+  struct cmsghdr *cmsg;
+
+  // Whatever came is ours to close.
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    size_t len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const uint8_t *data = CMSG_DATA(cmsg);
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+      int in;
+      memcpy(&in, data + i * sizeof(int), sizeof(int));
+      hsk_handoff_add(handoff, in);
+    }
+  }
+
+  if (n != HSK_HANDOFF_MAGIC_LEN
+      || memcmp(magic, HSK_HANDOFF_MAGIC, HSK_HANDOFF_MAGIC_LEN) != 0) {
+    return HSK_EFAILURE;
+  }
+
+  if (msg.msg_flags & MSG_CTRUNC)
+    return HSK_EFAILURE;
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * Handoff
+ */
+
+void
+hsk_handoff_init(hsk_handoff_t *handoff, const uv_loop_t *loop) {
+  assert(handoff && loop);
+
+  handoff->loop = (uv_loop_t *)loop;
+  handoff->fd_count = 0;
+  handoff->peer = -1;
+  memset(handoff->path, 0, sizeof(handoff->path));
+  handoff->dev = 0;
+  handoff->ino = 0;
+  handoff->listening = false;
+  handoff->connected = false;
+  handoff->collect = NULL;
+  handoff->done = NULL;
+  handoff->arg = NULL;
+}
+
+void
+hsk_handoff_uninit(hsk_handoff_t *handoff) {
+  assert(handoff);
+
+  int i;
+
+  for (i = 0; i < handoff->fd_count; i++)
+    close(handoff->fds[i]);
+
+  handoff->fd_count = 0;
+
+  // The old process carries on.
+  if (handoff->peer != -1) {
+    close(handoff->peer);
+    handoff->peer = -1;
+  }
+}
+
+// Socket activation: only for us, and not
+// passed on to anything we run.
+int
+hsk_handoff_inherit(hsk_handoff_t *handoff) {
+  assert(handoff);
+
+  const char *pid = getenv("LISTEN_PID");
+  const char *fds = getenv("LISTEN_FDS");
+
+  if (!pid || !fds)
+    return HSK_SUCCESS;
+
+  if (atol(pid) != (long)getpid())
+    return HSK_SUCCESS;
+
+  int count = atoi(fds);
+
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+
+  if (count <= 0)
+    return HSK_SUCCESS;
+
+  int i;
+
+  for (i = 0; i < count; i++)
+    hsk_handoff_add(handoff, HSK_HANDOFF_SYSTEMD_START + i);
+
+  hsk_log_printf("handoff: %d sockets from systemd\n", count);
+
+  return HSK_SUCCESS;
+}
+
+// Nothing listening is a fresh start, not an
+// error.
+int
+hsk_handoff_receive(hsk_handoff_t *handoff, const char *path) {
+  assert(handoff && path);
+
+  struct sockaddr_un un;
+
+  if (!hsk_handoff_unix_addr(&un, path))
+    return HSK_EBADARGS;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return HSK_EFAILURE;
+
+  hsk_handoff_cloexec(fd);
+
+  if (connect(fd, (struct sockaddr *)&un, sizeof(un)) != 0) {
+    int err = errno;
+
+    close(fd);
+
+    if (err == ENOENT || err == ECONNREFUSED) {
+      hsk_log_printf("handoff: nothing at %s, starting fresh\n", path);
+      return HSK_SUCCESS;
+    }
+
+    return HSK_EFAILURE;
+  }
+
+  struct timeval tv;
+  tv.tv_sec = HSK_HANDOFF_TIMEOUT / 1000;
+  tv.tv_usec = (HSK_HANDOFF_TIMEOUT % 1000) * 1000;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  int before = handoff->fd_count;
+  int rc = hsk_handoff_recv(handoff, fd);
+
+  if (rc != HSK_SUCCESS) {
+    close(fd);
+    return rc;
+  }
+
+  handoff->peer = fd;
+
+  hsk_log_printf("handoff: %d sockets from %s\n",
+                 handoff->fd_count - before, path);
+
+  return HSK_SUCCESS;
+}
+
+// Returns a socket bound to `addr` (listening,
+// for SOCK_STREAM), or -1. The caller owns it.
+int
+hsk_handoff_take(
+  hsk_handoff_t *handoff,
+  const struct sockaddr *addr,
+  int type
+) {
+  if (!handoff || !addr)
+    return -1;
+
+  int i;
+
+  for (i = 0; i < handoff->fd_count; i++) {
+    int fd = handoff->fds[i];
+
+    if (!hsk_handoff_match(fd, addr, type))
+      continue;
+
+    handoff->fd_count -= 1;
+    handoff->fds[i] = handoff->fds[handoff->fd_count];
+
+    return fd;
+  }
+
+  return -1;
+}
+
+// Once our servers are open: the old process
+// stops, and whatever we did not take (fewer
+// workers, say) is closed.
+int
+hsk_handoff_ready(hsk_handoff_t *handoff) {
+  assert(handoff);
+
+  int rc = HSK_SUCCESS;
+
+  if (handoff->peer != -1) {
+    ssize_t n;
+
+    do {
+      n = write(handoff->peer, "1", 1);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != 1)
+      rc = HSK_EFAILURE;
+
+    close(handoff->peer);
+    handoff->peer = -1;
+  }
+
+  if (handoff->fd_count > 0) {
+    hsk_log_printf("handoff: closing %d unused sockets\n",
+                   handoff->fd_count);
+  }
+
+  hsk_handoff_uninit(handoff);
+
+  return rc;
+}
+
+// Bound by hand rather than with uv_pipe_bind:
+// libuv would unlink the path on close, by
+// then the next process's socket.
+int
+hsk_handoff_open(
+  hsk_handoff_t *handoff,
+  const char *path,
+  hsk_handoff_collect_cb collect,
+  hsk_handoff_done_cb done,
+  void *arg
+) {
+  if (!handoff || !path || !collect || !done)
+    return HSK_EBADARGS;
+
+  if (handoff->listening)
+    return HSK_EFAILURE;
+
+  struct sockaddr_un un;
+
+  if (!hsk_handoff_unix_addr(&un, path))
+    return HSK_EBADARGS;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return HSK_EFAILURE;
+
+  hsk_handoff_cloexec(fd);
+
+  // The old process's, or left behind by an
+  // unclean exit.
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0) {
+    hsk_log_printf("handoff: could not bind %s: %s\n",
+                   path, strerror(errno));
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  struct stat st;
+
+  // Whoever connects gets our sockets.
+  if (chmod(path, S_IRUSR | S_IWUSR) != 0 || stat(path, &st) != 0) {
+    unlink(path);
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  if (uv_pipe_init(handoff->loop, &handoff->pipe, 0) != 0) {
+    unlink(path);
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  handoff->pipe.data = (void *)handoff;
+  handoff->listening = true;
+
+  strcpy(handoff->path, path);
+  handoff->dev = (uint64_t)st.st_dev;
+  handoff->ino = (uint64_t)st.st_ino;
+  handoff->collect = collect;
+  handoff->done = done;
+  handoff->arg = arg;
+
+  if (uv_pipe_open(&handoff->pipe, fd) != 0) {
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  if (uv_listen((uv_stream_t *)&handoff->pipe, 1, after_connection) != 0)
+    return HSK_EFAILURE;
+
+  // Does not keep the loop alive by itself.
+  uv_unref((uv_handle_t *)&handoff->pipe);
+
+  hsk_log_printf("handoff: listening on %s\n", path);
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_handoff_close(hsk_handoff_t *handoff) {
+  if (!handoff)
+    return HSK_EBADARGS;
+
+  // A drop already underway finishes itself.
+  if (handoff->connected && !uv_is_closing((uv_handle_t *)&handoff->conn))
+    uv_close((uv_handle_t *)&handoff->conn, after_conn_close);
+
+  if (!handoff->listening)
+    return HSK_SUCCESS;
+
+  uv_close((uv_handle_t *)&handoff->pipe, after_close);
+  handoff->listening = false;
+
+  struct stat st;
+
+  // Unless a new process has taken the path.
+  if (stat(handoff->path, &st) == 0
+      && (uint64_t)st.st_dev == handoff->dev
+      && (uint64_t)st.st_ino == handoff->ino) {
+    unlink(handoff->path);
+  }
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_handoff_drop(hsk_handoff_t *handoff) {
+  assert(handoff->connected);
+  uv_close((uv_handle_t *)&handoff->conn, after_conn_close);
+}
+
+// One at a time.
+static void
+hsk_handoff_reject(uv_stream_t *server) {
+  uv_pipe_t *conn = hsk_malloc(sizeof(uv_pipe_t));
+
+  if (!conn)
+    return;
+
+  if (uv_pipe_init(server->loop, conn, 0) != 0) {
+    hsk_free(conn);
+    return;
+  }
+
+  uv_accept(server, (uv_stream_t *)conn);
+  uv_close((uv_handle_t *)conn, after_reject_close);
+}
+
+static void
+after_connection(uv_stream_t *server, int status) {
+  hsk_handoff_t *handoff = (hsk_handoff_t *)server->data;
+
+  if (status != 0)
+    return;
+
+  if (handoff->connected) {
+    hsk_handoff_reject(server);
+    return;
+  }
+
+  if (uv_pipe_init(handoff->loop, &handoff->conn, 0) != 0)
+    return;
+
+  handoff->conn.data = (void *)handoff;
+  handoff->connected = true;
+
+  if (uv_accept(server, (uv_stream_t *)&handoff->conn) != 0) {
+    hsk_handoff_drop(handoff);
+    return;
+  }
+
+  uv_os_fd_t fd;
+  int fds[HSK_HANDOFF_MAX];
+  int count = handoff->collect(handoff->arg, fds, HSK_HANDOFF_MAX);
+
+  if (count <= 0
+      || uv_fileno((uv_handle_t *)&handoff->conn, &fd) != 0
+      || hsk_handoff_send(fd, fds, count) != HSK_SUCCESS) {
+    hsk_log_printf("handoff: could not send sockets\n");
+    hsk_handoff_drop(handoff);
+    return;
+  }
+
+  hsk_log_printf("handoff: sent %d sockets, waiting on the new process\n",
+                 count);
+
+  uv_stream_t *stream = (uv_stream_t *)&handoff->conn;
+
+  if (uv_read_start(stream, alloc_conn, after_conn_read) != 0)
+    hsk_handoff_drop(handoff);
+}
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
+  static char slab[16];
+
+  buf->base = slab;
+  buf->len = sizeof(slab);
+}
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  hsk_handoff_t *handoff = (hsk_handoff_t *)stream->data;
+
+  if (nread == 0)
+    return;
+
+  if (nread < 0) {
+    hsk_log_printf("handoff: new process went away, carrying on\n");
+    hsk_handoff_drop(handoff);
+    return;
+  }
+
+  hsk_log_printf("handoff: new process is up, stopping\n");
+
+  hsk_handoff_drop(handoff);
+
+  handoff->done(handoff->arg);
+}
+
+static void
+after_conn_close(uv_handle_t *handle) {
+  hsk_handoff_t *handoff = (hsk_handoff_t *)handle->data;
+  handoff->connected = false;
+}
+
+static void
+after_reject_close(uv_handle_t *handle) {
+  hsk_free(handle);
+}
+
+static void
+after_close(uv_handle_t *handle) {}
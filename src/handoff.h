@@ -0,0 +1,101 @@
+#ifndef _HSK_HANDOFF_H
+#define _HSK_HANDOFF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "uv.h"
+
+// Restarting without closing the DNS sockets.
+// The new process connects to the old one's
+// handoff socket (unix domain, owner only):
+//   1. The old one writes out its cache and
+//      sends its listening sockets over
+//      (SCM_RIGHTS), then keeps answering.
+//   2. The new one loads the chain and cache
+//      from the prefix, opens its servers on
+//      the sockets it was given and writes one
+//      byte back.
+//   3. The old one stops.
+// Queries are answered by one process or the
+// other throughout. Should the new one fail
+// to start, the old one carries on.
+//
+// Sockets passed by systemd (LISTEN_FDS) are
+// taken the same way.
+#define HSK_HANDOFF_MAX 64
+
+// How long the new process waits on the old.
+#define HSK_HANDOFF_TIMEOUT 10000
+
+/*
+ * Types
+ */
+
+// Fills `fds` with the sockets to hand over,
+// returning how many.
+typedef int (*hsk_handoff_collect_cb)(void *arg, int *fds, int max);
+
+// The new process is up.
+typedef void (*hsk_handoff_done_cb)(void *arg);
+
+typedef struct hsk_handoff_s {
+  uv_loop_t *loop;
+  // Inherited, not yet taken.
+  int fds[HSK_HANDOFF_MAX];
+  int fd_count;
+  // To the old process, until we are up.
+  int peer;
+  // Serving the next process.
+  char path[1024];
+  uint64_t dev;
+  uint64_t ino;
+  uv_pipe_t pipe;
+  bool listening;
+  uv_pipe_t conn;
+  bool connected;
+  hsk_handoff_collect_cb collect;
+  hsk_handoff_done_cb done;
+  void *arg;
+} hsk_handoff_t;
+
+/*
+ * Handoff
+ */
+
+void
+hsk_handoff_init(hsk_handoff_t *handoff, const uv_loop_t *loop);
+
+void
+hsk_handoff_uninit(hsk_handoff_t *handoff);
+
+int
+hsk_handoff_inherit(hsk_handoff_t *handoff);
+
+int
+hsk_handoff_receive(hsk_handoff_t *handoff, const char *path);
+
+int
+hsk_handoff_take(
+  hsk_handoff_t *handoff,
+  const struct sockaddr *addr,
+  int type
+);
+
+int
+hsk_handoff_ready(hsk_handoff_t *handoff);
+
+int
+hsk_handoff_open(
+  hsk_handoff_t *handoff,
+  const char *path,
+  hsk_handoff_collect_cb collect,
+  hsk_handoff_done_cb done,
+  void *arg
+);
+
+int
+hsk_handoff_close(hsk_handoff_t *handoff);
+#endif
@@ -6,12 +6,14 @@
 #include <stdio.h>
 
 #include "bio.h"
-#include "bn.h"
+#include "blake2b.h"
 #include "constants.h"
 #include "cuckoo.h"
 #include "error.h"
 #include "hash.h"
 #include "header.h"
+#include "mem.h"
+#include "u256.h"
 #include "utils.h"
 
 void
@@ -32,6 +34,9 @@ hsk_header_init(hsk_header_t *hdr) {
 
   hdr->cache = false;
   memset(hdr->hash, 0, 32);
+  hdr->prepared = false;
+  memset(hdr->key, 0, 32);
+  memset(hdr->sol_hash, 0, 32);
   hdr->height = 0;
   memset(hdr->work, 0, 32);
 
@@ -40,7 +45,7 @@ hsk_header_init(hsk_header_t *hdr) {
 
 hsk_header_t *
 hsk_header_alloc(void) {
-  hsk_header_t *hdr = malloc(sizeof(hsk_header_t));
+  hsk_header_t *hdr = hsk_malloc(sizeof(hsk_header_t));
   hsk_header_init(hdr);
   return hdr;
 }
@@ -50,7 +55,7 @@ hsk_header_clone(const hsk_header_t *hdr) {
   if (!hdr)
     return NULL;
 
-  hsk_header_t *copy = malloc(sizeof(hsk_header_t));
+  hsk_header_t *copy = hsk_malloc(sizeof(hsk_header_t));
 
   if (!copy)
     return NULL;
@@ -149,46 +154,55 @@ hsk_pow_to_bits(const uint8_t *target, uint32_t *bits) {
 }
 
 bool
-hsk_header_get_proof(const hsk_header_t *hdr, uint8_t *proof) {
+hsk_pow_to_proof(uint32_t bits, uint8_t *proof) {
   uint8_t target[32];
 
-  if (!hsk_pow_to_target(hdr->bits, target))
+  if (!hsk_pow_to_target(bits, target))
     return false;
 
-  hsk_bn_t max_bn;
-  hsk_bn_from_int(&max_bn, 1);
-  hsk_bn_lshift(&max_bn, &max_bn, 256);
+  hsk_u256_t target_n, one, not_n, proof_n;
+  int i;
+
+  hsk_u256_from_array(&target_n, target);
+  hsk_u256_from_int(&one, 1);
 
-  hsk_bn_t target_bn;
-  hsk_bn_from_array(&target_bn, target, 32);
-  hsk_bn_inc(&target_bn);
+  for (i = 0; i < 4; i++)
+    not_n.limbs[i] = ~target_n.limbs[i];
 
-  // (1 << 256) / (target + 1)
-  hsk_bn_div(&max_bn, &target_bn, &target_bn);
+  // (1 << 256) / (target + 1), which is
+  // ~target / (target + 1) + 1 in 256 bits.
+  if (hsk_u256_add(&target_n, &target_n, &one)) {
+    hsk_u256_from_int(&proof_n, 1);
+  } else {
+    hsk_u256_div(&proof_n, &not_n, &target_n);
+    hsk_u256_add(&proof_n, &proof_n, &one);
+  }
 
-  hsk_bn_to_array(&target_bn, proof, 32);
+  hsk_u256_to_array(&proof_n, proof);
 
   return true;
 }
 
+bool
+hsk_header_get_proof(const hsk_header_t *hdr, uint8_t *proof) {
+  return hsk_pow_to_proof(hdr->bits, proof);
+}
+
 bool
 hsk_header_calc_work(hsk_header_t *hdr, const hsk_header_t *prev) {
   if (!prev)
     return hsk_header_get_proof(hdr, hdr->work);
 
-  hsk_bn_t prev_bn;
-  hsk_bn_from_array(&prev_bn, prev->work, 32);
-
   uint8_t proof[32];
 
   if (!hsk_header_get_proof(hdr, proof))
     return false;
 
-  hsk_bn_t proof_bn;
-  hsk_bn_from_array(&proof_bn, proof, 32);
-
-  hsk_bn_add(&prev_bn, &proof_bn, &proof_bn);
-  hsk_bn_to_array(&proof_bn, hdr->work, 32);
+  hsk_u256_t work_n, proof_n;
+  hsk_u256_from_array(&work_n, prev->work);
+  hsk_u256_from_array(&proof_n, proof);
+  hsk_u256_add(&work_n, &work_n, &proof_n);
+  hsk_u256_to_array(&work_n, hdr->work);
 
   return true;
 }
@@ -227,41 +241,59 @@ encode_sol(uint8_t *data, const uint32_t *sol, uint8_t sol_size) {
   return write_sol(&data, sol, sol_size);
 }
 
-bool
-hsk_header_read(uint8_t **data, size_t *data_len, hsk_header_t *hdr) {
-  if (!read_u32(data, data_len, &hdr->version))
-    return false;
+// Hash a header straight from its serialization.
+// The preheader is a prefix of the full header,
+// so both BLAKE2b digests share a context up to
+// the solution size byte.
+static void
+hsk_header_prepare(hsk_header_t *hdr, const uint8_t *raw, size_t raw_len) {
+  hsk_blake2b_ctx ctx;
+  hsk_blake2b_ctx pre;
 
-  if (!read_bytes(data, data_len, hdr->prev_block, 32))
-    return false;
+  assert(raw_len >= 165);
 
-  if (!read_bytes(data, data_len, hdr->merkle_root, 32))
-    return false;
+  assert(hsk_blake2b_init(&ctx, 32) == 0);
+  hsk_blake2b_update(&ctx, raw, 164);
 
-  if (!read_bytes(data, data_len, hdr->name_root, 32))
-    return false;
+  pre = ctx;
+  hsk_blake2b_final(&pre, hdr->key, 32);
 
-  if (!read_bytes(data, data_len, hdr->reserved_root, 32))
-    return false;
+  hsk_blake2b_update(&ctx, raw + 164, raw_len - 164);
+  hsk_blake2b_final(&ctx, hdr->hash, 32);
 
-  if (!read_u64(data, data_len, &hdr->time))
-    return false;
+  hsk_hash_sha3(raw + 165, raw_len - 165, hdr->sol_hash);
 
-  if (!read_u32(data, data_len, &hdr->bits))
-    return false;
+  hdr->cache = true;
+  hdr->prepared = true;
+}
 
-  if (!read_bytes(data, data_len, hdr->nonce, 20))
-    return false;
+bool
+hsk_header_read(uint8_t **data, size_t *data_len, hsk_header_t *hdr) {
+  uint8_t *p;
 
-  if (!read_u8(data, data_len, &hdr->sol_size))
+  // Everything up to the solution.
+  if (!slice_bytes(data, data_len, &p, 165))
     return false;
 
+  hdr->version = get_u32(p);
+  memcpy(hdr->prev_block, p + 4, 32);
+  memcpy(hdr->merkle_root, p + 36, 32);
+  memcpy(hdr->name_root, p + 68, 32);
+  memcpy(hdr->reserved_root, p + 100, 32);
+  hdr->time = get_u64(p + 132);
+  hdr->bits = get_u32(p + 140);
+  memcpy(hdr->nonce, p + 144, 20);
+  hdr->sol_size = p[164];
+
   if (hdr->sol_size > 42)
     return false;
 
   if (!read_sol(data, data_len, hdr->sol, hdr->sol_size))
     return false;
 
+  // The solution follows the slice directly.
+  hsk_header_prepare(hdr, p, 165 + (((size_t)hdr->sol_size) << 2));
+
   return true;
 }
 
@@ -347,6 +379,11 @@ hsk_header_hash(hsk_header_t *hdr, uint8_t *hash) {
 
 void
 hsk_header_hash_pre(const hsk_header_t *hdr, uint8_t *hash) {
+  if (hdr->prepared) {
+    memcpy(hash, hdr->key, 32);
+    return;
+  }
+
   int size = hsk_header_size_pre(hdr);
   uint8_t raw[size];
 
@@ -356,6 +393,11 @@ hsk_header_hash_pre(const hsk_header_t *hdr, uint8_t *hash) {
 
 void
 hsk_header_hash_sol(const hsk_header_t *hdr, uint8_t *hash) {
+  if (hdr->prepared) {
+    memcpy(hash, hdr->sol_hash, 32);
+    return;
+  }
+
   int size = ((int)hdr->sol_size) << 2;
   uint8_t raw[size];
   encode_sol(raw, hdr->sol, hdr->sol_size);
@@ -369,31 +411,19 @@ hsk_header_verify_pow(const hsk_header_t *hdr) {
   if (!hsk_pow_to_target(hdr->bits, target))
     return HSK_ENEGTARGET;
 
-  int size = ((int)hdr->sol_size) << 2;
-
-  uint8_t raw[size];
-  encode_sol(raw, hdr->sol, hdr->sol_size);
-
   uint8_t hash[32];
-  hsk_hash_sha3(raw, size, hash);
+  hsk_header_hash_sol(hdr, hash);
 
   if (memcmp(hash, target, 32) > 0)
     return HSK_EHIGHHASH;
 
-  hsk_cuckoo_t ctx;
-
-  assert(hsk_cuckoo_init(&ctx,
-    HSK_CUCKOO_BITS,
-    HSK_CUCKOO_SIZE,
-    HSK_CUCKOO_PERC,
-    HSK_CUCKOO_LEGACY
-  ) == 0);
+  if (hdr->sol_size != HSK_CUCKOO_SIZE)
+    return HSK_EPOWPROOFSIZE;
 
-  size_t psize = hsk_header_size_pre(hdr);
-  uint8_t pre[psize];
-  hsk_header_encode_pre(hdr, pre);
+  uint8_t key[32];
+  hsk_header_hash_pre(hdr, key);
 
-  return hsk_cuckoo_verify_header(&ctx, pre, psize, hdr->sol, hdr->sol_size);
+  return hsk_cuckoo_verify_network(key, hdr->sol);
 }
 
 void
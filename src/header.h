@@ -19,6 +19,14 @@ typedef struct hsk_header_s {
 
   bool cache;
   uint8_t hash[32];
+
+  // Digests taken from the wire bytes when the
+  // header is read: the cuckoo key (hash of the
+  // preheader) and the solution hash.
+  bool prepared;
+  uint8_t key[32];
+  uint8_t sol_hash[32];
+
   uint32_t height;
   uint8_t work[32];
 
@@ -40,6 +48,9 @@ hsk_pow_to_target(uint32_t bits, uint8_t *target);
 bool
 hsk_pow_to_bits(const uint8_t *target, uint32_t *bits);
 
+bool
+hsk_pow_to_proof(uint32_t bits, uint8_t *proof);
+
 bool
 hsk_header_get_proof(const hsk_header_t *hdr, uint8_t *proof);
 
@@ -0,0 +1,345 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmap.h"
+#include "mem.h"
+
+#define HSK_HMAP_MIN 16
+
+// Old buckets moved per write while growing.
+// Tables up to a few times this are rehashed
+// at once.
+#define HSK_HMAP_STEP 256
+#define HSK_HMAP_EAGER (HSK_HMAP_STEP * 4)
+
+// Left in the old table where an entry was
+// (moved or deleted), so that probing carries
+// on past it.
+static const uint8_t hsk_hmap_tomb[32];
+
+static inline uint64_t
+hsk_hmap_tag(const uint8_t *key) {
+  uint64_t tag;
+  memcpy(&tag, &key[24], sizeof(tag));
+  return tag;
+}
+
+// Linear probing from the tag's low bits.
+// Returns the slot holding the key, or the
+// empty slot ending its run.
+static uint32_t
+hsk_hmap_find(
+  const hsk_hmap_entry_t *entries,
+  uint32_t n_buckets,
+  const uint8_t *key,
+  uint64_t tag
+) {
+  uint32_t mask = n_buckets - 1;
+  uint32_t i = (uint32_t)tag & mask;
+
+  for (;;) {
+    const hsk_hmap_entry_t *e = &entries[i];
+
+    if (!e->key)
+      return i;
+
+    if (e->tag == tag
+        && e->key != hsk_hmap_tomb
+        && memcmp(e->key, key, 32) == 0) {
+      return i;
+    }
+
+    i = (i + 1) & mask;
+  }
+}
+
+// The entry for a key still in the old table,
+// if any.
+static hsk_hmap_entry_t *
+hsk_hmap_find_old(const hsk_hmap_t *map, const uint8_t *key, uint64_t tag) {
+  if (!map->old)
+    return NULL;
+
+  uint32_t i = hsk_hmap_find(map->old, map->old_buckets, key, tag);
+
+  if (!map->old[i].key)
+    return NULL;
+
+  return &map->old[i];
+}
+
+static void
+hsk_hmap_insert(hsk_hmap_t *map, const hsk_hmap_entry_t *entry) {
+  uint32_t mask = map->n_buckets - 1;
+  uint32_t j = (uint32_t)entry->tag & mask;
+
+  while (map->entries[j].key)
+    j = (j + 1) & mask;
+
+  map->entries[j] = *entry;
+}
+
+static void
+hsk_hmap_move(hsk_hmap_t *map, uint32_t count) {
+  if (!map->old)
+    return;
+
+  uint32_t end = map->moved + count;
+
+  if (end > map->old_buckets || end < map->moved)
+    end = map->old_buckets;
+
+  for (; map->moved < end; map->moved++) {
+    hsk_hmap_entry_t *e = &map->old[map->moved];
+
+    if (!e->key || e->key == hsk_hmap_tomb)
+      continue;
+
+    hsk_hmap_insert(map, e);
+
+    e->tag = 0;
+    e->key = hsk_hmap_tomb;
+    e->value = NULL;
+  }
+
+  if (map->moved == map->old_buckets) {
+    hsk_free(map->old);
+    map->old = NULL;
+    map->old_buckets = 0;
+    map->moved = 0;
+  }
+}
+
+static bool
+hsk_hmap_resize(hsk_hmap_t *map, uint32_t n_buckets) {
+  hsk_hmap_settle(map);
+
+  hsk_hmap_entry_t *entries = hsk_calloc(n_buckets, sizeof(hsk_hmap_entry_t));
+
+  if (!entries)
+    return false;
+
+  map->old = map->entries;
+  map->old_buckets = map->n_buckets;
+  map->moved = 0;
+  map->entries = entries;
+  map->n_buckets = n_buckets;
+
+  if (map->old_buckets <= HSK_HMAP_EAGER)
+    hsk_hmap_settle(map);
+
+  return true;
+}
+
+void
+hsk_hmap_init(hsk_hmap_t *map, hsk_map_free_func free_func) {
+  assert(map);
+  map->entries = NULL;
+  map->n_buckets = 0;
+  map->size = 0;
+  map->old = NULL;
+  map->old_buckets = 0;
+  map->moved = 0;
+  map->free_func = free_func;
+}
+
+void
+hsk_hmap_uninit(hsk_hmap_t *map) {
+  if (!map)
+    return;
+
+  hsk_hmap_clear(map);
+
+  if (map->entries) {
+    hsk_free(map->entries);
+    map->entries = NULL;
+  }
+
+  map->n_buckets = 0;
+}
+
+void
+hsk_hmap_clear(hsk_hmap_t *map) {
+  uint32_t i;
+
+  hsk_hmap_settle(map);
+
+  for (i = 0; i < map->n_buckets; i++) {
+    hsk_hmap_entry_t *e = &map->entries[i];
+
+    if (!e->key)
+      continue;
+
+    if (map->free_func && e->value)
+      map->free_func(e->value);
+
+    e->tag = 0;
+    e->key = NULL;
+    e->value = NULL;
+  }
+
+  map->size = 0;
+}
+
+// Presized from an expected count (the height
+// of a stored chain), growing can be skipped.
+bool
+hsk_hmap_reserve(hsk_hmap_t *map, uint32_t count) {
+  uint64_t need = ((uint64_t)count * 4 + 2) / 3;
+  uint64_t n_buckets = map->n_buckets ? map->n_buckets : HSK_HMAP_MIN;
+
+  while (n_buckets < need)
+    n_buckets *= 2;
+
+  if (n_buckets > UINT32_MAX / 2 + 1)
+    return false;
+
+  if (n_buckets == map->n_buckets)
+    return true;
+
+  if (!hsk_hmap_resize(map, (uint32_t)n_buckets))
+    return false;
+
+  hsk_hmap_settle(map);
+
+  return true;
+}
+
+// Finish moving entries over from the table
+// being grown out of.
+void
+hsk_hmap_settle(hsk_hmap_t *map) {
+  if (map->old)
+    hsk_hmap_move(map, map->old_buckets);
+}
+
+bool
+hsk_hmap_set(hsk_hmap_t *map, const uint8_t *key, void *value) {
+  assert(key);
+
+  // Keep the load at or under 3/4. A doubled
+  // table starts at 3/8: the old one is gone
+  // long before it fills up again.
+  if ((uint64_t)(map->size + 1) * 4 > (uint64_t)map->n_buckets * 3) {
+    uint32_t n_buckets = map->n_buckets ? map->n_buckets * 2 : HSK_HMAP_MIN;
+
+    if (n_buckets == 0 || !hsk_hmap_resize(map, n_buckets))
+      return false;
+  }
+
+  uint64_t tag = hsk_hmap_tag(key);
+  uint32_t i = hsk_hmap_find(map->entries, map->n_buckets, key, tag);
+  hsk_hmap_entry_t *e = &map->entries[i];
+
+  if (!e->key) {
+    hsk_hmap_entry_t *o = hsk_hmap_find_old(map, key, tag);
+
+    if (o)
+      e = o;
+    else
+      map->size += 1;
+  }
+
+  // The key is replaced too: it usually lives
+  // in the value it came with.
+  e->tag = tag;
+  e->key = key;
+  e->value = value;
+
+  hsk_hmap_move(map, HSK_HMAP_STEP);
+
+  return true;
+}
+
+void *
+hsk_hmap_get(const hsk_hmap_t *map, const uint8_t *key) {
+  if (map->size == 0)
+    return NULL;
+
+  uint64_t tag = hsk_hmap_tag(key);
+  uint32_t i = hsk_hmap_find(map->entries, map->n_buckets, key, tag);
+
+  if (map->entries[i].key)
+    return map->entries[i].value;
+
+  hsk_hmap_entry_t *o = hsk_hmap_find_old(map, key, tag);
+
+  return o ? o->value : NULL;
+}
+
+bool
+hsk_hmap_has(const hsk_hmap_t *map, const uint8_t *key) {
+  if (map->size == 0)
+    return false;
+
+  uint64_t tag = hsk_hmap_tag(key);
+  uint32_t i = hsk_hmap_find(map->entries, map->n_buckets, key, tag);
+
+  if (map->entries[i].key)
+    return true;
+
+  return hsk_hmap_find_old(map, key, tag) != NULL;
+}
+
+bool
+hsk_hmap_del(hsk_hmap_t *map, const uint8_t *key) {
+  if (map->size == 0)
+    return false;
+
+  uint64_t tag = hsk_hmap_tag(key);
+  uint32_t mask = map->n_buckets - 1;
+  uint32_t i = hsk_hmap_find(map->entries, map->n_buckets, key, tag);
+
+  if (!map->entries[i].key) {
+    hsk_hmap_entry_t *o = hsk_hmap_find_old(map, key, tag);
+
+    if (!o)
+      return false;
+
+    o->tag = 0;
+    o->key = hsk_hmap_tomb;
+    o->value = NULL;
+
+    map->size -= 1;
+
+    hsk_hmap_move(map, HSK_HMAP_STEP);
+
+    return true;
+  }
+
+  // Backward shift: pull later entries of the
+  // run into the hole unless that would move
+  // one before its home slot. No tombstones.
+  uint32_t j = i;
+
+  for (;;) {
+    j = (j + 1) & mask;
+
+    hsk_hmap_entry_t *e = &map->entries[j];
+
+    if (!e->key)
+      break;
+
+    uint32_t home = (uint32_t)e->tag & mask;
+
+    if (((j - home) & mask) < ((j - i) & mask))
+      continue;
+
+    map->entries[i] = *e;
+    i = j;
+  }
+
+  map->entries[i].tag = 0;
+  map->entries[i].key = NULL;
+  map->entries[i].value = NULL;
+  map->size -= 1;
+
+  hsk_hmap_move(map, HSK_HMAP_STEP);
+
+  return true;
+}
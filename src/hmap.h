@@ -0,0 +1,71 @@
+#ifndef _HSK_HMAP_H
+#define _HSK_HMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "map.h"
+
+// An open addressing map keyed by 32 byte
+// digests (block hashes). The digest itself
+// is the hash: the last eight bytes, which
+// proof of work leaves random, are kept next
+// to the value and compared before the key.
+// Keys are not copied and must outlive their
+// entries, as with hsk_map_t.
+//
+// Large tables grow incrementally: the old one
+// is kept and a few of its buckets are moved
+// over on every write, while reads look in
+// both. Iterating only sees the new table:
+// settle the map first.
+typedef struct hsk_hmap_entry_s {
+  uint64_t tag;
+  const uint8_t *key;
+  void *value;
+} hsk_hmap_entry_t;
+
+typedef struct hsk_hmap_s {
+  hsk_hmap_entry_t *entries;
+  uint32_t n_buckets;
+  uint32_t size;
+  hsk_hmap_entry_t *old;
+  uint32_t old_buckets;
+  uint32_t moved;
+  hsk_map_free_func free_func;
+} hsk_hmap_t;
+
+#define hsk_hmap_begin(map) ((uint32_t)0)
+#define hsk_hmap_end(map) ((map)->n_buckets)
+#define hsk_hmap_exists(map, i) ((map)->entries[i].key != NULL)
+#define hsk_hmap_key(map, i) ((map)->entries[i].key)
+#define hsk_hmap_value(map, i) ((map)->entries[i].value)
+
+void
+hsk_hmap_init(hsk_hmap_t *map, hsk_map_free_func free_func);
+
+void
+hsk_hmap_uninit(hsk_hmap_t *map);
+
+void
+hsk_hmap_clear(hsk_hmap_t *map);
+
+bool
+hsk_hmap_reserve(hsk_hmap_t *map, uint32_t count);
+
+void
+hsk_hmap_settle(hsk_hmap_t *map);
+
+bool
+hsk_hmap_set(hsk_hmap_t *map, const uint8_t *key, void *value);
+
+void *
+hsk_hmap_get(const hsk_hmap_t *map, const uint8_t *key);
+
+bool
+hsk_hmap_has(const hsk_hmap_t *map, const uint8_t *key);
+
+bool
+hsk_hmap_del(hsk_hmap_t *map, const uint8_t *key);
+#endif
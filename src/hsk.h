@@ -8,6 +8,7 @@
 #include "blake2b.h"
 #include "bn.h"
 #include "brontide.h"
+#include "cache.h"
 #include "chain.h"
 #include "constants.h"
 #include "cuckoo.h"
@@ -15,21 +16,32 @@
 #include "dnssec.h"
 #include "ec.h"
 #include "ecc.h"
+#include "entry.h"
 #include "error.h"
 // #include "genesis.h"
 #include "hash.h"
 #include "header.h"
+#include "icann.h"
+#include "log.h"
 #include "map.h"
+#include "mem.h"
 #include "msg.h"
+#include "orphan.h"
+#include "prof.h"
 #include "proof.h"
 #include "random.h"
 #include "req.h"
+#include "resolver.h"
 #include "resource.h"
 // #include "seeds.h"
 #include "sha256.h"
 #include "sig0.h"
 #include "siphash.h"
+#include "slab.h"
+#include "store.h"
 #include "timedata.h"
+#include "trace.h"
 #include "utils.h"
+#include "wheel.h"
 
 #endif
@@ -0,0 +1,139 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "error.h"
+#include "icann.h"
+#include "mem.h"
+#include "resource.h"
+#include "tld.h"
+#include "tld-hash.h"
+#include "uv.h"
+
+static hsk_resource_t *hsk_icann = NULL;
+static bool hsk_icann_valid[HSK_TLD_SIZE];
+static uv_once_t hsk_icann_once = UV_ONCE_INIT;
+
+static int
+hsk_tld_index(const char *name) {
+  // FNV-1a, lowercased (see tld-hash.h).
+  uint32_t hash = 0x811c9dc5;
+
+  for (const char *s = name; *s; s++) {
+    char ch = *s;
+
+    if (ch >= 'A' && ch <= 'Z')
+      ch += ' ';
+
+    hash ^= (uint8_t)ch;
+    hash *= 0x01000193;
+  }
+
+  uint32_t slot = hash & (HSK_TLD_HASH_SIZE - 1);
+
+  for (int i = 0; i < HSK_TLD_HASH_PROBES; i++) {
+    uint16_t index = HSK_TLD_HASH[slot];
+
+    if (index == HSK_TLD_HASH_EMPTY)
+      break;
+
+    if (strcasecmp(HSK_TLD_NAMES[index], name) == 0)
+      return index;
+
+    slot = (slot + 1) & (HSK_TLD_HASH_SIZE - 1);
+  }
+
+  return -1;
+}
+
+static bool
+hsk_icann_decode(int index, hsk_resource_t **res) {
+  const uint8_t *item = (const uint8_t *)HSK_TLD_DATA[index];
+  const uint8_t *raw = &item[2];
+  size_t raw_len = (((size_t)item[1]) << 8) | ((size_t)item[0]);
+
+  return hsk_resource_decode(raw, raw_len, res);
+}
+
+// Decode the whole ICANN root zone into one
+// table, shared by every thread and kept for
+// the life of the process.
+static void
+hsk_icann_build(void) {
+  hsk_resource_t *table = hsk_calloc(HSK_TLD_SIZE, sizeof(hsk_resource_t));
+
+  if (!table)
+    return;
+
+  for (int i = 0; i < HSK_TLD_SIZE; i++) {
+    hsk_resource_t *res = NULL;
+
+    if (!hsk_icann_decode(i, &res))
+      continue;
+
+    // Move the records into the table.
+    memcpy(&table[i], res, sizeof(hsk_resource_t));
+    hsk_free(res);
+
+    hsk_icann_valid[i] = true;
+  }
+
+  hsk_icann = table;
+}
+
+void
+hsk_icann_load(void) {
+  uv_once(&hsk_icann_once, hsk_icann_build);
+}
+
+bool
+hsk_icann_shared(const hsk_resource_t *res) {
+  if (!hsk_icann)
+    return false;
+
+  return res >= &hsk_icann[0] && res < &hsk_icann[HSK_TLD_SIZE];
+}
+
+int
+hsk_icann_size(void) {
+  return HSK_TLD_SIZE;
+}
+
+const char *
+hsk_icann_name(int index) {
+  assert(index >= 0 && index < HSK_TLD_SIZE);
+  return HSK_TLD_NAMES[index];
+}
+
+// Leaves res NULL for a name that is not an
+// ICANN TLD.
+int
+hsk_icann_lookup(const char *name, hsk_resource_t **res) {
+  hsk_icann_load();
+
+  *res = NULL;
+
+  int index = hsk_tld_index(name);
+
+  if (index == -1)
+    return HSK_SUCCESS;
+
+  if (hsk_icann && hsk_icann_valid[index]) {
+    *res = &hsk_icann[index];
+    return HSK_SUCCESS;
+  }
+
+  // The table could not be built.
+  if (!hsk_icann_decode(index, res)) {
+    *res = NULL;
+    return HSK_EFAILURE;
+  }
+
+  return HSK_SUCCESS;
+}
+
@@ -0,0 +1,28 @@
+#ifndef _HSK_ICANN_H
+#define _HSK_ICANN_H
+
+#include <stdbool.h>
+
+#include "resource.h"
+
+// Builds the table of ICANN TLDs, once. Call
+// before other threads look names up, or the
+// first lookup pays for it.
+void
+hsk_icann_load(void);
+
+// Resources from the table are shared and must
+// not be freed.
+int
+hsk_icann_lookup(const char *name, hsk_resource_t **res);
+
+bool
+hsk_icann_shared(const hsk_resource_t *res);
+
+// The TLDs in the table, in order.
+int
+hsk_icann_size(void);
+
+const char *
+hsk_icann_name(int index);
+#endif
@@ -0,0 +1,876 @@
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bio.h"
+#include "dns.h"
+#include "error.h"
+#include "ipc.h"
+#include "log.h"
+#include "mem.h"
+#include "ns.h"
+#include "uv.h"
+
+// Frames are handled in turn, up to
+// HSK_IPC_PENDING at once; the rest wait in
+// the buffer (and reading stops once it fills,
+// or while that many are out). At EOF, what
+// was sent is answered before the connection
+// closes.
+typedef struct hsk_ipc_conn_s {
+  hsk_ipc_t *ipc;
+  uv_pipe_t socket;
+  uv_shutdown_t shutdown;
+  uint8_t buf[4 + HSK_IPC_REQUEST];
+  size_t buf_len;
+  int refs;
+  int pending;
+  bool reading;
+  bool eof;
+  bool closing;
+  struct hsk_ipc_conn_s *prev;
+  struct hsk_ipc_conn_s *next;
+} hsk_ipc_conn_t;
+
+struct hsk_ipc_batch_s;
+
+// An answer, encoded once it is in (or just
+// the rcode, if it failed).
+typedef struct hsk_ipc_item_s {
+  struct hsk_ipc_batch_s *batch;
+  uint16_t type;
+  uint8_t rcode;
+  uint8_t *data;
+  size_t data_len;
+} hsk_ipc_item_t;
+
+// Holds a reference to its connection until
+// every name is answered.
+typedef struct hsk_ipc_batch_s {
+  hsk_ipc_conn_t *conn;
+  uint32_t id;
+  uint8_t flags;
+  int pending;
+  int count;
+  hsk_ipc_item_t items[];
+} hsk_ipc_batch_t;
+
+typedef struct hsk_ipc_write_s {
+  uv_write_t req;
+  hsk_ipc_conn_t *conn;
+  uint8_t *data;
+} hsk_ipc_write_t;
+
+/*
+ * Prototypes
+ */
+
+static void
+after_close(uv_handle_t *handle);
+
+static void
+after_connection(uv_stream_t *server, int status);
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf);
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void
+after_conn_write(uv_write_t *req, int status);
+
+static void
+after_conn_shutdown(uv_shutdown_t *req, int status);
+
+static void
+after_conn_close(uv_handle_t *handle);
+
+static void
+hsk_ipc_conn_drain(hsk_ipc_conn_t *conn);
+
+/*
+ * Query Socket
+ */
+
+int
+hsk_ipc_init(hsk_ipc_t *ipc, const uv_loop_t *loop, const hsk_ns_t *ns) {
+  if (!ipc || !loop || !ns)
+    return HSK_EBADARGS;
+
+  ipc->loop = (uv_loop_t *)loop;
+  ipc->ns = (hsk_ns_t *)ns;
+  ipc->open = false;
+  memset(ipc->path, 0, sizeof(ipc->path));
+  ipc->dev = 0;
+  ipc->ino = 0;
+  ipc->conns = NULL;
+  ipc->conn_count = 0;
+  ipc->requests = 0;
+  ipc->names = 0;
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_ipc_uninit(hsk_ipc_t *ipc) {
+  if (!ipc)
+    return;
+
+  assert(!ipc->open);
+}
+
+hsk_ipc_t *
+hsk_ipc_alloc(const uv_loop_t *loop, const hsk_ns_t *ns) {
+  hsk_ipc_t *ipc = hsk_malloc(sizeof(hsk_ipc_t));
+
+  if (!ipc)
+    return NULL;
+
+  if (hsk_ipc_init(ipc, loop, ns) != HSK_SUCCESS) {
+    hsk_free(ipc);
+    return NULL;
+  }
+
+  return ipc;
+}
+
+void
+hsk_ipc_free(hsk_ipc_t *ipc) {
+  if (!ipc)
+    return;
+
+  hsk_ipc_uninit(ipc);
+  hsk_free(ipc);
+}
+
+// On the nameserver's loop.
+int
+hsk_ipc_open(hsk_ipc_t *ipc, const char *path) {
+  if (!ipc || !path)
+    return HSK_EBADARGS;
+
+  if (strlen(path) >= sizeof(ipc->path))
+    return HSK_EBADARGS;
+
+  strcpy(ipc->path, path);
+
+  struct sockaddr_un un;
+
+  if (strlen(path) >= sizeof(un.sun_path))
+    return HSK_EBADARGS;
+
+  memset(&un, 0, sizeof(un));
+  un.sun_family = AF_UNIX;
+  strcpy(un.sun_path, path);
+
+  // Bound by hand, as the control socket is.
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return HSK_EFAILURE;
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  // Left behind by an unclean exit.
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0) {
+    hsk_log_printf("ipc: could not bind %s: %s\n", path, strerror(errno));
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  struct stat st;
+
+  // Answers are trusted as the prefix is.
+  if (chmod(path, S_IRUSR | S_IWUSR) != 0 || stat(path, &st) != 0) {
+    unlink(path);
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  ipc->dev = (uint64_t)st.st_dev;
+  ipc->ino = (uint64_t)st.st_ino;
+
+  if (uv_pipe_init(ipc->loop, &ipc->pipe, 0) != 0) {
+    unlink(path);
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  ipc->pipe.data = (void *)ipc;
+  ipc->open = true;
+
+  if (uv_pipe_open(&ipc->pipe, fd) != 0) {
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  int rc = uv_listen((uv_stream_t *)&ipc->pipe, HSK_IPC_MAX, after_connection);
+
+  if (rc != 0) {
+    hsk_log_printf("ipc: could not listen: %s\n", uv_strerror(rc));
+    return HSK_EFAILURE;
+  }
+
+  hsk_log_printf("ipc: listening on %s\n", path);
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_ipc_conn_unref(hsk_ipc_conn_t *conn) {
+  assert(conn->refs > 0);
+
+  conn->refs -= 1;
+
+  if (conn->refs == 0)
+    hsk_free(conn);
+}
+
+// Lookups still out finish on their own,
+// and are not answered.
+static void
+hsk_ipc_conn_close(hsk_ipc_conn_t *conn) {
+  hsk_ipc_t *ipc = conn->ipc;
+
+  if (conn->closing)
+    return;
+
+  conn->closing = true;
+
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    ipc->conns = (void *)conn->next;
+
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  conn->prev = NULL;
+  conn->next = NULL;
+  ipc->conn_count -= 1;
+
+  uv_close((uv_handle_t *)&conn->socket, after_conn_close);
+}
+
+int
+hsk_ipc_close(hsk_ipc_t *ipc) {
+  if (!ipc)
+    return HSK_EBADARGS;
+
+  while (ipc->conns)
+    hsk_ipc_conn_close((hsk_ipc_conn_t *)ipc->conns);
+
+  if (ipc->open) {
+    struct stat st;
+
+    uv_close((uv_handle_t *)&ipc->pipe, after_close);
+    ipc->open = false;
+
+    if (stat(ipc->path, &st) == 0
+        && (uint64_t)st.st_dev == ipc->dev
+        && (uint64_t)st.st_ino == ipc->ino) {
+      unlink(ipc->path);
+    }
+
+    hsk_log_printf("ipc: answered %llu requests (%llu names)\n",
+                   (unsigned long long)ipc->requests,
+                   (unsigned long long)ipc->names);
+  }
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_ipc_destroy(hsk_ipc_t *ipc) {
+  if (!ipc)
+    return HSK_EBADARGS;
+
+  int rc = hsk_ipc_close(ipc);
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  hsk_ipc_free(ipc);
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * Answers
+ */
+
+// Section by section, each record as it would
+// be on the wire, its name uncompressed.
+static bool
+hsk_ipc_encode_msg(hsk_ipc_item_t *item, hsk_dns_msg_t *msg, bool dnssec) {
+  hsk_dns_rrs_t *sections[3] = { &msg->an, &msg->ns, &msg->ar };
+  size_t size = 7;
+  int i, j;
+
+  if (!dnssec && item->type != HSK_DNS_ANY) {
+    if (!hsk_dns_msg_clean(msg, item->type))
+      return false;
+  }
+
+  for (i = 0; i < 3; i++) {
+    hsk_dns_rrs_t *rrs = sections[i];
+
+    if (rrs->size > 0xffff)
+      return false;
+
+    for (j = 0; j < rrs->size; j++)
+      size += hsk_dns_rr_size(rrs->items[j]);
+  }
+
+  uint8_t *data = hsk_malloc(size);
+
+  if (!data)
+    return false;
+
+  uint8_t *pos = data;
+
+  write_u8(&pos, (uint8_t)msg->code);
+
+  for (i = 0; i < 3; i++)
+    write_u16be(&pos, (uint16_t)sections[i]->size);
+
+  for (i = 0; i < 3; i++) {
+    hsk_dns_rrs_t *rrs = sections[i];
+
+    for (j = 0; j < rrs->size; j++)
+      hsk_dns_rr_write(rrs->items[j], &pos, NULL);
+  }
+
+  assert((size_t)(pos - data) == size);
+
+  item->data = data;
+  item->data_len = size;
+
+  return true;
+}
+
+static bool
+hsk_ipc_encode_raw(
+  hsk_ipc_item_t *item,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  if (!exists)
+    data_len = 0;
+
+  if (data_len > 0xffff)
+    return false;
+
+  uint8_t *out = hsk_malloc(3 + data_len);
+
+  if (!out)
+    return false;
+
+  uint8_t *pos = out;
+
+  write_u8(&pos, exists ? HSK_DNS_NOERROR : HSK_DNS_NXDOMAIN);
+  write_u16be(&pos, (uint16_t)data_len);
+
+  if (data_len > 0)
+    write_bytes(&pos, data, data_len);
+
+  item->data = out;
+  item->data_len = 3 + data_len;
+
+  return true;
+}
+
+static size_t
+hsk_ipc_item_size(const hsk_ipc_item_t *item, bool raw) {
+  if (item->data)
+    return item->data_len;
+
+  return raw ? 3 : 7;
+}
+
+static void
+hsk_ipc_item_write(const hsk_ipc_item_t *item, bool raw, uint8_t **pos) {
+  if (item->data) {
+    write_bytes(pos, item->data, item->data_len);
+    return;
+  }
+
+  write_u8(pos, item->rcode);
+  write_u16be(pos, 0);
+
+  if (!raw) {
+    write_u16be(pos, 0);
+    write_u16be(pos, 0);
+  }
+}
+
+// Takes the data.
+static void
+hsk_ipc_conn_send(hsk_ipc_conn_t *conn, uint8_t *data, size_t data_len) {
+  hsk_ipc_write_t *wr = hsk_malloc(sizeof(hsk_ipc_write_t));
+
+  if (!wr) {
+    hsk_free(data);
+    hsk_ipc_conn_close(conn);
+    return;
+  }
+
+  wr->req.data = (void *)wr;
+  wr->conn = conn;
+  wr->data = data;
+
+  uv_buf_t buf = uv_buf_init((char *)data, data_len);
+  uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+  if (uv_write(&wr->req, stream, &buf, 1, after_conn_write) != 0) {
+    hsk_free(wr->data);
+    hsk_free(wr);
+    hsk_ipc_conn_close(conn);
+    return;
+  }
+
+  conn->refs += 1;
+}
+
+static void
+hsk_ipc_batch_reply(hsk_ipc_batch_t *batch) {
+  hsk_ipc_conn_t *conn = batch->conn;
+  bool raw = (batch->flags & HSK_IPC_RAW) != 0;
+  size_t size = 4 + 4 + 1;
+  int i;
+
+  for (i = 0; i < batch->count; i++)
+    size += hsk_ipc_item_size(&batch->items[i], raw);
+
+  if (size - 4 > UINT32_MAX) {
+    hsk_ipc_conn_close(conn);
+    return;
+  }
+
+  uint8_t *data = hsk_malloc(size);
+
+  if (!data) {
+    hsk_ipc_conn_close(conn);
+    return;
+  }
+
+  uint8_t *pos = data;
+
+  write_u32be(&pos, (uint32_t)(size - 4));
+  write_u32be(&pos, batch->id);
+  write_u8(&pos, (uint8_t)batch->count);
+
+  for (i = 0; i < batch->count; i++)
+    hsk_ipc_item_write(&batch->items[i], raw, &pos);
+
+  assert((size_t)(pos - data) == size);
+
+  hsk_ipc_conn_send(conn, data, size);
+}
+
+static void
+hsk_ipc_batch_free(hsk_ipc_batch_t *batch) {
+  int i;
+
+  for (i = 0; i < batch->count; i++)
+    hsk_free(batch->items[i].data);
+
+  hsk_free(batch);
+}
+
+// Every name is answered. Unless still reading
+// the request, the connection carries on.
+static void
+hsk_ipc_batch_done(hsk_ipc_batch_t *batch, bool drain) {
+  hsk_ipc_conn_t *conn = batch->conn;
+
+  if (!conn->closing)
+    hsk_ipc_batch_reply(batch);
+
+  hsk_ipc_batch_free(batch);
+
+  conn->pending -= 1;
+
+  if (drain && !conn->closing)
+    hsk_ipc_conn_drain(conn);
+
+  hsk_ipc_conn_unref(conn);
+}
+
+static void
+hsk_ipc_item_done(hsk_ipc_item_t *item) {
+  hsk_ipc_batch_t *batch = item->batch;
+
+  assert(batch->pending > 0);
+
+  batch->pending -= 1;
+
+  if (batch->pending == 0)
+    hsk_ipc_batch_done(batch, true);
+}
+
+static void
+after_lookup(void *arg, int status, hsk_dns_msg_t *msg) {
+  hsk_ipc_item_t *item = (hsk_ipc_item_t *)arg;
+  bool dnssec = (item->batch->flags & HSK_IPC_DNSSEC) != 0;
+
+  if (status != HSK_SUCCESS || !hsk_ipc_encode_msg(item, msg, dnssec))
+    item->rcode = HSK_DNS_SERVFAIL;
+
+  if (msg)
+    hsk_dns_msg_free(msg);
+
+  hsk_ipc_item_done(item);
+}
+
+static void
+after_lookup_raw(
+  void *arg,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  hsk_ipc_item_t *item = (hsk_ipc_item_t *)arg;
+
+  if (status != HSK_SUCCESS
+      || !hsk_ipc_encode_raw(item, exists, data, data_len)) {
+    item->rcode = HSK_DNS_SERVFAIL;
+  }
+
+  hsk_ipc_item_done(item);
+}
+
+/*
+ * Requests
+ */
+
+// Every entry is checked before any is looked
+// up, so that nothing is left running for a
+// request that is thrown out.
+static bool
+hsk_ipc_check_request(const uint8_t *data, size_t data_len) {
+  uint8_t *pos = (uint8_t *)data;
+  size_t left = data_len;
+  uint32_t id;
+  uint8_t flags, count;
+
+  if (!read_u32be(&pos, &left, &id))
+    return false;
+
+  if (!read_u8(&pos, &left, &flags) || !read_u8(&pos, &left, &count))
+    return false;
+
+  if (flags & ~(HSK_IPC_DNSSEC | HSK_IPC_RAW))
+    return false;
+
+  for (int i = 0; i < count; i++) {
+    uint8_t len;
+    uint16_t type;
+
+    if (!read_u8(&pos, &left, &len) || left < len)
+      return false;
+
+    pos += len;
+    left -= len;
+
+    if (!read_u16be(&pos, &left, &type))
+      return false;
+  }
+
+  return left == 0;
+}
+
+static bool
+hsk_ipc_conn_request(hsk_ipc_conn_t *conn, const uint8_t *data, size_t len) {
+  hsk_ipc_t *ipc = conn->ipc;
+
+  if (!hsk_ipc_check_request(data, len))
+    return false;
+
+  uint8_t *pos = (uint8_t *)data;
+  size_t left = len;
+  uint32_t id;
+  uint8_t flags, count;
+
+  if (!read_u32be(&pos, &left, &id))
+    return false;
+
+  if (!read_u8(&pos, &left, &flags) || !read_u8(&pos, &left, &count))
+    return false;
+
+  hsk_ipc_batch_t *batch = hsk_malloc(sizeof(hsk_ipc_batch_t)
+                                      + count * sizeof(hsk_ipc_item_t));
+
+  if (!batch)
+    return false;
+
+  batch->conn = conn;
+  batch->id = id;
+  batch->flags = flags;
+  batch->count = count;
+  // Held until every lookup is started.
+  batch->pending = count + 1;
+
+  conn->pending += 1;
+  conn->refs += 1;
+
+  ipc->requests += 1;
+  ipc->names += count;
+
+  for (int i = 0; i < count; i++) {
+    hsk_ipc_item_t *item = &batch->items[i];
+    char name[256];
+    uint8_t name_len;
+    uint16_t type;
+    int rc;
+
+    item->batch = batch;
+    item->rcode = HSK_DNS_NOERROR;
+    item->data = NULL;
+    item->data_len = 0;
+
+    item->type = 0;
+
+    // Lookups may be running already: an item
+    // cut short is refused (as is the rest).
+    if (!read_u8(&pos, &left, &name_len)
+        || !read_bytes(&pos, &left, (uint8_t *)name, name_len)
+        || !read_u16be(&pos, &left, &type)) {
+      item->rcode = HSK_DNS_REFUSED;
+      batch->pending -= 1;
+      continue;
+    }
+
+    name[name_len] = '\0';
+    item->type = type;
+
+    if (name_len == 0 || strlen(name) != name_len) {
+      item->rcode = HSK_DNS_REFUSED;
+      batch->pending -= 1;
+      continue;
+    }
+
+    if (flags & HSK_IPC_RAW)
+      rc = hsk_ns_lookup_raw(ipc->ns, name, after_lookup_raw, (void *)item);
+    else
+      rc = hsk_ns_lookup(ipc->ns, name, type, after_lookup, (void *)item);
+
+    if (rc != HSK_SUCCESS) {
+      item->rcode = rc == HSK_EBADARGS ? HSK_DNS_REFUSED : HSK_DNS_SERVFAIL;
+      batch->pending -= 1;
+    }
+  }
+
+  batch->pending -= 1;
+
+  if (batch->pending == 0)
+    hsk_ipc_batch_done(batch, false);
+
+  return true;
+}
+
+/*
+ * Connections
+ */
+
+static void
+hsk_ipc_conn_drain(hsk_ipc_conn_t *conn) {
+  size_t pos = 0;
+
+  while (!conn->closing && conn->pending < HSK_IPC_PENDING) {
+    size_t left = conn->buf_len - pos;
+
+    if (left < 4)
+      break;
+
+    uint32_t len = get_u32be(&conn->buf[pos]);
+
+    if (len > HSK_IPC_REQUEST) {
+      hsk_ipc_conn_close(conn);
+      return;
+    }
+
+    if (left < 4 + (size_t)len)
+      break;
+
+    pos += 4;
+
+    if (!hsk_ipc_conn_request(conn, &conn->buf[pos], len)) {
+      hsk_ipc_conn_close(conn);
+      return;
+    }
+
+    pos += len;
+  }
+
+  if (conn->closing)
+    return;
+
+  if (pos > 0) {
+    memmove(&conn->buf[0], &conn->buf[pos], conn->buf_len - pos);
+    conn->buf_len -= pos;
+  }
+
+  // Once the last reply is written.
+  if (conn->eof) {
+    if (conn->pending == 0) {
+      uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+      if (uv_shutdown(&conn->shutdown, stream, after_conn_shutdown) != 0)
+        hsk_ipc_conn_close(conn);
+      else
+        conn->refs += 1;
+    }
+    return;
+  }
+
+  // A full buffer holds a whole frame: it is
+  // only waiting on a slot.
+  if (conn->pending >= HSK_IPC_PENDING || conn->buf_len == sizeof(conn->buf)) {
+    if (conn->reading) {
+      uv_read_stop((uv_stream_t *)&conn->socket);
+      conn->reading = false;
+    }
+
+    return;
+  }
+
+  if (!conn->reading) {
+    uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+    if (uv_read_start(stream, alloc_conn, after_conn_read) != 0) {
+      hsk_ipc_conn_close(conn);
+      return;
+    }
+
+    conn->reading = true;
+  }
+}
+
+static void
+after_connection(uv_stream_t *server, int status) {
+  hsk_ipc_t *ipc = (hsk_ipc_t *)server->data;
+
+  if (status < 0) {
+    hsk_log_printf("ipc: connection error: %s\n", uv_strerror(status));
+    return;
+  }
+
+  hsk_ipc_conn_t *conn = hsk_malloc(sizeof(hsk_ipc_conn_t));
+
+  if (!conn)
+    return;
+
+  conn->ipc = ipc;
+  conn->buf_len = 0;
+  conn->refs = 1;
+  conn->pending = 0;
+  conn->reading = false;
+  conn->eof = false;
+  conn->closing = false;
+  conn->prev = NULL;
+  conn->next = (hsk_ipc_conn_t *)ipc->conns;
+
+  if (uv_pipe_init(ipc->loop, &conn->socket, 0) != 0) {
+    hsk_free(conn);
+    return;
+  }
+
+  conn->socket.data = (void *)conn;
+
+  if (conn->next)
+    conn->next->prev = conn;
+
+  ipc->conns = (void *)conn;
+  ipc->conn_count += 1;
+
+  if (uv_accept(server, (uv_stream_t *)&conn->socket) != 0) {
+    hsk_ipc_conn_close(conn);
+    return;
+  }
+
+  if (ipc->conn_count > HSK_IPC_MAX) {
+    hsk_ipc_conn_close(conn);
+    return;
+  }
+
+  hsk_ipc_conn_drain(conn);
+}
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
+  hsk_ipc_conn_t *conn = (hsk_ipc_conn_t *)handle->data;
+
+  buf->base = (char *)&conn->buf[conn->buf_len];
+  buf->len = sizeof(conn->buf) - conn->buf_len;
+}
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  hsk_ipc_conn_t *conn = (hsk_ipc_conn_t *)stream->data;
+
+  if (nread == UV_EOF) {
+    uv_read_stop(stream);
+    conn->reading = false;
+    conn->eof = true;
+    hsk_ipc_conn_drain(conn);
+    return;
+  }
+
+  if (nread < 0) {
+    hsk_ipc_conn_close(conn);
+    return;
+  }
+
+  if (nread == 0)
+    return;
+
+  conn->buf_len += nread;
+
+  hsk_ipc_conn_drain(conn);
+}
+
+static void
+after_conn_write(uv_write_t *req, int status) {
+  hsk_ipc_write_t *wr = (hsk_ipc_write_t *)req->data;
+  hsk_ipc_conn_t *conn = wr->conn;
+
+  hsk_free(wr->data);
+  hsk_free(wr);
+
+  if (status != 0)
+    hsk_ipc_conn_close(conn);
+
+  hsk_ipc_conn_unref(conn);
+}
+
+static void
+after_conn_shutdown(uv_shutdown_t *req, int status) {
+  hsk_ipc_conn_t *conn = (hsk_ipc_conn_t *)req->handle->data;
+
+  hsk_ipc_conn_close(conn);
+  hsk_ipc_conn_unref(conn);
+}
+
+static void
+after_conn_close(uv_handle_t *handle) {
+  hsk_ipc_conn_unref((hsk_ipc_conn_t *)handle->data);
+}
+
+static void
+after_close(uv_handle_t *handle) {}
@@ -0,0 +1,97 @@
+#ifndef _HSK_IPC_H
+#define _HSK_IPC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ns.h"
+#include "uv.h"
+
+// A binary query socket for programs on the
+// same host (unix domain, owner only): names
+// are answered from the root cache or the pool
+// as queries to the nameserver are, without
+// DNS messages or SIG(0) either way.
+//
+// Every frame is a 32 bit length and a body,
+// big endian throughout. A request is
+//   u32 id, u8 flags, u8 count,
+//   count * (u8 len, name, u16 type)
+// with names as text (the trailing dot may be
+// left out). Once all are answered, the reply
+//   u32 id, u8 count, count * answer
+// holds one answer each, in order:
+//   u8 rcode, u16 an, u16 ns, u16 ar, records
+// the records in wire format, uncompressed,
+// section by section. Signatures are left out
+// unless asked for (HSK_IPC_DNSSEC).
+//
+// With HSK_IPC_RAW, types are ignored and an
+// answer is
+//   u8 rcode, u16 len, resource
+// the resource of the name's TLD as committed
+// in the tree (NXDOMAIN if not there: ICANN's
+// TLDs are left to the caller).
+//
+// Bad names are REFUSED, failures SERVFAIL.
+// Requests on a connection are answered as
+// they complete: match replies by ID. Any
+// malformed frame closes the connection.
+#define HSK_IPC_DNSSEC 1
+#define HSK_IPC_RAW 2
+
+// Open connections, and requests in flight on
+// each (reading waits past that).
+#define HSK_IPC_MAX 64
+#define HSK_IPC_PENDING 8
+
+// Largest request: a full batch of the
+// longest names.
+#define HSK_IPC_BATCH 255
+#define HSK_IPC_REQUEST (6 + HSK_IPC_BATCH * (1 + 255 + 2))
+
+/*
+ * Types
+ */
+
+typedef struct hsk_ipc_s {
+  uv_loop_t *loop;
+  hsk_ns_t *ns;
+  uv_pipe_t pipe;
+  bool open;
+  char path[1024];
+  // Ours to unlink, unless replaced since.
+  uint64_t dev;
+  uint64_t ino;
+  void *conns;
+  int conn_count;
+  uint64_t requests;
+  uint64_t names;
+} hsk_ipc_t;
+
+/*
+ * Query Socket
+ */
+
+int
+hsk_ipc_init(hsk_ipc_t *ipc, const uv_loop_t *loop, const hsk_ns_t *ns);
+
+void
+hsk_ipc_uninit(hsk_ipc_t *ipc);
+
+hsk_ipc_t *
+hsk_ipc_alloc(const uv_loop_t *loop, const hsk_ns_t *ns);
+
+void
+hsk_ipc_free(hsk_ipc_t *ipc);
+
+int
+hsk_ipc_open(hsk_ipc_t *ipc, const char *path);
+
+int
+hsk_ipc_close(hsk_ipc_t *ipc);
+
+int
+hsk_ipc_destroy(hsk_ipc_t *ipc);
+#endif
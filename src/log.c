@@ -0,0 +1,208 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "uv.h"
+
+#include "log.h"
+
+int hsk_log_level = HSK_LOG_INFO;
+
+static struct {
+  uv_mutex_t lock;
+  uv_cond_t cond;
+  uv_thread_t thread;
+  char *buf;
+  char *out;
+  size_t len;
+  uint64_t dropped;
+  bool running;
+} hsk_logger;
+
+static const char *hsk_log_levels[] = {
+  "error",
+  "info",
+  "debug"
+};
+
+bool
+hsk_log_set_level(const char *name) {
+  int i;
+
+  for (i = HSK_LOG_ERROR; i <= HSK_LOG_DEBUG; i++) {
+    if (strcmp(name, hsk_log_levels[i]) == 0) {
+      hsk_log_level = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Swaps the buffers under the lock and writes
+// outside of it, so producers only ever wait
+// on a memcpy.
+static void
+hsk_log_run(void *arg) {
+  uint64_t dropped = 0;
+
+  uv_mutex_lock(&hsk_logger.lock);
+
+  for (;;) {
+    while (hsk_logger.running && hsk_logger.len == 0)
+      uv_cond_wait(&hsk_logger.cond, &hsk_logger.lock);
+
+    if (hsk_logger.len == 0)
+      break;
+
+    char *out = hsk_logger.buf;
+    size_t len = hsk_logger.len;
+
+    hsk_logger.buf = hsk_logger.out;
+    hsk_logger.out = out;
+    hsk_logger.len = 0;
+
+    dropped = hsk_logger.dropped;
+    hsk_logger.dropped = 0;
+
+    uv_mutex_unlock(&hsk_logger.lock);
+
+    fwrite(out, 1, len, stdout);
+
+    if (dropped > 0)
+      printf("log: dropped %lu lines\n", dropped);
+
+    fflush(stdout);
+
+    uv_mutex_lock(&hsk_logger.lock);
+  }
+
+  uv_mutex_unlock(&hsk_logger.lock);
+}
+
+bool
+hsk_log_open(void) {
+  assert(!hsk_logger.running);
+
+  hsk_logger.buf = hsk_malloc(HSK_LOG_BUFFER);
+  hsk_logger.out = hsk_malloc(HSK_LOG_BUFFER);
+  hsk_logger.len = 0;
+  hsk_logger.dropped = 0;
+
+  if (!hsk_logger.buf || !hsk_logger.out)
+    goto fail;
+
+  if (uv_mutex_init(&hsk_logger.lock) != 0)
+    goto fail;
+
+  if (uv_cond_init(&hsk_logger.cond) != 0) {
+    uv_mutex_destroy(&hsk_logger.lock);
+    goto fail;
+  }
+
+  hsk_logger.running = true;
+
+  if (uv_thread_create(&hsk_logger.thread, hsk_log_run, NULL) != 0) {
+    hsk_logger.running = false;
+    uv_cond_destroy(&hsk_logger.cond);
+    uv_mutex_destroy(&hsk_logger.lock);
+    goto fail;
+  }
+
+  return true;
+
+fail:
+  hsk_free(hsk_logger.buf);
+  hsk_free(hsk_logger.out);
+  hsk_logger.buf = NULL;
+  hsk_logger.out = NULL;
+  return false;
+}
+
+// Flushes whatever is buffered. Nothing else
+// may be logging by now.
+void
+hsk_log_close(void) {
+  if (!hsk_logger.running)
+    return;
+
+  uv_mutex_lock(&hsk_logger.lock);
+  hsk_logger.running = false;
+  uv_cond_signal(&hsk_logger.cond);
+  uv_mutex_unlock(&hsk_logger.lock);
+
+  uv_thread_join(&hsk_logger.thread);
+
+  uv_cond_destroy(&hsk_logger.cond);
+  uv_mutex_destroy(&hsk_logger.lock);
+
+  hsk_free(hsk_logger.buf);
+  hsk_free(hsk_logger.out);
+  hsk_logger.buf = NULL;
+  hsk_logger.out = NULL;
+}
+
+void
+hsk_log_vprintf(const char *prefix, const char *fmt, va_list args) {
+  if (!hsk_logger.running) {
+    if (prefix)
+      fputs(prefix, stdout);
+    vprintf(fmt, args);
+    return;
+  }
+
+  char line[HSK_LOG_LINE];
+  size_t len = 0;
+
+  if (prefix) {
+    len = strlen(prefix);
+
+    if (len > HSK_LOG_LINE - 1)
+      len = HSK_LOG_LINE - 1;
+
+    memcpy(line, prefix, len);
+  }
+
+  int r = vsnprintf(&line[len], HSK_LOG_LINE - len, fmt, args);
+
+  if (r < 0)
+    return;
+
+  // Truncated: keep the line break.
+  if ((size_t)r >= HSK_LOG_LINE - len) {
+    len = HSK_LOG_LINE - 1;
+    line[len - 1] = '\n';
+  } else {
+    len += (size_t)r;
+  }
+
+  uv_mutex_lock(&hsk_logger.lock);
+
+  if (hsk_logger.len + len > HSK_LOG_BUFFER) {
+    hsk_logger.dropped += 1;
+  } else {
+    memcpy(&hsk_logger.buf[hsk_logger.len], line, len);
+
+    if (hsk_logger.len == 0)
+      uv_cond_signal(&hsk_logger.cond);
+
+    hsk_logger.len += len;
+  }
+
+  uv_mutex_unlock(&hsk_logger.lock);
+}
+
+void
+hsk_log_printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf(NULL, fmt, args);
+  va_end(args);
+}
@@ -0,0 +1,45 @@
+#ifndef _HSK_LOG_H
+#define _HSK_LOG_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+#define HSK_LOG_ERROR 0
+#define HSK_LOG_INFO 1
+#define HSK_LOG_DEBUG 2
+
+// Lines above this level are compiled out
+// (configure --disable-debug-log).
+#ifndef HSK_LOG_MAX
+#define HSK_LOG_MAX HSK_LOG_DEBUG
+#endif
+
+// Once hsk_log_open has been called, lines go
+// to a buffer drained by a writer thread, so a
+// slow disk does not hold up the loop. Lines
+// arriving while it is full are dropped (and
+// counted). Before then they are written out
+// directly.
+#define HSK_LOG_BUFFER (1 << 20)
+#define HSK_LOG_LINE 1024
+
+extern int hsk_log_level;
+
+#define hsk_log_enabled(level) \
+  ((level) <= HSK_LOG_MAX && (level) <= hsk_log_level)
+
+bool
+hsk_log_set_level(const char *name);
+
+bool
+hsk_log_open(void);
+
+void
+hsk_log_close(void);
+
+void
+hsk_log_vprintf(const char *prefix, const char *fmt, va_list args);
+
+void
+hsk_log_printf(const char *fmt, ...);
+#endif
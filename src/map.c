@@ -36,6 +36,7 @@
 #include <stdio.h>
 
 #include "map.h"
+#include "mem.h"
 
 void
 hsk_map_init(
@@ -119,17 +120,17 @@ hsk_map_uninit(hsk_map_t *map) {
   hsk_map_clear(map);
 
   if (map->keys) {
-    free(map->keys);
+    hsk_free(map->keys);
     map->keys = NULL;
   }
 
   if (map->flags) {
-    free(map->flags);
+    hsk_free(map->flags);
     map->flags = NULL;
   }
 
   if (map->vals) {
-    free(map->vals);
+    hsk_free(map->vals);
     map->vals = NULL;
   }
 }
@@ -141,7 +142,7 @@ hsk_map_alloc(
   hsk_map_equal_func equal_func,
   hsk_map_free_func free_func
 ) {
-  hsk_map_t *map = (hsk_map_t *)malloc(sizeof(hsk_map_t));
+  hsk_map_t *map = (hsk_map_t *)hsk_malloc(sizeof(hsk_map_t));
   hsk_map_init(map, is_map, hash_func, equal_func, free_func);
   return map;
 }
@@ -152,7 +153,7 @@ hsk_map_alloc_map(
   hsk_map_equal_func equal_func,
   hsk_map_free_func free_func
 ) {
-  hsk_map_t *map = (hsk_map_t *)malloc(sizeof(hsk_map_t));
+  hsk_map_t *map = (hsk_map_t *)hsk_malloc(sizeof(hsk_map_t));
   hsk_map_init_map(map, hash_func, equal_func, free_func);
   return map;
 }
@@ -162,7 +163,7 @@ hsk_map_alloc_set(
   hsk_map_hash_func hash_func,
   hsk_map_equal_func equal_func
 ) {
-  hsk_map_t *map = (hsk_map_t *)malloc(sizeof(hsk_map_t));
+  hsk_map_t *map = (hsk_map_t *)hsk_malloc(sizeof(hsk_map_t));
   hsk_map_init_set(map, hash_func, equal_func);
   return map;
 }
@@ -217,7 +218,7 @@ hsk_map_free(hsk_map_t *map) {
     return;
 
   hsk_map_uninit(map);
-  free(map);
+  hsk_free(map);
 }
 
 void
@@ -273,7 +274,7 @@ hsk_map_resize(hsk_map_t *map, uint32_t new_n_buckets) {
       j = 0;
     } else {
       // hash table size to be changed (shrink or expand); rehash
-      new_flags = (uint32_t *)malloc(
+      new_flags = (uint32_t *)hsk_malloc(
         __hsk_fsize(new_n_buckets) * sizeof(uint32_t));
 
       if (!new_flags)
@@ -283,22 +284,22 @@ hsk_map_resize(hsk_map_t *map, uint32_t new_n_buckets) {
         __hsk_fsize(new_n_buckets) * sizeof(uint32_t));
 
       if (map->n_buckets < new_n_buckets) {  /* expand */
-        void **new_keys = (void **)realloc(
+        void **new_keys = (void **)hsk_realloc(
           map->keys, new_n_buckets * sizeof(void *));
 
         if (!new_keys) {
-          free(new_flags);
+          hsk_free(new_flags);
           return -1;
         }
 
         map->keys = new_keys;
 
         if (map->is_map) {
-          void **new_vals = (void **)realloc(
+          void **new_vals = (void **)hsk_realloc(
             (void *)map->vals, new_n_buckets * sizeof(void *));
 
           if (!new_vals) {
-            free(new_flags);
+            hsk_free(new_flags);
             return -1;
           }
 
@@ -362,17 +363,17 @@ hsk_map_resize(hsk_map_t *map, uint32_t new_n_buckets) {
 
     // shrink the hash table
     if (map->n_buckets > new_n_buckets) {
-      map->keys = (void **)realloc(
+      map->keys = (void **)hsk_realloc(
         (void *)map->keys, new_n_buckets * sizeof(void *));
 
       if (map->is_map) {
-        map->vals = (void **)realloc(
+        map->vals = (void **)hsk_realloc(
           (void *)map->vals, new_n_buckets * sizeof(void *));
       }
     }
 
     // free the working space
-    free(map->flags);
+    hsk_free(map->flags);
     map->flags = new_flags;
     map->n_buckets = new_n_buckets;
     map->n_occupied = map->size;
@@ -382,6 +383,19 @@ hsk_map_resize(hsk_map_t *map, uint32_t new_n_buckets) {
   return 0;
 }
 
+// Room for count entries before the next
+// rehash, for maps of a known size.
+bool
+hsk_map_reserve(hsk_map_t *map, uint32_t count) {
+  if (count <= map->upper_bound)
+    return true;
+
+  if (count > UINT32_MAX / 2)
+    return false;
+
+  return hsk_map_resize(map, (uint32_t)(count / __hsk_hash_upper) + 1) == 0;
+}
+
 uint32_t
 hsk_map_put(hsk_map_t *map, const void *key, int *ret) {
   uint32_t x;
@@ -35,6 +35,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "mem.h"
+
 typedef uint32_t (*hsk_map_hash_func)(const void *key);
 typedef bool (*hsk_map_equal_func)(const void *a, const void *b);
 typedef void (*hsk_map_free_func)(void *ptr);
@@ -217,6 +219,9 @@ hsk_map_lookup(const hsk_map_t *map, const void *key);
 int
 hsk_map_resize(hsk_map_t *map, uint32_t new_n_buckets);
 
+bool
+hsk_map_reserve(hsk_map_t *map, uint32_t count);
+
 uint32_t
 hsk_map_put(hsk_map_t *map, const void *key, int *ret);
 
@@ -272,4 +277,221 @@ hsk_map_tweak3(
   uint32_t n,
   uint32_t tweak
 );
+
+/*
+ * Typed Maps
+ */
+
+// Statically typed open addressing maps, in the
+// spirit of khash's KHASH_INIT. Each key sits
+// next to its value, and a byte per slot (empty,
+// deleted, or seven bits of the hash) is probed
+// before any key is compared. The hash and
+// equality functions (or function-like macros)
+// are called directly. Values must be scalars
+// or pointers: a missing key reads as zero.
+// Deleting only marks the slot, so iteration
+// may delete as it goes.
+#define HSK_TMAP_EMPTY 0x00
+#define HSK_TMAP_DELETED 0x01
+
+#define hsk_tmap_begin(map) ((uint32_t)0)
+#define hsk_tmap_end(map) ((map)->n_buckets)
+#define hsk_tmap_exists(map, i) (((map)->ctrl[i] & 0x80) != 0)
+#define hsk_tmap_key(map, i) ((map)->slots[i].key)
+#define hsk_tmap_value(map, i) ((map)->slots[i].value)
+
+#define HSK_TMAP_INIT(name, key_t, val_t, hash_func, equal_func)            \
+  typedef struct hsk_##name##_slot_s {                                    \
+    key_t key;                                                            \
+    val_t value;                                                          \
+  } hsk_##name##_slot_t;                                                  \
+                                                                          \
+  typedef struct hsk_##name##_s {                                         \
+    uint32_t n_buckets;                                                   \
+    uint32_t size;                                                        \
+    uint32_t used;                                                        \
+    uint8_t *ctrl;                                                        \
+    hsk_##name##_slot_t *slots;                                           \
+  } hsk_##name##_t;                                                       \
+                                                                          \
+  static inline void                                                      \
+  hsk_##name##_init(hsk_##name##_t *map) {                                \
+    map->n_buckets = 0;                                                   \
+    map->size = 0;                                                        \
+    map->used = 0;                                                        \
+    map->ctrl = NULL;                                                     \
+    map->slots = NULL;                                                    \
+  }                                                                       \
+                                                                          \
+  static inline void                                                      \
+  hsk_##name##_uninit(hsk_##name##_t *map) {                              \
+    /* The control bytes share the allocation. */                         \
+    hsk_free(map->slots);                                                     \
+    hsk_##name##_init(map);                                               \
+  }                                                                       \
+                                                                          \
+  static inline void                                                      \
+  hsk_##name##_reset(hsk_##name##_t *map) {                               \
+    if (map->ctrl)                                                        \
+      memset(map->ctrl, HSK_TMAP_EMPTY, map->n_buckets);                  \
+                                                                          \
+    map->size = 0;                                                        \
+    map->used = 0;                                                        \
+  }                                                                       \
+                                                                          \
+  static inline uint32_t                                                  \
+  hsk_##name##_find(const hsk_##name##_t *map, key_t key, uint32_t hash) { \
+    uint32_t mask = map->n_buckets - 1;                                   \
+    uint32_t i = hash & mask;                                             \
+    uint8_t tag = 0x80 | (uint8_t)(hash >> 25);                           \
+                                                                          \
+    for (;;) {                                                            \
+      uint8_t c = map->ctrl[i];                                           \
+                                                                          \
+      if (c == HSK_TMAP_EMPTY)                                            \
+        return map->n_buckets;                                            \
+                                                                          \
+      if (c == tag && equal_func(map->slots[i].key, key))                 \
+        return i;                                                         \
+                                                                          \
+      i = (i + 1) & mask;                                                 \
+    }                                                                     \
+  }                                                                       \
+                                                                          \
+  static inline uint32_t                                                  \
+  hsk_##name##_lookup(const hsk_##name##_t *map, key_t key) {             \
+    if (map->size == 0)                                                   \
+      return map->n_buckets;                                              \
+                                                                          \
+    return hsk_##name##_find(map, key, hash_func(key));                   \
+  }                                                                       \
+                                                                          \
+  static inline void                                                      \
+  hsk_##name##_place(                                                     \
+    hsk_##name##_t *map,                                                  \
+    key_t key,                                                            \
+    val_t value,                                                          \
+    uint32_t hash                                                         \
+  ) {                                                                     \
+    uint32_t mask = map->n_buckets - 1;                                   \
+    uint32_t i = hash & mask;                                             \
+                                                                          \
+    while (map->ctrl[i] & 0x80)                                           \
+      i = (i + 1) & mask;                                                 \
+                                                                          \
+    if (map->ctrl[i] == HSK_TMAP_EMPTY)                                   \
+      map->used += 1;                                                     \
+                                                                          \
+    map->ctrl[i] = 0x80 | (uint8_t)(hash >> 25);                          \
+    map->slots[i].key = key;                                              \
+    map->slots[i].value = value;                                          \
+    map->size += 1;                                                       \
+  }                                                                       \
+                                                                          \
+  static inline bool                                                      \
+  hsk_##name##_resize(hsk_##name##_t *map, uint32_t n_buckets) {          \
+    size_t slots_size = (size_t)n_buckets * sizeof(hsk_##name##_slot_t);  \
+    hsk_##name##_slot_t *slots = hsk_malloc(slots_size + n_buckets);          \
+                                                                          \
+    if (!slots)                                                           \
+      return false;                                                       \
+                                                                          \
+    hsk_##name##_t old = *map;                                            \
+    uint32_t i;                                                           \
+                                                                          \
+    map->n_buckets = n_buckets;                                           \
+    map->size = 0;                                                        \
+    map->used = 0;                                                        \
+    map->ctrl = (uint8_t *)slots + slots_size;                            \
+    map->slots = slots;                                                   \
+                                                                          \
+    memset(map->ctrl, HSK_TMAP_EMPTY, n_buckets);                         \
+                                                                          \
+    for (i = 0; i < old.n_buckets; i++) {                                 \
+      if (!hsk_tmap_exists(&old, i))                                      \
+        continue;                                                         \
+                                                                          \
+      key_t k = old.slots[i].key;                                         \
+                                                                          \
+      hsk_##name##_place(map, k, old.slots[i].value, hash_func(k));       \
+    }                                                                     \
+                                                                          \
+    hsk_free(old.slots);                                                      \
+                                                                          \
+    return true;                                                          \
+  }                                                                       \
+                                                                          \
+  static inline bool                                                      \
+  hsk_##name##_set(hsk_##name##_t *map, key_t key, val_t value) {         \
+    uint32_t hash = hash_func(key);                                       \
+                                                                          \
+    if (map->size > 0) {                                                  \
+      uint32_t i = hsk_##name##_find(map, key, hash);                     \
+                                                                          \
+      if (i != map->n_buckets) {                                          \
+        /* The key usually lives in the value. */                         \
+        map->slots[i].key = key;                                          \
+        map->slots[i].value = value;                                      \
+        return true;                                                      \
+      }                                                                   \
+    }                                                                     \
+                                                                          \
+    /* Keep live and deleted slots under 3/4. */                          \
+    if ((uint64_t)(map->used + 1) * 4 > (uint64_t)map->n_buckets * 3) {   \
+      uint32_t n_buckets = map->n_buckets ? map->n_buckets : 16;          \
+                                                                          \
+      if ((uint64_t)(map->size + 1) * 2 > n_buckets)                      \
+        n_buckets <<= 1;                                                  \
+                                                                          \
+      if (n_buckets == 0 || !hsk_##name##_resize(map, n_buckets))         \
+        return false;                                                     \
+    }                                                                     \
+                                                                          \
+    hsk_##name##_place(map, key, value, hash);                            \
+                                                                          \
+    return true;                                                          \
+  }                                                                       \
+                                                                          \
+  static inline val_t                                                     \
+  hsk_##name##_get(const hsk_##name##_t *map, key_t key) {                \
+    uint32_t i = hsk_##name##_lookup(map, key);                           \
+                                                                          \
+    if (i == map->n_buckets)                                              \
+      return (val_t)0;                                                    \
+                                                                          \
+    return map->slots[i].value;                                           \
+  }                                                                       \
+                                                                          \
+  static inline bool                                                      \
+  hsk_##name##_has(const hsk_##name##_t *map, key_t key) {                \
+    return hsk_##name##_lookup(map, key) != map->n_buckets;               \
+  }                                                                       \
+                                                                          \
+  static inline void                                                      \
+  hsk_##name##_delete(hsk_##name##_t *map, uint32_t i) {                  \
+    uint32_t next = (i + 1) & (map->n_buckets - 1);                       \
+                                                                          \
+    /* No probe runs on past an empty slot. */                            \
+    if (map->ctrl[next] == HSK_TMAP_EMPTY) {                              \
+      map->ctrl[i] = HSK_TMAP_EMPTY;                                      \
+      map->used -= 1;                                                     \
+    } else {                                                              \
+      map->ctrl[i] = HSK_TMAP_DELETED;                                    \
+    }                                                                     \
+                                                                          \
+    map->size -= 1;                                                       \
+  }                                                                       \
+                                                                          \
+  static inline bool                                                      \
+  hsk_##name##_del(hsk_##name##_t *map, key_t key) {                      \
+    uint32_t i = hsk_##name##_lookup(map, key);                           \
+                                                                          \
+    if (i == map->n_buckets)                                              \
+      return false;                                                       \
+                                                                          \
+    hsk_##name##_delete(map, i);                                          \
+                                                                          \
+    return true;                                                          \
+  }
 #endif
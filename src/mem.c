@@ -0,0 +1,169 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "mem.h"
+#include "uv.h"
+
+size_t hsk_mem_used[HSK_MEM_CLASSES];
+size_t hsk_mem_total = 0;
+size_t hsk_mem_budget = 0;
+
+hsk_allocator_t hsk_allocator = {
+  .malloc = malloc,
+  .calloc = calloc,
+  .realloc = realloc,
+  .free = free
+};
+
+#ifdef HSK_ALLOC_SITES
+// Each site adds itself on its first count.
+static hsk_alloc_site_t *hsk_alloc_sites = NULL;
+#endif
+
+static const char *hsk_mem_names[HSK_MEM_CLASSES] = {
+  "chain",
+  "orphans",
+  "cache",
+  "proofs",
+  "requests",
+  "peers",
+  "dns"
+};
+
+static void
+hsk_mem_printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("mem: ", fmt, args);
+  va_end(args);
+}
+
+bool
+hsk_mem_set_allocator(const hsk_allocator_t *allocator) {
+  if (!allocator
+      || !allocator->malloc
+      || !allocator->calloc
+      || !allocator->realloc
+      || !allocator->free) {
+    return false;
+  }
+
+  if (uv_replace_allocator(allocator->malloc, allocator->realloc,
+                           allocator->calloc, allocator->free) != 0) {
+    return false;
+  }
+
+  hsk_allocator = *allocator;
+
+  return true;
+}
+
+#ifdef HSK_ALLOC_SITES
+void
+hsk_alloc_site_count(hsk_alloc_site_t *site, size_t size) {
+  __atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&site->bytes, size, __ATOMIC_RELAXED);
+
+  if (__atomic_load_n(&site->listed, __ATOMIC_RELAXED))
+    return;
+
+  int listed = 0;
+
+  if (!__atomic_compare_exchange_n(&site->listed, &listed, 1, false,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  hsk_alloc_site_t *head = __atomic_load_n(&hsk_alloc_sites, __ATOMIC_RELAXED);
+
+  do {
+    site->next = head;
+  } while (!__atomic_compare_exchange_n(&hsk_alloc_sites, &head, site, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// The busiest sites (by count) since startup.
+static void
+hsk_alloc_sites_log(void) {
+  hsk_alloc_site_t *top[HSK_ALLOC_SITES_LOG];
+  hsk_alloc_site_t *site;
+  int len = 0;
+  int i;
+
+  site = __atomic_load_n(&hsk_alloc_sites, __ATOMIC_ACQUIRE);
+
+  for (; site; site = site->next) {
+    uint64_t count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+
+    for (i = len; i > 0; i--) {
+      if (__atomic_load_n(&top[i - 1]->count, __ATOMIC_RELAXED) >= count)
+        break;
+
+      if (i < HSK_ALLOC_SITES_LOG)
+        top[i] = top[i - 1];
+    }
+
+    if (i < HSK_ALLOC_SITES_LOG) {
+      top[i] = site;
+
+      if (len < HSK_ALLOC_SITES_LOG)
+        len += 1;
+    }
+  }
+
+  for (i = 0; i < len; i++) {
+    hsk_mem_printf("%s:%d: %llu allocs, %llu KiB\n",
+      top[i]->file, top[i]->line,
+      (unsigned long long)__atomic_load_n(&top[i]->count, __ATOMIC_RELAXED),
+      (unsigned long long)__atomic_load_n(&top[i]->bytes,
+                                          __ATOMIC_RELAXED) >> 10);
+  }
+}
+#endif
+
+void
+hsk_mem_set_budget(size_t budget) {
+  __atomic_store_n(&hsk_mem_budget, budget, __ATOMIC_RELAXED);
+}
+
+const char *
+hsk_mem_name(int cls) {
+  if (cls < 0 || cls >= HSK_MEM_CLASSES)
+    return "unknown";
+  return hsk_mem_names[cls];
+}
+
+// Resident size is logged next to our counts:
+// the gap is unbound, libuv and the allocator.
+void
+hsk_mem_log(void) {
+  size_t total = __atomic_load_n(&hsk_mem_total, __ATOMIC_RELAXED);
+  size_t budget = hsk_mem_get_budget();
+  size_t rss = 0;
+  int i;
+
+  if (uv_resident_set_memory(&rss) != 0)
+    rss = 0;
+
+  if (budget > 0) {
+    hsk_mem_printf("%zu KiB accounted of %zu KiB budget, %zu KiB resident\n",
+                   total >> 10, budget >> 10, rss >> 10);
+  } else {
+    hsk_mem_printf("%zu KiB accounted, %zu KiB resident\n",
+                   total >> 10, rss >> 10);
+  }
+
+  for (i = 0; i < HSK_MEM_CLASSES; i++) {
+    hsk_mem_printf("%s: %zu KiB\n",
+                   hsk_mem_names[i], hsk_mem_get(i) >> 10);
+  }
+
+#ifdef HSK_ALLOC_SITES
+  hsk_alloc_sites_log();
+#endif
+}
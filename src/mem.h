@@ -0,0 +1,158 @@
+#ifndef _HSK_MEM_H
+#define _HSK_MEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// What owns the memory. Only the big, growing
+// allocations are counted: small fixed ones
+// are not worth the bookkeeping.
+#define HSK_MEM_CHAIN 0
+#define HSK_MEM_ORPHANS 1
+#define HSK_MEM_CACHE 2
+#define HSK_MEM_PROOFS 3
+#define HSK_MEM_REQUESTS 4
+#define HSK_MEM_PEERS 5
+#define HSK_MEM_DNS 6
+#define HSK_MEM_CLASSES 7
+
+// Shared by every thread.
+extern size_t hsk_mem_used[HSK_MEM_CLASSES];
+extern size_t hsk_mem_total;
+extern size_t hsk_mem_budget;
+
+static inline void
+hsk_mem_add(int cls, size_t size) {
+  __atomic_add_fetch(&hsk_mem_used[cls], size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hsk_mem_total, size, __ATOMIC_RELAXED);
+}
+
+static inline void
+hsk_mem_sub(int cls, size_t size) {
+  __atomic_sub_fetch(&hsk_mem_used[cls], size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&hsk_mem_total, size, __ATOMIC_RELAXED);
+}
+
+static inline size_t
+hsk_mem_get(int cls) {
+  return __atomic_load_n(&hsk_mem_used[cls], __ATOMIC_RELAXED);
+}
+
+static inline size_t
+hsk_mem_get_budget(void) {
+  return __atomic_load_n(&hsk_mem_budget, __ATOMIC_RELAXED);
+}
+
+// Bytes over the budget: zero when under it,
+// or when there is none.
+static inline size_t
+hsk_mem_over(void) {
+  size_t budget = hsk_mem_get_budget();
+  size_t total = __atomic_load_n(&hsk_mem_total, __ATOMIC_RELAXED);
+
+  if (budget == 0 || total <= budget)
+    return 0;
+
+  return total - budget;
+}
+
+// Where every allocation of ours (and libuv's)
+// goes. Set it once, before anything else is
+// done: memory is never handed between two.
+typedef struct hsk_allocator_s {
+  void *(*malloc)(size_t size);
+  void *(*calloc)(size_t count, size_t size);
+  void *(*realloc)(void *ptr, size_t size);
+  void (*free)(void *ptr);
+} hsk_allocator_t;
+
+extern hsk_allocator_t hsk_allocator;
+
+static inline void *
+hsk_malloc(size_t size) {
+  return hsk_allocator.malloc(size);
+}
+
+static inline void *
+hsk_calloc(size_t count, size_t size) {
+  return hsk_allocator.calloc(count, size);
+}
+
+static inline void *
+hsk_realloc(void *ptr, size_t size) {
+  return hsk_allocator.realloc(ptr, size);
+}
+
+static inline void
+hsk_free(void *ptr) {
+  hsk_allocator.free(ptr);
+}
+
+static inline char *
+hsk_strdup(const char *str) {
+  size_t size = strlen(str) + 1;
+  char *dup = hsk_malloc(size);
+
+  if (dup)
+    memcpy(dup, str, size);
+
+  return dup;
+}
+
+// Built with --enable-alloc-sites, every call
+// site counts its allocations (and bytes),
+// for hsk_mem_log to list the busiest.
+#ifdef HSK_ALLOC_SITES
+#define HSK_ALLOC_SITES_LOG 20
+
+typedef struct hsk_alloc_site_s {
+  const char *file;
+  int line;
+  int listed;
+  uint64_t count;
+  uint64_t bytes;
+  struct hsk_alloc_site_s *next;
+} hsk_alloc_site_t;
+
+void
+hsk_alloc_site_count(hsk_alloc_site_t *site, size_t size);
+
+#define hsk_alloc_site_(size) do {                              \
+  static hsk_alloc_site_t site_ = { __FILE__, __LINE__ };      \
+  hsk_alloc_site_count(&site_, (size));                         \
+} while (0)
+
+#define hsk_malloc(size) ({                                     \
+  size_t size_ = (size);                                        \
+  hsk_alloc_site_(size_);                                       \
+  (hsk_malloc)(size_);                                          \
+})
+
+#define hsk_calloc(count, size) ({                              \
+  size_t count_ = (count);                                      \
+  size_t size_ = (size);                                        \
+  hsk_alloc_site_(count_ * size_);                              \
+  (hsk_calloc)(count_, size_);                                  \
+})
+
+#define hsk_realloc(ptr, size) ({                               \
+  size_t size_ = (size);                                        \
+  hsk_alloc_site_(size_);                                       \
+  (hsk_realloc)((ptr), size_);                                  \
+})
+#endif
+
+bool
+hsk_mem_set_allocator(const hsk_allocator_t *allocator);
+
+void
+hsk_mem_set_budget(size_t budget);
+
+const char *
+hsk_mem_name(int cls);
+
+void
+hsk_mem_log(void);
+#endif
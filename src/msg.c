@@ -9,6 +9,7 @@
 #include "addr.h"
 #include "bio.h"
 #include "header.h"
+#include "mem.h"
 #include "msg.h"
 #include "proof.h"
 #include "utils.h"
@@ -209,36 +210,36 @@ hsk_headers_msg_read(uint8_t **data, size_t *data_len, hsk_headers_msg_t *msg) {
   if (msg->header_count > 2000)
     return false;
 
-  hsk_header_t *tail = NULL;
-  int i;
+  if (msg->header_count == 0)
+    return true;
 
-  for (i = 0; i < msg->header_count; i++) {
-    hsk_header_t *h = hsk_header_alloc();
+  // All headers live in a single allocation,
+  // still linked through `next`. Freeing the
+  // first frees the whole list.
+  hsk_header_t *headers = hsk_malloc(msg->header_count * sizeof(hsk_header_t));
 
-    if (h == NULL)
-      goto fail;
+  if (headers == NULL)
+    return false;
 
-    if (!hsk_header_read(data, data_len, h))
-      goto fail;
+  int i;
 
-    if (msg->headers == NULL)
-      msg->headers = h;
+  for (i = 0; i < msg->header_count; i++) {
+    hsk_header_t *h = &headers[i];
 
-    if (tail)
-      tail->next = h;
+    hsk_header_init(h);
 
-    tail = h;
+    if (!hsk_header_read(data, data_len, h)) {
+      hsk_free(headers);
+      return false;
+    }
+
+    if (i > 0)
+      headers[i - 1].next = h;
   }
 
-  return true;
+  msg->headers = headers;
 
-fail: ;
-  hsk_header_t *c, *n;
-  for (c = msg->headers; c; c = n) {
-    n = c->next;
-    free(c);
-  }
-  return false;
+  return true;
 }
 
 int
@@ -300,7 +301,7 @@ hsk_proof_msg_read(uint8_t **data, size_t *data_len, hsk_proof_msg_t *msg) {
   if (!read_bytes(data, data_len, msg->key, 32))
     return false;
 
-  if (!hsk_proof_read(data, data_len, &msg->proof))
+  if (!hsk_proof_read_view(data, data_len, &msg->proof))
     return false;
 
   return true;
@@ -312,7 +313,195 @@ hsk_proof_msg_write(const hsk_proof_msg_t *msg, uint8_t **data) {
 
   s += write_bytes(data, msg->root, 32);
   s += write_bytes(data, msg->key, 32);
-  // XXX
+  s += hsk_proof_write(data, &msg->proof);
+
+  return s;
+}
+
+bool
+hsk_getproofs_msg_read(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_getproofs_msg_t *msg
+) {
+  if (!read_bytes(data, data_len, msg->root, 32))
+    return false;
+
+  if (!read_varsize(data, data_len, &msg->key_count))
+    return false;
+
+  if (msg->key_count > HSK_MAX_PROOFS)
+    return false;
+
+  int i;
+
+  for (i = 0; i < msg->key_count; i++) {
+    if (!read_bytes(data, data_len, msg->keys[i], 32))
+      return false;
+  }
+
+  return true;
+}
+
+int
+hsk_getproofs_msg_write(const hsk_getproofs_msg_t *msg, uint8_t **data) {
+  int s = 0;
+
+  s += write_bytes(data, msg->root, 32);
+  s += write_varsize(data, msg->key_count);
+
+  int i;
+
+  for (i = 0; i < msg->key_count; i++)
+    s += write_bytes(data, msg->keys[i], 32);
+
+  return s;
+}
+
+bool
+hsk_proofs_msg_read(uint8_t **data, size_t *data_len, hsk_proofs_msg_t *msg) {
+  size_t count;
+
+  if (!read_varsize(data, data_len, &count))
+    return false;
+
+  if (count > HSK_MAX_PROOFS)
+    return false;
+
+  if (count == 0)
+    return true;
+
+  hsk_proof_msg_t *proofs = hsk_malloc(count * sizeof(hsk_proof_msg_t));
+
+  if (proofs == NULL)
+    return false;
+
+  int i;
+
+  for (i = 0; i < count; i++) {
+    hsk_proof_msg_t *p = &proofs[i];
+
+    p->cmd = HSK_MSG_PROOF;
+    hsk_proof_init(&p->proof);
+
+    if (!hsk_proof_msg_read(data, data_len, p)) {
+      int j;
+      for (j = 0; j <= i; j++)
+        hsk_proof_uninit(&proofs[j].proof);
+      hsk_free(proofs);
+      return false;
+    }
+  }
+
+  msg->proof_count = count;
+  msg->proofs = proofs;
+
+  return true;
+}
+
+int
+hsk_proofs_msg_write(const hsk_proofs_msg_t *msg, uint8_t **data) {
+  int s = 0;
+
+  s += write_varsize(data, msg->proof_count);
+
+  int i;
+
+  for (i = 0; i < msg->proof_count; i++)
+    s += hsk_proof_msg_write(&msg->proofs[i], data);
+
+  return s;
+}
+
+bool
+hsk_multiproof_msg_read(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_multiproof_msg_t *msg
+) {
+  if (!read_bytes(data, data_len, msg->root, 32))
+    return false;
+
+  hsk_proof_node_t *table;
+  size_t table_size;
+
+  if (!hsk_proof_read_table(data, data_len, &table, &table_size))
+    return false;
+
+  size_t count;
+
+  if (!read_varsize(data, data_len, &count) || count > HSK_MAX_PROOFS) {
+    hsk_free(table);
+    return false;
+  }
+
+  hsk_proof_msg_t *proofs = NULL;
+
+  if (count > 0) {
+    proofs = hsk_malloc(count * sizeof(hsk_proof_msg_t));
+
+    if (!proofs) {
+      hsk_free(table);
+      return false;
+    }
+  }
+
+  int i;
+
+  for (i = 0; i < count; i++) {
+    hsk_proof_msg_t *p = &proofs[i];
+
+    p->cmd = HSK_MSG_PROOF;
+    memcpy(p->root, msg->root, 32);
+    hsk_proof_init(&p->proof);
+
+    if (!read_bytes(data, data_len, p->key, 32)
+        || !hsk_proof_read_indexed(data, data_len, &p->proof,
+                                   table, table_size)) {
+      int j;
+      for (j = 0; j <= i; j++)
+        hsk_proof_uninit(&proofs[j].proof);
+      hsk_free(proofs);
+      hsk_free(table);
+      return false;
+    }
+  }
+
+  hsk_free(table);
+
+  msg->proof_count = count;
+  msg->proofs = proofs;
+
+  return true;
+}
+
+int
+hsk_multiproof_msg_write(const hsk_multiproof_msg_t *msg, uint8_t **data) {
+  const hsk_proof_t *proofs[HSK_MAX_PROOFS];
+  size_t count = msg->proof_count;
+  int s = 0;
+  size_t i;
+
+  if (count > HSK_MAX_PROOFS)
+    return -1;
+
+  for (i = 0; i < count; i++)
+    proofs[i] = &msg->proofs[i].proof;
+
+  s += write_bytes(data, msg->root, 32);
+
+  int size = hsk_proof_write_table(data, proofs, count);
+
+  if (size < 0)
+    return -1;
+
+  s += size;
+  s += write_varsize(data, count);
+
+  for (i = 0; i < count; i++) {
+    s += write_bytes(data, msg->proofs[i].key, 32);
+    s += hsk_proof_write_indexed(data, proofs, i);
+  }
 
   return s;
 }
@@ -352,6 +541,18 @@ hsk_msg_cmd(const char *cmd) {
   if (strcmp(cmd, "proof") == 0)
     return HSK_MSG_PROOF;
 
+  if (strcmp(cmd, "getproofs") == 0)
+    return HSK_MSG_GETPROOFS;
+
+  if (strcmp(cmd, "proofs") == 0)
+    return HSK_MSG_PROOFS;
+
+  if (strcmp(cmd, "getmultiproof") == 0)
+    return HSK_MSG_GETMULTIPROOF;
+
+  if (strcmp(cmd, "multiproof") == 0)
+    return HSK_MSG_MULTIPROOF;
+
   return HSK_MSG_UNKNOWN;
 }
 
@@ -391,6 +592,18 @@ hsk_msg_str(uint8_t cmd) {
     case HSK_MSG_PROOF: {
       return "proof";
     }
+    case HSK_MSG_GETPROOFS: {
+      return "getproofs";
+    }
+    case HSK_MSG_PROOFS: {
+      return "proofs";
+    }
+    case HSK_MSG_GETMULTIPROOF: {
+      return "getmultiproof";
+    }
+    case HSK_MSG_MULTIPROOF: {
+      return "multiproof";
+    }
     default: {
       return "unknown";
     }
@@ -483,6 +696,35 @@ hsk_msg_init(hsk_msg_t *msg) {
       hsk_proof_init(&m->proof);
       break;
     }
+    case HSK_MSG_GETPROOFS: {
+      hsk_getproofs_msg_t *m = (hsk_getproofs_msg_t *)msg;
+      m->cmd = HSK_MSG_GETPROOFS;
+      memset(m->root, 0, 32);
+      m->key_count = 0;
+      break;
+    }
+    case HSK_MSG_PROOFS: {
+      hsk_proofs_msg_t *m = (hsk_proofs_msg_t *)msg;
+      m->cmd = HSK_MSG_PROOFS;
+      m->proof_count = 0;
+      m->proofs = NULL;
+      break;
+    }
+    case HSK_MSG_GETMULTIPROOF: {
+      hsk_getmultiproof_msg_t *m = (hsk_getmultiproof_msg_t *)msg;
+      m->cmd = HSK_MSG_GETMULTIPROOF;
+      memset(m->root, 0, 32);
+      m->key_count = 0;
+      break;
+    }
+    case HSK_MSG_MULTIPROOF: {
+      hsk_multiproof_msg_t *m = (hsk_multiproof_msg_t *)msg;
+      m->cmd = HSK_MSG_MULTIPROOF;
+      memset(m->root, 0, 32);
+      m->proof_count = 0;
+      m->proofs = NULL;
+      break;
+    }
   }
 }
 
@@ -492,47 +734,63 @@ hsk_msg_alloc(uint8_t cmd) {
 
   switch (cmd) {
     case HSK_MSG_VERSION: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_version_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_version_msg_t));
       break;
     }
     case HSK_MSG_VERACK: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_verack_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_verack_msg_t));
       break;
     }
     case HSK_MSG_PING: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_ping_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_ping_msg_t));
       break;
     }
     case HSK_MSG_PONG: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_pong_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_pong_msg_t));
       break;
     }
     case HSK_MSG_GETADDR: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_getaddr_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_getaddr_msg_t));
       break;
     }
     case HSK_MSG_ADDR: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_addr_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_addr_msg_t));
       break;
     }
     case HSK_MSG_GETHEADERS: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_getheaders_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_getheaders_msg_t));
       break;
     }
     case HSK_MSG_HEADERS: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_headers_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_headers_msg_t));
       break;
     }
     case HSK_MSG_SENDHEADERS: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_sendheaders_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_sendheaders_msg_t));
       break;
     }
     case HSK_MSG_GETPROOF: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_getproof_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_getproof_msg_t));
       break;
     }
     case HSK_MSG_PROOF: {
-      msg = (hsk_msg_t *)malloc(sizeof(hsk_proof_msg_t));
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_proof_msg_t));
+      break;
+    }
+    case HSK_MSG_GETPROOFS: {
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_getproofs_msg_t));
+      break;
+    }
+    case HSK_MSG_PROOFS: {
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_proofs_msg_t));
+      break;
+    }
+    case HSK_MSG_GETMULTIPROOF: {
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_getmultiproof_msg_t));
+      break;
+    }
+    case HSK_MSG_MULTIPROOF: {
+      msg = (hsk_msg_t *)hsk_malloc(sizeof(hsk_multiproof_msg_t));
       break;
     }
   }
@@ -553,63 +811,87 @@ hsk_msg_free(hsk_msg_t *msg) {
   switch (msg->cmd) {
     case HSK_MSG_VERSION: {
       hsk_version_msg_t *m = (hsk_version_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_VERACK: {
       hsk_verack_msg_t *m = (hsk_verack_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_PING: {
       hsk_ping_msg_t *m = (hsk_ping_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_PONG: {
       hsk_pong_msg_t *m = (hsk_pong_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_GETADDR: {
       hsk_getaddr_msg_t *m = (hsk_getaddr_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_ADDR: {
       hsk_addr_msg_t *m = (hsk_addr_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_GETHEADERS: {
       hsk_getheaders_msg_t *m = (hsk_getheaders_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_HEADERS: {
       hsk_headers_msg_t *m = (hsk_headers_msg_t *)msg;
-      hsk_header_t *c, *n;
-      for (c = m->headers; c; c = n) {
-        n = c->next;
-        free(c);
-      }
-      free(m);
+      hsk_free(m->headers);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_SENDHEADERS: {
       hsk_sendheaders_msg_t *m = (hsk_sendheaders_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_GETPROOF: {
       hsk_getproof_msg_t *m = (hsk_getproof_msg_t *)msg;
-      free(m);
+      hsk_free(m);
       break;
     }
     case HSK_MSG_PROOF: {
       hsk_proof_msg_t *m = (hsk_proof_msg_t *)msg;
       hsk_proof_uninit(&m->proof);
-      free(m);
+      hsk_free(m);
+      break;
+    }
+    case HSK_MSG_GETPROOFS: {
+      hsk_getproofs_msg_t *m = (hsk_getproofs_msg_t *)msg;
+      hsk_free(m);
+      break;
+    }
+    case HSK_MSG_PROOFS: {
+      hsk_proofs_msg_t *m = (hsk_proofs_msg_t *)msg;
+      int i;
+      for (i = 0; i < m->proof_count; i++)
+        hsk_proof_uninit(&m->proofs[i].proof);
+      hsk_free(m->proofs);
+      hsk_free(m);
+      break;
+    }
+    case HSK_MSG_GETMULTIPROOF: {
+      hsk_getmultiproof_msg_t *m = (hsk_getmultiproof_msg_t *)msg;
+      hsk_free(m);
+      break;
+    }
+    case HSK_MSG_MULTIPROOF: {
+      hsk_multiproof_msg_t *m = (hsk_multiproof_msg_t *)msg;
+      int i;
+      for (i = 0; i < m->proof_count; i++)
+        hsk_proof_uninit(&m->proofs[i].proof);
+      hsk_free(m->proofs);
+      hsk_free(m);
       break;
     }
   }
@@ -651,6 +933,20 @@ hsk_msg_read(uint8_t **data, size_t *data_len, hsk_msg_t *msg) {
     case HSK_MSG_PROOF: {
       return hsk_proof_msg_read(data, data_len, (hsk_proof_msg_t *)msg);
     }
+    case HSK_MSG_GETPROOFS: {
+      return hsk_getproofs_msg_read(data, data_len, (hsk_getproofs_msg_t *)msg);
+    }
+    case HSK_MSG_PROOFS: {
+      return hsk_proofs_msg_read(data, data_len, (hsk_proofs_msg_t *)msg);
+    }
+    case HSK_MSG_GETMULTIPROOF: {
+      return hsk_getproofs_msg_read(data, data_len,
+                                    (hsk_getmultiproof_msg_t *)msg);
+    }
+    case HSK_MSG_MULTIPROOF: {
+      return hsk_multiproof_msg_read(data, data_len,
+                                     (hsk_multiproof_msg_t *)msg);
+    }
     default: {
       return false;
     }
@@ -693,6 +989,18 @@ hsk_msg_write(const hsk_msg_t *msg, uint8_t **data) {
     case HSK_MSG_PROOF: {
       return hsk_proof_msg_write((hsk_proof_msg_t *)msg, data);
     }
+    case HSK_MSG_GETPROOFS: {
+      return hsk_getproofs_msg_write((hsk_getproofs_msg_t *)msg, data);
+    }
+    case HSK_MSG_PROOFS: {
+      return hsk_proofs_msg_write((hsk_proofs_msg_t *)msg, data);
+    }
+    case HSK_MSG_GETMULTIPROOF: {
+      return hsk_getproofs_msg_write((hsk_getmultiproof_msg_t *)msg, data);
+    }
+    case HSK_MSG_MULTIPROOF: {
+      return hsk_multiproof_msg_write((hsk_multiproof_msg_t *)msg, data);
+    }
     default: {
       return -1;
     }
@@ -713,3 +1021,24 @@ int
 hsk_msg_size(const hsk_msg_t *msg) {
   return hsk_msg_write(msg, NULL);
 }
+
+// Into a buffer of the caller's. Nothing is
+// written if the message does not fit.
+bool
+hsk_msg_encode_into(
+  const hsk_msg_t *msg,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+) {
+  assert(msg && data && data_len);
+
+  int size = hsk_msg_size(msg);
+
+  if (size < 0 || (size_t)size > cap)
+    return false;
+
+  *data_len = (size_t)hsk_msg_write(msg, &data);
+
+  return true;
+}
@@ -21,8 +21,15 @@
 #define HSK_MSG_SENDHEADERS 12
 #define HSK_MSG_GETPROOF 26
 #define HSK_MSG_PROOF 27
+#define HSK_MSG_GETPROOFS 40
+#define HSK_MSG_PROOFS 41
+#define HSK_MSG_GETMULTIPROOF 42
+#define HSK_MSG_MULTIPROOF 43
 #define HSK_MSG_UNKNOWN 255
 
+// Keys per batched proof request.
+#define HSK_MAX_PROOFS 64
+
 typedef struct {
   uint8_t cmd;
 } hsk_msg_t;
@@ -86,6 +93,8 @@ typedef struct {
   uint8_t key[32];
 } hsk_getproof_msg_t;
 
+// The proof points into the buffer the message
+// was decoded from (see hsk_proof_read_view).
 typedef struct {
   uint8_t cmd;
   uint8_t root[32];
@@ -93,6 +102,38 @@ typedef struct {
   hsk_proof_t proof;
 } hsk_proof_msg_t;
 
+// Only sent to peers advertising
+// HSK_SERVICE_PROOFS.
+typedef struct {
+  uint8_t cmd;
+  uint8_t root[32];
+  size_t key_count;
+  uint8_t keys[HSK_MAX_PROOFS][32];
+} hsk_getproofs_msg_t;
+
+// One allocation for all proofs, each a view
+// into the buffer the message was decoded from.
+typedef struct {
+  uint8_t cmd;
+  size_t proof_count;
+  hsk_proof_msg_t *proofs;
+} hsk_proofs_msg_t;
+
+// The same request as getproofs, only sent to
+// peers advertising HSK_SERVICE_MULTIPROOF.
+typedef hsk_getproofs_msg_t hsk_getmultiproof_msg_t;
+
+// Proofs under one root, their nodes given as
+// indexes into a table sent once before them.
+// Decoded like proofs: each proof gets its own
+// nodes, the rest are views into the buffer.
+typedef struct {
+  uint8_t cmd;
+  uint8_t root[32];
+  size_t proof_count;
+  hsk_proof_msg_t *proofs;
+} hsk_multiproof_msg_t;
+
 uint8_t
 hsk_msg_cmd(const char *cmd);
 
@@ -122,4 +163,12 @@ hsk_msg_encode(const hsk_msg_t *msg, uint8_t *data);
 
 int
 hsk_msg_size(const hsk_msg_t *msg);
+
+bool
+hsk_msg_encode_into(
+  const hsk_msg_t *msg,
+  uint8_t *data,
+  size_t cap,
+  size_t *data_len
+);
 #endif
@@ -1,6 +1,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -10,29 +11,79 @@
 #include <time.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "addr.h"
+#include "bio.h"
 #include "cache.h"
 #include "constants.h"
 #include "dns.h"
+#include "dnssec.h"
 #include "ec.h"
 #include "error.h"
+#include "icann.h"
+#include "log.h"
+#include "mem.h"
 #include "resource.h"
 #include "ns.h"
 #include "pool.h"
+#include "prof.h"
 #include "req.h"
-#include "tld.h"
+#include "trace.h"
+#include "udp.h"
+#include "utils.h"
 #include "uv.h"
 
 /*
  * Types
  */
 
-typedef struct {
+// A DNS over TCP client. Queries are length
+// prefixed and may be pipelined; each reply is
+// written as soon as it is ready (RFC 7766).
+// Pending lookups hold a reference, so a reply
+// to a closed connection is simply dropped.
+typedef struct hsk_ns_conn_s {
   hsk_ns_t *ns;
-  void *data;
-  bool should_free;
-} hsk_send_data_t;
+  uv_tcp_t socket;
+  uv_timer_t timer;
+  struct sockaddr_storage addr;
+  uint8_t buf[2 + HSK_DNS_MAX_TCP];
+  size_t buf_len;
+  int refs;
+  int handles;
+  bool closing;
+  bool reading;
+  struct hsk_ns_write_s *batch;
+  bool local;
+  struct hsk_ns_conn_s *prev;
+  struct hsk_ns_conn_s *next;
+} hsk_ns_conn_t;
+
+// A reply built and signed on the libuv
+// threadpool: either the full answer to a
+// lookup, or just the SIG(0) over a wire.
+typedef struct hsk_ns_sign_s {
+  uv_work_t req;
+  hsk_ns_t *ns;
+  hsk_dns_req_t *dns;
+  bool answer;
+  int status;
+  hsk_resource_t *res;
+  uint8_t *wire;
+  size_t wire_len;
+} hsk_ns_sign_t;
+
+// Each reply is a length prefix and its data.
+typedef struct hsk_ns_write_s {
+  uv_write_t req;
+  hsk_ns_conn_t *conn;
+  int count;
+  uint8_t prefixes[HSK_NS_TCP_BATCH][2];
+  uv_buf_t bufs[HSK_NS_TCP_BATCH * 2];
+} hsk_ns_write_t;
 
 /*
  * Prototypes
@@ -41,6 +92,13 @@ typedef struct {
 static void
 hsk_ns_log(hsk_ns_t *ns, const char *fmt, ...);
 
+// Per-query lines, compiled out
+// with --disable-debug-log.
+#define hsk_ns_debug(ns, ...) do {    \
+  if (hsk_log_enabled(HSK_LOG_DEBUG)) \
+    hsk_ns_log((ns), __VA_ARGS__);    \
+} while (0)
+
 static void
 after_resolve(
   const char *name,
@@ -51,6 +109,46 @@ after_resolve(
   const void *arg
 );
 
+static void
+after_refresh(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+);
+
+static void
+after_prefetch(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+);
+
+static void
+after_lookup(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+);
+
+static void
+after_lookup_raw(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+);
+
 int
 hsk_ns_send(
   hsk_ns_t *ns,
@@ -61,28 +159,104 @@ hsk_ns_send(
 );
 
 static void
-alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf);
-
-static void
-after_send(uv_udp_send_t *req, int status);
+after_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+);
 
 static void
-after_recv(
-  uv_udp_t *socket,
-  ssize_t nread,
-  const uv_buf_t *buf,
-  const struct sockaddr *addr,
-  unsigned flags
+after_local_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
 );
 
 static void
 after_close(uv_handle_t *handle);
 
+static void
+after_connection(uv_stream_t *server, int status);
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf);
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void
+after_conn_write(uv_write_t *req, int status);
+
+static void
+after_conn_timeout(uv_timer_t *timer);
+
+static void
+after_conn_close(uv_handle_t *handle);
+
+static void
+hsk_ns_conn_close(hsk_ns_conn_t *conn);
+
+static void
+after_root_timer(uv_timer_t *timer);
+
+static void
+on_sign(uv_work_t *req);
+
+static void
+after_sign(uv_work_t *req, int status);
+
+static bool
+hsk_ns_sign_root(hsk_ns_t *ns);
+
+static void
+hsk_ns_free_zone(hsk_ns_t *ns);
+
+static void
+hsk_ns_free_root(hsk_ns_t *ns);
+
+static void
+after_stop(uv_async_t *handle);
+
+static bool
+hsk_ns_remote(const hsk_ns_t *ns);
+
+static bool
+hsk_ns_init_shards(hsk_ns_t *ns, int count);
+
+static void
+hsk_ns_free_shards(hsk_ns_t *ns);
+
+static int
+hsk_ns_start_workers(hsk_ns_t *ns, const struct sockaddr *addr);
+
+static void
+hsk_ns_stop_workers(hsk_ns_t *ns);
+
+static void
+hsk_ns_resource_free(hsk_resource_t *res);
+
+static void
+hsk_ns_shared_clear(hsk_ns_t *ns);
+
+static int
+hsk_ns_load_cache(hsk_ns_t *ns);
+
 static int
-hsk_tld_index(const char *name);
+hsk_ns_save_cache(hsk_ns_t *ns);
+
+static void
+after_save_timer(uv_timer_t *timer);
+
+static void
+hsk_ns_prefetch_next(hsk_ns_t *ns);
+
+static void
+hsk_ns_prefetch_clear(hsk_ns_t *ns);
 
-static const uint8_t *
-hsk_icann_lookup(const char *name);
+static void
+after_prefetch_timer(uv_timer_t *timer);
 
 /*
  * Root Nameserver
@@ -93,7 +267,7 @@ hsk_ns_init(hsk_ns_t *ns, const uv_loop_t *loop, const hsk_pool_t *pool) {
   if (!ns || !loop || !pool)
     return HSK_EBADARGS;
 
-  hsk_ec_t *ec = hsk_ec_alloc();
+  hsk_ec_t *ec = hsk_ec_shared();
 
   if (!ec)
     return HSK_ENOMEM;
@@ -102,15 +276,102 @@ hsk_ns_init(hsk_ns_t *ns, const uv_loop_t *loop, const hsk_pool_t *pool) {
   ns->pool = (hsk_pool_t *)pool;
   hsk_addr_init(&ns->ip_);
   ns->ip = NULL;
-  ns->socket.data = (void *)ns;
+  hsk_udp_init(&ns->udp, ns->loop, after_recv, (void *)ns);
+  ns->tcp.data = (void *)ns;
+  ns->conns = NULL;
+  ns->conn_count = 0;
+  ns->listening = false;
+  hsk_udp_init(&ns->local, ns->loop, after_local_recv, (void *)ns);
+  ns->local_tcp.data = (void *)ns;
+  memset(&ns->local_addr, 0, sizeof(ns->local_addr));
+  ns->local_bound = false;
+  ns->local_listening = false;
+  memset(ns->root, 0, sizeof(ns->root));
+  memset(ns->root_len, 0, sizeof(ns->root_len));
+  ns->root_timer.data = (void *)ns;
+  ns->zone = NULL;
+  ns->zone_len = NULL;
+  ns->zone_count = 0;
+  memset(ns->zone_root, 0, sizeof(ns->zone_root));
+  ns->signing = false;
+  ns->offload = false;
+  ns->minimal = false;
+  ns->any_hinfo = false;
+  ns->unsigned_errors = false;
+  ns->capture = NULL;
+  ns->handoff = NULL;
+  ns->affinity = NULL;
+  ns->affinity_first = 0;
+  ns->cpu = -1;
+  ns->shm = NULL;
+  hsk_rrl_init(&ns->rrl);
+  hsk_slab_init(&ns->reqs, sizeof(hsk_dns_req_t), HSK_DNS_REQ_SLAB);
   ns->ec = ec;
-  hsk_cache_init(&ns->cache);
+  ns->shards = NULL;
+  ns->shard_count = 0;
+  ns->cache_size = HSK_CACHE_SIZE;
+  ns->min_ttl = HSK_CACHE_MIN_TTL;
+  ns->max_ttl = HSK_CACHE_MAX_TTL;
+  ns->neg_ttl = HSK_CACHE_NEG_TTL;
+  memset(ns->cache_path, 0, sizeof(ns->cache_path));
+  ns->save_timer.data = (void *)ns;
+  ns->saving = false;
+  ns->prefetch_head = NULL;
+  ns->prefetch_tail = NULL;
+  ns->prefetch_pending = 0;
+  ns->prefetch_done = 0;
+  ns->prefetch_failed = 0;
+  ns->prefetch_timer.data = (void *)ns;
+  ns->prefetching = false;
+  memset(ns->shared_tld, 0, sizeof(ns->shared_tld));
+  ns->shared_data = NULL;
+  ns->shared_len = 0;
+  ns->shared_types = 0;
+  ns->shared_res = NULL;
   memset(ns->key_, 0x00, sizeof(ns->key_));
   ns->key = NULL;
   memset(ns->pubkey, 0x00, sizeof(ns->pubkey));
-  memset(ns->read_buffer, 0x00, sizeof(ns->read_buffer));
   ns->bound = false;
-  ns->receiving = false;
+  ns->parent = NULL;
+  ns->workers = NULL;
+  ns->worker_count = 0;
+  ns->async.data = (void *)ns;
+  hsk_pool_client_init(&ns->client, loop, pool);
+  ns->running = false;
+  memset(&ns->stats, 0, sizeof(ns->stats));
+
+  if (uv_mutex_init(&ns->lock) != 0)
+    return HSK_EFAILURE;
+
+  if (hsk_tracer_init(&ns->tracer) != HSK_SUCCESS) {
+    uv_mutex_destroy(&ns->lock);
+    return HSK_EFAILURE;
+  }
+
+  if (!hsk_ns_init_shards(ns, 1)) {
+    hsk_tracer_uninit(&ns->tracer);
+    uv_mutex_destroy(&ns->lock);
+    return HSK_ENOMEM;
+  }
+
+  int rc = hsk_top_init(&ns->top_names, HSK_NS_TOP_NAMES, HSK_NS_TOP_WINDOW);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_ns_free_shards(ns);
+    hsk_tracer_uninit(&ns->tracer);
+    uv_mutex_destroy(&ns->lock);
+    return rc;
+  }
+
+  rc = hsk_top_init(&ns->top_tlds, HSK_NS_TOP_TLDS, HSK_NS_TOP_WINDOW);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_top_uninit(&ns->top_names);
+    hsk_ns_free_shards(ns);
+    hsk_tracer_uninit(&ns->tracer);
+    uv_mutex_destroy(&ns->lock);
+    return rc;
+  }
 
   return HSK_SUCCESS;
 }
@@ -120,14 +381,34 @@ hsk_ns_uninit(hsk_ns_t *ns) {
   if (!ns)
     return;
 
-  ns->socket.data = NULL;
+  hsk_udp_uninit(&ns->udp);
+  hsk_udp_uninit(&ns->local);
+  hsk_rrl_uninit(&ns->rrl);
+  hsk_slab_uninit(&ns->reqs);
 
-  if (ns->ec) {
-    hsk_ec_free(ns->ec);
-    ns->ec = NULL;
-  }
+  ns->ec = NULL;
 
-  hsk_cache_uninit(&ns->cache);
+  for (int i = 0; i < ns->worker_count; i++)
+    hsk_ns_free(ns->workers[i]);
+
+  hsk_free(ns->workers);
+  ns->workers = NULL;
+  ns->worker_count = 0;
+
+  hsk_pool_client_uninit(&ns->client);
+  hsk_ns_free_root(ns);
+  hsk_ns_free_zone(ns);
+  hsk_ns_prefetch_clear(ns);
+  hsk_ns_shared_clear(ns);
+
+  // Workers borrow the parent's shards.
+  if (!ns->parent)
+    hsk_ns_free_shards(ns);
+
+  hsk_top_uninit(&ns->top_names);
+  hsk_top_uninit(&ns->top_tlds);
+  hsk_tracer_uninit(&ns->tracer);
+  uv_mutex_destroy(&ns->lock);
 }
 
 bool
@@ -171,430 +452,3807 @@ hsk_ns_set_key(hsk_ns_t *ns, const uint8_t *key) {
   return true;
 }
 
-int
-hsk_ns_open(hsk_ns_t *ns, const struct sockaddr *addr) {
-  if (!ns || !addr)
-    return HSK_EBADARGS;
-
-  if (uv_udp_init(ns->loop, &ns->socket) != 0)
-    return HSK_EFAILURE;
-
-  ns->socket.data = (void *)ns;
+// Split evenly between the shards.
+bool
+hsk_ns_set_cache_size(hsk_ns_t *ns, size_t size) {
+  assert(ns);
 
-  if (uv_udp_bind(&ns->socket, addr, 0) != 0)
-    return HSK_EFAILURE;
+  if (size == 0)
+    return false;
 
-  ns->bound = true;
+  ns->cache_size = size;
 
-  int value = sizeof(ns->read_buffer);
+  size_t shard_size = size / ns->shard_count;
 
-  if (uv_send_buffer_size((uv_handle_t *)&ns->socket, &value) != 0)
-    return HSK_EFAILURE;
+  if (shard_size == 0)
+    shard_size = 1;
 
-  if (uv_recv_buffer_size((uv_handle_t *)&ns->socket, &value) != 0)
-    return HSK_EFAILURE;
+  for (int i = 0; i < ns->shard_count; i++) {
+    hsk_ns_shard_t *shard = &ns->shards[i];
+    uv_mutex_lock(&shard->lock);
+    hsk_cache_set_size(&shard->cache, shard_size);
+    uv_mutex_unlock(&shard->lock);
+  }
 
-  if (uv_udp_recv_start(&ns->socket, alloc_buffer, after_recv) != 0)
-    return HSK_EFAILURE;
+  return true;
+}
 
-  ns->receiving = true;
+// Bounds on how long answers are cached (see
+// cache.h), the same for every shard.
+bool
+hsk_ns_set_ttl(
+  hsk_ns_t *ns,
+  uint32_t min_ttl,
+  uint32_t max_ttl,
+  uint32_t neg_ttl
+) {
+  assert(ns);
 
-  if (!ns->ip)
-    hsk_ns_set_ip(ns, addr);
+  if (min_ttl > max_ttl)
+    return false;
 
-  char host[HSK_MAX_HOST];
-  assert(hsk_sa_to_string(addr, host, HSK_MAX_HOST, HSK_NS_PORT));
+  ns->min_ttl = min_ttl;
+  ns->max_ttl = max_ttl;
+  ns->neg_ttl = neg_ttl;
 
-  hsk_ns_log(ns, "root nameserver listening on: %s\n", host);
+  for (int i = 0; i < ns->shard_count; i++) {
+    hsk_ns_shard_t *shard = &ns->shards[i];
+    uv_mutex_lock(&shard->lock);
+    hsk_cache_set_ttl(&shard->cache, min_ttl, max_ttl, neg_ttl);
+    uv_mutex_unlock(&shard->lock);
+  }
 
-  return HSK_SUCCESS;
+  return true;
 }
 
-int
-hsk_ns_close(hsk_ns_t *ns) {
-  if (!ns)
-    return HSK_EBADARGS;
+// The cache is saved under the prefix every
+// HSK_NS_CACHE_FLUSH and on close, and what is
+// still valid loaded back on open.
+bool
+hsk_ns_set_prefix(hsk_ns_t *ns, const char *prefix) {
+  assert(ns);
 
-  if (ns->receiving) {
-    if (uv_udp_recv_stop(&ns->socket) != 0)
-      return HSK_EFAILURE;
-    ns->receiving = false;
-  }
+  if (ns->bound || ns->parent)
+    return false;
 
-  if (ns->bound) {
-    uv_close((uv_handle_t *)&ns->socket, after_close);
-    ns->bound = false;
+  if (!prefix) {
+    memset(ns->cache_path, 0, sizeof(ns->cache_path));
+    return true;
   }
 
-  ns->socket.data = NULL;
-
-  return HSK_SUCCESS;
-}
-
-hsk_ns_t *
-hsk_ns_alloc(const uv_loop_t *loop, const hsk_pool_t *pool) {
-  hsk_ns_t *ns = malloc(sizeof(hsk_ns_t));
+  size_t size = strlen(prefix) + sizeof(HSK_NS_CACHE_FILE) + 5;
 
-  if (!ns)
-    return NULL;
+  if (size > sizeof(ns->cache_path))
+    return false;
 
-  if (hsk_ns_init(ns, loop, pool) != HSK_SUCCESS) {
-    free(ns);
-    return NULL;
-  }
+  sprintf(ns->cache_path, "%s/%s", prefix, HSK_NS_CACHE_FILE);
 
-  return ns;
+  return true;
 }
 
-void
-hsk_ns_free(hsk_ns_t *ns) {
-  if (!ns)
-    return;
+bool
+hsk_ns_set_workers(hsk_ns_t *ns, int count) {
+  assert(ns);
 
-  hsk_ns_uninit(ns);
-  free(ns);
-}
+  if (count < 0 || count > HSK_NS_WORKERS_MAX)
+    return false;
 
-int
-hsk_ns_destroy(hsk_ns_t *ns) {
-  if (!ns)
-    return HSK_EBADARGS;
+  if (ns->bound || ns->parent)
+    return false;
 
-  int rc = hsk_ns_close(ns);
+  hsk_ns_free_shards(ns);
 
-  if (rc != 0)
-    return rc;
+  if (!hsk_ns_init_shards(ns, count > 0 ? HSK_NS_SHARDS : 1))
+    return false;
 
-  hsk_ns_free(ns);
+  ns->worker_count = count;
 
-  return HSK_SUCCESS;
+  if (!hsk_ns_set_ttl(ns, ns->min_ttl, ns->max_ttl, ns->neg_ttl))
+    return false;
+
+  return hsk_ns_set_cache_size(ns, ns->cache_size);
 }
 
-static void
-hsk_ns_log(hsk_ns_t *ns, const char *fmt, ...) {
-  printf("ns: ");
+// Sign replies on the libuv threadpool
+// (UV_THREADPOOL_SIZE) instead of the loop.
+bool
+hsk_ns_set_offload(hsk_ns_t *ns, bool offload) {
+  assert(ns);
 
-  va_list args;
-  va_start(args, fmt);
-  vprintf(fmt, args);
-  va_end(args);
+  if (ns->bound || ns->parent)
+    return false;
+
+  ns->offload = offload;
+
+  return true;
 }
 
-static void
-hsk_ns_onrecv(
-  hsk_ns_t *ns,
-  const uint8_t *data,
-  size_t data_len,
-  const struct sockaddr *addr,
-  uint32_t flags
-) {
-  hsk_dns_req_t *req = hsk_dns_req_create(data, data_len, addr);
+// Leave out the additional data a referral
+// can do without (see hsk_resource_to_dns).
+bool
+hsk_ns_set_minimal(hsk_ns_t *ns, bool minimal) {
+  assert(ns);
 
-  if (!req) {
-    hsk_ns_log(ns, "failed processing dns request\n");
-    return;
-  }
+  if (ns->bound || ns->parent)
+    return false;
 
-  hsk_dns_req_print(req, "ns: ");
+  ns->minimal = minimal;
 
-  uint8_t *wire = NULL;
-  size_t wire_len = 0;
-  hsk_dns_msg_t *msg = NULL;
+  return true;
+}
 
-  // Hit cache first.
-  msg = hsk_cache_get(&ns->cache, req);
+// Answer ANY with a synthesized HINFO record
+// rather than one of the name's RRsets (see
+// hsk_resource_to_any).
+bool
+hsk_ns_set_any_hinfo(hsk_ns_t *ns, bool hinfo) {
+  assert(ns);
 
-  if (msg) {
-    if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
-      hsk_ns_log(ns, "could not reply\n");
-      goto fail;
-    }
+  if (ns->bound || ns->parent)
+    return false;
 
-    hsk_ns_log(ns, "sending cached msg (%u): %u\n", req->id, wire_len);
+  ns->any_hinfo = hinfo;
 
-    hsk_ns_send(ns, wire, wire_len, addr, true);
+  return true;
+}
 
-    goto done;
-  }
+// Send SERVFAIL without SIG(0), so that
+// failing costs no signature (when overloaded,
+// most of all).
+bool
+hsk_ns_set_unsigned_errors(hsk_ns_t *ns, bool unsigned_errors) {
+  assert(ns);
 
-  // Requesting a lookup.
-  if (req->labels > 0) {
-    req->ns = (void *)ns;
+  if (ns->bound || ns->parent)
+    return false;
 
-    int rc = hsk_pool_resolve(
-      ns->pool,
-      req->tld,
-      after_resolve,
-      (void *)req
-    );
+  ns->unsigned_errors = unsigned_errors;
 
-    if (rc != HSK_SUCCESS) {
-      hsk_ns_log(ns, "pool resolve error: %s\n", hsk_strerror(rc));
-      goto fail;
-    }
+  return true;
+}
 
-    return;
-  }
+// Queries from our own resolver need no SIG(0)
+// (it ignores them anyway), so they get their
+// own socket pair on an ephemeral port.
+static int
+hsk_ns_open_local(hsk_ns_t *ns) {
+  struct sockaddr *addr = (struct sockaddr *)&ns->local_addr;
+  int addr_len = sizeof(ns->local_addr);
 
-  // Querying the root zone.
-  msg = hsk_resource_root(req->type, ns->ip);
+  assert(hsk_sa_from_string(addr, "127.0.0.1", 0));
 
-  if (!msg) {
-    hsk_ns_log(ns, "could not create root soa\n");
-    goto fail;
-  }
+  if (uv_tcp_init(ns->loop, &ns->local_tcp) != 0)
+    return HSK_EFAILURE;
 
-  hsk_cache_insert(&ns->cache, req, msg);
+  ns->local_tcp.data = (void *)ns;
+  ns->local_listening = true;
 
-  if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
-    hsk_ns_log(ns, "could not reply\n");
+  if (uv_tcp_bind(&ns->local_tcp, addr, 0) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_tcp_getsockname(&ns->local_tcp, addr, &addr_len) != 0)
+    return HSK_EFAILURE;
+
+  uv_stream_t *stream = (uv_stream_t *)&ns->local_tcp;
+
+  if (uv_listen(stream, 128, after_connection) != 0)
+    return HSK_EFAILURE;
+
+  if (hsk_udp_open(&ns->local, addr, false) != HSK_SUCCESS)
+    return HSK_EFAILURE;
+
+  ns->local_bound = true;
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_ns_close_local(hsk_ns_t *ns) {
+  if (ns->local_bound) {
+    hsk_udp_close(&ns->local);
+    ns->local_bound = false;
+  }
+
+  if (ns->local_listening) {
+    uv_close((uv_handle_t *)&ns->local_tcp, after_close);
+    ns->local_listening = false;
+  }
+}
+
+// Queries per second from each source prefix
+// (0 for no limit). This loop and each worker
+// keep tables of their own, each with an even
+// share of the rate (see hsk_rrl_share).
+bool
+hsk_ns_set_rate_limit(hsk_ns_t *ns, uint32_t rate) {
+  assert(ns);
+
+  if (ns->bound)
+    return false;
+
+  return hsk_rrl_set_rate(&ns->rrl, rate);
+}
+
+// Kernel buffers of the UDP sockets, in bytes
+// (0 for the system's defaults; see udp.h).
+bool
+hsk_ns_set_udp_buffers(hsk_ns_t *ns, int rcvbuf, int sndbuf) {
+  assert(ns);
+
+  if (ns->bound)
+    return false;
+
+  return hsk_udp_set_buffers(&ns->udp, rcvbuf, sndbuf);
+}
+
+// Trace one in every `rate` queries (0 for
+// none), for hsk_ns_dump_trace.
+bool
+hsk_ns_set_trace(hsk_ns_t *ns, uint32_t rate) {
+  assert(ns);
+
+  if (ns->bound)
+    return false;
+
+  return hsk_tracer_set_rate(&ns->tracer, rate);
+}
+
+// Record every query into `capture`, which
+// outlives the server. Workers share it.
+bool
+hsk_ns_set_capture(hsk_ns_t *ns, hsk_capture_t *capture) {
+  assert(ns);
+
+  if (ns->bound || ns->parent)
+    return false;
+
+  ns->capture = capture;
+
+  return true;
+}
+
+// Sockets bound to the address there are
+// opened on rather than bound again (see
+// hsk_handoff_take). Workers share it.
+bool
+hsk_ns_set_handoff(hsk_ns_t *ns, hsk_handoff_t *handoff) {
+  assert(ns);
+
+  if (ns->bound || ns->parent)
+    return false;
+
+  ns->handoff = handoff;
+
+  return true;
+}
+
+// Looked up when the shards miss, and written
+// through on insert. Outlives the server, and
+// workers share it.
+bool
+hsk_ns_set_shared_cache(hsk_ns_t *ns, hsk_shm_t *shm) {
+  assert(ns);
+
+  if (ns->bound || ns->parent)
+    return false;
+
+  ns->shm = shm;
+
+  return true;
+}
+
+// Workers are pinned to CPUs from the list,
+// the first to the `first`th.
+bool
+hsk_ns_set_affinity(hsk_ns_t *ns, const hsk_affinity_t *aff, int first) {
+  assert(ns);
+
+  if (ns->bound || ns->parent || first < 0)
+    return false;
+
+  ns->affinity = aff;
+  ns->affinity_first = first;
+
+  return true;
+}
+
+int
+hsk_ns_open(hsk_ns_t *ns, const struct sockaddr *addr) {
+  if (!ns || !addr)
+    return HSK_EBADARGS;
+
+  bool reuseport = ns->parent || ns->worker_count > 0;
+  int fd = hsk_handoff_take(ns->handoff, addr, SOCK_DGRAM);
+
+  if (fd != -1) {
+    if (hsk_udp_open_fd(&ns->udp, fd) != HSK_SUCCESS)
+      return HSK_EFAILURE;
+  } else {
+    if (hsk_udp_open(&ns->udp, addr, reuseport) != HSK_SUCCESS)
+      return HSK_EFAILURE;
+  }
+
+  ns->bound = true;
+
+  // The parent runs on the caller's thread.
+  if (!ns->parent)
+    ns->cpu = hsk_affinity_current();
+
+  if (reuseport)
+    hsk_udp_set_cpu(&ns->udp, ns->cpu);
+
+  if (!ns->ip)
+    hsk_ns_set_ip(ns, addr);
+
+  if (ns->parent)
+    return HSK_SUCCESS;
+
+  if (hsk_ns_remote(ns)) {
+    if (hsk_pool_client_open(&ns->client) != HSK_SUCCESS)
+      return HSK_EFAILURE;
+  }
+
+  // Before the workers start answering.
+  hsk_icann_load();
+
+  if (ns->cache_path[0] != '\0') {
+    char prefix[sizeof(ns->cache_path)];
+    char *slash;
+
+    strcpy(prefix, ns->cache_path);
+    slash = strrchr(prefix, '/');
+    *slash = '\0';
+
+    if (mkdir(prefix, 0755) != 0 && errno != EEXIST)
+      return HSK_EFAILURE;
+
+    if (hsk_ns_load_cache(ns) != HSK_SUCCESS)
+      hsk_ns_log(ns, "could not load cache from %s\n", ns->cache_path);
+
+    if (uv_timer_init(ns->loop, &ns->save_timer) != 0)
+      return HSK_EFAILURE;
+
+    ns->save_timer.data = (void *)ns;
+    ns->saving = true;
+
+    uint64_t flush = HSK_NS_CACHE_FLUSH;
+    uv_timer_start(&ns->save_timer, after_save_timer, flush, flush);
+  }
+
+  if (!hsk_ns_sign_root(ns))
+    return HSK_ENOMEM;
+
+  if (uv_timer_init(ns->loop, &ns->root_timer) != 0)
+    return HSK_EFAILURE;
+
+  ns->root_timer.data = (void *)ns;
+  ns->signing = true;
+
+  uint64_t refresh = HSK_NS_ROOT_REFRESH;
+  uv_timer_start(&ns->root_timer, after_root_timer, refresh, refresh);
+
+  // TCP stays on the parent's loop.
+  if (uv_tcp_init(ns->loop, &ns->tcp) != 0)
+    return HSK_EFAILURE;
+
+  ns->tcp.data = (void *)ns;
+  ns->listening = true;
+
+  fd = hsk_handoff_take(ns->handoff, addr, SOCK_STREAM);
+
+  if (fd != -1) {
+    if (uv_tcp_open(&ns->tcp, fd) != 0) {
+      close(fd);
+      return HSK_EFAILURE;
+    }
+  } else {
+    if (uv_tcp_bind(&ns->tcp, addr, 0) != 0)
+      return HSK_EFAILURE;
+  }
+
+  if (uv_listen((uv_stream_t *)&ns->tcp, 128, after_connection) != 0)
+    return HSK_EFAILURE;
+
+  // Not fatal: the resolver can still use the
+  // public address.
+  if (hsk_ns_open_local(ns) != HSK_SUCCESS) {
+    hsk_ns_log(ns, "could not open local listener\n");
+    hsk_ns_close_local(ns);
+  }
+
+  if (ns->worker_count > 0) {
+    int rc = hsk_ns_start_workers(ns, addr);
+
+    if (rc != HSK_SUCCESS)
+      return rc;
+  }
+
+  char host[HSK_MAX_HOST];
+  assert(hsk_sa_to_string(addr, host, HSK_MAX_HOST, HSK_NS_PORT));
+
+  hsk_ns_log(ns, "root nameserver listening on: %s\n", host);
+
+  return HSK_SUCCESS;
+}
+
+// What another process would need to take
+// over: the public sockets, workers' too.
+int
+hsk_ns_get_fds(const hsk_ns_t *ns, int *fds, int max) {
+  assert(ns && fds);
+
+  int count = 0;
+  uv_os_fd_t fd;
+  int i;
+
+  if (ns->bound && count < max)
+    fds[count++] = ns->udp.fd;
+
+  if (ns->listening && count < max) {
+    if (uv_fileno((uv_handle_t *)&ns->tcp, &fd) == 0)
+      fds[count++] = fd;
+  }
+
+  for (i = 0; i < ns->worker_count && count < max; i++) {
+    const hsk_ns_t *w = ns->workers[i];
+
+    if (w && w->bound)
+      fds[count++] = w->udp.fd;
+  }
+
+  return count;
+}
+
+// Written out now, for another process to
+// load (see hsk_handoff_open).
+int
+hsk_ns_save(hsk_ns_t *ns) {
+  if (!ns)
+    return HSK_EBADARGS;
+
+  if (!ns->saving)
+    return HSK_SUCCESS;
+
+  return hsk_ns_save_cache(ns);
+}
+
+int
+hsk_ns_close(hsk_ns_t *ns) {
+  if (!ns)
+    return HSK_EBADARGS;
+
+  if (!ns->parent)
+    hsk_ns_stop_workers(ns);
+
+  if (ns->bound) {
+    hsk_udp_close(&ns->udp);
+    ns->bound = false;
+  }
+
+  if (ns->listening) {
+    while (ns->conns)
+      hsk_ns_conn_close((hsk_ns_conn_t *)ns->conns);
+
+    uv_close((uv_handle_t *)&ns->tcp, after_close);
+    ns->listening = false;
+  }
+
+  hsk_ns_close_local(ns);
+
+  if (ns->signing) {
+    uv_close((uv_handle_t *)&ns->root_timer, after_close);
+    ns->signing = false;
+  }
+
+  // The workers are stopped: nothing else
+  // touches the shards.
+  if (ns->saving) {
+    if (hsk_ns_save_cache(ns) != HSK_SUCCESS)
+      hsk_ns_log(ns, "could not save cache to %s\n", ns->cache_path);
+
+    uv_close((uv_handle_t *)&ns->save_timer, after_close);
+    ns->saving = false;
+  }
+
+  if (ns->prefetching) {
+    uv_close((uv_handle_t *)&ns->prefetch_timer, after_close);
+    ns->prefetching = false;
+  }
+
+  hsk_pool_client_close(&ns->client);
+
+  if (ns->parent)
+    uv_close((uv_handle_t *)&ns->async, after_close);
+
+  return HSK_SUCCESS;
+}
+
+// Where our own recursive resolver should
+// send its queries, if the listener is up.
+bool
+hsk_ns_get_local(const hsk_ns_t *ns, struct sockaddr *addr) {
+  assert(ns && addr);
+
+  if (!ns->local_bound || !ns->local_listening)
+    return false;
+
+  return hsk_sa_copy(addr, (const struct sockaddr *)&ns->local_addr);
+}
+
+hsk_ns_t *
+hsk_ns_alloc(const uv_loop_t *loop, const hsk_pool_t *pool) {
+  hsk_ns_t *ns = hsk_malloc(sizeof(hsk_ns_t));
+
+  if (!ns)
+    return NULL;
+
+  if (hsk_ns_init(ns, loop, pool) != HSK_SUCCESS) {
+    hsk_free(ns);
+    return NULL;
+  }
+
+  return ns;
+}
+
+void
+hsk_ns_free(hsk_ns_t *ns) {
+  if (!ns)
+    return;
+
+  hsk_ns_uninit(ns);
+  hsk_free(ns);
+}
+
+int
+hsk_ns_destroy(hsk_ns_t *ns) {
+  if (!ns)
+    return HSK_EBADARGS;
+
+  int rc = hsk_ns_close(ns);
+
+  if (rc != 0)
+    return rc;
+
+  hsk_ns_free(ns);
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * Workers
+ */
+
+static bool
+hsk_ns_init_shards(hsk_ns_t *ns, int count) {
+  ns->shards = hsk_malloc(count * sizeof(hsk_ns_shard_t));
+
+  if (!ns->shards)
+    return false;
+
+  for (int i = 0; i < count; i++) {
+    hsk_ns_shard_t *shard = &ns->shards[i];
+
+    if (uv_mutex_init(&shard->lock) != 0) {
+      ns->shard_count = i;
+      hsk_ns_free_shards(ns);
+      return false;
+    }
+
+    hsk_cache_init(&shard->cache);
+  }
+
+  ns->shard_count = count;
+
+  return true;
+}
+
+static void
+hsk_ns_free_shards(hsk_ns_t *ns) {
+  for (int i = 0; i < ns->shard_count; i++) {
+    hsk_ns_shard_t *shard = &ns->shards[i];
+    hsk_cache_uninit(&shard->cache);
+    uv_mutex_destroy(&shard->lock);
+  }
+
+  hsk_free(ns->shards);
+
+  ns->shards = NULL;
+  ns->shard_count = 0;
+}
+
+static hsk_ns_shard_t *
+hsk_ns_tld_shard(const hsk_ns_t *ns, const char *tld) {
+  if (ns->shard_count == 1)
+    return &ns->shards[0];
+
+  uint32_t hash = hsk_map_murmur3((const uint8_t *)tld, strlen(tld), 0);
+
+  return &ns->shards[hash % ns->shard_count];
+}
+
+// By TLD, so a name and its referral (and
+// their finalized replies) share a shard.
+static hsk_ns_shard_t *
+hsk_ns_shard(const hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  return hsk_ns_tld_shard(ns, req->tld);
+}
+
+// Any thread may read the chain's view.
+static void
+hsk_ns_safe_root(hsk_ns_t *ns, uint8_t *root) {
+  hsk_chain_view_t view;
+  hsk_chain_get_view(&ns->pool->chain, &view);
+  memcpy(root, view.safe_root, 32);
+}
+
+// Locked, and told the current root so that
+// entries from before it are revalidated.
+static hsk_ns_shard_t *
+hsk_ns_lock_shard(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  uint8_t root[32];
+  hsk_ns_safe_root(ns, root);
+
+  hsk_ns_shard_t *shard = hsk_ns_shard(ns, req);
+  uv_mutex_lock(&shard->lock);
+  hsk_cache_set_root(&shard->cache, root);
+  return shard;
+}
+
+// Copied into the shard on a hit, aged from
+// when the other process fetched it.
+static hsk_dns_msg_t *
+hsk_ns_shm_get(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  uint8_t root[32];
+  uint8_t data[HSK_SHM_DATA];
+  size_t data_len;
+  int64_t time, expires;
+
+  hsk_ns_safe_root(ns, root);
+
+  if (!hsk_shm_get(ns->shm, req->name, req->type, root,
+                   data, &data_len, &time, &expires)) {
+    return NULL;
+  }
+
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  hsk_dns_msg_t *msg = NULL;
+
+  if (hsk_cache_insert_entry(&shard->cache, req->name, req->type,
+                             data, data_len, time, expires)) {
+    msg = hsk_cache_get(&shard->cache, req);
+  }
+
+  uv_mutex_unlock(&shard->lock);
+
+  return msg;
+}
+
+// Under the shard's lock, after an insert.
+static void
+hsk_ns_shm_put(hsk_ns_t *ns, hsk_ns_shard_t *shard, const hsk_dns_req_t *req) {
+  uint8_t root[32];
+  uint8_t *data;
+  size_t data_len;
+  int64_t time, expires;
+
+  if (!hsk_cache_get_entry(&shard->cache, req->name, req->type,
+                           &data, &data_len, &time, &expires)) {
+    return;
+  }
+
+  hsk_ns_safe_root(ns, root);
+  hsk_shm_put(ns->shm, req->name, req->type, root,
+              data, data_len, time, expires);
+}
+
+static hsk_dns_msg_t *
+hsk_ns_cache_get(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  hsk_dns_msg_t *msg = hsk_cache_get(&shard->cache, req);
+  uv_mutex_unlock(&shard->lock);
+
+  if (!msg && ns->shm)
+    msg = hsk_ns_shm_get(ns, req);
+
+  return msg;
+}
+
+static hsk_dns_msg_t *
+hsk_ns_cache_get_stale(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  hsk_dns_msg_t *msg = hsk_cache_get_stale(&shard->cache, req);
+  uv_mutex_unlock(&shard->lock);
+  return msg;
+}
+
+static bool
+hsk_ns_cache_insert(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  const hsk_dns_msg_t *msg
+) {
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  bool ret = hsk_cache_insert(&shard->cache, req, msg);
+  if (ret && ns->shm)
+    hsk_ns_shm_put(ns, shard, req);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static bool
+hsk_ns_cache_insert_encoded(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  const hsk_dns_msg_t *msg,
+  const uint8_t *wire,
+  size_t wire_len
+) {
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  bool ret = hsk_cache_insert_encoded(&shard->cache, req, msg, wire, wire_len);
+  if (ret && ns->shm)
+    hsk_ns_shm_put(ns, shard, req);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static bool
+hsk_ns_cache_get_wire(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  bool ret = hsk_cache_get_wire(&shard->cache, req, wire, wire_len);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static bool
+hsk_ns_cache_insert_wire(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  const uint8_t *wire,
+  size_t wire_len
+) {
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  bool ret = hsk_cache_insert_wire(&shard->cache, req, wire, wire_len);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static bool
+hsk_ns_cache_should_refresh(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  hsk_ns_shard_t *shard = hsk_ns_lock_shard(ns, req);
+  bool ret = hsk_cache_should_refresh(&shard->cache, req);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+// Whether the pool runs on another loop, to be
+// reached through our client.
+static bool
+hsk_ns_remote(const hsk_ns_t *ns) {
+  return ns->loop != ns->pool->loop;
+}
+
+static bool
+hsk_ns_cache_insert_nx(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  const hsk_dns_msg_t *msg
+) {
+  uint8_t root[32];
+  hsk_ns_safe_root(ns, root);
+
+  hsk_ns_shard_t *shard = hsk_ns_shard(ns, req);
+  uv_mutex_lock(&shard->lock);
+  bool ret = hsk_cache_insert_nx(&shard->cache, req->tld, root, msg);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static bool
+hsk_ns_cache_has_nx(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  uint8_t root[32];
+  hsk_ns_safe_root(ns, root);
+
+  hsk_ns_shard_t *shard = hsk_ns_shard(ns, req);
+  uv_mutex_lock(&shard->lock);
+  bool ret = hsk_cache_has_nx(&shard->cache, req->tld, root);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static bool
+hsk_ns_cache_insert_ref(
+  hsk_ns_t *ns,
+  const char *tld,
+  const uint8_t *data,
+  size_t data_len,
+  uint32_t ttl
+) {
+  uint8_t root[32];
+  hsk_ns_safe_root(ns, root);
+
+  hsk_ns_shard_t *shard = hsk_ns_tld_shard(ns, tld);
+  uv_mutex_lock(&shard->lock);
+  hsk_cache_set_root(&shard->cache, root);
+  bool ret = hsk_cache_insert_ref(&shard->cache, tld, root,
+                                  data, data_len, ttl);
+
+  // Kept as long as in the shard.
+  if (ret && ns->shm) {
+    if (ttl < shard->cache.min_ttl)
+      ttl = shard->cache.min_ttl;
+
+    if (ttl > shard->cache.max_ttl)
+      ttl = shard->cache.max_ttl;
+
+    hsk_shm_put_resource(ns->shm, tld, root, data, data_len,
+                         hsk_now() + ttl);
+  }
+
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+// Copied into the shard on a hit, for what is
+// left of its TTL.
+static bool
+hsk_ns_shm_get_ref(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  const uint8_t *root,
+  uint8_t **data,
+  size_t *data_len
+) {
+  uint8_t buf[HSK_SHM_DATA];
+  size_t len;
+  int64_t expires;
+
+  if (!hsk_shm_get_resource(ns->shm, req->tld, root, buf, &len, &expires))
+    return false;
+
+  int64_t ttl = expires - hsk_now();
+
+  if (ttl <= 0)
+    return false;
+
+  uint8_t *copy = NULL;
+
+  if (len > 0) {
+    copy = hsk_malloc(len);
+
+    if (!copy)
+      return false;
+
+    memcpy(copy, buf, len);
+  }
+
+  hsk_ns_shard_t *shard = hsk_ns_shard(ns, req);
+  uv_mutex_lock(&shard->lock);
+  hsk_cache_set_root(&shard->cache, root);
+  hsk_cache_insert_ref(&shard->cache, req->tld, root,
+                       buf, len, (uint32_t)ttl);
+  uv_mutex_unlock(&shard->lock);
+
+  *data = copy;
+  *data_len = len;
+
+  return true;
+}
+
+// The resource as proven (empty for an ICANN
+// TLD), a copy.
+static bool
+hsk_ns_cache_get_ref_data(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t **data,
+  size_t *data_len
+) {
+  uint8_t root[32];
+  hsk_ns_safe_root(ns, root);
+
+  hsk_ns_shard_t *shard = hsk_ns_shard(ns, req);
+  uv_mutex_lock(&shard->lock);
+  hsk_cache_set_root(&shard->cache, root);
+  bool ret = hsk_cache_get_ref(&shard->cache, req->tld, root,
+                               data, data_len);
+  uv_mutex_unlock(&shard->lock);
+
+  if (!ret && ns->shm)
+    ret = hsk_ns_shm_get_ref(ns, req, root, data, data_len);
+
+  return ret;
+}
+
+// Decoded outside of the lock.
+static hsk_resource_t *
+hsk_ns_cache_get_ref(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+  hsk_resource_t *res = NULL;
+
+  if (!hsk_ns_cache_get_ref_data(ns, req, &data, &data_len))
+    return NULL;
+
+  if (data_len == 0) {
+    if (hsk_icann_lookup(req->tld, &res) != HSK_SUCCESS)
+      res = NULL;
+  } else {
+    if (!hsk_resource_decode_for(data, data_len, req->type, &res))
+      res = NULL;
+    hsk_free(data);
+  }
+
+  return res;
+}
+
+// Workers (and a parent off the pool's loop)
+// reach the pool through a client of their
+// own.
+static int
+hsk_ns_resolve_tld(
+  hsk_ns_t *ns,
+  const char *tld,
+  int priority,
+  hsk_resolve_cb callback,
+  void *arg
+) {
+  if (!hsk_ns_remote(ns)) {
+    return hsk_pool_resolve_priority(ns->pool, tld, priority,
+                                     callback, arg);
+  }
+
+  return hsk_pool_client_resolve_priority(&ns->client, tld, priority,
+                                          callback, arg);
+}
+
+// On success the request is owned by the
+// lookup.
+static int
+hsk_ns_resolve(
+  hsk_ns_t *ns,
+  hsk_dns_req_t *req,
+  int priority,
+  hsk_resolve_cb callback
+) {
+  return hsk_ns_resolve_tld(ns, req->tld, priority, callback, (void *)req);
+}
+
+// How a worker learns it should close.
+static void
+after_stop(uv_async_t *handle) {
+  hsk_ns_t *ns = (hsk_ns_t *)handle->data;
+
+  uv_mutex_lock(&ns->lock);
+  bool running = ns->running;
+  uv_mutex_unlock(&ns->lock);
+
+  if (!running)
+    hsk_ns_close(ns);
+}
+
+static void
+hsk_ns_run(void *arg) {
+  hsk_ns_t *ns = (hsk_ns_t *)arg;
+
+  // Before the first read touches the buffers.
+  if (hsk_affinity_pin(ns->cpu) != HSK_SUCCESS)
+    hsk_ns_log(ns, "could not pin worker to cpu %d\n", ns->cpu);
+
+  uv_run(ns->loop, UV_RUN_DEFAULT);
+}
+
+static int
+hsk_ns_start_workers(hsk_ns_t *ns, const struct sockaddr *addr) {
+  int count = ns->worker_count;
+  uint32_t rate = hsk_rrl_share(ns->rrl.rate, count + 1);
+
+  ns->worker_count = 0;
+  ns->workers = hsk_calloc(count, sizeof(hsk_ns_t *));
+
+  if (!ns->workers)
+    return HSK_ENOMEM;
+
+  for (int i = 0; i < count; i++) {
+    hsk_ns_t *w = hsk_malloc(sizeof(hsk_ns_t));
+
+    if (!w)
+      return HSK_ENOMEM;
+
+    if (uv_loop_init(&w->loop_) != 0) {
+      hsk_free(w);
+      return HSK_EFAILURE;
+    }
+
+    if (hsk_ns_init(w, &w->loop_, ns->pool) != HSK_SUCCESS) {
+      uv_loop_close(&w->loop_);
+      hsk_free(w);
+      return HSK_EFAILURE;
+    }
+
+    ns->workers[ns->worker_count++] = w;
+
+    hsk_ns_free_shards(w);
+
+    w->parent = ns;
+    w->shards = ns->shards;
+    w->shard_count = ns->shard_count;
+    w->cache_size = ns->cache_size;
+    w->ip_ = ns->ip_;
+    w->ip = ns->ip ? &w->ip_ : NULL;
+    w->offload = ns->offload;
+    w->minimal = ns->minimal;
+    w->any_hinfo = ns->any_hinfo;
+    w->unsigned_errors = ns->unsigned_errors;
+    w->capture = ns->capture;
+    w->handoff = ns->handoff;
+    w->cpu = hsk_affinity_get(ns->affinity, ns->affinity_first + i);
+    w->shm = ns->shm;
+
+    if (!hsk_rrl_set_rate(&w->rrl, rate))
+      return HSK_ENOMEM;
+
+    if (!hsk_udp_set_buffers(&w->udp, ns->udp.rcvbuf, ns->udp.sndbuf))
+      return HSK_EFAILURE;
+
+    if (!hsk_ns_set_key(w, ns->key))
+      return HSK_EFAILURE;
+
+    if (uv_async_init(w->loop, &w->async, after_stop) != 0)
+      return HSK_EFAILURE;
+
+    w->async.data = (void *)w;
+
+    if (hsk_pool_client_open(&w->client) != HSK_SUCCESS)
+      return HSK_EFAILURE;
+    w->running = true;
+
+    int rc = hsk_ns_open(w, addr);
+
+    if (rc != HSK_SUCCESS)
+      return rc;
+
+    if (uv_thread_create(&w->thread, hsk_ns_run, (void *)w) != 0) {
+      w->running = false;
+      return HSK_EFAILURE;
+    }
+  }
+
+  // The parent reads the same port.
+  if (!hsk_rrl_set_rate(&ns->rrl, rate))
+    return HSK_ENOMEM;
+
+  hsk_ns_log(ns, "started %d worker threads\n", count);
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_ns_stop_workers(hsk_ns_t *ns) {
+  for (int i = 0; i < ns->worker_count; i++) {
+    hsk_ns_t *w = ns->workers[i];
+
+    uv_mutex_lock(&w->lock);
+
+    if (!w->running) {
+      uv_mutex_unlock(&w->lock);
+      continue;
+    }
+
+    w->running = false;
+    uv_async_send(&w->async);
+    uv_mutex_unlock(&w->lock);
+
+    uv_thread_join(&w->thread);
+    uv_loop_close(&w->loop_);
+  }
+}
+
+static void
+hsk_ns_log(hsk_ns_t *ns, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("ns: ", fmt, args);
+  va_end(args);
+}
+
+/*
+ * Cache File
+ */
+
+static hsk_cache_t *
+hsk_ns_pick_cache(const char *tld, void *arg) {
+  hsk_ns_t *ns = (hsk_ns_t *)arg;
+  return &hsk_ns_tld_shard(ns, tld)->cache;
+}
+
+// Before anything answers: the shards are not
+// locked. A file from another network, version
+// or shard count is ignored (entries go by TLD,
+// not by the shard they were saved from).
+static int
+hsk_ns_load_cache(hsk_ns_t *ns) {
+  FILE *file = fopen(ns->cache_path, "rb");
+
+  // Nothing saved yet.
+  if (!file)
+    return HSK_SUCCESS;
+
+  int rc = HSK_EENCODING;
+  uint8_t *raw = NULL;
+
+  if (fseek(file, 0, SEEK_END) != 0)
+    goto done;
+
+  long size = ftell(file);
+
+  if (size < HSK_NS_CACHE_HDR_SIZE || fseek(file, 0, SEEK_SET) != 0)
+    goto done;
+
+  raw = hsk_malloc((size_t)size);
+
+  if (!raw) {
+    rc = HSK_ENOMEM;
+    goto done;
+  }
+
+  if (fread(raw, 1, (size_t)size, file) != (size_t)size)
+    goto done;
+
+  uint8_t *data = raw;
+  size_t data_len = (size_t)size;
+  uint32_t magic, version, network, count;
+
+  read_u32(&data, &data_len, &magic);
+  read_u32(&data, &data_len, &version);
+  read_u32(&data, &data_len, &network);
+  read_u32(&data, &data_len, &count);
+
+  if (magic != HSK_NS_CACHE_MAGIC
+      || version != HSK_NS_CACHE_VERSION
+      || network != HSK_MAGIC) {
+    goto done;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (!hsk_cache_read(&data, &data_len, hsk_ns_pick_cache, (void *)ns))
+      goto done;
+  }
+
+  if (data_len != 0)
+    goto done;
+
+  hsk_ns_log(ns, "loaded cache from %s\n", ns->cache_path);
+
+  rc = HSK_SUCCESS;
+
+done:
+  if (raw)
+    hsk_free(raw);
+
+  fclose(file);
+
+  return rc;
+}
+
+// Each shard is locked only while it is copied
+// out; the file is replaced in one rename.
+static int
+hsk_ns_save_cache(hsk_ns_t *ns) {
+  size_t size = HSK_NS_CACHE_HDR_SIZE;
+  uint8_t *raw = hsk_malloc(size);
+
+  if (!raw)
+    return HSK_ENOMEM;
+
+  uint8_t *data = raw;
+
+  write_u32(&data, HSK_NS_CACHE_MAGIC);
+  write_u32(&data, HSK_NS_CACHE_VERSION);
+  write_u32(&data, HSK_MAGIC);
+  write_u32(&data, ns->shard_count);
+
+  for (int i = 0; i < ns->shard_count; i++) {
+    hsk_ns_shard_t *shard = &ns->shards[i];
+
+    uv_mutex_lock(&shard->lock);
+
+    size_t len = hsk_cache_write_size(&shard->cache);
+    uint8_t *next = hsk_realloc(raw, size + len);
+
+    if (!next) {
+      uv_mutex_unlock(&shard->lock);
+      hsk_free(raw);
+      return HSK_ENOMEM;
+    }
+
+    raw = next;
+    data = raw + size;
+
+    assert(hsk_cache_write(&shard->cache, &data) == len);
+
+    uv_mutex_unlock(&shard->lock);
+
+    size += len;
+  }
+
+  char tmp[sizeof(ns->cache_path) + 4];
+  sprintf(tmp, "%s.tmp", ns->cache_path);
+
+  int rc = HSK_EFAILURE;
+  FILE *file = fopen(tmp, "wb");
+
+  if (!file)
+    goto done;
+
+  if (fwrite(raw, 1, size, file) != size) {
+    fclose(file);
+    remove(tmp);
+    goto done;
+  }
+
+  if (fflush(file) != 0 || fclose(file) != 0) {
+    remove(tmp);
+    goto done;
+  }
+
+  if (rename(tmp, ns->cache_path) != 0) {
+    remove(tmp);
+    goto done;
+  }
+
+  rc = HSK_SUCCESS;
+
+done:
+  hsk_free(raw);
+  return rc;
+}
+
+static void
+after_save_timer(uv_timer_t *timer) {
+  hsk_ns_t *ns = (hsk_ns_t *)timer->data;
+
+  if (hsk_ns_save_cache(ns) != HSK_SUCCESS)
+    hsk_ns_log(ns, "could not save cache to %s\n", ns->cache_path);
+}
+
+/*
+ * Stats
+ */
+
+static inline void
+hsk_ns_count(uint64_t *counter) {
+  __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void
+hsk_ns_count_name(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  hsk_ns_count(&ns->stats.queries);
+
+  if (req->labels == 0)
+    return;
+
+  hsk_top_add(&ns->top_names, req->name);
+  hsk_top_add(&ns->top_tlds, req->tld);
+}
+
+// Returns the time taken, in microseconds.
+static uint32_t
+hsk_ns_time(hsk_ns_t *ns, int stage, uint64_t start) {
+  uint64_t us = (uv_hrtime() - start) / 1000;
+  int i;
+
+  for (i = 0; i < HSK_NS_STATS_BUCKETS - 1; i++) {
+    if (us <= ((uint64_t)HSK_NS_STATS_BASE << i))
+      break;
+  }
+
+  hsk_ns_count(&ns->stats.latency[stage][i]);
+
+  return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+// Answered from the cache, or off to the pool.
+static void
+hsk_ns_looked_up(hsk_ns_t *ns, hsk_dns_req_t *req, bool hit) {
+  uint32_t us = hsk_ns_time(ns, HSK_NS_STAGE_CACHE, req->time);
+
+  if (hit) {
+    hsk_ns_count(&ns->stats.cached);
+  } else {
+    hsk_ns_count(&ns->stats.lookups);
+    req->lookup_time = uv_hrtime();
+  }
+
+  if (req->trace) {
+    req->trace->cache = us;
+    req->trace->flags |= hit ? HSK_TRACE_CACHED : HSK_TRACE_LOOKUP;
+  }
+}
+
+static void
+hsk_ns_add_stats(const hsk_ns_t *ns, hsk_ns_stats_t *stats) {
+  const uint64_t *src = (const uint64_t *)&ns->stats;
+  uint64_t *dst = (uint64_t *)stats;
+  size_t i;
+
+  for (i = 0; i < sizeof(hsk_ns_stats_t) / sizeof(uint64_t); i++)
+    dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void
+hsk_ns_get_stats(const hsk_ns_t *ns, hsk_ns_stats_t *stats) {
+  assert(ns && stats);
+
+  memset(stats, 0, sizeof(hsk_ns_stats_t));
+
+  hsk_ns_add_stats(ns, stats);
+  stats->drops += hsk_udp_drops(&ns->udp);
+
+  int i;
+
+  for (i = 0; i < ns->worker_count; i++) {
+    hsk_ns_add_stats(ns->workers[i], stats);
+    stats->drops += hsk_udp_drops(&ns->workers[i]->udp);
+  }
+}
+
+// Shard by shard: the totals are not a single
+// snapshot.
+void
+hsk_ns_get_cache_info(hsk_ns_t *ns, hsk_ns_cache_info_t *info) {
+  assert(ns && info);
+
+  memset(info, 0, sizeof(hsk_ns_cache_info_t));
+
+  int i;
+
+  for (i = 0; i < ns->shard_count; i++) {
+    hsk_ns_shard_t *shard = &ns->shards[i];
+    const hsk_cache_t *c = &shard->cache;
+
+    uv_mutex_lock(&shard->lock);
+    info->items += c->map.size;
+    info->item_bytes += c->size;
+    info->replies += c->wires.size;
+    info->reply_bytes += c->wire_size;
+    info->nxs += c->nx_count;
+    info->refs += c->ref_count;
+    info->max_bytes += c->max_size;
+    info->rejected += c->rejected;
+    uv_mutex_unlock(&shard->lock);
+  }
+}
+
+void
+hsk_ns_log_stats(hsk_ns_t *ns) {
+  static const char *names[HSK_NS_STAGES] = {
+    "cache",
+    "proof",
+    "answer",
+    "sign",
+    "total"
+  };
+
+  hsk_ns_stats_t stats;
+  hsk_ns_get_stats(ns, &stats);
+
+  hsk_ns_log(ns,
+    "stats: %lu queries, %lu cached, %lu lookups, %lu stale, %lu servfails, "
+    "%lu dropped\n",
+    stats.queries, stats.cached, stats.lookups, stats.stale, stats.servfails,
+    stats.drops);
+
+  if (ns->shm) {
+    hsk_ns_log(ns,
+      "stats: shared cache %lu hits, %lu misses, %lu stores, %lu busy\n",
+      ns->shm->hits, ns->shm->misses, ns->shm->stores, ns->shm->busy);
+  }
+
+  int s, i;
+
+  for (s = 0; s < HSK_NS_STAGES; s++) {
+    for (i = 0; i < HSK_NS_STATS_BUCKETS; i++) {
+      uint64_t count = stats.latency[s][i];
+
+      if (count == 0)
+        continue;
+
+      if (i == HSK_NS_STATS_BUCKETS - 1) {
+        hsk_ns_log(ns, "stats: %s over %luus: %lu\n", names[s],
+                   (uint64_t)HSK_NS_STATS_BASE << (i - 1), count);
+      } else {
+        hsk_ns_log(ns, "stats: %s within %luus: %lu\n", names[s],
+                   (uint64_t)HSK_NS_STATS_BASE << i, count);
+      }
+    }
+  }
+
+  hsk_top_item_t top[5];
+  int count = hsk_ns_get_top(ns, true, top, 5);
+
+  for (i = 0; i < count; i++)
+    hsk_ns_log(ns, "stats: top tld %s: %lu\n", top[i].key, top[i].count);
+}
+
+// The most queried names (or TLDs) of every
+// loop, merged: counts are at most off by the
+// sum of errors.
+int
+hsk_ns_get_top(hsk_ns_t *ns, bool tlds, hsk_top_item_t *items, int max) {
+  assert(ns && items);
+
+  int size = tlds ? HSK_NS_TOP_TLDS : HSK_NS_TOP_NAMES;
+  int total = size * (ns->worker_count + 1);
+  hsk_top_item_t *all = hsk_malloc(total * sizeof(hsk_top_item_t));
+
+  if (!all)
+    return 0;
+
+  int count = 0;
+  int i;
+
+  for (i = -1; i < ns->worker_count; i++) {
+    hsk_ns_t *loop = i < 0 ? ns : ns->workers[i];
+    hsk_top_t *top = tlds ? &loop->top_tlds : &loop->top_names;
+
+    count += hsk_top_list(top, &all[count], size);
+  }
+
+  count = hsk_top_merge(all, count);
+
+  if (count > max)
+    count = max;
+
+  memcpy(items, all, count * sizeof(hsk_top_item_t));
+
+  hsk_free(all);
+
+  return count;
+}
+
+/*
+ * Tracing
+ */
+
+static hsk_tracer_t *
+hsk_ns_tracer(hsk_ns_t *ns) {
+  return ns->parent ? &ns->parent->tracer : &ns->tracer;
+}
+
+static void
+hsk_ns_trace_start(hsk_ns_t *ns, hsk_dns_req_t *req) {
+  hsk_trace_t *trace = hsk_tracer_sample(hsk_ns_tracer(ns));
+
+  if (!trace)
+    return;
+
+  trace->time = hsk_now();
+  trace->id = req->id;
+  trace->type = req->type;
+  strcpy(trace->name, req->name);
+
+  if (req->conn)
+    trace->flags |= HSK_TRACE_TCP;
+
+  req->trace = trace;
+}
+
+// How the pool answered.
+static void
+hsk_ns_trace_lookup(hsk_dns_req_t *req, const hsk_name_trace_t *lookup) {
+  hsk_trace_t *trace = req->trace;
+
+  if (!trace || !lookup)
+    return;
+
+  trace->peer = lookup->peer;
+  trace->verify = lookup->verify > UINT32_MAX
+    ? UINT32_MAX
+    : (uint32_t)lookup->verify;
+  trace->retries = lookup->retries > 255 ? 255 : (uint8_t)lookup->retries;
+
+  if (lookup->hedged)
+    trace->flags |= HSK_TRACE_HEDGED;
+
+  if (lookup->cached)
+    trace->flags |= HSK_TRACE_PROOF_CACHED;
+}
+
+static void
+hsk_ns_trace_finish(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  uint32_t total,
+  const uint8_t *wire,
+  size_t wire_len
+) {
+  hsk_trace_t *trace = req->trace;
+
+  trace->total = total;
+  trace->sent = wire_len > 0xffff ? 0xffff : (uint16_t)wire_len;
+
+  if (wire_len >= 4)
+    trace->rcode = wire[3] & 0x0f;
+
+  hsk_tracer_push(hsk_ns_tracer(ns), trace);
+}
+
+// The queries traced since the last dump are
+// appended to a file (see trace.h).
+int
+hsk_ns_dump_trace(hsk_ns_t *ns, const char *path) {
+  assert(ns && path);
+  return hsk_tracer_dump(&ns->tracer, path);
+}
+
+static bool
+hsk_ns_sign(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  if (!hsk_dns_wire_cookie(req, wire, wire_len))
+    return false;
+
+  if (!ns->key || req->local)
+    return true;
+
+  uint64_t start = uv_hrtime();
+  bool ret = hsk_dns_wire_sign(ns->ec, ns->key, wire, wire_len);
+  uint32_t us = hsk_ns_time(ns, HSK_NS_STAGE_SIGN, start);
+
+  if (req->trace)
+    req->trace->sign = us;
+
+  return ret;
+}
+
+// Encode a cacheable reply, keeping the
+// unsigned wire for later hits.
+static bool
+hsk_ns_prepare(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  hsk_dns_msg_t **msg,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  if (!hsk_dns_msg_prepare(msg, req, ns->key != NULL, wire, wire_len))
+    return false;
+
+  hsk_ns_cache_insert_wire(ns, req, *wire, *wire_len);
+
+  return true;
+}
+
+// Likewise for a message just built, which is
+// cached too. Unless records were stripped or
+// cut, the reply doubles as the cached copy and
+// the message is encoded only once.
+static bool
+hsk_ns_prepare_new(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  hsk_dns_msg_t **msg,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  if (!req->dnssec) {
+    hsk_ns_cache_insert(ns, req, *msg);
+    return hsk_ns_prepare(ns, req, msg, wire, wire_len);
+  }
+
+  bool ret = hsk_dns_msg_reply(*msg, req, ns->key != NULL, wire, wire_len);
+
+  if (ret && !hsk_ns_cache_insert_encoded(ns, req, *msg, *wire, *wire_len)) {
+    hsk_ns_cache_insert(ns, req, *msg);
+    hsk_ns_cache_insert_wire(ns, req, *wire, *wire_len);
+  }
+
+  hsk_dns_msg_free(*msg);
+  *msg = NULL;
+
+  return ret;
+}
+
+static bool
+hsk_ns_finalize(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  hsk_dns_msg_t **msg,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  if (!hsk_ns_prepare_new(ns, req, msg, wire, wire_len))
+    return false;
+
+  if (!hsk_ns_sign(ns, req, wire, wire_len)) {
+    hsk_free(*wire);
+    *wire = NULL;
+    *wire_len = 0;
+    return false;
+  }
+
+  return true;
+}
+
+// A SERVFAIL written straight to wire, with
+// no message built (see hsk_dns_wire_empty).
+static bool
+hsk_ns_servfail(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  hsk_ns_count(&ns->stats.servfails);
+
+  if (!hsk_dns_wire_empty(req, 0, HSK_DNS_SERVFAIL, wire, wire_len))
+    return false;
+
+  bool ret = ns->unsigned_errors
+    ? hsk_dns_wire_cookie(req, wire, wire_len)
+    : hsk_ns_sign(ns, req, wire, wire_len);
+
+  if (!ret) {
+    hsk_free(*wire);
+    *wire = NULL;
+    *wire_len = 0;
+  }
+
+  return ret;
+}
+
+static int
+hsk_ns_conn_send(hsk_ns_conn_t *conn, uint8_t *data, size_t data_len);
+
+static void
+hsk_ns_conn_unref(hsk_ns_conn_t *conn);
+
+// Over the transport the query came in on.
+static int
+hsk_ns_reply(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t *wire,
+  size_t wire_len
+) {
+  uint32_t us = hsk_ns_time(ns, HSK_NS_STAGE_TOTAL, req->time);
+
+  if (req->trace)
+    hsk_ns_trace_finish(ns, req, us, wire, wire_len);
+
+  if (req->conn)
+    return hsk_ns_conn_send((hsk_ns_conn_t *)req->conn, wire, wire_len);
+
+  if (req->local)
+    return hsk_udp_send(&ns->local, wire, wire_len, req->addr, true);
+
+  return hsk_ns_send(ns, wire, wire_len, req->addr, true);
+}
+
+static void
+hsk_ns_req_free(hsk_dns_req_t *req) {
+  hsk_ns_t *ns = (hsk_ns_t *)req->ns;
+
+  if (req->conn)
+    hsk_ns_conn_unref((hsk_ns_conn_t *)req->conn);
+
+  hsk_dns_req_give(ns ? &ns->reqs : NULL, req);
+}
+
+// ANY gets one RRset, never the lot.
+static hsk_dns_msg_t *
+hsk_ns_to_dns(
+  hsk_ns_t *ns,
+  const hsk_resource_t *res,
+  const hsk_dns_req_t *req
+) {
+  if (req->type == HSK_DNS_ANY)
+    return hsk_resource_to_any(res, req->name, ns->any_hinfo, ns->minimal);
+
+  return hsk_resource_to_dns(res, req->name, req->type, ns->minimal);
+}
+
+/*
+ * Root Zone
+ */
+
+static int
+hsk_ns_root_index(uint16_t type) {
+  switch (type) {
+    case HSK_DNS_ANY:
+    case HSK_DNS_NS:
+      return 0;
+    case HSK_DNS_SOA:
+      return 1;
+    case HSK_DNS_DNSKEY:
+      return 2;
+    case HSK_DNS_DS:
+      return 3;
+    default:
+      return 4;
+  }
+}
+
+static void
+hsk_ns_free_root(hsk_ns_t *ns) {
+  for (int i = 0; i < HSK_NS_ROOT_ANSWERS; i++) {
+    hsk_free(ns->root[i]);
+    ns->root[i] = NULL;
+    ns->root_len[i] = 0;
+  }
+}
+
+// Sign every root answer and swap them in.
+// Workers read them under the parent's lock.
+static bool
+hsk_ns_sign_root(hsk_ns_t *ns) {
+  static const uint16_t types[HSK_NS_ROOT_ANSWERS] = {
+    HSK_DNS_NS,
+    HSK_DNS_SOA,
+    HSK_DNS_DNSKEY,
+    HSK_DNS_DS,
+    HSK_DNS_NULL
+  };
+
+  uint8_t *root[HSK_NS_ROOT_ANSWERS];
+  size_t root_len[HSK_NS_ROOT_ANSWERS];
+
+  for (int i = 0; i < HSK_NS_ROOT_ANSWERS; i++) {
+    hsk_dns_msg_t *msg = hsk_resource_root(types[i], ns->ip);
+    bool ok = msg && hsk_dns_msg_encode(msg, &root[i], &root_len[i]);
+
+    if (msg)
+      hsk_dns_msg_free(msg);
+
+    if (!ok) {
+      for (int j = 0; j < i; j++)
+        hsk_free(root[j]);
+      return false;
+    }
+  }
+
+  uv_mutex_lock(&ns->lock);
+
+  hsk_ns_free_root(ns);
+  hsk_ns_free_zone(ns);
+
+  memcpy(ns->root, root, sizeof(root));
+  memcpy(ns->root_len, root_len, sizeof(root_len));
+
+  uv_mutex_unlock(&ns->lock);
+
+  // Along with the replies built from the old
+  // signatures.
+  hsk_ns_shard_t *shard = hsk_ns_tld_shard(ns, "");
+  uv_mutex_lock(&shard->lock);
+  hsk_cache_purge(&shard->cache, "");
+  uv_mutex_unlock(&shard->lock);
+
+  return true;
+}
+
+static hsk_dns_msg_t *
+hsk_ns_root(hsk_ns_t *ns, uint16_t type) {
+  hsk_ns_t *parent = ns->parent ? ns->parent : ns;
+  int index = hsk_ns_root_index(type);
+  hsk_dns_msg_t *msg = NULL;
+
+  uv_mutex_lock(&parent->lock);
+
+  if (parent->root[index])
+    hsk_dns_msg_decode(parent->root[index], parent->root_len[index], &msg);
+
+  uv_mutex_unlock(&parent->lock);
+
+  // Not open yet.
+  if (!msg)
+    msg = hsk_resource_root(type, ns->ip);
+
+  return msg;
+}
+
+/*
+ * Zone Transfer
+ */
+
+typedef struct hsk_ns_zone_s {
+  uint8_t **msgs;
+  size_t *lens;
+  int count;
+  uint8_t *buf;
+  size_t len;
+  uint16_t rrs;
+} hsk_ns_zone_t;
+
+// A Handshake resource copied out of a shard.
+typedef struct hsk_ns_zone_ref_s {
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  uint8_t *data;
+  size_t data_len;
+} hsk_ns_zone_ref_t;
+
+static void
+hsk_ns_zone_ref_free(hsk_ns_zone_ref_t *ref) {
+  if (ref) {
+    hsk_free(ref->data);
+    hsk_free(ref);
+  }
+}
+
+static void
+hsk_ns_free_zone(hsk_ns_t *ns) {
+  for (int i = 0; i < ns->zone_count; i++)
+    hsk_free(ns->zone[i]);
+
+  hsk_free(ns->zone);
+  hsk_free(ns->zone_len);
+
+  ns->zone = NULL;
+  ns->zone_len = NULL;
+  ns->zone_count = 0;
+}
+
+static void
+hsk_ns_zone_init(hsk_ns_zone_t *z) {
+  z->msgs = NULL;
+  z->lens = NULL;
+  z->count = 0;
+  z->buf = NULL;
+  z->len = 0;
+  z->rrs = 0;
+}
+
+static void
+hsk_ns_zone_uninit(hsk_ns_zone_t *z) {
+  for (int i = 0; i < z->count; i++)
+    hsk_free(z->msgs[i]);
+
+  hsk_free(z->msgs);
+  hsk_free(z->lens);
+  hsk_free(z->buf);
+
+  hsk_ns_zone_init(z);
+}
+
+// Every message carries the question. The ID
+// is the asker's, set on each transfer.
+static bool
+hsk_ns_zone_start(hsk_ns_zone_t *z) {
+  uint8_t *buf = hsk_malloc(HSK_DNS_MAX_TCP);
+
+  if (!buf)
+    return false;
+
+  memset(buf, 0, 12);
+  set_u16be(&buf[2], HSK_DNS_QR | HSK_DNS_AA);
+  set_u16be(&buf[4], 1);
+
+  buf[12] = 0x00;
+  set_u16be(&buf[13], HSK_DNS_AXFR);
+  set_u16be(&buf[15], HSK_DNS_IN);
+
+  z->buf = buf;
+  z->len = 17;
+  z->rrs = 0;
+
+  return true;
+}
+
+static bool
+hsk_ns_zone_end(hsk_ns_zone_t *z) {
+  if (!z->buf)
+    return true;
+
+  int count = z->count + 1;
+  uint8_t **msgs = hsk_realloc(z->msgs, count * sizeof(uint8_t *));
+
+  if (!msgs)
+    return false;
+
+  z->msgs = msgs;
+
+  size_t *lens = hsk_realloc(z->lens, count * sizeof(size_t));
+
+  if (!lens)
+    return false;
+
+  z->lens = lens;
+
+  set_u16be(&z->buf[6], z->rrs);
+
+  z->msgs[z->count] = z->buf;
+  z->lens[z->count] = z->len;
+  z->count = count;
+  z->buf = NULL;
+
+  return true;
+}
+
+// Proofs of absence have no place in a zone
+// (and would not chain together anyway).
+static bool
+hsk_ns_zone_push(hsk_ns_zone_t *z, const hsk_dns_rr_t *rr) {
+  switch (rr->type) {
+    case HSK_DNS_OPT:
+    case HSK_DNS_NSEC:
+      return true;
+    case HSK_DNS_RRSIG: {
+      const hsk_dns_rrsig_rd_t *rd = rr->rd;
+      if (rd->type_covered == HSK_DNS_NSEC)
+        return true;
+      break;
+    }
+  }
+
+  size_t size = hsk_dns_rr_size(rr);
+
+  if (z->buf && (z->len + size > HSK_NS_ZONE_MAX || z->rrs == 0xffff)) {
+    if (!hsk_ns_zone_end(z))
+      return false;
+  }
+
+  if (!z->buf && !hsk_ns_zone_start(z))
+    return false;
+
+  if (z->len + size > HSK_NS_ZONE_MAX)
+    return false;
+
+  uint8_t *data = &z->buf[z->len];
+  hsk_dns_rr_write(rr, &data, NULL);
+
+  z->len += size;
+  z->rrs += 1;
+
+  return true;
+}
+
+static bool
+hsk_ns_zone_rrs(hsk_ns_zone_t *z, const hsk_dns_rrs_t *rrs) {
+  for (size_t i = 0; i < rrs->size; i++) {
+    if (!hsk_ns_zone_push(z, rrs->items[i]))
+      return false;
+  }
+  return true;
+}
+
+static bool
+hsk_ns_zone_msg(hsk_ns_zone_t *z, hsk_dns_msg_t *msg) {
+  if (!msg)
+    return false;
+
+  bool ret = hsk_ns_zone_rrs(z, &msg->an)
+          && hsk_ns_zone_rrs(z, &msg->ns)
+          && hsk_ns_zone_rrs(z, &msg->ar);
+
+  hsk_dns_msg_free(msg);
+
+  return ret;
+}
+
+static bool
+hsk_ns_zone_tld(
+  hsk_ns_t *ns,
+  hsk_ns_zone_t *z,
+  const char *tld,
+  const hsk_resource_t *res
+) {
+  char name[HSK_DNS_MAX_NAME + 1];
+
+  sprintf(name, "%s.", tld);
+
+  hsk_dns_msg_t *msg = hsk_resource_to_dns(res, name, HSK_DNS_NS, false);
+
+  // Left out rather than fail the transfer.
+  if (!msg) {
+    hsk_ns_debug(ns, "could not add %s to the zone\n", tld);
+    return true;
+  }
+
+  return hsk_ns_zone_msg(z, msg);
+}
+
+static void
+hsk_ns_zone_collect(
+  const char *tld,
+  const uint8_t *data,
+  size_t data_len,
+  void *arg
+) {
+  hsk_map_t *refs = (hsk_map_t *)arg;
+
+  if (hsk_map_has(refs, tld))
+    return;
+
+  hsk_ns_zone_ref_t *ref = hsk_malloc(sizeof(hsk_ns_zone_ref_t));
+
+  if (!ref)
+    return;
+
+  ref->data = hsk_malloc(data_len);
+
+  if (!ref->data) {
+    hsk_free(ref);
+    return;
+  }
+
+  strcpy(ref->tld, tld);
+  memcpy(ref->data, data, data_len);
+  ref->data_len = data_len;
+
+  if (!hsk_map_set(refs, ref->tld, ref))
+    hsk_ns_zone_ref_free(ref);
+}
+
+// The apex, then the delegations. A Handshake
+// resource for an ICANN TLD replaces ICANN's,
+// as it does for lookups.
+static bool
+hsk_ns_zone_build(hsk_ns_t *ns, const uint8_t *root, hsk_ns_zone_t *z) {
+  hsk_dns_msg_t *soa = hsk_ns_root(ns, HSK_DNS_SOA);
+  hsk_map_t refs;
+  bool ret = false;
+
+  if (!soa)
+    return false;
+
+  hsk_map_init_str_map(&refs, (hsk_map_free_func)hsk_ns_zone_ref_free);
+
+  for (int i = 0; i < ns->shard_count; i++) {
+    hsk_ns_shard_t *shard = &ns->shards[i];
+    uv_mutex_lock(&shard->lock);
+    hsk_cache_set_root(&shard->cache, root);
+    hsk_cache_each_ref(&shard->cache, root, hsk_ns_zone_collect, &refs);
+    uv_mutex_unlock(&shard->lock);
+  }
+
+  if (!hsk_ns_zone_rrs(z, &soa->an))
+    goto done;
+
+  if (!hsk_ns_zone_msg(z, hsk_ns_root(ns, HSK_DNS_NS)))
+    goto done;
+
+  hsk_dns_msg_t *dnskey = hsk_ns_root(ns, HSK_DNS_DNSKEY);
+
+  if (!dnskey || !hsk_ns_zone_rrs(z, &dnskey->an)) {
+    if (dnskey)
+      hsk_dns_msg_free(dnskey);
+    goto done;
+  }
+
+  hsk_dns_msg_free(dnskey);
+
+  for (int i = 0; i < hsk_icann_size(); i++) {
+    const char *tld = hsk_icann_name(i);
+    hsk_resource_t *res = NULL;
+
+    if (hsk_map_has(&refs, tld))
+      continue;
+
+    if (hsk_icann_lookup(tld, &res) != HSK_SUCCESS || !res)
+      continue;
+
+    bool ok = hsk_ns_zone_tld(ns, z, tld, res);
+
+    hsk_ns_resource_free(res);
+
+    if (!ok)
+      goto done;
+  }
+
+  for (uint32_t i = hsk_map_begin(&refs); i < hsk_map_end(&refs); i++) {
+    if (!hsk_map_exists(&refs, i))
+      continue;
+
+    hsk_ns_zone_ref_t *ref = hsk_map_value(&refs, i);
+    hsk_resource_t *res = NULL;
+
+    if (!hsk_resource_decode(ref->data, ref->data_len, &res))
+      continue;
+
+    bool ok = hsk_ns_zone_tld(ns, z, ref->tld, res);
+
+    hsk_resource_free(res);
+
+    if (!ok)
+      goto done;
+  }
+
+  // And the SOA again, alone, to close it.
+  if (!hsk_ns_zone_push(z, soa->an.items[0]))
+    goto done;
+
+  ret = hsk_ns_zone_end(z);
+
+done:
+  hsk_map_uninit(&refs);
+  hsk_dns_msg_free(soa);
+  return ret;
+}
+
+// Over the connection the AXFR came in on,
+// each message stamped with the asker's ID
+// and signed. Returns false only while nothing
+// has been sent.
+static bool
+hsk_ns_axfr(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  hsk_ns_t *parent = ns->parent ? ns->parent : ns;
+  hsk_ns_conn_t *conn = (hsk_ns_conn_t *)req->conn;
+  hsk_ns_zone_t z;
+  uint8_t root[32];
+
+  assert(conn);
+
+  hsk_ns_safe_root(ns, root);
+  hsk_ns_zone_init(&z);
+
+  uv_mutex_lock(&parent->lock);
+
+  bool current = parent->zone != NULL
+              && memcmp(parent->zone_root, root, 32) == 0;
+
+  uv_mutex_unlock(&parent->lock);
+
+  if (!current) {
+    if (!hsk_ns_zone_build(ns, root, &z)) {
+      hsk_ns_zone_uninit(&z);
+      return false;
+    }
+
+    hsk_ns_log(ns, "built root zone: %d messages\n", z.count);
+
+    uv_mutex_lock(&parent->lock);
+    hsk_ns_free_zone(parent);
+    parent->zone = z.msgs;
+    parent->zone_len = z.lens;
+    parent->zone_count = z.count;
+    memcpy(parent->zone_root, root, 32);
+    uv_mutex_unlock(&parent->lock);
+
+    hsk_ns_zone_init(&z);
+  }
+
+  // Copied out so as not to sign under the lock.
+  uv_mutex_lock(&parent->lock);
+
+  int count = parent->zone_count;
+  bool copied = count > 0;
+
+  z.msgs = hsk_calloc(count, sizeof(uint8_t *));
+  z.lens = hsk_calloc(count, sizeof(size_t));
+
+  if (!z.msgs || !z.lens)
+    copied = false;
+
+  for (int i = 0; copied && i < count; i++) {
+    z.msgs[i] = hsk_malloc(parent->zone_len[i]);
+
+    if (!z.msgs[i]) {
+      copied = false;
+      break;
+    }
+
+    memcpy(z.msgs[i], parent->zone[i], parent->zone_len[i]);
+    z.lens[i] = parent->zone_len[i];
+    z.count += 1;
+  }
+
+  uv_mutex_unlock(&parent->lock);
+
+  if (!copied) {
+    hsk_ns_zone_uninit(&z);
+    return false;
+  }
+
+  int i;
+
+  for (i = 0; i < z.count; i++) {
+    uint8_t *wire = z.msgs[i];
+    size_t wire_len = z.lens[i];
+
+    z.msgs[i] = NULL;
+
+    set_u16be(&wire[0], req->id);
+
+    if (req->rd)
+      wire[2] |= HSK_DNS_RD >> 8;
+
+    if (!hsk_ns_sign(ns, req, &wire, &wire_len)) {
+      hsk_free(wire);
+      break;
+    }
+
+    if (hsk_ns_conn_send(conn, wire, wire_len) != HSK_SUCCESS)
+      break;
+  }
+
+  // A transfer cut short must not look whole.
+  if (i < z.count && i > 0 && !conn->closing)
+    hsk_ns_conn_close(conn);
+
+  hsk_ns_zone_uninit(&z);
+
+  return i > 0;
+}
+
+// Answer with an expired entry rather than
+// fail outright (RFC 8767).
+static bool
+hsk_ns_get_stale(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  hsk_dns_msg_t *msg = hsk_ns_cache_get_stale(ns, req);
+
+  if (!msg)
+    return false;
+
+  if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, wire, wire_len)) {
+    hsk_ns_log(ns, "could not finalize stale reply\n");
+    return false;
+  }
+
+  hsk_ns_debug(ns, "sending stale reply (%u): %u\n", req->id, *wire_len);
+
+  hsk_ns_count(&ns->stats.stale);
+
+  if (req->trace)
+    req->trace->flags |= HSK_TRACE_STALE;
+
+  return true;
+}
+
+static bool
+hsk_ns_send_stale(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  uint8_t *wire = NULL;
+  size_t wire_len = 0;
+
+  if (!hsk_ns_get_stale(ns, req, &wire, &wire_len))
+    return false;
+
+  hsk_ns_reply(ns, req, wire, wire_len);
+
+  return true;
+}
+
+// Hand the rest of the reply to the threadpool.
+// Takes ownership of the request (and of the
+// resource or wire) when it returns true.
+static bool
+hsk_ns_offload(
+  hsk_ns_t *ns,
+  hsk_dns_req_t *req,
+  bool answer,
+  int status,
+  hsk_resource_t *res,
+  uint8_t *wire,
+  size_t wire_len
+) {
+  if (!ns->offload)
+    return false;
+
+  // Nothing to sign.
+  if (!answer && (!ns->key || req->local))
+    return false;
+
+  hsk_ns_sign_t *job = hsk_malloc(sizeof(hsk_ns_sign_t));
+
+  if (!job)
+    return false;
+
+  job->req.data = (void *)job;
+  job->ns = ns;
+  job->dns = req;
+  job->answer = answer;
+  job->status = status;
+  job->res = res;
+  job->wire = wire;
+  job->wire_len = wire_len;
+
+  if (uv_queue_work(ns->loop, &job->req, on_sign, after_sign) != 0) {
+    hsk_free(job);
+    return false;
+  }
+
+  return true;
+}
+
+// Fetch a popular name again shortly before
+// its cache entry expires. Takes ownership of
+// the request.
+static bool
+hsk_ns_refresh(hsk_ns_t *ns, hsk_dns_req_t *req) {
+  if (req->labels == 0)
+    return false;
+
+  if (!hsk_ns_cache_should_refresh(ns, req))
+    return false;
+
+  req->ns = (void *)ns;
+
+  int rc = hsk_ns_resolve(ns, req, HSK_PRIORITY_REFRESH, after_refresh);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_ns_log(ns, "could not refresh %s: %s\n", req->name, hsk_strerror(rc));
+    return false;
+  }
+
+  hsk_ns_debug(ns, "refreshing %s\n", req->name);
+
+  return true;
+}
+
+// A name as an operator typed it, the root
+// excluded (nothing is cached above a TLD).
+static bool
+hsk_ns_set_name(hsk_dns_req_t *req, const char *name) {
+  size_t len = strlen(name);
+
+  if (len == 0 || len > HSK_DNS_MAX_NAME - 1)
+    return false;
+
+  strcpy(req->name, name);
+
+  if (req->name[len - 1] != '.')
+    strcat(req->name, ".");
+
+  if (!hsk_dns_name_verify(req->name) || hsk_dns_name_dirty(req->name))
+    return false;
+
+  req->labels = hsk_dns_label_count(req->name);
+
+  if (req->labels == 0)
+    return false;
+
+  hsk_dns_label_get(req->name, -1, req->tld);
+  hsk_to_lower(req->tld);
+
+  return true;
+}
+
+// Drops everything cached under the name's
+// TLD. Any thread.
+int
+hsk_ns_purge(hsk_ns_t *ns, const char *name, size_t *count) {
+  assert(ns && name && count);
+
+  hsk_dns_req_t req;
+  hsk_dns_req_init(&req);
+
+  if (!hsk_ns_set_name(&req, name))
+    return HSK_EBADARGS;
+
+  hsk_ns_shard_t *shard = hsk_ns_shard(ns, &req);
+  uv_mutex_lock(&shard->lock);
+  *count = hsk_cache_purge(&shard->cache, req.tld);
+  uv_mutex_unlock(&shard->lock);
+
+  hsk_ns_log(ns, "purged %zu entries under %s\n", *count, req.tld);
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_ns_fetch(
+  hsk_ns_t *ns,
+  const char *name,
+  uint16_t type,
+  hsk_resolve_cb callback
+) {
+  hsk_dns_req_t *req = hsk_dns_req_take(&ns->reqs);
+
+  if (!req)
+    return HSK_ENOMEM;
+
+  if (!hsk_ns_set_name(req, name)) {
+    hsk_dns_req_give(&ns->reqs, req);
+    return HSK_EBADARGS;
+  }
+
+  req->ns = (void *)ns;
+  req->type = type;
+  req->class = HSK_DNS_IN;
+
+  int rc = hsk_ns_resolve(ns, req, HSK_PRIORITY_PREFETCH, callback);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_dns_req_give(&ns->reqs, req);
+    return rc;
+  }
+
+  hsk_ns_debug(ns, "prefetching %s\n", req->name);
+
+  return HSK_SUCCESS;
+}
+
+// Resolves a name into the cache, as a refresh
+// would (a fresh entry is kept: purge first to
+// replace it). On the nameserver's loop.
+int
+hsk_ns_prefetch(hsk_ns_t *ns, const char *name, uint16_t type) {
+  assert(ns && name);
+  return hsk_ns_fetch(ns, name, type, after_refresh);
+}
+
+/*
+ * Prefetch Lists
+ */
+
+typedef struct hsk_ns_prefetch_s {
+  char name[HSK_DNS_MAX_NAME];
+  uint16_t type;
+  struct hsk_ns_prefetch_s *next;
+} hsk_ns_prefetch_t;
+
+static bool
+hsk_ns_synced(const hsk_ns_t *ns) {
+  hsk_chain_view_t view;
+  hsk_chain_get_view(&ns->pool->chain, &view);
+  return view.synced;
+}
+
+// Keeps up to HSK_NS_PREFETCH_MAX lookups in
+// flight until the list is done.
+static void
+hsk_ns_prefetch_next(hsk_ns_t *ns) {
+  if (!ns->prefetching || !hsk_ns_synced(ns))
+    return;
+
+  while (ns->prefetch_head && ns->prefetch_pending < HSK_NS_PREFETCH_MAX) {
+    hsk_ns_prefetch_t *item = (hsk_ns_prefetch_t *)ns->prefetch_head;
+
+    ns->prefetch_head = (void *)item->next;
+
+    if (!ns->prefetch_head)
+      ns->prefetch_tail = NULL;
+
+    int rc = hsk_ns_fetch(ns, item->name, item->type, after_prefetch);
+
+    if (rc == HSK_SUCCESS) {
+      ns->prefetch_pending += 1;
+    } else {
+      hsk_ns_debug(ns, "could not prefetch %s: %s\n",
+                   item->name, hsk_strerror(rc));
+      ns->prefetch_failed += 1;
+    }
+
+    hsk_free(item);
+  }
+
+  if (ns->prefetch_head || ns->prefetch_pending > 0)
+    return;
+
+  hsk_ns_log(ns, "prefetched %zu names (%zu failed)\n",
+             ns->prefetch_done, ns->prefetch_failed);
+
+  ns->prefetch_done = 0;
+  ns->prefetch_failed = 0;
+
+  uv_timer_stop(&ns->prefetch_timer);
+}
+
+static void
+hsk_ns_prefetch_clear(hsk_ns_t *ns) {
+  hsk_ns_prefetch_t *item = (hsk_ns_prefetch_t *)ns->prefetch_head;
+
+  while (item) {
+    hsk_ns_prefetch_t *next = item->next;
+    hsk_free(item);
+    item = next;
+  }
+
+  ns->prefetch_head = NULL;
+  ns->prefetch_tail = NULL;
+}
+
+static void
+after_prefetch_timer(uv_timer_t *timer) {
+  hsk_ns_prefetch_next((hsk_ns_t *)timer->data);
+}
+
+// Reads `name [type]` lines (A by default; `#`
+// starts a comment) and queues them to be
+// resolved into the cache once the chain is
+// synced. On the nameserver's loop, once open.
+int
+hsk_ns_prefetch_list(hsk_ns_t *ns, const char *path, size_t *count) {
+  assert(ns && path && count);
+
+  if (!ns->bound || ns->parent)
+    return HSK_EBADARGS;
+
+  FILE *file = fopen(path, "r");
+
+  if (!file)
+    return HSK_EFAILURE;
+
+  char line[1024];
+  int num = 0;
+
+  *count = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    char *comment = strchr(line, '#');
+    char *name, *type, *extra;
+    hsk_ns_prefetch_t *item;
+
+    num += 1;
+
+    if (comment)
+      *comment = '\0';
+
+    name = strtok(line, " \t\r\n");
+
+    if (!name)
+      continue;
+
+    type = strtok(NULL, " \t\r\n");
+    extra = type ? strtok(NULL, " \t\r\n") : NULL;
+
+    item = hsk_malloc(sizeof(hsk_ns_prefetch_t));
+
+    if (!item) {
+      fclose(file);
+      return HSK_ENOMEM;
+    }
+
+    item->type = HSK_DNS_A;
+    item->next = NULL;
+
+    if (extra || strlen(name) >= sizeof(item->name)
+        || (type && !hsk_dns_type_from_string(type, &item->type))) {
+      hsk_ns_log(ns, "%s:%d: invalid prefetch entry\n", path, num);
+      hsk_free(item);
+      continue;
+    }
+
+    strcpy(item->name, name);
+
+    if (ns->prefetch_tail)
+      ((hsk_ns_prefetch_t *)ns->prefetch_tail)->next = item;
+    else
+      ns->prefetch_head = (void *)item;
+
+    ns->prefetch_tail = (void *)item;
+    *count += 1;
+  }
+
+  fclose(file);
+
+  if (*count == 0)
+    return HSK_SUCCESS;
+
+  if (!ns->prefetching) {
+    if (uv_timer_init(ns->loop, &ns->prefetch_timer) != 0)
+      return HSK_EFAILURE;
+
+    ns->prefetch_timer.data = (void *)ns;
+    ns->prefetching = true;
+  }
+
+  // A list already running just grows.
+  if (!uv_is_active((uv_handle_t *)&ns->prefetch_timer)) {
+    uint64_t wait = HSK_NS_PREFETCH_WAIT;
+    uv_timer_start(&ns->prefetch_timer, after_prefetch_timer, wait, wait);
+  }
+
+  hsk_ns_log(ns, "queued %zu names to prefetch from %s\n", *count, path);
+
+  hsk_ns_prefetch_next(ns);
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * Lookups
+ */
+
+typedef struct hsk_ns_lookup_s {
+  hsk_dns_req_t *req;
+  hsk_ns_lookup_cb callback;
+  hsk_ns_lookup_raw_cb raw_callback;
+  void *arg;
+} hsk_ns_lookup_t;
+
+static hsk_dns_req_t *
+hsk_ns_lookup_req(hsk_ns_t *ns, const char *name, uint16_t type, int *rc) {
+  hsk_dns_req_t *req = hsk_dns_req_take(&ns->reqs);
+
+  if (!req) {
+    *rc = HSK_ENOMEM;
+    return NULL;
+  }
+
+  if (!hsk_ns_set_name(req, name)) {
+    hsk_dns_req_give(&ns->reqs, req);
+    *rc = HSK_EBADARGS;
+    return NULL;
+  }
+
+  req->ns = (void *)ns;
+  req->type = type;
+  req->class = HSK_DNS_IN;
+  req->time = uv_hrtime();
+
+  hsk_ns_count_name(ns, req);
+
+  *rc = HSK_SUCCESS;
+
+  return req;
+}
+
+// As a query would be answered without the
+// pool (the finalized replies aside).
+static bool
+hsk_ns_lookup_cached(hsk_ns_t *ns, const hsk_dns_req_t *req,
+                     hsk_dns_msg_t **msg) {
+  *msg = hsk_ns_cache_get(ns, req);
+
+  if (*msg)
+    return true;
+
+  if (hsk_ns_cache_has_nx(ns, req)) {
+    *msg = hsk_resource_to_nx(req->tld);
+    return true;
+  }
+
+  if (req->labels == 2 && hsk_resource_is_ptr(req->name)) {
+    *msg = hsk_resource_ptr_to_dns(req->name, req->type, HSK_NS_PTR_TTL);
+
+    if (*msg)
+      hsk_ns_cache_insert(ns, req, *msg);
+
+    return true;
+  }
+
+  hsk_resource_t *res = hsk_ns_cache_get_ref(ns, req);
+
+  if (!res)
+    return false;
+
+  *msg = hsk_ns_to_dns(ns, res, req);
+
+  hsk_ns_resource_free(res);
+
+  if (*msg)
+    hsk_ns_cache_insert(ns, req, *msg);
+
+  return true;
+}
+
+static int
+hsk_ns_lookup_start(
+  hsk_ns_t *ns,
+  hsk_dns_req_t *req,
+  hsk_ns_lookup_cb callback,
+  hsk_ns_lookup_raw_cb raw_callback,
+  void *arg
+) {
+  hsk_ns_lookup_t *lookup = hsk_malloc(sizeof(hsk_ns_lookup_t));
+
+  if (!lookup)
+    return HSK_ENOMEM;
+
+  lookup->req = req;
+  lookup->callback = callback;
+  lookup->raw_callback = raw_callback;
+  lookup->arg = arg;
+
+  hsk_ns_looked_up(ns, req, false);
+
+  int rc = hsk_ns_resolve_tld(ns, req->tld, HSK_PRIORITY_CLIENT,
+                              callback ? after_lookup : after_lookup_raw,
+                              (void *)lookup);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_free(lookup);
+    return rc;
+  }
+
+  return HSK_SUCCESS;
+}
+
+// What a query for the name and type would be
+// answered with, for programs on the host
+// (see ipc.h). On the nameserver's loop. The
+// callback may run before this returns, and
+// does not run if it fails.
+int
+hsk_ns_lookup(
+  hsk_ns_t *ns,
+  const char *name,
+  uint16_t type,
+  hsk_ns_lookup_cb callback,
+  void *arg
+) {
+  assert(ns && name && callback);
+
+  hsk_dns_msg_t *msg = NULL;
+  int rc;
+
+  hsk_dns_req_t *req = hsk_ns_lookup_req(ns, name, type, &rc);
+
+  if (!req)
+    return rc;
+
+  if (hsk_ns_lookup_cached(ns, req, &msg)) {
+    hsk_ns_looked_up(ns, req, true);
+    hsk_ns_req_free(req);
+    callback(arg, msg ? HSK_SUCCESS : HSK_ENOMEM, msg);
+    return HSK_SUCCESS;
+  }
+
+  rc = hsk_ns_lookup_start(ns, req, callback, NULL, arg);
+
+  if (rc == HSK_SUCCESS)
+    return HSK_SUCCESS;
+
+  hsk_ns_log(ns, "lookup error: %s\n", hsk_strerror(rc));
+
+  // A stale answer over none (RFC 8767).
+  msg = hsk_ns_cache_get_stale(ns, req);
+
+  hsk_ns_req_free(req);
+
+  if (!msg)
+    return rc;
+
+  hsk_ns_count(&ns->stats.stale);
+
+  callback(arg, HSK_SUCCESS, msg);
+
+  return HSK_SUCCESS;
+}
+
+// The resource of the name's TLD as committed
+// in the tree, if it is there. Likewise.
+int
+hsk_ns_lookup_raw(
+  hsk_ns_t *ns,
+  const char *name,
+  hsk_ns_lookup_raw_cb callback,
+  void *arg
+) {
+  assert(ns && name && callback);
+
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+  int rc;
+
+  // Every record type is decoded, for the
+  // referral cached on the way.
+  hsk_dns_req_t *req = hsk_ns_lookup_req(ns, name, HSK_DNS_ANY, &rc);
+
+  if (!req)
+    return rc;
+
+  if (hsk_ns_cache_has_nx(ns, req)) {
+    hsk_ns_looked_up(ns, req, true);
+    hsk_ns_req_free(req);
+    callback(arg, HSK_SUCCESS, false, NULL, 0);
+    return HSK_SUCCESS;
+  }
+
+  // An ICANN TLD is cached empty, whether it is
+  // in the tree or not: ask again.
+  if (hsk_ns_cache_get_ref_data(ns, req, &data, &data_len)) {
+    if (data_len > 0) {
+      hsk_ns_looked_up(ns, req, true);
+      hsk_ns_req_free(req);
+      callback(arg, HSK_SUCCESS, true, data, data_len);
+      hsk_free(data);
+      return HSK_SUCCESS;
+    }
+
+    hsk_free(data);
+  }
+
+  rc = hsk_ns_lookup_start(ns, req, NULL, callback, arg);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_ns_log(ns, "lookup error: %s\n", hsk_strerror(rc));
+    hsk_ns_req_free(req);
+    return rc;
+  }
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_ns_onrecv(
+  hsk_ns_t *ns,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr,
+  hsk_ns_conn_t *conn,
+  bool local
+) {
+  if (ns->capture) {
+    uint8_t flags = 0;
+
+    if (conn)
+      flags |= HSK_CAPTURE_TCP;
+
+    if (local)
+      flags |= HSK_CAPTURE_LOCAL;
+
+    hsk_capture_push(ns->capture, flags, addr, data, data_len);
+  }
+
+  hsk_dns_req_t *req = hsk_dns_req_create(&ns->reqs, data, data_len, addr);
+
+  if (!req) {
+    hsk_ns_log(ns, "failed processing dns request\n");
+    return;
+  }
+
+  req->ns = (void *)ns;
+  req->local = local;
+  req->time = uv_hrtime();
+
+  hsk_ns_count_name(ns, req);
+
+  // No need to truncate over TCP.
+  if (conn) {
+    req->conn = (void *)conn;
+    req->max_size = HSK_DNS_MAX_TCP;
+    conn->refs += 1;
+  }
+
+  hsk_ns_trace_start(ns, req);
+
+  if (hsk_log_enabled(HSK_LOG_DEBUG))
+    hsk_dns_req_print(req, "ns: ");
+
+  uint8_t *wire = NULL;
+  size_t wire_len = 0;
+  hsk_dns_msg_t *msg = NULL;
+
+  // Only sources that could be spoofed (a
+  // valid server cookie proves it is not).
+  if (!conn && !local && ns->rrl.rate != 0 && !hsk_dns_req_cookie_ok(req)) {
+    switch (hsk_rrl_check(&ns->rrl, addr, uv_now(ns->loop))) {
+      case HSK_RRL_DROP: {
+        hsk_ns_debug(ns, "rate limited (%u)\n", req->id);
+        goto done;
+      }
+      case HSK_RRL_TRUNCATE: {
+        if (hsk_rrl_truncated(req, &wire, &wire_len))
+          hsk_ns_reply(ns, req, wire, wire_len);
+        hsk_ns_debug(ns, "rate limited, truncating (%u)\n", req->id);
+        goto done;
+      }
+    }
+  }
+
+  // A transfer of the root zone.
+  if (conn && req->labels == 0 && req->type == HSK_DNS_AXFR) {
+    if (!hsk_ns_axfr(ns, req)) {
+      hsk_ns_log(ns, "could not transfer root zone (%u)\n", req->id);
+      goto fail;
+    }
+
+    hsk_ns_debug(ns, "sent root zone (%u)\n", req->id);
+    goto done;
+  }
+
+  // Hit the finalized replies first: only the
+  // ID (and signature) need to change.
+  if (hsk_ns_cache_get_wire(ns, req, &wire, &wire_len)) {
+    hsk_ns_looked_up(ns, req, true);
+    hsk_ns_debug(ns, "sending cached reply (%u): %u\n", req->id, wire_len);
+    goto sign;
+  }
+
+  // Then the cached messages.
+  msg = hsk_ns_cache_get(ns, req);
+
+  if (msg) {
+    hsk_ns_looked_up(ns, req, true);
+
+    if (!hsk_ns_prepare(ns, req, &msg, &wire, &wire_len)) {
+      hsk_ns_log(ns, "could not reply\n");
+      goto fail;
+    }
+
+    hsk_ns_debug(ns, "sending cached msg (%u): %u\n", req->id, wire_len);
+    goto sign;
+  }
+
+  // Anything under a TLD known not to exist.
+  if (req->labels > 0 && hsk_ns_cache_has_nx(ns, req)) {
+    hsk_ns_looked_up(ns, req, true);
+
+    msg = hsk_resource_to_nx(req->tld);
+
+    if (!msg) {
+      hsk_ns_log(ns, "could not create nx response (%u)\n", req->id);
+      goto fail;
+    }
+
+    if (!hsk_ns_prepare_new(ns, req, &msg, &wire, &wire_len)) {
+      hsk_ns_log(ns, "could not reply\n");
+      goto fail;
+    }
+
+    hsk_ns_debug(ns, "sending cached nxdomain (%u): %u\n", req->id, wire_len);
+    goto sign;
+  }
+
+  // A pointer holds its own answer: no need
+  // for the TLD's resource.
+  if (req->labels == 2 && hsk_resource_is_ptr(req->name)) {
+    hsk_ns_looked_up(ns, req, true);
+
+    msg = hsk_resource_ptr_to_dns(req->name, req->type, HSK_NS_PTR_TTL);
+
+    if (!msg) {
+      hsk_ns_log(ns, "could not create pointer response (%u)\n", req->id);
+      goto fail;
+    }
+
+    if (!hsk_ns_prepare_new(ns, req, &msg, &wire, &wire_len)) {
+      hsk_ns_log(ns, "could not reply\n");
+      goto fail;
+    }
+
+    hsk_ns_debug(ns, "sending pointer (%u): %u\n", req->id, wire_len);
+    goto sign;
+  }
+
+  // Or from the TLD's resource, which answers
+  // every name below it.
+  if (req->labels > 0) {
+    hsk_resource_t *res = hsk_ns_cache_get_ref(ns, req);
+
+    if (res) {
+      hsk_ns_looked_up(ns, req, true);
+
+      msg = hsk_ns_to_dns(ns, res, req);
+
+      hsk_ns_resource_free(res);
+
+      if (!msg) {
+        hsk_ns_log(ns, "could not create dns response (%u)\n", req->id);
+        goto fail;
+      }
+
+      if (!hsk_ns_prepare_new(ns, req, &msg, &wire, &wire_len)) {
+        hsk_ns_log(ns, "could not reply\n");
+        goto fail;
+      }
+
+      hsk_ns_debug(ns, "sending cached referral (%u): %u\n", req->id, wire_len);
+      goto sign;
+    }
+  }
+
+  // Requesting a lookup.
+  if (req->labels > 0) {
+    hsk_ns_looked_up(ns, req, false);
+
+    int rc = hsk_ns_resolve(ns, req, HSK_PRIORITY_CLIENT, after_resolve);
+
+    // The pool is backed up: fail fast rather
+    // than let the client wait for a timeout.
+    if (rc == HSK_EBUSY) {
+      hsk_ns_log(ns, "pool is busy (%u)\n", req->id);
+      goto stale;
+    }
+
+    if (rc != HSK_SUCCESS) {
+      hsk_ns_log(ns, "pool resolve error: %s\n", hsk_strerror(rc));
+      goto stale;
+    }
+
+    return;
+  }
+
+  // Querying the root zone. The answer is
+  // cached like any other, so that the next
+  // asker is sent the finalized reply above
+  // rather than have it decoded and encoded
+  // again.
+  msg = hsk_ns_root(ns, req->type);
+
+  if (!msg) {
+    hsk_ns_log(ns, "could not create root soa\n");
+    goto fail;
+  }
+
+  if (!hsk_ns_prepare_new(ns, req, &msg, &wire, &wire_len)) {
+    hsk_ns_log(ns, "could not reply\n");
     goto fail;
   }
 
-  hsk_ns_log(ns, "sending root soa (%u): %u\n", req->id, wire_len);
+  hsk_ns_debug(ns, "sending root soa (%u): %u\n", req->id, wire_len);
+
+sign:
+  if (hsk_ns_offload(ns, req, false, HSK_SUCCESS, NULL, wire, wire_len))
+    return;
+
+  if (!hsk_ns_sign(ns, req, &wire, &wire_len)) {
+    hsk_ns_log(ns, "could not sign reply\n");
+    hsk_free(wire);
+    goto fail;
+  }
+
+  hsk_ns_reply(ns, req, wire, wire_len);
+
+  if (hsk_ns_refresh(ns, req))
+    return;
+
+  goto done;
+
+stale:
+  if (hsk_ns_send_stale(ns, req))
+    goto done;
+
+fail:
+  assert(!msg);
+
+  if (!hsk_ns_servfail(ns, req, &wire, &wire_len)) {
+    hsk_ns_log(ns, "could not create servfail\n");
+    goto done;
+  }
+
+  hsk_ns_debug(ns, "sending servfail (%u): %u\n", req->id, wire_len);
+
+  hsk_ns_reply(ns, req, wire, wire_len);
+
+done:
+  if (req)
+    hsk_ns_req_free(req);
+}
+
+// Build the signed reply to a lookup. Safe to
+// call from the threadpool: the cache shards
+// are locked and nothing is sent.
+static bool
+hsk_ns_answer(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  int status,
+  const hsk_resource_t *res,
+  uint8_t **out,
+  size_t *out_len
+) {
+  hsk_dns_msg_t *msg = NULL;
+  uint8_t *wire = NULL;
+  size_t wire_len = 0;
+  uint64_t start = uv_hrtime();
+
+  if (status != HSK_SUCCESS) {
+    // Pool resolve error.
+    hsk_ns_log(ns, "resolve response error: %s\n", hsk_strerror(status));
+
+    if (hsk_ns_get_stale(ns, req, out, out_len))
+      return true;
+  } else if (!res) {
+    // Doesn't exist.
+    //
+    // We should be giving a real NSEC proof
+    // here, but I don't think it's possible
+    // with the current construction.
+    //
+    // I imagine this would only be possible
+    // if NSEC3 begins to support BLAKE2b for
+    // name hashing. Even then, it's still
+    // not possible for SPV nodes since they
+    // can't arbitrarily iterate over the tree.
+    //
+    // Instead, we give a proof with made up
+    // neighbours, covering only the TLD.
+    msg = hsk_resource_to_nx(req->tld);
+
+    if (!msg) {
+      hsk_ns_log(ns, "could not create nx response (%u)\n", req->id);
+    } else {
+      hsk_ns_cache_insert_nx(ns, req, msg);
+      hsk_ns_debug(ns, "sending nxdomain (%u)\n", req->id);
+    }
+  } else if (hsk_ns_cache_get_wire(ns, req, &wire, &wire_len)) {
+    // Exists, and built already for another
+    // lookup waiting on the same name and type.
+    if (!hsk_ns_sign(ns, req, &wire, &wire_len)) {
+      hsk_ns_log(ns, "could not sign reply\n");
+      hsk_free(wire);
+      wire = NULL;
+    } else {
+      hsk_ns_debug(ns, "sending shared msg (%u)\n", req->id);
+    }
+  } else {
+    // Exists!
+    msg = hsk_ns_to_dns(ns, res, req);
+
+    if (!msg)
+      hsk_ns_log(ns, "could not create dns response (%u)\n", req->id);
+    else
+      hsk_ns_debug(ns, "sending msg (%u)\n", req->id);
+  }
+
+  if (msg) {
+    if (!hsk_ns_finalize(ns, req, &msg, &wire, &wire_len)) {
+      assert(!msg && !wire);
+      hsk_ns_log(ns, "could not finalize\n");
+    }
+  }
+
+  if (!wire) {
+    // Send SERVFAIL in case of error.
+    assert(!msg);
+
+    if (!hsk_ns_servfail(ns, req, &wire, &wire_len)) {
+      hsk_ns_log(ns, "could not create servfail\n");
+      return false;
+    }
+
+    hsk_ns_debug(ns, "sending servfail (%u): %u\n", req->id, wire_len);
+  }
+
+  uint32_t us = hsk_ns_time(ns, HSK_NS_STAGE_ANSWER, start);
+
+  if (req->trace)
+    req->trace->answer = us;
+
+  *out = wire;
+  *out_len = wire_len;
+
+  return true;
+}
+
+static void
+hsk_ns_respond(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  int status,
+  const hsk_resource_t *res
+) {
+  uint8_t *wire = NULL;
+  size_t wire_len = 0;
+
+  if (hsk_ns_answer(ns, req, status, res, &wire, &wire_len))
+    hsk_ns_reply(ns, req, wire, wire_len);
+}
+
+int
+hsk_ns_send(
+  hsk_ns_t *ns,
+  uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr,
+  bool should_free
+) {
+  int rc = hsk_udp_send(&ns->udp, data, data_len, addr, should_free);
+
+  if (rc != HSK_SUCCESS)
+    hsk_ns_log(ns, "failed sending: %s\n", hsk_strerror(rc));
+
+  return rc;
+}
+
+/*
+ * UV behavior
+ */
+
+static void
+after_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  hsk_ns_t *ns = (hsk_ns_t *)arg;
+  uint64_t start = hsk_prof_start();
+
+  hsk_ns_onrecv(ns, data, data_len, addr, NULL, false);
+
+  hsk_prof_end(HSK_PROF_NS_RECV, start);
+}
+
+static void
+after_local_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  hsk_ns_t *ns = (hsk_ns_t *)arg;
+  uint64_t start = hsk_prof_start();
+
+  hsk_ns_onrecv(ns, data, data_len, addr, NULL, true);
+
+  hsk_prof_end(HSK_PROF_NS_RECV, start);
+}
+
+static void
+after_close(uv_handle_t *handle) {}
+
+/*
+ * TCP
+ */
+
+static void
+hsk_ns_write_free(hsk_ns_write_t *wr) {
+  for (int i = 0; i < wr->count; i++)
+    hsk_free(wr->bufs[i * 2 + 1].base);
+
+  hsk_free(wr);
+}
+
+static void
+hsk_ns_conn_unref(hsk_ns_conn_t *conn) {
+  assert(conn->refs > 0);
+
+  conn->refs -= 1;
+
+  if (conn->refs == 0)
+    hsk_free(conn);
+}
+
+static void
+hsk_ns_conn_close(hsk_ns_conn_t *conn) {
+  hsk_ns_t *ns = conn->ns;
+
+  if (conn->closing)
+    return;
+
+  conn->closing = true;
+
+  if (conn->batch) {
+    hsk_ns_write_free(conn->batch);
+    conn->batch = NULL;
+  }
+
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    ns->conns = (void *)conn->next;
+
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  conn->prev = NULL;
+  conn->next = NULL;
+  ns->conn_count -= 1;
+
+  uv_close((uv_handle_t *)&conn->socket, after_conn_close);
+  uv_close((uv_handle_t *)&conn->timer, after_conn_close);
+}
+
+static int
+hsk_ns_conn_flush(hsk_ns_conn_t *conn) {
+  hsk_ns_write_t *wr = conn->batch;
+
+  if (!wr)
+    return HSK_SUCCESS;
+
+  conn->batch = NULL;
+
+  uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+  int rc = uv_write(&wr->req, stream, wr->bufs, wr->count * 2,
+                    after_conn_write);
+
+  if (rc != 0) {
+    hsk_ns_log(conn->ns, "tcp write error: %s\n", uv_strerror(rc));
+    hsk_ns_write_free(wr);
+    hsk_ns_conn_close(conn);
+    return HSK_EFAILURE;
+  }
+
+  conn->refs += 1;
+
+  return HSK_SUCCESS;
+}
+
+// Held back while the connection's read is
+// being answered (see after_conn_read).
+static int
+hsk_ns_conn_send(hsk_ns_conn_t *conn, uint8_t *data, size_t data_len) {
+  if (conn->closing || data_len > HSK_DNS_MAX_TCP) {
+    hsk_free(data);
+    return HSK_EFAILURE;
+  }
+
+  hsk_ns_write_t *wr = conn->batch;
+
+  if (!wr) {
+    wr = hsk_malloc(sizeof(hsk_ns_write_t));
+
+    if (!wr) {
+      hsk_free(data);
+      return HSK_ENOMEM;
+    }
+
+    wr->req.data = (void *)wr;
+    wr->conn = conn;
+    wr->count = 0;
+
+    conn->batch = wr;
+  }
+
+  uint8_t *prefix = wr->prefixes[wr->count];
+  uv_buf_t *bufs = &wr->bufs[wr->count * 2];
+
+  set_u16be(prefix, (uint16_t)data_len);
+
+  bufs[0] = uv_buf_init((char *)prefix, 2);
+  bufs[1] = uv_buf_init((char *)data, data_len);
+
+  wr->count += 1;
+
+  // Busy connections are not idle.
+  uv_timer_again(&conn->timer);
+
+  if (conn->reading && wr->count < HSK_NS_TCP_BATCH)
+    return HSK_SUCCESS;
+
+  return hsk_ns_conn_flush(conn);
+}
+
+static void
+after_connection(uv_stream_t *server, int status) {
+  hsk_ns_t *ns = (hsk_ns_t *)server->data;
+
+  if (status < 0) {
+    hsk_ns_log(ns, "tcp connection error: %s\n", uv_strerror(status));
+    return;
+  }
+
+  hsk_ns_conn_t *conn = hsk_malloc(sizeof(hsk_ns_conn_t));
+
+  if (!conn) {
+    hsk_ns_log(ns, "could not allocate tcp connection\n");
+    return;
+  }
+
+  conn->ns = ns;
+  conn->buf_len = 0;
+  conn->refs = 1;
+  conn->handles = 0;
+  conn->closing = false;
+  conn->reading = false;
+  conn->batch = NULL;
+  conn->local = server == (uv_stream_t *)&ns->local_tcp;
+  conn->prev = NULL;
+  conn->next = (hsk_ns_conn_t *)ns->conns;
+  memset(&conn->addr, 0, sizeof(conn->addr));
+
+  if (uv_tcp_init(ns->loop, &conn->socket) != 0) {
+    hsk_free(conn);
+    return;
+  }
+
+  conn->socket.data = (void *)conn;
+  conn->handles += 1;
+
+  if (uv_timer_init(ns->loop, &conn->timer) != 0) {
+    uv_close((uv_handle_t *)&conn->socket, after_conn_close);
+    return;
+  }
+
+  conn->timer.data = (void *)conn;
+  conn->handles += 1;
+
+  if (conn->next)
+    conn->next->prev = conn;
+
+  ns->conns = (void *)conn;
+  ns->conn_count += 1;
+
+  if (uv_accept(server, (uv_stream_t *)&conn->socket) != 0) {
+    hsk_ns_conn_close(conn);
+    return;
+  }
+
+  if (ns->conn_count > HSK_NS_TCP_MAX) {
+    hsk_ns_log(ns, "too many tcp connections\n");
+    hsk_ns_conn_close(conn);
+    return;
+  }
+
+  int addr_len = sizeof(conn->addr);
+  struct sockaddr *addr = (struct sockaddr *)&conn->addr;
+
+  if (uv_tcp_getpeername(&conn->socket, addr, &addr_len) != 0) {
+    hsk_ns_conn_close(conn);
+    return;
+  }
+
+  uv_tcp_nodelay(&conn->socket, 1);
+
+  uint64_t timeout = HSK_NS_TCP_TIMEOUT;
+  uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+  uv_timer_start(&conn->timer, after_conn_timeout, timeout, timeout);
+
+  if (uv_read_start(stream, alloc_conn, after_conn_read) != 0)
+    hsk_ns_conn_close(conn);
+}
+
+// Read straight into the connection buffer:
+// it always has room for the rest of a frame.
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
+  hsk_ns_conn_t *conn = (hsk_ns_conn_t *)handle->data;
+
+  buf->base = (char *)&conn->buf[conn->buf_len];
+  buf->len = sizeof(conn->buf) - conn->buf_len;
+}
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  hsk_ns_conn_t *conn = (hsk_ns_conn_t *)stream->data;
+  hsk_ns_t *ns = conn->ns;
+
+  if (nread < 0) {
+    hsk_ns_conn_close(conn);
+    return;
+  }
+
+  if (nread == 0)
+    return;
+
+  conn->buf_len += nread;
+
+  uv_timer_again(&conn->timer);
+
+  const struct sockaddr *addr = (struct sockaddr *)&conn->addr;
+  size_t pos = 0;
+
+  conn->reading = true;
+
+  while (conn->buf_len - pos >= 2) {
+    size_t size = get_u16be(&conn->buf[pos]);
 
-  hsk_ns_send(ns, wire, wire_len, addr, true);
+    if (size == 0) {
+      hsk_ns_conn_close(conn);
+      return;
+    }
 
-  goto done;
+    if (conn->buf_len - pos < 2 + size)
+      break;
 
-fail:
-  assert(!msg);
+    uint64_t start = hsk_prof_start();
 
-  msg = hsk_resource_to_servfail();
+    hsk_ns_onrecv(ns, &conn->buf[pos + 2], size, addr, conn, conn->local);
 
-  if (!msg) {
-    hsk_ns_log(ns, "failed creating servfail\n");
-    goto done;
-  }
+    hsk_prof_end(HSK_PROF_NS_TCP, start);
 
-  if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
-    hsk_ns_log(ns, "could not reply\n");
-    goto done;
+    if (conn->closing)
+      return;
+
+    pos += 2 + size;
   }
 
-  hsk_ns_log(ns, "sending servfail (%u): %u\n", req->id, wire_len);
+  if (pos > 0) {
+    memmove(&conn->buf[0], &conn->buf[pos], conn->buf_len - pos);
+    conn->buf_len -= pos;
+  }
 
-  hsk_ns_send(ns, wire, wire_len, addr, true);
+  conn->reading = false;
 
-done:
-  if (req)
-    hsk_dns_req_free(req);
+  hsk_ns_conn_flush(conn);
 }
 
 static void
-hsk_ns_respond(
-  hsk_ns_t *ns,
-  const hsk_dns_req_t *req,
-  int status,
-  const hsk_resource_t *res
-) {
-  hsk_dns_msg_t *msg = NULL;
-  uint8_t *wire = NULL;
-  size_t wire_len = 0;
-
-  if (status != HSK_SUCCESS) {
-    // Pool resolve error.
-    hsk_ns_log(ns, "resolve response error: %s\n", hsk_strerror(status));
-  } else if (!res) {
-    // Doesn't exist.
-    //
-    // We should be giving a real NSEC proof
-    // here, but I don't think it's possible
-    // with the current construction.
-    //
-    // I imagine this would only be possible
-    // if NSEC3 begins to support BLAKE2b for
-    // name hashing. Even then, it's still
-    // not possible for SPV nodes since they
-    // can't arbitrarily iterate over the tree.
-    //
-    // Instead, we give a phony proof, which
-    // makes the root zone look empty.
-    msg = hsk_resource_to_nx();
+after_conn_write(uv_write_t *req, int status) {
+  hsk_ns_write_t *wr = (hsk_ns_write_t *)req->data;
+  hsk_ns_conn_t *conn = wr->conn;
 
-    if (!msg)
-      hsk_ns_log(ns, "could not create nx response (%u)\n", req->id);
-    else
-      hsk_ns_log(ns, "sending nxdomain (%u)\n", req->id);
-  } else {
-    // Exists!
-    msg = hsk_resource_to_dns(res, req->name, req->type);
+  hsk_ns_write_free(wr);
 
-    if (!msg)
-      hsk_ns_log(ns, "could not create dns response (%u)\n", req->id);
-    else
-      hsk_ns_log(ns, "sending msg (%u)\n", req->id);
+  if (status != 0 && !conn->closing) {
+    hsk_ns_log(conn->ns, "tcp write error: %s\n", uv_strerror(status));
+    hsk_ns_conn_close(conn);
   }
 
-  if (msg) {
-    hsk_cache_insert(&ns->cache, req, msg);
+  hsk_ns_conn_unref(conn);
+}
 
-    if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
-      assert(!msg && !wire);
-      hsk_ns_log(ns, "could not finalize\n");
-    }
-  }
+static void
+after_conn_timeout(uv_timer_t *timer) {
+  hsk_ns_conn_close((hsk_ns_conn_t *)timer->data);
+}
 
-  if (!wire) {
-    // Send SERVFAIL in case of error.
-    assert(!msg);
+static void
+after_conn_close(uv_handle_t *handle) {
+  hsk_ns_conn_t *conn = (hsk_ns_conn_t *)handle->data;
 
-    msg = hsk_resource_to_servfail();
+  conn->handles -= 1;
 
-    if (!msg) {
-      hsk_ns_log(ns, "could not create servfail response\n");
-      return;
-    }
+  if (conn->handles == 0)
+    hsk_ns_conn_unref(conn);
+}
 
-    if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
-      hsk_ns_log(ns, "could not create servfail\n");
-      return;
+static void
+on_sign(uv_work_t *req) {
+  hsk_ns_sign_t *job = (hsk_ns_sign_t *)req->data;
+  hsk_ns_t *ns = job->ns;
+
+  if (job->answer) {
+    if (!hsk_ns_answer(ns, job->dns, job->status, job->res,
+                       &job->wire, &job->wire_len)) {
+      job->wire = NULL;
     }
+    return;
+  }
 
-    hsk_ns_log(ns, "sending servfail (%u): %u\n", req->id, wire_len);
+  if (!hsk_ns_sign(ns, job->dns, &job->wire, &job->wire_len)) {
+    hsk_ns_log(ns, "could not sign reply\n");
+    hsk_free(job->wire);
+    job->wire = NULL;
   }
+}
+
+static void
+after_sign(uv_work_t *req, int status) {
+  hsk_ns_sign_t *job = (hsk_ns_sign_t *)req->data;
+  hsk_ns_t *ns = job->ns;
+  hsk_dns_req_t *dns = job->dns;
+  uint64_t start = hsk_prof_start();
+
+  if (job->wire)
+    hsk_ns_reply(ns, dns, job->wire, job->wire_len);
+
+  hsk_prof_end(HSK_PROF_NS_SIGN, start);
+
+  hsk_ns_resource_free(job->res);
+
+  bool answer = job->answer;
+
+  hsk_free(job);
+
+  // A cache hit may be due for a refresh.
+  if (!answer && hsk_ns_refresh(ns, dns))
+    return;
 
-  hsk_ns_send(ns, wire, wire_len, req->addr, true);
+  hsk_ns_req_free(dns);
 }
 
-int
-hsk_ns_send(
+static void
+after_root_timer(uv_timer_t *timer) {
+  hsk_ns_t *ns = (hsk_ns_t *)timer->data;
+
+  if (!hsk_ns_sign_root(ns))
+    hsk_ns_log(ns, "could not sign root zone\n");
+}
+
+static void
+hsk_ns_shared_clear(hsk_ns_t *ns) {
+  hsk_resource_free(ns->shared_res);
+  hsk_free(ns->shared_data);
+  ns->shared_tld[0] = '\0';
+  ns->shared_data = NULL;
+  ns->shared_len = 0;
+  ns->shared_types = 0;
+  ns->shared_res = NULL;
+}
+
+// The decode of the proof if it was the last
+// one seen, and kept what this type needs.
+static hsk_resource_t *
+hsk_ns_shared_get(
   hsk_ns_t *ns,
-  uint8_t *data,
+  const char *name,
+  const uint8_t *data,
   size_t data_len,
-  const struct sockaddr *addr,
-  bool should_free
+  uint16_t type
 ) {
-  int rc = HSK_SUCCESS;
-  hsk_send_data_t *sd = NULL;
-  uv_udp_send_t *req = NULL;
+  uint32_t types = hsk_resource_types(type);
 
-  sd = (hsk_send_data_t *)malloc(sizeof(hsk_send_data_t));
+  if (!ns->shared_res)
+    return NULL;
 
-  if (!sd) {
-    rc = HSK_ENOMEM;
-    goto fail;
-  }
+  if ((ns->shared_types & types) != types)
+    return NULL;
 
-  req = (uv_udp_send_t *)malloc(sizeof(uv_udp_send_t));
+  if (ns->shared_len != data_len || strcmp(ns->shared_tld, name) != 0)
+    return NULL;
 
-  if (!req) {
-    rc = HSK_ENOMEM;
-    goto fail;
-  }
+  if (memcmp(ns->shared_data, data, data_len) != 0)
+    return NULL;
 
-  sd->ns = ns;
-  sd->data = (void *)data;
-  sd->should_free = should_free;
+  return hsk_resource_ref(ns->shared_res);
+}
 
-  req->data = (void *)sd;
+static void
+hsk_ns_shared_set(
+  hsk_ns_t *ns,
+  const char *name,
+  const uint8_t *data,
+  size_t data_len,
+  uint16_t type,
+  hsk_resource_t *res
+) {
+  if (strlen(name) > HSK_DNS_MAX_LABEL)
+    return;
 
-  uv_buf_t bufs[] = {
-    { .base = (char *)data, .len = data_len }
-  };
+  uint8_t *copy = hsk_malloc(data_len);
 
-  int status = uv_udp_send(req, &ns->socket, bufs, 1, addr, after_send);
+  if (!copy)
+    return;
 
-  if (status != 0) {
-    hsk_ns_log(ns, "failed sending: %s\n", uv_strerror(status));
-    rc = HSK_EFAILURE;
-    goto fail;
-  }
+  memcpy(copy, data, data_len);
 
-  return rc;
+  hsk_ns_shared_clear(ns);
 
-fail:
-  if (sd)
-    free(sd);
+  strcpy(ns->shared_tld, name);
+  ns->shared_data = copy;
+  ns->shared_len = data_len;
+  ns->shared_types = hsk_resource_types(type);
+  ns->shared_res = hsk_resource_ref(res);
+}
 
-  if (req)
-    free(req);
+static int
+hsk_ns_decode(
+  hsk_ns_t *ns,
+  const hsk_dns_req_t *req,
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  hsk_resource_t **out
+) {
+  hsk_resource_t *res = NULL;
 
-  if (data && should_free)
-    free(data);
+  if (status == HSK_SUCCESS) {
+    if (!exists || data_len == 0) {
+      if (hsk_icann_lookup(name, &res) != HSK_SUCCESS) {
+        hsk_ns_log(ns, "could not decode root resource for: %s\n", name);
+        status = HSK_EFAILURE;
+      }
+      data_len = 0;
+    } else if ((res = hsk_ns_shared_get(ns, name, data, data_len, req->type))) {
+      // Already kept for the other names too.
+      *out = res;
+      return status;
+    } else {
+      if (hsk_resource_decode_for(data, data_len, req->type, &res)) {
+        hsk_ns_shared_set(ns, name, data, data_len, req->type, res);
+      } else {
+        hsk_ns_log(ns, "could not decode resource for: %s\n", name);
+        status = HSK_EFAILURE;
+        res = NULL;
+      }
+    }
+  }
 
-  return rc;
-}
+  // Keep it for the other names under the TLD.
+  if (res)
+    hsk_ns_cache_insert_ref(ns, name, data, data_len, res->ttl);
 
-/*
- * UV behavior
- */
+  *out = res;
+
+  return status;
+}
 
 static void
-alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
-  hsk_ns_t *ns = (hsk_ns_t *)handle->data;
+after_resolve(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+) {
+  hsk_dns_req_t *req = (hsk_dns_req_t *)arg;
+  hsk_ns_t *ns = (hsk_ns_t *)req->ns;
+  hsk_resource_t *res = NULL;
 
-  if (!ns) {
-    buf->base = NULL;
-    buf->len = 0;
-    return;
+  uint32_t us = hsk_ns_time(ns, HSK_NS_STAGE_PROOF, req->lookup_time);
+
+  if (req->trace) {
+    req->trace->proof = us;
+
+    if (hsk_ns_remote(ns))
+      hsk_ns_trace_lookup(req, hsk_pool_client_get_trace(&ns->client));
+    else
+      hsk_ns_trace_lookup(req, hsk_pool_get_trace(ns->pool));
   }
 
-  buf->base = (char *)ns->read_buffer;
-  buf->len = sizeof(ns->read_buffer);
+  status = hsk_ns_decode(ns, req, name, status, exists,
+                         data, data_len, &res);
+
+  if (hsk_ns_offload(ns, req, true, status, res, NULL, 0))
+    return;
+
+  hsk_ns_respond(ns, req, status, res);
+
+  hsk_ns_resource_free(res);
+
+  hsk_ns_req_free(req);
 }
 
+// Nothing is sent: the fresh reply only
+// replaces the cache entry.
 static void
-after_send(uv_udp_send_t *req, int status) {
-  hsk_send_data_t *sd = (hsk_send_data_t *)req->data;
-  hsk_ns_t *ns = sd->ns;
+after_refresh(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+) {
+  hsk_dns_req_t *req = (hsk_dns_req_t *)arg;
+  hsk_ns_t *ns = (hsk_ns_t *)req->ns;
+  hsk_resource_t *res = NULL;
+  hsk_dns_msg_t *msg = NULL;
 
-  if (sd->data && sd->should_free)
-    free(sd->data);
+  status = hsk_ns_decode(ns, req, name, status, exists,
+                         data, data_len, &res);
 
-  free(sd);
-  free(req);
+  if (status != HSK_SUCCESS) {
+    hsk_ns_log(ns, "refresh error: %s\n", hsk_strerror(status));
+    goto done;
+  }
 
-  if (!ns)
-    return;
+  if (res)
+    msg = hsk_ns_to_dns(ns, res, req);
+  else
+    msg = hsk_resource_to_nx(req->tld);
 
-  if (status != 0) {
-    hsk_ns_log(ns, "send error: %s\n", uv_strerror(status));
-    return;
+  if (msg) {
+    hsk_ns_cache_insert(ns, req, msg);
+    hsk_dns_msg_free(msg);
   }
+
+done:
+  hsk_ns_resource_free(res);
+
+  hsk_ns_req_free(req);
 }
 
+// One entry of a prefetch list is done.
 static void
-after_recv(
-  uv_udp_t *socket,
-  ssize_t nread,
-  const uv_buf_t *buf,
-  const struct sockaddr *addr,
-  unsigned flags
+after_prefetch(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
 ) {
-  hsk_ns_t *ns = (hsk_ns_t *)socket->data;
-
-  if (!ns)
-    return;
+  hsk_dns_req_t *req = (hsk_dns_req_t *)arg;
+  hsk_ns_t *ns = (hsk_ns_t *)req->ns;
 
-  if (nread < 0) {
-    hsk_ns_log(ns, "udp read error: %s\n", uv_strerror(nread));
-    return;
-  }
+  ns->prefetch_pending -= 1;
 
-  // No more data to read.
-  // Happens after every msg?
-  if (nread == 0 && addr == NULL)
-    return;
+  if (status == HSK_SUCCESS)
+    ns->prefetch_done += 1;
+  else
+    ns->prefetch_failed += 1;
 
-  // Never seems to happen on its own.
-  if (addr == NULL)
-    return;
+  after_refresh(name, status, exists, data, data_len, arg);
 
-  hsk_ns_onrecv(
-    ns,
-    (uint8_t *)buf->base,
-    (size_t)nread,
-    (struct sockaddr *)addr,
-    (uint32_t)flags
-  );
+  hsk_ns_prefetch_next(ns);
 }
 
+// A name's non-existence is cached as it would
+// be for a query.
 static void
-after_close(uv_handle_t *handle) {}
+hsk_ns_lookup_nx(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  hsk_dns_msg_t *msg = hsk_resource_to_nx(req->tld);
+
+  if (msg) {
+    hsk_ns_cache_insert_nx(ns, req, msg);
+    hsk_dns_msg_free(msg);
+  }
+}
 
 static void
-after_resolve(
+after_lookup(
   const char *name,
   int status,
   bool exists,
@@ -602,68 +4260,91 @@ after_resolve(
   size_t data_len,
   const void *arg
 ) {
-  hsk_dns_req_t *req = (hsk_dns_req_t *)arg;
+  hsk_ns_lookup_t *lookup = (hsk_ns_lookup_t *)arg;
+  hsk_dns_req_t *req = lookup->req;
   hsk_ns_t *ns = (hsk_ns_t *)req->ns;
   hsk_resource_t *res = NULL;
+  hsk_dns_msg_t *msg = NULL;
 
-  if (status == HSK_SUCCESS) {
-    if (!exists || data_len == 0) {
-      const uint8_t *item = hsk_icann_lookup(name);
+  hsk_ns_time(ns, HSK_NS_STAGE_PROOF, req->lookup_time);
 
-      if (item) {
-        const uint8_t *raw = &item[2];
-        size_t raw_len = (((size_t)item[1]) << 8) | ((size_t)item[0]);
+  status = hsk_ns_decode(ns, req, name, status, exists,
+                         data, data_len, &res);
 
-        if (!hsk_resource_decode(raw, raw_len, &res)) {
-          hsk_ns_log(ns, "could not decode root resource for: %s\n", name);
-          status = HSK_EFAILURE;
-          res = NULL;
-        }
-      }
+  if (status != HSK_SUCCESS) {
+    hsk_ns_log(ns, "lookup error: %s\n", hsk_strerror(status));
+
+    msg = hsk_ns_cache_get_stale(ns, req);
+
+    if (msg) {
+      hsk_ns_count(&ns->stats.stale);
+      status = HSK_SUCCESS;
     } else {
-      if (!hsk_resource_decode(data, data_len, &res)) {
-        hsk_ns_log(ns, "could not decode resource for: %s\n", name);
-        status = HSK_EFAILURE;
-        res = NULL;
-      }
+      hsk_ns_count(&ns->stats.servfails);
     }
+  } else if (res) {
+    msg = hsk_ns_to_dns(ns, res, req);
+
+    if (msg)
+      hsk_ns_cache_insert(ns, req, msg);
+  } else {
+    hsk_ns_lookup_nx(ns, req);
+    msg = hsk_resource_to_nx(req->tld);
   }
 
-  hsk_ns_respond(ns, req, status, res);
+  if (status == HSK_SUCCESS && !msg)
+    status = HSK_ENOMEM;
 
-  if (res)
-    hsk_resource_free(res);
+  hsk_ns_time(ns, HSK_NS_STAGE_TOTAL, req->time);
+
+  lookup->callback(lookup->arg, status, msg);
 
-  hsk_dns_req_free(req);
+  hsk_ns_resource_free(res);
+  hsk_ns_req_free(req);
+  hsk_free(lookup);
 }
 
-static int
-hsk_tld_index(const char *name) {
-  int start = 0;
-  int end = HSK_TLD_SIZE - 1;
+static void
+after_lookup_raw(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+) {
+  hsk_ns_lookup_t *lookup = (hsk_ns_lookup_t *)arg;
+  hsk_dns_req_t *req = lookup->req;
+  hsk_ns_t *ns = (hsk_ns_t *)req->ns;
+  hsk_resource_t *res = NULL;
 
-  while (start <= end) {
-    int pos = (start + end) >> 1;
-    int cmp = strcasecmp(HSK_TLD_NAMES[pos], name);
+  hsk_ns_time(ns, HSK_NS_STAGE_PROOF, req->lookup_time);
 
-    if (cmp == 0)
-      return pos;
+  status = hsk_ns_decode(ns, req, name, status, exists,
+                         data, data_len, &res);
 
-    if (cmp < 0)
-      start = pos + 1;
-    else
-      end = pos - 1;
+  if (status != HSK_SUCCESS) {
+    hsk_ns_log(ns, "lookup error: %s\n", hsk_strerror(status));
+    hsk_ns_count(&ns->stats.servfails);
+  } else if (!res) {
+    hsk_ns_lookup_nx(ns, req);
   }
 
-  return -1;
-}
+  if (!exists)
+    data_len = 0;
 
-static const uint8_t *
-hsk_icann_lookup(const char *name) {
-  int index = hsk_tld_index(name);
+  hsk_ns_time(ns, HSK_NS_STAGE_TOTAL, req->time);
 
-  if (index == -1)
-    return NULL;
+  lookup->raw_callback(lookup->arg, status, exists && data_len > 0,
+                       data, data_len);
 
-  return (const uint8_t *)HSK_TLD_DATA[index];
+  hsk_ns_resource_free(res);
+  hsk_ns_req_free(req);
+  hsk_free(lookup);
+}
+
+static void
+hsk_ns_resource_free(hsk_resource_t *res) {
+  if (res && !hsk_icann_shared(res))
+    hsk_resource_free(res);
 }
@@ -6,36 +6,251 @@
 #include <stdbool.h>
 #include "uv.h"
 
+#include "affinity.h"
 #include "cache.h"
 #include "ec.h"
+#include "handoff.h"
 #include "pool.h"
+#include "resource.h"
+#include "rrl.h"
+#include "shm.h"
+#include "top.h"
+#include "trace.h"
+#include "udp.h"
 
 /*
  * Defs
  */
 
-#define HSK_UDP_BUFFER 4096
+// Extra threads answering queries, each with
+// its own loop and SO_REUSEPORT socket. The
+// cache is split into shards (by TLD) shared
+// by all of them.
+#define HSK_NS_WORKERS_MAX 64
+#define HSK_NS_SHARDS 16
+
+// Signing can be moved to the libuv threadpool,
+// which caps its size at 128.
+#define HSK_NS_SIGNERS_MAX 128
+
+// DNS over TCP (RFC 7766): open connections,
+// and how long (ms) an idle one is kept.
+#define HSK_NS_TCP_MAX 256
+#define HSK_NS_TCP_TIMEOUT 10000
+
+// Replies to the queries in one read are
+// written together, this many at most.
+#define HSK_NS_TCP_BATCH 16
+
+// Root zone answers (NS, SOA, DNSKEY, DS and
+// the empty proof) are signed ahead of time,
+// and again every hour (the SOA serial).
+#define HSK_NS_ROOT_ANSWERS 5
+#define HSK_NS_ROOT_REFRESH (60 * 60 * 1000)
+
+// The root zone can be transferred (AXFR, over
+// TCP) by resolvers that would rather serve it
+// themselves (RFC 8806): the apex, every ICANN
+// delegation and every Handshake name with a
+// verified resource in the cache. The messages
+// are built on the first transfer after the
+// tree root or the root's signatures change,
+// each holding this much at most (leaving room
+// for a cookie and SIG(0)).
+#define HSK_NS_ZONE_MAX (HSK_DNS_MAX_TCP - 1024)
+
+// The cache file ("nsch") is saved every 15
+// minutes: a header (magic, version, network
+// and a count) and each shard's cache, all
+// little endian (see hsk_cache_write).
+#define HSK_NS_CACHE_MAGIC 0x6863736e
+#define HSK_NS_CACHE_VERSION 1
+#define HSK_NS_CACHE_FILE "cache.dat"
+#define HSK_NS_CACHE_HDR_SIZE 16
+#define HSK_NS_CACHE_FLUSH (15 * 60 * 1000)
+
+// A prefetch list is resolved once the chain
+// is synced (checked every second), with at
+// most this many lookups in flight.
+#define HSK_NS_PREFETCH_MAX 16
+#define HSK_NS_PREFETCH_WAIT 1000
+
+// Synthesized pointers (addresses as labels,
+// see resource.c) are answered from the name
+// alone, with this TTL: the answer cannot
+// change.
+#define HSK_NS_PTR_TTL 86400
+
+// Stages of answering a query, timed in log2
+// buckets: within HSK_NS_STATS_BASE << i
+// microseconds, the last one open ended.
+//   cache: receipt until a hit or a lookup
+//   proof: lookup until the pool answers
+//   answer: conversion, encoding and signing
+//   sign: SIG(0) alone
+//   total: receipt until the reply is sent
+#define HSK_NS_STAGE_CACHE 0
+#define HSK_NS_STAGE_PROOF 1
+#define HSK_NS_STAGE_ANSWER 2
+#define HSK_NS_STAGE_SIGN 3
+#define HSK_NS_STAGE_TOTAL 4
+#define HSK_NS_STAGES 5
+#define HSK_NS_STATS_BUCKETS 20
+#define HSK_NS_STATS_BASE 4
+
+// The most queried names and TLDs, tracked in
+// each loop (see top.h) and halved every
+// HSK_NS_TOP_WINDOW queries.
+#define HSK_NS_TOP_NAMES 128
+#define HSK_NS_TOP_TLDS 64
+#define HSK_NS_TOP_WINDOW 100000
 
 /*
  * Types
  */
 
-typedef struct {
+typedef struct hsk_ns_shard_s {
+  uv_mutex_t lock;
+  hsk_cache_t cache;
+} hsk_ns_shard_t;
+
+// Updated atomically: workers, the parent and
+// the threadpool all count into their own.
+typedef struct hsk_ns_stats_s {
+  uint64_t queries;
+  uint64_t cached;
+  uint64_t lookups;
+  uint64_t stale;
+  uint64_t servfails;
+  // Queries the kernel dropped on a full
+  // receive buffer (filled in from the sockets).
+  uint64_t drops;
+  uint64_t latency[HSK_NS_STAGES][HSK_NS_STATS_BUCKETS];
+} hsk_ns_stats_t;
+
+// Summed over the shards. Each tier has its
+// own budget (max_bytes, per tier).
+typedef struct hsk_ns_cache_info_s {
+  size_t items;
+  size_t item_bytes;
+  size_t replies;
+  size_t reply_bytes;
+  size_t nxs;
+  size_t refs;
+  size_t max_bytes;
+  uint64_t rejected;
+} hsk_ns_cache_info_t;
+
+typedef struct hsk_ns_s {
   uv_loop_t *loop;
   hsk_pool_t *pool;
   hsk_addr_t ip_;
   hsk_addr_t *ip;
-  uv_udp_t socket;
+  hsk_udp_t udp;
+  uv_tcp_t tcp;
+  void *conns;
+  int conn_count;
+  bool listening;
+  // A private loopback listener for our own
+  // recursive resolver (kept by the parent).
+  hsk_udp_t local;
+  // Freed requests, for the next query.
+  hsk_slab_t reqs;
+  uv_tcp_t local_tcp;
+  struct sockaddr_storage local_addr;
+  bool local_bound;
+  bool local_listening;
+  uint8_t *root[HSK_NS_ROOT_ANSWERS];
+  size_t root_len[HSK_NS_ROOT_ANSWERS];
+  uv_timer_t root_timer;
+  uint8_t **zone;
+  size_t *zone_len;
+  int zone_count;
+  uint8_t zone_root[32];
+  bool signing;
+  bool offload;
+  bool minimal;
+  bool any_hinfo;
+  bool unsigned_errors;
+  // Per source prefix, for queries over UDP.
+  hsk_rrl_t rrl;
   hsk_ec_t *ec;
-  hsk_cache_t cache;
+  hsk_ns_shard_t *shards;
+  int shard_count;
+  size_t cache_size;
+  uint32_t min_ttl;
+  uint32_t max_ttl;
+  uint32_t neg_ttl;
+  char cache_path[1024];
+  uv_timer_t save_timer;
+  bool saving;
+  // Names from hsk_ns_prefetch_list, waiting.
+  void *prefetch_head;
+  void *prefetch_tail;
+  int prefetch_pending;
+  size_t prefetch_done;
+  size_t prefetch_failed;
+  uv_timer_t prefetch_timer;
+  bool prefetching;
+  // The proof decoded last, and for which
+  // record types (see hsk_resource_types).
+  // Lookups waiting on the same name are
+  // answered one after another, and share it.
+  char shared_tld[HSK_DNS_MAX_LABEL + 1];
+  uint8_t *shared_data;
+  size_t shared_len;
+  uint32_t shared_types;
+  hsk_resource_t *shared_res;
   uint8_t key_[32];
   uint8_t *key;
   uint8_t pubkey[33];
-  uint8_t read_buffer[HSK_UDP_BUFFER];
   bool bound;
-  bool receiving;
+  // Workers resolve through a pool client of
+  // their own; the parent keeps what they share.
+  struct hsk_ns_s *parent;
+  struct hsk_ns_s **workers;
+  int worker_count;
+  uv_loop_t loop_;
+  uv_thread_t thread;
+  uv_async_t async;
+  uv_mutex_t lock;
+  hsk_pool_client_t client;
+  bool running;
+  hsk_ns_stats_t stats;
+  // Sampled queries (the parent's serves all).
+  hsk_tracer_t tracer;
+  // Every query as it arrived (shared).
+  hsk_capture_t *capture;
+  // Sockets to open on, if bound already.
+  hsk_handoff_t *handoff;
+  // Workers' CPUs, from `affinity_first` on,
+  // and this one's (-1 for unpinned).
+  const hsk_affinity_t *affinity;
+  int affinity_first;
+  int cpu;
+  // Messages shared with other processes,
+  // behind the shards (see shm.h).
+  hsk_shm_t *shm;
+  hsk_top_t top_names;
+  hsk_top_t top_tlds;
 } hsk_ns_t;
 
+// Answers to hsk_ns_lookup: the message a
+// query would get, neither finalized nor
+// signed, and the callee's to free (NULL on
+// failure).
+typedef void (*hsk_ns_lookup_cb)(void *arg, int status, hsk_dns_msg_t *msg);
+
+// And to hsk_ns_lookup_raw: the TLD's resource
+// as committed in the tree, if it is there.
+typedef void (*hsk_ns_lookup_raw_cb)(
+  void *arg,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+);
+
 /*
  * Root Nameserver
  */
@@ -52,9 +267,68 @@ hsk_ns_set_ip(hsk_ns_t *ns, const struct sockaddr *addr);
 bool
 hsk_ns_set_key(hsk_ns_t *ns, const uint8_t *key);
 
+bool
+hsk_ns_set_cache_size(hsk_ns_t *ns, size_t size);
+
+bool
+hsk_ns_set_ttl(
+  hsk_ns_t *ns,
+  uint32_t min_ttl,
+  uint32_t max_ttl,
+  uint32_t neg_ttl
+);
+
+bool
+hsk_ns_set_prefix(hsk_ns_t *ns, const char *prefix);
+
+bool
+hsk_ns_set_workers(hsk_ns_t *ns, int count);
+
+bool
+hsk_ns_set_offload(hsk_ns_t *ns, bool offload);
+
+bool
+hsk_ns_set_minimal(hsk_ns_t *ns, bool minimal);
+
+bool
+hsk_ns_set_any_hinfo(hsk_ns_t *ns, bool hinfo);
+
+bool
+hsk_ns_set_unsigned_errors(hsk_ns_t *ns, bool unsigned_errors);
+
+bool
+hsk_ns_set_rate_limit(hsk_ns_t *ns, uint32_t rate);
+
+bool
+hsk_ns_set_udp_buffers(hsk_ns_t *ns, int rcvbuf, int sndbuf);
+
+bool
+hsk_ns_set_trace(hsk_ns_t *ns, uint32_t rate);
+
+bool
+hsk_ns_set_capture(hsk_ns_t *ns, hsk_capture_t *capture);
+
+bool
+hsk_ns_set_handoff(hsk_ns_t *ns, hsk_handoff_t *handoff);
+
+bool
+hsk_ns_set_shared_cache(hsk_ns_t *ns, hsk_shm_t *shm);
+
+bool
+hsk_ns_set_affinity(hsk_ns_t *ns, const hsk_affinity_t *aff, int first);
+
 int
 hsk_ns_open(hsk_ns_t *ns, const struct sockaddr *addr);
 
+int
+hsk_ns_get_fds(const hsk_ns_t *ns, int *fds, int max);
+
+int
+hsk_ns_save(hsk_ns_t *ns);
+
+bool
+hsk_ns_get_local(const hsk_ns_t *ns, struct sockaddr *addr);
+
 int
 hsk_ns_close(hsk_ns_t *ns);
 
@@ -66,4 +340,45 @@ hsk_ns_free(hsk_ns_t *ns);
 
 int
 hsk_ns_destroy(hsk_ns_t *ns);
+
+void
+hsk_ns_get_stats(const hsk_ns_t *ns, hsk_ns_stats_t *stats);
+
+void
+hsk_ns_get_cache_info(hsk_ns_t *ns, hsk_ns_cache_info_t *info);
+
+void
+hsk_ns_log_stats(hsk_ns_t *ns);
+
+int
+hsk_ns_get_top(hsk_ns_t *ns, bool tlds, hsk_top_item_t *items, int max);
+
+int
+hsk_ns_purge(hsk_ns_t *ns, const char *name, size_t *count);
+
+int
+hsk_ns_prefetch(hsk_ns_t *ns, const char *name, uint16_t type);
+
+int
+hsk_ns_prefetch_list(hsk_ns_t *ns, const char *path, size_t *count);
+
+int
+hsk_ns_lookup(
+  hsk_ns_t *ns,
+  const char *name,
+  uint16_t type,
+  hsk_ns_lookup_cb callback,
+  void *arg
+);
+
+int
+hsk_ns_lookup_raw(
+  hsk_ns_t *ns,
+  const char *name,
+  hsk_ns_lookup_raw_cb callback,
+  void *arg
+);
+
+int
+hsk_ns_dump_trace(hsk_ns_t *ns, const char *path);
 #endif
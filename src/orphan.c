@@ -0,0 +1,310 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "header.h"
+#include "map.h"
+#include "mem.h"
+#include "orphan.h"
+
+/*
+ * Helpers
+ */
+
+static uint32_t
+hsk_orphan_hash_id(const void *key) {
+  uint64_t id = *((uint64_t *)key);
+  return (uint32_t)(id ^ (id >> 32));
+}
+
+static bool
+hsk_orphan_equal_id(const void *a, const void *b) {
+  return *((uint64_t *)a) == *((uint64_t *)b);
+}
+
+// What an orphan actually costs us.
+static size_t
+hsk_orphan_bytes(void) {
+  return sizeof(hsk_orphan_t) + sizeof(hsk_header_t);
+}
+
+/*
+ * Orphans
+ */
+
+void
+hsk_orphans_init(hsk_orphans_t *orphans) {
+  assert(orphans);
+
+  hsk_hmap_init(&orphans->map, NULL);
+  hsk_hmap_init(&orphans->prevs, NULL);
+  hsk_map_init_map(&orphans->peers,
+    hsk_orphan_hash_id, hsk_orphan_equal_id, hsk_free);
+
+  orphans->head = NULL;
+  orphans->tail = NULL;
+  orphans->size = 0;
+  orphans->bytes = 0;
+  orphans->max_bytes = HSK_ORPHAN_MAX_BYTES;
+  orphans->peer_bytes = HSK_ORPHAN_PEER_BYTES;
+  orphans->inserts = 0;
+  orphans->evictions = 0;
+  orphans->resolutions = 0;
+}
+
+void
+hsk_orphans_uninit(hsk_orphans_t *orphans) {
+  assert(orphans);
+
+  hsk_orphans_clear(orphans);
+
+  hsk_hmap_uninit(&orphans->map);
+  hsk_hmap_uninit(&orphans->prevs);
+  hsk_map_uninit(&orphans->peers);
+}
+
+hsk_orphans_t *
+hsk_orphans_alloc(void) {
+  hsk_orphans_t *orphans = hsk_malloc(sizeof(hsk_orphans_t));
+  if (orphans)
+    hsk_orphans_init(orphans);
+  return orphans;
+}
+
+void
+hsk_orphans_free(hsk_orphans_t *orphans) {
+  if (!orphans)
+    return;
+
+  hsk_orphans_uninit(orphans);
+  hsk_free(orphans);
+}
+
+// Each peer still gets a quarter at most.
+// Takes effect from the next insert.
+bool
+hsk_orphans_set_size(hsk_orphans_t *orphans, size_t max_bytes) {
+  assert(orphans);
+
+  if (max_bytes == 0)
+    return false;
+
+  orphans->max_bytes = max_bytes;
+  orphans->peer_bytes = max_bytes / 4;
+
+  return true;
+}
+
+bool
+hsk_orphans_has(const hsk_orphans_t *orphans, const uint8_t *hash) {
+  return hsk_hmap_has(&orphans->map, hash);
+}
+
+hsk_header_t *
+hsk_orphans_get(const hsk_orphans_t *orphans, const uint8_t *hash) {
+  hsk_orphan_t *orphan = hsk_hmap_get(&orphans->map, hash);
+
+  if (!orphan)
+    return NULL;
+
+  return orphan->hdr;
+}
+
+// Unlink an orphan and hand back its header.
+static hsk_header_t *
+hsk_orphans_remove(hsk_orphans_t *orphans, hsk_orphan_t *orphan) {
+  hsk_header_t *hdr = orphan->hdr;
+  hsk_orphan_peer_t *peer = hsk_map_get(&orphans->peers, &orphan->source);
+
+  assert(peer);
+
+  if (orphan->prev)
+    orphan->prev->next = orphan->next;
+  else
+    orphans->head = orphan->next;
+
+  if (orphan->next)
+    orphan->next->prev = orphan->prev;
+  else
+    orphans->tail = orphan->prev;
+
+  if (orphan->peer_prev)
+    orphan->peer_prev->peer_next = orphan->peer_next;
+  else
+    peer->head = orphan->peer_next;
+
+  if (orphan->peer_next)
+    orphan->peer_next->peer_prev = orphan->peer_prev;
+  else
+    peer->tail = orphan->peer_prev;
+
+  hsk_hmap_del(&orphans->map, hsk_header_cache(hdr));
+
+  // Several orphans can share a parent;
+  // only the latest one is reachable.
+  if (hsk_hmap_get(&orphans->prevs, hdr->prev_block) == orphan)
+    hsk_hmap_del(&orphans->prevs, hdr->prev_block);
+
+  assert(orphans->size > 0);
+  assert(orphans->bytes >= hsk_orphan_bytes());
+  assert(peer->bytes >= hsk_orphan_bytes());
+
+  orphans->size -= 1;
+  orphans->bytes -= hsk_orphan_bytes();
+  peer->bytes -= hsk_orphan_bytes();
+
+  hsk_mem_sub(HSK_MEM_ORPHANS, hsk_orphan_bytes());
+
+  if (!peer->head) {
+    assert(peer->bytes == 0);
+    hsk_map_del(&orphans->peers, &peer->id);
+    hsk_free(peer);
+  }
+
+  hsk_free(orphan);
+
+  return hdr;
+}
+
+static void
+hsk_orphans_evict(hsk_orphans_t *orphans, hsk_orphan_t *orphan) {
+  hsk_free(hsk_orphans_remove(orphans, orphan));
+  orphans->evictions += 1;
+}
+
+int
+hsk_orphans_add(hsk_orphans_t *orphans, hsk_header_t *hdr, uint64_t source) {
+  assert(orphans && hdr);
+
+  const uint8_t *hash = hsk_header_cache(hdr);
+
+  if (hsk_hmap_has(&orphans->map, hash))
+    return HSK_EDUPLICATEORPHAN;
+
+  hsk_orphan_peer_t *peer = hsk_map_get(&orphans->peers, &source);
+
+  // Over quota: the peer pays with its own
+  // oldest orphans first.
+  while (peer && peer->bytes + hsk_orphan_bytes() > orphans->peer_bytes) {
+    bool last = peer->head == peer->tail;
+    hsk_orphans_evict(orphans, peer->head);
+    if (last)
+      peer = NULL;
+  }
+
+  // Over budget: evict the oldest overall.
+  while (orphans->head
+         && orphans->bytes + hsk_orphan_bytes() > orphans->max_bytes) {
+    hsk_orphan_t *oldest = orphans->head;
+
+    if (peer && peer->head == oldest && peer->head == peer->tail)
+      peer = NULL;
+
+    hsk_orphans_evict(orphans, oldest);
+  }
+
+  bool created = false;
+
+  if (!peer) {
+    peer = hsk_malloc(sizeof(hsk_orphan_peer_t));
+
+    if (!peer)
+      return HSK_ENOMEM;
+
+    peer->id = source;
+    peer->bytes = 0;
+    peer->head = NULL;
+    peer->tail = NULL;
+
+    if (!hsk_map_set(&orphans->peers, &peer->id, (void *)peer)) {
+      hsk_free(peer);
+      return HSK_ENOMEM;
+    }
+
+    created = true;
+  }
+
+  hsk_orphan_t *orphan = hsk_malloc(sizeof(hsk_orphan_t));
+
+  if (!orphan)
+    goto fail;
+
+  orphan->hdr = hdr;
+  orphan->source = source;
+  orphan->prev = orphans->tail;
+  orphan->next = NULL;
+  orphan->peer_prev = peer->tail;
+  orphan->peer_next = NULL;
+
+  if (!hsk_hmap_set(&orphans->map, hash, (void *)orphan))
+    goto fail;
+
+  if (!hsk_hmap_set(&orphans->prevs, hdr->prev_block, (void *)orphan)) {
+    hsk_hmap_del(&orphans->map, hash);
+    goto fail;
+  }
+
+  if (orphans->tail)
+    orphans->tail->next = orphan;
+  else
+    orphans->head = orphan;
+
+  orphans->tail = orphan;
+
+  if (peer->tail)
+    peer->tail->peer_next = orphan;
+  else
+    peer->head = orphan;
+
+  peer->tail = orphan;
+
+  orphans->size += 1;
+  orphans->bytes += hsk_orphan_bytes();
+  peer->bytes += hsk_orphan_bytes();
+
+  hsk_mem_add(HSK_MEM_ORPHANS, hsk_orphan_bytes());
+  orphans->inserts += 1;
+
+  return HSK_SUCCESS;
+
+fail:
+  if (orphan)
+    hsk_free(orphan);
+
+  if (created) {
+    hsk_map_del(&orphans->peers, &peer->id);
+    hsk_free(peer);
+  }
+
+  return HSK_ENOMEM;
+}
+
+hsk_header_t *
+hsk_orphans_resolve(hsk_orphans_t *orphans, const uint8_t *prev_hash) {
+  assert(orphans && prev_hash);
+
+  hsk_orphan_t *orphan = hsk_hmap_get(&orphans->prevs, prev_hash);
+
+  if (!orphan)
+    return NULL;
+
+  orphans->resolutions += 1;
+
+  return hsk_orphans_remove(orphans, orphan);
+}
+
+void
+hsk_orphans_clear(hsk_orphans_t *orphans) {
+  assert(orphans);
+
+  while (orphans->head)
+    hsk_free(hsk_orphans_remove(orphans, orphans->head));
+
+  assert(orphans->size == 0);
+  assert(orphans->bytes == 0);
+}
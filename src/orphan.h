@@ -0,0 +1,90 @@
+#ifndef _HSK_ORPHAN_H
+#define _HSK_ORPHAN_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "header.h"
+#include "hmap.h"
+#include "map.h"
+
+/*
+ * Defs
+ */
+
+// Roughly 9000 orphans on mainnet.
+#define HSK_ORPHAN_MAX_BYTES (4 << 20)
+
+// No single peer may hold more than this.
+#define HSK_ORPHAN_PEER_BYTES (HSK_ORPHAN_MAX_BYTES / 4)
+
+/*
+ * Types
+ */
+
+typedef struct hsk_orphan_s {
+  hsk_header_t *hdr;
+  uint64_t source;
+  struct hsk_orphan_s *prev;
+  struct hsk_orphan_s *next;
+  struct hsk_orphan_s *peer_prev;
+  struct hsk_orphan_s *peer_next;
+} hsk_orphan_t;
+
+typedef struct hsk_orphan_peer_s {
+  uint64_t id;
+  size_t bytes;
+  hsk_orphan_t *head;
+  hsk_orphan_t *tail;
+} hsk_orphan_peer_t;
+
+typedef struct hsk_orphans_s {
+  hsk_hmap_t map;
+  hsk_hmap_t prevs;
+  hsk_map_t peers;
+  hsk_orphan_t *head;
+  hsk_orphan_t *tail;
+  size_t size;
+  size_t bytes;
+  size_t max_bytes;
+  size_t peer_bytes;
+  uint64_t inserts;
+  uint64_t evictions;
+  uint64_t resolutions;
+} hsk_orphans_t;
+
+/*
+ * Orphans
+ */
+
+void
+hsk_orphans_init(hsk_orphans_t *orphans);
+
+void
+hsk_orphans_uninit(hsk_orphans_t *orphans);
+
+hsk_orphans_t *
+hsk_orphans_alloc(void);
+
+void
+hsk_orphans_free(hsk_orphans_t *orphans);
+
+bool
+hsk_orphans_set_size(hsk_orphans_t *orphans, size_t max_bytes);
+
+bool
+hsk_orphans_has(const hsk_orphans_t *orphans, const uint8_t *hash);
+
+hsk_header_t *
+hsk_orphans_get(const hsk_orphans_t *orphans, const uint8_t *hash);
+
+int
+hsk_orphans_add(hsk_orphans_t *orphans, hsk_header_t *hdr, uint64_t source);
+
+hsk_header_t *
+hsk_orphans_resolve(hsk_orphans_t *orphans, const uint8_t *prev_hash);
+
+void
+hsk_orphans_clear(hsk_orphans_t *orphans);
+#endif
@@ -0,0 +1,974 @@
+#include "config.h"
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "addr.h"
+#include "bio.h"
+#include "brontide.h"
+#include "constants.h"
+#include "dns.h"
+#include "ec.h"
+#include "error.h"
+#include "fixture.h"
+#include "hash.h"
+#include "header.h"
+#include "mem.h"
+#include "msg.h"
+#include "proof.h"
+#include "utils.h"
+#include "uv.h"
+
+// A peer for hnsd to sync from and resolve
+// against, with nothing behind it: a chain is
+// mined and a name tree built at startup, the
+// same ones on every run given the same names
+// and options. It answers version, ping,
+// getheaders and proof requests, and nothing
+// else. Only regtest and simnet headers can be
+// mined.
+
+#define HSK_FAKE_HEIGHT 20
+#define HSK_FAKE_NAMES 100
+#define HSK_FAKE_TRIES 100000
+#define HSK_FAKE_MAX_HEADERS 2000
+#define HSK_FAKE_AGENT "/hnsd-peer:0.0.0/"
+
+// Hashed for the identity key, unless one is
+// given.
+#define HSK_FAKE_SEED "hnsd-peer"
+
+extern char *optarg;
+extern int optind;
+
+typedef struct hsk_fake_s {
+  uv_loop_t *loop;
+  uv_tcp_t server;
+  hsk_ec_t *ec;
+  uint8_t key[32];
+  uint8_t pubkey[33];
+  uint64_t services;
+  uint64_t nonce;
+  hsk_fixture_tree_t tree;
+  hsk_header_t *headers;
+  uint8_t (*hashes)[32];
+  uint32_t height;
+} hsk_fake_t;
+
+typedef struct hsk_fake_conn_s {
+  hsk_fake_t *fake;
+  uv_tcp_t socket;
+  hsk_brontide_t brontide;
+  hsk_addr_t addr;
+  char host[HSK_MAX_HOST];
+  uint8_t *buf;
+  size_t buf_len;
+  size_t buf_size;
+  bool closing;
+} hsk_fake_conn_t;
+
+typedef struct hsk_fake_write_s {
+  uv_write_t req;
+  uv_buf_t buf;
+} hsk_fake_write_t;
+
+// A name with an address and a TXT record.
+static const uint8_t hsk_fake_resource[] = ""
+  "\x00\x00\x38\x00"
+  "\x01\x7f\x00\x00\x01"
+  "\x0d\x09" "hnsd-peer";
+
+static void
+after_connection(uv_stream_t *server, int status);
+
+static void
+alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf);
+
+static void
+after_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void
+after_write(uv_write_t *req, int status);
+
+static void
+after_close(uv_handle_t *handle);
+
+static void
+after_brontide_connect(const void *arg);
+
+static void
+after_brontide_read(const void *arg, const uint8_t *data, size_t data_len);
+
+static int
+brontide_do_write(
+  const void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  bool is_heap
+);
+
+/*
+ * Fixtures
+ */
+
+// One name per line, optionally followed by
+// its resource in hex.
+static bool
+hsk_fake_read_names(hsk_fake_t *fake, const char *path) {
+  FILE *file = fopen(path, "r");
+
+  if (!file)
+    return false;
+
+  char line[2 * HSK_MAX_DATA_SIZE + HSK_DNS_MAX_LABEL + 4];
+  uint8_t res[HSK_MAX_DATA_SIZE];
+  size_t count = 0;
+  bool ok = true;
+
+  while (fgets(line, sizeof(line), file)) {
+    char *name = line;
+    size_t len = strcspn(name, " \t\r\n");
+
+    if (len == 0)
+      continue;
+
+    char *hex = name + len;
+
+    hex += strspn(hex, " \t");
+    hex[strcspn(hex, " \t\r\n")] = '\0';
+    name[len] = '\0';
+
+    if (name[len - 1] == '.')
+      name[len - 1] = '\0';
+
+    const uint8_t *data = hsk_fake_resource;
+    size_t size = sizeof(hsk_fake_resource) - 1;
+
+    if (*hex) {
+      size_t hex_size = hsk_hex_decode_size(hex);
+
+      if (hex_size == 0
+          || hex_size > sizeof(res)
+          || !hsk_hex_decode(hex, res)) {
+        fprintf(stderr, "bad resource for %s\n", name);
+        ok = false;
+        break;
+      }
+
+      data = res;
+      size = hex_size;
+    }
+
+    if (!hsk_fixture_tree_insert_name(&fake->tree, name, data, size)) {
+      ok = false;
+      break;
+    }
+
+    count += 1;
+  }
+
+  fclose(file);
+
+  return ok && count > 0;
+}
+
+static bool
+hsk_fake_default_names(hsk_fake_t *fake) {
+  const uint8_t *res = (const uint8_t *)hsk_fake_resource;
+  size_t res_len = sizeof(hsk_fake_resource) - 1;
+  char name[64];
+
+  for (int i = 0; i < HSK_FAKE_NAMES; i++) {
+    sprintf(name, "name%d", i);
+
+    if (!hsk_fixture_tree_insert_name(&fake->tree, name, res, res_len))
+      return false;
+  }
+
+  return true;
+}
+
+// Genesis, then `height` headers committing
+// to the tree, a block interval apart.
+static bool
+hsk_fake_mine(hsk_fake_t *fake) {
+  size_t count = (size_t)fake->height + 1;
+
+  fake->headers = hsk_calloc(count, sizeof(hsk_header_t));
+  fake->hashes = hsk_calloc(count, 32);
+
+  if (!fake->headers || !fake->hashes)
+    return false;
+
+  hsk_header_t *genesis = &fake->headers[0];
+
+  hsk_header_init(genesis);
+
+  if (!hsk_header_decode(HSK_GENESIS, sizeof(HSK_GENESIS) - 1, genesis))
+    return false;
+
+  hsk_header_hash(genesis, fake->hashes[0]);
+
+  for (size_t i = 1; i < count; i++) {
+    hsk_header_t *hdr = &fake->headers[i];
+
+    hsk_header_init(hdr);
+    memcpy(hdr->prev_block, fake->hashes[i - 1], 32);
+    memcpy(hdr->name_root, fake->tree.root, 32);
+    hdr->time = genesis->time + i * HSK_TARGET_SPACING;
+    hdr->bits = HSK_BITS;
+
+    if (!hsk_fixture_mine(hdr, HSK_FAKE_TRIES))
+      return false;
+
+    hsk_header_hash(hdr, fake->hashes[i]);
+  }
+
+  return true;
+}
+
+static int64_t
+hsk_fake_find(const hsk_fake_t *fake, const uint8_t *hash) {
+  for (uint32_t i = 0; i <= fake->height; i++) {
+    if (memcmp(fake->hashes[i], hash, 32) == 0)
+      return (int64_t)i;
+  }
+  return -1;
+}
+
+/*
+ * Connections
+ */
+
+static void
+hsk_fake_log(const hsk_fake_conn_t *conn, const char *fmt, ...) {
+  printf("%s: ", conn->host);
+
+  va_list args;
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+
+  fflush(stdout);
+}
+
+static void
+hsk_fake_close(hsk_fake_conn_t *conn) {
+  if (conn->closing)
+    return;
+
+  conn->closing = true;
+
+  hsk_fake_log(conn, "disconnected\n");
+
+  hsk_brontide_destroy(&conn->brontide);
+  uv_close((uv_handle_t *)&conn->socket, after_close);
+}
+
+static int
+hsk_fake_send(hsk_fake_conn_t *conn, const hsk_msg_t *msg) {
+  int msg_size = hsk_msg_size(msg);
+
+  if (msg_size < 0)
+    return HSK_EENCODING;
+
+  size_t size = 9 + (size_t)msg_size;
+  uint8_t *data = hsk_malloc(size);
+
+  if (!data)
+    return HSK_ENOMEM;
+
+  uint8_t *buf = data;
+
+  write_u32(&buf, HSK_MAGIC);
+  write_u8(&buf, msg->cmd);
+  write_u32(&buf, (uint32_t)msg_size);
+  hsk_msg_write(msg, &buf);
+
+  return hsk_brontide_write(&conn->brontide, data, size);
+}
+
+static int
+hsk_fake_handle_version(hsk_fake_conn_t *conn, const hsk_version_msg_t *msg) {
+  hsk_fake_t *fake = conn->fake;
+
+  hsk_fake_log(conn, "version %s (%u)\n", msg->agent, msg->height);
+
+  hsk_version_msg_t version = { .cmd = HSK_MSG_VERSION };
+  hsk_msg_init((hsk_msg_t *)&version);
+
+  version.version = HSK_PROTO_VERSION;
+  version.services = fake->services;
+  version.time = (uint64_t)time(NULL);
+  hsk_addr_copy(&version.remote.addr, &conn->addr);
+  version.nonce = ++fake->nonce;
+  strcpy(version.agent, HSK_FAKE_AGENT);
+  version.height = fake->height;
+
+  int rc = hsk_fake_send(conn, (hsk_msg_t *)&version);
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  hsk_verack_msg_t verack = { .cmd = HSK_MSG_VERACK };
+
+  return hsk_fake_send(conn, (hsk_msg_t *)&verack);
+}
+
+static int
+hsk_fake_handle_ping(hsk_fake_conn_t *conn, const hsk_ping_msg_t *msg) {
+  hsk_pong_msg_t pong = {
+    .cmd = HSK_MSG_PONG,
+    .nonce = msg->nonce
+  };
+  return hsk_fake_send(conn, (hsk_msg_t *)&pong);
+}
+
+// Headers after the first locator hash we
+// have (or genesis), up to `stop`.
+static int
+hsk_fake_handle_getheaders(
+  hsk_fake_conn_t *conn,
+  const hsk_getheaders_msg_t *msg
+) {
+  hsk_fake_t *fake = conn->fake;
+  int64_t start = 0;
+
+  for (size_t i = 0; i < msg->hash_count; i++) {
+    int64_t height = hsk_fake_find(fake, msg->hashes[i]);
+
+    if (height != -1) {
+      start = height;
+      break;
+    }
+  }
+
+  uint32_t first = (uint32_t)start + 1;
+  uint32_t end = first;
+
+  while (end <= fake->height && end - first < HSK_FAKE_MAX_HEADERS) {
+    end += 1;
+
+    if (memcmp(fake->hashes[end - 1], msg->stop, 32) == 0)
+      break;
+  }
+
+  hsk_fake_log(conn, "getheaders (sending %u from %u)\n", end - first, first);
+
+  hsk_headers_msg_t headers = { .cmd = HSK_MSG_HEADERS };
+
+  headers.header_count = end - first;
+  headers.headers = end > first ? &fake->headers[first] : NULL;
+
+  // Written as a list.
+  for (uint32_t i = first; i + 1 < end; i++)
+    fake->headers[i].next = &fake->headers[i + 1];
+
+  int rc = hsk_fake_send(conn, (hsk_msg_t *)&headers);
+
+  for (uint32_t i = first; i < end; i++)
+    fake->headers[i].next = NULL;
+
+  return rc;
+}
+
+// Proofs for `keys`, or NULL if the root is
+// not ours.
+static hsk_proof_msg_t *
+hsk_fake_prove(
+  hsk_fake_conn_t *conn,
+  const uint8_t *root,
+  const uint8_t (*keys)[32],
+  size_t count
+) {
+  hsk_fake_t *fake = conn->fake;
+
+  if (memcmp(root, fake->tree.root, 32) != 0) {
+    hsk_fake_log(conn, "unknown root %s\n", hsk_hex_encode32(root));
+    return NULL;
+  }
+
+  hsk_proof_msg_t *proofs = hsk_calloc(count, sizeof(hsk_proof_msg_t));
+
+  if (!proofs)
+    return NULL;
+
+  for (size_t i = 0; i < count; i++) {
+    hsk_proof_msg_t *p = &proofs[i];
+
+    p->cmd = HSK_MSG_PROOF;
+    memcpy(p->root, root, 32);
+    memcpy(p->key, keys[i], 32);
+    hsk_proof_init(&p->proof);
+
+    if (!hsk_fixture_tree_prove(&fake->tree, p->key, &p->proof)) {
+      for (size_t j = 0; j < i; j++)
+        hsk_proof_uninit(&proofs[j].proof);
+      hsk_free(proofs);
+      return NULL;
+    }
+  }
+
+  return proofs;
+}
+
+static void
+hsk_fake_free_proofs(hsk_proof_msg_t *proofs, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    hsk_proof_uninit(&proofs[i].proof);
+  hsk_free(proofs);
+}
+
+static int
+hsk_fake_handle_getproof(
+  hsk_fake_conn_t *conn,
+  const hsk_getproof_msg_t *msg
+) {
+  hsk_fake_log(conn, "getproof %s\n", hsk_hex_encode32(msg->key));
+
+  const uint8_t (*keys)[32] = (const uint8_t (*)[32])msg->key;
+  hsk_proof_msg_t *proof = hsk_fake_prove(conn, msg->root, keys, 1);
+
+  if (!proof)
+    return HSK_SUCCESS;
+
+  int rc = hsk_fake_send(conn, (hsk_msg_t *)proof);
+
+  hsk_fake_free_proofs(proof, 1);
+
+  return rc;
+}
+
+// Answered with proofs or a multiproof, as
+// asked.
+static int
+hsk_fake_handle_getproofs(
+  hsk_fake_conn_t *conn,
+  const hsk_getproofs_msg_t *msg
+) {
+  hsk_fake_log(conn, "%s (%zu keys)\n", hsk_msg_str(msg->cmd), msg->key_count);
+
+  hsk_proof_msg_t *proofs =
+    hsk_fake_prove(conn, msg->root, msg->keys, msg->key_count);
+
+  if (!proofs)
+    return HSK_SUCCESS;
+
+  int rc;
+
+  if (msg->cmd == HSK_MSG_GETMULTIPROOF) {
+    hsk_multiproof_msg_t reply = { .cmd = HSK_MSG_MULTIPROOF };
+
+    memcpy(reply.root, msg->root, 32);
+    reply.proof_count = msg->key_count;
+    reply.proofs = proofs;
+
+    rc = hsk_fake_send(conn, (hsk_msg_t *)&reply);
+  } else {
+    hsk_proofs_msg_t reply = { .cmd = HSK_MSG_PROOFS };
+
+    reply.proof_count = msg->key_count;
+    reply.proofs = proofs;
+
+    rc = hsk_fake_send(conn, (hsk_msg_t *)&reply);
+  }
+
+  hsk_fake_free_proofs(proofs, msg->key_count);
+
+  return rc;
+}
+
+static int
+hsk_fake_handle_msg(hsk_fake_conn_t *conn, const hsk_msg_t *msg) {
+  switch (msg->cmd) {
+    case HSK_MSG_VERSION:
+      return hsk_fake_handle_version(conn, (hsk_version_msg_t *)msg);
+    case HSK_MSG_PING:
+      return hsk_fake_handle_ping(conn, (hsk_ping_msg_t *)msg);
+    case HSK_MSG_GETHEADERS:
+      return hsk_fake_handle_getheaders(conn, (hsk_getheaders_msg_t *)msg);
+    case HSK_MSG_GETPROOF:
+      return hsk_fake_handle_getproof(conn, (hsk_getproof_msg_t *)msg);
+    case HSK_MSG_GETPROOFS:
+    case HSK_MSG_GETMULTIPROOF:
+      return hsk_fake_handle_getproofs(conn, (hsk_getproofs_msg_t *)msg);
+    default:
+      return HSK_SUCCESS;
+  }
+}
+
+// Whole messages off the front of the buffer.
+static int
+hsk_fake_parse(hsk_fake_conn_t *conn) {
+  size_t pos = 0;
+  int rc = HSK_SUCCESS;
+
+  while (!conn->closing && conn->buf_len - pos >= 9) {
+    uint8_t *data = &conn->buf[pos];
+    uint32_t magic = get_u32(data);
+    uint8_t cmd = data[4];
+    uint32_t size = get_u32(data + 5);
+
+    if (magic != HSK_MAGIC || size > HSK_MAX_MESSAGE) {
+      rc = HSK_EENCODING;
+      break;
+    }
+
+    if (conn->buf_len - pos < 9 + (size_t)size)
+      break;
+
+    pos += 9 + (size_t)size;
+
+    if (strcmp(hsk_msg_str(cmd), "unknown") == 0)
+      continue;
+
+    hsk_msg_t *msg = hsk_msg_alloc(cmd);
+
+    if (!msg) {
+      rc = HSK_ENOMEM;
+      break;
+    }
+
+    hsk_msg_init(msg);
+
+    if (!hsk_msg_decode(data + 9, size, msg)) {
+      hsk_free(msg);
+      rc = HSK_EENCODING;
+      break;
+    }
+
+    rc = hsk_fake_handle_msg(conn, msg);
+
+    hsk_msg_free(msg);
+
+    if (rc != HSK_SUCCESS)
+      break;
+  }
+
+  memmove(conn->buf, &conn->buf[pos], conn->buf_len - pos);
+  conn->buf_len -= pos;
+
+  return rc;
+}
+
+/*
+ * UV behavior
+ */
+
+static void
+after_connection(uv_stream_t *server, int status) {
+  hsk_fake_t *fake = (hsk_fake_t *)server->data;
+
+  if (status < 0) {
+    fprintf(stderr, "connection error: %s\n", uv_strerror(status));
+    return;
+  }
+
+  hsk_fake_conn_t *conn = hsk_calloc(1, sizeof(hsk_fake_conn_t));
+
+  if (!conn)
+    return;
+
+  conn->fake = fake;
+
+  if (uv_tcp_init(fake->loop, &conn->socket) != 0) {
+    hsk_free(conn);
+    return;
+  }
+
+  conn->socket.data = (void *)conn;
+
+  if (uv_accept(server, (uv_stream_t *)&conn->socket) != 0) {
+    conn->closing = true;
+    uv_close((uv_handle_t *)&conn->socket, after_close);
+    return;
+  }
+
+  struct sockaddr_storage ss;
+  int len = sizeof(ss);
+
+  hsk_addr_init(&conn->addr);
+
+  if (uv_tcp_getpeername(&conn->socket, (struct sockaddr *)&ss, &len) == 0)
+    hsk_addr_from_sa(&conn->addr, (struct sockaddr *)&ss);
+
+  hsk_addr_to_string(&conn->addr, conn->host, sizeof(conn->host), HSK_PORT);
+
+  hsk_brontide_init(&conn->brontide, fake->ec);
+  conn->brontide.connect_cb = after_brontide_connect;
+  conn->brontide.connect_arg = (void *)conn;
+  conn->brontide.write_cb = brontide_do_write;
+  conn->brontide.write_arg = (void *)conn;
+  conn->brontide.read_cb = after_brontide_read;
+  conn->brontide.read_arg = (void *)conn;
+
+  hsk_fake_log(conn, "connected\n");
+
+  if (hsk_brontide_accept(&conn->brontide, fake->key) != HSK_SUCCESS
+      || uv_read_start((uv_stream_t *)&conn->socket,
+                       alloc_buffer, after_read) != 0) {
+    hsk_fake_close(conn);
+  }
+}
+
+static void
+alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
+  buf->base = hsk_malloc(size);
+  buf->len = buf->base ? size : 0;
+}
+
+static void
+after_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  hsk_fake_conn_t *conn = (hsk_fake_conn_t *)stream->data;
+
+  if (nread < 0) {
+    hsk_fake_close(conn);
+  } else if (nread > 0 && !conn->closing) {
+    int rc = hsk_brontide_on_read(&conn->brontide,
+                                  (uint8_t *)buf->base, (size_t)nread);
+
+    if (rc != HSK_SUCCESS) {
+      hsk_fake_log(conn, "%s\n", hsk_strerror(rc));
+      hsk_fake_close(conn);
+    }
+  }
+
+  hsk_free(buf->base);
+}
+
+static void
+after_write(uv_write_t *req, int status) {
+  hsk_fake_write_t *wr = (hsk_fake_write_t *)req;
+  hsk_fake_conn_t *conn = (hsk_fake_conn_t *)req->data;
+
+  hsk_free(wr->buf.base);
+  hsk_free(wr);
+
+  if (status != 0)
+    hsk_fake_close(conn);
+}
+
+static void
+after_close(uv_handle_t *handle) {
+  hsk_fake_conn_t *conn = (hsk_fake_conn_t *)handle->data;
+
+  hsk_brontide_uninit(&conn->brontide);
+  hsk_free(conn->buf);
+  hsk_free(conn);
+}
+
+static void
+after_brontide_connect(const void *arg) {
+  hsk_fake_conn_t *conn = (hsk_fake_conn_t *)arg;
+  hsk_fake_log(conn, "handshake complete\n");
+}
+
+static void
+after_brontide_read(const void *arg, const uint8_t *data, size_t data_len) {
+  hsk_fake_conn_t *conn = (hsk_fake_conn_t *)arg;
+
+  if (conn->closing)
+    return;
+
+  if (conn->buf_len + data_len > conn->buf_size) {
+    size_t size = conn->buf_len + data_len;
+    uint8_t *buf = hsk_realloc(conn->buf, size);
+
+    if (!buf) {
+      hsk_fake_close(conn);
+      return;
+    }
+
+    conn->buf = buf;
+    conn->buf_size = size;
+  }
+
+  memcpy(&conn->buf[conn->buf_len], data, data_len);
+  conn->buf_len += data_len;
+
+  int rc = hsk_fake_parse(conn);
+
+  if (rc != HSK_SUCCESS) {
+    hsk_fake_log(conn, "%s\n", hsk_strerror(rc));
+    hsk_fake_close(conn);
+  }
+}
+
+static int
+brontide_do_write(
+  const void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  bool is_heap
+) {
+  hsk_fake_conn_t *conn = (hsk_fake_conn_t *)arg;
+  uint8_t *buf = (uint8_t *)data;
+
+  if (conn->closing) {
+    if (is_heap)
+      hsk_free(buf);
+    return HSK_SUCCESS;
+  }
+
+  if (!is_heap) {
+    buf = hsk_malloc(data_len);
+
+    if (!buf)
+      return HSK_ENOMEM;
+
+    memcpy(buf, data, data_len);
+  }
+
+  hsk_fake_write_t *wr = hsk_malloc(sizeof(hsk_fake_write_t));
+
+  if (!wr) {
+    hsk_free(buf);
+    return HSK_ENOMEM;
+  }
+
+  wr->req.data = (void *)conn;
+  wr->buf = uv_buf_init((char *)buf, (unsigned int)data_len);
+
+  if (uv_write(&wr->req, (uv_stream_t *)&conn->socket,
+               &wr->buf, 1, after_write) != 0) {
+    hsk_free(buf);
+    hsk_free(wr);
+    return HSK_EFAILURE;
+  }
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * Main
+ */
+
+static void
+help(int r) {
+  fprintf(stderr,
+    "\n"
+    "hnsd-peer 0.0.0\n"
+    "  Copyright (c) 2018, Christopher Jeffrey <chjj@handshake.org>\n"
+    "\n"
+    "Usage: hnsd-peer [options]\n"
+    "\n"
+    "  Serves a made-up chain and name tree to hnsd over brontide: mines\n"
+    "  the headers, each committing to the tree, and answers getheaders\n"
+    "  and proof requests from them. The same names and options give the\n"
+    "  same chain on every run. Only regtest and simnet builds can mine.\n"
+    "  Point hnsd at the printed address with --seeds.\n"
+    "\n"
+    "  -x, --host <ip[:port]>\n"
+    "    Address to listen on (default: 127.0.0.1:%d).\n"
+    "\n"
+    "  -n, --names <file>\n"
+    "    Names in the tree, one per line, each optionally followed by\n"
+    "    its resource in hex (default: name0 to name%d, with an A and\n"
+    "    a TXT record).\n"
+    "\n"
+    "  -b, --height <n>\n"
+    "    Headers to mine on top of genesis (default: %d).\n"
+    "\n"
+    "  -k, --key <hex>\n"
+    "    Identity key (default: derived from a fixed seed).\n"
+    "\n"
+    "  --proofs\n"
+    "    Advertise getproofs support.\n"
+    "\n"
+    "  --multiproof\n"
+    "    Advertise getmultiproof support.\n"
+    "\n"
+    "  -h, --help\n"
+    "    This help message.\n"
+    "\n",
+    HSK_PORT,
+    HSK_FAKE_NAMES - 1,
+    HSK_FAKE_HEIGHT
+  );
+
+  exit(r);
+}
+
+static const struct option longopts[] = {
+  { "host", required_argument, NULL, 'x' },
+  { "names", required_argument, NULL, 'n' },
+  { "height", required_argument, NULL, 'b' },
+  { "key", required_argument, NULL, 'k' },
+  { "proofs", no_argument, NULL, 256 },
+  { "multiproof", no_argument, NULL, 257 },
+  { "help", no_argument, NULL, 'h' },
+  { NULL, 0, NULL, 0 }
+};
+
+int
+main(int argc, char **argv) {
+  hsk_fake_t fake;
+  struct sockaddr_storage host_;
+  struct sockaddr *host = (struct sockaddr *)&host_;
+  const char *names = NULL;
+  const char *key = NULL;
+
+  memset(&fake, 0, sizeof(fake));
+
+  fake.height = HSK_FAKE_HEIGHT;
+
+  assert(hsk_sa_from_string(host, "127.0.0.1", HSK_PORT));
+
+  for (;;) {
+    int o = getopt_long(argc, argv, "x:n:b:k:h", longopts, NULL);
+
+    if (o == -1)
+      break;
+
+    switch (o) {
+      case 'x': {
+        if (!hsk_sa_from_string(host, optarg, HSK_PORT))
+          help(1);
+        break;
+      }
+
+      case 'n': {
+        names = optarg;
+        break;
+      }
+
+      case 'b': {
+        long long n = atoll(optarg);
+        if (n < 0 || n > 1000000)
+          help(1);
+        fake.height = (uint32_t)n;
+        break;
+      }
+
+      case 'k': {
+        key = optarg;
+        break;
+      }
+
+      case 256: {
+        fake.services |= HSK_SERVICE_PROOFS;
+        break;
+      }
+
+      case 257: {
+        fake.services |= HSK_SERVICE_MULTIPROOF;
+        break;
+      }
+
+      case 'h': {
+        help(0);
+        break;
+      }
+
+      default: {
+        help(1);
+        break;
+      }
+    }
+  }
+
+  if (optind != argc)
+    help(1);
+
+  int rc = 1;
+
+  hsk_fixture_tree_init(&fake.tree);
+
+  fake.ec = hsk_ec_alloc();
+
+  if (!fake.ec) {
+    fprintf(stderr, "ENOMEM\n");
+    goto done;
+  }
+
+  if (key) {
+    if (hsk_hex_decode_size(key) != 32 || !hsk_hex_decode(key, fake.key)) {
+      fprintf(stderr, "bad key\n");
+      goto done;
+    }
+  } else {
+    hsk_hash_blake2b((uint8_t *)HSK_FAKE_SEED,
+                     sizeof(HSK_FAKE_SEED) - 1, fake.key);
+  }
+
+  if (!hsk_ec_verify_privkey(fake.ec, fake.key)
+      || !hsk_ec_create_pubkey(fake.ec, fake.key, fake.pubkey)) {
+    fprintf(stderr, "bad key\n");
+    goto done;
+  }
+
+  if (names) {
+    if (!hsk_fake_read_names(&fake, names)) {
+      fprintf(stderr, "could not read names: %s\n", names);
+      goto done;
+    }
+  } else if (!hsk_fake_default_names(&fake)) {
+    fprintf(stderr, "ENOMEM\n");
+    goto done;
+  }
+
+  if (!hsk_fixture_tree_commit(&fake.tree)) {
+    fprintf(stderr, "ENOMEM\n");
+    goto done;
+  }
+
+  if (!hsk_fake_mine(&fake)) {
+    fprintf(stderr, "could not mine headers on this network\n");
+    goto done;
+  }
+
+  fake.loop = uv_default_loop();
+
+  if (uv_tcp_init(fake.loop, &fake.server) != 0) {
+    fprintf(stderr, "could not listen\n");
+    goto done;
+  }
+
+  fake.server.data = (void *)&fake;
+
+  if (uv_tcp_bind(&fake.server, host, 0) != 0
+      || uv_listen((uv_stream_t *)&fake.server, 128, after_connection) != 0) {
+    fprintf(stderr, "could not listen\n");
+    uv_close((uv_handle_t *)&fake.server, NULL);
+    uv_run(fake.loop, UV_RUN_DEFAULT);
+    goto done;
+  }
+
+  hsk_addr_t addr;
+  char full[HSK_MAX_HOST];
+
+  hsk_addr_from_sa(&addr, host);
+  memcpy(addr.key, fake.pubkey, 33);
+
+  if (!hsk_addr_to_full(&addr, full, sizeof(full), HSK_PORT)) {
+    fprintf(stderr, "bad address\n");
+    goto done;
+  }
+
+  printf("height %u, %zu names, root %s\n",
+         fake.height, fake.tree.leaf_count, hsk_hex_encode32(fake.tree.root));
+  printf("tip %s\n", hsk_hex_encode32(fake.hashes[fake.height]));
+  printf("listening on %s\n", full);
+  fflush(stdout);
+
+  uv_run(fake.loop, UV_RUN_DEFAULT);
+
+  rc = 0;
+
+done:
+  hsk_fixture_tree_uninit(&fake.tree);
+  hsk_free(fake.headers);
+  hsk_free(fake.hashes);
+
+  if (fake.ec)
+    hsk_ec_free(fake.ec);
+
+  return rc;
+}
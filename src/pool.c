@@ -1,6 +1,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -20,8 +21,11 @@
 #include "error.h"
 #include "hash.h"
 #include "header.h"
+#include "log.h"
 #include "map.h"
+#include "mem.h"
 #include "msg.h"
+#include "prof.h"
 #include "proof.h"
 #include "resource.h"
 #include "timedata.h"
@@ -29,24 +33,132 @@
 #include "utils.h"
 #include "uv.h"
 
-#ifdef HSK_DEBUG_LOG
-#define hsk_pool_debug hsk_pool_log
-#define hsk_peer_debug hsk_peer_log
-#else
-#define hsk_pool_debug(...) do {} while (0)
-#define hsk_peer_debug(...) do {} while (0)
-#endif
+// Chatty lines (pings, proofs, address misses),
+// compiled out with --disable-debug-log.
+#define hsk_pool_debug(pool, ...) do { \
+  if (hsk_log_enabled(HSK_LOG_DEBUG))  \
+    hsk_pool_log((pool), __VA_ARGS__); \
+} while (0)
+
+#define hsk_peer_debug(peer, ...) do { \
+  if (hsk_log_enabled(HSK_LOG_DEBUG))  \
+    hsk_peer_log((peer), __VA_ARGS__); \
+} while (0)
 
 /*
  * Types
  */
 
 typedef struct hsk_write_data_s {
+  uv_write_t req;
   hsk_peer_t *peer;
-  void *data;
-  bool should_free;
+  int count;
+  uv_buf_t bufs[HSK_SEND_BUFS];
 } hsk_write_data_t;
 
+// A headers batch having its proof of work
+// checked on the libuv thread pool. Each job
+// covers a contiguous run of the batch.
+typedef struct hsk_verify_job_s {
+  uv_work_t req;
+  void *batch;
+  hsk_header_t *start;
+  size_t count;
+  size_t checked;
+  uint64_t time;
+  int rc;
+} hsk_verify_job_t;
+
+// A verified proof result, keyed by name hash
+// and root (64 bytes at `key`, like requests).
+typedef struct hsk_proof_entry_s {
+  uint8_t key[64];
+  bool exists;
+  uint8_t *data;
+  size_t data_len;
+  struct hsk_proof_entry_s *prev;
+  struct hsk_proof_entry_s *next;
+} hsk_proof_entry_t;
+
+// Batches are queued per peer and added to
+// the chain in the order they arrived.
+typedef struct hsk_verify_s {
+  hsk_pool_t *pool;
+  hsk_peer_t *peer;
+  hsk_header_t *headers;
+  size_t header_count;
+  bool requested;
+  int pending;
+  int rc;
+  // Next header to add, and whether an orphan
+  // has been seen so far.
+  hsk_header_t *cursor;
+  bool orphan;
+  // Filled in as the message arrives: headers
+  // read so far, the height of the next (-1
+  // once past the checkpoints), the hash of
+  // the last, and headers per job.
+  size_t filled;
+  int64_t height;
+  const uint8_t *last;
+  size_t per;
+  int job_count;
+  hsk_verify_job_t jobs[HSK_VERIFY_JOBS];
+  struct hsk_verify_s *next;
+} hsk_verify_t;
+
+// A proof checked on the libuv thread pool.
+// Jobs are queued per peer and finished in the
+// order their proofs arrived.
+typedef struct hsk_proof_job_s {
+  uv_work_t req;
+  hsk_peer_t *peer;
+  uint8_t root[32];
+  uint8_t key[32];
+  hsk_proof_t proof;
+  hsk_node_cache_t *nodes;
+  uint64_t recv;
+  uint64_t verify;
+  bool pending;
+  int rc;
+  bool exists;
+  // Points into the job's proof.
+  const uint8_t *data;
+  size_t data_len;
+  struct hsk_proof_job_s *next;
+} hsk_proof_job_t;
+
+// A large frame opened on the thread pool,
+// and decoded there too if it holds a single
+// whole message (other than headers, which
+// are read as a stream). Frames behind one
+// queue up with it, already open, so that the
+// peer reads them in order.
+typedef struct hsk_read_job_s {
+  uv_work_t req;
+  hsk_peer_t *peer;
+  hsk_cs_t cs;
+  uint8_t *data;
+  size_t data_len;
+  size_t size;
+  bool pending;
+  bool ok;
+  hsk_msg_t *msg;
+  struct hsk_read_job_s *next;
+} hsk_read_job_t;
+
+// Handshake keys made on the thread pool. The
+// pool lets go of it if it closes first.
+typedef struct hsk_keys_job_s {
+  uv_work_t req;
+  hsk_pool_t *pool;
+  hsk_ec_t *ec;
+  uint8_t keys[HSK_HANDSHAKE_KEYS][32];
+  uint8_t pubs[HSK_HANDSHAKE_KEYS][33];
+  int count;
+  int made;
+} hsk_keys_job_t;
+
 /*
  * Prototypes
  */
@@ -60,9 +172,15 @@ hsk_peer_free(hsk_peer_t *peer);
 static void
 hsk_pool_log(hsk_pool_t *pool, const char *fmt, ...);
 
+static void
+hsk_peer_count_error(hsk_peer_t *peer, int rc);
+
 static int
 hsk_pool_refill(hsk_pool_t *pool);
 
+static int
+hsk_pool_connect(hsk_pool_t *pool, const hsk_addr_t *addr);
+
 static void
 hsk_peer_push(hsk_peer_t *peer);
 
@@ -87,9 +205,57 @@ hsk_peer_parse(hsk_peer_t * peer, const uint8_t *msg, size_t msg_len);
 static int
 hsk_peer_send_ping(hsk_peer_t *peer, uint64_t nonce);
 
+static int
+hsk_peer_flush(hsk_peer_t *peer);
+
+static int
+hsk_pool_queue_reqs(hsk_pool_t *pool, hsk_name_req_t *reqs);
+
+static int
+hsk_peer_add_reqs(hsk_peer_t *peer, hsk_name_req_t *reqs);
+
+static void
+hsk_pool_clear_proofs(hsk_pool_t *pool);
+
+static hsk_name_req_t *
+hsk_name_req_alloc(hsk_pool_t *pool);
+
+static void
+hsk_name_req_free(hsk_pool_t *pool, hsk_name_req_t *req);
+
+static uint32_t
+hsk_req_key_hash(const void *key);
+
+static bool
+hsk_req_key_equal(const void *a, const void *b);
+
 static int
 hsk_peer_send_getheaders(hsk_peer_t *peer, const uint8_t *stop);
 
+static int
+hsk_peer_send_getheaders_after(hsk_peer_t *peer, const uint8_t *last);
+
+static void
+hsk_peer_drain_verify(hsk_peer_t *peer);
+
+static hsk_verify_t *
+hsk_verify_alloc(hsk_pool_t *pool, hsk_peer_t *peer, size_t count);
+
+static void
+hsk_verify_free(hsk_verify_t *batch);
+
+static void
+hsk_peer_drain_proofs(hsk_peer_t *peer);
+
+static void
+hsk_proof_job_free(hsk_proof_job_t *job);
+
+static void
+hsk_peer_drain_reads(hsk_peer_t *peer);
+
+static void
+hsk_read_job_free(hsk_read_job_t *job);
+
 static int
 hsk_peer_send_getproof(
   hsk_peer_t *peer,
@@ -115,15 +281,78 @@ after_close(uv_handle_t *handle);
 static void
 after_timer(uv_timer_t *timer);
 
+static void
+after_jobs(uv_async_t *handle);
+
+static void
+after_replies(uv_async_t *handle);
+
+static void
+after_check(uv_check_t *check);
+
+static void
+after_idle(uv_idle_t *idle);
+
+static void
+after_flush_timer(uv_timer_t *timer);
+
+static void
+after_hedge_timer(uv_timer_t *timer);
+
+static void
+after_refresh_timer(uv_timer_t *timer);
+
+static void
+after_refill_timer(uv_timer_t *timer);
+
+static void
+on_verify(uv_work_t *req);
+
+static void
+after_verify(uv_work_t *req, int status);
+
+static void
+on_proof(uv_work_t *req);
+
+static void
+after_proof(uv_work_t *req, int status);
+
+static void
+on_read_job(uv_work_t *req);
+
+static void
+after_read_job(uv_work_t *req, int status);
+
+static void
+on_keys(uv_work_t *req);
+
+static void
+after_keys(uv_work_t *req, int status);
+
 void
 hsk_chain_get_locator(hsk_chain_t *chain, hsk_getheaders_msg_t *msg);
 
+void
+hsk_chain_get_tip_locator(
+  hsk_chain_t *chain,
+  hsk_getheaders_msg_t *msg,
+  int count
+);
+
 static void
 after_brontide_connect(const void *arg);
 
 static void
 after_brontide_read(const void *arg, const uint8_t *data, size_t data_len);
 
+static int
+after_brontide_offload(
+  const void *arg,
+  const hsk_cs_t *cs,
+  const uint8_t *data,
+  size_t data_len
+);
+
 static int
 brontide_do_write(
   const void *arg,
@@ -141,7 +370,7 @@ hsk_pool_init(hsk_pool_t *pool, const uv_loop_t *loop) {
   if (!pool || !loop)
     return HSK_EBADARGS;
 
-  hsk_ec_t *ec = hsk_ec_alloc();
+  hsk_ec_t *ec = hsk_ec_shared();
 
   if (!ec)
     return HSK_ENOMEM;
@@ -152,22 +381,90 @@ hsk_pool_init(hsk_pool_t *pool, const uv_loop_t *loop) {
   if (!hsk_ec_create_pubkey(ec, pool->key_, pool->pubkey))
     return HSK_EFAILURE;
 
+  hsk_node_cache_t *nodes = hsk_node_cache_alloc();
+
+  if (!nodes)
+    return HSK_ENOMEM;
+
+  if (hsk_top_init(&pool->hot, HSK_HOT_NAMES, 0) != HSK_SUCCESS) {
+    hsk_node_cache_free(nodes);
+    return HSK_ENOMEM;
+  }
+
   pool->loop = (uv_loop_t *)loop;
   pool->ec = ec;
   pool->key = &pool->key_[0];
+  memset(pool->ephemeral, 0, sizeof(pool->ephemeral));
+  memset(pool->ephemeral_pub, 0, sizeof(pool->ephemeral_pub));
+  pool->ephemeral_count = 0;
+  pool->keys_job = NULL;
   hsk_timedata_init(&pool->td);
   hsk_chain_init(&pool->chain, &pool->td);
   hsk_addrman_init(&pool->am, &pool->td);
+  pool->flush_delay = HSK_SEND_DELAY;
+  pool->flush_bytes = HSK_SEND_BYTES;
+  pool->hedge_percentile = HSK_HEDGE_PERCENTILE;
+  pool->proof_workers = true;
+  pool->nodes = nodes;
+  pool->hedge_delay = HSK_HEDGE_MAX;
+  memset(pool->rtts, 0, sizeof(pool->rtts));
+  pool->rtts_size = 0;
+  pool->rtts_pos = 0;
   pool->peer_id = 0;
   hsk_map_init_map(&pool->peers, hsk_addr_hash, hsk_addr_equal, NULL);
   pool->head = NULL;
   pool->tail = NULL;
   pool->size = 0;
   pool->max_size = HSK_POOL_SIZE;
-  pool->pending = NULL;
+  pool->max_race = HSK_POOL_RACE;
+  pool->base_size = HSK_POOL_SIZE;
+  pool->max_grow = 0;
+  pool->idle_ticks = 0;
+  pool->replace = true;
+  pool->replace_time = 0;
+  pool->proof_timeout = HSK_PROOF_TIMEOUT;
+  pool->proof_retries = HSK_PROOF_RETRIES;
+  pool->max_pending = HSK_PENDING_MAX;
+  pool->max_proofs = HSK_PROOF_CACHE_SIZE;
+  pool->mem_ticks = 0;
+  pool->last_af = 0;
+  pool->has_node = false;
+  memset(&pool->node, 0, sizeof(hsk_addr_t));
+  pool->offload_size = 0;
+  memset(pool->pending, 0, sizeof(pool->pending));
+  memset(pool->pending_tail, 0, sizeof(pool->pending_tail));
+  hsk_name_map_init(&pool->pending_names);
   pool->pending_count = 0;
+  hsk_map_init_map(&pool->inflight, hsk_req_key_hash, hsk_req_key_equal, NULL);
+  hsk_map_init_map(&pool->proofs, hsk_req_key_hash, hsk_req_key_equal, NULL);
+  hsk_map_reserve(&pool->proofs, HSK_PROOF_CACHE_SIZE + 1);
+  memset(pool->proofs_root, 0x00, sizeof(pool->proofs_root));
+  pool->proofs_head = NULL;
+  pool->proofs_tail = NULL;
+  pool->proof_hits = 0;
+  pool->proof_misses = 0;
+  memset(pool->memo, 0, sizeof(pool->memo));
+  hsk_slab_init(&pool->reqs, sizeof(hsk_name_req_t), HSK_REQ_SLAB);
+  pool->trace = NULL;
+  pool->async.data = (void *)pool;
+  pool->jobs = NULL;
+  pool->accepting = false;
+  pool->refresh_count = 0;
+  pool->refresh_pos = 0;
+  hsk_watch_init(&pool->watch);
+  pool->watch_pos = 0;
   pool->block_time = 0;
   pool->getheaders_time = 0;
+  pool->pow_count = 0;
+  pool->pow_last = 0;
+  pool->pow_time = 0;
+  pool->addr_time = 0;
+  memset(&pool->stats, 0, sizeof(pool->stats));
+  pool->headers_last = 0;
+  memset(pool->prefix_, 0x00, sizeof(pool->prefix_));
+  pool->prefix = NULL;
+  memset(pool->snapshot_, 0x00, sizeof(pool->snapshot_));
+  pool->snapshot = NULL;
 
   return HSK_SUCCESS;
 }
@@ -177,9 +474,14 @@ hsk_pool_uninit(hsk_pool_t *pool) {
   if (!pool)
     return;
 
-  if (pool->ec) {
-    hsk_ec_free(pool->ec);
-    pool->ec = NULL;
+  pool->ec = NULL;
+
+  memset(pool->ephemeral, 0, sizeof(pool->ephemeral));
+  pool->ephemeral_count = 0;
+
+  if (pool->keys_job) {
+    ((hsk_keys_job_t *)pool->keys_job)->pool = NULL;
+    pool->keys_job = NULL;
   }
 
   hsk_peer_t *peer, *next;
@@ -188,17 +490,61 @@ hsk_pool_uninit(hsk_pool_t *pool) {
     hsk_peer_destroy(peer);
   }
 
-  hsk_name_req_t *req, *n;
-  for (req = pool->pending; req; req = n) {
-    n = req->next;
-    free(req);
+  hsk_name_req_t *head, *req, *n;
+  int p;
+  for (p = 0; p < HSK_PRIORITIES; p++) {
+    while ((head = pool->pending[p])) {
+      pool->pending[p] = head->pending_next;
+      for (req = head; req; req = n) {
+        n = req->next;
+        hsk_name_req_free(pool, req);
+      }
+    }
+
+    pool->pending_tail[p] = NULL;
   }
 
-  pool->pending = NULL;
   pool->pending_count = 0;
 
+  // Clients are closed by now.
+  hsk_pool_job_t *job, *job_next;
+  for (job = pool->jobs; job; job = job_next) {
+    job_next = job->next;
+    hsk_free(job);
+  }
+
+  pool->jobs = NULL;
+
+  hsk_name_map_uninit(&pool->pending_names);
+  hsk_map_uninit(&pool->inflight);
+
+  hsk_pool_clear_proofs(pool);
+  hsk_map_uninit(&pool->proofs);
+
+  hsk_top_uninit(&pool->hot);
+
+  if (pool->watch.dirty) {
+    int rc = hsk_watch_flush(&pool->watch);
+
+    if (rc != HSK_SUCCESS)
+      hsk_pool_log(pool, "could not save watchlist: %s\n", hsk_strerror(rc));
+  }
+
+  hsk_watch_uninit(&pool->watch);
+
+  hsk_slab_uninit(&pool->reqs);
+
+  hsk_node_cache_free(pool->nodes);
+  pool->nodes = NULL;
+
   hsk_map_uninit(&pool->peers);
   hsk_chain_uninit(&pool->chain);
+
+  int rc = hsk_addrman_flush(&pool->am);
+
+  if (rc != HSK_SUCCESS)
+    hsk_pool_log(pool, "could not save peers: %s\n", hsk_strerror(rc));
+
   hsk_addrman_uninit(&pool->am);
   hsk_timedata_uninit(&pool->td);
 }
@@ -230,7 +576,36 @@ hsk_pool_set_size(hsk_pool_t *pool, int max_size) {
   if (max_size <= 0 || max_size > 1000)
     return false;
 
+  pool->base_size = max_size;
   pool->max_size = max_size;
+  pool->idle_ticks = 0;
+
+  return true;
+}
+
+bool
+hsk_pool_set_race(hsk_pool_t *pool, int max_race) {
+  assert(pool);
+
+  if (max_race < 0 || max_race > HSK_POOL_RACE_MAX)
+    return false;
+
+  pool->max_race = max_race;
+
+  return true;
+}
+
+bool
+hsk_pool_set_grow(hsk_pool_t *pool, int max_grow) {
+  assert(pool);
+
+  if (max_grow < 0 || max_grow > 1000)
+    return false;
+
+  pool->max_grow = max_grow;
+
+  if (pool->max_size > pool->base_size + max_grow)
+    pool->max_size = pool->base_size + max_grow;
 
   return true;
 }
@@ -280,1485 +655,5379 @@ hsk_pool_set_seeds(hsk_pool_t *pool, const char *seeds) {
   return true;
 }
 
-hsk_pool_t *
-hsk_pool_alloc(const uv_loop_t *loop) {
-  hsk_pool_t *pool = malloc(sizeof(hsk_pool_t));
-
-  if (!pool)
-    return NULL;
+bool
+hsk_pool_set_node(hsk_pool_t *pool, const char *node) {
+  assert(pool);
 
-  if (hsk_pool_init(pool, loop) != HSK_SUCCESS) {
-    hsk_pool_free(pool);
-    return NULL;
+  if (!node) {
+    pool->has_node = false;
+    return true;
   }
 
-  return pool;
-}
+  hsk_addr_t addr;
 
-void
-hsk_pool_free(hsk_pool_t *pool) {
-  if (!pool)
-    return;
+  if (!hsk_addr_from_string(&addr, node, HSK_PORT))
+    return false;
 
-  hsk_pool_uninit(pool);
-  free(pool);
-}
+  if (!hsk_addr_has_key(&addr))
+    return false;
 
-int
-hsk_pool_open(hsk_pool_t *pool) {
-  if (!pool)
-    return HSK_EBADARGS;
+  if (!hsk_ec_verify_pubkey(pool->ec, addr.key))
+    return false;
 
-  pool->timer.data = (void *)pool;
+  hsk_addr_copy(&pool->node, &addr);
+  pool->has_node = true;
 
-  if (uv_timer_init(pool->loop, &pool->timer) != 0)
-    return HSK_EFAILURE;
+  return true;
+}
 
-  if (uv_timer_start(&pool->timer, after_timer, 3000, 3000) != 0)
-    return HSK_EFAILURE;
+bool
+hsk_pool_set_offload(hsk_pool_t *pool, size_t size) {
+  assert(pool);
 
-  hsk_pool_log(pool, "pool opened (size=%u)\n", pool->max_size);
+  if (size > 0 && size < HSK_OFFLOAD_MIN)
+    return false;
 
-  hsk_pool_refill(pool);
+  pool->offload_size = size;
 
-  return HSK_SUCCESS;
+  return true;
 }
 
-int
-hsk_pool_close(hsk_pool_t *pool) {
-  if (!pool)
-    return HSK_EBADARGS;
+bool
+hsk_pool_set_flush(hsk_pool_t *pool, uint64_t delay, size_t bytes) {
+  assert(pool);
 
-  if (uv_timer_stop(&pool->timer) != 0)
-    return HSK_EFAILURE;
+  if (bytes == 0)
+    return false;
 
-  hsk_pool_uninit(pool);
+  pool->flush_delay = delay;
+  pool->flush_bytes = bytes;
 
-  return HSK_SUCCESS;
+  return true;
 }
 
-int
-hsk_pool_destroy(hsk_pool_t *pool) {
-  if (!pool)
-    return HSK_EBADARGS;
+bool
+hsk_pool_set_hedge(hsk_pool_t *pool, int percentile) {
+  assert(pool);
 
-  hsk_pool_free(pool);
+  // Zero disables hedging.
+  if (percentile < 0 || percentile > 100)
+    return false;
 
-  return HSK_SUCCESS;
+  pool->hedge_percentile = percentile;
+
+  return true;
 }
 
-static void
-hsk_pool_log(hsk_pool_t *pool, const char *fmt, ...) {
-  printf("pool: ");
+bool
+hsk_pool_set_workers(hsk_pool_t *pool, bool enabled) {
+  assert(pool);
 
-  va_list args;
-  va_start(args, fmt);
-  vprintf(fmt, args);
-  va_end(args);
-}
+  // Verify proofs on the libuv thread pool
+  // rather than on the event loop.
+  pool->proof_workers = enabled;
 
-static bool
-hsk_pool_getaddr(hsk_pool_t *pool, hsk_addr_t *addr) {
-  return hsk_addrman_pick_addr(&pool->am, &pool->peers, addr);
+  return true;
 }
 
-static int
-hsk_pool_refill(hsk_pool_t *pool) {
-  while (pool->size < pool->max_size) {
-    hsk_addr_t addr;
+bool
+hsk_pool_set_replace(hsk_pool_t *pool, bool enabled) {
+  assert(pool);
 
-    if (!hsk_pool_getaddr(pool, &addr)) {
-      hsk_pool_debug(pool, "could not find suitable addr\n");
-      break;
-    }
+  // Swap slow peers for faster known ones
+  // (see hsk_pool_replace).
+  pool->replace = enabled;
 
-    if (!hsk_ec_verify_pubkey(pool->ec, addr.key)) {
-      hsk_addrman_remove_addr(&pool->am, &addr);
-      continue;
-    }
+  return true;
+}
 
-    hsk_peer_t *peer = hsk_peer_alloc(pool);
+// Seconds a proof request may take (on each
+// try), and how many more tries it gets.
+bool
+hsk_pool_set_timeout(hsk_pool_t *pool, int64_t timeout, int retries) {
+  assert(pool);
 
-    if (!peer) {
-      hsk_pool_log(pool, "could not allocate peer\n");
-      return HSK_ENOMEM;
-    }
+  if (timeout <= 0 || retries < 0)
+    return false;
 
-    hsk_addrman_mark_attempt(&pool->am, &addr);
+  pool->proof_timeout = timeout;
+  pool->proof_retries = retries;
 
-    int rc = hsk_peer_open(peer, &addr);
+  return true;
+}
 
-    if (rc != HSK_SUCCESS) {
-      hsk_peer_destroy(peer);
-      return rc;
-    }
+// Names waiting for a peer to ask. Lookups
+// past this fail with HSK_EBUSY.
+bool
+hsk_pool_set_pending(hsk_pool_t *pool, int max_pending) {
+  assert(pool);
 
-    hsk_peer_push(peer);
-  }
+  if (max_pending <= 0)
+    return false;
 
-  return HSK_SUCCESS;
-}
+  pool->max_pending = max_pending;
 
-static hsk_peer_t *
-hsk_pool_pick_prover(hsk_pool_t *pool, const uint8_t *name_hash) {
-  hsk_peer_t *first_best = pool->head;
-  hsk_peer_t *second_best = NULL;
-  hsk_peer_t *deterministic = NULL;
-  hsk_peer_t *random = NULL;
+  return true;
+}
 
-  int total = 0;
+bool
+hsk_pool_set_proof_cache(hsk_pool_t *pool, size_t max_proofs) {
+  assert(pool);
 
-  hsk_peer_t *peer;
-  for (peer = pool->head; peer; peer = peer->next) {
-    if (peer->state != HSK_STATE_HANDSHAKE)
-      continue;
+  if (max_proofs == 0)
+    return false;
 
-    if (peer->proofs > first_best->proofs
-        && peer->names.size <= first_best->names.size) {
-      second_best = first_best;
-      first_best = peer;
-    }
+  pool->max_proofs = max_proofs;
 
-    total += 1;
-  }
+  // The cache fills up to this and stays there.
+  hsk_map_reserve(&pool->proofs, (uint32_t)max_proofs + 1);
 
-  if (total == 0)
-    return NULL;
+  return true;
+}
 
-  int i = name_hash[0] % total;
-  int r = hsk_random() % total;
+bool
+hsk_pool_set_prefix(hsk_pool_t *pool, const char *prefix) {
+  assert(pool);
 
-  for (peer = pool->head; peer; peer = peer->next) {
-    if (peer->state != HSK_STATE_HANDSHAKE)
-      continue;
+  if (!prefix) {
+    memset(pool->prefix_, 0x00, sizeof(pool->prefix_));
+    pool->prefix = NULL;
+    return true;
+  }
+
+  size_t size = strlen(prefix);
+
+  if (size > 255)
+    return false;
 
-    if (i == 0)
-      deterministic = peer;
+  memcpy(&pool->prefix_[0], prefix, size + 1);
+  pool->prefix = &pool->prefix_[0];
 
-    if (r == 0)
-      random = peer;
+  return true;
+}
+
+bool
+hsk_pool_set_snapshot(hsk_pool_t *pool, const char *snapshot) {
+  assert(pool);
 
-    i -= 1;
-    r -= 1;
+  if (!snapshot) {
+    memset(pool->snapshot_, 0x00, sizeof(pool->snapshot_));
+    pool->snapshot = NULL;
+    return true;
   }
 
-  if (random && (hsk_random() % 5) == 0)
-    return random;
+  size_t size = strlen(snapshot);
 
-  if (second_best && (hsk_random() % 10) == 0)
-    return second_best;
+  if (size > 255)
+    return false;
 
-  if (first_best && (hsk_random() % 10) == 0)
-    return first_best;
+  memcpy(&pool->snapshot_[0], snapshot, size + 1);
+  pool->snapshot = &pool->snapshot_[0];
 
-  return deterministic;
+  return true;
 }
 
 int
-hsk_pool_resolve(
-  hsk_pool_t *pool,
-  const char *name,
-  hsk_resolve_cb callback,
-  const void *arg
-) {
-  hsk_pool_log(pool, "sending proof request for: %s.\n", name);
+hsk_pool_watch_list(hsk_pool_t *pool, const char *path, int *count) {
+  assert(pool && path && count);
+  return hsk_watch_read_list(&pool->watch, path, count);
+}
 
-  if (!hsk_chain_synced(&pool->chain)) {
-    hsk_pool_log(pool, "cannot send proof request: chain not synced.\n");
-    return HSK_ETIMEOUT;
+hsk_pool_t *
+hsk_pool_alloc(const uv_loop_t *loop) {
+  hsk_pool_t *pool = hsk_malloc(sizeof(hsk_pool_t));
+
+  if (!pool)
+    return NULL;
+
+  if (hsk_pool_init(pool, loop) != HSK_SUCCESS) {
+    hsk_pool_free(pool);
+    return NULL;
   }
 
-  const uint8_t *root = hsk_chain_safe_root(&pool->chain);
-  hsk_name_req_t *req = malloc(sizeof(hsk_name_req_t));
+  return pool;
+}
 
-  if (!req)
-    return HSK_ENOMEM;
+void
+hsk_pool_free(hsk_pool_t *pool) {
+  if (!pool)
+    return;
 
-  strcpy(req->name, name);
+  hsk_pool_uninit(pool);
+  hsk_free(pool);
+}
 
-  hsk_hash_name(name, req->hash);
+int
+hsk_pool_open(hsk_pool_t *pool) {
+  if (!pool)
+    return HSK_EBADARGS;
 
-  memcpy(req->root, root, 32);
+  if (pool->prefix) {
+    int rc = hsk_chain_open(&pool->chain, pool->prefix);
 
-  req->callback = callback;
-  req->arg = (void *)arg;
-  req->time = hsk_now();
-  req->next = NULL;
+    if (rc != HSK_SUCCESS) {
+      hsk_pool_log(pool, "could not open header store: %s\n",
+                   hsk_strerror(rc));
+      return rc;
+    }
 
-  hsk_peer_t *peer = hsk_pool_pick_prover(pool, req->hash);
+    // A bad peers file only costs us the
+    // addresses, so carry on without it.
+    rc = hsk_addrman_open(&pool->am, pool->prefix);
 
-  // Insert into a "pending" list.
-  if (!peer) {
-    hsk_pool_log(pool, "cannot send proof request: no peer.\n");
-    req->next = pool->pending;
-    pool->pending = req;
-    pool->pending_count += 1;
-    return HSK_SUCCESS;
-  }
+    if (rc != HSK_SUCCESS) {
+      hsk_pool_log(pool, "could not load peers: %s\n",
+                   hsk_strerror(rc));
+    }
 
-  hsk_name_req_t *head = hsk_map_get(&peer->names, req->hash);
+    // Likewise for the watchlist's store, which
+    // is only fetched again.
+    if (pool->watch.count > 0) {
+      rc = hsk_watch_open(&pool->watch, pool->prefix);
 
-  if (!hsk_map_set(&peer->names, req->hash, (void *)req)) {
-    free(req);
-    return HSK_ENOMEM;
+      if (rc != HSK_SUCCESS) {
+        hsk_pool_log(pool, "could not load watchlist: %s\n",
+                     hsk_strerror(rc));
+      }
+    }
+
+    pool->addr_time = hsk_now();
   }
 
-  if (head) {
-    hsk_peer_log(peer, "already requesting proof for: %s.\n", name);
-    req->next = head;
-    req->time = head->time;
-    return HSK_SUCCESS;
+  if (pool->snapshot) {
+    int rc = hsk_chain_import(&pool->chain, pool->snapshot);
+
+    if (rc != HSK_SUCCESS) {
+      hsk_pool_log(pool, "could not import snapshot: %s\n",
+                   hsk_strerror(rc));
+      return rc;
+    }
   }
 
-  hsk_peer_log(peer, "sending proof request for: %s.\n", name);
+  pool->timer.data = (void *)pool;
 
-  return hsk_peer_send_getproof(peer, req->hash, root);
-}
+  if (uv_timer_init(pool->loop, &pool->timer) != 0)
+    return HSK_EFAILURE;
 
-static void
-hsk_pool_resend(hsk_pool_t *pool) {
-  if (!hsk_chain_synced(&pool->chain))
-    return;
+  if (uv_timer_start(&pool->timer, after_timer, 3000, 3000) != 0)
+    return HSK_EFAILURE;
 
-  uint8_t *root = pool->chain.tip->name_root;
-  hsk_name_req_t *req = pool->pending;
+  pool->check.data = (void *)pool;
 
-  if (!req)
-    return;
+  if (uv_check_init(pool->loop, &pool->check) != 0)
+    return HSK_EFAILURE;
 
-  hsk_peer_t *peer = hsk_pool_pick_prover(pool, req->hash);
+  if (uv_check_start(&pool->check, after_check) != 0)
+    return HSK_EFAILURE;
 
-  if (!peer)
-    return;
+  pool->idle.data = (void *)pool;
 
-  hsk_name_req_t *next;
+  if (uv_idle_init(pool->loop, &pool->idle) != 0)
+    return HSK_EFAILURE;
 
-  pool->pending = NULL;
-  pool->pending_count = 0;
+  pool->flush_timer.data = (void *)pool;
 
-  int64_t now = hsk_now();
+  if (uv_timer_init(pool->loop, &pool->flush_timer) != 0)
+    return HSK_EFAILURE;
 
-  for (; req; req = next) {
-    next = req->next;
+  pool->hedge_timer.data = (void *)pool;
 
-    hsk_peer_t *peer = hsk_pool_pick_prover(pool, req->hash);
-    assert(peer);
+  if (uv_timer_init(pool->loop, &pool->hedge_timer) != 0)
+    return HSK_EFAILURE;
 
-    req->next = NULL;
-    req->time = now;
+  pool->refresh_timer.data = (void *)pool;
 
-    hsk_name_req_t *head = hsk_map_get(&peer->names, req->hash);
+  if (uv_timer_init(pool->loop, &pool->refresh_timer) != 0)
+    return HSK_EFAILURE;
 
-    if (!hsk_map_set(&peer->names, req->hash, (void *)req)) {
-      free(req);
-      continue;
-    }
+  pool->refill_timer.data = (void *)pool;
 
-    if (head) {
-      req->next = head;
-      continue;
-    }
+  if (uv_timer_init(pool->loop, &pool->refill_timer) != 0)
+    return HSK_EFAILURE;
 
-    hsk_peer_send_getproof(peer, req->hash, root);
-  }
+  pool->async.data = (void *)pool;
+
+  if (uv_async_init(pool->loop, &pool->async, after_jobs) != 0)
+    return HSK_EFAILURE;
+
+  __atomic_store_n(&pool->accepting, true, __ATOMIC_RELEASE);
+
+  hsk_pool_log(pool, "pool opened (size=%u)\n", pool->max_size);
+
+  hsk_pool_refill(pool);
+
+  return HSK_SUCCESS;
 }
 
-static void
-hsk_pool_send_getheaders(hsk_pool_t *pool) {
-  hsk_peer_t *peer;
+int
+hsk_pool_close(hsk_pool_t *pool) {
+  if (!pool)
+    return HSK_EBADARGS;
 
-  for (peer = pool->head; peer; peer = peer->next) {
-    if (peer->state != HSK_STATE_HANDSHAKE)
-      continue;
+  if (uv_timer_stop(&pool->timer) != 0)
+    return HSK_EFAILURE;
 
-    hsk_peer_send_getheaders(peer, NULL);
+  if (uv_check_stop(&pool->check) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_idle_stop(&pool->idle) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_timer_stop(&pool->flush_timer) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_timer_stop(&pool->hedge_timer) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_timer_stop(&pool->refresh_timer) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_timer_stop(&pool->refill_timer) != 0)
+    return HSK_EFAILURE;
+
+  if (pool->accepting) {
+    __atomic_store_n(&pool->accepting, false, __ATOMIC_RELEASE);
+    uv_close((uv_handle_t *)&pool->async, NULL);
   }
 
-  pool->getheaders_time = hsk_now();
+  hsk_pool_uninit(pool);
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_pool_destroy(hsk_pool_t *pool) {
+  if (!pool)
+    return HSK_EBADARGS;
+
+  hsk_pool_free(pool);
+
+  return HSK_SUCCESS;
 }
 
 static void
-hsk_pool_merge_reqs(hsk_pool_t *pool, hsk_map_t *map) {
-  hsk_map_iter_t i;
+hsk_pool_log(hsk_pool_t *pool, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("pool: ", fmt, args);
+  va_end(args);
+}
 
-  for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
-    if (!hsk_map_exists(map, i))
-      continue;
+// Alternate between IPv4 and IPv6 candidates
+// when both are known, so one broken family
+// cannot stall every attempt.
+static bool
+hsk_pool_getaddr(hsk_pool_t *pool, hsk_addr_t *addr) {
+  int i;
 
-    hsk_name_req_t *req = (hsk_name_req_t *)hsk_map_value(map, i);
-    assert(req);
+  for (i = 0; i < 4; i++) {
+    if (!hsk_addrman_pick_addr(&pool->am, &pool->peers, addr))
+      return false;
 
-    hsk_name_req_t *tail;
-    int count = 0;
+    int af = hsk_addr_get_af(addr);
 
-    for (tail = req; tail; tail = tail->next) {
-      count += 1;
-      if (!tail->next)
-        break;
+    if (af != pool->last_af || i == 3) {
+      pool->last_af = af;
+      break;
     }
+  }
 
-    if (tail) {
-      tail->next = pool->pending;
-      pool->pending = req;
-      pool->pending_count += count;
-    }
+  return true;
+}
+
+static int
+hsk_pool_ready(const hsk_pool_t *pool) {
+  hsk_peer_t *peer;
+  int ready = 0;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state == HSK_STATE_HANDSHAKE)
+      ready += 1;
   }
 
-  hsk_map_reset(map);
+  return ready;
+}
 
-  if (pool->pending_count > 100) {
-    hsk_name_req_t *req, *next;
+static bool
+hsk_pool_is_node(const hsk_pool_t *pool, const hsk_peer_t *peer) {
+  return pool->has_node && hsk_addr_equal(&peer->addr, &pool->node);
+}
 
-    for (req = pool->pending; req; req = next) {
-      next = req->next;
+// Our full node, if handshaked.
+static hsk_peer_t *
+hsk_pool_node_peer(hsk_pool_t *pool) {
+  if (!pool->has_node)
+    return NULL;
 
-      req->callback(
-        req->name,
-        HSK_ETIMEOUT,
-        false,
-        NULL,
-        0,
-        req->arg
-      );
+  hsk_peer_t *peer = hsk_map_get(&pool->peers, &pool->node);
 
-      free(req);
-    }
+  if (!peer || peer->state != HSK_STATE_HANDSHAKE)
+    return NULL;
 
-    pool->pending_count = 0;
-  }
+  return peer;
 }
 
-static void
-hsk_peer_timeout_reqs(hsk_peer_t *peer) {
-  hsk_map_t *map = &peer->names;
-  hsk_map_iter_t i;
+/*
+ * Stats
+ */
 
-  for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
-    if (!hsk_map_exists(map, i))
-      continue;
+static int
+hsk_stats_bucket(uint64_t ms) {
+  int i;
 
-    hsk_name_req_t *req = (hsk_name_req_t *)hsk_map_value(map, i);
-    hsk_name_req_t *next;
+  for (i = 0; i < HSK_STATS_BUCKETS - 1; i++) {
+    if (ms <= ((uint64_t)HSK_STATS_BASE << i))
+      break;
+  }
 
-    assert(req);
+  return i;
+}
 
-    hsk_map_delete(map, i);
+static void
+hsk_peer_count_error(hsk_peer_t *peer, int rc) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
 
-    for (; req; req = next) {
-      next = req->next;
+  if (rc <= HSK_SUCCESS || rc >= HSK_MAXERROR)
+    rc = HSK_EUNKNOWNERROR;
 
-      req->callback(
-        req->name,
-        HSK_ETIMEOUT,
-        false,
-        NULL,
-        0,
-        req->arg
-      );
+  peer->stats.errors += 1;
+  pool->stats.errors[rc] += 1;
+}
 
-      free(req);
-    }
+void
+hsk_pool_get_stats(const hsk_pool_t *pool, hsk_pool_stats_t *stats) {
+  assert(pool && stats);
+
+  memcpy(stats, &pool->stats, sizeof(hsk_pool_stats_t));
+
+  stats->peers = pool->size;
+  stats->ready = hsk_pool_ready(pool);
+  stats->pending = pool->pending_count;
+  stats->inflight = (int)pool->inflight.size;
+  stats->watch_hits = pool->watch.hits;
+  stats->watched = pool->watch.count;
+  stats->height = pool->chain.height;
+}
+
+// Fills in up to `max` peers and returns how
+// many were written.
+int
+hsk_pool_get_peers(const hsk_pool_t *pool, hsk_peer_info_t *peers, int max) {
+  assert(pool && (peers || max == 0));
+
+  hsk_peer_t *peer;
+  int count = 0;
+
+  for (peer = pool->head; peer && count < max; peer = peer->next) {
+    hsk_peer_info_t *info = &peers[count++];
+
+    info->id = peer->id;
+    memcpy(info->host, peer->host, sizeof(info->host));
+    info->state = peer->state;
+    info->height = peer->height;
+    info->conn_time = peer->conn_time;
+    info->min_ping = peer->min_ping;
+    info->handshake_rtt = peer->handshake_rtt;
+    info->proof_rtt = peer->proof_rtt;
+    info->proofs = peer->proofs;
+    info->proof_fails = peer->proof_fails;
+    info->requests = (int)peer->names.size;
+    memcpy(&info->stats, &peer->stats, sizeof(hsk_peer_stats_t));
   }
 
-  hsk_map_reset(map);
+  return count;
 }
 
-static bool
-hsk_peer_is_overdue(hsk_peer_t *peer) {
-  int64_t now = hsk_now();
+// The TLDs most looked up for clients (the
+// cache's misses), most first. Any thread.
+int
+hsk_pool_get_hot(hsk_pool_t *pool, hsk_top_item_t *items, int max) {
+  assert(pool && (items || max == 0));
+  return hsk_top_list(&pool->hot, items, max);
+}
+
+void
+hsk_pool_log_stats(hsk_pool_t *pool) {
+  assert(pool);
 
-  hsk_map_t *map = &peer->names;
-  hsk_map_iter_t i;
+  hsk_pool_stats_t stats;
+  hsk_pool_get_stats(pool, &stats);
 
-  for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
-    if (!hsk_map_exists(map, i))
+  hsk_pool_log(pool,
+    "stats: %d peers (%d ready), %d pending, %d inflight, height %ld\n",
+    stats.peers, stats.ready, stats.pending, stats.inflight,
+    (long)stats.height);
+
+  hsk_pool_log(pool,
+    "stats: %lu connects, %lu handshakes, %lu disconnects\n",
+    stats.connects, stats.handshakes, stats.disconnects);
+
+  hsk_pool_log(pool,
+    "stats: %lu bytes in, %lu bytes out, %lu msgs in, %lu msgs out\n",
+    stats.bytes_in, stats.bytes_out, stats.msgs_in, stats.msgs_out);
+
+  hsk_pool_log(pool,
+    "stats: %lu headers (%lu/s), %lu proofs, %lu timeouts\n",
+    stats.headers, stats.headers_rate, stats.proofs, stats.timeouts);
+
+  int i;
+
+  for (i = 0; i < HSK_STATS_BUCKETS; i++) {
+    if (stats.latency[i] == 0)
       continue;
 
-    hsk_name_req_t *req = (hsk_name_req_t *)hsk_map_value(map, i);
-    assert(req);
+    if (i == HSK_STATS_BUCKETS - 1) {
+      hsk_pool_log(pool, "stats: proofs over %lums: %lu\n",
+                   (uint64_t)HSK_STATS_BASE << (i - 1), stats.latency[i]);
+    } else {
+      hsk_pool_log(pool, "stats: proofs within %lums: %lu\n",
+                   (uint64_t)HSK_STATS_BASE << i, stats.latency[i]);
+    }
+  }
+
+  for (i = 0; i < HSK_MAXERROR; i++) {
+    if (stats.errors[i] == 0)
+      continue;
 
-    if (now > req->time + 5)
-      return true;
+    hsk_pool_log(pool, "stats: error %s: %lu\n",
+                 hsk_strerror(i), stats.errors[i]);
   }
 
-  return false;
+  hsk_peer_t *peer;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    hsk_pool_log(pool,
+      "stats: peer %lu (%s): state %d, height %ld, ping %ldms, "
+      "handshake %ums, proof rtt %lums, %d proofs, %d fails, "
+      "%u requests, %lu/%lu bytes in/out, %lu errors\n",
+      peer->id, peer->host, peer->state, (long)peer->height,
+      (long)peer->min_ping, peer->handshake_rtt, peer->proof_rtt,
+      peer->proofs,
+      peer->proof_fails, peer->names.size, peer->stats.bytes_in,
+      peer->stats.bytes_out, peer->stats.errors);
+  }
 }
 
+// How the lookup whose callback is running was
+// answered. NULL outside of resolve callbacks.
+const hsk_name_trace_t *
+hsk_pool_get_trace(const hsk_pool_t *pool) {
+  assert(pool);
+  return pool->trace;
+}
+
+// Once enough peers have handshaked, drop the
+// attempts that lost the race.
 static void
-hsk_pool_timer(hsk_pool_t *pool) {
+hsk_pool_trim(hsk_pool_t *pool) {
+  if (hsk_pool_ready(pool) < pool->max_size)
+    return;
+
   hsk_peer_t *peer, *next;
-  int64_t now = hsk_now();
 
   for (peer = pool->head; peer; peer = next) {
     next = peer->next;
 
-    if (peer->state != HSK_STATE_HANDSHAKE)
+    if (hsk_pool_is_node(pool, peer))
       continue;
 
-    if (now > peer->conn_time + 60) {
-      if (peer->last_send == 0 || peer->last_recv == 0) {
-        hsk_peer_log(peer, "peer is stalling (no message)\n");
+    switch (peer->state) {
+      case HSK_STATE_CONNECTING:
+      case HSK_STATE_CONNECTED:
+      case HSK_STATE_READING:
+        hsk_peer_log(peer, "closing slower connection attempt\n");
         hsk_peer_destroy(peer);
-        continue;
-      }
-
-      if (now > peer->last_send + 20 * 60) {
-        hsk_peer_log(peer, "peer is stalling (no send)\n");
-        hsk_peer_destroy(peer);
-        continue;
-      }
+        break;
+    }
+  }
+}
 
-      if (now > peer->last_recv + 20 * 60) {
-        hsk_peer_log(peer, "peer is stalling (no recv)\n");
-        hsk_peer_destroy(peer);
-        continue;
-      }
+// Refill soon after losing a peer rather than
+// on the next pool timer tick.
+static void
+hsk_pool_schedule_refill(hsk_pool_t *pool) {
+  uv_timer_t *timer = &pool->refill_timer;
 
-      if (peer->challenge && now > peer->last_ping + 20 * 60) {
-        hsk_peer_log(peer, "peer is stalling (ping)\n");
-        hsk_peer_destroy(peer);
-        continue;
-      }
-    }
+  if (!uv_is_active((uv_handle_t *)&pool->timer))
+    return;
 
-    if (now > peer->ping_timer + 30) {
-      peer->ping_timer = now;
-      if (peer->challenge) {
-        hsk_peer_log(peer, "peer has not responded to ping\n");
-      } else {
-        hsk_peer_debug(peer, "pinging...\n");
-        peer->challenge = hsk_nonce();
-        peer->last_ping = now;
-        hsk_peer_send_ping(peer, peer->challenge);
-      }
-    }
+  if (!uv_is_active((uv_handle_t *)timer))
+    uv_timer_start(timer, after_refill_timer, HSK_REFILL_DELAY, 0);
+}
 
-    if (!hsk_chain_synced(&pool->chain)) {
-      if (peer->getheaders_time && now > peer->getheaders_time + 30) {
-        hsk_peer_log(peer, "peer is stalling (headers)\n");
-        hsk_peer_destroy(peer);
-        continue;
-      }
-    }
+static int
+hsk_pool_refill(hsk_pool_t *pool) {
+  // Our full node first, whatever the size.
+  if (pool->has_node && !hsk_map_has(&pool->peers, &pool->node)) {
+    int rc = hsk_pool_connect(pool, &pool->node);
 
-    if (peer->version_time && now > peer->version_time + 10) {
-      hsk_peer_log(peer, "peer is stalling (verack)\n");
-      hsk_peer_destroy(peer);
-      continue;
+    if (rc != HSK_SUCCESS)
+      hsk_pool_log(pool, "could not connect to full node: %s\n",
+                   hsk_strerror(rc));
+  }
+
+  int ready = hsk_pool_ready(pool);
+
+  // Over the memory budget, make do with the
+  // peers we have.
+  if (ready > 0 && hsk_mem_over() > 0)
+    return HSK_SUCCESS;
+
+  // While short of handshaked peers, keep a few
+  // more attempts in flight than we need.
+  while (ready < pool->max_size
+         && pool->size < pool->max_size + pool->max_race) {
+    hsk_addr_t addr;
+
+    if (!hsk_pool_getaddr(pool, &addr)) {
+      hsk_pool_debug(pool, "could not find suitable addr\n");
+      break;
     }
 
-    if (hsk_peer_is_overdue(peer)) {
-      hsk_peer_log(peer, "peer is stalling (overdue)\n");
-      hsk_peer_destroy(peer);
+    int rc = hsk_pool_connect(pool, &addr);
+
+    if (rc == HSK_EBADARGS)
       continue;
-    }
-  }
 
-  if (pool->block_time && now > pool->block_time + 10 * 60) {
-    if (!pool->getheaders_time || now > pool->getheaders_time + 5 * 60) {
-      hsk_pool_log(pool, "resending getheaders to pool\n");
-      hsk_pool_send_getheaders(pool);
-    }
+    if (rc != HSK_SUCCESS)
+      return rc;
   }
 
-  hsk_pool_refill(pool);
+  return HSK_SUCCESS;
 }
 
-/*
- * Peer
- */
-
 static int
-hsk_peer_init(hsk_peer_t *peer, hsk_pool_t *pool) {
-  if (!peer || !pool)
+hsk_pool_connect(hsk_pool_t *pool, const hsk_addr_t *addr) {
+  if (!hsk_ec_verify_pubkey(pool->ec, addr->key)) {
+    hsk_addrman_remove_addr(&pool->am, addr);
     return HSK_EBADARGS;
+  }
 
-  assert(pool && pool->loop);
+  hsk_peer_t *peer = hsk_peer_alloc(pool);
 
-  peer->pool = (void *)pool;
-  peer->chain = &pool->chain;
-  peer->loop = pool->loop;
-  // peer->socket;
+  if (!peer) {
+    hsk_pool_log(pool, "could not allocate peer\n");
+    return HSK_ENOMEM;
+  }
 
-  hsk_brontide_init(&peer->brontide, pool->ec);
-  peer->brontide.connect_cb = after_brontide_connect;
-  peer->brontide.connect_arg = (void *)peer;
-  peer->brontide.write_cb = brontide_do_write;
-  peer->brontide.write_arg = (void *)peer;
-  peer->brontide.read_cb = after_brontide_read;
-  peer->brontide.read_arg = (void *)peer;
+  hsk_addrman_mark_attempt(&pool->am, addr);
 
-  peer->id = pool->peer_id++;
-  memset(peer->host, 0, sizeof(peer->host));
-  hsk_addr_init(&peer->addr);
-  peer->state = HSK_STATE_DISCONNECTED;
-  memset(peer->read_buffer, 0, HSK_BUFFER_SIZE);
-  peer->headers = 0;
-  peer->proofs = 0;
-  peer->height = 0;
-  hsk_map_init_hash_map(&peer->names, free);
-  peer->getheaders_time = 0;
-  peer->version_time = 0;
-  peer->last_ping = 0;
-  peer->last_pong = 0;
-  peer->min_ping = 0;
-  peer->ping_timer = 0;
-  peer->challenge = 0;
-  peer->conn_time = 0;
-  peer->last_send = 0;
-  peer->last_recv = 0;
-  peer->msg_hdr = false;
-  peer->msg = (uint8_t *)malloc(9);
-  peer->msg_pos = 0;
-  peer->msg_len = 9;
-  peer->msg_cmd = 0;
-  peer->next = NULL;
+  int rc = hsk_peer_open(peer, addr);
 
-  if (!peer->msg)
-    goto fail;
+  if (rc != HSK_SUCCESS) {
+    hsk_peer_destroy(peer);
+    return rc;
+  }
+
+  hsk_peer_push(peer);
 
   return HSK_SUCCESS;
+}
 
-fail:
-  if (peer->msg) {
-    free(peer->msg);
-    peer->msg = NULL;
-  }
+// Expected time to get a proof back from this
+// peer: its average proof latency, times the
+// requests already waiting on it, inflated by
+// the rate at which it has sent us bad proofs.
+static uint64_t
+hsk_peer_score(const hsk_peer_t *peer) {
+  uint64_t rtt = peer->proof_rtt;
 
-  return HSK_ENOMEM;
+  if (rtt == 0)
+    rtt = peer->min_ping > 0 ? (uint64_t)peer->min_ping : HSK_PROOF_RTT;
+
+  uint64_t score = rtt * (uint64_t)(peer->names.size + 1);
+  uint64_t total = (uint64_t)(peer->proofs + peer->proof_fails + 1);
+
+  score += score * 4 * (uint64_t)peer->proof_fails / total;
+
+  return score;
 }
 
-static void
-hsk_peer_uninit(hsk_peer_t *peer) {
-  if (!peer)
-    return;
+// In-flight proofs are keyed by name hash and
+// root. These sit next to each other in the
+// request, so the key is 64 bytes at `hash`.
+_Static_assert(
+  offsetof(hsk_name_req_t, root) == offsetof(hsk_name_req_t, hash) + 32,
+  "hsk_name_req_t root must directly follow hash"
+);
 
-  hsk_brontide_uninit(&peer->brontide);
+static uint32_t
+hsk_req_key_hash(const void *key) {
+  return hsk_map_murmur3((const uint8_t *)key, 64, 0xfba4c795);
+}
+
+static bool
+hsk_req_key_equal(const void *a, const void *b) {
+  return memcmp(a, b, 64) == 0;
+}
 
-  hsk_map_uninit(&peer->names);
+static void
+hsk_pool_track_req(hsk_pool_t *pool, hsk_peer_t *peer, hsk_name_req_t *head) {
+  // The key points into the head request.
+  hsk_map_del(&pool->inflight, head->hash);
 
-  if (peer->msg) {
-    free(peer->msg);
-    peer->msg = NULL;
-  }
+  if (!hsk_map_set(&pool->inflight, head->hash, (void *)peer))
+    hsk_pool_log(pool, "could not track proof request\n");
+}
+
+static void
+hsk_pool_untrack_req(
+  hsk_pool_t *pool,
+  const hsk_peer_t *peer,
+  const hsk_name_req_t *head
+) {
+  if (hsk_map_get(&pool->inflight, head->hash) == peer)
+    hsk_map_del(&pool->inflight, head->hash);
 }
 
 static hsk_peer_t *
-hsk_peer_alloc(hsk_pool_t *pool) {
-  hsk_peer_t *peer = malloc(sizeof(hsk_peer_t));
+hsk_pool_pick_prover(
+  hsk_pool_t *pool,
+  const uint8_t *name_hash,
+  const uint8_t *root
+) {
+  uint8_t key[64];
 
-  if (!peer)
-    return NULL;
+  memcpy(&key[0], name_hash, 32);
+  memcpy(&key[32], root, 32);
 
-  if (hsk_peer_init(peer, pool) != HSK_SUCCESS) {
-    hsk_peer_free(peer);
-    return NULL;
-  }
+  // Share a proof already in flight.
+  hsk_peer_t *peer = hsk_map_get(&pool->inflight, key);
 
-  return peer;
-}
+  if (peer && peer->state == HSK_STATE_HANDSHAKE)
+    return peer;
 
-static void
-hsk_peer_free(hsk_peer_t *peer) {
-  if (!peer)
-    return;
+  // Our full node is the closest there is, for
+  // as long as its proofs arrive in time.
+  peer = hsk_pool_node_peer(pool);
 
-  hsk_peer_uninit(peer);
-  free(peer);
-}
+  if (peer && peer->proof_strikes == 0)
+    return peer;
 
-static int
-hsk_peer_open(hsk_peer_t *peer, const hsk_addr_t *addr) {
-  assert(peer && addr);
-  assert(peer->pool && peer->loop && peer->state == HSK_STATE_DISCONNECTED);
+  int total = 0;
+  int busy = 0;
 
-  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
-  uv_loop_t *loop = pool->loop;
+  // Prefer peers not already asked for this
+  // name (under a different root).
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
 
-  if (uv_tcp_init(loop, &peer->socket) != 0)
-    return HSK_EFAILURE;
+    if (hsk_name_map_has(&peer->names, name_hash))
+      busy += 1;
 
-  peer->socket.data = (void *)peer;
+    total += 1;
+  }
 
-  hsk_addr_copy(&peer->addr, addr);
+  if (total == 0)
+    return NULL;
 
-  if (!hsk_addr_to_string(addr, peer->host, HSK_MAX_HOST, HSK_PORT))
-    return HSK_EBADARGS;
+  bool any = busy == total;
 
-  uv_connect_t *conn = malloc(sizeof(uv_connect_t));
+  if (!any)
+    total -= busy;
 
-  if (!conn)
-    return HSK_ENOMEM;
+  // Power of two choices: compare two random
+  // peers and take the one with the lower score.
+  int a = hsk_random() % total;
+  int b = a;
 
-  struct sockaddr_storage ss;
-  struct sockaddr *sa = (struct sockaddr *)&ss;
+  if (total > 1) {
+    b = hsk_random() % (total - 1);
+    if (b >= a)
+      b += 1;
+  }
 
-  assert(hsk_addr_to_sa(addr, sa));
+  hsk_peer_t *first = NULL;
+  hsk_peer_t *second = NULL;
+  int i = 0;
 
-  assert(hsk_brontide_connect(&peer->brontide, pool->key, addr->key) == 0);
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
 
-  if (uv_tcp_connect(conn, &peer->socket, sa, on_connect) != 0) {
-    free(conn);
-    return HSK_EFAILURE;
+    if (!any && hsk_name_map_has(&peer->names, name_hash))
+      continue;
+
+    if (i == a)
+      first = peer;
+
+    if (i == b)
+      second = peer;
+
+    i += 1;
   }
 
-  peer->state = HSK_STATE_CONNECTING;
+  assert(first && second);
 
-  return HSK_SUCCESS;
+  if (hsk_peer_score(second) < hsk_peer_score(first))
+    return second;
+
+  return first;
 }
 
-static int
-hsk_peer_close(hsk_peer_t *peer) {
-  switch (peer->state) {
-    case HSK_STATE_DISCONNECTING:
-      return HSK_SUCCESS;
-    case HSK_STATE_HANDSHAKE:
-      hsk_brontide_destroy(&peer->brontide);
-    case HSK_STATE_READING:
-      assert(uv_read_stop((uv_stream_t *)&peer->socket) == 0);
-    case HSK_STATE_CONNECTED:
-    case HSK_STATE_CONNECTING:
-      uv_close((uv_handle_t *)&peer->socket, after_close);
-      hsk_peer_log(peer, "closing peer\n");
-      break;
-    case HSK_STATE_DISCONNECTED:
-      hsk_peer_log(peer, "closed peer (never opened)\n");
-      hsk_peer_remove(peer);
-      hsk_peer_free(peer);
-      return HSK_SUCCESS;
-    default:
-      assert(false);
-      break;
-  }
+// Whether a peer may take a request chain now.
+// Background work joins proofs already in
+// flight for free, but otherwise only uses
+// spare capacity.
+static bool
+hsk_pool_can_send(hsk_pool_t *pool, hsk_peer_t *peer, hsk_name_req_t *reqs) {
+  if (!peer)
+    return false;
 
-  peer->state = HSK_STATE_DISCONNECTING;
-  // hsk_pool_merge_reqs(peer->pool, &peer->names);
-  hsk_peer_timeout_reqs(peer);
-  hsk_peer_remove(peer);
+  if (reqs->priority == HSK_PRIORITY_CLIENT)
+    return true;
 
-  return HSK_SUCCESS;
+  if (hsk_name_map_has(&peer->names, reqs->hash))
+    return true;
+
+  if (pool->pending[HSK_PRIORITY_CLIENT])
+    return false;
+
+  return peer->names.size < HSK_BACKGROUND_SLOTS;
 }
 
 static int
-hsk_peer_destroy(hsk_peer_t *peer) {
-  return hsk_peer_close(peer);
-}
+qsort_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *((uint64_t *)a);
+  uint64_t y = *((uint64_t *)b);
 
-static void
-hsk_peer_log(hsk_peer_t *peer, const char *fmt, ...) {
-  printf("peer %lu (%s): ", peer->id, peer->host);
+  if (x < y)
+    return -1;
 
-  va_list args;
-  va_start(args, fmt);
-  vprintf(fmt, args);
-  va_end(args);
+  if (x > y)
+    return 1;
+
+  return 0;
 }
 
 static void
-hsk_peer_push(hsk_peer_t *peer) {
-  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+hsk_pool_add_rtt(hsk_pool_t *pool, uint64_t rtt) {
+  pool->rtts[pool->rtts_pos] = rtt;
+  pool->rtts_pos = (pool->rtts_pos + 1) % HSK_HEDGE_SAMPLES;
 
-  if (!peer)
+  if (pool->rtts_size < HSK_HEDGE_SAMPLES)
+    pool->rtts_size += 1;
+
+  // Not enough samples for a percentile yet.
+  if (pool->rtts_size < HSK_HEDGE_SAMPLES / 4) {
+    pool->hedge_delay = HSK_HEDGE_MAX;
     return;
+  }
 
-  peer->next = NULL;
+  uint64_t sorted[HSK_HEDGE_SAMPLES];
+  size_t size = pool->rtts_size;
 
-  if (!pool->head)
-    pool->head = peer;
+  memcpy(sorted, pool->rtts, size * sizeof(uint64_t));
+  qsort((void *)sorted, size, sizeof(uint64_t), qsort_cmp_u64);
 
-  if (pool->tail)
-    pool->tail->next = peer;
+  uint64_t delay = sorted[(size - 1) * pool->hedge_percentile / 100];
 
-  pool->tail = peer;
-  pool->size += 1;
+  if (delay < HSK_HEDGE_MIN)
+    delay = HSK_HEDGE_MIN;
 
-  assert(!hsk_map_has(&pool->peers, &peer->addr));
-  hsk_map_set(&pool->peers, &peer->addr, peer);
+  if (delay > HSK_HEDGE_MAX)
+    delay = HSK_HEDGE_MAX;
+
+  pool->hedge_delay = delay;
 }
 
-static void
-hsk_peer_remove(hsk_peer_t *peer) {
-  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+// Best scoring peer, other than `from`, that
+// is not already working on this name.
+static hsk_peer_t *
+hsk_pool_pick_hedge(
+  hsk_pool_t *pool,
+  const hsk_peer_t *from,
+  const uint8_t *name_hash
+) {
+  hsk_peer_t *best = NULL;
+  uint64_t best_score = 0;
+  hsk_peer_t *peer;
 
-  if (!peer)
-    return;
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer == from || peer->state != HSK_STATE_HANDSHAKE)
+      continue;
 
-  if (!pool->head)
-    return;
+    if (hsk_name_map_has(&peer->names, name_hash))
+      continue;
 
-  if (pool->head == peer) {
-    if (pool->tail == peer)
-      pool->tail = NULL;
-    pool->head = peer->next;
-    peer->next = NULL;
-    assert(pool->size > 0);
-    pool->size -= 1;
-    assert(hsk_map_del(&pool->peers, &peer->addr));
-    return;
+    uint64_t score = hsk_peer_score(peer);
+
+    if (!best || score < best_score) {
+      best = peer;
+      best_score = score;
+    }
   }
 
-  hsk_peer_t *prev;
+  return best;
+}
 
-  // O(n), but who cares.
-  for (prev = pool->head; prev; prev = prev->next) {
-    if (prev->next == peer)
-      break;
-  }
+static void
+hsk_pool_hedge(hsk_pool_t *pool) {
+  uint64_t now = uv_now(pool->loop);
+  bool waiting = false;
 
-  if (!prev)
-    return;
+  hsk_peer_t *peer;
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
 
-  if (pool->tail == peer)
-    pool->tail = prev;
+    hsk_name_map_t *map = &peer->names;
+    uint32_t i;
 
-  prev->next = peer->next;
+    for (i = hsk_tmap_begin(map); i != hsk_tmap_end(map); i++) {
+      if (!hsk_tmap_exists(map, i))
+        continue;
 
-  assert(pool->size > 0);
-  pool->size -= 1;
+      hsk_name_req_t *head = hsk_tmap_value(map, i);
 
-  assert(hsk_map_del(&pool->peers, &peer->addr));
-}
+      // Nobody is waiting on background work.
+      if (head->hedged || head->priority != HSK_PRIORITY_CLIENT)
+        continue;
 
-static int
-hsk_peer_write(
-  hsk_peer_t *peer,
-  uint8_t *data,
-  size_t data_len,
-  bool should_free
-) {
-  if (peer->state != HSK_STATE_HANDSHAKE)
-    return HSK_SUCCESS;
+      if (now - head->start < pool->hedge_delay) {
+        waiting = true;
+        continue;
+      }
 
-  assert(should_free);
+      hsk_name_req_t *req;
+      for (req = head; req; req = req->next)
+        req->hedged = true;
 
-  return hsk_brontide_write(&peer->brontide, data, data_len);
-}
+      hsk_peer_t *alt = hsk_pool_pick_hedge(pool, peer, head->hash);
 
-static int
-hsk_peer_write_raw(
-  hsk_peer_t *peer,
-  uint8_t *data,
-  size_t data_len,
-  bool should_free
-) {
-  if (peer->state == HSK_STATE_DISCONNECTING)
-    return HSK_SUCCESS;
+      if (!alt)
+        continue;
 
-  int rc = HSK_SUCCESS;
-  hsk_write_data_t *wd = NULL;
-  uv_write_t *req = NULL;
+      hsk_name_req_t *copy = hsk_name_req_alloc(pool);
 
-  wd = (hsk_write_data_t *)malloc(sizeof(hsk_write_data_t));
+      if (!copy)
+        continue;
 
-  if (!wd) {
-    rc = HSK_ENOMEM;
-    goto fail;
-  }
+      memcpy((void *)copy, (void *)head, sizeof(hsk_name_req_t));
 
-  req = (uv_write_t *)malloc(sizeof(uv_write_t));
+      copy->callback = NULL;
+      copy->arg = NULL;
+      copy->time = hsk_now();
+      copy->start = now;
+      copy->next = NULL;
 
-  if (!req) {
-    rc = HSK_ENOMEM;
-    goto fail;
+      if (!hsk_name_map_set(&alt->names, copy->hash, copy)) {
+        hsk_name_req_free(pool, copy);
+        continue;
+      }
+
+      hsk_peer_log(alt, "hedging proof request for: %s.\n", copy->name);
+
+      hsk_peer_send_getproof(alt, copy->hash, copy->root);
+    }
   }
 
-  wd->peer = peer;
-  wd->data = (void *)data;
-  wd->should_free = should_free;
+  if (!waiting)
+    uv_timer_stop(&pool->hedge_timer);
+}
 
-  req->data = (void *)wd;
+static void
+hsk_proof_entry_free(hsk_proof_entry_t *entry) {
+  hsk_mem_sub(HSK_MEM_PROOFS, sizeof(hsk_proof_entry_t) + entry->data_len);
+  hsk_free(entry->data);
+  hsk_free(entry);
+}
 
-  uv_stream_t *stream = (uv_stream_t *)&peer->socket;
+static void
+hsk_pool_unlink_proof(hsk_pool_t *pool, hsk_proof_entry_t *entry) {
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    pool->proofs_head = (void *)entry->next;
+
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    pool->proofs_tail = (void *)entry->prev;
+
+  entry->prev = NULL;
+  entry->next = NULL;
+}
 
-  uv_buf_t bufs[] = {
-    { .base = (char *)data, .len = data_len }
-  };
+static void
+hsk_pool_push_proof(hsk_pool_t *pool, hsk_proof_entry_t *entry) {
+  hsk_proof_entry_t *head = (hsk_proof_entry_t *)pool->proofs_head;
 
-  int status = uv_write(req, stream, bufs, 1, after_write);
+  entry->prev = NULL;
+  entry->next = head;
 
-  if (status != 0) {
-    hsk_peer_log(peer, "failed writing: %s\n", uv_strerror(status));
-    hsk_peer_destroy(peer);
-    rc = HSK_EFAILURE;
-    goto fail;
+  if (head)
+    head->prev = entry;
+  else
+    pool->proofs_tail = (void *)entry;
+
+  pool->proofs_head = (void *)entry;
+}
+
+static void
+hsk_pool_clear_proofs(hsk_pool_t *pool) {
+  hsk_proof_entry_t *entry, *next;
+
+  for (entry = pool->proofs_head; entry; entry = next) {
+    next = entry->next;
+    hsk_proof_entry_free(entry);
   }
 
-  peer->last_send = hsk_now();
+  hsk_map_reset(&pool->proofs);
 
-  return rc;
+  pool->proofs_head = NULL;
+  pool->proofs_tail = NULL;
+}
 
-fail:
-  if (wd)
-    free(wd);
+// Everything cached is for one root. Once the
+// safe root moves, none of it is usable.
+static bool
+hsk_pool_sync_proofs(hsk_pool_t *pool, const uint8_t *root) {
+  if (memcmp(pool->proofs_root, root, 32) == 0)
+    return false;
 
-  if (req)
-    free(req);
+  if (pool->proofs.size > 0)
+    hsk_pool_log(pool, "tree root changed, dropping cached proofs\n");
 
-  if (data && should_free)
-    free(data);
+  hsk_pool_clear_proofs(pool);
 
-  return rc;
+  memcpy(pool->proofs_root, root, 32);
+
+  return true;
 }
 
-static int
-hsk_peer_send(hsk_peer_t *peer, const hsk_msg_t *msg) {
-  int msg_size = hsk_msg_size(msg);
-  assert(msg_size != -1);
+static hsk_proof_entry_t *
+hsk_pool_get_proof(hsk_pool_t *pool, const uint8_t *key) {
+  hsk_proof_entry_t *entry = hsk_map_get(&pool->proofs, key);
 
-  size_t size = 9 + msg_size;
-  uint8_t *data = malloc(size);
+  if (!entry)
+    return NULL;
 
-  if (!data)
-    return HSK_ENOMEM;
+  hsk_pool_unlink_proof(pool, entry);
+  hsk_pool_push_proof(pool, entry);
 
-  uint8_t *buf = data;
+  return entry;
+}
 
-  // Magic Number
-  write_u32(&buf, HSK_MAGIC);
+static void
+hsk_pool_cache_proof(
+  hsk_pool_t *pool,
+  const uint8_t *name_hash,
+  const uint8_t *root,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  if (!hsk_chain_synced(&pool->chain))
+    return;
 
-  // Command
-  write_u8(&buf, msg->cmd);
+  if (memcmp(root, hsk_chain_safe_root(&pool->chain), 32) != 0)
+    return;
 
-  // Msg Size
-  write_u32(&buf, msg_size);
+  hsk_pool_sync_proofs(pool, root);
 
-  // Msg
-  hsk_msg_write(msg, &buf);
+  hsk_watch_update(&pool->watch, name_hash, root, exists, data, data_len);
 
-  return hsk_peer_write(peer, data, size, true);
-}
+  uint8_t key[64];
 
-static int
-hsk_peer_send_version(hsk_peer_t *peer) {
-  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  memcpy(&key[0], name_hash, 32);
+  memcpy(&key[32], root, 32);
 
-  hsk_version_msg_t msg = { .cmd = HSK_MSG_VERSION };
-  hsk_msg_init((hsk_msg_t *)&msg);
+  if (hsk_map_has(&pool->proofs, key))
+    return;
 
-  msg.version = HSK_PROTO_VERSION;
-  msg.services = HSK_SERVICES;
-  msg.time = hsk_timedata_now(&pool->td);
+  hsk_proof_entry_t *entry = hsk_malloc(sizeof(hsk_proof_entry_t));
 
-  const hsk_addrentry_t *entry = hsk_addrman_get(&pool->am, &peer->addr);
+  if (!entry)
+    return;
 
-  if (entry) {
-    msg.remote.time = entry->time;
-    msg.remote.services = entry->services;
-  }
+  memcpy(entry->key, key, 64);
 
-  hsk_addr_copy(&msg.remote.addr, &peer->addr);
+  entry->exists = exists;
+  entry->data = NULL;
+  entry->data_len = 0;
 
-  msg.nonce = hsk_nonce();
-  strcpy(msg.agent, HSK_USER_AGENT);
-  msg.height = (uint32_t)pool->chain.height;
+  if (data_len > 0) {
+    entry->data = hsk_malloc(data_len);
 
-  peer->version_time = hsk_now();
+    if (!entry->data) {
+      hsk_free(entry);
+      return;
+    }
 
-  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
-}
+    memcpy(entry->data, data, data_len);
+    entry->data_len = data_len;
+  }
 
-static int
-hsk_peer_send_verack(hsk_peer_t *peer) {
-  hsk_version_msg_t msg = { .cmd = HSK_MSG_VERACK };
-  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
-}
+  hsk_mem_add(HSK_MEM_PROOFS, sizeof(hsk_proof_entry_t) + entry->data_len);
 
-static int
-hsk_peer_send_ping(hsk_peer_t *peer, uint64_t nonce) {
-  hsk_ping_msg_t msg = {
-    .cmd = HSK_MSG_PING,
-    .nonce = nonce
-  };
-  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
-}
+  if (!hsk_map_set(&pool->proofs, entry->key, (void *)entry)) {
+    hsk_proof_entry_free(entry);
+    return;
+  }
 
-static int
-hsk_peer_send_pong(hsk_peer_t *peer, uint64_t nonce) {
-  hsk_pong_msg_t msg = {
-    .cmd = HSK_MSG_PONG,
-    .nonce = nonce
-  };
-  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
-}
+  hsk_pool_push_proof(pool, entry);
 
-static int
-hsk_peer_send_sendheaders(hsk_peer_t *peer) {
-  hsk_version_msg_t msg = { .cmd = HSK_MSG_SENDHEADERS };
-  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
-}
+  if (pool->proofs.size > pool->max_proofs) {
+    hsk_proof_entry_t *tail = (hsk_proof_entry_t *)pool->proofs_tail;
 
-static int
-hsk_peer_send_getheaders(hsk_peer_t *peer, const uint8_t *stop) {
-  hsk_getheaders_msg_t msg = { .cmd = HSK_MSG_GETHEADERS };
+    hsk_map_del(&pool->proofs, tail->key);
+    hsk_pool_unlink_proof(pool, tail);
+    hsk_proof_entry_free(tail);
+  }
+}
 
-  hsk_msg_init((hsk_msg_t *)&msg);
+// Lookups are mostly for a few names: hash
+// each of them once. Names come in lowercased
+// (TLDs, from the nameserver and resolver).
+static void
+hsk_pool_hash_name(hsk_pool_t *pool, const char *name, uint8_t *hash) {
+  size_t len = strlen(name);
 
-  hsk_chain_get_locator(peer->chain, &msg);
+  if (len == 0 || len >= sizeof(pool->memo[0].name)) {
+    hsk_hash_name(name, hash);
+    return;
+  }
 
-  if (stop)
-    memcpy(msg.stop, stop, 32);
+  uint32_t slot = hsk_map_hash_str(name) & (HSK_NAME_MEMO - 1);
+  hsk_name_memo_t *memo = &pool->memo[slot];
 
-  peer->getheaders_time = hsk_now();
+  if (strcmp(memo->name, name) != 0) {
+    hsk_hash_name(name, memo->hash);
+    memcpy(memo->name, name, len + 1);
+  }
 
-  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+  memcpy(hash, memo->hash, 32);
 }
 
 static int
-hsk_peer_send_getproof(
-  hsk_peer_t *peer,
-  const uint8_t *name_hash,
-  const uint8_t *root
+hsk_pool_request(
+  hsk_pool_t *pool,
+  const char *name,
+  int priority,
+  hsk_resolve_cb callback,
+  const void *arg
 ) {
-  hsk_getproof_msg_t msg = { .cmd = HSK_MSG_GETPROOF };
-  hsk_msg_init((hsk_msg_t *)&msg);
+  hsk_pool_debug(pool, "sending proof request for: %s.\n", name);
 
-  memcpy(msg.key, name_hash, 32);
-  memcpy(msg.root, root, 32);
+  if (!hsk_chain_synced(&pool->chain)) {
+    hsk_pool_log(pool, "cannot send proof request: chain not synced.\n");
+    return HSK_ETIMEOUT;
+  }
 
-  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
-}
+  if (strlen(name) >= HSK_NAME_SIZE)
+    return HSK_EBADARGS;
 
-static int
-hsk_peer_handle_version(hsk_peer_t *peer, const hsk_version_msg_t *msg) {
-  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  const uint8_t *root = hsk_chain_safe_root(&pool->chain);
+  hsk_name_req_t *req = hsk_name_req_alloc(pool);
 
-  hsk_peer_log(peer, "received version: %s (%u)\n", msg->agent, msg->height);
-  peer->height = (int64_t)msg->height;
+  if (!req)
+    return HSK_ENOMEM;
 
-  hsk_timedata_add(&pool->td, &peer->addr, msg->time);
-  hsk_addrman_mark_ack(&pool->am, &peer->addr, msg->services);
+  strcpy(req->name, name);
+  memset(&req->trace, 0, sizeof(req->trace));
 
-  return hsk_peer_send_verack(peer);
-}
+  hsk_pool_hash_name(pool, name, req->hash);
 
-static int
-hsk_peer_handle_verack(hsk_peer_t *peer, const hsk_verack_msg_t *msg) {
-  peer->version_time = 0;
+  memcpy(req->root, root, 32);
 
-  int rc = hsk_peer_send_sendheaders(peer);
+  hsk_pool_sync_proofs(pool, root);
 
-  if (rc != HSK_SUCCESS)
-    return rc;
+  const hsk_watch_name_t *watched =
+    hsk_watch_lookup(&pool->watch, req->hash, root);
 
-  return hsk_peer_send_getheaders(peer, NULL);
-}
+  hsk_proof_entry_t *cached = NULL;
 
-static int
-hsk_peer_handle_ping(hsk_peer_t *peer, const hsk_ping_msg_t *msg) {
-  return hsk_peer_send_pong(peer, msg->nonce);
-}
+  if (!watched)
+    cached = hsk_pool_get_proof(pool, req->hash);
 
-static int
-hsk_peer_handle_pong(hsk_peer_t *peer, const hsk_pong_msg_t *msg) {
-  if (!peer->challenge) {
-    hsk_peer_log(peer, "peer sent an unsolicited pong\n");
-    return HSK_SUCCESS;
-  }
+  // Answer from the watchlist's store or the
+  // cache of verified proofs.
+  if (watched || cached) {
+    hsk_pool_debug(pool, "using %s proof for: %s.\n",
+                   watched ? "watched" : "cached", name);
+
+    if (cached)
+      pool->proof_hits += 1;
+
+    req->trace.cached = true;
+    pool->trace = &req->trace;
+
+    callback(
+      req->name,
+      HSK_SUCCESS,
+      watched ? watched->exists : cached->exists,
+      watched ? watched->data : cached->data,
+      watched ? watched->data_len : cached->data_len,
+      arg
+    );
+
+    pool->trace = NULL;
+
+    hsk_name_req_free(pool, req);
 
-  if (msg->nonce != peer->challenge) {
-    if (msg->nonce == 0) {
-      hsk_peer_log(peer, "peer sent a zero nonce\n");
-      peer->challenge = 0;
-      return HSK_SUCCESS;
-    }
-    hsk_peer_log(peer, "peer sent the wrong nonce\n");
     return HSK_SUCCESS;
   }
 
-  hsk_peer_debug(peer, "received pong\n");
+  pool->proof_misses += 1;
 
-  int64_t now = hsk_now();
+  req->callback = callback;
+  req->arg = (void *)arg;
+  req->time = hsk_now();
+  req->start = uv_now(pool->loop);
+  req->hedged = false;
+  req->retries = 0;
+  req->priority = priority;
+  req->next = NULL;
+  req->pending_next = NULL;
 
-  if (now >= peer->last_ping) {
-    int64_t min = now - peer->last_ping;
-    peer->last_pong = now;
-    if (!peer->min_ping)
-      peer->min_ping = min;
-    peer->min_ping = peer->min_ping < min ? peer->min_ping : min;
-  } else {
-    hsk_peer_log(peer, "timing mismatch\n");
+  hsk_peer_t *peer = hsk_pool_pick_prover(pool, req->hash, req->root);
+
+  // Wait for a peer (or, for background work,
+  // for one with room to spare).
+  if (!hsk_pool_can_send(pool, peer, req)) {
+    if (!peer)
+      hsk_pool_log(pool, "cannot send proof request: no peer.\n");
+
+    int rc = hsk_pool_queue_reqs(pool, req);
+
+    if (rc != HSK_SUCCESS)
+      hsk_name_req_free(pool, req);
+
+    return rc;
   }
 
-  peer->challenge = 0;
+  if (hsk_name_map_has(&peer->names, req->hash))
+    hsk_peer_log(peer, "already requesting proof for: %s.\n", name);
+  else
+    hsk_peer_debug(peer, "sending proof request for: %s.\n", name);
+
+  int rc = hsk_peer_add_reqs(peer, req);
+
+  if (rc != HSK_SUCCESS)
+    hsk_name_req_free(pool, req);
+
+  return rc;
+}
+
+/*
+ * Client
+ */
+
+int
+hsk_pool_client_init(
+  hsk_pool_client_t *client,
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool
+) {
+  if (!client || !loop || !pool)
+    return HSK_EBADARGS;
+
+  client->loop = (uv_loop_t *)loop;
+  client->pool = (hsk_pool_t *)pool;
+  client->async.data = (void *)client;
+  client->replies = NULL;
+  client->current = NULL;
+  client->running = false;
+  client->senders = 0;
 
   return HSK_SUCCESS;
 }
 
-static int
-hsk_peer_handle_addr(hsk_peer_t *peer, hsk_addr_msg_t *msg) {
-  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+static void
+hsk_pool_job_free(hsk_pool_job_t *job) {
+  hsk_free(job->data);
+  hsk_free(job);
+}
 
-  if (msg->addr_count > 1000)
-    return HSK_EFAILURE;
+static hsk_pool_job_t *
+hsk_pool_take_jobs(hsk_pool_job_t **head) {
+  hsk_pool_job_t *job, *next, *list = NULL;
 
-  hsk_peer_log(peer, "received %u addrs\n", msg->addr_count);
+  job = __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
 
-  int64_t now = hsk_timedata_now(&pool->td);
+  // Pushed newest first.
+  for (; job; job = next) {
+    next = job->next;
+    job->next = list;
+    list = job;
+  }
 
-  int i;
-  for (i = 0; i < msg->addr_count; i++) {
-    hsk_netaddr_t *addr = &msg->addrs[i];
+  return list;
+}
 
-    if (!hsk_addr_is_routable(&addr->addr))
-      continue;
+// Any thread may push: the only pop takes the
+// whole list, so there is no ABA to worry
+// about.
+static void
+hsk_pool_push_job(hsk_pool_job_t **head, hsk_pool_job_t *job) {
+  job->next = __atomic_load_n(head, __ATOMIC_RELAXED);
 
-    if (!(addr->services & 1))
-      continue;
+  while (!__atomic_compare_exchange_n(head, &job->next, job, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    continue;
+  }
+}
 
-    if (addr->time <= 100000000 || addr->time > now + 10 * 60)
-      addr->time = now - 5 * 24 * 60 * 60;
+void
+hsk_pool_client_uninit(hsk_pool_client_t *client) {
+  if (!client)
+    return;
 
-    if (addr->addr.port == 0)
-      continue;
+  assert(!client->running);
 
-    if (!hsk_addr_has_key(&addr->addr))
-      continue;
+  hsk_pool_job_t *job, *next;
+
+  for (job = hsk_pool_take_jobs(&client->replies); job; job = next) {
+    next = job->next;
+    hsk_pool_job_free(job);
+  }
+}
+
+hsk_pool_client_t *
+hsk_pool_client_alloc(const uv_loop_t *loop, const hsk_pool_t *pool) {
+  hsk_pool_client_t *client = hsk_malloc(sizeof(hsk_pool_client_t));
+
+  if (!client)
+    return NULL;
 
-    hsk_addrman_add_na(&pool->am, addr);
+  if (hsk_pool_client_init(client, loop, pool) != HSK_SUCCESS) {
+    hsk_free(client);
+    return NULL;
   }
 
-  return HSK_SUCCESS;
+  return client;
 }
 
-static int
-hsk_peer_handle_headers(hsk_peer_t *peer, const hsk_headers_msg_t *msg) {
-  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+void
+hsk_pool_client_free(hsk_pool_client_t *client) {
+  if (!client)
+    return;
 
-  hsk_peer_log(peer, "received %u headers\n", msg->header_count);
+  hsk_pool_client_uninit(client);
+  hsk_free(client);
+}
 
-  if (msg->header_count == 0)
-    return HSK_SUCCESS;
+// May be called before the client's loop runs
+// on its own thread.
+int
+hsk_pool_client_open(hsk_pool_client_t *client) {
+  if (!client)
+    return HSK_EBADARGS;
 
-  if (msg->header_count > 2000)
+  if (client->running)
     return HSK_EFAILURE;
 
-  const uint8_t *last = NULL;
-  hsk_header_t *hdr;
+  if (uv_async_init(client->loop, &client->async, after_replies) != 0)
+    return HSK_EFAILURE;
 
-  for (hdr = msg->headers; hdr; hdr = hdr->next) {
-    if (last && memcmp(hdr->prev_block, last, 32) != 0) {
-      hsk_peer_log(peer, "invalid header chain\n");
-      return HSK_EHASHMISMATCH;
-    }
+  client->async.data = (void *)client;
 
-    last = hsk_header_cache(hdr);
+  __atomic_store_n(&client->running, true, __ATOMIC_RELEASE);
 
-    int rc = hsk_header_verify_pow(hdr);
+  return HSK_SUCCESS;
+}
 
-    if (rc != HSK_SUCCESS) {
-      hsk_peer_log(peer, "invalid header pow\n");
-      return rc;
-    }
-  }
+// On the client's loop. Lookups still out are
+// dropped when they come back, so free the
+// client only after the pool.
+int
+hsk_pool_client_close(hsk_pool_client_t *client) {
+  if (!client)
+    return HSK_EBADARGS;
 
-  bool orphan = false;
+  if (!client->running)
+    return HSK_SUCCESS;
 
-  for (hdr = msg->headers; hdr; hdr = hdr->next) {
-    int rc = hsk_chain_add(peer->chain, hdr);
+  __atomic_store_n(&client->running, false, __ATOMIC_SEQ_CST);
 
-    if (rc == HSK_ETIMETOOOLD || rc == HSK_EBADDIFFBITS) {
-      hsk_peer_log(peer, "failed adding block: %s\n", hsk_strerror(rc));
+  // Wait out a reply being handed over.
+  while (__atomic_load_n(&client->senders, __ATOMIC_SEQ_CST) > 0)
+    continue;
 
-      if (!hsk_addrman_add_ban(&pool->am, &peer->addr))
-        return HSK_ENOMEM;
+  uv_close((uv_handle_t *)&client->async, NULL);
 
-      hsk_peer_destroy(peer);
-      return rc;
-    }
+  return HSK_SUCCESS;
+}
 
-    if (rc == HSK_ETIMETOONEW) {
-      hsk_peer_log(peer, "failed adding block: %s\n", hsk_strerror(rc));
-      hsk_peer_destroy(peer);
-      return rc;
-    }
+// From the client's loop.
+int
+hsk_pool_client_resolve(
+  hsk_pool_client_t *client,
+  const char *name,
+  hsk_resolve_cb callback,
+  const void *arg
+) {
+  return hsk_pool_client_resolve_priority(client, name, HSK_PRIORITY_CLIENT,
+                                          callback, arg);
+}
 
-    if (rc == HSK_EORPHAN || rc == HSK_EDUPLICATEORPHAN) {
-      if (!orphan)
-        hsk_peer_log(peer, "failed adding orphan\n");
-      orphan = true;
-      continue;
-    }
+int
+hsk_pool_client_resolve_priority(
+  hsk_pool_client_t *client,
+  const char *name,
+  int priority,
+  hsk_resolve_cb callback,
+  const void *arg
+) {
+  assert(client && name && callback);
+  assert(priority >= 0 && priority < HSK_PRIORITIES);
 
-    if (rc != HSK_SUCCESS) {
-      hsk_peer_log(peer, "failed adding block: %s\n", hsk_strerror(rc));
-      return rc;
-    }
+  hsk_pool_t *pool = client->pool;
+  size_t len = strlen(name);
 
-    peer->headers += 1;
-  }
+  if (len >= sizeof(((hsk_pool_job_t *)0)->name))
+    return HSK_EBADARGS;
 
-  if (orphan) {
-    hsk_header_t *hdr = msg->headers;
-    const uint8_t *hash = hsk_header_cache(hdr);
-    hsk_peer_log(peer, "peer sent orphan: %s\n", hsk_hex_encode32(hash));
-    hsk_peer_log(peer, "peer sending orphan locator\n");
-    hsk_peer_send_getheaders(peer, NULL);
-    return HSK_SUCCESS;
-  }
+  if (!__atomic_load_n(&pool->accepting, __ATOMIC_ACQUIRE))
+    return HSK_EFAILURE;
 
-  pool->block_time = hsk_now();
-  peer->getheaders_time = 0;
+  hsk_pool_job_t *job = hsk_malloc(sizeof(hsk_pool_job_t));
 
-  if (msg->header_count == 2000) {
-    hsk_peer_log(peer, "requesting more headers\n");
-    return hsk_peer_send_getheaders(peer, NULL);
-  }
+  if (!job)
+    return HSK_ENOMEM;
+
+  job->client = client;
+  memcpy(job->name, name, len + 1);
+  job->priority = priority;
+  job->callback = callback;
+  job->arg = arg;
+  job->status = HSK_SUCCESS;
+  job->exists = false;
+  job->data = NULL;
+  job->data_len = 0;
+  memset(&job->trace, 0, sizeof(job->trace));
+
+  hsk_pool_push_job(&pool->jobs, job);
+
+  uv_async_send(&pool->async);
 
   return HSK_SUCCESS;
 }
 
-static int
-hsk_peer_handle_proof(hsk_peer_t *peer, const hsk_proof_msg_t *msg) {
-  hsk_peer_log(peer, "received proof: %s\n", hsk_hex_encode32(msg->key));
+// How the lookup whose callback is running was
+// answered. NULL outside of callbacks.
+const hsk_name_trace_t *
+hsk_pool_client_get_trace(const hsk_pool_client_t *client) {
+  assert(client);
 
-  hsk_name_req_t *reqs = hsk_map_get(&peer->names, msg->key);
+  if (!client->current)
+    return NULL;
 
-  if (!reqs) {
-    hsk_peer_log(peer,
-      "received unsolicited proof: %s\n",
-      hsk_hex_encode32(msg->key));
-    return HSK_EBADARGS;
+  return &client->current->trace;
+}
+
+// Runs on the pool's loop.
+static void
+hsk_pool_reply_job(
+  hsk_pool_t *pool,
+  hsk_pool_job_t *job,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  hsk_pool_client_t *client = job->client;
+  const hsk_name_trace_t *trace = hsk_pool_get_trace(pool);
+
+  __atomic_fetch_add(&client->senders, 1, __ATOMIC_SEQ_CST);
+
+  if (!__atomic_load_n(&client->running, __ATOMIC_SEQ_CST)) {
+    __atomic_fetch_sub(&client->senders, 1, __ATOMIC_SEQ_CST);
+    hsk_pool_job_free(job);
+    return;
   }
 
-  hsk_peer_log(peer, "received proof for: %s\n", reqs->name);
+  job->status = status;
+  job->exists = exists;
 
-  if (memcmp(msg->root, reqs->root, 32) != 0) {
-    hsk_peer_log(peer, "proof hash mismatch (why?)\n");
-    return HSK_EHASHMISMATCH;
+  if (data_len > 0) {
+    job->data = hsk_malloc(data_len);
+
+    if (job->data) {
+      memcpy(job->data, data, data_len);
+      job->data_len = data_len;
+    } else {
+      job->status = HSK_ENOMEM;
+    }
   }
 
-  bool exists;
-  uint8_t *data;
-  size_t data_len;
+  if (trace)
+    job->trace = *trace;
 
-  int rc = hsk_proof_verify(
-    msg->root,
-    msg->key,
-    &msg->proof,
-    &exists,
-    &data,
-    &data_len
-  );
+  hsk_pool_push_job(&client->replies, job);
 
-  if (rc != HSK_SUCCESS) {
-    hsk_peer_log(peer, "invalid proof: %s\n", hsk_strerror(rc));
-    return rc;
+  uv_async_send(&client->async);
+
+  __atomic_fetch_sub(&client->senders, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+after_client_resolve(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+) {
+  hsk_pool_job_t *job = (hsk_pool_job_t *)arg;
+  hsk_pool_reply_job(job->client->pool, job, status, exists, data, data_len);
+}
+
+static void
+after_jobs(uv_async_t *handle) {
+  hsk_pool_t *pool = (hsk_pool_t *)handle->data;
+  hsk_pool_job_t *job, *next;
+
+  for (job = hsk_pool_take_jobs(&pool->jobs); job; job = next) {
+    next = job->next;
+
+    int rc = hsk_pool_resolve_priority(pool, job->name, job->priority,
+                                       after_client_resolve, (void *)job);
+
+    if (rc != HSK_SUCCESS)
+      hsk_pool_reply_job(pool, job, rc, false, NULL, 0);
   }
+}
 
-  hsk_map_del(&peer->names, msg->key);
+// Runs on the client's loop.
+static void
+after_replies(uv_async_t *handle) {
+  hsk_pool_client_t *client = (hsk_pool_client_t *)handle->data;
+  hsk_pool_job_t *job, *next;
+
+  for (job = hsk_pool_take_jobs(&client->replies); job; job = next) {
+    next = job->next;
+
+    if (client->running) {
+      client->current = job;
+      job->callback(
+        job->name,
+        job->status,
+        job->exists,
+        job->data,
+        job->data_len,
+        job->arg
+      );
+      client->current = NULL;
+    }
 
-  hsk_name_req_t *req, *next;
+    hsk_pool_job_free(job);
+  }
+}
 
-  for (req = reqs; req; req = next) {
-    next = req->next;
+/*
+ * Refresh
+ */
 
-    req->callback(
-      req->name,
-      HSK_SUCCESS,
-      exists,
-      data,
-      data_len,
-      req->arg
-    );
+static void
+hsk_pool_count_name(hsk_pool_t *pool, const char *name) {
+  hsk_top_add(&pool->hot, name);
+}
 
-    free(req);
+static void
+after_refresh(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+) {
+  // Only the proof cache cares about the result.
+  (void)name;
+  (void)status;
+  (void)exists;
+  (void)data;
+  (void)data_len;
+  (void)arg;
+}
+
+static void
+hsk_pool_start_refresh(hsk_pool_t *pool) {
+  uv_timer_t *timer = &pool->refresh_timer;
+
+  if (pool->watch_pos >= pool->watch.count
+      && pool->refresh_pos >= pool->refresh_count) {
+    return;
   }
 
-  free(data);
+  if (!uv_is_active((uv_handle_t *)timer))
+    uv_timer_start(timer, after_refresh_timer, 0, HSK_REFRESH_TICK);
+}
 
-  peer->proofs += 1;
+// Called whenever new headers land. If the safe
+// root moved, fetch the new proofs of every
+// watched name, then of the most looked up ones.
+static void
+hsk_pool_maybe_refresh(hsk_pool_t *pool) {
+  if (!hsk_chain_synced(&pool->chain))
+    return;
 
-  return HSK_SUCCESS;
+  if (!hsk_pool_sync_proofs(pool, hsk_chain_safe_root(&pool->chain)))
+    return;
+
+  pool->watch_pos = 0;
+  pool->refresh_count = 0;
+  pool->refresh_pos = 0;
+
+  if (pool->watch.count > 0)
+    hsk_pool_log(pool, "refreshing %d watched names\n", pool->watch.count);
+
+  int count = hsk_top_list(&pool->hot, pool->refresh, HSK_REFRESH_NAMES);
+
+  // Age the counts so that popularity follows
+  // recent traffic rather than all of history.
+  hsk_top_decay(&pool->hot);
+
+  pool->refresh_count = count;
+  pool->refresh_pos = 0;
+
+  hsk_pool_log(pool, "refreshing %d popular names\n", pool->refresh_count);
+
+  hsk_pool_start_refresh(pool);
 }
 
-static int
-hsk_peer_handle_msg(hsk_peer_t *peer, const hsk_msg_t *msg) {
-  hsk_peer_debug(peer, "handling msg: %s\n", hsk_msg_str(msg->cmd));
+static void
+hsk_pool_refresh(hsk_pool_t *pool) {
+  int sent = 0;
 
-  switch (msg->cmd) {
-    case HSK_MSG_VERSION: {
-      return hsk_peer_handle_version(peer, (hsk_version_msg_t *)msg);
-    }
-    case HSK_MSG_VERACK: {
-      return hsk_peer_handle_verack(peer, (hsk_verack_msg_t *)msg);
-    }
-    case HSK_MSG_PING: {
-      return hsk_peer_handle_ping(peer, (hsk_ping_msg_t *)msg);
-    }
-    case HSK_MSG_PONG: {
-      return hsk_peer_handle_pong(peer, (hsk_pong_msg_t *)msg);
-    }
-    case HSK_MSG_GETADDR: {
-      hsk_peer_debug(peer, "cannot handle getaddr\n");
-      return HSK_SUCCESS;
-    }
-    case HSK_MSG_ADDR: {
-      return hsk_peer_handle_addr(peer, (hsk_addr_msg_t *)msg);
+  while (pool->watch_pos < pool->watch.count && sent < HSK_REFRESH_RATE) {
+    const hsk_watch_name_t *item = pool->watch.names[pool->watch_pos];
+
+    pool->watch_pos += 1;
+
+    int rc = hsk_pool_request(pool, item->name, HSK_PRIORITY_PREFETCH,
+                              after_refresh, NULL);
+
+    if (rc != HSK_SUCCESS) {
+      hsk_pool_log(pool, "stopping watchlist refresh: %s\n",
+                   hsk_strerror(rc));
+      pool->watch_pos = pool->watch.count;
+      break;
     }
-    case HSK_MSG_GETHEADERS: {
-      hsk_peer_debug(peer, "cannot handle getheaders\n");
-      return HSK_SUCCESS;
+
+    sent += 1;
+  }
+
+  while (pool->refresh_pos < pool->refresh_count && sent < HSK_REFRESH_RATE) {
+    const char *name = pool->refresh[pool->refresh_pos].key;
+
+    pool->refresh_pos += 1;
+
+    int rc = hsk_pool_request(pool, name, HSK_PRIORITY_REFRESH,
+                              after_refresh, NULL);
+
+    if (rc != HSK_SUCCESS) {
+      hsk_pool_log(pool, "stopping refresh: %s\n", hsk_strerror(rc));
+      pool->refresh_pos = pool->refresh_count;
+      break;
     }
-    case HSK_MSG_HEADERS: {
-      return hsk_peer_handle_headers(peer, (hsk_headers_msg_t *)msg);
+
+    sent += 1;
+  }
+
+  if (pool->watch_pos >= pool->watch.count
+      && pool->refresh_pos >= pool->refresh_count) {
+    uv_timer_stop(&pool->refresh_timer);
+  }
+}
+
+int
+hsk_pool_resolve(
+  hsk_pool_t *pool,
+  const char *name,
+  hsk_resolve_cb callback,
+  const void *arg
+) {
+  return hsk_pool_resolve_priority(pool, name, HSK_PRIORITY_CLIENT,
+                                   callback, arg);
+}
+
+// Only client lookups count towards a name's
+// popularity: background work would otherwise
+// keep itself going.
+int
+hsk_pool_resolve_priority(
+  hsk_pool_t *pool,
+  const char *name,
+  int priority,
+  hsk_resolve_cb callback,
+  const void *arg
+) {
+  assert(priority >= 0 && priority < HSK_PRIORITIES);
+
+  if (priority == HSK_PRIORITY_CLIENT)
+    hsk_pool_count_name(pool, name);
+
+  return hsk_pool_request(pool, name, priority, callback, arg);
+}
+
+static void
+hsk_pool_send_getheaders(hsk_pool_t *pool) {
+  hsk_peer_t *peer;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
+
+    hsk_peer_send_getheaders(peer, NULL);
+  }
+
+  pool->getheaders_time = hsk_now();
+}
+
+static hsk_name_req_t *
+hsk_name_req_alloc(hsk_pool_t *pool) {
+  hsk_name_req_t *req = (hsk_name_req_t *)hsk_slab_alloc(&pool->reqs);
+
+  if (req)
+    hsk_mem_add(HSK_MEM_REQUESTS, sizeof(hsk_name_req_t));
+
+  return req;
+}
+
+static void
+hsk_name_req_free(hsk_pool_t *pool, hsk_name_req_t *req) {
+  hsk_mem_sub(HSK_MEM_REQUESTS, sizeof(hsk_name_req_t));
+  hsk_slab_free(&pool->reqs, (void *)req);
+}
+
+// Hedged copies of a request carry no callback.
+static void
+hsk_name_req_finish(
+  hsk_pool_t *pool,
+  hsk_name_req_t *reqs,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  hsk_name_req_t *req, *next;
+
+  for (req = reqs; req; req = next) {
+    next = req->next;
+
+    if (req->callback) {
+      req->trace.retries = req->retries;
+      req->trace.hedged = req->hedged;
+
+      pool->trace = &req->trace;
+
+      req->callback(
+        req->name,
+        status,
+        exists,
+        data,
+        data_len,
+        req->arg
+      );
+
+      pool->trace = NULL;
     }
-    case HSK_MSG_SENDHEADERS: {
-      hsk_peer_debug(peer, "cannot handle sendheaders\n");
-      return HSK_SUCCESS;
+
+    hsk_name_req_free(pool, req);
+  }
+}
+
+// Hand requests over to another peer that has
+// the same proof in flight (i.e. a hedge).
+static bool
+hsk_pool_adopt_reqs(hsk_pool_t *pool, hsk_peer_t *from, hsk_name_req_t *reqs) {
+  hsk_peer_t *peer;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer == from || peer->state != HSK_STATE_HANDSHAKE)
+      continue;
+
+    hsk_name_req_t *head = hsk_name_map_get(&peer->names, reqs->hash);
+
+    if (!head)
+      continue;
+
+    hsk_name_req_t *tail = reqs;
+
+    while (tail->next)
+      tail = tail->next;
+
+    tail->next = head->next;
+    head->next = reqs;
+
+    hsk_pool_track_req(pool, peer, head);
+
+    return true;
+  }
+
+  return false;
+}
+
+// Drop hedged copies, which nobody waits on.
+static hsk_name_req_t *
+hsk_name_req_strip(hsk_pool_t *pool, hsk_name_req_t *reqs) {
+  hsk_name_req_t *head = NULL;
+  hsk_name_req_t *req, *next;
+
+  for (req = reqs; req; req = next) {
+    next = req->next;
+
+    if (!req->callback) {
+      hsk_name_req_free(pool, req);
+      continue;
     }
-    case HSK_MSG_GETPROOF: {
-      hsk_peer_debug(peer, "cannot handle getproof\n");
-      return HSK_SUCCESS;
+
+    req->next = head;
+    head = req;
+  }
+
+  return head;
+}
+
+// Hand a request chain to a peer, joining any
+// request it already has in flight for the name.
+static int
+hsk_peer_add_reqs(hsk_peer_t *peer, hsk_name_req_t *reqs) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  hsk_name_req_t *head = hsk_name_map_get(&peer->names, reqs->hash);
+  hsk_name_req_t *req, *tail = NULL;
+
+  int64_t now = hsk_now();
+  uint64_t start = uv_now(pool->loop);
+
+  for (req = reqs; req; req = req->next) {
+    req->time = head ? head->time : now;
+    req->start = head ? head->start : start;
+    req->hedged = head ? head->hedged : false;
+    req->pending_next = NULL;
+    tail = req;
+  }
+
+  if (head) {
+    tail->next = head->next;
+    head->next = reqs;
+
+    // The head speaks for the whole chain.
+    if (reqs->priority < head->priority)
+      head->priority = reqs->priority;
+
+    return HSK_SUCCESS;
+  }
+
+  if (!hsk_name_map_set(&peer->names, reqs->hash, reqs))
+    return HSK_ENOMEM;
+
+  hsk_pool_track_req(pool, peer, reqs);
+
+  return hsk_peer_send_getproof(peer, reqs->hash, reqs->root);
+}
+
+static void
+hsk_pool_push_reqs(hsk_pool_t *pool, hsk_name_req_t *reqs) {
+  int p = reqs->priority;
+
+  reqs->pending_next = NULL;
+
+  if (pool->pending_tail[p])
+    pool->pending_tail[p]->pending_next = reqs;
+  else
+    pool->pending[p] = reqs;
+
+  pool->pending_tail[p] = reqs;
+}
+
+static void
+hsk_pool_unlink_reqs(hsk_pool_t *pool, hsk_name_req_t *reqs) {
+  int p = reqs->priority;
+  hsk_name_req_t *prev = NULL;
+  hsk_name_req_t *cur;
+
+  for (cur = pool->pending[p]; cur; prev = cur, cur = cur->pending_next) {
+    if (cur == reqs)
+      break;
+  }
+
+  assert(cur);
+
+  if (prev)
+    prev->pending_next = cur->pending_next;
+  else
+    pool->pending[p] = cur->pending_next;
+
+  if (pool->pending_tail[p] == cur)
+    pool->pending_tail[p] = prev;
+
+  cur->pending_next = NULL;
+}
+
+// Park requests until a peer is available. Each
+// class is a FIFO of names (oldest first), with
+// duplicate lookups chained behind the first.
+static int
+hsk_pool_queue_reqs(hsk_pool_t *pool, hsk_name_req_t *reqs) {
+  hsk_name_req_t *head = hsk_name_map_get(&pool->pending_names, reqs->hash);
+  hsk_name_req_t *tail;
+
+  if (head) {
+    for (tail = reqs; tail->next; tail = tail->next);
+    tail->next = head->next;
+    head->next = reqs;
+
+    // A client now waits on background work:
+    // move it up to the client's class.
+    if (reqs->priority < head->priority) {
+      hsk_pool_unlink_reqs(pool, head);
+      head->priority = reqs->priority;
+      hsk_pool_push_reqs(pool, head);
     }
-    case HSK_MSG_PROOF: {
-      return hsk_peer_handle_proof(peer, (hsk_proof_msg_t *)msg);
+
+    return HSK_SUCCESS;
+  }
+
+  if (pool->pending_count >= pool->max_pending)
+    return HSK_EBUSY;
+
+  if (reqs->priority != HSK_PRIORITY_CLIENT
+      && pool->pending_count >= pool->max_pending / 2) {
+    return HSK_EBUSY;
+  }
+
+  if (!hsk_name_map_set(&pool->pending_names, reqs->hash, reqs))
+    return HSK_ENOMEM;
+
+  hsk_pool_push_reqs(pool, reqs);
+
+  pool->pending_count += 1;
+
+  return HSK_SUCCESS;
+}
+
+static hsk_name_req_t *
+hsk_pool_shift_reqs(hsk_pool_t *pool, int priority) {
+  hsk_name_req_t *head = pool->pending[priority];
+
+  if (!head)
+    return NULL;
+
+  hsk_pool_unlink_reqs(pool, head);
+
+  pool->pending_count -= 1;
+
+  hsk_name_map_del(&pool->pending_names, head->hash);
+
+  return head;
+}
+
+// Send parked requests (most urgent class and
+// oldest first) now that there may be a peer
+// to take them.
+static void
+hsk_pool_resend(hsk_pool_t *pool) {
+  if (pool->pending_count == 0 || !hsk_chain_synced(&pool->chain))
+    return;
+
+  int p;
+  for (p = 0; p < HSK_PRIORITIES; p++) {
+    while (pool->pending[p]) {
+      hsk_name_req_t *next = pool->pending[p];
+      hsk_peer_t *peer = hsk_pool_pick_prover(pool, next->hash, next->root);
+
+      if (!hsk_pool_can_send(pool, peer, next))
+        break;
+
+      hsk_name_req_t *reqs = hsk_pool_shift_reqs(pool, p);
+
+      if (hsk_peer_add_reqs(peer, reqs) != HSK_SUCCESS)
+        hsk_name_req_finish(pool, reqs, HSK_ENOMEM, false, NULL, 0);
     }
-    case HSK_MSG_UNKNOWN:
-    default: {
-      return HSK_SUCCESS;
+
+    // Nothing goes ahead of a parked client.
+    if (pool->pending[HSK_PRIORITY_CLIENT])
+      break;
+  }
+}
+
+static void
+hsk_pool_expire_pending(hsk_pool_t *pool) {
+  int64_t now = hsk_now();
+  int p;
+
+  for (p = 0; p < HSK_PRIORITIES; p++) {
+    hsk_name_req_t *head;
+
+    while ((head = pool->pending[p])
+           && now > head->time + pool->proof_timeout) {
+      hsk_name_req_t *reqs = hsk_pool_shift_reqs(pool, p);
+      hsk_pool_log(pool, "pending request timed out: %s\n", reqs->name);
+      hsk_name_req_finish(pool, reqs, HSK_ETIMEOUT, false, NULL, 0);
     }
   }
 }
 
+// Requests on a peer that went away: give them
+// to another peer if we can, else park them.
+static void
+hsk_pool_requeue_reqs(hsk_pool_t *pool, hsk_name_req_t *reqs) {
+  reqs = hsk_name_req_strip(pool, reqs);
+
+  if (!reqs)
+    return;
+
+  hsk_peer_t *peer = hsk_pool_pick_prover(pool, reqs->hash, reqs->root);
+
+  if (hsk_pool_can_send(pool, peer, reqs)
+      && hsk_peer_add_reqs(peer, reqs) == HSK_SUCCESS) {
+    return;
+  }
+
+  reqs->time = hsk_now();
+
+  if (hsk_pool_queue_reqs(pool, reqs) != HSK_SUCCESS)
+    hsk_name_req_finish(pool, reqs, HSK_ETIMEOUT, false, NULL, 0);
+}
+
+static void
+hsk_peer_timeout_reqs(hsk_peer_t *peer) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  hsk_name_map_t *map = &peer->names;
+  uint32_t i;
+
+  for (i = hsk_tmap_begin(map); i != hsk_tmap_end(map); i++) {
+    if (!hsk_tmap_exists(map, i))
+      continue;
+
+    hsk_name_req_t *req = hsk_tmap_value(map, i);
+
+    assert(req);
+
+    hsk_name_map_delete(map, i);
+    hsk_pool_untrack_req(pool, peer, req);
+
+    if (hsk_pool_adopt_reqs(pool, peer, req))
+      continue;
+
+    hsk_pool_requeue_reqs(pool, req);
+  }
+
+  hsk_name_map_reset(map);
+}
+
+// Move expired requests to another peer, or fail
+// them once they have been retried enough.
+static void
+hsk_pool_retry_reqs(hsk_pool_t *pool, hsk_peer_t *from, hsk_name_req_t *reqs) {
+  if (hsk_pool_adopt_reqs(pool, from, reqs))
+    return;
+
+  hsk_name_req_t *head = NULL;
+  hsk_name_req_t *req, *next;
+
+  for (req = hsk_name_req_strip(pool, reqs); req; req = next) {
+    next = req->next;
+    req->next = NULL;
+
+    req->retries += 1;
+
+    if (req->retries > pool->proof_retries) {
+      hsk_name_req_finish(pool, req, HSK_ETIMEOUT, false, NULL, 0);
+      continue;
+    }
+
+    req->next = head;
+    head = req;
+  }
+
+  if (!head)
+    return;
+
+  hsk_peer_t *peer = hsk_pool_pick_hedge(pool, from, head->hash);
+
+  if (!hsk_pool_can_send(pool, peer, head)) {
+    head->time = hsk_now();
+
+    if (hsk_pool_queue_reqs(pool, head) != HSK_SUCCESS)
+      hsk_name_req_finish(pool, head, HSK_ETIMEOUT, false, NULL, 0);
+
+    return;
+  }
+
+  hsk_peer_log(peer, "retrying proof request for: %s.\n", head->name);
+
+  if (hsk_peer_add_reqs(peer, head) != HSK_SUCCESS)
+    hsk_name_req_finish(pool, head, HSK_ENOMEM, false, NULL, 0);
+}
+
+typedef struct hsk_expire_s {
+  hsk_peer_t *peer;
+  int64_t now;
+  int expired;
+} hsk_expire_t;
+
+static void
+hsk_peer_expire_req(void *arg, const uint8_t *key, int64_t deadline) {
+  hsk_expire_t *ctx = (hsk_expire_t *)arg;
+  hsk_peer_t *peer = ctx->peer;
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  hsk_name_req_t *req = hsk_name_map_get(&peer->names, key);
+
+  // Answered, or moved elsewhere.
+  if (!req)
+    return;
+
+  // Sent again since this deadline was set.
+  if (ctx->now <= req->time + pool->proof_timeout) {
+    hsk_wheel_add(&peer->timeouts, req->time + pool->proof_timeout + 1, key);
+    return;
+  }
+
+  hsk_peer_log(peer, "proof request timed out: %s\n", req->name);
+
+  hsk_peer_count_error(peer, HSK_ETIMEOUT);
+  pool->stats.timeouts += 1;
+
+  hsk_name_map_del(&peer->names, key);
+  hsk_pool_untrack_req(pool, peer, req);
+
+  hsk_pool_retry_reqs(pool, peer, req);
+
+  ctx->expired += 1;
+}
+
+// Only deadlines that came due are visited.
+static void
+hsk_peer_expire_reqs(hsk_peer_t *peer) {
+  hsk_expire_t ctx;
+
+  ctx.peer = peer;
+  ctx.now = hsk_now();
+  ctx.expired = 0;
+
+  hsk_wheel_advance(&peer->timeouts, ctx.now, hsk_peer_expire_req, &ctx);
+
+  if (ctx.expired > 0) {
+    peer->proof_fails += ctx.expired;
+    peer->proof_strikes += 1;
+  }
+}
+
+// Top up the handshake keys on the thread pool
+// (one job at a time).
+static void
+hsk_pool_queue_keys(hsk_pool_t *pool) {
+  if (!pool->proof_workers || pool->keys_job)
+    return;
+
+  if (pool->ephemeral_count == HSK_HANDSHAKE_KEYS)
+    return;
+
+  hsk_keys_job_t *job = hsk_malloc(sizeof(hsk_keys_job_t));
+
+  if (!job)
+    return;
+
+  job->req.data = (void *)job;
+  job->pool = pool;
+  job->ec = pool->ec;
+  job->count = HSK_HANDSHAKE_KEYS - pool->ephemeral_count;
+  job->made = 0;
+
+  if (uv_queue_work(pool->loop, &job->req, on_keys, after_keys) != 0) {
+    hsk_free(job);
+    return;
+  }
+
+  pool->keys_job = (void *)job;
+}
+
+// Refilled between connection bursts, so that
+// a reconnect has only its ECDHs to do. Made
+// on the loop without proof workers.
+static void
+hsk_pool_fill_keys(hsk_pool_t *pool) {
+  if (pool->proof_workers) {
+    hsk_pool_queue_keys(pool);
+    return;
+  }
+
+  while (pool->ephemeral_count < HSK_HANDSHAKE_KEYS) {
+    int i = pool->ephemeral_count;
+
+    if (!hsk_ec_create_privkey(pool->ec, pool->ephemeral[i]))
+      break;
+
+    if (!hsk_ec_create_pubkey(pool->ec, pool->ephemeral[i],
+                              pool->ephemeral_pub[i])) {
+      break;
+    }
+
+    pool->ephemeral_count += 1;
+  }
+}
+
+// Over the memory budget: our proof cache goes
+// first, as DNS caches do on their own threads
+// (they evict as they insert). If that is not
+// enough by the next tick, orphans, then idle
+// peers, keeping one ready.
+static void
+hsk_pool_shed(hsk_pool_t *pool) {
+  if (hsk_mem_over() == 0) {
+    pool->mem_ticks = 0;
+    return;
+  }
+
+  if (pool->proofs.size > 0) {
+    hsk_pool_log(pool, "over memory budget, dropping cached proofs\n");
+    hsk_pool_clear_proofs(pool);
+  }
+
+  if (pool->mem_ticks++ == 0 || hsk_mem_over() == 0)
+    return;
+
+  if (pool->chain.orphans.size > 0) {
+    hsk_pool_log(pool, "over memory budget, dropping %zu orphans\n",
+                 pool->chain.orphans.size);
+    hsk_orphans_clear(&pool->chain.orphans);
+  }
+
+  int ready = hsk_pool_ready(pool);
+  hsk_peer_t *peer, *next;
+
+  for (peer = pool->head; peer; peer = next) {
+    next = peer->next;
+
+    if (hsk_mem_over() == 0)
+      break;
+
+    if (peer->names.size > 0 || peer->send_count > 0)
+      continue;
+
+    if (hsk_pool_is_node(pool, peer))
+      continue;
+
+    if (peer->state == HSK_STATE_HANDSHAKE) {
+      if (ready <= 1)
+        continue;
+      ready -= 1;
+    }
+
+    hsk_peer_log(peer, "over memory budget, dropping idle peer\n");
+    hsk_peer_destroy(peer);
+  }
+}
+
+// Grow the pool by a peer while the ones we
+// have are backed up with proof requests, and
+// shrink it back, dropping the worst idle peer,
+// once they have been quiet for a while.
+static void
+hsk_pool_autosize(hsk_pool_t *pool) {
+  if (pool->max_grow == 0)
+    return;
+
+  int ready = 0;
+  int load = pool->pending_count;
+  hsk_peer_t *peer;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
+
+    ready += 1;
+    load += (int)peer->names.size;
+  }
+
+  if (ready == 0)
+    return;
+
+  uint64_t rtt = 0;
+  size_t i;
+
+  for (i = 0; i < pool->rtts_size; i++)
+    rtt += pool->rtts[i];
+
+  if (pool->rtts_size > 0)
+    rtt /= pool->rtts_size;
+
+  bool busy = load > ready * HSK_GROW_LOAD
+           || (load >= ready && rtt > HSK_GROW_RTT);
+
+  if (busy) {
+    pool->idle_ticks = 0;
+
+    // Not while still filling what we have, or
+    // over the memory budget.
+    if (ready < pool->max_size
+        || pool->max_size >= pool->base_size + pool->max_grow
+        || hsk_mem_over() > 0) {
+      return;
+    }
+
+    pool->max_size += 1;
+
+    hsk_pool_log(pool, "growing pool to %d peers (load=%d, rtt=%lu)\n",
+                 pool->max_size, load, rtt);
+    return;
+  }
+
+  if (load >= ready || pool->max_size <= pool->base_size) {
+    pool->idle_ticks = 0;
+    return;
+  }
+
+  if (++pool->idle_ticks < HSK_SHRINK_TICKS)
+    return;
+
+  pool->idle_ticks = 0;
+  pool->max_size -= 1;
+
+  hsk_pool_log(pool, "shrinking pool to %d peers\n", pool->max_size);
+
+  if (ready <= pool->max_size)
+    return;
+
+  hsk_peer_t *worst = NULL;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
+
+    if (peer->names.size > 0 || peer->send_count > 0)
+      continue;
+
+    if (hsk_pool_is_node(pool, peer))
+      continue;
+
+    if (!worst || hsk_peer_score(peer) > hsk_peer_score(worst))
+      worst = peer;
+  }
+
+  if (worst) {
+    hsk_peer_log(worst, "pool shrinking, dropping idle peer\n");
+    hsk_peer_destroy(worst);
+  }
+}
+
+// How long a peer takes to get back to us: its
+// proof latency, or the handshake until it has
+// answered a proof.
+static uint64_t
+hsk_peer_latency(const hsk_peer_t *peer) {
+  uint64_t rtt = peer->handshake_rtt;
+
+  if (peer->proofs > 0 && peer->proof_rtt > rtt)
+    rtt = peer->proof_rtt;
+
+  return rtt;
+}
+
+// Swap the slowest idle peer for the quickest
+// known address, if that is much faster. Each
+// handshake's time is kept by the address
+// manager (and saved with it), so the pool
+// drifts towards the closest peers.
+static void
+hsk_pool_replace(hsk_pool_t *pool, int64_t now) {
+  if (!pool->replace)
+    return;
+
+  if (now < pool->replace_time + HSK_REPLACE_INTERVAL)
+    return;
+
+  pool->replace_time = now;
+
+  if (!hsk_chain_synced(&pool->chain) || hsk_mem_over() > 0)
+    return;
+
+  if (hsk_pool_ready(pool) < pool->max_size)
+    return;
+
+  hsk_peer_t *slow = NULL;
+  hsk_peer_t *peer;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE || peer->handshake_rtt == 0)
+      continue;
+
+    // Give new peers time to answer some proofs.
+    if (now < peer->conn_time + HSK_REPLACE_INTERVAL)
+      continue;
+
+    if (peer->names.size > 0 || peer->send_count > 0)
+      continue;
+
+    if (hsk_pool_is_node(pool, peer))
+      continue;
+
+    if (!slow || hsk_peer_latency(peer) > hsk_peer_latency(slow))
+      slow = peer;
+  }
+
+  if (!slow)
+    return;
+
+  uint64_t rtt = hsk_peer_latency(slow);
+
+  if (rtt < HSK_REPLACE_RATIO)
+    return;
+
+  const hsk_addrentry_t *entry = hsk_addrman_pick_fast(&pool->am,
+    &pool->peers, (uint32_t)(rtt / HSK_REPLACE_RATIO));
+
+  if (!entry)
+    return;
+
+  hsk_addr_t addr;
+  hsk_addr_copy(&addr, &entry->addr);
+
+  hsk_peer_log(slow, "replacing slow peer (%lums) with one at %ums\n",
+               rtt, entry->rtt);
+
+  hsk_peer_destroy(slow);
+
+  int rc = hsk_pool_connect(pool, &addr);
+
+  if (rc != HSK_SUCCESS)
+    hsk_pool_log(pool, "could not connect to replacement: %s\n",
+                 hsk_strerror(rc));
+}
+
+static void
+hsk_pool_timer(hsk_pool_t *pool) {
+  hsk_peer_t *peer, *next;
+  int64_t now = hsk_now();
+
+  hsk_pool_shed(pool);
+
+  for (peer = pool->head; peer; peer = next) {
+    next = peer->next;
+
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
+
+    if (now > peer->conn_time + 60) {
+      if (peer->last_send == 0 || peer->last_recv == 0) {
+        hsk_peer_log(peer, "peer is stalling (no message)\n");
+        hsk_peer_destroy(peer);
+        continue;
+      }
+
+      if (now > peer->last_send + 20 * 60) {
+        hsk_peer_log(peer, "peer is stalling (no send)\n");
+        hsk_peer_destroy(peer);
+        continue;
+      }
+
+      if (now > peer->last_recv + 20 * 60) {
+        hsk_peer_log(peer, "peer is stalling (no recv)\n");
+        hsk_peer_destroy(peer);
+        continue;
+      }
+
+      if (peer->challenge && now > peer->last_ping + 20 * 60) {
+        hsk_peer_log(peer, "peer is stalling (ping)\n");
+        hsk_peer_destroy(peer);
+        continue;
+      }
+    }
+
+    if (now > peer->ping_timer + 30) {
+      peer->ping_timer = now;
+      if (peer->challenge) {
+        hsk_peer_log(peer, "peer has not responded to ping\n");
+      } else {
+        hsk_peer_debug(peer, "pinging...\n");
+        peer->challenge = hsk_nonce();
+        peer->last_ping = now;
+        peer->ping_start = uv_hrtime();
+        hsk_peer_send_ping(peer, peer->challenge);
+      }
+    }
+
+    if (!hsk_chain_synced(&pool->chain)) {
+      if (peer->getheaders_time && now > peer->getheaders_time + 30) {
+        hsk_peer_log(peer, "peer is stalling (headers)\n");
+        hsk_peer_destroy(peer);
+        continue;
+      }
+    }
+
+    if (peer->version_time && now > peer->version_time + 10) {
+      hsk_peer_log(peer, "peer is stalling (verack)\n");
+      hsk_peer_destroy(peer);
+      continue;
+    }
+
+    hsk_peer_expire_reqs(peer);
+
+    if (peer->proof_strikes >= HSK_PROOF_STRIKES) {
+      hsk_peer_log(peer, "peer is stalling (proofs)\n");
+      hsk_peer_destroy(peer);
+      continue;
+    }
+  }
+
+  if (now >= pool->pow_time + 10) {
+    if (pool->pow_time && pool->pow_count != pool->pow_last) {
+      uint64_t rate = (pool->pow_count - pool->pow_last)
+                    / (uint64_t)(now - pool->pow_time);
+      hsk_pool_log(pool, "verified %lu proofs of work per second\n", rate);
+    }
+    if (pool->pow_time) {
+      pool->stats.headers_rate = (pool->stats.headers - pool->headers_last)
+                               / (uint64_t)(now - pool->pow_time);
+    }
+    pool->headers_last = pool->stats.headers;
+    pool->pow_last = pool->pow_count;
+    pool->pow_time = now;
+
+    hsk_chain_log_progress(&pool->chain);
+
+    if (pool->reqs.allocs > 0) {
+      hsk_pool_log(pool, "request slab: %lu allocs, %lu reused, %lu free\n",
+                   pool->reqs.allocs, pool->reqs.reused, pool->reqs.count);
+    }
+
+    if (pool->proof_hits + pool->proof_misses > 0) {
+      hsk_pool_log(pool, "proof cache: %lu hits, %lu misses, %u cached\n",
+                   pool->proof_hits, pool->proof_misses, pool->proofs.size);
+    }
+
+    if (pool->watch.count > 0) {
+      hsk_pool_log(pool, "watchlist: %d names, %lu hits\n",
+                   pool->watch.count, pool->watch.hits);
+    }
+
+    uv_mutex_lock(&pool->nodes->lock);
+    uint64_t node_hits = pool->nodes->hits;
+    uint64_t node_misses = pool->nodes->misses;
+    uv_mutex_unlock(&pool->nodes->lock);
+
+    if (node_hits + node_misses > 0) {
+      hsk_pool_log(pool, "node cache: %lu hits, %lu misses\n",
+                   node_hits, node_misses);
+    }
+  }
+
+  if (pool->block_time && now > pool->block_time + 10 * 60) {
+    if (!pool->getheaders_time || now > pool->getheaders_time + 5 * 60) {
+      hsk_pool_log(pool, "resending getheaders to pool\n");
+      hsk_pool_send_getheaders(pool);
+    }
+  }
+
+  // Saved whenever a refresh brings new proofs
+  // in (and not retried until the next one).
+  if (pool->watch.dirty) {
+    int rc = hsk_watch_flush(&pool->watch);
+
+    if (rc != HSK_SUCCESS)
+      hsk_pool_log(pool, "could not save watchlist: %s\n", hsk_strerror(rc));
+
+    pool->watch.dirty = false;
+  }
+
+  if (pool->addr_time && now >= pool->addr_time + HSK_ADDR_FLUSH) {
+    int rc = hsk_addrman_flush(&pool->am);
+
+    if (rc != HSK_SUCCESS)
+      hsk_pool_log(pool, "could not save peers: %s\n", hsk_strerror(rc));
+
+    pool->addr_time = now;
+  }
+
+  hsk_pool_expire_pending(pool);
+  hsk_pool_resend(pool);
+
+  hsk_pool_autosize(pool);
+  hsk_pool_replace(pool, now);
+  hsk_pool_refill(pool);
+  hsk_pool_fill_keys(pool);
+}
+
+/*
+ * Peer
+ */
+
+static int
+hsk_peer_init(hsk_peer_t *peer, hsk_pool_t *pool) {
+  if (!peer || !pool)
+    return HSK_EBADARGS;
+
+  assert(pool && pool->loop);
+
+  peer->pool = (void *)pool;
+  peer->chain = &pool->chain;
+  peer->loop = pool->loop;
+  // peer->socket;
+
+  hsk_brontide_init(&peer->brontide, pool->ec);
+  peer->brontide.connect_cb = after_brontide_connect;
+  peer->brontide.connect_arg = (void *)peer;
+  peer->brontide.write_cb = brontide_do_write;
+  peer->brontide.write_arg = (void *)peer;
+  peer->brontide.read_cb = after_brontide_read;
+  peer->brontide.read_arg = (void *)peer;
+
+  if (pool->offload_size > 0) {
+    peer->brontide.offload_cb = after_brontide_offload;
+    peer->brontide.offload_arg = (void *)peer;
+    peer->brontide.offload_size = pool->offload_size;
+  }
+
+  peer->id = pool->peer_id++;
+  memset(peer->host, 0, sizeof(peer->host));
+  hsk_addr_init(&peer->addr);
+  peer->state = HSK_STATE_DISCONNECTED;
+  peer->headers = 0;
+  peer->proofs = 0;
+  peer->proof_fails = 0;
+  peer->proof_strikes = 0;
+  peer->proof_rtt = 0;
+  peer->height = 0;
+  peer->services = 0;
+  hsk_name_map_init(&peer->names);
+  hsk_wheel_init(&peer->timeouts, hsk_now());
+  memset(peer->batch_root, 0, 32);
+  peer->batch_count = 0;
+  peer->getheaders_time = 0;
+  peer->gap = false;
+  peer->version_time = 0;
+  peer->last_ping = 0;
+  peer->last_pong = 0;
+  peer->ping_start = 0;
+  peer->min_ping = 0;
+  peer->ping_timer = 0;
+  peer->challenge = 0;
+  peer->conn_time = 0;
+  peer->open_time = 0;
+  peer->handshake_rtt = 0;
+  peer->last_send = 0;
+  peer->last_recv = 0;
+  peer->msg_hdr = false;
+  peer->msg = (uint8_t *)hsk_malloc(9);
+  peer->msg_pos = 0;
+  peer->msg_len = 9;
+  peer->msg_size = 9;
+  peer->msg_cmd = 0;
+  peer->stream = false;
+  peer->stream_skip = false;
+  peer->stream_batch = NULL;
+  peer->out = NULL;
+  peer->out_size = 0;
+  peer->verify = NULL;
+  peer->proof_jobs = NULL;
+  peer->read_jobs = NULL;
+  memset(&peer->stats, 0, sizeof(peer->stats));
+  memset(peer->send_bufs, 0, sizeof(peer->send_bufs));
+  peer->send_count = 0;
+  peer->send_bytes = 0;
+  peer->send_time = 0;
+  peer->next = NULL;
+
+  if (!peer->msg)
+    goto fail;
+
+  hsk_mem_add(HSK_MEM_PEERS, peer->msg_size);
+
+  return HSK_SUCCESS;
+
+fail:
+  if (peer->msg) {
+    hsk_free(peer->msg);
+    peer->msg = NULL;
+  }
+
+  return HSK_ENOMEM;
+}
+
+static void
+hsk_peer_uninit(hsk_peer_t *peer) {
+  if (!peer)
+    return;
+
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  hsk_brontide_uninit(&peer->brontide);
+
+  hsk_name_map_t *map = &peer->names;
+  uint32_t it;
+
+  for (it = hsk_tmap_begin(map); it != hsk_tmap_end(map); it++) {
+    if (!hsk_tmap_exists(map, it))
+      continue;
+
+    hsk_name_req_t *req = hsk_tmap_value(map, it);
+    hsk_name_req_t *next;
+
+    for (; req; req = next) {
+      next = req->next;
+      hsk_name_req_free(pool, req);
+    }
+  }
+
+  hsk_name_map_uninit(&peer->names);
+
+  hsk_wheel_uninit(&peer->timeouts);
+
+  int i;
+  for (i = 0; i < peer->send_count; i++)
+    hsk_free(peer->send_bufs[i].base);
+
+  peer->send_count = 0;
+  peer->send_bytes = 0;
+
+  if (peer->msg) {
+    hsk_mem_sub(HSK_MEM_PEERS, peer->msg_size);
+    hsk_free(peer->msg);
+    peer->msg = NULL;
+  }
+
+  if (peer->out) {
+    hsk_mem_sub(HSK_MEM_PEERS, peer->out_size);
+    hsk_free(peer->out);
+    peer->out = NULL;
+  }
+
+  peer->msg_size = 0;
+  peer->out_size = 0;
+}
+
+static hsk_peer_t *
+hsk_peer_alloc(hsk_pool_t *pool) {
+  hsk_peer_t *peer = hsk_malloc(sizeof(hsk_peer_t));
+
+  if (!peer)
+    return NULL;
+
+  hsk_mem_add(HSK_MEM_PEERS, sizeof(hsk_peer_t));
+
+  if (hsk_peer_init(peer, pool) != HSK_SUCCESS) {
+    hsk_peer_free(peer);
+    return NULL;
+  }
+
+  return peer;
+}
+
+static void
+hsk_peer_free(hsk_peer_t *peer) {
+  if (!peer)
+    return;
+
+  hsk_peer_uninit(peer);
+  hsk_mem_sub(HSK_MEM_PEERS, sizeof(hsk_peer_t));
+  hsk_free(peer);
+}
+
+static int
+hsk_peer_open(hsk_peer_t *peer, const hsk_addr_t *addr) {
+  assert(peer && addr);
+  assert(peer->pool && peer->loop && peer->state == HSK_STATE_DISCONNECTED);
+
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  uv_loop_t *loop = pool->loop;
+
+  if (uv_tcp_init(loop, &peer->socket) != 0)
+    return HSK_EFAILURE;
+
+  peer->socket.data = (void *)peer;
+
+  hsk_addr_copy(&peer->addr, addr);
+
+  if (!hsk_addr_to_string(addr, peer->host, HSK_MAX_HOST, HSK_PORT))
+    return HSK_EBADARGS;
+
+  uv_connect_t *conn = hsk_malloc(sizeof(uv_connect_t));
+
+  if (!conn)
+    return HSK_ENOMEM;
+
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+
+  assert(hsk_addr_to_sa(addr, sa));
+
+  assert(hsk_brontide_connect(&peer->brontide, pool->key, addr->key) == 0);
+
+  const uint8_t *pubkey = pool->key ? pool->pubkey : NULL;
+
+  if (pool->ephemeral_count > 0) {
+    int i = --pool->ephemeral_count;
+
+    hsk_brontide_set_keys(&peer->brontide, pubkey,
+                          pool->ephemeral[i], pool->ephemeral_pub[i]);
+
+    memset(pool->ephemeral[i], 0, 32);
+  } else {
+    hsk_brontide_set_keys(&peer->brontide, pubkey, NULL, NULL);
+  }
+
+  hsk_pool_queue_keys(pool);
+
+  if (uv_tcp_connect(conn, &peer->socket, sa, on_connect) != 0) {
+    hsk_free(conn);
+    return HSK_EFAILURE;
+  }
+
+  peer->state = HSK_STATE_CONNECTING;
+  peer->open_time = uv_now(loop);
+  pool->stats.connects += 1;
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_close(hsk_peer_t *peer) {
+  switch (peer->state) {
+    case HSK_STATE_DISCONNECTING:
+      return HSK_SUCCESS;
+    case HSK_STATE_HANDSHAKE:
+      hsk_brontide_destroy(&peer->brontide);
+    case HSK_STATE_READING:
+      assert(uv_read_stop((uv_stream_t *)&peer->socket) == 0);
+    case HSK_STATE_CONNECTED:
+    case HSK_STATE_CONNECTING:
+      uv_close((uv_handle_t *)&peer->socket, after_close);
+      hsk_peer_log(peer, "closing peer\n");
+      break;
+    case HSK_STATE_DISCONNECTED:
+      hsk_peer_log(peer, "closed peer (never opened)\n");
+      hsk_peer_remove(peer);
+      hsk_peer_free(peer);
+      return HSK_SUCCESS;
+    default:
+      assert(false);
+      break;
+  }
+
+  peer->state = HSK_STATE_DISCONNECTING;
+  ((hsk_pool_t *)peer->pool)->stats.disconnects += 1;
+  hsk_peer_timeout_reqs(peer);
+  hsk_peer_remove(peer);
+
+  hsk_pool_schedule_refill((hsk_pool_t *)peer->pool);
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_destroy(hsk_peer_t *peer) {
+  return hsk_peer_close(peer);
+}
+
+static void
+hsk_peer_log(hsk_peer_t *peer, const char *fmt, ...) {
+  char prefix[HSK_MAX_HOST + 32];
+  sprintf(prefix, "peer %lu (%s): ", peer->id, peer->host);
+
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf(prefix, fmt, args);
+  va_end(args);
+}
+
+static void
+hsk_peer_push(hsk_peer_t *peer) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  if (!peer)
+    return;
+
+  peer->next = NULL;
+
+  if (!pool->head)
+    pool->head = peer;
+
+  if (pool->tail)
+    pool->tail->next = peer;
+
+  pool->tail = peer;
+  pool->size += 1;
+
+  assert(!hsk_map_has(&pool->peers, &peer->addr));
+  hsk_map_set(&pool->peers, &peer->addr, peer);
+}
+
+static void
+hsk_peer_remove(hsk_peer_t *peer) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  if (!peer)
+    return;
+
+  if (!pool->head)
+    return;
+
+  if (pool->head == peer) {
+    if (pool->tail == peer)
+      pool->tail = NULL;
+    pool->head = peer->next;
+    peer->next = NULL;
+    assert(pool->size > 0);
+    pool->size -= 1;
+    assert(hsk_map_del(&pool->peers, &peer->addr));
+    return;
+  }
+
+  hsk_peer_t *prev;
+
+  // O(n), but who cares.
+  for (prev = pool->head; prev; prev = prev->next) {
+    if (prev->next == peer)
+      break;
+  }
+
+  if (!prev)
+    return;
+
+  if (pool->tail == peer)
+    pool->tail = prev;
+
+  prev->next = peer->next;
+
+  assert(pool->size > 0);
+  pool->size -= 1;
+
+  assert(hsk_map_del(&pool->peers, &peer->addr));
+}
+
+static int
+hsk_peer_write(
+  hsk_peer_t *peer,
+  uint8_t *data,
+  size_t data_len,
+  bool should_free
+) {
+  if (peer->state != HSK_STATE_HANDSHAKE) {
+    if (should_free)
+      hsk_free(data);
+    return HSK_SUCCESS;
+  }
+
+  if (!should_free)
+    return hsk_brontide_send(&peer->brontide, data, data_len);
+
+  return hsk_brontide_write(&peer->brontide, data, data_len);
+}
+
+static int
+hsk_peer_write_raw(
+  hsk_peer_t *peer,
+  uint8_t *data,
+  size_t data_len,
+  bool should_free
+) {
+  if (peer->state == HSK_STATE_DISCONNECTING) {
+    if (should_free)
+      hsk_free(data);
+    return HSK_SUCCESS;
+  }
+
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  if (!should_free) {
+    uint8_t *buf = hsk_malloc(data_len);
+
+    if (!buf)
+      return HSK_ENOMEM;
+
+    memcpy(buf, data, data_len);
+    data = buf;
+  }
+
+  if (peer->send_count == HSK_SEND_BUFS) {
+    int rc = hsk_peer_flush(peer);
+
+    if (rc != HSK_SUCCESS) {
+      hsk_free(data);
+      return rc;
+    }
+  }
+
+  if (peer->send_count == 0) {
+    uv_timer_t *timer = &pool->flush_timer;
+
+    peer->send_time = uv_now(peer->loop);
+
+    if (pool->flush_delay > 0 && !uv_is_active((uv_handle_t *)timer))
+      uv_timer_start(timer, after_flush_timer, pool->flush_delay, 0);
+  }
+
+  uv_buf_t *buf = &peer->send_bufs[peer->send_count++];
+
+  buf->base = (char *)data;
+  buf->len = data_len;
+
+  peer->send_bytes += data_len;
+
+  if (peer->send_bytes >= pool->flush_bytes)
+    return hsk_peer_flush(peer);
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_flush(hsk_peer_t *peer) {
+  if (peer->send_count == 0)
+    return HSK_SUCCESS;
+
+  hsk_write_data_t *wd = (hsk_write_data_t *)hsk_malloc(sizeof(hsk_write_data_t));
+  int i;
+
+  if (!wd) {
+    hsk_peer_destroy(peer);
+    return HSK_ENOMEM;
+  }
+
+  wd->peer = peer;
+  wd->count = peer->send_count;
+
+  memcpy(wd->bufs, peer->send_bufs, wd->count * sizeof(uv_buf_t));
+
+  peer->send_count = 0;
+  peer->send_bytes = 0;
+
+  uv_write_t *req = &wd->req;
+  req->data = (void *)wd;
+
+  uv_stream_t *stream = (uv_stream_t *)&peer->socket;
+
+  int status = uv_write(req, stream, wd->bufs, wd->count, after_write);
+
+  if (status != 0) {
+    for (i = 0; i < wd->count; i++)
+      hsk_free(wd->bufs[i].base);
+
+    hsk_free(wd);
+
+    hsk_peer_log(peer, "failed writing: %s\n", uv_strerror(status));
+    hsk_peer_destroy(peer);
+
+    return HSK_EFAILURE;
+  }
+
+  peer->last_send = hsk_now();
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_send(hsk_peer_t *peer, const hsk_msg_t *msg) {
+  int msg_size = hsk_msg_size(msg);
+  assert(msg_size != -1);
+
+  size_t size = 9 + msg_size;
+
+  // Messages are serialized into a buffer owned
+  // by the peer; brontide encrypts out of it.
+  if (size > peer->out_size || peer->out_size > HSK_MSG_KEEP) {
+    uint8_t *out = hsk_realloc(peer->out, size);
+
+    if (!out)
+      return HSK_ENOMEM;
+
+    hsk_mem_sub(HSK_MEM_PEERS, peer->out_size);
+    hsk_mem_add(HSK_MEM_PEERS, size);
+
+    peer->out = out;
+    peer->out_size = size;
+  }
+
+  uint8_t *data = peer->out;
+  uint8_t *buf = data;
+
+  // Magic Number
+  write_u32(&buf, HSK_MAGIC);
+
+  // Command
+  write_u8(&buf, msg->cmd);
+
+  // Msg Size
+  write_u32(&buf, msg_size);
+
+  // Msg
+  hsk_msg_write(msg, &buf);
+
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  peer->stats.msgs_out += 1;
+  pool->stats.msgs_out += 1;
+
+  return hsk_peer_write(peer, data, size, false);
+}
+
+static int
+hsk_peer_send_version(hsk_peer_t *peer) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  hsk_version_msg_t msg = { .cmd = HSK_MSG_VERSION };
+  hsk_msg_init((hsk_msg_t *)&msg);
+
+  msg.version = HSK_PROTO_VERSION;
+  msg.services = HSK_SERVICES;
+  msg.time = hsk_timedata_now(&pool->td);
+
+  const hsk_addrentry_t *entry = hsk_addrman_get(&pool->am, &peer->addr);
+
+  if (entry) {
+    msg.remote.time = entry->time;
+    msg.remote.services = entry->services;
+  }
+
+  hsk_addr_copy(&msg.remote.addr, &peer->addr);
+
+  msg.nonce = hsk_nonce();
+  strcpy(msg.agent, HSK_USER_AGENT);
+  msg.height = (uint32_t)pool->chain.height;
+
+  peer->version_time = hsk_now();
+
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_send_verack(hsk_peer_t *peer) {
+  hsk_version_msg_t msg = { .cmd = HSK_MSG_VERACK };
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_send_ping(hsk_peer_t *peer, uint64_t nonce) {
+  hsk_ping_msg_t msg = {
+    .cmd = HSK_MSG_PING,
+    .nonce = nonce
+  };
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_send_pong(hsk_peer_t *peer, uint64_t nonce) {
+  hsk_pong_msg_t msg = {
+    .cmd = HSK_MSG_PONG,
+    .nonce = nonce
+  };
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_send_sendheaders(hsk_peer_t *peer) {
+  hsk_version_msg_t msg = { .cmd = HSK_MSG_SENDHEADERS };
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_send_getheaders(hsk_peer_t *peer, const uint8_t *stop) {
+  hsk_getheaders_msg_t msg = { .cmd = HSK_MSG_GETHEADERS };
+
+  hsk_msg_init((hsk_msg_t *)&msg);
+
+  hsk_chain_get_locator(peer->chain, &msg);
+
+  if (stop)
+    memcpy(msg.stop, stop, 32);
+
+  peer->getheaders_time = hsk_now();
+
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+// Headers from just below our tip up to `stop`.
+static int
+hsk_peer_send_getheaders_gap(hsk_peer_t *peer, const uint8_t *stop) {
+  hsk_getheaders_msg_t msg = { .cmd = HSK_MSG_GETHEADERS };
+
+  hsk_msg_init((hsk_msg_t *)&msg);
+
+  hsk_chain_get_tip_locator(peer->chain, &msg, HSK_TIP_LOCATOR);
+
+  memcpy(msg.stop, stop, 32);
+
+  peer->getheaders_time = hsk_now();
+
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_send_getheaders_after(hsk_peer_t *peer, const uint8_t *last) {
+  hsk_getheaders_msg_t msg = { .cmd = HSK_MSG_GETHEADERS };
+
+  hsk_msg_init((hsk_msg_t *)&msg);
+
+  hsk_chain_get_locator(peer->chain, &msg);
+
+  size_t max = sizeof(msg.hashes) / sizeof(msg.hashes[0]);
+
+  if (msg.hash_count == max)
+    msg.hash_count -= 1;
+
+  memmove(msg.hashes[1], msg.hashes[0], msg.hash_count * 32);
+  memcpy(msg.hashes[0], last, 32);
+
+  msg.hash_count += 1;
+
+  peer->getheaders_time = hsk_now();
+
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_flush_getproofs(hsk_peer_t *peer) {
+  if (peer->batch_count == 0)
+    return HSK_SUCCESS;
+
+  if (peer->batch_count == 1) {
+    hsk_getproof_msg_t msg = { .cmd = HSK_MSG_GETPROOF };
+    hsk_msg_init((hsk_msg_t *)&msg);
+
+    memcpy(msg.key, peer->batch[0], 32);
+    memcpy(msg.root, peer->batch_root, 32);
+
+    peer->batch_count = 0;
+
+    return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+  }
+
+  // Peers that can dedupe shared nodes get the
+  // same keys as one getmultiproof.
+  uint8_t cmd = HSK_MSG_GETPROOFS;
+
+  if (peer->services & HSK_SERVICE_MULTIPROOF)
+    cmd = HSK_MSG_GETMULTIPROOF;
+
+  hsk_getproofs_msg_t msg = { .cmd = cmd };
+  hsk_msg_init((hsk_msg_t *)&msg);
+
+  memcpy(msg.root, peer->batch_root, 32);
+  memcpy(msg.keys, peer->batch, peer->batch_count * 32);
+  msg.key_count = peer->batch_count;
+
+  peer->batch_count = 0;
+
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+static int
+hsk_peer_send_getproof(
+  hsk_peer_t *peer,
+  const uint8_t *name_hash,
+  const uint8_t *root
+) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  uv_timer_t *timer = &pool->hedge_timer;
+
+  if (pool->hedge_percentile > 0 && !uv_is_active((uv_handle_t *)timer))
+    uv_timer_start(timer, after_hedge_timer, HSK_HEDGE_TICK, HSK_HEDGE_TICK);
+
+  // Checked again when it fires: the request
+  // may be answered or gone by then.
+  int64_t deadline = hsk_now() + pool->proof_timeout + 1;
+
+  if (!hsk_wheel_add(&peer->timeouts, deadline, name_hash))
+    return HSK_ENOMEM;
+
+  // Keys under the same root are collected and
+  // sent together at the end of the loop
+  // iteration (see after_check). Peers without
+  // batch support get one getproof each.
+  if (peer->batch_count > 0 && memcmp(peer->batch_root, root, 32) != 0) {
+    int rc = hsk_peer_flush_getproofs(peer);
+
+    if (rc != HSK_SUCCESS)
+      return rc;
+  }
+
+  memcpy(peer->batch_root, root, 32);
+  memcpy(peer->batch[peer->batch_count], name_hash, 32);
+  peer->batch_count += 1;
+
+  if (!(peer->services & (HSK_SERVICE_PROOFS | HSK_SERVICE_MULTIPROOF))
+      || peer->batch_count == HSK_MAX_PROOFS) {
+    return hsk_peer_flush_getproofs(peer);
+  }
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_handle_version(hsk_peer_t *peer, const hsk_version_msg_t *msg) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  hsk_peer_log(peer, "received version: %s (%u)\n", msg->agent, msg->height);
+  peer->height = (int64_t)msg->height;
+  peer->services = msg->services;
+
+  hsk_timedata_add(&pool->td, &peer->addr, msg->time);
+  hsk_addrman_mark_ack(&pool->am, &peer->addr, msg->services);
+
+  return hsk_peer_send_verack(peer);
+}
+
+static int
+hsk_peer_handle_verack(hsk_peer_t *peer, const hsk_verack_msg_t *msg) {
+  peer->version_time = 0;
+
+  int rc = hsk_peer_send_sendheaders(peer);
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  hsk_pool_resend((hsk_pool_t *)peer->pool);
+
+  return hsk_peer_send_getheaders(peer, NULL);
+}
+
+static int
+hsk_peer_handle_ping(hsk_peer_t *peer, const hsk_ping_msg_t *msg) {
+  return hsk_peer_send_pong(peer, msg->nonce);
+}
+
+static int
+hsk_peer_handle_pong(hsk_peer_t *peer, const hsk_pong_msg_t *msg) {
+  if (!peer->challenge) {
+    hsk_peer_log(peer, "peer sent an unsolicited pong\n");
+    return HSK_SUCCESS;
+  }
+
+  if (msg->nonce != peer->challenge) {
+    if (msg->nonce == 0) {
+      hsk_peer_log(peer, "peer sent a zero nonce\n");
+      peer->challenge = 0;
+      return HSK_SUCCESS;
+    }
+    hsk_peer_log(peer, "peer sent the wrong nonce\n");
+    return HSK_SUCCESS;
+  }
+
+  hsk_peer_debug(peer, "received pong\n");
+
+  uint64_t mark = uv_hrtime();
+
+  if (peer->ping_start != 0 && mark >= peer->ping_start) {
+    // Round to at least 1ms so a local peer
+    // doesn't read as "never measured".
+    int64_t min = (int64_t)((mark - peer->ping_start) / 1000000);
+    if (min == 0)
+      min = 1;
+    peer->last_pong = hsk_now();
+    if (!peer->min_ping)
+      peer->min_ping = min;
+    peer->min_ping = peer->min_ping < min ? peer->min_ping : min;
+  } else {
+    hsk_peer_log(peer, "timing mismatch\n");
+  }
+
+  peer->challenge = 0;
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_handle_addr(hsk_peer_t *peer, hsk_addr_msg_t *msg) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  if (msg->addr_count > 1000)
+    return HSK_EFAILURE;
+
+  int64_t now = hsk_timedata_now(&pool->td);
+  size_t count = 0;
+
+  // Keep the usable ones at the front.
+  int i;
+  for (i = 0; i < msg->addr_count; i++) {
+    hsk_netaddr_t *addr = &msg->addrs[i];
+
+    if (!hsk_addr_is_routable(&addr->addr))
+      continue;
+
+    if (!(addr->services & 1))
+      continue;
+
+    if (addr->time <= 100000000 || addr->time > now + 10 * 60)
+      addr->time = now - 5 * 24 * 60 * 60;
+
+    if (addr->addr.port == 0)
+      continue;
+
+    if (!hsk_addr_has_key(&addr->addr))
+      continue;
+
+    if (&msg->addrs[count] != addr)
+      msg->addrs[count] = *addr;
+
+    count += 1;
+  }
+
+  size_t added = hsk_addrman_add_nas(&pool->am, msg->addrs, count);
+
+  hsk_peer_log(peer, "received %u addrs (%zu new)\n",
+               msg->addr_count, added);
+
+  return HSK_SUCCESS;
+}
+
+// Add up to `limit` more headers of a checked
+// batch to the chain. The batch is finished
+// once its cursor is NULL.
+static int
+hsk_peer_add_headers(hsk_peer_t *peer, hsk_verify_t *batch, size_t *limit) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  hsk_header_t *hdr = batch->cursor;
+
+  for (; hdr && *limit > 0; hdr = hdr->next, *limit -= 1) {
+    int rc = hsk_chain_add_verified(peer->chain, hdr, peer->id);
+
+    if (rc != HSK_SUCCESS
+        && rc != HSK_EORPHAN
+        && rc != HSK_EDUPLICATEORPHAN) {
+      batch->cursor = NULL;
+    }
+
+    if (rc == HSK_ETIMETOOOLD
+        || rc == HSK_EBADDIFFBITS
+        || rc == HSK_ECHECKPOINT) {
+      hsk_peer_log(peer, "failed adding block: %s\n", hsk_strerror(rc));
+
+      if (!hsk_addrman_add_ban(&pool->am, &peer->addr))
+        return HSK_ENOMEM;
+
+      hsk_peer_destroy(peer);
+      return rc;
+    }
+
+    if (rc == HSK_ETIMETOONEW) {
+      hsk_peer_log(peer, "failed adding block: %s\n", hsk_strerror(rc));
+      hsk_peer_destroy(peer);
+      return rc;
+    }
+
+    if (rc == HSK_EORPHAN || rc == HSK_EDUPLICATEORPHAN) {
+      if (!batch->orphan)
+        hsk_peer_log(peer, "failed adding orphan\n");
+      batch->orphan = true;
+      continue;
+    }
+
+    if (rc != HSK_SUCCESS) {
+      hsk_peer_log(peer, "failed adding block: %s\n", hsk_strerror(rc));
+      return rc;
+    }
+
+    peer->headers += 1;
+  }
+
+  batch->cursor = hdr;
+
+  if (hdr)
+    return HSK_SUCCESS;
+
+  if (batch->orphan) {
+    hsk_header_t *hdr = batch->headers;
+    const uint8_t *hash = hsk_header_cache(hdr);
+    hsk_peer_log(peer, "peer sent orphan: %s\n", hsk_hex_encode32(hash));
+
+    // An announcement a few blocks ahead of us:
+    // ask for what is missing before it.
+    if (!peer->gap && !batch->requested && hsk_chain_synced(peer->chain)) {
+      hsk_peer_log(peer, "peer requesting gap\n");
+      peer->gap = true;
+      hsk_peer_send_getheaders_gap(peer, hdr->prev_block);
+      return HSK_SUCCESS;
+    }
+
+    peer->gap = false;
+    hsk_peer_log(peer, "peer sending orphan locator\n");
+    hsk_peer_send_getheaders(peer, NULL);
+    return HSK_SUCCESS;
+  }
+
+  peer->gap = false;
+
+  pool->block_time = hsk_now();
+
+  hsk_pool_maybe_refresh(pool);
+
+  if (batch->header_count == 2000 && !batch->requested) {
+    hsk_peer_log(peer, "requesting more headers\n");
+    return hsk_peer_send_getheaders(peer, NULL);
+  }
+
+  return HSK_SUCCESS;
+}
+
+// Headers messages are parsed as they arrive
+// (see hsk_peer_stream). Once the count is
+// read, a batch is set up for them, or NULL
+// if there are none or the queue is full.
+static hsk_verify_t *
+hsk_peer_headers_start(hsk_peer_t *peer, size_t count) {
+  // Whatever we asked for is being answered.
+  peer->getheaders_time = 0;
+
+  if (count == 0) {
+    hsk_peer_log(peer, "received 0 headers\n");
+    return NULL;
+  }
+
+  int queued = 0;
+  hsk_verify_t *b;
+
+  for (b = (hsk_verify_t *)peer->verify; b; b = b->next)
+    queued += 1;
+
+  if (queued >= HSK_VERIFY_QUEUE) {
+    hsk_peer_log(peer, "ignoring headers (verify queue full)\n");
+    return NULL;
+  }
+
+  return hsk_verify_alloc((hsk_pool_t *)peer->pool, peer, count);
+}
+
+static hsk_verify_t *
+hsk_verify_alloc(hsk_pool_t *pool, hsk_peer_t *peer, size_t count) {
+  // All headers live in a single allocation,
+  // linked up front: jobs walk their run of
+  // it while the rest is still being read.
+  hsk_header_t *headers = hsk_malloc(count * sizeof(hsk_header_t));
+
+  if (!headers)
+    return NULL;
+
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    hsk_header_init(&headers[i]);
+
+    if (i > 0)
+      headers[i - 1].next = &headers[i];
+  }
+
+  hsk_verify_t *batch = hsk_malloc(sizeof(hsk_verify_t));
+
+  if (!batch) {
+    hsk_free(headers);
+    return NULL;
+  }
+
+  batch->pool = pool;
+  batch->peer = peer;
+  batch->headers = headers;
+  batch->header_count = count;
+  batch->requested = false;
+  batch->pending = 0;
+  batch->rc = HSK_SUCCESS;
+  batch->cursor = headers;
+  batch->orphan = false;
+  batch->filled = 0;
+  batch->height = -1;
+  batch->last = NULL;
+  batch->per = (count + HSK_VERIFY_JOBS - 1) / HSK_VERIFY_JOBS;
+  batch->job_count = 0;
+  memset(batch->jobs, 0, sizeof(batch->jobs));
+  batch->next = NULL;
+
+  return batch;
+}
+
+static void
+hsk_verify_queue(hsk_peer_t *peer, hsk_verify_t *batch) {
+  hsk_verify_job_t *job = &batch->jobs[batch->job_count];
+
+  batch->job_count += 1;
+  batch->pending += 1;
+
+  assert(uv_queue_work(peer->loop, &job->req, on_verify, after_verify) == 0);
+}
+
+// The next header of the batch has been read.
+// Its proof of work is checked on the thread
+// pool as soon as a job's worth are in.
+static int
+hsk_peer_headers_add(hsk_peer_t *peer, hsk_verify_t *batch) {
+  hsk_header_t *hdr = &batch->headers[batch->filled];
+
+  if (batch->last && memcmp(hdr->prev_block, batch->last, 32) != 0) {
+    hsk_peer_log(peer, "invalid header chain\n");
+    return HSK_EHASHMISMATCH;
+  }
+
+  // Height of the first header, if it connects.
+  if (batch->filled == 0) {
+    hsk_entry_t *start = hsk_chain_get(peer->chain, hdr->prev_block);
+
+    batch->height = start ? (int64_t)start->height + 1 : -1;
+  }
+
+  // Note: this also fills the hash cache
+  // before the header is shared with workers.
+  batch->last = hsk_header_cache(hdr);
+  batch->filled += 1;
+
+  // Checked against the checkpoints by the chain.
+  if (batch->height != -1
+      && hsk_chain_below_checkpoint(peer->chain, batch->height)) {
+    batch->height += 1;
+    return HSK_SUCCESS;
+  }
+
+  batch->height = -1;
+
+  assert(batch->job_count < HSK_VERIFY_JOBS);
+
+  hsk_verify_job_t *job = &batch->jobs[batch->job_count];
+
+  if (job->count == 0) {
+    job->req.data = (void *)job;
+    job->batch = (void *)batch;
+    job->start = hdr;
+    job->checked = 0;
+    job->time = 0;
+    job->rc = HSK_SUCCESS;
+  }
+
+  job->count += 1;
+
+  if (job->count == batch->per)
+    hsk_verify_queue(peer, batch);
+
+  return HSK_SUCCESS;
+}
+
+// Every header is in: queue the batch to be
+// added to the chain once checked.
+static void
+hsk_peer_headers_finish(hsk_peer_t *peer, hsk_verify_t *batch) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  hsk_peer_log(peer, "received %zu headers\n", batch->header_count);
+
+  peer->stats.headers += batch->header_count;
+  pool->stats.headers += batch->header_count;
+
+  if (batch->job_count < HSK_VERIFY_JOBS
+      && batch->jobs[batch->job_count].count > 0) {
+    hsk_verify_queue(peer, batch);
+  }
+
+  int queued = 0;
+  hsk_verify_t *tail = NULL;
+  hsk_verify_t *b;
+
+  for (b = (hsk_verify_t *)peer->verify; b; b = b->next) {
+    tail = b;
+    queued += 1;
+  }
+
+  if (tail)
+    tail->next = batch;
+  else
+    peer->verify = (void *)batch;
+
+  // During initial sync, ask for the next batch
+  // now so the round trip overlaps with checking
+  // this one. The locator starts from the last
+  // header even though it is not in the chain yet.
+  if (batch->header_count == 2000
+      && !hsk_chain_synced(peer->chain)
+      && queued + 1 < HSK_VERIFY_QUEUE) {
+    hsk_peer_debug(peer, "pipelining getheaders\n");
+    batch->requested = true;
+    hsk_peer_send_getheaders_after(peer, batch->last);
+  }
+
+  hsk_peer_drain_verify(peer);
+}
+
+// A batch whose message turned out bad. Jobs
+// already queued finish without it.
+static void
+hsk_verify_abandon(hsk_verify_t *batch) {
+  batch->peer = NULL;
+
+  if (batch->pending == 0)
+    hsk_verify_free(batch);
+}
+
+/*
+ * Import
+ */
+
+static void
+after_import_verify(uv_work_t *req, int status) {
+  hsk_verify_job_t *job = (hsk_verify_job_t *)req->data;
+  hsk_verify_t *batch = (hsk_verify_t *)job->batch;
+
+  if (status != 0 && job->rc == HSK_SUCCESS)
+    job->rc = HSK_EFAILURE;
+
+  if (job->rc != HSK_SUCCESS && batch->rc == HSK_SUCCESS)
+    batch->rc = job->rc;
+
+  batch->pool->pow_count += job->checked;
+  hsk_chain_count_pow(&batch->pool->chain, job->checked, job->time);
+
+  assert(batch->pending > 0);
+
+  batch->pending -= 1;
+}
+
+// Read one serialized header. Returns false at
+// the end of the file, with `rc` set if the
+// file ends partway into a header.
+static bool
+hsk_import_header(FILE *file, hsk_header_t *hdr, int *rc) {
+  uint8_t raw[HSK_HEADERS_PART_MAX];
+  size_t size = fread(raw, 1, 165, file);
+
+  if (size != 165) {
+    if (size != 0 || ferror(file))
+      *rc = HSK_EENCODING;
+    return false;
+  }
+
+  if (raw[164] > 42) {
+    *rc = HSK_EENCODING;
+    return false;
+  }
+
+  size_t sol_size = ((size_t)raw[164]) << 2;
+
+  if (fread(raw + 165, 1, sol_size, file) != sol_size
+      || !hsk_header_decode(raw, 165 + sol_size, hdr)) {
+    *rc = HSK_EENCODING;
+    return false;
+  }
+
+  return true;
+}
+
+// Read up to HSK_IMPORT_BATCH headers into a
+// batch, queueing their proofs of work as
+// they come in, like a headers message. The
+// batch is NULL once the file is used up.
+static int
+hsk_import_batch(
+  hsk_pool_t *pool,
+  FILE *file,
+  hsk_verify_t **out,
+  int64_t *height,
+  uint8_t *last
+) {
+  hsk_verify_t *batch = hsk_verify_alloc(pool, NULL, HSK_IMPORT_BATCH);
+  int rc = HSK_SUCCESS;
+
+  *out = NULL;
+
+  if (!batch)
+    return HSK_ENOMEM;
+
+  while (batch->filled < HSK_IMPORT_BATCH) {
+    hsk_header_t *hdr = &batch->headers[batch->filled];
+
+    if (!hsk_import_header(file, hdr, &rc))
+      break;
+
+    // The first header must build on our tip
+    // (or something below it), the rest on the
+    // one before.
+    if (*height == -1) {
+      hsk_entry_t *prev = hsk_chain_get(&pool->chain, hdr->prev_block);
+
+      if (!prev) {
+        hsk_pool_log(pool, "imported headers do not connect\n");
+        rc = HSK_EORPHAN;
+        break;
+      }
+
+      *height = (int64_t)prev->height + 1;
+    } else if (memcmp(hdr->prev_block, last, 32) != 0) {
+      hsk_pool_log(pool, "invalid header chain at height %u\n",
+                   (uint32_t)*height);
+      rc = HSK_EHASHMISMATCH;
+      break;
+    } else {
+      *height += 1;
+    }
+
+    memcpy(last, hsk_header_cache(hdr), 32);
+
+    batch->filled += 1;
+
+    if (hsk_chain_below_checkpoint(&pool->chain, *height))
+      continue;
+
+    hsk_verify_job_t *job = &batch->jobs[batch->job_count];
+
+    if (job->count == 0) {
+      job->req.data = (void *)job;
+      job->batch = (void *)batch;
+      job->start = hdr;
+      job->checked = 0;
+      job->time = 0;
+      job->rc = HSK_SUCCESS;
+    }
+
+    job->count += 1;
+
+    if (job->count == batch->per) {
+      batch->job_count += 1;
+      batch->pending += 1;
+      assert(uv_queue_work(pool->loop, &job->req,
+                           on_verify, after_import_verify) == 0);
+    }
+  }
+
+  if (batch->job_count < HSK_VERIFY_JOBS
+      && batch->jobs[batch->job_count].count > 0) {
+    hsk_verify_job_t *job = &batch->jobs[batch->job_count];
+
+    batch->job_count += 1;
+    batch->pending += 1;
+    assert(uv_queue_work(pool->loop, &job->req,
+                         on_verify, after_import_verify) == 0);
+  }
+
+  if (batch->filled == 0) {
+    assert(batch->pending == 0);
+    hsk_verify_free(batch);
+    return rc;
+  }
+
+  batch->header_count = batch->filled;
+  batch->headers[batch->filled - 1].next = NULL;
+
+  *out = batch;
+
+  return rc;
+}
+
+// Wait out the jobs of a batch and free it.
+static void
+hsk_import_drop(hsk_pool_t *pool, hsk_verify_t *batch) {
+  while (batch->pending > 0)
+    uv_run(pool->loop, UV_RUN_ONCE);
+
+  hsk_verify_free(batch);
+}
+
+int
+hsk_pool_import_headers(hsk_pool_t *pool, const char *path) {
+  if (!pool || !path)
+    return HSK_EBADARGS;
+
+  FILE *file = fopen(path, "rb");
+
+  if (!file)
+    return HSK_EFAILURE;
+
+  uint64_t start = uv_hrtime();
+  int64_t height = -1;
+  uint8_t last[32];
+  hsk_verify_t *head = NULL;
+  hsk_verify_t *tail = NULL;
+  int queued = 0;
+  bool done = false;
+  size_t added = 0;
+  size_t skipped = 0;
+  int read_rc = HSK_SUCCESS;
+  int rc = HSK_SUCCESS;
+
+  // Up to HSK_VERIFY_QUEUE batches are read
+  // ahead, so the disk and the thread pool are
+  // kept busy while the oldest is added. What
+  // was read before a bad header still goes in.
+  for (;;) {
+    while (!done && queued < HSK_VERIFY_QUEUE) {
+      hsk_verify_t *batch;
+
+      read_rc = hsk_import_batch(pool, file, &batch, &height, last);
+
+      if (batch) {
+        if (tail)
+          tail->next = batch;
+        else
+          head = batch;
+        tail = batch;
+        queued += 1;
+      }
+
+      if (read_rc != HSK_SUCCESS
+          || !batch
+          || batch->filled < HSK_IMPORT_BATCH) {
+        done = true;
+      }
+    }
+
+    if (!head)
+      break;
+
+    hsk_verify_t *batch = head;
+
+    while (batch->pending > 0)
+      uv_run(pool->loop, UV_RUN_ONCE);
+
+    if (batch->rc != HSK_SUCCESS) {
+      rc = batch->rc;
+      hsk_pool_log(pool, "imported header failed verification: %s\n",
+                   hsk_strerror(rc));
+      goto fail;
+    }
+
+    hsk_header_t *hdr;
+
+    for (hdr = batch->headers; hdr; hdr = hdr->next) {
+      rc = hsk_chain_add_verified(&pool->chain, hdr, 0);
+
+      // Already stored (an earlier import).
+      if (rc == HSK_EDUPLICATE) {
+        skipped += 1;
+        continue;
+      }
+
+      if (rc != HSK_SUCCESS) {
+        hsk_pool_log(pool, "failed adding imported header: %s\n",
+                     hsk_strerror(rc));
+        goto fail;
+      }
+
+      added += 1;
+    }
+
+    head = batch->next;
+
+    if (!head)
+      tail = NULL;
+
+    queued -= 1;
+
+    hsk_verify_free(batch);
+  }
+
+  rc = read_rc;
+
+fail:
+  while (head) {
+    hsk_verify_t *next = head->next;
+    hsk_import_drop(pool, head);
+    head = next;
+  }
+
+  fclose(file);
+
+  double secs = (double)(uv_hrtime() - start) / 1e9;
+
+  hsk_pool_log(pool,
+    "imported %zu headers (%zu known) in %.1fs (%.0f headers/sec)\n",
+    added, skipped, secs, secs > 0 ? (double)added / secs : 0.0);
+
+  hsk_pool_log(pool, "chain height: %u\n", (uint32_t)pool->chain.height);
+
+  return rc;
+}
+
+// Complete the requests waiting on a verified
+// proof. The one sent to this peer may be gone
+// (timed out and retried elsewhere) by the time
+// a worker has checked it.
+static void
+hsk_name_req_served(hsk_name_req_t *reqs, uint64_t peer, uint64_t verify) {
+  hsk_name_req_t *req;
+
+  for (req = reqs; req; req = req->next) {
+    req->trace.peer = peer;
+    req->trace.verify = verify;
+  }
+}
+
+static void
+hsk_peer_finish_proof(
+  hsk_peer_t *peer,
+  const uint8_t *key,
+  const uint8_t *root,
+  uint64_t recv,
+  uint64_t verify,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  hsk_name_req_t *reqs = hsk_name_map_get(&peer->names, key);
+
+  if (reqs && memcmp(reqs->root, root, 32) != 0)
+    reqs = NULL;
+
+  if (reqs) {
+    hsk_name_map_del(&peer->names, key);
+    hsk_pool_untrack_req(pool, peer, reqs);
+
+    // Moving average of proof latency (1/8 weight).
+    uint64_t elapsed = recv - reqs->start;
+    uint64_t rtt = elapsed;
+
+    if (peer->proof_rtt != 0)
+      rtt = (peer->proof_rtt * 7 + rtt) / 8;
+
+    peer->proof_rtt = rtt > 0 ? rtt : 1;
+    peer->proof_strikes = 0;
+
+    hsk_pool_add_rtt(pool, elapsed);
+
+    int bucket = hsk_stats_bucket(elapsed);
+
+    peer->stats.latency[bucket] += 1;
+    pool->stats.latency[bucket] += 1;
+    pool->stats.proofs += 1;
+  }
+
+  hsk_pool_cache_proof(pool, key, root, exists, data, data_len);
+
+  if (reqs) {
+    hsk_name_req_served(reqs, peer->id, verify);
+    hsk_name_req_finish(pool, reqs, HSK_SUCCESS, exists, data, data_len);
+  }
+
+  // Complete the same request on other peers
+  // (the original, or any hedged copies).
+  hsk_peer_t *other;
+
+  for (other = pool->head; other; other = other->next) {
+    if (other == peer)
+      continue;
+
+    reqs = hsk_name_map_get(&other->names, key);
+
+    if (!reqs)
+      continue;
+
+    hsk_name_map_del(&other->names, key);
+    hsk_pool_untrack_req(pool, other, reqs);
+    hsk_name_req_served(reqs, peer->id, verify);
+    hsk_name_req_finish(pool, reqs, HSK_SUCCESS, exists, data, data_len);
+  }
+
+  peer->proofs += 1;
+
+  // The peer may have room for parked work now.
+  hsk_pool_resend(pool);
+}
+
+static int
+hsk_peer_queue_proof(hsk_peer_t *peer, const hsk_proof_msg_t *msg) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  hsk_proof_job_t *job = hsk_malloc(sizeof(hsk_proof_job_t));
+
+  if (!job)
+    return HSK_ENOMEM;
+
+  // The message proof points into the peer's
+  // read buffer, which is reused right away.
+  if (!hsk_proof_copy(&job->proof, &msg->proof)) {
+    hsk_free(job);
+    return HSK_ENOMEM;
+  }
+
+  job->req.data = (void *)job;
+  job->peer = peer;
+  memcpy(job->root, msg->root, 32);
+  memcpy(job->key, msg->key, 32);
+  job->nodes = pool->nodes;
+  job->recv = uv_now(peer->loop);
+  job->verify = 0;
+  job->pending = true;
+  job->rc = HSK_SUCCESS;
+  job->exists = false;
+  job->data = NULL;
+  job->data_len = 0;
+  job->next = NULL;
+
+  hsk_proof_job_t *tail = (hsk_proof_job_t *)peer->proof_jobs;
+
+  while (tail && tail->next)
+    tail = tail->next;
+
+  if (tail)
+    tail->next = job;
+  else
+    peer->proof_jobs = (void *)job;
+
+  int rc = uv_queue_work(peer->loop, &job->req, on_proof, after_proof);
+
+  if (rc != 0) {
+    hsk_peer_log(peer, "could not queue proof: %s\n", uv_strerror(rc));
+    job->rc = HSK_EFAILURE;
+    job->pending = false;
+    hsk_peer_drain_proofs(peer);
+  }
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_handle_proof(hsk_peer_t *peer, const hsk_proof_msg_t *msg) {
+  hsk_peer_debug(peer, "received proof: %s\n", hsk_hex_encode32(msg->key));
+
+  hsk_name_req_t *reqs = hsk_name_map_get(&peer->names, msg->key);
+
+  if (!reqs) {
+    hsk_peer_log(peer,
+      "received unsolicited proof: %s\n",
+      hsk_hex_encode32(msg->key));
+    return HSK_EBADARGS;
+  }
+
+  hsk_peer_debug(peer, "received proof for: %s\n", reqs->name);
+
+  if (memcmp(msg->root, reqs->root, 32) != 0) {
+    hsk_peer_log(peer, "proof hash mismatch (why?)\n");
+    peer->proof_fails += 1;
+    return HSK_EHASHMISMATCH;
+  }
+
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  if (pool->proof_workers)
+    return hsk_peer_queue_proof(peer, msg);
+
+  bool exists;
+  const uint8_t *data;
+  size_t data_len;
+  uint64_t start = uv_hrtime();
+
+  // The resource is read in place, from the
+  // message, for as long as the callbacks run.
+  int rc = hsk_proof_verify_view(
+    msg->root,
+    msg->key,
+    &msg->proof,
+    pool->nodes,
+    &exists,
+    &data,
+    &data_len
+  );
+
+  uint64_t verify = (uv_hrtime() - start) / 1000;
+
+  if (rc != HSK_SUCCESS) {
+    hsk_peer_log(peer, "invalid proof: %s\n", hsk_strerror(rc));
+    peer->proof_fails += 1;
+    return rc;
+  }
+
+  hsk_peer_finish_proof(
+    peer,
+    msg->key,
+    msg->root,
+    uv_now(peer->loop),
+    verify,
+    exists,
+    data,
+    data_len
+  );
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_handle_proofs(hsk_peer_t *peer, const hsk_proofs_msg_t *msg) {
+  hsk_peer_debug(peer, "received %zu proofs\n", msg->proof_count);
+
+  // Each proof stands on its own: a bad one
+  // does not hold up the rest.
+  int i;
+  for (i = 0; i < msg->proof_count; i++)
+    hsk_peer_handle_proof(peer, &msg->proofs[i]);
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_handle_multiproof(
+  hsk_peer_t *peer,
+  const hsk_multiproof_msg_t *msg
+) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  hsk_peer_debug(peer, "received multiproof of %zu\n", msg->proof_count);
+
+  // Workers share nodes through the node cache.
+  if (pool->proof_workers) {
+    int i;
+    for (i = 0; i < msg->proof_count; i++)
+      hsk_peer_handle_proof(peer, &msg->proofs[i]);
+    return HSK_SUCCESS;
+  }
+
+  const uint8_t *keys[HSK_MAX_PROOFS];
+  const hsk_proof_t *proofs[HSK_MAX_PROOFS];
+  hsk_proof_result_t results[HSK_MAX_PROOFS];
+  size_t count = 0;
+
+  int i;
+  for (i = 0; i < msg->proof_count; i++) {
+    const hsk_proof_msg_t *p = &msg->proofs[i];
+    hsk_name_req_t *reqs = hsk_name_map_get(&peer->names, p->key);
+
+    if (!reqs) {
+      hsk_peer_log(peer,
+        "received unsolicited proof: %s\n",
+        hsk_hex_encode32(p->key));
+      continue;
+    }
+
+    if (memcmp(msg->root, reqs->root, 32) != 0) {
+      hsk_peer_log(peer, "proof hash mismatch (why?)\n");
+      peer->proof_fails += 1;
+      continue;
+    }
+
+    keys[count] = p->key;
+    proofs[count] = &p->proof;
+    count += 1;
+  }
+
+  if (count == 0)
+    return HSK_SUCCESS;
+
+  // Nodes shared by several proofs are only
+  // hashed once.
+  uint64_t start = uv_hrtime();
+  int rc = hsk_proof_verify_multi(msg->root, keys, proofs, count, results);
+  uint64_t verify = (uv_hrtime() - start) / 1000 / count;
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  uint64_t recv = uv_now(peer->loop);
+
+  for (i = 0; i < count; i++) {
+    hsk_proof_result_t *res = &results[i];
+
+    if (res->rc != HSK_SUCCESS) {
+      hsk_peer_log(peer, "invalid proof: %s\n", hsk_strerror(res->rc));
+      peer->proof_fails += 1;
+      continue;
+    }
+
+    hsk_peer_finish_proof(
+      peer,
+      keys[i],
+      msg->root,
+      recv,
+      verify,
+      res->exists,
+      res->data,
+      res->data_len
+    );
+  }
+
+  return HSK_SUCCESS;
+}
+
+static int
+hsk_peer_handle_msg(hsk_peer_t *peer, const hsk_msg_t *msg) {
+  hsk_peer_debug(peer, "handling msg: %s\n", hsk_msg_str(msg->cmd));
+
+  switch (msg->cmd) {
+    case HSK_MSG_VERSION: {
+      return hsk_peer_handle_version(peer, (hsk_version_msg_t *)msg);
+    }
+    case HSK_MSG_VERACK: {
+      return hsk_peer_handle_verack(peer, (hsk_verack_msg_t *)msg);
+    }
+    case HSK_MSG_PING: {
+      return hsk_peer_handle_ping(peer, (hsk_ping_msg_t *)msg);
+    }
+    case HSK_MSG_PONG: {
+      return hsk_peer_handle_pong(peer, (hsk_pong_msg_t *)msg);
+    }
+    case HSK_MSG_GETADDR: {
+      hsk_peer_debug(peer, "cannot handle getaddr\n");
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_ADDR: {
+      return hsk_peer_handle_addr(peer, (hsk_addr_msg_t *)msg);
+    }
+    case HSK_MSG_GETHEADERS: {
+      hsk_peer_debug(peer, "cannot handle getheaders\n");
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_HEADERS: {
+      // Parsed as they arrive (hsk_peer_stream).
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_SENDHEADERS: {
+      hsk_peer_debug(peer, "cannot handle sendheaders\n");
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_GETPROOF: {
+      hsk_peer_debug(peer, "cannot handle getproof\n");
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_PROOF: {
+      return hsk_peer_handle_proof(peer, (hsk_proof_msg_t *)msg);
+    }
+    case HSK_MSG_GETPROOFS: {
+      hsk_peer_debug(peer, "cannot handle getproofs\n");
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_PROOFS: {
+      return hsk_peer_handle_proofs(peer, (hsk_proofs_msg_t *)msg);
+    }
+    case HSK_MSG_GETMULTIPROOF: {
+      hsk_peer_debug(peer, "cannot handle getmultiproof\n");
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_MULTIPROOF: {
+      return hsk_peer_handle_multiproof(peer, (hsk_multiproof_msg_t *)msg);
+    }
+    case HSK_MSG_UNKNOWN:
+    default: {
+      return HSK_SUCCESS;
+    }
+  }
+}
+
+// Bytes the next part of a streamed headers
+// message takes, from the `len` of it we have
+// at `data`: the count, then each header (its
+// size is known from the first 165 bytes).
+// Zero if it cannot be valid.
+static size_t
+hsk_peer_stream_need(hsk_peer_t *peer, const uint8_t *data, size_t len) {
+  if (!peer->stream_batch) {
+    if (len < 1)
+      return 1;
+
+    switch (data[0]) {
+      case 0xfd:
+        return 3;
+      case 0xfe:
+        return 5;
+      case 0xff:
+        return 9;
+      default:
+        return 1;
+    }
+  }
+
+  if (len < 165)
+    return 165;
+
+  if (data[164] > 42)
+    return 0;
+
+  return 165 + ((size_t)data[164] << 2);
+}
+
+// Handle one complete part: the count, or the
+// next header.
+static int
+hsk_peer_stream_part(hsk_peer_t *peer, const uint8_t *data, size_t len) {
+  uint8_t *p = (uint8_t *)data;
+
+  if (!peer->stream_batch) {
+    size_t count;
+
+    if (!read_varsize(&p, &len, &count) || count > 2000)
+      return HSK_EENCODING;
+
+    hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+    peer->stats.msgs_in += 1;
+    pool->stats.msgs_in += 1;
+
+    peer->stream_batch = (void *)hsk_peer_headers_start(peer, count);
+
+    if (!peer->stream_batch)
+      peer->stream_skip = true;
+
+    return HSK_SUCCESS;
+  }
+
+  hsk_verify_t *batch = (hsk_verify_t *)peer->stream_batch;
+
+  if (!hsk_header_read(&p, &len, &batch->headers[batch->filled]))
+    return HSK_EENCODING;
+
+  int rc = hsk_peer_headers_add(peer, batch);
+
+  if (rc != HSK_SUCCESS)
+    return rc;
+
+  // Anything after the last header is ignored.
+  if (batch->filled == batch->header_count)
+    peer->stream_skip = true;
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_peer_stream_fail(hsk_peer_t *peer, int rc) {
+  if (rc == HSK_EENCODING)
+    hsk_peer_log(peer, "error parsing msg: headers\n");
+
+  hsk_peer_count_error(peer, rc);
+
+  if (peer->stream_batch) {
+    hsk_verify_abandon((hsk_verify_t *)peer->stream_batch);
+    peer->stream_batch = NULL;
+  }
+
+  peer->stream_skip = true;
+}
+
+// The message is over: hand the batch on if
+// it is whole, and go back to reading headers.
+static void
+hsk_peer_stream_end(hsk_peer_t *peer) {
+  hsk_verify_t *batch = (hsk_verify_t *)peer->stream_batch;
+
+  if (batch && batch->filled < batch->header_count)
+    hsk_peer_stream_fail(peer, HSK_EENCODING);
+  else if (!batch && !peer->stream_skip)
+    hsk_peer_stream_fail(peer, HSK_EENCODING);
+
+  batch = (hsk_verify_t *)peer->stream_batch;
+
+  peer->stream = false;
+  peer->stream_batch = NULL;
+  peer->stream_skip = false;
+  peer->msg_hdr = false;
+  peer->msg_pos = 0;
+  peer->msg_len = 9;
+  peer->msg_cmd = 0;
+
+  if (batch)
+    hsk_peer_headers_finish(peer, batch);
+}
+
+// A headers message (up to ~700 KB) is not
+// buffered whole: its headers are read off
+// the stream one by one, straight from `data`
+// where they are whole, and checked on the
+// thread pool while the rest comes in. Only
+// a part cut between reads is copied, into
+// the message buffer. `msg_len` counts down
+// what is left of the message. Returns the
+// bytes used.
+static size_t
+hsk_peer_stream(hsk_peer_t *peer, const uint8_t *data, size_t data_len) {
+  size_t used = 0;
+
+  if (data_len > peer->msg_len)
+    data_len = peer->msg_len;
+
+  while (used < data_len && !peer->stream_skip) {
+    const uint8_t *in = data + used;
+    size_t in_len = data_len - used;
+    size_t need;
+
+    if (peer->msg_pos == 0) {
+      need = hsk_peer_stream_need(peer, in, in_len);
+
+      if (need == 0) {
+        hsk_peer_stream_fail(peer, HSK_EENCODING);
+        break;
+      }
+
+      if (in_len >= need) {
+        int rc = hsk_peer_stream_part(peer, in, need);
+
+        used += need;
+
+        if (rc != HSK_SUCCESS)
+          hsk_peer_stream_fail(peer, rc);
+
+        continue;
+      }
+    }
+
+    need = hsk_peer_stream_need(peer, peer->msg, peer->msg_pos);
+
+    if (need == 0) {
+      hsk_peer_stream_fail(peer, HSK_EENCODING);
+      break;
+    }
+
+    size_t take = need - peer->msg_pos;
+
+    if (take > in_len)
+      take = in_len;
+
+    memcpy(peer->msg + peer->msg_pos, in, take);
+
+    peer->msg_pos += take;
+    used += take;
+
+    // Only now whole if its size is unchanged
+    // by what was just added.
+    if (peer->msg_pos == need
+        && hsk_peer_stream_need(peer, peer->msg, need) == need) {
+      int rc = hsk_peer_stream_part(peer, peer->msg, need);
+
+      peer->msg_pos = 0;
+
+      if (rc != HSK_SUCCESS)
+        hsk_peer_stream_fail(peer, rc);
+    }
+  }
+
+  // The rest of a message we are done with.
+  if (peer->stream_skip)
+    used = data_len;
+
+  peer->msg_len -= used;
+
+  if (peer->msg_len == 0)
+    hsk_peer_stream_end(peer);
+
+  return used;
+}
+
+static void
+hsk_peer_on_read(hsk_peer_t *peer, const uint8_t *data, size_t data_len) {
+  if (peer->state != HSK_STATE_HANDSHAKE)
+    return;
+
+  peer->last_recv = hsk_now();
+
+  for (;;) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      return;
+
+    if (peer->stream) {
+      if (data_len == 0)
+        return;
+
+      size_t used = hsk_peer_stream(peer, data, data_len);
+
+      data += used;
+      data_len -= used;
+
+      continue;
+    }
+
+    // Parse straight out of the caller's buffer
+    // (usually brontide's decrypted frame) while
+    // it holds complete message parts.
+    if (peer->msg_pos == 0 && data_len >= peer->msg_len) {
+      size_t len = peer->msg_len;
+
+      hsk_peer_parse(peer, data, len);
+
+      data += len;
+      data_len -= len;
+
+      continue;
+    }
+
+    if (peer->msg_pos + data_len < peer->msg_len)
+      break;
+
+    assert(peer->msg_pos <= peer->msg_len);
+    size_t need = peer->msg_len - peer->msg_pos;
+    memcpy(peer->msg + peer->msg_pos, data, need);
+    data += need;
+    data_len -= need;
+    hsk_peer_parse(peer, peer->msg, peer->msg_len);
+  }
+
+  memcpy(peer->msg + peer->msg_pos, data, data_len);
+  peer->msg_pos += data_len;
+}
+
+// Grow the read buffer when needed. Large ones
+// are given back once the message is handled.
+static bool
+hsk_peer_reserve(hsk_peer_t *peer, size_t size) {
+  if (size <= peer->msg_size && peer->msg_size <= HSK_MSG_KEEP)
+    return true;
+
+  if (size == 0)
+    size = 1;
+
+  uint8_t *msg = hsk_realloc(peer->msg, size);
+
+  if (!msg)
+    return false;
+
+  hsk_mem_sub(HSK_MEM_PEERS, peer->msg_size);
+  hsk_mem_add(HSK_MEM_PEERS, size);
+
+  peer->msg = msg;
+  peer->msg_size = size;
+
+  return true;
+}
+
+static int
+hsk_peer_parse_hdr(hsk_peer_t *peer, const uint8_t *msg, size_t msg_len) {
+  uint32_t magic;
+  uint8_t *ms = (uint8_t *)msg;
+
+  if (!read_u32(&ms, &msg_len, &magic)) {
+    hsk_peer_log(peer, "invalid header\n");
+    return HSK_EENCODING;
+  }
+
+  if (magic != HSK_MAGIC) {
+    hsk_peer_log(peer, "invalid magic: %x\n", magic);
+    return HSK_EENCODING;
+  }
+
+  uint8_t cmd;
+
+  if (!read_u8(&ms, &msg_len, &cmd)) {
+    hsk_peer_log(peer, "invalid command\n");
+    return HSK_EENCODING;
+  }
+
+  const char *str = hsk_msg_str(cmd);
+
+  uint32_t size;
+
+  if (!read_u32(&ms, &msg_len, &size)) {
+    hsk_peer_log(peer, "invalid header: %s\n", str);
+    return HSK_EENCODING;
+  }
+
+  if (size > HSK_MAX_MESSAGE) {
+    hsk_peer_log(peer, "invalid msg size: %s - %u\n", str, size);
+    return HSK_EENCODING;
+  }
+
+  // Headers are read as they arrive, only ever
+  // one at a time in the buffer.
+  peer->stream = cmd == HSK_MSG_HEADERS && size > 0;
+
+  if (!hsk_peer_reserve(peer, peer->stream ? HSK_HEADERS_PART_MAX : size))
+    return HSK_ENOMEM;
+
+  peer->msg_hdr = true;
+  peer->msg_pos = 0;
+  peer->msg_len = size;
+  peer->msg_cmd = cmd;
+
+  hsk_peer_debug(peer, "received header: %s\n", str);
+  hsk_peer_debug(peer, "  msg size: %u\n", peer->msg_len);
+
+  return HSK_SUCCESS;
+}
+
+// Takes the message.
+static int
+hsk_peer_handle_read(hsk_peer_t *peer, hsk_msg_t *m) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  peer->stats.msgs_in += 1;
+  pool->stats.msgs_in += 1;
+
+  int rc = hsk_peer_handle_msg(peer, m);
+  hsk_msg_free(m);
+
+  return rc;
+}
+
+static int
+hsk_peer_parse(hsk_peer_t *peer, const uint8_t *msg, size_t msg_len) {
+  if (!peer->msg_hdr)
+    return hsk_peer_parse_hdr(peer, msg, msg_len);
+
+  int rc = HSK_SUCCESS;
+  const char *str = hsk_msg_str(peer->msg_cmd);
+
+  if (strcmp(str, "unknown") == 0) {
+    hsk_peer_log(peer, "unknown command: %u\n", peer->msg_cmd);
+    goto done;
+  }
+
+  hsk_msg_t *m = hsk_msg_alloc(peer->msg_cmd);
+
+  if (!m) {
+    rc = HSK_ENOMEM;
+    goto done;
+  }
+
+  if (!hsk_msg_decode(msg, msg_len, m)) {
+    hsk_peer_log(peer, "error parsing msg: %s\n", str);
+    hsk_free(m);
+    rc = HSK_EENCODING;
+    goto done;
+  }
+
+  rc = hsk_peer_handle_read(peer, m);
+
+done:
+  if (rc != HSK_SUCCESS)
+    hsk_peer_count_error(peer, rc);
+
+  if (!hsk_peer_reserve(peer, 9))
+    return HSK_ENOMEM;
+
+  peer->msg_hdr = false;
+  peer->msg_pos = 0;
+  peer->msg_len = 9;
+  peer->msg_cmd = 0;
+
+  return rc;
+}
+
+/*
+ * UV behavior
+ */
+
+static void
+on_connect(uv_connect_t *conn, int status) {
+  uv_tcp_t *socket = (uv_tcp_t *)conn->handle;
+  hsk_free(conn);
+
+  hsk_peer_t *peer = (hsk_peer_t *)socket->data;
+
+  if (!peer || peer->state != HSK_STATE_CONNECTING)
+    return;
+
+  if (status != 0) {
+    hsk_peer_log(peer, "failed connecting: %s\n", uv_strerror(status));
+    hsk_peer_destroy(peer);
+    return;
+  }
+
+  peer->state = HSK_STATE_CONNECTED;
+  hsk_peer_log(peer, "connected\n");
+
+  // Writes are batched already: requests should
+  // not wait on an ACK behind them.
+  uv_tcp_nodelay(socket, 1);
+
+  status = uv_read_start((uv_stream_t *)socket, alloc_buffer, after_read);
+
+  if (status != 0) {
+    hsk_peer_log(peer, "failed reading: %s\n", uv_strerror(status));
+    hsk_peer_destroy(peer);
+    return;
+  }
+
+  peer->state = HSK_STATE_READING;
+  peer->conn_time = hsk_now();
+
+  int r = hsk_brontide_on_connect(&peer->brontide);
+
+  if (r != HSK_SUCCESS) {
+    hsk_peer_log(peer, "brontide_on_connect failed: %s\n", hsk_strerror(r));
+    hsk_peer_destroy(peer);
+    return;
+  }
+}
+
+static void
+after_write(uv_write_t *req, int status) {
+  hsk_write_data_t *wd = (hsk_write_data_t *)req->data;
+  hsk_peer_t *peer = wd->peer;
+  int i;
+
+  for (i = 0; i < wd->count; i++)
+    hsk_free(wd->bufs[i].base);
+
+  req->data = NULL;
+
+  hsk_free(wd);
+
+  if (status != 0) {
+    hsk_peer_log(peer, "write error: %s\n", uv_strerror(status));
+    hsk_peer_destroy(peer);
+    return;
+  }
+}
+
+static void
+alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
+  hsk_peer_t *peer = (hsk_peer_t *)handle->data;
+
+  if (!peer) {
+    buf->base = NULL;
+    buf->len = 0;
+    return;
+  }
+
+  // Read straight into brontide's frame buffer.
+  uint8_t *data;
+  size_t data_len;
+
+  hsk_brontide_read_buf(&peer->brontide, &data, &data_len);
+
+  buf->base = (char *)data;
+  buf->len = data_len;
+}
+
+static void
+after_read(uv_stream_t *stream, long int nread, const uv_buf_t *buf) {
+  hsk_peer_t *peer = (hsk_peer_t *)stream->data;
+
+  if (!peer)
+    return;
+
+  if (nread < 0) {
+    if (nread != UV_EOF)
+      hsk_peer_log(peer, "read error: %s\n", uv_strerror(nread));
+    hsk_peer_destroy(peer);
+    return;
+  }
+
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  peer->stats.bytes_in += (uint64_t)nread;
+  pool->stats.bytes_in += (uint64_t)nread;
+
+  uint64_t start = hsk_prof_start();
+  int r = hsk_brontide_on_recv(&peer->brontide, (size_t)nread);
+
+  hsk_prof_end(HSK_PROF_PEER_READ, start);
+
+  if (r != HSK_SUCCESS) {
+    hsk_peer_count_error(peer, r);
+    hsk_peer_log(peer, "brontide_on_recv failed: %s\n", hsk_strerror(r));
+    hsk_peer_destroy(peer);
+    return;
+  }
+}
+
+static void
+after_close(uv_handle_t *handle) {
+  hsk_peer_t *peer = (hsk_peer_t *)handle->data;
+  assert(peer);
+  handle->data = NULL;
+  peer->state = HSK_STATE_DISCONNECTED;
+  hsk_peer_log(peer, "closed peer\n");
+
+  // Let in-flight batches finish without us.
+  hsk_verify_t *batch, *next;
+  for (batch = (hsk_verify_t *)peer->verify; batch; batch = next) {
+    next = batch->next;
+    batch->peer = NULL;
+    batch->next = NULL;
+    if (batch->pending == 0)
+      hsk_verify_free(batch);
+  }
+
+  peer->verify = NULL;
+
+  if (peer->stream_batch) {
+    hsk_verify_abandon((hsk_verify_t *)peer->stream_batch);
+    peer->stream_batch = NULL;
+  }
+
+  hsk_proof_job_t *job, *job_next;
+  for (job = (hsk_proof_job_t *)peer->proof_jobs; job; job = job_next) {
+    job_next = job->next;
+    job->peer = NULL;
+    job->next = NULL;
+    if (!job->pending)
+      hsk_proof_job_free(job);
+  }
+
+  peer->proof_jobs = NULL;
+
+  hsk_read_job_t *rjob, *rjob_next;
+  for (rjob = (hsk_read_job_t *)peer->read_jobs; rjob; rjob = rjob_next) {
+    rjob_next = rjob->next;
+    rjob->peer = NULL;
+    rjob->next = NULL;
+    if (!rjob->pending)
+      hsk_read_job_free(rjob);
+  }
+
+  peer->read_jobs = NULL;
+
+  hsk_peer_free(peer);
+}
+
+static void
+after_timer(uv_timer_t *timer) {
+  hsk_pool_t *pool = (hsk_pool_t *)timer->data;
+  assert(pool);
+
+  uint64_t start = hsk_prof_start();
+  hsk_pool_timer(pool);
+  hsk_prof_end(HSK_PROF_POOL_TIMER, start);
+}
+
+static void
+hsk_pool_flush(hsk_pool_t *pool) {
+  uint64_t now = uv_now(pool->loop);
+  uint64_t wait = 0;
+
+  hsk_peer_t *peer, *next;
+  for (peer = pool->head; peer; peer = next) {
+    next = peer->next;
+
+    if (peer->send_count == 0)
+      continue;
+
+    uint64_t elapsed = now - peer->send_time;
+
+    if (elapsed < pool->flush_delay) {
+      uint64_t left = pool->flush_delay - elapsed;
+      if (wait == 0 || left < wait)
+        wait = left;
+      continue;
+    }
+
+    hsk_peer_flush(peer);
+  }
+
+  if (wait > 0 && !uv_is_active((uv_handle_t *)&pool->flush_timer))
+    uv_timer_start(&pool->flush_timer, after_flush_timer, wait, 0);
+}
+
+static void
+after_check(uv_check_t *check) {
+  hsk_pool_t *pool = (hsk_pool_t *)check->data;
+  assert(pool);
+
+  uint64_t start = hsk_prof_start();
+  hsk_peer_t *peer, *next;
+  for (peer = pool->head; peer; peer = next) {
+    next = peer->next;
+
+    int rc = hsk_peer_flush_getproofs(peer);
+
+    if (rc != HSK_SUCCESS)
+      hsk_peer_log(peer, "could not send getproofs: %s\n", hsk_strerror(rc));
+  }
+
+  // Without a delay, everything queued during
+  // this loop iteration goes out right now.
+  if (pool->flush_delay == 0)
+    hsk_pool_flush(pool);
+
+  hsk_prof_end(HSK_PROF_POOL_CHECK, start);
+}
+
+static void
+after_idle(uv_idle_t *idle) {
+  hsk_pool_t *pool = (hsk_pool_t *)idle->data;
+  assert(pool);
+
+  // Restarted by any peer with headers left.
+  uv_idle_stop(&pool->idle);
+
+  uint64_t start = hsk_prof_start();
+  hsk_peer_t *peer, *next;
+  for (peer = pool->head; peer; peer = next) {
+    next = peer->next;
+    hsk_peer_drain_verify(peer);
+  }
+
+  hsk_prof_end(HSK_PROF_HEADERS, start);
+}
+
+static void
+after_flush_timer(uv_timer_t *timer) {
+  hsk_pool_t *pool = (hsk_pool_t *)timer->data;
+  assert(pool);
+  hsk_pool_flush(pool);
+}
+
+static void
+after_hedge_timer(uv_timer_t *timer) {
+  hsk_pool_t *pool = (hsk_pool_t *)timer->data;
+  assert(pool);
+  hsk_pool_hedge(pool);
+}
+
+static void
+after_refresh_timer(uv_timer_t *timer) {
+  hsk_pool_t *pool = (hsk_pool_t *)timer->data;
+  assert(pool);
+  hsk_pool_refresh(pool);
+}
+
+static void
+after_refill_timer(uv_timer_t *timer) {
+  hsk_pool_t *pool = (hsk_pool_t *)timer->data;
+  assert(pool);
+  hsk_pool_refill(pool);
+}
+
 static void
-hsk_peer_on_read(hsk_peer_t *peer, const uint8_t *data, size_t data_len) {
-  if (peer->state != HSK_STATE_HANDSHAKE)
-    return;
+on_verify(uv_work_t *req) {
+  // Runs on a worker thread: touch nothing
+  // but this job's slice of the batch.
+  hsk_verify_job_t *job = (hsk_verify_job_t *)req->data;
+  hsk_header_t *hdr = job->start;
+  uint64_t start = uv_hrtime();
+  size_t i;
+
+  for (i = 0; i < job->count; i++, hdr = hdr->next) {
+    int rc = hsk_header_verify_pow(hdr);
 
-  peer->last_recv = hsk_now();
+    job->checked += 1;
 
-  while (peer->msg_pos + data_len >= peer->msg_len) {
-    assert(peer->msg_pos <= peer->msg_len);
-    size_t need = peer->msg_len - peer->msg_pos;
-    memcpy(peer->msg + peer->msg_pos, data, need);
-    data += need;
-    data_len -= need;
-    hsk_peer_parse(peer, peer->msg, peer->msg_len);
+    if (rc != HSK_SUCCESS) {
+      job->rc = rc;
+      break;
+    }
   }
 
-  memcpy(peer->msg + peer->msg_pos, data, data_len);
-  peer->msg_pos += data_len;
+  job->time = uv_hrtime() - start;
 }
 
-static int
-hsk_peer_parse_hdr(hsk_peer_t *peer, const uint8_t *msg, size_t msg_len) {
-  uint32_t magic;
-  uint8_t *ms = (uint8_t *)msg;
-
-  if (!read_u32(&ms, &msg_len, &magic)) {
-    hsk_peer_log(peer, "invalid header\n");
-    return HSK_EENCODING;
-  }
+static void
+after_verify(uv_work_t *req, int status) {
+  hsk_verify_job_t *job = (hsk_verify_job_t *)req->data;
+  hsk_verify_t *batch = (hsk_verify_t *)job->batch;
 
-  if (magic != HSK_MAGIC) {
-    hsk_peer_log(peer, "invalid magic: %x\n", magic);
-    return HSK_EENCODING;
-  }
+  if (status != 0 && job->rc == HSK_SUCCESS)
+    job->rc = HSK_EFAILURE;
 
-  uint8_t cmd;
+  if (job->rc != HSK_SUCCESS && batch->rc == HSK_SUCCESS)
+    batch->rc = job->rc;
 
-  if (!read_u8(&ms, &msg_len, &cmd)) {
-    hsk_peer_log(peer, "invalid command\n");
-    return HSK_EENCODING;
-  }
+  batch->pool->pow_count += job->checked;
+  hsk_chain_count_pow(&batch->pool->chain, job->checked, job->time);
 
-  const char *str = hsk_msg_str(cmd);
+  assert(batch->pending > 0);
 
-  uint32_t size;
+  batch->pending -= 1;
 
-  if (!read_u32(&ms, &msg_len, &size)) {
-    hsk_peer_log(peer, "invalid header: %s\n", str);
-    return HSK_EENCODING;
-  }
+  if (batch->pending > 0)
+    return;
 
-  if (size > HSK_MAX_MESSAGE) {
-    hsk_peer_log(peer, "invalid msg size: %s - %u\n", str, size);
-    return HSK_EENCODING;
+  if (!batch->peer) {
+    hsk_verify_free(batch);
+    return;
   }
 
-  uint8_t *slab = realloc(peer->msg, size);
+  uint64_t start = hsk_prof_start();
+  hsk_peer_drain_verify(batch->peer);
+  hsk_prof_end(HSK_PROF_HEADERS, start);
+}
 
-  if (!slab && size != 0)
-    return HSK_ENOMEM;
+static void
+hsk_verify_free(hsk_verify_t *batch) {
+  // One allocation (see hsk_peer_headers_start).
+  hsk_free(batch->headers);
+  hsk_free(batch);
+}
 
-  peer->msg_hdr = true;
-  peer->msg = slab;
-  peer->msg_pos = 0;
-  peer->msg_len = size;
-  peer->msg_cmd = cmd;
+// Add finished batches to the chain, in order.
+// At most HSK_HEADERS_CHUNK headers go in per
+// call; the rest wait for the pool's idle
+// handle so reads on the loop are not held up
+// behind a whole batch.
+static void
+hsk_peer_drain_verify(hsk_peer_t *peer) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+  size_t limit = HSK_HEADERS_CHUNK;
 
-  hsk_peer_debug(peer, "received header: %s\n", str);
-  hsk_peer_debug(peer, "  msg size: %u\n", peer->msg_len);
+  while (peer->verify) {
+    hsk_verify_t *batch = (hsk_verify_t *)peer->verify;
 
-  return HSK_SUCCESS;
-}
+    if (batch->pending > 0)
+      break;
 
-static int
-hsk_peer_parse(hsk_peer_t *peer, const uint8_t *msg, size_t msg_len) {
-  if (!peer->msg_hdr)
-    return hsk_peer_parse_hdr(peer, msg, msg_len);
+    if (peer->state == HSK_STATE_HANDSHAKE) {
+      if (batch->rc != HSK_SUCCESS) {
+        hsk_peer_log(peer, "invalid header pow: %s\n",
+                     hsk_strerror(batch->rc));
+      } else {
+        if (limit == 0) {
+          uv_idle_start(&pool->idle, after_idle);
+          break;
+        }
+
+        hsk_peer_add_headers(peer, batch, &limit);
+
+        // Adding may have dropped the peer.
+        if (batch->cursor && peer->state == HSK_STATE_HANDSHAKE) {
+          uv_idle_start(&pool->idle, after_idle);
+          break;
+        }
+      }
+    }
 
-  int rc = HSK_SUCCESS;
-  const char *str = hsk_msg_str(peer->msg_cmd);
+    peer->verify = (void *)batch->next;
 
-  if (strcmp(str, "unknown") == 0) {
-    hsk_peer_log(peer, "unknown command: %u\n", peer->msg_cmd);
-    goto done;
+    hsk_verify_free(batch);
   }
+}
 
-  hsk_msg_t *m = hsk_msg_alloc(peer->msg_cmd);
-
-  if (!m) {
-    rc = HSK_ENOMEM;
-    goto done;
-  }
+static void
+on_proof(uv_work_t *req) {
+  // Runs on a worker thread. The job owns
+  // everything it reads and writes.
+  hsk_proof_job_t *job = (hsk_proof_job_t *)req->data;
+  uint64_t start = uv_hrtime();
+
+  job->rc = hsk_proof_verify_view(
+    job->root,
+    job->key,
+    &job->proof,
+    job->nodes,
+    &job->exists,
+    &job->data,
+    &job->data_len
+  );
 
-  if (!hsk_msg_decode(msg, msg_len, m)) {
-    hsk_peer_log(peer, "error parsing msg: %s\n", str);
-    free(m);
-    rc = HSK_EENCODING;
-    goto done;
-  }
+  job->verify = (uv_hrtime() - start) / 1000;
+}
 
-  rc = hsk_peer_handle_msg(peer, m);
-  hsk_msg_free(m);
+static void
+after_proof(uv_work_t *req, int status) {
+  hsk_proof_job_t *job = (hsk_proof_job_t *)req->data;
 
-done: ;
-  uint8_t *slab = realloc(peer->msg, 9);
+  if (status != 0 && job->rc == HSK_SUCCESS)
+    job->rc = HSK_EFAILURE;
 
-  if (!slab)
-    return HSK_ENOMEM;
+  job->pending = false;
 
-  peer->msg_hdr = false;
-  peer->msg = slab;
-  peer->msg_pos = 0;
-  peer->msg_len = 9;
-  peer->msg_cmd = 0;
+  if (!job->peer) {
+    hsk_proof_job_free(job);
+    return;
+  }
 
-  return rc;
+  uint64_t start = hsk_prof_start();
+  hsk_peer_drain_proofs(job->peer);
+  hsk_prof_end(HSK_PROF_PROOFS, start);
 }
 
-/*
- * UV behavior
- */
+static void
+hsk_proof_job_free(hsk_proof_job_t *job) {
+  hsk_proof_uninit(&job->proof);
+  hsk_free(job);
+}
 
 static void
-on_connect(uv_connect_t *conn, int status) {
-  uv_tcp_t *socket = (uv_tcp_t *)conn->handle;
-  free(conn);
+on_keys(uv_work_t *req) {
+  // Runs on a worker thread.
+  hsk_keys_job_t *job = (hsk_keys_job_t *)req->data;
 
-  hsk_peer_t *peer = (hsk_peer_t *)socket->data;
+  while (job->made < job->count) {
+    int i = job->made;
 
-  if (!peer || peer->state != HSK_STATE_CONNECTING)
-    return;
+    if (!hsk_ec_create_privkey(job->ec, job->keys[i]))
+      break;
 
-  if (status != 0) {
-    hsk_peer_log(peer, "failed connecting: %s\n", uv_strerror(status));
-    hsk_peer_destroy(peer);
-    return;
+    if (!hsk_ec_create_pubkey(job->ec, job->keys[i], job->pubs[i]))
+      break;
+
+    job->made += 1;
   }
+}
 
-  peer->state = HSK_STATE_CONNECTED;
-  hsk_peer_log(peer, "connected\n");
+static void
+after_keys(uv_work_t *req, int status) {
+  hsk_keys_job_t *job = (hsk_keys_job_t *)req->data;
+  hsk_pool_t *pool = job->pool;
 
-  status = uv_read_start((uv_stream_t *)socket, alloc_buffer, after_read);
+  if (status != 0)
+    job->made = 0;
 
-  if (status != 0) {
-    hsk_peer_log(peer, "failed reading: %s\n", uv_strerror(status));
-    hsk_peer_destroy(peer);
-    return;
-  }
+  if (pool) {
+    int i;
 
-  peer->state = HSK_STATE_READING;
-  peer->conn_time = hsk_now();
+    pool->keys_job = NULL;
 
-  int r = hsk_brontide_on_connect(&peer->brontide);
+    for (i = 0; i < job->made; i++) {
+      int j = pool->ephemeral_count;
 
-  if (r != HSK_SUCCESS) {
-    hsk_peer_log(peer, "brontide_on_connect failed: %s\n", hsk_strerror(r));
-    hsk_peer_destroy(peer);
-    return;
+      if (j == HSK_HANDSHAKE_KEYS)
+        break;
+
+      memcpy(pool->ephemeral[j], job->keys[i], 32);
+      memcpy(pool->ephemeral_pub[j], job->pubs[i], 33);
+
+      pool->ephemeral_count += 1;
+    }
   }
+
+  memset(job->keys, 0, sizeof(job->keys));
+  hsk_free(job);
 }
 
+// Finish checked proofs, in order.
 static void
-after_write(uv_write_t *req, int status) {
-  hsk_write_data_t *wd = (hsk_write_data_t *)req->data;
-  hsk_peer_t *peer = wd->peer;
+hsk_peer_drain_proofs(hsk_peer_t *peer) {
+  while (peer->proof_jobs) {
+    hsk_proof_job_t *job = (hsk_proof_job_t *)peer->proof_jobs;
 
-  if (wd->data && wd->should_free) {
-    free(wd->data);
-    wd->data = NULL;
-  }
+    if (job->pending)
+      break;
 
-  free(wd);
-  req->data = NULL;
+    peer->proof_jobs = (void *)job->next;
 
-  free(req);
+    if (peer->state == HSK_STATE_HANDSHAKE) {
+      if (job->rc != HSK_SUCCESS) {
+        hsk_peer_log(peer, "invalid proof: %s\n", hsk_strerror(job->rc));
+        hsk_peer_count_error(peer, job->rc);
+        peer->proof_fails += 1;
+      } else {
+        hsk_peer_finish_proof(peer, job->key, job->root, job->recv,
+                              job->verify, job->exists, job->data,
+                              job->data_len);
+      }
+    }
 
-  if (status != 0) {
-    hsk_peer_log(peer, "write error: %s\n", uv_strerror(status));
-    hsk_peer_destroy(peer);
-    return;
+    hsk_proof_job_free(job);
   }
 }
 
 static void
-alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
-  hsk_peer_t *peer = (hsk_peer_t *)handle->data;
+on_read_job(uv_work_t *req) {
+  // Runs on a worker thread. The job owns
+  // everything it reads and writes.
+  hsk_read_job_t *job = (hsk_read_job_t *)req->data;
 
-  if (!peer) {
-    buf->base = NULL;
-    buf->len = 0;
+  job->ok = hsk_brontide_open(&job->cs, job->data, job->data_len);
+
+  if (!job->ok)
+    return;
+
+  job->size = job->data_len - 16;
+
+  uint8_t *ms = job->data;
+  size_t ms_len = job->size;
+  uint32_t magic;
+  uint8_t cmd;
+  uint32_t size;
+
+  if (!read_u32(&ms, &ms_len, &magic)
+      || !read_u8(&ms, &ms_len, &cmd)
+      || !read_u32(&ms, &ms_len, &size)) {
     return;
   }
 
-  buf->base = (char *)peer->read_buffer;
-  buf->len = HSK_BUFFER_SIZE;
-}
+  if (magic != HSK_MAGIC || cmd == HSK_MSG_HEADERS || size != ms_len)
+    return;
 
-static void
-after_read(uv_stream_t *stream, long int nread, const uv_buf_t *buf) {
-  hsk_peer_t *peer = (hsk_peer_t *)stream->data;
+  hsk_msg_t *m = hsk_msg_alloc(cmd);
 
-  if (!peer)
+  if (!m)
     return;
 
-  if (nread < 0) {
-    if (nread != UV_EOF)
-      hsk_peer_log(peer, "read error: %s\n", uv_strerror(nread));
-    hsk_peer_destroy(peer);
+  if (!hsk_msg_decode(ms, ms_len, m)) {
+    hsk_free(m);
     return;
   }
 
-  int r = hsk_brontide_on_read(
-    &peer->brontide,
-    (uint8_t *)buf->base,
-    (size_t)nread
-  );
+  job->msg = m;
+}
 
-  if (r != HSK_SUCCESS) {
-    hsk_peer_log(peer, "brontide_on_read failed: %s\n", hsk_strerror(r));
-    hsk_peer_destroy(peer);
+static void
+after_read_job(uv_work_t *req, int status) {
+  hsk_read_job_t *job = (hsk_read_job_t *)req->data;
+
+  if (status != 0)
+    job->ok = false;
+
+  job->pending = false;
+
+  if (!job->peer) {
+    hsk_read_job_free(job);
     return;
   }
+
+  uint64_t start = hsk_prof_start();
+  hsk_peer_drain_reads(job->peer);
+  hsk_prof_end(HSK_PROF_PEER_READ, start);
 }
 
 static void
-after_close(uv_handle_t *handle) {
-  hsk_peer_t *peer = (hsk_peer_t *)handle->data;
-  assert(peer);
-  handle->data = NULL;
-  peer->state = HSK_STATE_DISCONNECTED;
-  hsk_peer_log(peer, "closed peer\n");
-  hsk_peer_free(peer);
+hsk_read_job_free(hsk_read_job_t *job) {
+  if (job->msg)
+    hsk_msg_free(job->msg);
+
+  hsk_mem_sub(HSK_MEM_PEERS, job->data_len);
+  hsk_free(job->data);
+  hsk_free(job);
+}
+
+static hsk_read_job_t *
+hsk_peer_push_read(hsk_peer_t *peer, const uint8_t *data, size_t data_len) {
+  hsk_read_job_t *job = hsk_malloc(sizeof(hsk_read_job_t));
+
+  if (!job)
+    return NULL;
+
+  job->data = hsk_malloc(data_len > 0 ? data_len : 1);
+
+  if (!job->data) {
+    hsk_free(job);
+    return NULL;
+  }
+
+  memcpy(job->data, data, data_len);
+  hsk_mem_add(HSK_MEM_PEERS, data_len);
+
+  job->req.data = (void *)job;
+  job->peer = peer;
+  job->data_len = data_len;
+  job->size = data_len;
+  job->pending = false;
+  job->ok = true;
+  job->msg = NULL;
+  job->next = NULL;
+
+  hsk_read_job_t *tail = (hsk_read_job_t *)peer->read_jobs;
+
+  while (tail && tail->next)
+    tail = tail->next;
+
+  if (tail)
+    tail->next = job;
+  else
+    peer->read_jobs = (void *)job;
+
+  return job;
 }
 
+// Hand on opened frames, in order. A message
+// decoded on the thread pool is only used if
+// it starts where the peer's reading is at;
+// otherwise it is read like any other frame.
 static void
-after_timer(uv_timer_t *timer) {
-  hsk_pool_t *pool = (hsk_pool_t *)timer->data;
-  assert(pool);
-  hsk_pool_timer(pool);
+hsk_peer_drain_reads(hsk_peer_t *peer) {
+  while (peer->read_jobs) {
+    hsk_read_job_t *job = (hsk_read_job_t *)peer->read_jobs;
+
+    if (job->pending)
+      break;
+
+    peer->read_jobs = (void *)job->next;
+
+    if (peer->state != HSK_STATE_HANDSHAKE) {
+      hsk_read_job_free(job);
+      continue;
+    }
+
+    if (!job->ok) {
+      hsk_peer_count_error(peer, HSK_EBADTAG);
+      hsk_peer_log(peer, "brontide_on_recv failed: %s\n",
+                   hsk_strerror(HSK_EBADTAG));
+      hsk_peer_destroy(peer);
+      hsk_read_job_free(job);
+      continue;
+    }
+
+    if (job->msg && !peer->msg_hdr && peer->msg_pos == 0 && !peer->stream) {
+      hsk_msg_t *m = job->msg;
+
+      job->msg = NULL;
+      peer->last_recv = hsk_now();
+
+      hsk_peer_debug(peer, "received %s (decoded off the loop)\n",
+                     hsk_msg_str(m->cmd));
+
+      int rc = hsk_peer_handle_read(peer, m);
+
+      if (rc != HSK_SUCCESS)
+        hsk_peer_count_error(peer, rc);
+    } else {
+      hsk_peer_on_read(peer, job->data, job->size);
+    }
+
+    hsk_read_job_free(job);
+  }
 }
 
 static void
@@ -1771,17 +6040,64 @@ after_brontide_connect(const void *arg) {
 
   hsk_addrman_mark_success(&pool->am, &peer->addr);
 
+  uint64_t rtt = uv_now(peer->loop) - peer->open_time;
+
+  peer->handshake_rtt = rtt > 0 ? (uint32_t)rtt : 1;
+
+  hsk_addrman_mark_rtt(&pool->am, &peer->addr, peer->handshake_rtt);
+
   peer->state = HSK_STATE_HANDSHAKE;
+  pool->stats.handshakes += 1;
 
   hsk_peer_send_version(peer);
+
+  hsk_pool_trim(pool);
 }
 
 static void
 after_brontide_read(const void *arg, const uint8_t *data, size_t data_len) {
   hsk_peer_t *peer = (hsk_peer_t *)arg;
+
+  // Behind a frame still being opened.
+  if (peer->read_jobs) {
+    if (!hsk_peer_push_read(peer, data, data_len)) {
+      hsk_peer_log(peer, "could not queue frame\n");
+      hsk_peer_destroy(peer);
+    }
+    return;
+  }
+
   hsk_peer_on_read(peer, data, data_len);
 }
 
+static int
+after_brontide_offload(
+  const void *arg,
+  const hsk_cs_t *cs,
+  const uint8_t *data,
+  size_t data_len
+) {
+  hsk_peer_t *peer = (hsk_peer_t *)arg;
+  hsk_read_job_t *job = hsk_peer_push_read(peer, data, data_len);
+
+  if (!job)
+    return HSK_ENOMEM;
+
+  memcpy(&job->cs, cs, sizeof(hsk_cs_t));
+  job->pending = true;
+
+  int rc = uv_queue_work(peer->loop, &job->req, on_read_job, after_read_job);
+
+  // Open it here instead.
+  if (rc != 0) {
+    on_read_job(&job->req);
+    job->pending = false;
+    hsk_peer_drain_reads(peer);
+  }
+
+  return HSK_SUCCESS;
+}
+
 static int
 brontide_do_write(
   const void *arg,
@@ -1790,9 +6106,13 @@ brontide_do_write(
   bool is_heap
 ) {
   hsk_peer_t *peer = (hsk_peer_t *)arg;
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
+
+  peer->stats.bytes_out += data_len;
+  pool->stats.bytes_out += data_len;
 
   if (!is_heap) {
-    uint8_t *buf = malloc(data_len);
+    uint8_t *buf = hsk_malloc(data_len);
 
     if (!buf)
       return HSK_ENOMEM;
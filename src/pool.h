@@ -11,16 +11,170 @@
 #include "brontide.h"
 #include "chain.h"
 #include "ec.h"
+#include "error.h"
 #include "header.h"
 #include "map.h"
+#include "msg.h"
+#include "slab.h"
 #include "timedata.h"
+#include "top.h"
+#include "watch.h"
+#include "wheel.h"
 
 /*
  * Defs
  */
 
-#define HSK_BUFFER_SIZE 32768
-#define HSK_POOL_SIZE 8
+#define HSK_POOL_SIZE 32
+#define HSK_VERIFY_JOBS 4
+#define HSK_VERIFY_QUEUE 3
+
+// The most of a headers message buffered: one
+// header with the largest solution.
+#define HSK_HEADERS_PART_MAX (165 + 42 * 4)
+
+// Headers added to the chain per loop pass.
+#define HSK_HEADERS_CHUNK 250
+
+// Headers read per batch by an import.
+#define HSK_IMPORT_BATCH 2000
+
+// Once synced, an announced header that does
+// not connect is followed by a getheaders for
+// the gap alone, located from this many blocks
+// below the tip. If the reply does not connect
+// either, a full locator is sent.
+#define HSK_TIP_LOCATOR 8
+
+// Ephemeral keys for outbound handshakes, made
+// ahead of time on the thread pool. Each is
+// used for a single connection.
+#define HSK_HANDSHAKE_KEYS 16
+
+// Extra connection attempts raced while the
+// pool is short of handshaked peers. The first
+// to finish are kept and the rest are closed.
+#define HSK_POOL_RACE 4
+#define HSK_POOL_RACE_MAX 64
+
+// With room to grow (hsk_pool_set_grow), a
+// peer is added per timer tick while peers
+// average more than HSK_GROW_LOAD proofs in
+// flight, or have some and take over
+// HSK_GROW_RTT ms on average to answer. One is
+// let go after HSK_SHRINK_TICKS ticks in a
+// row with under one each.
+#define HSK_GROW_LOAD 8
+#define HSK_GROW_RTT 1000
+#define HSK_SHRINK_TICKS 20
+
+// Every HSK_REPLACE_INTERVAL seconds, a full
+// pool swaps its slowest idle peer for a known
+// address that handshakes HSK_REPLACE_RATIO
+// times faster than that peer answers.
+#define HSK_REPLACE_INTERVAL (5 * 60)
+#define HSK_REPLACE_RATIO 2
+
+// Delay (ms) before replacing a lost peer.
+#define HSK_REFILL_DELAY 100
+
+// Outbound frames are queued per peer and
+// written together once per loop iteration (or
+// after the flush delay, in milliseconds).
+#define HSK_SEND_BUFS 64
+#define HSK_SEND_BYTES 65536
+#define HSK_SEND_DELAY 0
+
+// Assumed proof latency (ms) for a peer that
+// has not answered a getproof yet.
+#define HSK_PROOF_RTT 500
+
+// Proof requests time out after this many seconds
+// and are retried on another peer a few times. A
+// peer is only dropped after several consecutive
+// timer ticks in which its requests expired.
+#define HSK_PROOF_TIMEOUT 5
+#define HSK_PROOF_RETRIES 2
+#define HSK_PROOF_STRIKES 3
+
+// Names waiting for a usable peer. Once full,
+// new lookups fail right away with HSK_EBUSY.
+#define HSK_PENDING_MAX 1000
+
+// Proof request classes, most urgent first.
+// Client lookups are always sent first. Work
+// done ahead of demand (prefetches, refreshes)
+// waits while any client lookup is parked, only
+// goes to peers with fewer than the given
+// number of requests out, and may fill at most
+// half of the pending queue.
+#define HSK_PRIORITY_CLIENT 0
+#define HSK_PRIORITY_PREFETCH 1
+#define HSK_PRIORITY_REFRESH 2
+#define HSK_PRIORITIES 3
+#define HSK_BACKGROUND_SLOTS 4
+
+// Freed requests kept around for reuse.
+#define HSK_REQ_SLAB 1024
+
+// Seconds between saves of the peers file.
+#define HSK_ADDR_FLUSH (15 * 60)
+
+// Message buffers up to this size are kept
+// and reused for the next message.
+#ifdef HSK_LOW_MEMORY
+#define HSK_MSG_KEEP (4 << 10)
+#else
+#define HSK_MSG_KEEP (64 << 10)
+#endif
+
+// Smallest frame worth the trip to the thread
+// pool (see hsk_pool_set_offload): below this,
+// opening it costs less than the handoff.
+#define HSK_OFFLOAD_MIN (16 << 10)
+
+// Room for a name to look up. Only TLDs are
+// ever looked up: low-memory builds keep room
+// for a single label.
+#ifdef HSK_LOW_MEMORY
+#define HSK_NAME_SIZE 64
+#else
+#define HSK_NAME_SIZE 256
+#endif
+
+// Verified proofs kept for the current safe
+// root (least recently used are evicted).
+#define HSK_PROOF_CACHE_SIZE 4096
+
+// Lookup counts are kept for this many names.
+// When the safe root moves, the most popular
+// ones are fetched again ahead of demand, a
+// few (rate) per tick (in ms).
+#define HSK_HOT_NAMES 1024
+#define HSK_REFRESH_NAMES 64
+#define HSK_REFRESH_RATE 4
+#define HSK_REFRESH_TICK 250
+
+// Name hashes (BLAKE2b) remembered for recent
+// names, direct mapped.
+#define HSK_NAME_MEMO 256
+
+// A proof request still unanswered after the
+// given percentile of recent proof latencies
+// (clamped to min/max, in ms) is also sent to
+// a second peer.
+#define HSK_HEDGE_PERCENTILE 95
+#define HSK_HEDGE_SAMPLES 64
+#define HSK_HEDGE_MIN 50
+#define HSK_HEDGE_MAX 2000
+#define HSK_HEDGE_TICK 25
+
+// Proof latency histogram: bucket i counts
+// proofs answered within HSK_STATS_BASE << i
+// ms, the last bucket everything slower.
+#define HSK_STATS_BUCKETS 10
+#define HSK_STATS_BASE 25
+
 #define HSK_STATE_DISCONNECTED 0
 #define HSK_STATE_CONNECTING 2
 #define HSK_STATE_CONNECTED 3
@@ -41,16 +195,100 @@ typedef void (*hsk_resolve_cb)(
   const void *arg
 );
 
+// How a lookup was answered: by which peer
+// (or the proof cache), and the time spent (in
+// microseconds) verifying the proof.
+typedef struct hsk_name_trace_s {
+  uint64_t peer;
+  uint64_t verify;
+  int retries;
+  bool hedged;
+  bool cached;
+} hsk_name_trace_t;
+
 typedef struct hsk_name_req_s {
-  char name[256];
+  char name[HSK_NAME_SIZE];
   uint8_t hash[32];
   uint8_t root[32];
   hsk_resolve_cb callback;
   void *arg;
   int64_t time;
+  uint64_t start;
+  bool hedged;
+  int retries;
+  int priority;
+  hsk_name_trace_t trace;
   struct hsk_name_req_s *next;
+  struct hsk_name_req_s *pending_next;
 } hsk_name_req_t;
 
+typedef struct hsk_name_memo_s {
+  char name[64];
+  uint8_t hash[32];
+} hsk_name_memo_t;
+
+// A peer's outstanding requests by name hash.
+#define hsk_name_hash_equal(a, b) (memcmp((a), (b), 32) == 0)
+
+HSK_TMAP_INIT(
+  name_map,
+  const uint8_t *,
+  hsk_name_req_t *,
+  hsk_map_hash_hash,
+  hsk_name_hash_equal
+)
+
+typedef struct hsk_peer_stats_s {
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t msgs_in;
+  uint64_t msgs_out;
+  uint64_t headers;
+  uint64_t errors;
+  uint64_t latency[HSK_STATS_BUCKETS];
+} hsk_peer_stats_t;
+
+// Counters last as long as the pool. The
+// fields after `errors` are filled in by
+// hsk_pool_get_stats.
+typedef struct hsk_pool_stats_s {
+  uint64_t connects;
+  uint64_t handshakes;
+  uint64_t disconnects;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t msgs_in;
+  uint64_t msgs_out;
+  uint64_t headers;
+  uint64_t headers_rate;
+  uint64_t proofs;
+  uint64_t timeouts;
+  uint64_t watch_hits;
+  uint64_t latency[HSK_STATS_BUCKETS];
+  uint64_t errors[HSK_MAXERROR];
+  int peers;
+  int ready;
+  int pending;
+  int inflight;
+  int watched;
+  int64_t height;
+} hsk_pool_stats_t;
+
+typedef struct hsk_peer_info_s {
+  uint64_t id;
+  char host[HSK_MAX_HOST];
+  int state;
+  int64_t height;
+  int64_t conn_time;
+  int64_t min_ping;
+  uint32_t handshake_rtt;
+  uint64_t proof_rtt;
+  int proofs;
+  int proof_fails;
+  int requests;
+  hsk_peer_stats_t stats;
+} hsk_peer_info_t;
+
 typedef struct hsk_peer_s {
   void *pool;
   hsk_chain_t *chain;
@@ -62,49 +300,180 @@ typedef struct hsk_peer_s {
   hsk_addr_t addr;
   uint16_t port;
   int state;
-  uint8_t read_buffer[HSK_BUFFER_SIZE];
   int headers;
   int proofs;
+  int proof_fails;
+  int proof_strikes;
+  uint64_t proof_rtt;
   int64_t height;
-  hsk_map_t names;
+  uint64_t services;
+  hsk_name_map_t names;
+  hsk_wheel_t timeouts;
+  uint8_t batch_root[32];
+  uint8_t batch[HSK_MAX_PROOFS][32];
+  int batch_count;
   int64_t getheaders_time;
+  bool gap;
   int64_t version_time;
   int64_t last_ping;
   int64_t last_pong;
+  // High-resolution time (ns) the outstanding ping
+  // was sent, and the fastest pong seen (ms).
+  uint64_t ping_start;
   int64_t min_ping;
   int64_t ping_timer;
   uint64_t challenge;
   int64_t conn_time;
+  // Loop time (ms) the connection was opened,
+  // and how long the handshake took.
+  uint64_t open_time;
+  uint32_t handshake_rtt;
   int64_t last_send;
   int64_t last_recv;
   bool msg_hdr;
   uint8_t *msg;
   size_t msg_pos;
   size_t msg_len;
+  size_t msg_size;
   uint8_t msg_cmd;
+  // Reading a headers message as it arrives,
+  // into this batch once the count is in, or
+  // past the rest of it.
+  bool stream;
+  bool stream_skip;
+  void *stream_batch;
+  uint8_t *out;
+  size_t out_size;
+  void *verify;
+  void *proof_jobs;
+  void *read_jobs;
+  uv_buf_t send_bufs[HSK_SEND_BUFS];
+  int send_count;
+  size_t send_bytes;
+  uint64_t send_time;
+  hsk_peer_stats_t stats;
   struct hsk_peer_s *next;
 } hsk_peer_t;
 
+// A lookup handed to the pool from another
+// loop, then back to it with the answer.
+typedef struct hsk_pool_job_s {
+  struct hsk_pool_client_s *client;
+  char name[HSK_NAME_SIZE];
+  int priority;
+  hsk_resolve_cb callback;
+  const void *arg;
+  int status;
+  bool exists;
+  uint8_t *data;
+  size_t data_len;
+  hsk_name_trace_t trace;
+  struct hsk_pool_job_s *next;
+} hsk_pool_job_t;
+
+// Lets a loop other than the pool's resolve
+// names. Lookups are pushed onto the pool's
+// queue and answers onto the client's, both
+// without locks. Callbacks run on the client's
+// loop.
+typedef struct hsk_pool_client_s {
+  uv_loop_t *loop;
+  struct hsk_pool_s *pool;
+  uv_async_t async;
+  hsk_pool_job_t *replies;
+  const hsk_pool_job_t *current;
+  bool running;
+  int senders;
+} hsk_pool_client_t;
+
 typedef struct hsk_pool_s {
   uv_loop_t *loop;
   hsk_ec_t *ec;
   uint8_t key_[32];
   uint8_t *key;
   uint8_t pubkey[33];
+  uint8_t ephemeral[HSK_HANDSHAKE_KEYS][32];
+  uint8_t ephemeral_pub[HSK_HANDSHAKE_KEYS][33];
+  int ephemeral_count;
+  void *keys_job;
   hsk_timedata_t td;
   hsk_chain_t chain;
   hsk_addrman_t am;
   uv_timer_t timer;
+  uv_check_t check;
+  uv_idle_t idle;
+  uv_timer_t flush_timer;
+  uint64_t flush_delay;
+  size_t flush_bytes;
+  uv_timer_t hedge_timer;
+  int hedge_percentile;
+  bool proof_workers;
+  hsk_node_cache_t *nodes;
+  uint64_t hedge_delay;
+  uint64_t rtts[HSK_HEDGE_SAMPLES];
+  size_t rtts_size;
+  size_t rtts_pos;
   uint64_t peer_id;
   hsk_map_t peers;
   hsk_peer_t *head;
   hsk_peer_t *tail;
   int size;
   int max_size;
-  hsk_name_req_t *pending;
+  int max_race;
+  int base_size;
+  int max_grow;
+  int idle_ticks;
+  bool replace;
+  int64_t replace_time;
+  int64_t proof_timeout;
+  int proof_retries;
+  int max_pending;
+  size_t max_proofs;
+  int mem_ticks;
+  int last_af;
+  // A full node of our own (see
+  // hsk_pool_set_node).
+  bool has_node;
+  hsk_addr_t node;
+  size_t offload_size;
+  uv_timer_t refill_timer;
+  hsk_name_req_t *pending[HSK_PRIORITIES];
+  hsk_name_req_t *pending_tail[HSK_PRIORITIES];
+  hsk_name_map_t pending_names;
   int pending_count;
+  hsk_map_t inflight;
+  hsk_map_t proofs;
+  uint8_t proofs_root[32];
+  void *proofs_head;
+  void *proofs_tail;
+  uint64_t proof_hits;
+  uint64_t proof_misses;
+  // Names looked up for clients (see top.h).
+  hsk_top_t hot;
+  hsk_name_memo_t memo[HSK_NAME_MEMO];
+  hsk_slab_t reqs;
+  const hsk_name_trace_t *trace;
+  uv_async_t async;
+  hsk_pool_job_t *jobs;
+  bool accepting;
+  uv_timer_t refresh_timer;
+  hsk_top_item_t refresh[HSK_REFRESH_NAMES];
+  int refresh_count;
+  int refresh_pos;
+  hsk_watch_t watch;
+  int watch_pos;
   int64_t block_time;
   int64_t getheaders_time;
+  uint64_t pow_count;
+  uint64_t pow_last;
+  int64_t pow_time;
+  int64_t addr_time;
+  hsk_pool_stats_t stats;
+  uint64_t headers_last;
+  char prefix_[256];
+  char *prefix;
+  char snapshot_[256];
+  char *snapshot;
 } hsk_pool_t;
 
 /*
@@ -123,9 +492,72 @@ hsk_pool_set_key(hsk_pool_t *pool, const uint8_t *key);
 bool
 hsk_pool_set_size(hsk_pool_t *pool, int max_size);
 
+bool
+hsk_pool_set_race(hsk_pool_t *pool, int max_race);
+
+// Peers the pool may add on top of its size
+// under load (0, the default, for none).
+bool
+hsk_pool_set_grow(hsk_pool_t *pool, int max_grow);
+
 bool
 hsk_pool_set_seeds(hsk_pool_t *pool, const char *seeds);
 
+// A trusted full node close by (key@host:port,
+// NULL for none). It is kept connected, never
+// dropped to make room, and asked for proofs
+// before any other peer while they come back
+// in time. They are checked against our own
+// roots all the same.
+bool
+hsk_pool_set_node(hsk_pool_t *pool, const char *node);
+
+// Frames from peers this big or bigger are
+// opened (and decoded) on the thread pool,
+// for peers connected after (0, the default,
+// for none).
+bool
+hsk_pool_set_offload(hsk_pool_t *pool, size_t size);
+
+bool
+hsk_pool_set_flush(hsk_pool_t *pool, uint64_t delay, size_t bytes);
+
+bool
+hsk_pool_set_hedge(hsk_pool_t *pool, int percentile);
+
+bool
+hsk_pool_set_workers(hsk_pool_t *pool, bool enabled);
+
+bool
+hsk_pool_set_replace(hsk_pool_t *pool, bool enabled);
+
+bool
+hsk_pool_set_timeout(hsk_pool_t *pool, int64_t timeout, int retries);
+
+bool
+hsk_pool_set_pending(hsk_pool_t *pool, int max_pending);
+
+bool
+hsk_pool_set_proof_cache(hsk_pool_t *pool, size_t max_proofs);
+
+bool
+hsk_pool_set_prefix(hsk_pool_t *pool, const char *prefix);
+
+bool
+hsk_pool_set_snapshot(hsk_pool_t *pool, const char *snapshot);
+
+// Read raw serialized headers from a file and
+// add them to the chain, checking each proof
+// of work on the thread pool. Runs the loop
+// until done; for use before the pool opens.
+int
+hsk_pool_import_headers(hsk_pool_t *pool, const char *path);
+
+// Names to keep verified (see watch.h), one per
+// line. Before the pool is opened.
+int
+hsk_pool_watch_list(hsk_pool_t *pool, const char *path, int *count);
+
 hsk_pool_t *
 hsk_pool_alloc(const uv_loop_t *loop);
 
@@ -141,6 +573,21 @@ hsk_pool_close(hsk_pool_t *pool);
 int
 hsk_pool_destroy(hsk_pool_t *pool);
 
+void
+hsk_pool_get_stats(const hsk_pool_t *pool, hsk_pool_stats_t *stats);
+
+int
+hsk_pool_get_peers(const hsk_pool_t *pool, hsk_peer_info_t *peers, int max);
+
+int
+hsk_pool_get_hot(hsk_pool_t *pool, hsk_top_item_t *items, int max);
+
+void
+hsk_pool_log_stats(hsk_pool_t *pool);
+
+const hsk_name_trace_t *
+hsk_pool_get_trace(const hsk_pool_t *pool);
+
 int
 hsk_pool_resolve(
   hsk_pool_t *pool,
@@ -148,4 +595,59 @@ hsk_pool_resolve(
   hsk_resolve_cb callback,
   const void *arg
 );
+
+int
+hsk_pool_resolve_priority(
+  hsk_pool_t *pool,
+  const char *name,
+  int priority,
+  hsk_resolve_cb callback,
+  const void *arg
+);
+
+/*
+ * Client
+ */
+
+int
+hsk_pool_client_init(
+  hsk_pool_client_t *client,
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool
+);
+
+void
+hsk_pool_client_uninit(hsk_pool_client_t *client);
+
+hsk_pool_client_t *
+hsk_pool_client_alloc(const uv_loop_t *loop, const hsk_pool_t *pool);
+
+void
+hsk_pool_client_free(hsk_pool_client_t *client);
+
+int
+hsk_pool_client_open(hsk_pool_client_t *client);
+
+int
+hsk_pool_client_close(hsk_pool_client_t *client);
+
+int
+hsk_pool_client_resolve(
+  hsk_pool_client_t *client,
+  const char *name,
+  hsk_resolve_cb callback,
+  const void *arg
+);
+
+int
+hsk_pool_client_resolve_priority(
+  hsk_pool_client_t *client,
+  const char *name,
+  int priority,
+  hsk_resolve_cb callback,
+  const void *arg
+);
+
+const hsk_name_trace_t *
+hsk_pool_client_get_trace(const hsk_pool_client_t *client);
 #endif
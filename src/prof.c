@@ -0,0 +1,229 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "log.h"
+#include "prof.h"
+#include "uv.h"
+
+bool hsk_prof_enabled = false;
+
+typedef struct hsk_prof_class_s {
+  uint64_t calls;
+  uint64_t time;
+  uint64_t max;
+} hsk_prof_class_t;
+
+// Totals are shared by every thread (workers
+// time their own reads). The monitor watches
+// one loop: time spent in callbacks on each
+// thread is kept apart, so that it only sees
+// its own.
+static struct {
+  uv_prepare_t prepare;
+  uv_check_t check;
+  bool running;
+  uint64_t check_time;
+  uint64_t gap;
+  uint64_t mark;
+  uint64_t iterations;
+  uint64_t stalls;
+  uint64_t max;
+  uint64_t lag[HSK_PROF_BUCKETS];
+  hsk_prof_class_t classes[HSK_PROF_CLASSES];
+} hsk_prof;
+
+static __thread uint64_t hsk_prof_busy;
+static __thread uint64_t hsk_prof_top;
+static __thread int hsk_prof_top_cls;
+
+static const char *hsk_prof_names[HSK_PROF_CLASSES] = {
+  "peer read",
+  "pool timer",
+  "pool check",
+  "headers",
+  "proofs",
+  "ns recv",
+  "ns tcp",
+  "ns sign",
+  "rs recv",
+  "rs tcp",
+  "rs poll"
+};
+
+static void
+hsk_prof_printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("prof: ", fmt, args);
+  va_end(args);
+}
+
+void
+hsk_prof_end(int cls, uint64_t start) {
+  if (start == 0)
+    return;
+
+  assert(cls >= 0 && cls < HSK_PROF_CLASSES);
+
+  uint64_t elapsed = uv_hrtime() - start;
+  hsk_prof_class_t *c = &hsk_prof.classes[cls];
+  uint64_t max = __atomic_load_n(&c->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&c->time, elapsed, __ATOMIC_RELAXED);
+
+  while (elapsed > max) {
+    if (__atomic_compare_exchange_n(&c->max, &max, elapsed, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  hsk_prof_busy += elapsed;
+
+  if (elapsed > hsk_prof_top) {
+    hsk_prof_top = elapsed;
+    hsk_prof_top_cls = cls;
+  }
+}
+
+// About to poll: whatever ran since the last
+// check (timers, mostly) held the loop.
+static void
+after_prepare(uv_prepare_t *handle) {
+  uint64_t now = uv_hrtime();
+
+  hsk_prof.gap = hsk_prof.check_time ? now - hsk_prof.check_time : 0;
+  hsk_prof.mark = hsk_prof_busy;
+}
+
+// Done with I/O: add what its callbacks took.
+// Waiting in poll is not counted.
+static void
+after_check(uv_check_t *handle) {
+  uint64_t now = uv_hrtime();
+  uint64_t stall = hsk_prof.gap + (hsk_prof_busy - hsk_prof.mark);
+  uint64_t us = stall / 1000;
+  int i;
+
+  for (i = 0; i < HSK_PROF_BUCKETS - 1; i++) {
+    if (us <= ((uint64_t)HSK_PROF_BASE << i))
+      break;
+  }
+
+  hsk_prof.lag[i] += 1;
+  hsk_prof.iterations += 1;
+
+  if (stall > hsk_prof.max)
+    hsk_prof.max = stall;
+
+  if (us > HSK_PROF_STALL * 1000) {
+    hsk_prof.stalls += 1;
+
+    if (hsk_prof_top > 0) {
+      hsk_prof_printf("loop stalled for %lums (%s: %lums)\n",
+                      us / 1000, hsk_prof_names[hsk_prof_top_cls],
+                      hsk_prof_top / 1000000);
+    } else {
+      hsk_prof_printf("loop stalled for %lums\n", us / 1000);
+    }
+  }
+
+  hsk_prof_top = 0;
+  hsk_prof.gap = 0;
+  hsk_prof.check_time = now;
+}
+
+// Turns on the timers everywhere, and watches
+// the given loop.
+int
+hsk_prof_open(uv_loop_t *loop) {
+  assert(loop && !hsk_prof.running);
+
+  memset(&hsk_prof, 0, sizeof(hsk_prof));
+
+  if (uv_prepare_init(loop, &hsk_prof.prepare) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_check_init(loop, &hsk_prof.check) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_prepare_start(&hsk_prof.prepare, after_prepare) != 0)
+    return HSK_EFAILURE;
+
+  if (uv_check_start(&hsk_prof.check, after_check) != 0) {
+    uv_prepare_stop(&hsk_prof.prepare);
+    return HSK_EFAILURE;
+  }
+
+  // Do not keep the loop alive by themselves.
+  uv_unref((uv_handle_t *)&hsk_prof.prepare);
+  uv_unref((uv_handle_t *)&hsk_prof.check);
+
+  hsk_prof.running = true;
+  hsk_prof_enabled = true;
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_prof_close(void) {
+  if (!hsk_prof.running)
+    return;
+
+  hsk_prof_enabled = false;
+
+  uv_prepare_stop(&hsk_prof.prepare);
+  uv_check_stop(&hsk_prof.check);
+  uv_close((uv_handle_t *)&hsk_prof.prepare, NULL);
+  uv_close((uv_handle_t *)&hsk_prof.check, NULL);
+
+  hsk_prof.running = false;
+}
+
+void
+hsk_prof_log(void) {
+  if (!hsk_prof.running)
+    return;
+
+  hsk_prof_printf("%lu loop iterations, %lu stalls, longest %luus\n",
+                  hsk_prof.iterations, hsk_prof.stalls, hsk_prof.max / 1000);
+
+  int i;
+
+  for (i = 0; i < HSK_PROF_BUCKETS; i++) {
+    uint64_t count = hsk_prof.lag[i];
+
+    if (count == 0)
+      continue;
+
+    if (i == HSK_PROF_BUCKETS - 1) {
+      hsk_prof_printf("iterations over %luus: %lu\n",
+                      (uint64_t)HSK_PROF_BASE << (i - 1), count);
+    } else {
+      hsk_prof_printf("iterations within %luus: %lu\n",
+                      (uint64_t)HSK_PROF_BASE << i, count);
+    }
+  }
+
+  for (i = 0; i < HSK_PROF_CLASSES; i++) {
+    const hsk_prof_class_t *c = &hsk_prof.classes[i];
+    uint64_t calls = __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+    uint64_t time = __atomic_load_n(&c->time, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&c->max, __ATOMIC_RELAXED);
+
+    if (calls == 0)
+      continue;
+
+    hsk_prof_printf("%s: %lu calls, %luus total, %luus avg, %luus max\n",
+                    hsk_prof_names[i], calls, time / 1000,
+                    time / calls / 1000, max / 1000);
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef _HSK_PROF_H
+#define _HSK_PROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "uv.h"
+
+// Callbacks timed, by what woke the loop. Only
+// outermost ones: a proof answered in a read is
+// counted as the read.
+#define HSK_PROF_PEER_READ 0
+#define HSK_PROF_POOL_TIMER 1
+#define HSK_PROF_POOL_CHECK 2
+#define HSK_PROF_HEADERS 3
+#define HSK_PROF_PROOFS 4
+#define HSK_PROF_NS_RECV 5
+#define HSK_PROF_NS_TCP 6
+#define HSK_PROF_NS_SIGN 7
+#define HSK_PROF_RS_RECV 8
+#define HSK_PROF_RS_TCP 9
+#define HSK_PROF_RS_POLL 10
+#define HSK_PROF_CLASSES 11
+
+// Loop iterations are timed in log2 buckets:
+// within HSK_PROF_BASE << i microseconds, the
+// last one open ended. Any longer than
+// HSK_PROF_STALL (ms) are logged as they end.
+#define HSK_PROF_BUCKETS 16
+#define HSK_PROF_BASE 64
+#define HSK_PROF_STALL 50
+
+extern bool hsk_prof_enabled;
+
+// Zero when profiling is off (the end is then
+// a no-op).
+static inline uint64_t
+hsk_prof_start(void) {
+  return hsk_prof_enabled ? uv_hrtime() : 0;
+}
+
+void
+hsk_prof_end(int cls, uint64_t start);
+
+int
+hsk_prof_open(uv_loop_t *loop);
+
+void
+hsk_prof_close(void);
+
+void
+hsk_prof_log(void);
+#endif
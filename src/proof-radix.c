@@ -12,6 +12,8 @@
 #include "constants.h"
 #include "error.h"
 #include "hash.h"
+#include "map.h"
+#include "mem.h"
 #include "proof.h"
 
 #define HSK_HAS_BIT(m, i) (((m)[(i) >> 3] >> (7 - ((i) & 7))) & 1)
@@ -48,6 +50,17 @@ read_bitlen(uint8_t **data, size_t *data_len, uint16_t *bits, size_t *bytes) {
   return true;
 }
 
+static size_t
+write_bitlen(uint8_t **data, uint16_t bits) {
+  if (bits < 0x80)
+    return write_u8(data, (uint8_t)bits);
+
+  size_t size = write_u8(data, 0x80 | (uint8_t)(bits >> 8));
+  size += write_u8(data, (uint8_t)bits);
+
+  return size;
+}
+
 void
 hsk_proof_init(hsk_proof_t *proof) {
   assert(proof);
@@ -63,124 +76,123 @@ hsk_proof_init(hsk_proof_t *proof) {
   proof->nx_hash = NULL;
   proof->value = NULL;
   proof->value_size = 0;
+  proof->view = false;
 }
 
 hsk_proof_t *
 hsk_proof_alloc(void) {
-  hsk_proof_t *proof = malloc(sizeof(hsk_proof_t));
+  hsk_proof_t *proof = hsk_malloc(sizeof(hsk_proof_t));
   if (proof)
     hsk_proof_init(proof);
   return proof;
 }
 
+// The nodes are the one allocation: an owned
+// proof keeps the rest after them (see
+// hsk_proof_own_tail), a view borrows it.
 void
 hsk_proof_uninit(hsk_proof_t *proof) {
   assert(proof);
 
-  if (proof->nodes) {
-    free(proof->nodes);
-    proof->nodes = NULL;
-    proof->node_count = 0;
-  }
-
-  if (proof->prefix) {
-    free(proof->prefix);
-    proof->prefix = NULL;
-    proof->prefix_size = 0;
-  }
-
-  if (proof->left) {
-    free(proof->left);
-    proof->left = NULL;
-  }
-
-  if (proof->right) {
-    free(proof->right);
-    proof->right = NULL;
-  }
+  if (proof->nodes)
+    hsk_free(proof->nodes);
 
-  if (proof->nx_key) {
-    free(proof->nx_key);
-    proof->nx_key = NULL;
-  }
-
-  if (proof->nx_hash) {
-    free(proof->nx_hash);
-    proof->nx_hash = NULL;
-  }
-
-  if (proof->value) {
-    free(proof->value);
-    proof->value = NULL;
-    proof->value_size = 0;
-  }
+  hsk_proof_init(proof);
 }
 
 void
 hsk_proof_free(hsk_proof_t *proof) {
   assert(proof);
   hsk_proof_uninit(proof);
-  free(proof);
+  hsk_free(proof);
 }
 
-bool
-hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
-  assert(data && proof);
-  assert(proof->node_count == 0);
-
-  uint16_t field;
+// Bytes after the nodes of an owned proof.
+static size_t
+hsk_proof_tail_size(const hsk_proof_t *proof) {
+  size_t size = 0;
 
-  if (!read_u16(data, data_len, &field))
-    return false;
+  if (proof->prefix)
+    size += ((size_t)proof->prefix_size + 7) / 8;
 
-  proof->type = field >> 14;
-  proof->depth = field & ~(3 << 14);
+  if (proof->left)
+    size += 32;
 
-  if (proof->depth > 256)
-    return false;
+  if (proof->right)
+    size += 32;
 
-  uint16_t count;
+  if (proof->nx_key)
+    size += 32;
 
-  if (!read_u16(data, data_len, &count))
-    return false;
+  if (proof->nx_hash)
+    size += 32;
 
-  if (count > 256)
-    return false;
+  if (proof->value)
+    size += proof->value_size;
 
-  size_t bsize = (count + 7) / 8;
-  uint8_t *map;
+  return size;
+}
 
-  if (!slice_bytes(data, data_len, &map, bsize))
-    return false;
+static void
+place_bytes(uint8_t **field, size_t size, uint8_t **out) {
+  if (!*field)
+    return;
 
-  proof->nodes = calloc(count, sizeof(hsk_proof_node_t));
+  memcpy(*out, *field, size);
 
-  if (count > 0 && !proof->nodes)
-    return false;
+  *field = *out;
+  *out += size;
+}
 
-  proof->node_count = count;
+// Copy the fields after the nodes to `out`
+// (hsk_proof_tail_size bytes) and point them
+// there.
+static void
+hsk_proof_own_tail(hsk_proof_t *proof, uint8_t *out) {
+  place_bytes(&proof->prefix, ((size_t)proof->prefix_size + 7) / 8, &out);
+  place_bytes(&proof->left, 32, &out);
+  place_bytes(&proof->right, 32, &out);
+  place_bytes(&proof->nx_key, 32, &out);
+  place_bytes(&proof->nx_hash, 32, &out);
+  place_bytes(&proof->value, proof->value_size, &out);
+}
 
-  size_t i;
-  for (i = 0; i < count; i++) {
-    hsk_proof_node_t *item = &proof->nodes[i];
+// Deep copy (also of a view), in one
+// allocation.
+bool
+hsk_proof_copy(hsk_proof_t *proof, const hsk_proof_t *other) {
+  assert(proof && other);
 
-    if (HSK_HAS_BIT(map, i)) {
-      uint16_t size;
-      size_t bytes;
+  *proof = *other;
 
-      if (!read_bitlen(data, data_len, &size, &bytes))
-        goto fail;
+  size_t nodes_size = other->node_count * sizeof(hsk_proof_node_t);
+  size_t size = nodes_size + hsk_proof_tail_size(other);
+  uint8_t *arena = NULL;
 
-      if (!read_bytes(data, data_len, &item->prefix[0], bytes))
-        goto fail;
+  if (size > 0) {
+    arena = hsk_malloc(size);
 
-      item->prefix_size = size;
+    if (!arena) {
+      hsk_proof_init(proof);
+      return false;
     }
 
-    if (!read_bytes(data, data_len, &item->node[0], 32))
-      goto fail;
+    if (nodes_size > 0)
+      memcpy(arena, other->nodes, nodes_size);
   }
 
+  proof->nodes = (hsk_proof_node_t *)arena;
+  proof->view = false;
+
+  hsk_proof_own_tail(proof, arena + nodes_size);
+
+  return true;
+}
+
+// What follows the nodes, by type, borrowed
+// from `data`.
+static bool
+hsk_proof_read_tail(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
   switch (proof->type) {
     case HSK_PROOF_DEADEND: {
       break;
@@ -191,41 +203,41 @@ hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
       size_t bytes;
 
       if (!read_bitlen(data, data_len, &size, &bytes))
-        goto fail;
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->prefix, bytes))
-        goto fail;
+      if (!slice_bytes(data, data_len, &proof->prefix, bytes))
+        return false;
 
       proof->prefix_size = size;
 
-      if (!alloc_bytes(data, data_len, &proof->left, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, &proof->left, 32))
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->right, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, &proof->right, 32))
+        return false;
 
       break;
     }
 
     case HSK_PROOF_COLLISION: {
-      if (!alloc_bytes(data, data_len, &proof->nx_key, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, &proof->nx_key, 32))
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->nx_hash, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, &proof->nx_hash, 32))
+        return false;
 
       break;
     }
 
     case HSK_PROOF_EXISTS: {
       if (!read_u16(data, data_len, &proof->value_size))
-        goto fail;
+        return false;
 
       if (proof->value_size > HSK_MAX_DATA_SIZE)
-        goto fail;
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->value, proof->value_size))
-        goto fail;
+      if (!slice_bytes(data, data_len, &proof->value, proof->value_size))
+        return false;
 
       break;
     }
@@ -234,18 +246,450 @@ hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
       assert(0 && "bad type");
       break;
     }
-  }
+  }
+
+  return true;
+}
+
+// A bitmap of the nodes with a prefix, then
+// the nodes. They must be zeroed, or NULL to
+// skip over them.
+static bool
+hsk_proof_read_nodes(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_proof_node_t *nodes,
+  size_t count
+) {
+  size_t bsize = (count + 7) / 8;
+  uint8_t *map;
+
+  if (!slice_bytes(data, data_len, &map, bsize))
+    return false;
+
+  size_t i;
+  for (i = 0; i < count; i++) {
+    uint8_t *p;
+
+    if (HSK_HAS_BIT(map, i)) {
+      uint16_t size;
+      size_t bytes;
+
+      if (!read_bitlen(data, data_len, &size, &bytes))
+        return false;
+
+      if (!slice_bytes(data, data_len, &p, bytes))
+        return false;
+
+      if (nodes) {
+        memcpy(nodes[i].prefix, p, bytes);
+        nodes[i].prefix_size = size;
+      }
+    }
+
+    if (!slice_bytes(data, data_len, &p, 32))
+      return false;
+
+    if (nodes)
+      memcpy(nodes[i].node, p, 32);
+  }
+
+  return true;
+}
+
+// Type and depth, then the node count.
+static bool
+hsk_proof_read_head(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_proof_t *proof,
+  uint16_t *count
+) {
+  uint8_t *p;
+
+  if (!slice_bytes(data, data_len, &p, 4))
+    return false;
+
+  uint16_t field = get_u16(p);
+
+  proof->type = field >> 14;
+  proof->depth = field & ~(3 << 14);
+
+  if (proof->depth > 256)
+    return false;
+
+  *count = get_u16(p + 2);
+
+  if (*count > 256)
+    return false;
+
+  return true;
+}
+
+static bool
+hsk_proof__read(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_proof_t *proof,
+  bool view
+) {
+  assert(data && proof);
+  assert(proof->node_count == 0);
+
+  uint16_t count;
+
+  if (!hsk_proof_read_head(data, data_len, proof, &count))
+    return false;
+
+  // Find the tail first (borrowing it), so an
+  // owned proof is sized from the wire and
+  // decoded into one allocation.
+  uint8_t *tail = *data;
+  size_t tail_len = *data_len;
+
+  if (!hsk_proof_read_nodes(&tail, &tail_len, NULL, count))
+    return false;
+
+  if (!hsk_proof_read_tail(&tail, &tail_len, proof))
+    return false;
+
+  size_t nodes_size = (size_t)count * sizeof(hsk_proof_node_t);
+  size_t size = nodes_size;
+
+  if (!view)
+    size += hsk_proof_tail_size(proof);
+
+  uint8_t *arena = NULL;
+
+  if (size > 0) {
+    arena = hsk_malloc(size);
+
+    if (!arena)
+      return false;
+
+    memset(arena, 0x00, nodes_size);
+  }
+
+  if (!hsk_proof_read_nodes(data, data_len,
+                            (hsk_proof_node_t *)arena, count)) {
+    hsk_free(arena);
+    return false;
+  }
+
+  proof->nodes = (hsk_proof_node_t *)arena;
+  proof->node_count = count;
+  proof->view = view;
+
+  if (!view)
+    hsk_proof_own_tail(proof, arena + nodes_size);
+
+  *data = tail;
+  *data_len = tail_len;
+
+  return true;
+}
+
+bool
+hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
+  return hsk_proof__read(data, data_len, proof, false);
+}
+
+// Like hsk_proof_read, but the proof borrows
+// from `data`, which must outlive it. Only the
+// decoded nodes are allocated.
+bool
+hsk_proof_read_view(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
+  return hsk_proof__read(data, data_len, proof, true);
+}
+
+bool
+hsk_proof_decode(const uint8_t *data, size_t data_len, hsk_proof_t *proof) {
+  return hsk_proof_read((uint8_t **)&data, &data_len, proof);
+}
+
+// The node table of a multiproof: every node
+// its proofs go through, once.
+bool
+hsk_proof_read_table(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_proof_node_t **table,
+  size_t *table_size
+) {
+  size_t count;
+
+  if (!read_varsize(data, data_len, &count))
+    return false;
+
+  if (count > HSK_PROOF_TABLE_MAX)
+    return false;
+
+  hsk_proof_node_t *nodes = hsk_calloc(count, sizeof(hsk_proof_node_t));
+
+  if (count > 0 && !nodes)
+    return false;
+
+  if (!hsk_proof_read_nodes(data, data_len, nodes, count)) {
+    hsk_free(nodes);
+    return false;
+  }
+
+  *table = nodes;
+  *table_size = count;
+
+  return true;
+}
+
+// A proof out of a multiproof: nodes are given
+// as u16 indexes into the table, and copied
+// out of it. Otherwise a view, as above.
+bool
+hsk_proof_read_indexed(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_proof_t *proof,
+  const hsk_proof_node_t *table,
+  size_t table_size
+) {
+  assert(data && proof);
+  assert(proof->node_count == 0);
+
+  proof->view = true;
+
+  uint16_t count;
+
+  if (!hsk_proof_read_head(data, data_len, proof, &count))
+    return false;
+
+  proof->nodes = hsk_malloc(count * sizeof(hsk_proof_node_t));
+
+  if (count > 0 && !proof->nodes)
+    return false;
+
+  proof->node_count = count;
+
+  size_t i;
+  for (i = 0; i < count; i++) {
+    uint16_t index;
+
+    if (!read_u16(data, data_len, &index) || index >= table_size)
+      goto fail;
+
+    proof->nodes[i] = table[index];
+  }
+
+  if (!hsk_proof_read_tail(data, data_len, proof))
+    goto fail;
+
+  return true;
+
+fail:
+  hsk_proof_uninit(proof);
+  return false;
+}
+
+/*
+ * Writing
+ */
+
+static size_t
+hsk_proof_write_tail(uint8_t **data, const hsk_proof_t *proof) {
+  size_t size = 0;
+
+  switch (proof->type) {
+    case HSK_PROOF_SHORT: {
+      size += write_bitlen(data, proof->prefix_size);
+      size += write_bytes(data, proof->prefix,
+                          ((size_t)proof->prefix_size + 7) / 8);
+      size += write_bytes(data, proof->left, 32);
+      size += write_bytes(data, proof->right, 32);
+      break;
+    }
+
+    case HSK_PROOF_COLLISION: {
+      size += write_bytes(data, proof->nx_key, 32);
+      size += write_bytes(data, proof->nx_hash, 32);
+      break;
+    }
+
+    case HSK_PROOF_EXISTS: {
+      size += write_u16(data, proof->value_size);
+      size += write_bytes(data, proof->value, proof->value_size);
+      break;
+    }
+  }
+
+  return size;
+}
+
+static bool
+hsk_proof_node_equal(const hsk_proof_node_t *a, const hsk_proof_node_t *b) {
+  if (a->prefix_size != b->prefix_size)
+    return false;
+
+  if (memcmp(a->node, b->node, 32) != 0)
+    return false;
+
+  return memcmp(a->prefix, b->prefix, ((size_t)a->prefix_size + 7) / 8) == 0;
+}
+
+// Nodes go from the root down, so the keys of
+// neighbouring proofs share the first few: a
+// node equal to the one in the same place in
+// the proof before is left out of the table.
+// That needs no memory of its own, so sizing
+// a message always agrees with writing it.
+static bool
+hsk_proof_table_shared(const hsk_proof_t *const *proofs, size_t p, size_t i) {
+  if (p == 0 || i >= proofs[p - 1]->node_count)
+    return false;
+
+  return hsk_proof_node_equal(&proofs[p - 1]->nodes[i], &proofs[p]->nodes[i]);
+}
+
+// The reverse of hsk_proof_read_table.
+int
+hsk_proof_write_table(
+  uint8_t **data,
+  const hsk_proof_t *const *proofs,
+  size_t count
+) {
+  size_t total = 0;
+  size_t p, i;
+
+  for (p = 0; p < count; p++) {
+    for (i = 0; i < proofs[p]->node_count; i++) {
+      if (!hsk_proof_table_shared(proofs, p, i))
+        total += 1;
+    }
+  }
+
+  if (total > HSK_PROOF_TABLE_MAX)
+    return -1;
+
+  size_t size = write_varsize(data, total);
+
+  // The bitmap of nodes with a prefix, a byte
+  // at a time.
+  uint8_t bits = 0;
+  size_t n = 0;
+
+  for (p = 0; p < count; p++) {
+    for (i = 0; i < proofs[p]->node_count; i++) {
+      if (hsk_proof_table_shared(proofs, p, i))
+        continue;
+
+      if (proofs[p]->nodes[i].prefix_size > 0)
+        bits |= 0x80 >> (n & 7);
+
+      n += 1;
+
+      if ((n & 7) == 0) {
+        size += write_u8(data, bits);
+        bits = 0;
+      }
+    }
+  }
+
+  if (n & 7)
+    size += write_u8(data, bits);
+
+  for (p = 0; p < count; p++) {
+    for (i = 0; i < proofs[p]->node_count; i++) {
+      const hsk_proof_node_t *node = &proofs[p]->nodes[i];
+
+      if (hsk_proof_table_shared(proofs, p, i))
+        continue;
+
+      if (node->prefix_size > 0) {
+        size += write_bitlen(data, node->prefix_size);
+        size += write_bytes(data, node->prefix,
+                            ((size_t)node->prefix_size + 7) / 8);
+      }
+
+      size += write_bytes(data, node->node, 32);
+    }
+  }
+
+  return (int)size;
+}
+
+// The reverse of hsk_proof_read_indexed, for
+// proofs[index] in a table written as above.
+int
+hsk_proof_write_indexed(
+  uint8_t **data,
+  const hsk_proof_t *const *proofs,
+  size_t index
+) {
+  uint16_t where[256];
+  uint16_t next = 0;
+  size_t p, i;
+
+  // Where each node of every proof up to this
+  // one went (shared ones where they were).
+  for (p = 0; p <= index; p++) {
+    for (i = 0; i < proofs[p]->node_count; i++) {
+      if (!hsk_proof_table_shared(proofs, p, i))
+        where[i] = next++;
+    }
+  }
+
+  const hsk_proof_t *proof = proofs[index];
+  size_t size = 0;
+
+  assert(proof->depth <= 256 && proof->node_count <= 256);
+
+  size += write_u16(data, ((uint16_t)proof->type << 14) | proof->depth);
+  size += write_u16(data, proof->node_count);
+
+  for (i = 0; i < proof->node_count; i++)
+    size += write_u16(data, where[i]);
+
+  size += hsk_proof_write_tail(data, proof);
+
+  return (int)size;
+}
+
+// The reverse of hsk_proof_read.
+int
+hsk_proof_write(uint8_t **data, const hsk_proof_t *proof) {
+  size_t size = 0;
+  size_t i;
+
+  assert(proof->depth <= 256 && proof->node_count <= 256);
+
+  size += write_u16(data, ((uint16_t)proof->type << 14) | proof->depth);
+  size += write_u16(data, proof->node_count);
+
+  // The bitmap of nodes with a prefix.
+  uint8_t map[32];
+  size_t bsize = ((size_t)proof->node_count + 7) / 8;
+
+  memset(map, 0x00, sizeof(map));
+
+  for (i = 0; i < proof->node_count; i++) {
+    if (proof->nodes[i].prefix_size > 0)
+      map[i >> 3] |= 0x80 >> (i & 7);
+  }
+
+  size += write_bytes(data, map, bsize);
+
+  for (i = 0; i < proof->node_count; i++) {
+    const hsk_proof_node_t *node = &proof->nodes[i];
+
+    if (node->prefix_size > 0) {
+      size += write_bitlen(data, node->prefix_size);
+      size += write_bytes(data, node->prefix,
+                          ((size_t)node->prefix_size + 7) / 8);
+    }
 
-  return true;
+    size += write_bytes(data, node->node, 32);
+  }
 
-fail:
-  hsk_proof_uninit(proof);
-  return false;
-}
+  size += hsk_proof_write_tail(data, proof);
 
-bool
-hsk_proof_decode(const uint8_t *data, size_t data_len, hsk_proof_t *proof) {
-  return hsk_proof_read((uint8_t **)&data, &data_len, proof);
+  return (int)size;
 }
 
 static void
@@ -304,6 +748,36 @@ hsk_proof_hash_value(
   hsk_proof_hash_leaf(key, out, out);
 }
 
+// 64 bits of `data` (`len` bytes) from bit
+// `pos`, first bit highest. Zero past the end.
+static inline uint64_t
+hsk_proof_bits(const uint8_t *data, size_t len, size_t pos) {
+  size_t off = pos >> 3;
+  int shift = pos & 7;
+  uint8_t buf[9];
+  const uint8_t *p;
+
+  if (off + 9 <= len) {
+    p = data + off;
+  } else {
+    memset(buf, 0x00, 9);
+
+    if (off < len)
+      memcpy(buf, data + off, len - off);
+
+    p = buf;
+  }
+
+  uint64_t word = get_u64be(p);
+
+  if (shift != 0)
+    word = (word << shift) | (p[8] >> (8 - shift));
+
+  return word;
+}
+
+// Whether the key continues with the prefix at
+// `depth`. Compared a word at a time.
 static bool
 hsk_proof_has(
   const uint8_t *prefix,
@@ -311,29 +785,29 @@ hsk_proof_has(
   const uint8_t *key,
   uint16_t depth
 ) {
-  int xs = prefix_size;
-  int ys = 256 - depth;
-  int len = xs < ys ? xs : ys;
+  assert(depth <= 256);
 
-  assert(len >= 0 && len <= 256);
+  if (prefix_size > 256 - depth)
+    return false;
 
-  int x = 0;
-  int y = depth;
-  int c = 0;
+  size_t bytes = ((size_t)prefix_size + 7) / 8;
   int i;
 
-  for (i = 0; i < len; i++) {
-    if (HSK_HAS_BIT(prefix, x) != HSK_HAS_BIT(key, y))
-      break;
+  for (i = 0; i < prefix_size; i += 64) {
+    int left = prefix_size - i;
+    uint64_t mask = left >= 64 ? UINT64_MAX : ~(UINT64_MAX >> left);
+    uint64_t x = hsk_proof_bits(prefix, bytes, i);
+    uint64_t y = hsk_proof_bits(key, 32, depth + i);
 
-    x += 1;
-    y += 1;
-    c += 1;
+    if ((x ^ y) & mask)
+      return false;
   }
 
-  return c == prefix_size;
+  return true;
 }
 
+// The resource is left in place (a view into
+// the value).
 static bool
 hsk_parse_namestate(
   uint8_t *data,
@@ -359,7 +833,7 @@ hsk_parse_namestate(
   if (!read_u16(&data, &data_len, &res_size))
     return false;
 
-  if (!alloc_bytes(&data, &data_len, res, res_size))
+  if (!slice_bytes(&data, &data_len, res, res_size))
     return false;
 
   *res_len = res_size;
@@ -367,26 +841,138 @@ hsk_parse_namestate(
   return true;
 }
 
-int
-hsk_proof_verify(
+/*
+ * Node Cache
+ */
+
+hsk_node_cache_t *
+hsk_node_cache_alloc(void) {
+  hsk_node_cache_t *cache = hsk_malloc(sizeof(hsk_node_cache_t));
+
+  if (!cache)
+    return NULL;
+
+  if (uv_mutex_init(&cache->lock) != 0) {
+    hsk_free(cache);
+    return NULL;
+  }
+
+  memset(cache->entries, 0, sizeof(cache->entries));
+  cache->hits = 0;
+  cache->misses = 0;
+
+  return cache;
+}
+
+void
+hsk_node_cache_free(hsk_node_cache_t *cache) {
+  if (!cache)
+    return;
+
+  uv_mutex_destroy(&cache->lock);
+  hsk_free(cache);
+}
+
+// The first `depth` bits of the key: where the
+// node sits in the tree.
+static void
+hsk_node_path(const uint8_t *key, uint16_t depth, uint8_t *path) {
+  size_t bytes = ((size_t)depth + 7) / 8;
+
+  memset(path, 0x00, 32);
+  memcpy(path, key, bytes);
+
+  if (depth & 7)
+    path[depth >> 3] &= 0xff << (8 - (depth & 7));
+}
+
+static hsk_node_entry_t *
+hsk_node_slot(
+  hsk_node_cache_t *cache,
+  const uint8_t *root,
+  const uint8_t *path,
+  uint16_t depth
+) {
+  uint32_t h = hsk_map_murmur3(path, ((size_t)depth + 7) / 8, depth);
+
+  h ^= (uint32_t)root[0] | ((uint32_t)root[1] << 8);
+
+  return &cache->entries[h % HSK_NODE_CACHE_SIZE];
+}
+
+static bool
+hsk_node_cache_has(
+  hsk_node_cache_t *cache,
   const uint8_t *root,
   const uint8_t *key,
-  const hsk_proof_t *proof,
-  bool *exists,
-  uint8_t **data,
-  size_t *data_len
+  uint16_t depth,
+  const uint8_t *hash
 ) {
-  if (root == NULL || key == NULL || proof == NULL)
-    return HSK_EBADARGS;
+  uint8_t path[32];
+  hsk_node_path(key, depth, path);
 
-  uint8_t leaf[32];
+  uv_mutex_lock(&cache->lock);
 
-  assert(proof->depth <= 256);
-  assert(proof->nodes || proof->node_count == 0);
-  assert(proof->node_count <= 256);
-  assert(proof->value_size <= HSK_MAX_DATA_SIZE);
+  hsk_node_entry_t *entry = hsk_node_slot(cache, root, path, depth);
+
+  bool has = entry->valid
+          && entry->depth == depth
+          && memcmp(entry->hash, hash, 32) == 0
+          && memcmp(entry->path, path, 32) == 0
+          && memcmp(entry->root, root, 32) == 0;
+
+  uv_mutex_unlock(&cache->lock);
 
-  // Re-create the leaf.
+  return has;
+}
+
+static void
+hsk_node_cache_add(
+  hsk_node_cache_t *cache,
+  const uint8_t *root,
+  const uint8_t *key,
+  uint16_t depth,
+  const uint8_t *hash
+) {
+  uint8_t path[32];
+  hsk_node_path(key, depth, path);
+
+  uv_mutex_lock(&cache->lock);
+
+  hsk_node_entry_t *entry = hsk_node_slot(cache, root, path, depth);
+
+  memcpy(entry->root, root, 32);
+  memcpy(entry->path, path, 32);
+  memcpy(entry->hash, hash, 32);
+  entry->depth = depth;
+  entry->valid = true;
+
+  uv_mutex_unlock(&cache->lock);
+}
+
+static void
+hsk_node_cache_count(hsk_node_cache_t *cache, bool hit) {
+  uv_mutex_lock(&cache->lock);
+
+  if (hit)
+    cache->hits += 1;
+  else
+    cache->misses += 1;
+
+  uv_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Verify
+ */
+
+// Re-create the leaf.
+static int
+hsk_proof_rebuild_leaf(
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  uint8_t *leaf
+) {
   switch (proof->type) {
     case HSK_PROOF_DEADEND: {
       memset(leaf, 0x00, 32);
@@ -434,10 +1020,125 @@ hsk_proof_verify(
       break;
   }
 
+  return HSK_EPROOFOK;
+}
+
+static int
+hsk_proof_result(
+  const hsk_proof_t *proof,
+  bool *exists,
+  const uint8_t **data,
+  size_t *data_len
+) {
+  if (proof->type == HSK_PROOF_EXISTS) {
+    uint8_t *res;
+
+    if (!hsk_parse_namestate(proof->value, proof->value_size, &res, data_len))
+      return HSK_EENCODING;
+
+    *data = res;
+
+    *exists = true;
+  } else {
+    *data = NULL;
+    *data_len = 0;
+    *exists = false;
+  }
+
+  return HSK_EPROOFOK;
+}
+
+int
+hsk_proof_verify(
+  const uint8_t *root,
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  bool *exists,
+  uint8_t **data,
+  size_t *data_len
+) {
+  return hsk_proof_verify_cached(root, key, proof, NULL,
+                                 exists, data, data_len);
+}
+
+// Returns a copy of the resource (free it).
+int
+hsk_proof_verify_cached(
+  const uint8_t *root,
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  hsk_node_cache_t *cache,
+  bool *exists,
+  uint8_t **data,
+  size_t *data_len
+) {
+  const uint8_t *view;
+  size_t view_len;
+
+  int rc = hsk_proof_verify_view(root, key, proof, cache,
+                                 exists, &view, &view_len);
+
+  if (rc != HSK_EPROOFOK)
+    return rc;
+
+  *data = NULL;
+  *data_len = 0;
+
+  if (view_len > 0) {
+    *data = hsk_malloc(view_len);
+
+    if (!*data)
+      return HSK_ENOMEM;
+
+    memcpy(*data, view, view_len);
+    *data_len = view_len;
+  }
+
+  return HSK_EPROOFOK;
+}
+
+// With a cache, the walk up stops at the first
+// node already known to hash up to this root at
+// the same position: everything above it was
+// checked by an earlier proof.
+//
+// The resource returned points into the proof's
+// value and lives as long as the proof does.
+int
+hsk_proof_verify_view(
+  const uint8_t *root,
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  hsk_node_cache_t *cache,
+  bool *exists,
+  const uint8_t **data,
+  size_t *data_len
+) {
+  if (root == NULL || key == NULL || proof == NULL)
+    return HSK_EBADARGS;
+
+  uint8_t leaf[32];
+
+  assert(proof->depth <= 256);
+  assert(proof->nodes || proof->node_count == 0);
+  assert(proof->node_count <= 256);
+  assert(proof->value_size <= HSK_MAX_DATA_SIZE);
+
+  int rc = hsk_proof_rebuild_leaf(key, proof, leaf);
+
+  if (rc != HSK_EPROOFOK)
+    return rc;
+
   uint8_t *next = &leaf[0];
   int depth = (int)proof->depth;
   int i = ((int)proof->node_count) - 1;
 
+  // Nodes nearest the root (a ring).
+  uint8_t seen[HSK_NODE_CACHE_DEPTH][32];
+  uint16_t seen_depth[HSK_NODE_CACHE_DEPTH];
+  int seen_count = 0;
+  bool hit = false;
+
   // Traverse bits right to left.
   for (; i >= 0; i--) {
     hsk_proof_node_t *item = &proof->nodes[i];
@@ -459,24 +1160,248 @@ hsk_proof_verify(
 
     if (!hsk_proof_has(prefix, prefix_size, key, depth))
       return HSK_EPATHMISMATCH;
+
+    if (!cache || depth == 0)
+      continue;
+
+    if (hsk_node_cache_has(cache, root, key, depth, next)) {
+      hit = true;
+      break;
+    }
+
+    int slot = seen_count % HSK_NODE_CACHE_DEPTH;
+
+    memcpy(seen[slot], next, 32);
+    seen_depth[slot] = (uint16_t)depth;
+    seen_count += 1;
   }
 
-  if (depth != 0)
-    return HSK_ETOODEEP;
+  if (!hit) {
+    if (depth != 0)
+      return HSK_ETOODEEP;
 
-  if (memcmp(next, root, 32) != 0)
-    return HSK_EHASHMISMATCH;
+    if (memcmp(next, root, 32) != 0)
+      return HSK_EHASHMISMATCH;
+  }
 
-  if (proof->type == HSK_PROOF_EXISTS) {
-    if (!hsk_parse_namestate(proof->value, proof->value_size, data, data_len))
-      return HSK_EENCODING;
+  if (cache) {
+    int count = seen_count;
 
-    *exists = true;
-  } else {
-    *data = NULL;
-    *data_len = 0;
-    *exists = false;
+    if (count > HSK_NODE_CACHE_DEPTH)
+      count = HSK_NODE_CACHE_DEPTH;
+
+    for (i = 0; i < count; i++)
+      hsk_node_cache_add(cache, root, key, seen_depth[i], seen[i]);
+
+    hsk_node_cache_count(cache, hit);
+  }
+
+  return hsk_proof_result(proof, exists, data, data_len);
+}
+
+/*
+ * Multiproofs
+ */
+
+typedef struct hsk_proof_memo_s {
+  uint8_t path[32];
+  uint8_t hash[32];
+  uint16_t depth;
+  bool used;
+} hsk_proof_memo_t;
+
+// Nodes known to hash up to the root, by
+// position: on a walk, the nodes it hashed and
+// the siblings it hashed them with.
+typedef struct hsk_proof_memos_s {
+  hsk_proof_memo_t *items;
+  size_t mask;
+} hsk_proof_memos_t;
+
+static hsk_proof_memo_t *
+hsk_proof_memo_slot(
+  const hsk_proof_memos_t *memos,
+  const uint8_t *path,
+  uint16_t depth
+) {
+  uint32_t h = hsk_map_murmur3(path, ((size_t)depth + 7) / 8, depth);
+  size_t i = h & memos->mask;
+
+  for (;;) {
+    hsk_proof_memo_t *memo = &memos->items[i];
+
+    if (!memo->used)
+      return memo;
+
+    if (memo->depth == depth && memcmp(memo->path, path, 32) == 0)
+      return memo;
+
+    i = (i + 1) & memos->mask;
+  }
+}
+
+static void
+hsk_proof_memo_add(
+  hsk_proof_memos_t *memos,
+  const uint8_t *path,
+  uint16_t depth,
+  const uint8_t *hash
+) {
+  hsk_proof_memo_t *memo = hsk_proof_memo_slot(memos, path, depth);
+
+  memcpy(memo->path, path, 32);
+  memcpy(memo->hash, hash, 32);
+  memo->depth = depth;
+  memo->used = true;
+}
+
+// Walks up until the root, or a node already
+// known to hash up to it. Memos are only added
+// once the walk succeeds.
+static int
+hsk_proof_walk_multi(
+  const uint8_t *root,
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  hsk_proof_memos_t *memos
+) {
+  uint8_t next[32];
+  int rc = hsk_proof_rebuild_leaf(key, proof, next);
+
+  if (rc != HSK_EPROOFOK)
+    return rc;
+
+  // Positions and hashes to remember: two per
+  // node, and the leaf.
+  uint8_t paths[513][32];
+  uint8_t hashes[513][32];
+  uint16_t depths[513];
+  int count = 0;
+
+  int depth = (int)proof->depth;
+  int i = ((int)proof->node_count) - 1;
+  bool hit = false;
+
+  for (;;) {
+    uint8_t path[32];
+
+    hsk_node_path(key, (uint16_t)depth, path);
+
+    const hsk_proof_memo_t *memo =
+      hsk_proof_memo_slot(memos, path, (uint16_t)depth);
+
+    if (memo->used) {
+      if (memcmp(memo->hash, next, 32) != 0)
+        return HSK_EHASHMISMATCH;
+
+      hit = true;
+      break;
+    }
+
+    memcpy(paths[count], path, 32);
+    memcpy(hashes[count], next, 32);
+    depths[count] = (uint16_t)depth;
+    count += 1;
+
+    if (i < 0)
+      break;
+
+    const hsk_proof_node_t *item = &proof->nodes[i--];
+    const uint8_t *prefix = &item->prefix[0];
+    uint16_t prefix_size = item->prefix_size;
+    const uint8_t *node = &item->node[0];
+
+    if (depth < prefix_size + 1)
+      return HSK_ENEGDEPTH;
+
+    depth -= 1;
+
+    // The sibling sits on the other side of
+    // this bit.
+    hsk_node_path(key, (uint16_t)(depth + 1), paths[count]);
+    paths[count][depth >> 3] ^= 0x80 >> (depth & 7);
+    memcpy(hashes[count], node, 32);
+    depths[count] = (uint16_t)(depth + 1);
+    count += 1;
+
+    if (HSK_HAS_BIT(key, depth))
+      hsk_proof_hash_internal(prefix, prefix_size, node, next, next);
+    else
+      hsk_proof_hash_internal(prefix, prefix_size, next, node, next);
+
+    depth -= prefix_size;
+
+    if (!hsk_proof_has(prefix, prefix_size, key, depth))
+      return HSK_EPATHMISMATCH;
+  }
+
+  if (!hit) {
+    if (depth != 0)
+      return HSK_ETOODEEP;
+
+    if (memcmp(next, root, 32) != 0)
+      return HSK_EHASHMISMATCH;
+  }
+
+  for (i = 0; i < count; i++)
+    hsk_proof_memo_add(memos, paths[i], depths[i], hashes[i]);
+
+  return HSK_EPROOFOK;
+}
+
+// Checks proofs for several keys under one root
+// in one pass: a walk stops where it meets one
+// verified before it, so nodes shared between
+// keys are hashed once. A bad proof fails alone.
+//
+// Resources returned point into the proofs, as
+// with hsk_proof_verify_view.
+int
+hsk_proof_verify_multi(
+  const uint8_t *root,
+  const uint8_t *const *keys,
+  const hsk_proof_t *const *proofs,
+  size_t count,
+  hsk_proof_result_t *results
+) {
+  if (root == NULL || keys == NULL || proofs == NULL || results == NULL)
+    return HSK_EBADARGS;
+
+  size_t total = 1;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    assert(proofs[i]->node_count <= 256);
+    total += 2 * (size_t)proofs[i]->node_count + 1;
+  }
+
+  size_t size = 64;
+
+  while (size < total * 2)
+    size *= 2;
+
+  hsk_proof_memos_t memos;
+
+  memos.items = hsk_calloc(size, sizeof(hsk_proof_memo_t));
+  memos.mask = size - 1;
+
+  if (!memos.items)
+    return HSK_ENOMEM;
+
+  for (i = 0; i < count; i++) {
+    hsk_proof_result_t *res = &results[i];
+
+    res->exists = false;
+    res->data = NULL;
+    res->data_len = 0;
+    res->rc = hsk_proof_walk_multi(root, keys[i], proofs[i], &memos);
+
+    if (res->rc == HSK_EPROOFOK)
+      res->rc = hsk_proof_result(proofs[i], &res->exists,
+                                 &res->data, &res->data_len);
   }
 
+  hsk_free(memos.items);
+
   return HSK_EPROOFOK;
 }
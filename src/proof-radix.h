@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "uv.h"
 
 #define HSK_PROOF_DEADEND 0
 #define HSK_PROOF_SHORT 1
@@ -10,6 +11,12 @@
 #define HSK_PROOF_EXISTS 3
 #define HSK_PROOF_UNKNOWN 4
 
+// Internal nodes remembered once a proof has
+// hashed through them to its root (the ones
+// nearest the root, per proof).
+#define HSK_NODE_CACHE_SIZE 2048
+#define HSK_NODE_CACHE_DEPTH 16
+
 typedef struct hsk_proof_node_s {
   uint8_t prefix[32];
   uint16_t prefix_size;
@@ -29,8 +36,36 @@ typedef struct hsk_proof_s {
   uint8_t *nx_hash;
   uint8_t *value;
   uint16_t value_size;
+  bool view;
 } hsk_proof_t;
 
+// A multiproof's node table holds every node
+// of its proofs once.
+#define HSK_PROOF_TABLE_MAX (64 * 256)
+
+typedef struct hsk_proof_result_s {
+  int rc;
+  bool exists;
+  const uint8_t *data;
+  size_t data_len;
+} hsk_proof_result_t;
+
+typedef struct hsk_node_entry_s {
+  uint8_t root[32];
+  uint8_t path[32];
+  uint8_t hash[32];
+  uint16_t depth;
+  bool valid;
+} hsk_node_entry_t;
+
+// Shared by verifications on any thread.
+typedef struct hsk_node_cache_s {
+  uv_mutex_t lock;
+  hsk_node_entry_t entries[HSK_NODE_CACHE_SIZE];
+  uint64_t hits;
+  uint64_t misses;
+} hsk_node_cache_t;
+
 void
 hsk_proof_init(hsk_proof_t *proof);
 
@@ -43,12 +78,52 @@ hsk_proof_uninit(hsk_proof_t *proof);
 void
 hsk_proof_free(hsk_proof_t *proof);
 
+bool
+hsk_proof_copy(hsk_proof_t *proof, const hsk_proof_t *other);
+
 bool
 hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof);
 
 bool
 hsk_proof_decode(const uint8_t *data, size_t data_len, hsk_proof_t *proof);
 
+bool
+hsk_proof_read_view(uint8_t **data, size_t *data_len, hsk_proof_t *proof);
+
+bool
+hsk_proof_read_table(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_proof_node_t **table,
+  size_t *table_size
+);
+
+bool
+hsk_proof_read_indexed(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_proof_t *proof,
+  const hsk_proof_node_t *table,
+  size_t table_size
+);
+
+int
+hsk_proof_write(uint8_t **data, const hsk_proof_t *proof);
+
+int
+hsk_proof_write_table(
+  uint8_t **data,
+  const hsk_proof_t *const *proofs,
+  size_t count
+);
+
+int
+hsk_proof_write_indexed(
+  uint8_t **data,
+  const hsk_proof_t *const *proofs,
+  size_t index
+);
+
 int
 hsk_proof_verify(
   const uint8_t *root,
@@ -58,4 +133,41 @@ hsk_proof_verify(
   uint8_t **data,
   size_t *data_len
 );
+
+hsk_node_cache_t *
+hsk_node_cache_alloc(void);
+
+void
+hsk_node_cache_free(hsk_node_cache_t *cache);
+
+int
+hsk_proof_verify_cached(
+  const uint8_t *root,
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  hsk_node_cache_t *cache,
+  bool *exists,
+  uint8_t **data,
+  size_t *data_len
+);
+
+int
+hsk_proof_verify_view(
+  const uint8_t *root,
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  hsk_node_cache_t *cache,
+  bool *exists,
+  const uint8_t **data,
+  size_t *data_len
+);
+
+int
+hsk_proof_verify_multi(
+  const uint8_t *root,
+  const uint8_t *const *keys,
+  const hsk_proof_t *const *proofs,
+  size_t count,
+  hsk_proof_result_t *results
+);
 #endif
@@ -12,6 +12,7 @@
 #include "constants.h"
 #include "error.h"
 #include "hash.h"
+#include "mem.h"
 #include "proof.h"
 
 #define HSK_HAS_BIT(m, i) (((m)[(i) >> 3] >> (7 - ((i) & 7))) & 1)
@@ -33,7 +34,7 @@ hsk_proof_init(hsk_proof_t *proof) {
 
 hsk_proof_t *
 hsk_proof_alloc(void) {
-  hsk_proof_t *proof = malloc(sizeof(hsk_proof_t));
+  hsk_proof_t *proof = hsk_malloc(sizeof(hsk_proof_t));
   if (proof)
     hsk_proof_init(proof);
   return proof;
@@ -44,24 +45,24 @@ hsk_proof_uninit(hsk_proof_t *proof) {
   assert(proof);
 
   if (proof->nodes) {
-    free(proof->nodes);
+    hsk_free(proof->nodes);
     proof->nodes = NULL;
     proof->node_count = 0;
   }
 
   if (proof->value) {
-    free(proof->value);
+    hsk_free(proof->value);
     proof->value = NULL;
     proof->value_size = 0;
   }
 
   if (proof->nx_key) {
-    free(proof->nx_key);
+    hsk_free(proof->nx_key);
     proof->nx_key = NULL;
   }
 
   if (proof->nx_hash) {
-    free(proof->nx_hash);
+    hsk_free(proof->nx_hash);
     proof->nx_hash = NULL;
   }
 }
@@ -70,7 +71,7 @@ void
 hsk_proof_free(hsk_proof_t *proof) {
   assert(proof);
   hsk_proof_uninit(proof);
-  free(proof);
+  hsk_free(proof);
 }
 
 bool
@@ -96,7 +97,7 @@ hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
   if (!slice_bytes(data, data_len, &map, bsize))
     return false;
 
-  proof->nodes = malloc(count * 32);
+  proof->nodes = hsk_malloc(count * 32);
 
   if (!proof->nodes)
     return false;
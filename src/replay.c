@@ -0,0 +1,1009 @@
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "addr.h"
+#include "bio.h"
+#include "constants.h"
+#include "dns.h"
+#include "mem.h"
+#include "trace.h"
+
+// Plays a capture (see hsk_capture_t) back at
+// the servers, with the original spacing scaled
+// by --speed. Every query gets an ID of its own
+// so answers can be matched and timed.
+//
+// With --load, it makes the queries up instead,
+// at a fixed rate and in a given mix.
+
+#define HSK_REPLAY_SLOTS 65536
+#define HSK_REPLAY_TCP_MAX 256
+#define HSK_REPLAY_TIMEOUT 2000
+
+#define HSK_LOAD_QPS 1000
+#define HSK_LOAD_DURATION 10
+#define HSK_LOAD_CACHED 90
+#define HSK_LOAD_ICANN 50
+#define HSK_LOAD_DO 50
+#define HSK_LOAD_NX 0
+#define HSK_LOAD_NAMES_MAX 4096
+
+// Names asked for over and over (so mostly
+// answered from the caches). Unless a file of
+// them is given, Handshake names are some
+// registered early on mainnet.
+static const char *hsk_load_icann[] = {
+  "example.com.",
+  "example.net.",
+  "example.org.",
+  "iana.org.",
+  "icann.org.",
+  "wikipedia.org.",
+  "kernel.org.",
+  "gnu.org."
+};
+
+static const char *hsk_load_hns[] = {
+  "welcome.",
+  "nb.",
+  "forever.",
+  "proofofconcept.",
+  "humbly.",
+  "theshake.",
+  "hns.",
+  "3b."
+};
+
+extern char *optarg;
+extern int optind;
+
+typedef struct hsk_replay_slot_s {
+  bool busy;
+  uint64_t seq;
+  uint64_t time;
+  int fd;
+  uint8_t size[2];
+  size_t read;
+} hsk_replay_slot_t;
+
+typedef struct hsk_replay_s {
+  struct sockaddr_storage ns_;
+  struct sockaddr_storage rs_;
+  struct sockaddr *ns;
+  struct sockaddr *rs;
+  double speed;
+  uint64_t timeout;
+  bool with_local;
+  int ns_fd;
+  int rs_fd;
+  hsk_replay_slot_t *slots;
+  uint64_t head;
+  uint64_t next;
+  int tcp[HSK_REPLAY_TCP_MAX];
+  int tcp_count;
+  uint32_t *lat;
+  size_t lat_len;
+  size_t lat_size;
+  uint64_t sent;
+  uint64_t answered;
+  uint64_t timed_out;
+  uint64_t skipped;
+  uint64_t failed;
+  bool load;
+  bool root;
+  uint64_t qps;
+  uint64_t duration;
+  int cached;
+  int icann;
+  int dnssec;
+  int nx;
+  char *names[HSK_LOAD_NAMES_MAX];
+  size_t name_count;
+  uint64_t rand;
+  uint64_t sent_nx;
+  uint64_t sent_icann;
+  uint64_t sent_hns;
+  uint64_t sent_cached;
+  uint64_t sent_do;
+} hsk_replay_t;
+
+static uint64_t
+now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static socklen_t
+sa_len(const struct sockaddr *sa) {
+  if (sa->sa_family == AF_INET6)
+    return sizeof(struct sockaddr_in6);
+  return sizeof(struct sockaddr_in);
+}
+
+static int
+open_udp(const struct sockaddr *sa) {
+  int fd = socket(sa->sa_family, SOCK_DGRAM, 0);
+
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, sa, sa_len(sa)) != 0
+      || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Blocking connect and write: the servers are
+// expected to be close by.
+static int
+open_tcp(const struct sockaddr *sa, const uint8_t *data, size_t data_len) {
+  int fd = socket(sa->sa_family, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, sa, sa_len(sa)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  uint8_t frame[2 + HSK_DNS_MAX_TCP];
+
+  frame[0] = (uint8_t)(data_len >> 8);
+  frame[1] = (uint8_t)data_len;
+  memcpy(&frame[2], data, data_len);
+
+  if (write(fd, frame, 2 + data_len) != (ssize_t)(2 + data_len)
+      || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void
+hsk_replay_release(hsk_replay_t *r, hsk_replay_slot_t *slot) {
+  if (slot->fd != -1) {
+    int index = (int)(slot - r->slots);
+    int i;
+
+    for (i = 0; i < r->tcp_count; i++) {
+      if (r->tcp[i] == index) {
+        r->tcp[i] = r->tcp[--r->tcp_count];
+        break;
+      }
+    }
+
+    close(slot->fd);
+    slot->fd = -1;
+  }
+
+  slot->busy = false;
+}
+
+static void
+hsk_replay_answer(hsk_replay_t *r, hsk_replay_slot_t *slot) {
+  uint64_t lat = now_us() - slot->time;
+
+  if (r->lat_len == r->lat_size) {
+    size_t size = r->lat_size ? r->lat_size * 2 : 4096;
+    uint32_t *lat = hsk_realloc(r->lat, size * sizeof(uint32_t));
+
+    if (!lat) {
+      hsk_replay_release(r, slot);
+      r->answered += 1;
+      return;
+    }
+
+    r->lat = lat;
+    r->lat_size = size;
+  }
+
+  r->lat[r->lat_len++] = lat > UINT32_MAX ? UINT32_MAX : (uint32_t)lat;
+  r->answered += 1;
+
+  hsk_replay_release(r, slot);
+}
+
+static void
+hsk_replay_recv_udp(hsk_replay_t *r, int fd) {
+  uint8_t buf[HSK_DNS_MAX_TCP];
+
+  for (;;) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+
+    if (n < 0)
+      return;
+
+    if (n < 2)
+      continue;
+
+    hsk_replay_slot_t *slot = &r->slots[((size_t)buf[0] << 8) | buf[1]];
+
+    if (slot->busy && slot->fd == -1)
+      hsk_replay_answer(r, slot);
+  }
+}
+
+// Only the length prefix is kept; the rest is
+// counted off.
+static void
+hsk_replay_recv_tcp(hsk_replay_t *r, hsk_replay_slot_t *slot) {
+  uint8_t buf[HSK_DNS_MAX_TCP];
+
+  for (;;) {
+    ssize_t n = read(slot->fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EAGAIN)
+      return;
+
+    if (n <= 0) {
+      r->failed += 1;
+      hsk_replay_release(r, slot);
+      return;
+    }
+
+    size_t i;
+
+    for (i = 0; i < (size_t)n && slot->read < 2; i++)
+      slot->size[slot->read++] = buf[i];
+
+    slot->read += (size_t)n - i;
+
+    if (slot->read < 2)
+      continue;
+
+    size_t size = ((size_t)slot->size[0] << 8) | slot->size[1];
+
+    if (slot->read >= 2 + size) {
+      hsk_replay_answer(r, slot);
+      return;
+    }
+  }
+}
+
+// Waits for answers until `until` (or just
+// checks, when it has passed), then expires
+// the queries that waited too long.
+static void
+hsk_replay_poll(hsk_replay_t *r, uint64_t until) {
+  struct pollfd fds[2 + HSK_REPLAY_TCP_MAX];
+  int ids[HSK_REPLAY_TCP_MAX];
+  int count = 0;
+  int i;
+
+  fds[count].fd = r->ns_fd;
+  fds[count].events = POLLIN;
+  count += 1;
+
+  fds[count].fd = r->rs_fd;
+  fds[count].events = POLLIN;
+  count += 1;
+
+  // Answers move the list: keep a copy.
+  for (i = 0; i < r->tcp_count; i++) {
+    ids[i] = r->tcp[i];
+    fds[count].fd = r->slots[ids[i]].fd;
+    fds[count].events = POLLIN;
+    count += 1;
+  }
+
+  uint64_t now = now_us();
+  int wait = until > now ? (int)((until - now + 999) / 1000) : 0;
+
+  if (poll(fds, count, wait) > 0) {
+    if (fds[0].revents)
+      hsk_replay_recv_udp(r, r->ns_fd);
+
+    if (fds[1].revents)
+      hsk_replay_recv_udp(r, r->rs_fd);
+
+    for (i = 2; i < count; i++) {
+      if (fds[i].revents) {
+        hsk_replay_slot_t *slot = &r->slots[ids[i - 2]];
+        if (slot->busy && slot->fd == fds[i].fd)
+          hsk_replay_recv_tcp(r, slot);
+      }
+    }
+  }
+
+  now = now_us();
+
+  while (r->head < r->next) {
+    hsk_replay_slot_t *slot = &r->slots[r->head % HSK_REPLAY_SLOTS];
+
+    if (slot->busy && slot->seq == r->head) {
+      if (now - slot->time < r->timeout)
+        break;
+
+      r->timed_out += 1;
+      hsk_replay_release(r, slot);
+    }
+
+    r->head += 1;
+  }
+}
+
+static void
+hsk_replay_send(
+  hsk_replay_t *r,
+  uint8_t flags,
+  uint8_t *data,
+  size_t data_len
+) {
+  bool tcp = (flags & HSK_CAPTURE_TCP) != 0;
+  const struct sockaddr *sa = (flags & HSK_CAPTURE_RS) ? r->rs : r->ns;
+  int fd = (flags & HSK_CAPTURE_RS) ? r->rs_fd : r->ns_fd;
+
+  // Our own resolver's questions: replaying
+  // its queries asks them again.
+  if ((flags & HSK_CAPTURE_LOCAL) && !r->with_local) {
+    r->skipped += 1;
+    return;
+  }
+
+  // Shorter than a header (no ID to give), or
+  // too many connections open.
+  if (data_len < 12
+      || (tcp && r->tcp_count == HSK_REPLAY_TCP_MAX)) {
+    r->skipped += 1;
+    return;
+  }
+
+  hsk_replay_slot_t *slot = &r->slots[r->next % HSK_REPLAY_SLOTS];
+
+  // Every ID is in use: the oldest gives way.
+  if (slot->busy) {
+    r->timed_out += 1;
+    hsk_replay_release(r, slot);
+  }
+
+  uint16_t id = (uint16_t)(r->next % HSK_REPLAY_SLOTS);
+
+  data[0] = (uint8_t)(id >> 8);
+  data[1] = (uint8_t)id;
+
+  slot->seq = r->next;
+  slot->time = now_us();
+  slot->fd = -1;
+  slot->read = 0;
+
+  if (tcp) {
+    slot->fd = open_tcp(sa, data, data_len);
+
+    if (slot->fd == -1) {
+      r->failed += 1;
+      return;
+    }
+
+    r->tcp[r->tcp_count++] = (int)id;
+  } else {
+    if (send(fd, data, data_len, 0) != (ssize_t)data_len) {
+      r->failed += 1;
+      return;
+    }
+  }
+
+  slot->busy = true;
+  r->next += 1;
+  r->sent += 1;
+}
+
+static int
+cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void
+hsk_replay_print(hsk_replay_t *r, uint64_t elapsed) {
+  double secs = (double)elapsed / 1e6;
+
+  printf("sent: %llu (%.1f/s)\n",
+         (unsigned long long)r->sent,
+         secs > 0 ? (double)r->sent / secs : 0.0);
+  printf("answered: %llu\n", (unsigned long long)r->answered);
+  printf("timed out: %llu\n", (unsigned long long)r->timed_out);
+  printf("failed: %llu\n", (unsigned long long)r->failed);
+  printf("skipped: %llu\n", (unsigned long long)r->skipped);
+
+  if (r->lat_len == 0)
+    return;
+
+  qsort(r->lat, r->lat_len, sizeof(uint32_t), cmp_u32);
+
+  printf("latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, "
+         "max %.3f\n",
+         r->lat[r->lat_len * 50 / 100] / 1e3,
+         r->lat[r->lat_len * 90 / 100] / 1e3,
+         r->lat[r->lat_len * 99 / 100] / 1e3,
+         r->lat[r->lat_len * 999 / 1000] / 1e3,
+         r->lat[r->lat_len - 1] / 1e3);
+}
+
+static int
+hsk_replay_run(hsk_replay_t *r, FILE *file) {
+  uint8_t hdr[HSK_CAPTURE_HDR_SIZE];
+  uint8_t *p = hdr;
+  size_t len = sizeof(hdr);
+  uint32_t magic;
+  uint8_t version;
+
+  if (fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr)
+      || !read_u32(&p, &len, &magic)
+      || !read_u8(&p, &len, &version)
+      || magic != HSK_CAPTURE_MAGIC
+      || version != HSK_CAPTURE_VERSION) {
+    fprintf(stderr, "not a capture\n");
+    return 1;
+  }
+
+  uint64_t start = now_us();
+  uint8_t data[HSK_DNS_MAX_TCP];
+
+  for (;;) {
+    uint8_t rec[HSK_CAPTURE_REC_SIZE];
+    uint64_t us;
+    uint8_t flags;
+    uint16_t size;
+
+    p = rec;
+    len = sizeof(rec);
+
+    if (fread(rec, 1, sizeof(rec), file) != sizeof(rec))
+      break;
+
+    read_u64(&p, &len, &us);
+    read_u8(&p, &len, &flags);
+    read_u16(&p, &len, &size);
+
+    if (size > sizeof(data) || fread(data, 1, size, file) != size) {
+      fprintf(stderr, "capture cut short\n");
+      break;
+    }
+
+    if (r->speed > 0) {
+      uint64_t due = start + (uint64_t)((double)us / r->speed);
+
+      while (now_us() < due)
+        hsk_replay_poll(r, due);
+    }
+
+    hsk_replay_poll(r, 0);
+    hsk_replay_send(r, flags, data, size);
+  }
+
+  while (r->head < r->next)
+    hsk_replay_poll(r, now_us() + 10000);
+
+  hsk_replay_print(r, now_us() - start);
+
+  return 0;
+}
+
+/*
+ * Load
+ */
+
+// xorshift64*: the mix needs no more.
+static uint32_t
+hsk_load_rand(hsk_replay_t *r) {
+  r->rand ^= r->rand >> 12;
+  r->rand ^= r->rand << 25;
+  r->rand ^= r->rand >> 27;
+  return (uint32_t)((r->rand * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+static bool
+hsk_load_roll(hsk_replay_t *r, int pct) {
+  return (int)(hsk_load_rand(r) % 100) < pct;
+}
+
+// A label no cache has seen.
+static void
+hsk_load_label(hsk_replay_t *r, char *label) {
+  sprintf(label, "%08x%04x",
+          hsk_load_rand(r), hsk_load_rand(r) & 0xffff);
+}
+
+static void
+hsk_load_name(hsk_replay_t *r, char *name) {
+  char label[16];
+
+  if (hsk_load_roll(r, r->nx)) {
+    hsk_load_label(r, label);
+    sprintf(name, "%s.", label);
+    r->sent_nx += 1;
+    return;
+  }
+
+  const char *base;
+
+  if (hsk_load_roll(r, r->icann)) {
+    base = hsk_load_icann[hsk_load_rand(r) % (sizeof(hsk_load_icann)
+                                              / sizeof(hsk_load_icann[0]))];
+    r->sent_icann += 1;
+  } else if (r->name_count > 0) {
+    base = r->names[hsk_load_rand(r) % r->name_count];
+    r->sent_hns += 1;
+  } else {
+    base = hsk_load_hns[hsk_load_rand(r) % (sizeof(hsk_load_hns)
+                                            / sizeof(hsk_load_hns[0]))];
+    r->sent_hns += 1;
+  }
+
+  if (hsk_load_roll(r, r->cached)) {
+    strcpy(name, base);
+    r->sent_cached += 1;
+    return;
+  }
+
+  hsk_load_label(r, label);
+  sprintf(name, "%s.%s", label, base);
+}
+
+// An A query with EDNS, as a stub resolver
+// would send it. The ID is filled in on send.
+static size_t
+hsk_load_query(const char *name, bool dnssec, uint8_t *data) {
+  uint8_t *p = data;
+  size_t size = 0;
+
+  size += write_u16be(&p, 0);
+  size += write_u16be(&p, 0x0100);
+  size += write_u16be(&p, 1);
+  size += write_u16be(&p, 0);
+  size += write_u16be(&p, 0);
+  size += write_u16be(&p, 1);
+
+  const char *label = name;
+
+  while (*label) {
+    const char *dot = strchr(label, '.');
+    size_t len = dot ? (size_t)(dot - label) : strlen(label);
+
+    size += write_u8(&p, (uint8_t)len);
+    size += write_bytes(&p, (const uint8_t *)label, len);
+
+    label += len;
+
+    if (*label == '.')
+      label += 1;
+  }
+
+  size += write_u8(&p, 0);
+  size += write_u16be(&p, HSK_DNS_A);
+  size += write_u16be(&p, HSK_DNS_IN);
+
+  // OPT: no name, our buffer size, then the
+  // extended rcode, version and flags.
+  size += write_u8(&p, 0);
+  size += write_u16be(&p, HSK_DNS_OPT);
+  size += write_u16be(&p, HSK_DNS_MAX_EDNS);
+  size += write_u32be(&p, dnssec ? 0x8000 : 0);
+  size += write_u16be(&p, 0);
+
+  return size;
+}
+
+static void
+hsk_load_print(hsk_replay_t *r, uint64_t elapsed) {
+  printf("target: %llu/s for %llus to the %s server\n",
+         (unsigned long long)r->qps,
+         (unsigned long long)r->duration,
+         r->root ? "root" : "recursive");
+  printf("mix: %llu nx, %llu icann, %llu handshake, %llu cached, "
+         "%llu do\n",
+         (unsigned long long)r->sent_nx,
+         (unsigned long long)r->sent_icann,
+         (unsigned long long)r->sent_hns,
+         (unsigned long long)r->sent_cached,
+         (unsigned long long)r->sent_do);
+
+  hsk_replay_print(r, elapsed);
+}
+
+// Queries go out on a fixed schedule: those
+// due are sent before waiting again, so a slow
+// wakeup is caught up on rather than lost.
+static int
+hsk_load_run(hsk_replay_t *r) {
+  uint64_t start = now_us();
+  uint64_t end = start + r->duration * 1000000;
+  uint64_t count = 0;
+  uint8_t flags = r->root ? 0 : HSK_CAPTURE_RS;
+  uint8_t data[HSK_DNS_MAX_NAME + 64];
+  char name[HSK_DNS_MAX_NAME + 1];
+
+  r->rand = start | 1;
+
+  for (;;) {
+    uint64_t due = start + count * 1000000 / r->qps;
+
+    if (due >= end)
+      break;
+
+    if (now_us() < due) {
+      hsk_replay_poll(r, due);
+      continue;
+    }
+
+    bool dnssec = hsk_load_roll(r, r->dnssec);
+
+    hsk_load_name(r, name);
+
+    if (dnssec)
+      r->sent_do += 1;
+
+    hsk_replay_poll(r, 0);
+    hsk_replay_send(r, flags, data, hsk_load_query(name, dnssec, data));
+
+    count += 1;
+  }
+
+  while (r->head < r->next)
+    hsk_replay_poll(r, now_us() + 10000);
+
+  hsk_load_print(r, now_us() - start);
+
+  return 0;
+}
+
+// One Handshake name per line.
+static bool
+hsk_load_read_names(hsk_replay_t *r, const char *path) {
+  FILE *file = fopen(path, "r");
+
+  if (!file)
+    return false;
+
+  char line[HSK_DNS_MAX_NAME + 2];
+
+  while (fgets(line, sizeof(line), file)) {
+    size_t len = strcspn(line, " \t\r\n");
+
+    if (len == 0)
+      continue;
+
+    line[len] = '\0';
+
+    if (r->name_count == HSK_LOAD_NAMES_MAX)
+      break;
+
+    char name[HSK_DNS_MAX_NAME + 2];
+
+    // Room for a label in front.
+    if (len > HSK_DNS_MAX_NAME - 16)
+      continue;
+
+    sprintf(name, line[len - 1] == '.' ? "%s" : "%s.", line);
+
+    if (!hsk_dns_name_verify(name))
+      continue;
+
+    r->names[r->name_count] = hsk_strdup(name);
+
+    if (!r->names[r->name_count])
+      break;
+
+    r->name_count += 1;
+  }
+
+  fclose(file);
+
+  return r->name_count > 0;
+}
+
+static void
+help(int r) {
+  fprintf(stderr,
+    "\n"
+    "hnsd-replay 0.0.0\n"
+    "  Copyright (c) 2018, Christopher Jeffrey <chjj@handshake.org>\n"
+    "\n"
+    "Usage: hnsd-replay [options] <capture>\n"
+    "       hnsd-replay --load [options]\n"
+    "\n"
+    "  Plays back a capture written by hnsd --capture. Run hnsd from the\n"
+    "  same chain snapshot (--bootstrap) and a copy of the cache under\n"
+    "  its prefix to see how it answered the traffic.\n"
+    "\n"
+    "  With --load, sends made-up A queries at a fixed rate instead, in\n"
+    "  the mix given below, and prints the latency percentiles.\n"
+    "\n"
+    "  -n, --ns-host <ip[:port]>\n"
+    "    Root nameserver to query (default: 127.0.0.1:%d).\n"
+    "\n"
+    "  -r, --rs-host <ip[:port]>\n"
+    "    Recursive nameserver to query (default: 127.0.0.1:%d).\n"
+    "\n"
+    "  -s, --speed <x>\n"
+    "    Play x times faster than recorded; 0 sends as fast as\n"
+    "    possible (default: 1).\n"
+    "\n"
+    "  -w, --timeout <ms>\n"
+    "    Give up on an answer after this long (default: %d).\n"
+    "\n"
+    "  --with-local\n"
+    "    Also replay queries from hnsd's own resolver to the root\n"
+    "    (these are asked again by replaying its queries).\n"
+    "\n"
+    "  -l, --load\n"
+    "    Generate queries rather than replay a capture.\n"
+    "\n"
+    "  -q, --qps <n>\n"
+    "    Queries per second to send (default: %d).\n"
+    "\n"
+    "  -d, --duration <secs>\n"
+    "    How long to send for (default: %d).\n"
+    "\n"
+    "  --cached <pct>\n"
+    "    Share of queries for a few names asked over and over; the rest\n"
+    "    are for a new name under one of them (default: %d).\n"
+    "\n"
+    "  --icann <pct>\n"
+    "    Share of queries under ICANN TLDs; the rest are under Handshake\n"
+    "    names (default: %d).\n"
+    "\n"
+    "  --do <pct>\n"
+    "    Share of queries with the DO bit set (default: %d).\n"
+    "\n"
+    "  --nx <pct>\n"
+    "    Share of queries for random TLDs that do not exist, as in an NX\n"
+    "    flood (default: %d).\n"
+    "\n"
+    "  --names <file>\n"
+    "    Handshake names to query, one per line.\n"
+    "\n"
+    "  --root\n"
+    "    Query the root nameserver rather than the recursive one.\n"
+    "\n"
+    "  -h, --help\n"
+    "    This help message.\n"
+    "\n",
+    HSK_NS_PORT,
+    HSK_RS_PORT,
+    HSK_REPLAY_TIMEOUT,
+    HSK_LOAD_QPS,
+    HSK_LOAD_DURATION,
+    HSK_LOAD_CACHED,
+    HSK_LOAD_ICANN,
+    HSK_LOAD_DO,
+    HSK_LOAD_NX
+  );
+
+  exit(r);
+}
+
+static const struct option longopts[] = {
+  { "ns-host", required_argument, NULL, 'n' },
+  { "rs-host", required_argument, NULL, 'r' },
+  { "speed", required_argument, NULL, 's' },
+  { "timeout", required_argument, NULL, 'w' },
+  { "with-local", no_argument, NULL, 256 },
+  { "load", no_argument, NULL, 'l' },
+  { "qps", required_argument, NULL, 'q' },
+  { "duration", required_argument, NULL, 'd' },
+  { "cached", required_argument, NULL, 257 },
+  { "icann", required_argument, NULL, 258 },
+  { "do", required_argument, NULL, 259 },
+  { "nx", required_argument, NULL, 260 },
+  { "names", required_argument, NULL, 261 },
+  { "root", no_argument, NULL, 262 },
+  { "help", no_argument, NULL, 'h' },
+  { NULL, 0, NULL, 0 }
+};
+
+int
+main(int argc, char **argv) {
+  hsk_replay_t r;
+
+  memset(&r, 0, sizeof(r));
+
+  r.ns = (struct sockaddr *)&r.ns_;
+  r.rs = (struct sockaddr *)&r.rs_;
+  r.speed = 1;
+  r.timeout = (uint64_t)HSK_REPLAY_TIMEOUT * 1000;
+  r.ns_fd = -1;
+  r.rs_fd = -1;
+  r.qps = HSK_LOAD_QPS;
+  r.duration = HSK_LOAD_DURATION;
+  r.cached = HSK_LOAD_CACHED;
+  r.icann = HSK_LOAD_ICANN;
+  r.dnssec = HSK_LOAD_DO;
+  r.nx = HSK_LOAD_NX;
+
+  const char *names = NULL;
+
+  assert(hsk_sa_from_string(r.ns, "127.0.0.1", HSK_NS_PORT));
+  assert(hsk_sa_from_string(r.rs, "127.0.0.1", HSK_RS_PORT));
+
+  for (;;) {
+    int o = getopt_long(argc, argv, "n:r:s:w:lq:d:h", longopts, NULL);
+
+    if (o == -1)
+      break;
+
+    switch (o) {
+      case 'n': {
+        if (!hsk_sa_from_string(r.ns, optarg, HSK_NS_PORT))
+          help(1);
+        break;
+      }
+
+      case 'r': {
+        if (!hsk_sa_from_string(r.rs, optarg, HSK_RS_PORT))
+          help(1);
+        break;
+      }
+
+      case 's': {
+        r.speed = atof(optarg);
+        if (r.speed < 0)
+          help(1);
+        break;
+      }
+
+      case 'w': {
+        long long ms = atoll(optarg);
+        if (ms < 1)
+          help(1);
+        r.timeout = (uint64_t)ms * 1000;
+        break;
+      }
+
+      case 256: {
+        r.with_local = true;
+        break;
+      }
+
+      case 'l': {
+        r.load = true;
+        break;
+      }
+
+      case 'q': {
+        long long n = atoll(optarg);
+        if (n < 1 || n > 10000000)
+          help(1);
+        r.qps = (uint64_t)n;
+        break;
+      }
+
+      case 'd': {
+        long long n = atoll(optarg);
+        if (n < 1)
+          help(1);
+        r.duration = (uint64_t)n;
+        break;
+      }
+
+      case 257:
+      case 258:
+      case 259:
+      case 260: {
+        int pct = atoi(optarg);
+        if (pct < 0 || pct > 100)
+          help(1);
+        if (o == 257)
+          r.cached = pct;
+        else if (o == 258)
+          r.icann = pct;
+        else if (o == 259)
+          r.dnssec = pct;
+        else
+          r.nx = pct;
+        break;
+      }
+
+      case 261: {
+        names = optarg;
+        break;
+      }
+
+      case 262: {
+        r.root = true;
+        break;
+      }
+
+      case 'h': {
+        help(0);
+        break;
+      }
+
+      default: {
+        help(1);
+        break;
+      }
+    }
+  }
+
+  if (optind != argc - (r.load ? 0 : 1))
+    help(1);
+
+  FILE *file = NULL;
+
+  if (!r.load) {
+    file = fopen(argv[optind], "rb");
+
+    if (!file) {
+      fprintf(stderr, "could not open capture: %s\n", argv[optind]);
+      return 1;
+    }
+  }
+
+  int rc = 1;
+
+  if (names && !hsk_load_read_names(&r, names)) {
+    fprintf(stderr, "could not read names: %s\n", names);
+    goto done;
+  }
+
+  r.slots = hsk_calloc(HSK_REPLAY_SLOTS, sizeof(hsk_replay_slot_t));
+
+  if (!r.slots) {
+    fprintf(stderr, "ENOMEM\n");
+    goto done;
+  }
+
+  r.ns_fd = open_udp(r.ns);
+  r.rs_fd = open_udp(r.rs);
+
+  if (r.ns_fd == -1 || r.rs_fd == -1) {
+    fprintf(stderr, "could not open sockets\n");
+    goto done;
+  }
+
+  if (r.load)
+    rc = hsk_load_run(&r);
+  else
+    rc = hsk_replay_run(&r, file);
+
+done:
+  if (r.slots) {
+    size_t i;
+
+    for (i = 0; i < HSK_REPLAY_SLOTS; i++) {
+      if (r.slots[i].busy)
+        hsk_replay_release(&r, &r.slots[i]);
+    }
+
+    hsk_free(r.slots);
+  }
+
+  if (r.ns_fd != -1)
+    close(r.ns_fd);
+
+  if (r.rs_fd != -1)
+    close(r.rs_fd);
+
+  for (size_t i = 0; i < r.name_count; i++)
+    hsk_free(r.names[i]);
+
+  hsk_free(r.lat);
+
+  if (file)
+    fclose(file);
+
+  return rc;
+}
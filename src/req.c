@@ -8,18 +8,41 @@
 #include <stdio.h>
 
 #include "addr.h"
+#include "bio.h"
 #include "constants.h"
 #include "dns.h"
 #include "ec.h"
 #include "error.h"
+#include "log.h"
+#include "mem.h"
+#include "random.h"
 #include "req.h"
 #include "sig0.h"
+#include "siphash.h"
+#include "trace.h"
 #include "utils.h"
+#include "uv.h"
+
+static uint8_t hsk_dns_cookie_secret[16];
+static bool hsk_dns_cookie_ready = false;
+static uv_once_t hsk_dns_cookie_once = UV_ONCE_INIT;
+
+// Set once, before any server opens.
+static size_t hsk_dns_udp_size = HSK_DNS_SAFE_EDNS;
+
+static const size_t hsk_dns_udp_classes[HSK_DNS_UDP_CLASSES] = {
+  HSK_DNS_MAX_UDP,
+  HSK_DNS_SAFE_EDNS,
+  HSK_DNS_MAX_EDNS
+};
 
 void
 hsk_dns_req_init(hsk_dns_req_t *req) {
   assert(req);
   req->ns = NULL;
+  req->conn = NULL;
+  req->stream = NULL;
+  req->local = false;
   req->id = 0;
   req->labels = 0;
   memset(req->name, 0x00, sizeof(req->name));
@@ -30,19 +53,33 @@ hsk_dns_req_init(hsk_dns_req_t *req) {
   req->ad = false;
   req->edns = false;
   req->dnssec = false;
+  req->cookie = false;
+  req->cookie_checked = false;
+  req->cookie_ok = false;
+  memset(req->client_cookie, 0x00, sizeof(req->client_cookie));
+  memset(req->server_cookie, 0x00, sizeof(req->server_cookie));
+  req->server_cookie_len = 0;
   memset(req->tld, 0x00, sizeof(req->tld));
   memset(&req->ss, 0x00, sizeof(struct sockaddr_storage));
   req->addr = (struct sockaddr *)&req->ss;
+  req->time = 0;
+  req->lookup_time = 0;
+  req->trace = NULL;
 }
 
 void
 hsk_dns_req_uninit(hsk_dns_req_t *req) {
   assert(req);
+
+  if (req->trace) {
+    hsk_trace_free(req->trace);
+    req->trace = NULL;
+  }
 }
 
 hsk_dns_req_t *
 hsk_dns_req_alloc(void) {
-  hsk_dns_req_t *req = malloc(sizeof(hsk_dns_req_t));
+  hsk_dns_req_t *req = hsk_malloc(sizeof(hsk_dns_req_t));
   if (req)
     hsk_dns_req_init(req);
   return req;
@@ -52,25 +89,370 @@ void
 hsk_dns_req_free(hsk_dns_req_t *req) {
   assert(req);
   hsk_dns_req_uninit(req);
-  free(req);
+  hsk_free(req);
 }
 
+// From (and back to) a server's free list, or
+// plain malloc without one.
 hsk_dns_req_t *
-hsk_dns_req_create(
-  const uint8_t *data,
-  size_t data_len,
-  const struct sockaddr *addr
+hsk_dns_req_take(hsk_slab_t *slab) {
+  if (!slab)
+    return hsk_dns_req_alloc();
+
+  hsk_dns_req_t *req = hsk_slab_alloc(slab);
+
+  if (req)
+    hsk_dns_req_init(req);
+
+  return req;
+}
+
+void
+hsk_dns_req_give(hsk_slab_t *slab, hsk_dns_req_t *req) {
+  if (!slab) {
+    hsk_dns_req_free(req);
+    return;
+  }
+
+  assert(req);
+  hsk_dns_req_uninit(req);
+  hsk_slab_free(slab, (void *)req);
+}
+
+static void
+hsk_dns_req_set_flags(
+  hsk_dns_req_t *req,
+  uint16_t flags,
+  bool edns,
+  uint16_t edns_size,
+  uint16_t edns_flags
 ) {
-  hsk_dns_req_t *req = NULL;
-  hsk_dns_msg_t *msg = NULL;
+  req->rd = (flags & HSK_DNS_RD) != 0;
+  req->cd = (flags & HSK_DNS_CD) != 0;
+  req->ad = (flags & HSK_DNS_AD) != 0;
+  req->edns = edns;
+  req->max_size = HSK_DNS_MAX_UDP;
+  if (edns) {
+    for (int i = HSK_DNS_UDP_CLASSES - 1; i > 0; i--) {
+      if (edns_size >= hsk_dns_udp_classes[i]) {
+        req->max_size = hsk_dns_udp_classes[i];
+        break;
+      }
+    }
+    if (req->max_size > hsk_dns_udp_size)
+      req->max_size = hsk_dns_udp_size;
+  }
+  req->dnssec = (edns_flags & HSK_DNS_DO) != 0;
+}
 
-  req = hsk_dns_req_alloc();
+// Largest UDP reply sent (and the buffer size
+// we advertise).
+bool
+hsk_dns_req_set_udp_size(size_t size) {
+  if (size < HSK_DNS_MAX_UDP || size > HSK_DNS_MAX_EDNS)
+    return false;
 
-  if (!req)
-    goto fail;
+  hsk_dns_udp_size = size;
+
+  return true;
+}
+
+size_t
+hsk_dns_req_udp_size(void) {
+  return hsk_dns_udp_size;
+}
+
+/*
+ * Cookies
+ */
+
+static void
+hsk_dns_cookie_init(void) {
+  hsk_dns_cookie_ready = hsk_randombytes(hsk_dns_cookie_secret, 16);
+}
+
+// Picks the cookie out of OPT rdata. A
+// malformed one is taken as none at all.
+static void
+hsk_dns_req_read_cookie(hsk_dns_req_t *req, const uint8_t *rd, size_t len) {
+  while (len >= 4) {
+    uint16_t code = get_u16be(rd);
+    uint16_t size = get_u16be(rd + 2);
+
+    rd += 4;
+    len -= 4;
+
+    if (size > len)
+      return;
+
+    if (code == HSK_DNS_OPT_COOKIE) {
+      if (size < HSK_DNS_COOKIE_CLIENT)
+        return;
+
+      size_t server = size - HSK_DNS_COOKIE_CLIENT;
+
+      if (server != 0 && (server < 8 || server > HSK_DNS_COOKIE_MAX))
+        return;
+
+      req->cookie = true;
+      memcpy(req->client_cookie, rd, HSK_DNS_COOKIE_CLIENT);
+      memcpy(req->server_cookie, rd + HSK_DNS_COOKIE_CLIENT, server);
+      req->server_cookie_len = server;
+
+      return;
+    }
+
+    rd += size;
+    len -= size;
+  }
+}
+
+// The hash part of a server cookie: over the
+// client cookie, the first half of the server
+// cookie (version, reserved and timestamp) and
+// the client's address.
+static bool
+hsk_dns_cookie_hash(
+  const hsk_dns_req_t *req,
+  const uint8_t *head,
+  uint8_t *hash
+) {
+  uint8_t data[HSK_DNS_COOKIE_CLIENT + 8 + 16];
+  size_t len = 0;
+
+  memcpy(&data[len], req->client_cookie, HSK_DNS_COOKIE_CLIENT);
+  len += HSK_DNS_COOKIE_CLIENT;
+
+  memcpy(&data[len], head, 8);
+  len += 8;
+
+  if (req->addr->sa_family == AF_INET) {
+    const struct sockaddr_in *sai = (const struct sockaddr_in *)req->addr;
+    memcpy(&data[len], &sai->sin_addr, 4);
+    len += 4;
+  } else if (req->addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *sai = (const struct sockaddr_in6 *)req->addr;
+    memcpy(&data[len], &sai->sin6_addr, 16);
+    len += 16;
+  } else {
+    return false;
+  }
+
+  set_u64(hash, hsk_siphash(data, len, hsk_dns_cookie_secret));
+
+  return true;
+}
+
+// Whether the server cookie is one of ours,
+// made for this client cookie and address.
+static bool
+hsk_dns_req_check_cookie(const hsk_dns_req_t *req) {
+  const uint8_t *sc = req->server_cookie;
+  uint8_t hash[8];
+  uint8_t diff = 0;
+
+  if (!req->cookie || req->server_cookie_len != HSK_DNS_COOKIE_SERVER)
+    return false;
+
+  uv_once(&hsk_dns_cookie_once, hsk_dns_cookie_init);
+
+  if (!hsk_dns_cookie_ready)
+    return false;
+
+  // Version 1, reserved bytes zero.
+  if (sc[0] != 1 || sc[1] != 0 || sc[2] != 0 || sc[3] != 0)
+    return false;
+
+  int64_t now = hsk_now();
+  int64_t time = (int64_t)get_u32be(sc + 4);
+
+  if (time < now - HSK_DNS_COOKIE_LIFETIME
+      || time > now + HSK_DNS_COOKIE_SKEW) {
+    return false;
+  }
+
+  if (!hsk_dns_cookie_hash(req, sc, hash))
+    return false;
+
+  for (int i = 0; i < 8; i++)
+    diff |= hash[i] ^ sc[8 + i];
+
+  return diff == 0;
+}
+
+bool
+hsk_dns_req_cookie_ok(hsk_dns_req_t *req) {
+  assert(req);
+
+  if (!req->cookie_checked) {
+    req->cookie_ok = hsk_dns_req_check_cookie(req);
+    req->cookie_checked = true;
+  }
+
+  return req->cookie_ok;
+}
+
+// Adds our cookie to a reply made by
+// hsk_dns_msg_reply (which leaves room for it,
+// its OPT record last and empty). Before the
+// signature: that covers the cookie too.
+bool
+hsk_dns_wire_cookie(
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(req && wire && wire_len);
+
+  uint8_t *data = *wire;
+  size_t len = *wire_len;
+
+  if (!req->cookie)
+    return true;
+
+  uv_once(&hsk_dns_cookie_once, hsk_dns_cookie_init);
+
+  if (!hsk_dns_cookie_ready)
+    return true;
+
+  // Root name, type, class, TTL and rdlength.
+  if (len < 12 + 11)
+    return true;
+
+  const uint8_t *opt = &data[len - 11];
+
+  if (opt[0] != 0x00
+      || get_u16be(opt + 1) != HSK_DNS_OPT
+      || get_u16be(opt + 9) != 0) {
+    return true;
+  }
+
+  uint8_t *buf = hsk_realloc(data, len + HSK_DNS_COOKIE_SIZE);
+
+  if (!buf)
+    return false;
+
+  uint8_t *p = &buf[len];
+
+  set_u16be(p, HSK_DNS_OPT_COOKIE);
+  set_u16be(p + 2, HSK_DNS_COOKIE_CLIENT + HSK_DNS_COOKIE_SERVER);
+  memcpy(p + 4, req->client_cookie, HSK_DNS_COOKIE_CLIENT);
+
+  uint8_t *sc = p + 4 + HSK_DNS_COOKIE_CLIENT;
+
+  sc[0] = 1;
+  sc[1] = 0;
+  sc[2] = 0;
+  sc[3] = 0;
+  set_u32be(sc + 4, (uint32_t)hsk_now());
+
+  if (!hsk_dns_cookie_hash(req, sc, sc + 8)) {
+    *wire = buf;
+    return true;
+  }
+
+  set_u16be(&buf[len - 2], HSK_DNS_COOKIE_SIZE);
+
+  *wire = buf;
+  *wire_len = len + HSK_DNS_COOKIE_SIZE;
+
+  return true;
+}
+
+// Nearly every query is one question and maybe
+// an OPT record: read those straight off the
+// wire, without decoding a message. Anything
+// else (or anything odd) is left to the full
+// decoder, which gets the final say.
+static bool
+hsk_dns_req_parse(hsk_dns_req_t *req, const uint8_t *data, size_t data_len) {
+  uint8_t *buf = (uint8_t *)data;
+  size_t len = data_len;
+  uint8_t *p;
+
+  hsk_dns_dmp_t dmp;
+  dmp.msg = buf;
+  dmp.msg_len = len;
+
+  if (!slice_bytes(&buf, &len, &p, 12))
+    return false;
+
+  uint16_t id = get_u16be(p);
+  uint16_t flags = get_u16be(p + 2);
+  uint16_t qdcount = get_u16be(p + 4);
+  uint16_t ancount = get_u16be(p + 6);
+  uint16_t nscount = get_u16be(p + 8);
+  uint16_t arcount = get_u16be(p + 10);
+
+  if (((flags >> 11) & 0x0f) != HSK_DNS_QUERY
+      || (flags & 0x0f) != HSK_DNS_NOERROR
+      || qdcount != 1
+      || ancount != 0
+      || nscount != 0) {
+    return false;
+  }
+
+  if (!hsk_dns_name_read(&buf, &len, &dmp, req->name)
+      || !slice_bytes(&buf, &len, &p, 4)) {
+    return false;
+  }
+
+  uint16_t type = get_u16be(p);
+  uint16_t class = get_u16be(p + 2);
+
+  bool edns = false;
+  uint16_t edns_size = 0;
+  uint16_t edns_flags = 0;
+  uint32_t i;
+
+  for (i = 0; i < arcount; i++) {
+    if (len == 0)
+      break;
+
+    if (hsk_dns_name_parse(&buf, &len, &dmp, NULL) == -1
+        || !slice_bytes(&buf, &len, &p, 10)) {
+      return false;
+    }
+
+    uint16_t rr_type = get_u16be(p);
+    uint16_t rr_class = get_u16be(p + 2);
+    uint32_t rr_ttl = get_u32be(p + 4);
+    uint16_t rr_len = get_u16be(p + 8);
+
+    if (len < rr_len)
+      return false;
+
+    // Extended rcodes are for replies.
+    if (rr_type != HSK_DNS_OPT || (rr_ttl >> 24) != 0)
+      return false;
+
+    edns = true;
+    edns_size = rr_class;
+    edns_flags = rr_ttl & 0xffff;
+
+    hsk_dns_req_read_cookie(req, buf, rr_len);
+
+    buf += rr_len;
+    len -= rr_len;
+  }
+
+  req->id = id;
+  req->type = type;
+  req->class = class;
+
+  hsk_dns_req_set_flags(req, flags, edns, edns_size, edns_flags);
+
+  return true;
+}
+
+// The full decoder, for whatever the fast
+// parser would not take.
+static bool
+hsk_dns_req_decode(hsk_dns_req_t *req, const uint8_t *data, size_t data_len) {
+  hsk_dns_msg_t *msg = NULL;
 
   if (!hsk_dns_msg_decode(data, data_len, &msg))
-    goto fail;
+    return false;
 
   if (msg->opcode != HSK_DNS_QUERY
       || msg->code != HSK_DNS_NOERROR
@@ -83,17 +465,59 @@ hsk_dns_req_create(
   // Grab the first question.
   hsk_dns_qs_t *qs = msg->qd.items[0];
 
+  req->id = msg->id;
+  strcpy(req->name, qs->name);
+  req->type = qs->type;
+  req->class = qs->class;
+
+  hsk_dns_req_set_flags(
+    req,
+    msg->flags,
+    msg->edns.enabled,
+    msg->edns.size,
+    msg->edns.flags
+  );
+
+  if (msg->edns.rd)
+    hsk_dns_req_read_cookie(req, msg->edns.rd, msg->edns.rd_len);
+
+  hsk_dns_msg_free(msg);
+
+  return true;
+
+fail:
+  hsk_dns_msg_free(msg);
+  return false;
+}
+
+hsk_dns_req_t *
+hsk_dns_req_create(
+  hsk_slab_t *slab,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  hsk_dns_req_t *req = hsk_dns_req_take(slab);
+
+  if (!req)
+    return NULL;
+
+  if (!hsk_dns_req_parse(req, data, data_len)
+      && !hsk_dns_req_decode(req, data, data_len)) {
+    goto fail;
+  }
+
 #if 0
-  if (qs->class != HSK_DNS_IN)
+  if (req->class != HSK_DNS_IN)
     goto fail;
 
   // Don't allow dirty names.
-  if (hsk_dns_name_dirty(qs->name))
+  if (hsk_dns_name_dirty(req->name))
     goto fail;
 #endif
 
   // Check for a TLD.
-  hsk_dns_label_get(qs->name, -1, req->tld);
+  hsk_dns_label_get(req->name, -1, req->tld);
 
   // Don't allow dirty TLDs.
   if (hsk_dns_name_dirty(req->tld))
@@ -104,40 +528,20 @@ hsk_dns_req_create(
 
   // Reference.
   req->ns = NULL;
+  req->conn = NULL;
+  req->stream = NULL;
+  req->local = false;
 
   // DNS stuff.
-  req->id = msg->id;
-  req->labels = hsk_dns_label_count(qs->name);
-  strcpy(req->name, qs->name);
-  req->type = qs->type;
-  req->class = qs->class;
-  req->rd = (msg->flags & HSK_DNS_RD) != 0;
-  req->cd = (msg->flags & HSK_DNS_CD) != 0;
-  req->ad = (msg->flags & HSK_DNS_AD) != 0;
-  req->edns = msg->edns.enabled;
-  req->max_size = HSK_DNS_MAX_UDP;
-  if (msg->edns.enabled && msg->edns.size >= HSK_DNS_MAX_UDP) {
-    req->max_size = msg->edns.size;
-    if (req->max_size > HSK_DNS_MAX_EDNS)
-      req->max_size = HSK_DNS_MAX_EDNS;
-  }
-  req->dnssec = (msg->edns.flags & HSK_DNS_DO) != 0;
+  req->labels = hsk_dns_label_count(req->name);
 
   // Sender address.
   hsk_sa_copy(req->addr, addr);
 
-  // Free stuff up.
-  hsk_dns_msg_free(msg);
-
   return req;
 
 fail:
-  if (req)
-    free(req);
-
-  if (msg)
-    hsk_dns_msg_free(msg);
-
+  hsk_dns_req_give(slab, req);
   return NULL;
 }
 
@@ -149,37 +553,39 @@ hsk_dns_req_print(const hsk_dns_req_t *req, const char *prefix) {
 
   assert(hsk_sa_to_string(req->addr, addr, HSK_MAX_HOST, 1));
 
-  printf("%squery\n", prefix);
-  printf("%s  id=%d\n", prefix, req->id);
-  printf("%s  labels=%u\n", prefix, (uint32_t)req->labels);
-  printf("%s  name=%s\n", prefix, req->name);
-  printf("%s  type=%d\n", prefix, req->type);
-  printf("%s  class=%d\n", prefix, req->class);
-  printf("%s  edns=%d\n", prefix, (int)req->edns);
-  printf("%s  dnssec=%d\n", prefix, (int)req->dnssec);
-  printf("%s  tld=%s\n", prefix, req->tld);
-  printf("%s  addr=%s\n", prefix, addr);
+  hsk_log_printf("%squery\n", prefix);
+  hsk_log_printf("%s  id=%d\n", prefix, req->id);
+  hsk_log_printf("%s  labels=%u\n", prefix, (uint32_t)req->labels);
+  hsk_log_printf("%s  name=%s\n", prefix, req->name);
+  hsk_log_printf("%s  type=%d\n", prefix, req->type);
+  hsk_log_printf("%s  class=%d\n", prefix, req->class);
+  hsk_log_printf("%s  edns=%d\n", prefix, (int)req->edns);
+  hsk_log_printf("%s  dnssec=%d\n", prefix, (int)req->dnssec);
+  hsk_log_printf("%s  cookie=%d\n", prefix, (int)req->cookie);
+  hsk_log_printf("%s  cookie_ok=%d\n", prefix,
+                 (int)hsk_dns_req_check_cookie(req));
+  hsk_log_printf("%s  tld=%s\n", prefix, req->tld);
+  hsk_log_printf("%s  addr=%s\n", prefix, addr);
 }
 
+// Like hsk_dns_msg_prepare, but the message is
+// kept, left as it was encoded for the request.
 bool
-hsk_dns_msg_finalize(
-  hsk_dns_msg_t **res,
+hsk_dns_msg_reply(
+  hsk_dns_msg_t *msg,
   const hsk_dns_req_t *req,
-  const hsk_ec_t *ec,
-  const uint8_t *key,
+  bool sig0,
   uint8_t **wire,
   size_t *wire_len
 ) {
-  assert(res && req && ec && wire && wire_len);
+  assert(msg && req && wire && wire_len);
 
-  hsk_dns_msg_t *msg = *res;
-
-  *res = NULL;
   *wire = NULL;
   *wire_len = 0;
 
   // Reset ID & flags.
   msg->id = req->id;
+  msg->flags &= ~(HSK_DNS_RD | HSK_DNS_CD);
   msg->flags |= HSK_DNS_QR;
 
   if (req->rd)
@@ -197,13 +603,13 @@ hsk_dns_msg_finalize(
   msg->edns.rd_len = 0;
 
   if (msg->edns.rd) {
-    free(msg->edns.rd);
+    hsk_free(msg->edns.rd);
     msg->edns.rd = NULL;
   }
 
   if (req->edns) {
     msg->edns.enabled = true;
-    msg->edns.size = HSK_DNS_MAX_EDNS;
+    msg->edns.size = hsk_dns_udp_size;
     if (req->dnssec)
       msg->edns.flags |= HSK_DNS_DO;
   }
@@ -213,10 +619,8 @@ hsk_dns_msg_finalize(
 
   hsk_dns_qs_t *qs = hsk_dns_qs_alloc();
 
-  if (!qs) {
-    hsk_dns_msg_free(msg);
-    return NULL;
-  }
+  if (!qs)
+    return false;
 
   hsk_dns_rr_set_name(qs, req->name);
   qs->type = req->type;
@@ -228,57 +632,547 @@ hsk_dns_msg_finalize(
   if (!req->dnssec) {
     // If we're recursive, and the query was ANY, do not remove.
     if (!(msg->flags & HSK_DNS_RA) || req->type != HSK_DNS_ANY) {
-      if (!hsk_dns_msg_clean(msg, req->type)) {
-        hsk_dns_msg_free(msg);
+      if (!hsk_dns_msg_clean(msg, req->type))
         return false;
-      }
     }
   }
 
-  // Reserialize.
+  // Reserialize, truncating as we go.
   uint8_t *data = NULL;
   size_t data_len = 0;
+  size_t max = req->max_size;
 
-  if (!hsk_dns_msg_encode(msg, &data, &data_len)) {
-    hsk_dns_msg_free(msg);
-    return false;
+  if (sig0)
+    max -= HSK_SIG0_RR_SIZE;
+
+  // Room for hsk_dns_wire_cookie. Kept for any
+  // EDNS reply, as it may be cached and sent to
+  // clients with cookies.
+  if (req->edns)
+    max -= HSK_DNS_COOKIE_SIZE;
+
+  if (req->trace) {
+    size_t size = (size_t)hsk_dns_msg_size(msg);
+
+    req->trace->size = size > 0xffff ? 0xffff : (uint16_t)size;
+
+    if (size > max)
+      req->trace->flags |= HSK_TRACE_TRUNCATED;
   }
 
+  if (!hsk_dns_msg_encode_max(msg, max, &data, &data_len))
+    return false;
+
   assert(data);
 
+  *wire = data;
+  *wire_len = data_len;
+
+  return true;
+}
+
+// Everything but the signature. Room for one
+// is left when the reply is to be signed.
+bool
+hsk_dns_msg_prepare(
+  hsk_dns_msg_t **res,
+  const hsk_dns_req_t *req,
+  bool sig0,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(res && req && wire && wire_len);
+
+  hsk_dns_msg_t *msg = *res;
+
+  *res = NULL;
+
+  bool ret = hsk_dns_msg_reply(msg, req, sig0, wire, wire_len);
+
   hsk_dns_msg_free(msg);
 
-  // Truncate.
+  return ret;
+}
+
+// Where a reply from elsewhere may be cut or
+// point: at most this many dropped runs and
+// compression pointers in what is kept.
+#define HSK_DNS_WIRE_CUTS 64
+#define HSK_DNS_WIRE_PTRS 256
+
+// The RFC 1035 types, the only ones whose
+// rdata names may be compressed (RFC 3597):
+// where the first name starts, and how many
+// there are.
+static bool
+hsk_dns_wire_rd_names(uint16_t type, size_t *skip, int *count) {
+  *skip = 0;
+  *count = 1;
+
+  switch (type) {
+    case HSK_DNS_NS:
+    case HSK_DNS_MD:
+    case HSK_DNS_MF:
+    case HSK_DNS_CNAME:
+    case HSK_DNS_MB:
+    case HSK_DNS_MG:
+    case HSK_DNS_MR:
+    case HSK_DNS_PTR:
+      return true;
+    case HSK_DNS_SOA:
+    case HSK_DNS_MINFO:
+      *count = 2;
+      return true;
+    case HSK_DNS_MX:
+      *skip = 2;
+      return true;
+  }
+
+  return false;
+}
+
+// As hsk_dns_rrs_clean.
+static bool
+hsk_dns_wire_is_dnssec(uint16_t type) {
+  switch (type) {
+    case HSK_DNS_DS:
+    case HSK_DNS_DLV:
+    case HSK_DNS_DNSKEY:
+    case HSK_DNS_RRSIG:
+    case HSK_DNS_NXT:
+    case HSK_DNS_NSEC:
+    case HSK_DNS_NSEC3:
+    case HSK_DNS_NSEC3PARAM:
+      return true;
+  }
+
+  return false;
+}
+
+// Skips a name ending before `end`, noting the
+// position of the pointer it ends in (0 if
+// none).
+static bool
+hsk_dns_wire_skip_name(
+  const uint8_t *data,
+  size_t *pos,
+  size_t end,
+  size_t *ptr
+) {
+  size_t p = *pos;
+
+  for (;;) {
+    if (p >= end)
+      return false;
+
+    uint8_t c = data[p];
+
+    if ((c & 0xc0) == 0xc0) {
+      if (p + 2 > end)
+        return false;
+      *ptr = p;
+      *pos = p + 2;
+      return true;
+    }
+
+    if (c & 0xc0)
+      return false;
+
+    p += 1 + c;
+
+    if (c == 0) {
+      *ptr = 0;
+      *pos = p;
+      return true;
+    }
+  }
+}
+
+// Bytes dropped before `pos`, or -1 if `pos`
+// is itself dropped.
+static long
+hsk_dns_wire_shift(size_t (*cuts)[2], int count, size_t pos) {
+  long shift = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (pos < cuts[i][0])
+      break;
+
+    if (pos < cuts[i][1])
+      return -1;
+
+    shift += cuts[i][1] - cuts[i][0];
+  }
+
+  return shift;
+}
+
+static bool
+hsk_dns_wire_equal(const uint8_t *a, const uint8_t *b, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t x = a[i];
+    uint8_t y = b[i];
+
+    if (x >= 'A' && x <= 'Z')
+      x += ' ';
+
+    if (y >= 'A' && y <= 'Z')
+      y += ' ';
+
+    if (x != y)
+      return false;
+  }
+
+  return true;
+}
+
+// What hsk_dns_msg_reply does to a message
+// with these flags and code, done to a reply
+// from elsewhere (unbound's) without decoding
+// it: the header and question are rewritten,
+// the authority and additional sections are
+// dropped when there are answers, DNSSEC
+// records unless asked for, and our OPT record
+// goes last. Compression pointers behind what
+// is dropped are moved down. Returns false,
+// with nothing written, for anything it does
+// not handle (several questions, pointers into
+// dropped records, a reply that would need
+// truncating...), to be left to the decoder.
+bool
+hsk_dns_wire_reply(
+  const uint8_t *data,
+  size_t data_len,
+  const hsk_dns_req_t *req,
+  uint16_t flags,
+  uint8_t code,
+  bool sig0,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(data && req && wire && wire_len);
+
+  size_t cuts[HSK_DNS_WIRE_CUTS][2];
+  size_t ptrs[HSK_DNS_WIRE_PTRS];
+  int cut_count = 0;
+  int ptr_count = 0;
+  uint16_t kept[3] = { 0, 0, 0 };
+  uint8_t qname[256];
+  size_t pos = 12;
+  size_t ptr;
+
+  *wire = NULL;
+  *wire_len = 0;
+
+  if (data_len < 12 || code > 0x0f || get_u16be(&data[4]) != 1)
+    return false;
+
+  uint16_t counts[3] = {
+    get_u16be(&data[6]),
+    get_u16be(&data[8]),
+    get_u16be(&data[10])
+  };
+
+  // The asker's spelling of the same question.
+  int qlen = hsk_dns_name_pack(req->name, qname);
+
+  if (qlen <= 0 || !hsk_dns_wire_skip_name(data, &pos, data_len, &ptr))
+    return false;
+
+  if (ptr != 0 || pos - 12 != (size_t)qlen || pos + 4 > data_len)
+    return false;
+
+  if (!hsk_dns_wire_equal(&data[12], qname, qlen)
+      || get_u16be(&data[pos]) != req->type
+      || get_u16be(&data[pos + 2]) != req->class) {
+    return false;
+  }
+
+  pos += 4;
+
+  bool clean = !req->dnssec
+            && (!(flags & HSK_DNS_RA) || req->type != HSK_DNS_ANY);
+
+  for (int s = 0; s < 3; s++) {
+    for (int i = 0; i < counts[s]; i++) {
+      size_t start = pos;
+
+      if (!hsk_dns_wire_skip_name(data, &pos, data_len, &ptr))
+        return false;
+
+      if (pos + 10 > data_len)
+        return false;
+
+      uint16_t type = get_u16be(&data[pos]);
+      size_t rd = pos + 10;
+      size_t rd_end = rd + get_u16be(&data[pos + 8]);
+
+      if (rd_end > data_len)
+        return false;
+
+      pos = rd_end;
+
+      bool drop = (s > 0 && counts[0] > 0)
+               || type == HSK_DNS_OPT
+               || (clean && hsk_dns_wire_is_dnssec(type) && type != req->type);
+
+      if (drop) {
+        if (cut_count > 0 && cuts[cut_count - 1][1] == start) {
+          cuts[cut_count - 1][1] = pos;
+          continue;
+        }
+
+        if (cut_count == HSK_DNS_WIRE_CUTS)
+          return false;
+
+        cuts[cut_count][0] = start;
+        cuts[cut_count][1] = pos;
+        cut_count += 1;
+
+        continue;
+      }
+
+      kept[s] += 1;
+
+      size_t skip;
+      int names;
+
+      if (!hsk_dns_wire_rd_names(type, &skip, &names))
+        names = 0;
+
+      size_t p = rd + skip;
+
+      for (int n = -1; n < names; n++) {
+        // The owner name, then any in the rdata.
+        if (n >= 0 && !hsk_dns_wire_skip_name(data, &p, rd_end, &ptr))
+          return false;
+
+        if (ptr == 0)
+          continue;
+
+        if (ptr_count == HSK_DNS_WIRE_PTRS)
+          return false;
+
+        ptrs[ptr_count++] = ptr;
+      }
+    }
+  }
+
+  if (pos != data_len)
+    return false;
+
+  size_t dropped = 0;
+
+  for (int i = 0; i < cut_count; i++)
+    dropped += cuts[i][1] - cuts[i][0];
+
+  size_t size = data_len - dropped + (req->edns ? 11 : 0);
   size_t max = req->max_size;
 
-  if (key)
+  if (sig0)
     max -= HSK_SIG0_RR_SIZE;
 
-  if (!hsk_dns_msg_truncate(data, data_len, max, &data_len)) {
-    free(data);
+  // As in hsk_dns_msg_reply.
+  if (req->edns)
+    max -= HSK_DNS_COOKIE_SIZE;
+
+  if (size > max)
     return false;
+
+  uint8_t *buf = hsk_malloc(size);
+
+  if (!buf)
+    return false;
+
+  uint8_t *b = buf;
+  size_t last = 0;
+
+  for (int i = 0; i < cut_count; i++) {
+    memcpy(b, &data[last], cuts[i][0] - last);
+    b += cuts[i][0] - last;
+    last = cuts[i][1];
   }
 
-  if (!key) {
-    *wire = data;
-    *wire_len = data_len;
-    return true;
+  memcpy(b, &data[last], data_len - last);
+  b += data_len - last;
+
+  for (int i = 0; i < ptr_count; i++) {
+    size_t at = ptrs[i];
+    size_t to = get_u16be(&data[at]) & 0x3fff;
+    long shift = hsk_dns_wire_shift(cuts, cut_count, to);
+
+    // Pointers only go back.
+    if (to >= at || shift < 0) {
+      hsk_free(buf);
+      return false;
+    }
+
+    at -= hsk_dns_wire_shift(cuts, cut_count, at);
+    set_u16be(&buf[at], 0xc000 | (to - shift));
   }
 
-  // Sign.
-  uint8_t *out = NULL;
-  size_t out_len = 0;
+  if (req->edns) {
+    b[0] = 0x00;
+    set_u16be(&b[1], HSK_DNS_OPT);
+    set_u16be(&b[3], hsk_dns_udp_size);
+    set_u32be(&b[5], req->dnssec ? HSK_DNS_DO : 0);
+    set_u16be(&b[9], 0);
+    kept[2] += 1;
+  }
+
+  flags &= ~(HSK_DNS_RD | HSK_DNS_CD | (0x0f << 11) | 0x0f);
+  flags |= HSK_DNS_QR | code;
+
+  if (req->rd)
+    flags |= HSK_DNS_RD;
+
+  if (req->cd)
+    flags |= HSK_DNS_CD;
+
+  set_u16be(&buf[0], req->id);
+  set_u16be(&buf[2], flags);
+  set_u16be(&buf[6], kept[0]);
+  set_u16be(&buf[8], kept[1]);
+  set_u16be(&buf[10], kept[2]);
+  memcpy(&buf[12], qname, qlen);
+
+  if (req->trace)
+    req->trace->size = size > 0xffff ? 0xffff : (uint16_t)size;
+
+  *wire = buf;
+  *wire_len = size;
+
+  return true;
+}
+
+// An empty reply (SERVFAIL, NOTIMP, TC...)
+// written straight from the request: the bytes
+// hsk_dns_msg_reply would encode for an empty
+// message, without building one. Small enough
+// to always leave room for a cookie and SIG(0).
+bool
+hsk_dns_wire_empty(
+  const hsk_dns_req_t *req,
+  uint16_t flags,
+  uint8_t code,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(req && wire && wire_len);
+
+  uint8_t qname[256];
+
+  *wire = NULL;
+  *wire_len = 0;
+
+  if (code > 0x0f)
+    return false;
+
+  int qlen = hsk_dns_name_pack(req->name, qname);
 
-  if (!hsk_sig0_sign(ec, key, data, data_len, &out, &out_len)) {
-    free(data);
+  if (qlen <= 0)
     return false;
+
+  size_t size = 12 + qlen + 4 + (req->edns ? 11 : 0);
+  uint8_t *buf = hsk_malloc(size);
+
+  if (!buf)
+    return false;
+
+  flags &= ~(HSK_DNS_RD | HSK_DNS_CD | (0x0f << 11) | 0x0f);
+  flags |= HSK_DNS_QR | code;
+
+  if (req->rd)
+    flags |= HSK_DNS_RD;
+
+  if (req->cd)
+    flags |= HSK_DNS_CD;
+
+  set_u16be(&buf[0], req->id);
+  set_u16be(&buf[2], flags);
+  set_u16be(&buf[4], 1);
+  set_u16be(&buf[6], 0);
+  set_u16be(&buf[8], 0);
+  set_u16be(&buf[10], req->edns ? 1 : 0);
+
+  uint8_t *b = &buf[12];
+
+  memcpy(b, qname, qlen);
+  set_u16be(&b[qlen], req->type);
+  set_u16be(&b[qlen + 2], req->class);
+
+  b += qlen + 4;
+
+  if (req->edns) {
+    b[0] = 0x00;
+    set_u16be(&b[1], HSK_DNS_OPT);
+    set_u16be(&b[3], hsk_dns_udp_size);
+    set_u32be(&b[5], req->dnssec ? HSK_DNS_DO : 0);
+    set_u16be(&b[9], 0);
   }
 
-  assert(out);
-  free(data);
+  if (req->trace)
+    req->trace->size = (uint16_t)size;
+
+  *wire = buf;
+  *wire_len = size;
+
+  return true;
+}
+
+// Signs the wire in place, growing it to fit
+// the record (usually without moving it: the
+// cache leaves room).
+bool
+hsk_dns_wire_sign(
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(ec && key && wire && wire_len);
+
+  size_t size = *wire_len + HSK_SIG0_RR_SIZE;
+  uint8_t *data = hsk_realloc(*wire, size);
 
-  *wire = out;
-  *wire_len = out_len;
+  if (!data)
+    return false;
+
+  *wire = data;
+
+  return hsk_sig0_sign_into(ec, key, data, *wire_len, size, wire_len);
+}
+
+bool
+hsk_dns_msg_finalize(
+  hsk_dns_msg_t **res,
+  const hsk_dns_req_t *req,
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(res && req && ec && wire && wire_len);
+
+  if (!hsk_dns_msg_prepare(res, req, key != NULL, wire, wire_len))
+    return false;
+
+  if (!hsk_dns_wire_cookie(req, wire, wire_len)) {
+    hsk_free(*wire);
+    *wire = NULL;
+    *wire_len = 0;
+    return false;
+  }
+
+  if (!key)
+    return true;
+
+  if (!hsk_dns_wire_sign(ec, key, wire, wire_len)) {
+    hsk_free(*wire);
+    *wire = NULL;
+    *wire_len = 0;
+    return false;
+  }
 
   return true;
 }
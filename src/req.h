@@ -10,11 +10,51 @@
 
 #include "dns.h"
 #include "ec.h"
+#include "slab.h"
+#include "trace.h"
+
+// DNS Cookies (RFC 7873). Server cookies keep
+// no state (RFC 9018): a version, a timestamp
+// and SipHash-2-4 over the client cookie, both
+// of those and the client's address, under a
+// secret drawn at startup. One is good for an
+// hour (and five minutes of clock skew).
+#define HSK_DNS_COOKIE_CLIENT 8
+#define HSK_DNS_COOKIE_SERVER 16
+#define HSK_DNS_COOKIE_MAX 32
+#define HSK_DNS_COOKIE_SIZE (4 + HSK_DNS_COOKIE_CLIENT + HSK_DNS_COOKIE_SERVER)
+#define HSK_DNS_COOKIE_LIFETIME 3600
+#define HSK_DNS_COOKIE_SKEW 300
+
+// UDP replies are cut to one of a few sizes
+// (the largest the client takes), so cached
+// wire replies come in few variants. Nothing
+// above the UDP size we were given (DNS Flag
+// Day 2020 suggests 1232, to stay clear of
+// fragmentation).
+#define HSK_DNS_UDP_CLASSES 3
+
+// Freed requests each server (one per loop)
+// keeps for the next datagram.
+#ifdef HSK_LOW_MEMORY
+#define HSK_DNS_REQ_SLAB 32
+#else
+#define HSK_DNS_REQ_SLAB 256
+#endif
 
 typedef struct {
   // Reference.
   void *ns;
 
+  // TCP connection it came in on (if any).
+  void *conn;
+
+  // DoQ stream it came in on (if any).
+  void *stream;
+
+  // Came from our own recursive resolver.
+  bool local;
+
   // DNS stuff
   uint16_t id;
   size_t labels;
@@ -28,12 +68,32 @@ typedef struct {
   size_t max_size;
   bool dnssec;
 
+  // Sent a cookie, and with it a server cookie
+  // of ours that is still good for its address
+  // (so the source is not spoofed). Checked
+  // only once asked (see hsk_dns_req_cookie_ok):
+  // most replies never need to know.
+  bool cookie;
+  bool cookie_checked;
+  bool cookie_ok;
+  uint8_t client_cookie[HSK_DNS_COOKIE_CLIENT];
+  uint8_t server_cookie[HSK_DNS_COOKIE_MAX];
+  size_t server_cookie_len;
+
   // HSK stuff
   char tld[HSK_DNS_MAX_LABEL + 1];
 
   // Who it's from.
   struct sockaddr_storage ss;
   struct sockaddr *addr;
+
+  // When it came in and when its lookup began
+  // (uv_hrtime), for the nameserver's stats.
+  uint64_t time;
+  uint64_t lookup_time;
+
+  // Set on the few queries being traced.
+  hsk_trace_t *trace;
 } hsk_dns_req_t;
 
 void
@@ -48,8 +108,15 @@ hsk_dns_req_alloc(void);
 void
 hsk_dns_req_free(hsk_dns_req_t *req);
 
+hsk_dns_req_t *
+hsk_dns_req_take(hsk_slab_t *slab);
+
+void
+hsk_dns_req_give(hsk_slab_t *slab, hsk_dns_req_t *req);
+
 hsk_dns_req_t *
 hsk_dns_req_create(
+  hsk_slab_t *slab,
   const uint8_t *data,
   size_t data_len,
   const struct sockaddr *addr
@@ -58,6 +125,69 @@ hsk_dns_req_create(
 void
 hsk_dns_req_print(const hsk_dns_req_t *req, const char *prefix);
 
+bool
+hsk_dns_req_cookie_ok(hsk_dns_req_t *req);
+
+bool
+hsk_dns_req_set_udp_size(size_t size);
+
+size_t
+hsk_dns_req_udp_size(void);
+
+bool
+hsk_dns_msg_reply(
+  hsk_dns_msg_t *msg,
+  const hsk_dns_req_t *req,
+  bool sig0,
+  uint8_t **wire,
+  size_t *wire_len
+);
+
+bool
+hsk_dns_msg_prepare(
+  hsk_dns_msg_t **res,
+  const hsk_dns_req_t *req,
+  bool sig0,
+  uint8_t **wire,
+  size_t *wire_len
+);
+
+bool
+hsk_dns_wire_reply(
+  const uint8_t *data,
+  size_t data_len,
+  const hsk_dns_req_t *req,
+  uint16_t flags,
+  uint8_t code,
+  bool sig0,
+  uint8_t **wire,
+  size_t *wire_len
+);
+
+bool
+hsk_dns_wire_empty(
+  const hsk_dns_req_t *req,
+  uint16_t flags,
+  uint8_t code,
+  uint8_t **wire,
+  size_t *wire_len
+);
+
+bool
+hsk_dns_wire_cookie(
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+);
+
+bool
+hsk_dns_wire_sign(
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  uint8_t **wire,
+  size_t *wire_len
+);
+
 bool
 hsk_dns_msg_finalize(
   hsk_dns_msg_t **res,
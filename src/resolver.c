@@ -0,0 +1,521 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "chain.h"
+#include "dns.h"
+#include "error.h"
+#include "icann.h"
+#include "mem.h"
+#include "pool.h"
+#include "resolver.h"
+#include "resource.h"
+#include "utils.h"
+#include "uv.h"
+
+/*
+ * Prototypes
+ */
+
+static void
+after_async(uv_async_t *handle);
+
+static void
+after_close(uv_handle_t *handle);
+
+static void
+after_resolve(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+);
+
+/*
+ * Resolver
+ */
+
+int
+hsk_resolver_init(
+  hsk_resolver_t *resolver,
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool
+) {
+  if (!resolver || !loop || !pool)
+    return HSK_EBADARGS;
+
+  resolver->loop = (uv_loop_t *)loop;
+  resolver->pool = (hsk_pool_t *)pool;
+  resolver->running = false;
+  resolver->head = NULL;
+  resolver->tail = NULL;
+  resolver->lookups = NULL;
+  resolver->async.data = (void *)resolver;
+
+  hsk_cache_init(&resolver->cache);
+
+  if (uv_mutex_init(&resolver->lock) != 0) {
+    hsk_cache_uninit(&resolver->cache);
+    return HSK_EFAILURE;
+  }
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_resolver_uninit(hsk_resolver_t *resolver) {
+  if (!resolver)
+    return;
+
+  assert(!resolver->running);
+  assert(!resolver->head && !resolver->lookups);
+
+  hsk_cache_uninit(&resolver->cache);
+  uv_mutex_destroy(&resolver->lock);
+}
+
+hsk_resolver_t *
+hsk_resolver_alloc(const uv_loop_t *loop, const hsk_pool_t *pool) {
+  hsk_resolver_t *resolver = hsk_malloc(sizeof(hsk_resolver_t));
+
+  if (!resolver)
+    return NULL;
+
+  if (hsk_resolver_init(resolver, loop, pool) != HSK_SUCCESS) {
+    hsk_free(resolver);
+    return NULL;
+  }
+
+  return resolver;
+}
+
+void
+hsk_resolver_free(hsk_resolver_t *resolver) {
+  if (!resolver)
+    return;
+
+  hsk_resolver_uninit(resolver);
+  hsk_free(resolver);
+}
+
+bool
+hsk_resolver_set_cache_size(hsk_resolver_t *resolver, size_t max_size) {
+  assert(resolver);
+
+  if (resolver->running)
+    return false;
+
+  return hsk_cache_set_size(&resolver->cache, max_size);
+}
+
+int
+hsk_resolver_open(hsk_resolver_t *resolver) {
+  if (!resolver)
+    return HSK_EBADARGS;
+
+  if (resolver->running)
+    return HSK_EFAILURE;
+
+  if (uv_async_init(resolver->loop, &resolver->async, after_async) != 0)
+    return HSK_EFAILURE;
+
+  resolver->async.data = (void *)resolver;
+
+  // Before answers can come from other threads.
+  hsk_icann_load();
+
+  uv_mutex_lock(&resolver->lock);
+  resolver->running = true;
+  uv_mutex_unlock(&resolver->lock);
+
+  return HSK_SUCCESS;
+}
+
+static hsk_resolver_job_t *
+hsk_resolver_take_jobs(hsk_resolver_t *resolver) {
+  uv_mutex_lock(&resolver->lock);
+  hsk_resolver_job_t *list = resolver->head;
+  resolver->head = NULL;
+  resolver->tail = NULL;
+  uv_mutex_unlock(&resolver->lock);
+  return list;
+}
+
+static void
+hsk_resolver_answer(
+  hsk_resolver_job_t *job,
+  int status,
+  const hsk_dns_msg_t *msg
+) {
+  job->callback(job->name, job->type, status, msg, job->arg);
+  hsk_free(job);
+}
+
+// Runs on the loop. Queued queries fail, and so
+// do ones waiting on the pool: those are left
+// for the pool to free when it answers.
+int
+hsk_resolver_close(hsk_resolver_t *resolver) {
+  if (!resolver)
+    return HSK_EBADARGS;
+
+  if (!resolver->running)
+    return HSK_SUCCESS;
+
+  uv_mutex_lock(&resolver->lock);
+  resolver->running = false;
+  uv_mutex_unlock(&resolver->lock);
+
+  uv_close((uv_handle_t *)&resolver->async, after_close);
+
+  hsk_resolver_job_t *job, *next;
+
+  for (job = hsk_resolver_take_jobs(resolver); job; job = next) {
+    next = job->next;
+    hsk_resolver_answer(job, HSK_EFAILURE, NULL);
+  }
+
+  while ((job = resolver->lookups)) {
+    resolver->lookups = job->next;
+    job->resolver = NULL;
+    job->callback(job->name, job->type, HSK_EFAILURE, NULL, job->arg);
+  }
+
+  return HSK_SUCCESS;
+}
+
+static hsk_resolver_job_t *
+hsk_resolver_job_alloc(
+  hsk_resolver_t *resolver,
+  const char *name,
+  uint16_t type,
+  hsk_resolver_cb callback,
+  void *arg,
+  int *rc
+) {
+  *rc = HSK_EBADARGS;
+
+  if (!hsk_dns_name_verify(name))
+    return NULL;
+
+  size_t len = strlen(name);
+
+  // The root zone is not ours to answer.
+  if (len == 0 || strcmp(name, ".") == 0)
+    return NULL;
+
+  hsk_resolver_job_t *job = hsk_malloc(sizeof(hsk_resolver_job_t));
+
+  if (!job) {
+    *rc = HSK_ENOMEM;
+    return NULL;
+  }
+
+  memcpy(job->name, name, len + 1);
+
+  if (name[len - 1] != '.') {
+    job->name[len + 0] = '.';
+    job->name[len + 1] = '\0';
+  }
+
+  hsk_dns_label_get(job->name, -1, job->tld);
+
+  if (hsk_dns_name_dirty(job->tld)) {
+    hsk_free(job);
+    return NULL;
+  }
+
+  hsk_to_lower(job->tld);
+
+  job->resolver = resolver;
+  job->type = type;
+  job->callback = callback;
+  job->arg = arg;
+  job->prev = NULL;
+  job->next = NULL;
+
+  *rc = HSK_SUCCESS;
+
+  return job;
+}
+
+// Queues the batch under one lock with one
+// wakeup. Either every query is queued, or
+// none is and no callback runs.
+int
+hsk_resolver_resolve_many(
+  hsk_resolver_t *resolver,
+  const hsk_resolver_query_t *queries,
+  size_t count,
+  hsk_resolver_cb callback
+) {
+  if (!resolver || !queries || !callback)
+    return HSK_EBADARGS;
+
+  if (count == 0)
+    return HSK_SUCCESS;
+
+  hsk_resolver_job_t *head = NULL;
+  hsk_resolver_job_t *tail = NULL;
+  hsk_resolver_job_t *job, *next;
+  int rc = HSK_SUCCESS;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    const hsk_resolver_query_t *q = &queries[i];
+
+    job = hsk_resolver_job_alloc(resolver, q->name, q->type,
+                                 callback, q->arg, &rc);
+
+    if (!job)
+      goto fail;
+
+    if (tail)
+      tail->next = job;
+    else
+      head = job;
+
+    tail = job;
+  }
+
+  uv_mutex_lock(&resolver->lock);
+
+  if (!resolver->running) {
+    uv_mutex_unlock(&resolver->lock);
+    rc = HSK_EFAILURE;
+    goto fail;
+  }
+
+  if (resolver->tail)
+    resolver->tail->next = head;
+  else
+    resolver->head = head;
+
+  resolver->tail = tail;
+
+  uv_async_send(&resolver->async);
+  uv_mutex_unlock(&resolver->lock);
+
+  return HSK_SUCCESS;
+
+fail:
+  for (job = head; job; job = next) {
+    next = job->next;
+    hsk_free(job);
+  }
+
+  return rc;
+}
+
+int
+hsk_resolver_resolve(
+  hsk_resolver_t *resolver,
+  const char *name,
+  uint16_t type,
+  hsk_resolver_cb callback,
+  void *arg
+) {
+  hsk_resolver_query_t query;
+
+  query.name = name;
+  query.type = type;
+  query.arg = arg;
+
+  return hsk_resolver_resolve_many(resolver, &query, 1, callback);
+}
+
+/*
+ * Lookups
+ */
+
+static void
+hsk_resolver_link(hsk_resolver_t *resolver, hsk_resolver_job_t *job) {
+  job->prev = NULL;
+  job->next = resolver->lookups;
+
+  if (resolver->lookups)
+    resolver->lookups->prev = job;
+
+  resolver->lookups = job;
+}
+
+static void
+hsk_resolver_unlink(hsk_resolver_t *resolver, hsk_resolver_job_t *job) {
+  if (job->prev)
+    job->prev->next = job->next;
+  else
+    resolver->lookups = job->next;
+
+  if (job->next)
+    job->next->prev = job->prev;
+
+  job->prev = NULL;
+  job->next = NULL;
+}
+
+static void
+hsk_resolver_resource_free(hsk_resource_t *res) {
+  if (res && !hsk_icann_shared(res))
+    hsk_resource_free(res);
+}
+
+// A resource came from a proof or the cache
+// (NULL for a TLD that does not exist).
+static void
+hsk_resolver_reply(hsk_resolver_job_t *job, const hsk_resource_t *res) {
+  hsk_dns_msg_t *msg;
+
+  if (res)
+    msg = hsk_resource_to_dns(res, job->name, job->type, false);
+  else
+    msg = hsk_resource_to_nx(job->tld);
+
+  if (!msg) {
+    hsk_resolver_answer(job, HSK_ENOMEM, NULL);
+    return;
+  }
+
+  hsk_resolver_answer(job, HSK_SUCCESS, msg);
+  hsk_dns_msg_free(msg);
+}
+
+// Anything under a TLD seen recently needs no
+// proof. Empty resources stand for ICANN TLDs.
+static bool
+hsk_resolver_cached(hsk_resolver_t *resolver, hsk_resolver_job_t *job) {
+  const uint8_t *root = hsk_chain_safe_root(&resolver->pool->chain);
+  hsk_resource_t *res = NULL;
+  uint8_t *data = NULL;
+  size_t data_len = 0;
+
+  if (hsk_cache_has_nx(&resolver->cache, job->tld, root)) {
+    hsk_resolver_reply(job, NULL);
+    return true;
+  }
+
+  if (!hsk_cache_get_ref(&resolver->cache, job->tld, root,
+                         &data, &data_len)) {
+    return false;
+  }
+
+  if (data_len == 0) {
+    if (hsk_icann_lookup(job->tld, &res) != HSK_SUCCESS)
+      res = NULL;
+  } else {
+    if (!hsk_resource_decode_for(data, data_len, job->type, &res))
+      res = NULL;
+    hsk_free(data);
+  }
+
+  if (!res)
+    return false;
+
+  hsk_resolver_reply(job, res);
+  hsk_resolver_resource_free(res);
+
+  return true;
+}
+
+static void
+after_async(uv_async_t *handle) {
+  hsk_resolver_t *resolver = (hsk_resolver_t *)handle->data;
+  hsk_resolver_job_t *job, *next;
+
+  for (job = hsk_resolver_take_jobs(resolver); job; job = next) {
+    next = job->next;
+
+    if (!resolver->running) {
+      hsk_resolver_answer(job, HSK_EFAILURE, NULL);
+      continue;
+    }
+
+    if (hsk_resolver_cached(resolver, job))
+      continue;
+
+    hsk_resolver_link(resolver, job);
+
+    int rc = hsk_pool_resolve(
+      resolver->pool,
+      job->tld,
+      after_resolve,
+      (void *)job
+    );
+
+    if (rc != HSK_SUCCESS) {
+      hsk_resolver_unlink(resolver, job);
+      hsk_resolver_answer(job, rc, NULL);
+    }
+  }
+}
+
+static void
+after_close(uv_handle_t *handle) {}
+
+static void
+after_resolve(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+) {
+  hsk_resolver_job_t *job = (hsk_resolver_job_t *)arg;
+  hsk_resolver_t *resolver = job->resolver;
+  hsk_resource_t *res = NULL;
+
+  // Already failed by a close.
+  if (!resolver) {
+    hsk_free(job);
+    return;
+  }
+
+  hsk_resolver_unlink(resolver, job);
+
+  if (status != HSK_SUCCESS) {
+    hsk_resolver_answer(job, status, NULL);
+    return;
+  }
+
+  const uint8_t *root = hsk_chain_safe_root(&resolver->pool->chain);
+
+  if (!exists || data_len == 0) {
+    if (hsk_icann_lookup(job->tld, &res) != HSK_SUCCESS) {
+      hsk_resolver_answer(job, HSK_EFAILURE, NULL);
+      return;
+    }
+    data_len = 0;
+  } else {
+    if (!hsk_resource_decode_for(data, data_len, job->type, &res)) {
+      hsk_resolver_answer(job, HSK_EENCODING, NULL);
+      return;
+    }
+  }
+
+  if (res) {
+    hsk_cache_insert_ref(&resolver->cache, job->tld, root,
+                         data, data_len, res->ttl);
+    hsk_resolver_reply(job, res);
+    hsk_resolver_resource_free(res);
+    return;
+  }
+
+  // Neither on Handshake nor in the ICANN zone.
+  hsk_dns_msg_t *msg = hsk_resource_to_nx(job->tld);
+
+  if (!msg) {
+    hsk_resolver_answer(job, HSK_ENOMEM, NULL);
+    return;
+  }
+
+  hsk_cache_insert_nx(&resolver->cache, job->tld, root, msg);
+  hsk_resolver_answer(job, HSK_SUCCESS, msg);
+  hsk_dns_msg_free(msg);
+}
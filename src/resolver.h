@@ -0,0 +1,97 @@
+#ifndef _HSK_RESOLVER_H
+#define _HSK_RESOLVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "dns.h"
+#include "pool.h"
+#include "uv.h"
+
+// Answers come back on the resolver's loop. The
+// message is freed once the callback returns
+// (NULL when status is not HSK_SUCCESS).
+typedef void (*hsk_resolver_cb)(
+  const char *name,
+  uint16_t type,
+  int status,
+  const hsk_dns_msg_t *msg,
+  void *arg
+);
+
+typedef struct hsk_resolver_query_s {
+  const char *name;
+  uint16_t type;
+  void *arg;
+} hsk_resolver_query_t;
+
+typedef struct hsk_resolver_job_s {
+  struct hsk_resolver_s *resolver;
+  char name[HSK_DNS_MAX_NAME + 1];
+  char tld[HSK_DNS_MAX_LABEL + 1];
+  uint16_t type;
+  hsk_resolver_cb callback;
+  void *arg;
+  struct hsk_resolver_job_s *prev;
+  struct hsk_resolver_job_s *next;
+} hsk_resolver_job_t;
+
+// Queries may be submitted from any thread.
+// Everything else, the cache included, belongs
+// to the loop the pool runs on.
+typedef struct hsk_resolver_s {
+  uv_loop_t *loop;
+  hsk_pool_t *pool;
+  hsk_cache_t cache;
+  uv_mutex_t lock;
+  uv_async_t async;
+  bool running;
+  hsk_resolver_job_t *head;
+  hsk_resolver_job_t *tail;
+  hsk_resolver_job_t *lookups;
+} hsk_resolver_t;
+
+int
+hsk_resolver_init(
+  hsk_resolver_t *resolver,
+  const uv_loop_t *loop,
+  const hsk_pool_t *pool
+);
+
+void
+hsk_resolver_uninit(hsk_resolver_t *resolver);
+
+hsk_resolver_t *
+hsk_resolver_alloc(const uv_loop_t *loop, const hsk_pool_t *pool);
+
+void
+hsk_resolver_free(hsk_resolver_t *resolver);
+
+bool
+hsk_resolver_set_cache_size(hsk_resolver_t *resolver, size_t max_size);
+
+int
+hsk_resolver_open(hsk_resolver_t *resolver);
+
+int
+hsk_resolver_close(hsk_resolver_t *resolver);
+
+int
+hsk_resolver_resolve(
+  hsk_resolver_t *resolver,
+  const char *name,
+  uint16_t type,
+  hsk_resolver_cb callback,
+  void *arg
+);
+
+int
+hsk_resolver_resolve_many(
+  hsk_resolver_t *resolver,
+  const hsk_resolver_query_t *queries,
+  size_t count,
+  hsk_resolver_cb callback
+);
+#endif
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -13,6 +14,7 @@
 #include "dns.h"
 #include "dnssec.h"
 #include "error.h"
+#include "mem.h"
 #include "resource.h"
 #include "utils.h"
 
@@ -44,9 +46,17 @@ static const uint8_t hsk_type_map_aaaa[] = {
   0x00, 0x06, 0x00, 0x00, 0x00, 0x80, 0x00, 0x03
 };
 
+// RRSIG NSEC
+static const uint8_t hsk_type_map_nsec[] = {
+  0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03
+};
+
 static void
 to_fqdn(char *name);
 
+static void
+hsk_resource_next_name(const char *name, char *out);
+
 static void
 ip_size(const uint8_t *ip, size_t *s, size_t *l);
 
@@ -190,7 +200,19 @@ hsk_resource_target_read(
       return read_bytes(data, data_len, target->onion, 33);
     }
     case HSK_NAME: {
+#ifdef HSK_LOW_MEMORY
+      char name[HSK_DNS_MAX_NAME + 1];
+
+      if (!hsk_dns_name_read(data, data_len, &st->dmp, name))
+        return false;
+
+      hsk_free(target->name);
+      target->name = hsk_strdup(name);
+
+      return target->name != NULL;
+#else
       return hsk_dns_name_read(data, data_len, &st->dmp, target->name);
+#endif
     }
     default: {
       return false;
@@ -573,6 +595,51 @@ hsk_extra_record_read(
   return true;
 }
 
+static void
+hsk_target_init(hsk_target_t *target) {
+  target->type = 0;
+#ifdef HSK_LOW_MEMORY
+  target->name = NULL;
+#else
+  memset(target->name, 0, sizeof(target->name));
+#endif
+  memset(target->inet4, 0, sizeof(target->inet4));
+  memset(target->inet6, 0, sizeof(target->inet6));
+  memset(target->onion, 0, sizeof(target->onion));
+}
+
+// The target a record holds, if any.
+static hsk_target_t *
+hsk_record_target(hsk_record_t *r) {
+  switch (r->type) {
+    case HSK_INET4:
+    case HSK_INET6:
+    case HSK_ONION:
+    case HSK_ONIONNG:
+    case HSK_NAME:
+    case HSK_CANONICAL:
+    case HSK_DELEGATE:
+    case HSK_NS:
+      return &((hsk_host_record_t *)r)->target;
+    case HSK_SERVICE:
+      return &((hsk_service_record_t *)r)->target;
+  }
+
+  return NULL;
+}
+
+static void
+hsk_record_uninit(hsk_record_t *r) {
+#ifdef HSK_LOW_MEMORY
+  hsk_target_t *target = hsk_record_target(r);
+
+  if (target) {
+    hsk_free(target->name);
+    target->name = NULL;
+  }
+#endif
+}
+
 void
 hsk_record_init(hsk_record_t *r) {
   if (r == NULL)
@@ -590,11 +657,7 @@ hsk_record_init(hsk_record_t *r) {
     case HSK_DELEGATE:
     case HSK_NS: {
       hsk_host_record_t *rec = (hsk_host_record_t *)r;
-      rec->target.type = 0;
-      memset(rec->target.name, 0, sizeof(rec->target.name));
-      memset(rec->target.inet4, 0, sizeof(rec->target.inet4));
-      memset(rec->target.inet6, 0, sizeof(rec->target.inet6));
-      memset(rec->target.onion, 0, sizeof(rec->target.onion));
+      hsk_target_init(&rec->target);
       break;
     }
     case HSK_SERVICE: {
@@ -603,11 +666,7 @@ hsk_record_init(hsk_record_t *r) {
       memset(rec->protocol, 0, sizeof(rec->protocol));
       rec->priority = 0;
       rec->weight = 0;
-      rec->target.type = 0;
-      memset(rec->target.name, 0, sizeof(rec->target.name));
-      memset(rec->target.inet4, 0, sizeof(rec->target.inet4));
-      memset(rec->target.inet6, 0, sizeof(rec->target.inet6));
-      memset(rec->target.onion, 0, sizeof(rec->target.onion));
+      hsk_target_init(&rec->target);
       rec->port = 0;
       break;
     }
@@ -714,53 +773,53 @@ hsk_record_alloc(uint8_t type) {
     case HSK_CANONICAL:
     case HSK_DELEGATE:
     case HSK_NS: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_host_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_host_record_t));
       break;
     }
     case HSK_SERVICE: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_service_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_service_record_t));
       break;
     }
     case HSK_URI:
     case HSK_EMAIL:
     case HSK_TEXT: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_txt_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_txt_record_t));
       break;
     }
     case HSK_LOCATION: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_location_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_location_record_t));
       break;
     }
     case HSK_MAGNET: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_magnet_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_magnet_record_t));
       break;
     }
     case HSK_DS: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_ds_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_ds_record_t));
       break;
     }
     case HSK_TLS: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_tls_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_tls_record_t));
       break;
     }
     case HSK_SMIME: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_smime_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_smime_record_t));
       break;
     }
     case HSK_SSH: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_ssh_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_ssh_record_t));
       break;
     }
     case HSK_PGP: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_pgp_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_pgp_record_t));
       break;
     }
     case HSK_ADDR: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_addr_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_addr_record_t));
       break;
     }
     default: {
-      r = (hsk_record_t *)malloc(sizeof(hsk_extra_record_t));
+      r = (hsk_record_t *)hsk_malloc(sizeof(hsk_extra_record_t));
       break;
     }
   }
@@ -782,6 +841,8 @@ hsk_record_free(hsk_record_t *r) {
   if (r == NULL)
     return;
 
+  hsk_record_uninit(r);
+
   switch (r->type) {
     case HSK_INET4:
     case HSK_INET6:
@@ -792,74 +853,84 @@ hsk_record_free(hsk_record_t *r) {
     case HSK_DELEGATE:
     case HSK_NS: {
       hsk_host_record_t *rec = (hsk_host_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_SERVICE: {
       hsk_service_record_t *rec = (hsk_service_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_URI:
     case HSK_EMAIL:
     case HSK_TEXT: {
       hsk_txt_record_t *rec = (hsk_txt_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_LOCATION: {
       hsk_location_record_t *rec = (hsk_location_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_MAGNET: {
       hsk_magnet_record_t *rec = (hsk_magnet_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_DS: {
       hsk_ds_record_t *rec = (hsk_ds_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_TLS: {
       hsk_tls_record_t *rec = (hsk_tls_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_SMIME: {
       hsk_smime_record_t *rec = (hsk_smime_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_SSH: {
       hsk_ssh_record_t *rec = (hsk_ssh_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_PGP: {
       hsk_pgp_record_t *rec = (hsk_pgp_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     case HSK_ADDR: {
       hsk_addr_record_t *rec = (hsk_addr_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
     default: {
       hsk_extra_record_t *rec = (hsk_extra_record_t *)r;
-      free(rec);
+      hsk_free(rec);
       break;
     }
   }
 }
 
+hsk_resource_t *
+hsk_resource_ref(hsk_resource_t *res) {
+  if (res)
+    __atomic_add_fetch(&res->refs, 1, __ATOMIC_RELAXED);
+  return res;
+}
+
 void
 hsk_resource_free(hsk_resource_t *res) {
   if (res == NULL)
     return;
 
+  if (__atomic_sub_fetch(&res->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
   int i;
 
   for (i = 0; i < res->record_count; i++) {
@@ -867,22 +938,21 @@ hsk_resource_free(hsk_resource_t *res) {
     hsk_record_free(rec);
   }
 
-  free(res);
+#ifdef HSK_LOW_MEMORY
+  hsk_free(res->records);
+#endif
+
+  hsk_free(res);
 }
 
-bool
-hsk_record_read(
+static bool
+hsk_record_parse(
   uint8_t **data,
   size_t *data_len,
   uint8_t type,
   const hsk_symbol_table_t *st,
-  hsk_record_t **res
+  hsk_record_t *r
 ) {
-  hsk_record_t *r = hsk_record_alloc(type);
-
-  if (r == NULL)
-    return false;
-
   bool result = true;
 
   switch (type) {
@@ -961,8 +1031,24 @@ hsk_record_read(
     }
   }
 
-  if (!result) {
-    free(r);
+  return result;
+}
+
+bool
+hsk_record_read(
+  uint8_t **data,
+  size_t *data_len,
+  uint8_t type,
+  const hsk_symbol_table_t *st,
+  hsk_record_t **res
+) {
+  hsk_record_t *r = hsk_record_alloc(type);
+
+  if (r == NULL)
+    return false;
+
+  if (!hsk_record_parse(data, data_len, type, st, r)) {
+    hsk_record_free(r);
     return false;
   }
 
@@ -971,10 +1057,104 @@ hsk_record_read(
   return true;
 }
 
-bool
-hsk_resource_decode(
+// Room for any record, to skip one.
+typedef union hsk_record_any_u {
+  hsk_record_t record;
+  hsk_host_record_t host;
+  hsk_service_record_t service;
+  hsk_txt_record_t txt;
+  hsk_location_record_t location;
+  hsk_magnet_record_t magnet;
+  hsk_ds_record_t ds;
+  hsk_tls_record_t tls;
+  hsk_smime_record_t smime;
+  hsk_ssh_record_t ssh;
+  hsk_pgp_record_t pgp;
+  hsk_addr_record_t addr;
+  hsk_extra_record_t extra;
+} hsk_record_any_t;
+
+// Checked just as it would be read, so that a
+// resource decodes (or fails to) the same way
+// whichever of its records are kept.
+static bool
+hsk_record_skip(
+  uint8_t **data,
+  size_t *data_len,
+  uint8_t type,
+  const hsk_symbol_table_t *st
+) {
+  hsk_record_any_t any;
+  hsk_record_t *r = &any.record;
+
+  r->type = type == HSK_NAME ? HSK_CANONICAL : type;
+
+  hsk_record_init(r);
+
+  bool result = hsk_record_parse(data, data_len, type, st, r);
+
+  hsk_record_uninit(r);
+
+  return result;
+}
+
+// Record types hsk_resource_to_dns may look at
+// to answer a query of this type, for any name.
+uint32_t
+hsk_resource_types(uint16_t type) {
+  // Referrals, and the fallbacks for any type.
+  uint32_t types = (1 << HSK_CANONICAL)
+                 | (1 << HSK_DELEGATE)
+                 | (1 << HSK_NS)
+                 | (1 << HSK_DS);
+
+  switch (type) {
+    case HSK_DNS_A:
+      types |= 1 << HSK_INET4;
+      break;
+    case HSK_DNS_AAAA:
+      types |= 1 << HSK_INET6;
+      break;
+    case HSK_DNS_MX:
+    case HSK_DNS_SRV:
+      types |= 1 << HSK_SERVICE;
+      break;
+    case HSK_DNS_TXT:
+      types |= 1 << HSK_TEXT;
+      break;
+    case HSK_DNS_LOC:
+      types |= 1 << HSK_LOCATION;
+      break;
+    case HSK_DNS_SSHFP:
+      types |= 1 << HSK_SSH;
+      break;
+    case HSK_DNS_URI:
+      types |= (1 << HSK_URI) | (1 << HSK_MAGNET) | (1 << HSK_ADDR);
+      break;
+    case HSK_DNS_RP:
+      types |= 1 << HSK_EMAIL;
+      break;
+    case HSK_DNS_TLSA:
+      types |= 1 << HSK_TLS;
+      break;
+    case HSK_DNS_SMIMEA:
+      types |= 1 << HSK_SMIME;
+      break;
+    case HSK_DNS_OPENPGPKEY:
+      types |= 1 << HSK_PGP;
+      break;
+  }
+
+  return types;
+}
+
+// Records not in the set are checked but not
+// kept (a NULL set keeps them all).
+static bool
+hsk_resource_read(
   const uint8_t *data,
   size_t data_len,
+  const uint32_t *types,
   hsk_resource_t **resource
 ) {
   uint8_t *dat = (uint8_t *)data;
@@ -984,7 +1164,7 @@ hsk_resource_decode(
   st.dmp.msg = dat;
   st.dmp.msg_len = data_len;
 
-  hsk_resource_t *res = malloc(sizeof(hsk_resource_t));
+  hsk_resource_t *res = hsk_malloc(sizeof(hsk_resource_t));
 
   if (res == NULL)
     goto fail;
@@ -993,7 +1173,13 @@ hsk_resource_decode(
   res->compat = false;
   res->ttl = 0;
   res->record_count = 0;
+#ifdef HSK_LOW_MEMORY
+  res->record_cap = 0;
+  res->records = NULL;
+#else
   memset(res->records, 0, sizeof(hsk_record_t *));
+#endif
+  res->refs = 1;
 
   if (!read_u8(&dat, &data_len, &res->version))
     goto fail;
@@ -1040,11 +1226,39 @@ hsk_resource_decode(
 
     read_u8(&dat, &data_len, &type);
 
-    if (!hsk_record_read(&dat, &data_len, type, &st, &res->records[i]))
+    uint8_t kind = type == HSK_NAME ? HSK_CANONICAL : type;
+
+    if (types && (kind >= 32 || !((*types >> kind) & 1))) {
+      if (!hsk_record_skip(&dat, &data_len, type, &st))
+        goto fail;
+      continue;
+    }
+
+#ifdef HSK_LOW_MEMORY
+    if (res->record_count == res->record_cap) {
+      size_t cap = res->record_cap ? res->record_cap * 2 : 4;
+
+      if (cap > 255)
+        cap = 255;
+
+      hsk_record_t **records =
+        hsk_realloc(res->records, cap * sizeof(hsk_record_t *));
+
+      if (!records)
+        goto fail;
+
+      res->records = records;
+      res->record_cap = cap;
+    }
+#endif
+
+    hsk_record_t **rec = &res->records[res->record_count];
+
+    if (!hsk_record_read(&dat, &data_len, type, &st, rec))
       goto fail;
-  }
 
-  res->record_count = i;
+    res->record_count += 1;
+  }
 
   *resource = res;
 
@@ -1055,6 +1269,29 @@ fail:
   return false;
 }
 
+bool
+hsk_resource_decode(
+  const uint8_t *data,
+  size_t data_len,
+  hsk_resource_t **resource
+) {
+  return hsk_resource_read(data, data_len, NULL, resource);
+}
+
+// Only what a query of this type needs (see
+// hsk_resource_types). Such a resource answers
+// that type alone.
+bool
+hsk_resource_decode_for(
+  const uint8_t *data,
+  size_t data_len,
+  uint16_t type,
+  hsk_resource_t **resource
+) {
+  uint32_t types = hsk_resource_types(type);
+  return hsk_resource_read(data, data_len, &types, resource);
+}
+
 const hsk_record_t *
 hsk_resource_get(const hsk_resource_t *res, uint8_t type) {
   int i;
@@ -1589,7 +1826,7 @@ hsk_resource_to_ds(
     rd->digest_type = rec->digest_type;
     rd->digest_len = rec->digest_len;
 
-    rd->digest = malloc(rec->digest_len);
+    rd->digest = hsk_malloc(rec->digest_len);
 
     if (!rd->digest) {
       hsk_dns_rr_free(rr);
@@ -1643,7 +1880,7 @@ hsk_resource_to_tlsa(
     rd->matching_type = rec->matching_type;
     rd->certificate_len = rec->certificate_len;
 
-    rd->certificate = malloc(rec->certificate_len);
+    rd->certificate = hsk_malloc(rec->certificate_len);
 
     if (!rd->certificate) {
       hsk_dns_rr_free(rr);
@@ -1693,7 +1930,7 @@ hsk_resource_to_smimea(
     rd->matching_type = rec->matching_type;
     rd->certificate_len = rec->certificate_len;
 
-    rd->certificate = malloc(rec->certificate_len);
+    rd->certificate = hsk_malloc(rec->certificate_len);
 
     if (!rd->certificate) {
       hsk_dns_rr_free(rr);
@@ -1738,7 +1975,7 @@ hsk_resource_to_sshfp(
     rd->digest_type = rec->digest_type;
     rd->fingerprint_len = rec->fingerprint_len;
 
-    rd->fingerprint = malloc(rec->fingerprint_len);
+    rd->fingerprint = hsk_malloc(rec->fingerprint_len);
 
     if (!rd->fingerprint) {
       hsk_dns_rr_free(rr);
@@ -1784,7 +2021,7 @@ hsk_resource_to_openpgpkey(
     hsk_dns_openpgpkey_rd_t *rd = rr->rd;
     rd->pubkey_len = rec->pubkey_len;
 
-    rd->pubkey = malloc(rec->pubkey_len);
+    rd->pubkey = hsk_malloc(rec->pubkey_len);
 
     if (!rd->pubkey) {
       hsk_dns_rr_free(rr);
@@ -1837,7 +2074,7 @@ hsk_resource_to_uri(
   }
 
   char nid[HSK_DNS_MAX_LABEL + 1];
-  char nin[HSK_DNS_MAX_NAME + 1];
+  char nin[64 * 2 + 1];
 
   for (i = 0; i < res->record_count; i++) {
     hsk_record_t *c = res->records[i];
@@ -1984,11 +2221,33 @@ hsk_resource_to_rp(
   return true;
 }
 
+// Either may leave off the final dot.
+static bool
+hsk_resource_in_zone(const char *name, const char *zone) {
+  size_t len = strlen(name);
+  size_t size = strlen(zone);
+
+  if (len > 0 && name[len - 1] == '.')
+    len -= 1;
+
+  if (size > 0 && zone[size - 1] == '.')
+    size -= 1;
+
+  if (len < size || strncasecmp(&name[len - size], zone, size) != 0)
+    return false;
+
+  return len == size || name[len - size - 1] == '.';
+}
+
+// Addresses for the targets of glue records.
+// Given a zone, only those within it (the
+// glue a referral cannot do without).
 static bool
 hsk_resource_to_glue(
   const hsk_resource_t *res,
   hsk_dns_rrs_t *an,
-  uint16_t rrtype
+  uint16_t rrtype,
+  const char *zone
 ) {
   int i;
 
@@ -2056,6 +2315,9 @@ hsk_resource_to_glue(
     if (target->type != HSK_GLUE)
       continue;
 
+    if (zone && !hsk_resource_in_zone(target->name, zone))
+      continue;
+
     if (memcmp(target->inet4, hsk_zero_inet4, 4) != 0) {
       hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_A);
 
@@ -2248,12 +2510,12 @@ hsk_resource_to_empty(
 
   hsk_dns_nsec_rd_t *rd = rr->rd;
 
-  strcpy(rd->next_domain, ".");
+  hsk_resource_next_name(rr->name, rd->next_domain);
   rd->type_map = NULL;
   rd->type_map_len = 0;
 
   if (type_map) {
-    uint8_t *buf = malloc(type_map_len);
+    uint8_t *buf = hsk_malloc(type_map_len);
 
     if (!buf) {
       hsk_dns_rr_free(rr);
@@ -2271,6 +2533,126 @@ hsk_resource_to_empty(
   return true;
 }
 
+// Covering NSECs (RFC 4034, section 6.1) are
+// kept as narrow as we can make them without
+// knowing the neighbouring names: a validator
+// doing aggressive negative caching (RFC 8198)
+// may deny anything in between. Only bytes no
+// Handshake name can contain sort between a
+// name and its neighbours here. Names keep a
+// literal dot as 0xfe (see hsk_dns_name_parse).
+static char
+hsk_resource_byte(int c) {
+  if (c == 0x2e)
+    return (char)0xfe;
+  return (char)c;
+}
+
+// Follows `name` and its subdomains: the first
+// label with `!` appended (or, when that is too
+// long, its last byte incremented).
+static void
+hsk_resource_after_label(const char *name, char *out) {
+  const char *dot = strchr(name, '.');
+  size_t len = dot - name;
+  size_t size = strlen(name);
+
+  if (len < HSK_DNS_MAX_LABEL && size + 1 <= HSK_DNS_MAX_NAME) {
+    memcpy(out, name, len);
+    out[len] = '!';
+    strcpy(&out[len + 1], dot);
+    return;
+  }
+
+  strcpy(out, name);
+  out[len - 1] = hsk_resource_byte((uint8_t)name[len - 1] + 1);
+}
+
+// Precedes `name`: the first label's last byte
+// decremented, then `~` (which sorts after
+// every byte a valid label holds).
+static void
+hsk_resource_before_label(const char *name, char *out) {
+  const char *dot = strchr(name, '.');
+  size_t len = dot - name;
+  size_t size = strlen(name);
+
+  memcpy(out, name, len);
+  out[len - 1] = hsk_resource_byte((uint8_t)name[len - 1] - 1);
+
+  if (len < HSK_DNS_MAX_LABEL && size + 1 <= HSK_DNS_MAX_NAME)
+    out[len++] = '~';
+
+  strcpy(&out[len], dot);
+}
+
+// The next name after `name` itself (but before
+// its subdomains): `!.` prepended.
+static void
+hsk_resource_next_name(const char *name, char *out) {
+  size_t size = strlen(name);
+
+  if (strcmp(name, ".") == 0) {
+    strcpy(out, "!.");
+    return;
+  }
+
+  if (size + 2 <= HSK_DNS_MAX_NAME) {
+    sprintf(out, "!.%s", name);
+    return;
+  }
+
+  // No room: anything between is too long.
+  hsk_resource_after_label(name, out);
+}
+
+// An NSEC from `owner` to `next`, signed on
+// its own (signatures cover one owner name).
+static bool
+hsk_resource_to_cover(
+  const char *owner,
+  const char *next,
+  hsk_dns_rrs_t *ns
+) {
+  hsk_dns_rrs_t rrs;
+  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_NSEC);
+
+  if (!rr)
+    return false;
+
+  uint8_t *bitmap = hsk_malloc(sizeof(hsk_type_map_nsec));
+
+  if (!bitmap) {
+    hsk_dns_rr_free(rr);
+    return false;
+  }
+
+  memcpy(bitmap, &hsk_type_map_nsec[0], sizeof(hsk_type_map_nsec));
+
+  rr->ttl = 86400;
+
+  strcpy(rr->name, owner);
+
+  hsk_dns_nsec_rd_t *rd = rr->rd;
+
+  strcpy(rd->next_domain, next);
+  rd->type_map = bitmap;
+  rd->type_map_len = sizeof(hsk_type_map_nsec);
+
+  hsk_dns_rrs_init(&rrs);
+  hsk_dns_rrs_push(&rrs, rr);
+  hsk_dnssec_sign_zsk(&rrs, HSK_DNS_NSEC);
+
+  for (int i = 0; i < rrs.size; i++)
+    hsk_dns_rrs_push(ns, rrs.items[i]);
+
+  // The records moved to `ns`.
+  rrs.size = 0;
+  hsk_dns_rrs_uninit(&rrs);
+
+  return true;
+}
+
 static bool
 hsk_resource_root_to_nsec(hsk_dns_rrs_t *an) {
   hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_NSEC);
@@ -2278,7 +2660,7 @@ hsk_resource_root_to_nsec(hsk_dns_rrs_t *an) {
   if (!rr)
     return false;
 
-  uint8_t *bitmap = malloc(sizeof(hsk_type_map));
+  uint8_t *bitmap = hsk_malloc(sizeof(hsk_type_map));
 
   if (!bitmap) {
     hsk_dns_rr_free(rr);
@@ -2293,7 +2675,7 @@ hsk_resource_root_to_nsec(hsk_dns_rrs_t *an) {
 
   hsk_dns_nsec_rd_t *rd = rr->rd;
 
-  strcpy(rd->next_domain, ".");
+  hsk_resource_next_name(".", rd->next_domain);
   rd->type_map = bitmap;
   rd->type_map_len = sizeof(hsk_type_map);
 
@@ -2302,13 +2684,21 @@ hsk_resource_root_to_nsec(hsk_dns_rrs_t *an) {
   return true;
 }
 
-hsk_dns_msg_t *
-hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
-  assert(hsk_dns_name_is_fqdn(name));
-
-  int labels = hsk_dns_label_count(name);
+// A synthesized pointer (see target_to_dns)
+// answers for the address in its label alone:
+// A or AAAA as it encodes, or a signed denial
+// of the other types.
+static hsk_dns_msg_t *
+hsk_resource__ptr_to_dns(
+  const char *name,
+  uint16_t type,
+  uint32_t ttl,
+  hsk_dns_signer_t *signer
+) {
+  uint8_t ip[16];
+  uint16_t family;
 
-  if (labels == 0)
+  if (!pointer_to_ip(name, ip, &family))
     return NULL;
 
   hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
@@ -2318,85 +2708,109 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
 
   hsk_dns_rrs_t *an = &msg->an;
   hsk_dns_rrs_t *ns = &msg->ns;
-  hsk_dns_rrs_t *ar = &msg->ar;
+  bool match = false;
 
-  // Handle reverse pointers.
-  if (labels == 2) {
-    uint8_t ip[16];
-    uint16_t family;
-
-    if (pointer_to_ip(name, ip, &family)) {
-      bool match = false;
-
-      switch (type) {
-        case HSK_DNS_ANY:
-          match = true;
-          break;
-        case HSK_DNS_A:
-          match = family == HSK_INET4;
-          break;
-        case HSK_DNS_AAAA:
-          match = family == HSK_INET6;
-          break;
-      }
+  switch (type) {
+    case HSK_DNS_ANY:
+      match = true;
+      break;
+    case HSK_DNS_A:
+      match = family == HSK_INET4;
+      break;
+    case HSK_DNS_AAAA:
+      match = family == HSK_INET6;
+      break;
+  }
 
-      if (!match) {
-        // Needs SOA.
-        // TODO: Make the reverse pointers TLDs.
-        // Empty proof:
-        if (family == HSK_INET4) {
-          hsk_resource_to_empty(
-            name,
-            hsk_type_map_a,
-            sizeof(hsk_type_map_a),
-            ns
-          );
-        } else {
-          hsk_resource_to_empty(
-            name,
-            hsk_type_map_aaaa,
-            sizeof(hsk_type_map_aaaa),
-            ns
-          );
-        }
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_NSEC);
-        hsk_resource_root_to_soa(ns);
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_SOA);
-        return msg;
-      }
+  if (!match) {
+    // Needs SOA.
+    // TODO: Make the reverse pointers TLDs.
+    // Empty proof:
+    if (family == HSK_INET4) {
+      hsk_resource_to_empty(
+        name,
+        hsk_type_map_a,
+        sizeof(hsk_type_map_a),
+        ns
+      );
+    } else {
+      hsk_resource_to_empty(
+        name,
+        hsk_type_map_aaaa,
+        sizeof(hsk_type_map_aaaa),
+        ns
+      );
+    }
+    hsk_dns_signer_add(signer, ns, HSK_DNS_NSEC);
+    hsk_resource_root_to_soa(ns);
+    hsk_dns_signer_add(signer, ns, HSK_DNS_SOA);
+    return msg;
+  }
 
-      uint16_t rrtype = HSK_DNS_A;
+  uint16_t rrtype = HSK_DNS_A;
 
-      if (family == HSK_INET6)
-        rrtype = HSK_DNS_AAAA;
+  if (family == HSK_INET6)
+    rrtype = HSK_DNS_AAAA;
 
-      msg->flags |= HSK_DNS_AA;
+  msg->flags |= HSK_DNS_AA;
 
-      hsk_dns_rr_t *rr = hsk_dns_rr_create(rrtype);
+  hsk_dns_rr_t *rr = hsk_dns_rr_create(rrtype);
 
-      if (!rr) {
-        hsk_dns_msg_free(msg);
-        return NULL;
-      }
+  if (!rr) {
+    hsk_dns_msg_free(msg);
+    return NULL;
+  }
 
-      rr->ttl = rs->ttl;
-      hsk_dns_rr_set_name(rr, name);
+  rr->ttl = ttl;
+  hsk_dns_rr_set_name(rr, name);
 
-      if (family == HSK_INET4) {
-        hsk_dns_a_rd_t *rd = rr->rd;
-        memcpy(&rd->addr[0], &ip[0], 4);
-      } else {
-        hsk_dns_aaaa_rd_t *rd = rr->rd;
-        memcpy(&rd->addr[0], &ip[0], 16);
-      }
+  if (family == HSK_INET4) {
+    hsk_dns_a_rd_t *rd = rr->rd;
+    memcpy(&rd->addr[0], &ip[0], 4);
+  } else {
+    hsk_dns_aaaa_rd_t *rd = rr->rd;
+    memcpy(&rd->addr[0], &ip[0], 16);
+  }
 
-      hsk_dns_rrs_push(an, rr);
+  hsk_dns_rrs_push(an, rr);
 
-      hsk_dnssec_sign_zsk(ar, rrtype);
+  hsk_dns_signer_add(signer, an, rrtype);
 
-      return msg;
-    }
-  }
+  return msg;
+}
+
+// Minimal responses leave out (and do not sign)
+// additional data the answer does not need:
+// addresses for CNAME, DNAME, MX and SRV
+// targets, and glue from outside the zone
+// being referred to.
+static hsk_dns_msg_t *
+hsk_resource__to_dns(
+  const hsk_resource_t *rs,
+  const char *name,
+  uint16_t type,
+  bool minimal,
+  hsk_dns_signer_t *signer
+) {
+  assert(hsk_dns_name_is_fqdn(name));
+
+  int labels = hsk_dns_label_count(name);
+
+  if (labels == 0)
+    return NULL;
+
+  // Handle reverse pointers.
+  if (labels == 2 && pointer_to_ip(name, NULL, NULL))
+    return hsk_resource__ptr_to_dns(name, type, rs->ttl, signer);
+
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+
+  if (!msg)
+    return NULL;
+
+  hsk_dns_rrs_t *an = &msg->an;
+  hsk_dns_rrs_t *ns = &msg->ns;
+  hsk_dns_rrs_t *ar = &msg->ar;
 
   // Handle SRV, TLSA, and SMIMEA.
   if (labels == 3) {
@@ -2410,9 +2824,11 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
           to_fqdn(protocol);
           to_fqdn(service);
           hsk_resource_to_srv(rs, name, protocol, service, an);
-          hsk_resource_to_srvip(rs, name, protocol, service, ar);
-          hsk_resource_to_glue(rs, ar, HSK_DNS_SRV);
-          hsk_dnssec_sign_zsk(an, HSK_DNS_SRV);
+          if (!minimal) {
+            hsk_resource_to_srvip(rs, name, protocol, service, ar);
+            hsk_resource_to_glue(rs, ar, HSK_DNS_SRV, NULL);
+          }
+          hsk_dns_signer_add(signer, an, HSK_DNS_SRV);
         }
 
         break;
@@ -2425,7 +2841,7 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
         if (is_tlsa) {
           to_fqdn(protocol);
           hsk_resource_to_tlsa(rs, name, protocol, port, an);
-          hsk_dnssec_sign_zsk(an, HSK_DNS_TLSA);
+          hsk_dns_signer_add(signer, an, HSK_DNS_TLSA);
         }
 
         break;
@@ -2436,7 +2852,7 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
 
         if (is_smimea) {
           hsk_resource_to_smimea(rs, name, hash, an);
-          hsk_dnssec_sign_zsk(an, HSK_DNS_SMIMEA);
+          hsk_dns_signer_add(signer, an, HSK_DNS_SMIMEA);
         }
 
         break;
@@ -2447,7 +2863,7 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
 
         if (is_openpgpkey) {
           hsk_resource_to_openpgpkey(rs, name, hash, an);
-          hsk_dnssec_sign_zsk(an, HSK_DNS_OPENPGPKEY);
+          hsk_dns_signer_add(signer, an, HSK_DNS_OPENPGPKEY);
         }
 
         break;
@@ -2470,24 +2886,26 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
       hsk_resource_to_ns(rs, tld, ns);
       hsk_resource_to_ds(rs, tld, ns);
       hsk_resource_to_nsip(rs, tld, ar);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_NS);
+      hsk_resource_to_glue(rs, ar, HSK_DNS_NS, minimal ? tld : NULL);
       if (!hsk_resource_has(rs, HSK_DS))
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_NS);
+        hsk_dns_signer_add(signer, ns, HSK_DNS_NS);
       else
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_DS);
+        hsk_dns_signer_add(signer, ns, HSK_DNS_DS);
     } else if (hsk_resource_has(rs, HSK_DELEGATE)) {
       hsk_resource_to_dname(rs, name, an);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_DNAME);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_DNAME);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_A);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_AAAA);
+      hsk_dns_signer_add(signer, an, HSK_DNS_DNAME);
+      if (!minimal) {
+        hsk_resource_to_glue(rs, ar, HSK_DNS_DNAME, NULL);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_A);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_AAAA);
+      }
     } else {
       // Needs SOA.
       // Empty proof:
       hsk_resource_to_empty(tld, NULL, 0, ns);
-      hsk_dnssec_sign_zsk(ns, HSK_DNS_NSEC);
+      hsk_dns_signer_add(signer, ns, HSK_DNS_NSEC);
       hsk_resource_root_to_soa(ns);
-      hsk_dnssec_sign_zsk(ns, HSK_DNS_SOA);
+      hsk_dns_signer_add(signer, ns, HSK_DNS_SOA);
     }
 
     return msg;
@@ -2496,61 +2914,67 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
   switch (type) {
     case HSK_DNS_A:
       hsk_resource_to_a(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_A);
+      hsk_dns_signer_add(signer, an, HSK_DNS_A);
       break;
     case HSK_DNS_AAAA:
       hsk_resource_to_aaaa(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_AAAA);
+      hsk_dns_signer_add(signer, an, HSK_DNS_AAAA);
       break;
     case HSK_DNS_CNAME:
       hsk_resource_to_cname(rs, name, an);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_CNAME);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_CNAME);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_A);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_AAAA);
+      hsk_dns_signer_add(signer, an, HSK_DNS_CNAME);
+      if (!minimal) {
+        hsk_resource_to_glue(rs, ar, HSK_DNS_CNAME, NULL);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_A);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_AAAA);
+      }
       break;
     case HSK_DNS_DNAME:
       hsk_resource_to_dname(rs, name, an);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_DNAME);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_DNAME);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_A);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_AAAA);
+      hsk_dns_signer_add(signer, an, HSK_DNS_DNAME);
+      if (!minimal) {
+        hsk_resource_to_glue(rs, ar, HSK_DNS_DNAME, NULL);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_A);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_AAAA);
+      }
       break;
     case HSK_DNS_NS:
       hsk_resource_to_ns(rs, name, ns);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_NS);
+      hsk_resource_to_glue(rs, ar, HSK_DNS_NS, minimal ? name : NULL);
       hsk_resource_to_nsip(rs, name, ar);
-      hsk_dnssec_sign_zsk(ns, HSK_DNS_NS);
+      hsk_dns_signer_add(signer, ns, HSK_DNS_NS);
       break;
     case HSK_DNS_MX:
       hsk_resource_to_mx(rs, name, an);
-      hsk_resource_to_mxip(rs, name, ar);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_MX);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_MX);
+      if (!minimal) {
+        hsk_resource_to_mxip(rs, name, ar);
+        hsk_resource_to_glue(rs, ar, HSK_DNS_MX, NULL);
+      }
+      hsk_dns_signer_add(signer, an, HSK_DNS_MX);
       break;
     case HSK_DNS_TXT:
       hsk_resource_to_txt(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_TXT);
+      hsk_dns_signer_add(signer, an, HSK_DNS_TXT);
       break;
     case HSK_DNS_LOC:
       hsk_resource_to_loc(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_LOC);
+      hsk_dns_signer_add(signer, an, HSK_DNS_LOC);
       break;
     case HSK_DNS_DS:
       hsk_resource_to_ds(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_DS);
+      hsk_dns_signer_add(signer, an, HSK_DNS_DS);
       break;
     case HSK_DNS_SSHFP:
       hsk_resource_to_sshfp(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_SSHFP);
+      hsk_dns_signer_add(signer, an, HSK_DNS_SSHFP);
       break;
     case HSK_DNS_URI:
       hsk_resource_to_uri(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_URI);
+      hsk_dns_signer_add(signer, an, HSK_DNS_URI);
       break;
     case HSK_DNS_RP:
       hsk_resource_to_rp(rs, name, an);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_RP);
+      hsk_dns_signer_add(signer, an, HSK_DNS_RP);
       break;
   }
 
@@ -2561,29 +2985,175 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
     if (hsk_resource_has(rs, HSK_CANONICAL)) {
       msg->flags |= HSK_DNS_AA;
       hsk_resource_to_cname(rs, name, an);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_CNAME);
-      hsk_dnssec_sign_zsk(an, HSK_DNS_CNAME);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_A);
-      hsk_dnssec_sign_zsk(ar, HSK_DNS_AAAA);
+      hsk_dns_signer_add(signer, an, HSK_DNS_CNAME);
+      if (!minimal) {
+        hsk_resource_to_glue(rs, ar, HSK_DNS_CNAME, NULL);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_A);
+        hsk_dns_signer_add(signer, ar, HSK_DNS_AAAA);
+      }
     } else if (hsk_resource_has(rs, HSK_NS)) {
       hsk_resource_to_ns(rs, name, ns);
       hsk_resource_to_ds(rs, name, ns);
       hsk_resource_to_nsip(rs, name, ar);
-      hsk_resource_to_glue(rs, ar, HSK_DNS_NS);
+      hsk_resource_to_glue(rs, ar, HSK_DNS_NS, minimal ? name : NULL);
       if (!hsk_resource_has(rs, HSK_DS))
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_NS);
+        hsk_dns_signer_add(signer, ns, HSK_DNS_NS);
       else
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_DS);
+        hsk_dns_signer_add(signer, ns, HSK_DNS_DS);
     } else {
       // Needs SOA.
       // Empty proof:
       hsk_resource_to_empty(name, NULL, 0, ns);
-      hsk_dnssec_sign_zsk(ns, HSK_DNS_NSEC);
+      hsk_dns_signer_add(signer, ns, HSK_DNS_NSEC);
       hsk_resource_root_to_soa(ns);
-      hsk_dnssec_sign_zsk(ns, HSK_DNS_SOA);
+      hsk_dns_signer_add(signer, ns, HSK_DNS_SOA);
+    }
+  }
+
+  return msg;
+}
+
+hsk_dns_msg_t *
+hsk_resource_to_dns(
+  const hsk_resource_t *rs,
+  const char *name,
+  uint16_t type,
+  bool minimal
+) {
+  hsk_dns_signer_t signer;
+
+  // The response's RRSIGs are signed together,
+  // once it is built.
+  hsk_dnssec_signer_zsk(&signer);
+
+  hsk_dns_msg_t *msg = hsk_resource__to_dns(rs, name, type, minimal, &signer);
+
+  if (msg)
+    hsk_dns_signer_finish(&signer);
+
+  return msg;
+}
+
+// Without the TLD's resource: NULL unless the
+// name is a synthesized pointer.
+hsk_dns_msg_t *
+hsk_resource_ptr_to_dns(const char *name, uint16_t type, uint32_t ttl) {
+  assert(hsk_dns_name_is_fqdn(name));
+
+  if (hsk_dns_label_count(name) != 2)
+    return NULL;
+
+  hsk_dns_signer_t signer;
+
+  hsk_dnssec_signer_zsk(&signer);
+
+  hsk_dns_msg_t *msg = hsk_resource__ptr_to_dns(name, type, ttl, &signer);
+
+  if (msg)
+    hsk_dns_signer_finish(&signer);
+
+  return msg;
+}
+
+// The type of the first record a query for the
+// name itself answers.
+static uint16_t
+hsk_resource_any_type(const hsk_resource_t *rs) {
+  int i;
+
+  for (i = 0; i < rs->record_count; i++) {
+    switch (rs->records[i]->type) {
+      case HSK_INET4:
+        return HSK_DNS_A;
+      case HSK_INET6:
+        return HSK_DNS_AAAA;
+      case HSK_CANONICAL:
+        return HSK_DNS_CNAME;
+      case HSK_TEXT:
+        return HSK_DNS_TXT;
+      case HSK_LOCATION:
+        return HSK_DNS_LOC;
+      case HSK_SSH:
+        return HSK_DNS_SSHFP;
+      case HSK_URI:
+        return HSK_DNS_URI;
+      case HSK_EMAIL:
+        return HSK_DNS_RP;
     }
   }
 
+  return HSK_DNS_ANY;
+}
+
+// HINFO "RFC8482" "".
+static bool
+hsk_resource_to_hinfo(const char *name, uint32_t ttl, hsk_dns_rrs_t *an) {
+  static const uint8_t hinfo[9] = "\x07RFC8482\x00";
+
+  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_HINFO);
+
+  if (!rr)
+    return false;
+
+  hsk_dns_unknown_rd_t *rd = rr->rd;
+
+  rd->rd = hsk_malloc(sizeof(hinfo));
+
+  if (!rd->rd) {
+    hsk_dns_rr_free(rr);
+    return false;
+  }
+
+  memcpy(rd->rd, hinfo, sizeof(hinfo));
+  rd->rd_len = sizeof(hinfo);
+
+  hsk_dns_rr_set_name(rr, name);
+  rr->ttl = ttl;
+
+  hsk_dns_rrs_push(an, rr);
+
+  return true;
+}
+
+// ANY, as RFC 8482 has it: one RRset of the
+// name (or, with `hinfo`, a made-up HINFO
+// record) rather than all of them. Names
+// below the TLD and delegated TLDs get what
+// any other type would.
+hsk_dns_msg_t *
+hsk_resource_to_any(
+  const hsk_resource_t *rs,
+  const char *name,
+  bool hinfo,
+  bool minimal
+) {
+  assert(hsk_dns_name_is_fqdn(name));
+
+  if (hsk_dns_label_count(name) != 1
+      || hsk_resource_has(rs, HSK_NS)
+      || hsk_resource_has(rs, HSK_DELEGATE)) {
+    return hsk_resource_to_dns(rs, name, HSK_DNS_ANY, minimal);
+  }
+
+  if (!hinfo) {
+    uint16_t type = hsk_resource_any_type(rs);
+    return hsk_resource_to_dns(rs, name, type, minimal);
+  }
+
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+
+  if (!msg)
+    return NULL;
+
+  msg->flags |= HSK_DNS_AA;
+
+  if (!hsk_resource_to_hinfo(name, rs->ttl, &msg->an)) {
+    hsk_dns_msg_free(msg);
+    return NULL;
+  }
+
+  hsk_dnssec_sign_zsk(&msg->an, HSK_DNS_HINFO);
+
   return msg;
 }
 
@@ -2656,8 +3226,22 @@ hsk_resource_root(uint16_t type, const hsk_addr_t *addr) {
   return msg;
 }
 
+// Denies a TLD and everything under it.
 hsk_dns_msg_t *
-hsk_resource_to_nx(void) {
+hsk_resource_to_nx(const char *tld) {
+  assert(tld);
+
+  char name[HSK_DNS_MAX_NAME + 1];
+  char owner[HSK_DNS_MAX_NAME + 1];
+  char next[HSK_DNS_MAX_NAME + 1];
+  size_t len = strlen(tld);
+
+  if (len == 0 || len > HSK_DNS_MAX_LABEL || strchr(tld, '.'))
+    return NULL;
+
+  sprintf(name, "%s.", tld);
+  hsk_to_lower(name);
+
   hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
 
   if (!msg)
@@ -2669,13 +3253,15 @@ hsk_resource_to_nx(void) {
   hsk_dns_rrs_t *ns = &msg->ns;
 
   // NX Proof:
-  // Just make it look like an
-  // empty zone for the NX proof.
-  // It seems to fool unbound without
-  // breaking anything.
-  hsk_resource_root_to_nsec(ns);
-  hsk_resource_root_to_nsec(ns);
-  hsk_dnssec_sign_zsk(ns, HSK_DNS_NSEC);
+  // We cannot iterate over the tree to find
+  // the real neighbours, so the names around
+  // the TLD are made up: one NSEC covers it
+  // (and its subdomains), another the root
+  // wildcard.
+  hsk_resource_before_label(name, owner);
+  hsk_resource_after_label(name, next);
+  hsk_resource_to_cover(owner, next, ns);
+  hsk_resource_to_cover("!.", "+.", ns);
 
   hsk_resource_root_to_soa(ns);
   hsk_dnssec_sign_zsk(ns, HSK_DNS_SOA);
@@ -34,9 +34,15 @@ typedef struct hsk_record_s {
   uint8_t type;
 } hsk_record_t;
 
+// Low-memory builds keep the name (set for
+// HSK_NAME and HSK_GLUE) on the heap.
 typedef struct hsk_target_s {
   uint8_t type;
+#ifdef HSK_LOW_MEMORY
+  char *name;
+#else
   char name[256];
+#endif
   uint8_t inet4[4];
   uint8_t inet6[16];
   uint8_t onion[33];
@@ -164,15 +170,27 @@ typedef struct hsk_symbol_table_s {
   hsk_dns_dmp_t dmp;
 } hsk_symbol_table_t;
 
-// Resource
+// Resource. Reference counted: a decoded
+// resource may be shared by several replies
+// (each free drops one reference). Up to 255
+// records; low-memory builds grow the list.
 typedef struct hsk_resource_s {
   uint8_t version;
   bool compat;
   uint32_t ttl;
   size_t record_count;
+#ifdef HSK_LOW_MEMORY
+  size_t record_cap;
+  hsk_record_t **records;
+#else
   hsk_record_t *records[255];
+#endif
+  int refs;
 } hsk_resource_t;
 
+hsk_resource_t *
+hsk_resource_ref(hsk_resource_t *res);
+
 void
 hsk_resource_free(hsk_resource_t *res);
 
@@ -183,6 +201,17 @@ hsk_resource_decode(
   hsk_resource_t **res
 );
 
+uint32_t
+hsk_resource_types(uint16_t type);
+
+bool
+hsk_resource_decode_for(
+  const uint8_t *data,
+  size_t data_len,
+  uint16_t type,
+  hsk_resource_t **res
+);
+
 const hsk_record_t *
 hsk_resource_get(const hsk_resource_t *res, uint8_t type);
 
@@ -190,13 +219,29 @@ bool
 hsk_resource_has(const hsk_resource_t *res, uint8_t type);
 
 hsk_dns_msg_t *
-hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type);
+hsk_resource_to_dns(
+  const hsk_resource_t *rs,
+  const char *name,
+  uint16_t type,
+  bool minimal
+);
+
+hsk_dns_msg_t *
+hsk_resource_ptr_to_dns(const char *name, uint16_t type, uint32_t ttl);
+
+hsk_dns_msg_t *
+hsk_resource_to_any(
+  const hsk_resource_t *rs,
+  const char *name,
+  bool hinfo,
+  bool minimal
+);
 
 hsk_dns_msg_t *
 hsk_resource_root(uint16_t type, const hsk_addr_t *addr);
 
 hsk_dns_msg_t *
-hsk_resource_to_nx(void);
+hsk_resource_to_nx(const char *tld);
 
 hsk_dns_msg_t *
 hsk_resource_to_servfail(void);
@@ -0,0 +1,210 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+#include "mem.h"
+#include "random.h"
+#include "req.h"
+#include "rrl.h"
+#include "siphash.h"
+
+/*
+ * RRL
+ */
+
+void
+hsk_rrl_init(hsk_rrl_t *rrl) {
+  assert(rrl);
+  rrl->rate = 0;
+  memset(rrl->key, 0, sizeof(rrl->key));
+  rrl->buckets = NULL;
+}
+
+void
+hsk_rrl_uninit(hsk_rrl_t *rrl) {
+  assert(rrl);
+
+  if (rrl->buckets) {
+    hsk_free(rrl->buckets);
+    rrl->buckets = NULL;
+  }
+
+  rrl->rate = 0;
+}
+
+// Zero turns limiting off.
+bool
+hsk_rrl_set_rate(hsk_rrl_t *rrl, uint32_t rate) {
+  assert(rrl);
+
+  if (rate == 0) {
+    hsk_rrl_uninit(rrl);
+    return true;
+  }
+
+  if (!rrl->buckets) {
+    rrl->buckets = hsk_calloc(HSK_RRL_SIZE, sizeof(hsk_rrl_bucket_t));
+
+    if (!rrl->buckets)
+      return false;
+
+    if (!hsk_randombytes(rrl->key, sizeof(rrl->key))) {
+      hsk_rrl_uninit(rrl);
+      return false;
+    }
+  }
+
+  rrl->rate = rate;
+
+  return true;
+}
+
+// Each of `loops` loops reading one SO_REUSEPORT
+// port keeps its own table, and the kernel
+// spreads a prefix's queries across them by
+// source port. Giving each an even share keeps
+// the total close to `rate`: a prefix whose
+// queries all hash to one loop gets less.
+uint32_t
+hsk_rrl_share(uint32_t rate, int loops) {
+  if (rate == 0 || loops <= 1)
+    return rate;
+
+  return (uint32_t)(((uint64_t)rate + loops - 1) / loops);
+}
+
+static bool
+hsk_rrl_prefix(const struct sockaddr *addr, uint8_t *prefix) {
+  memset(prefix, 0, 16);
+
+  if (addr->sa_family == AF_INET) {
+    const struct sockaddr_in *sai = (const struct sockaddr_in *)addr;
+    const uint8_t *ip = (const uint8_t *)&sai->sin_addr;
+
+    // As a v4-mapped address.
+    prefix[10] = 0xff;
+    prefix[11] = 0xff;
+    memcpy(&prefix[12], ip, HSK_RRL_IPV4_PREFIX / 8);
+
+    return true;
+  }
+
+  if (addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *sai = (const struct sockaddr_in6 *)addr;
+    const uint8_t *ip = (const uint8_t *)&sai->sin6_addr;
+
+    memcpy(prefix, ip, HSK_RRL_IPV6_PREFIX / 8);
+
+    return true;
+  }
+
+  return false;
+}
+
+// Tokens are kept in thousandths of a query,
+// and time in milliseconds.
+static void
+hsk_rrl_refill(const hsk_rrl_t *rrl, hsk_rrl_bucket_t *b, uint64_t now) {
+  uint64_t burst = (uint64_t)rrl->rate * 1000;
+
+  if (now > b->time) {
+    b->tokens += (now - b->time) * rrl->rate;
+
+    if (b->tokens > burst)
+      b->tokens = burst;
+
+    b->time = now;
+  }
+}
+
+// The bucket for `prefix`, or one to take over
+// for it: a free one, or else the least recently
+// used. A prefix taking a bucket over gets what
+// was left in it, so alternating with prefixes
+// in the same set never refills the bucket.
+static hsk_rrl_bucket_t *
+hsk_rrl_bucket(hsk_rrl_t *rrl, const uint8_t *prefix, uint64_t now) {
+  uint64_t hash = hsk_siphash(prefix, 16, rrl->key);
+  hsk_rrl_bucket_t *set = &rrl->buckets[(hash % HSK_RRL_SETS) * HSK_RRL_WAYS];
+  hsk_rrl_bucket_t *victim = NULL;
+  int i;
+
+  for (i = 0; i < HSK_RRL_WAYS; i++) {
+    hsk_rrl_bucket_t *b = &set[i];
+
+    if (b->used && memcmp(b->prefix, prefix, 16) == 0) {
+      hsk_rrl_refill(rrl, b, now);
+      return b;
+    }
+
+    if (!victim || (victim->used && (!b->used || b->time < victim->time)))
+      victim = b;
+  }
+
+  if (victim->used) {
+    hsk_rrl_refill(rrl, victim, now);
+  } else {
+    victim->used = true;
+    victim->tokens = (uint64_t)rrl->rate * 1000;
+  }
+
+  memcpy(victim->prefix, prefix, 16);
+  victim->time = now;
+  victim->limited = 0;
+
+  return victim;
+}
+
+int
+hsk_rrl_check(hsk_rrl_t *rrl, const struct sockaddr *addr, uint64_t now) {
+  assert(rrl && addr);
+
+  if (rrl->rate == 0)
+    return HSK_RRL_PASS;
+
+  uint8_t prefix[16];
+
+  if (!hsk_rrl_prefix(addr, prefix))
+    return HSK_RRL_PASS;
+
+  hsk_rrl_bucket_t *b = hsk_rrl_bucket(rrl, prefix, now);
+
+  if (b->tokens >= 1000) {
+    b->tokens -= 1000;
+    return HSK_RRL_PASS;
+  }
+
+  b->limited += 1;
+
+  if (b->limited % HSK_RRL_SLIP == 0)
+    return HSK_RRL_TRUNCATE;
+
+  return HSK_RRL_DROP;
+}
+
+// An empty, unsigned reply with TC set.
+bool
+hsk_rrl_truncated(const hsk_dns_req_t *req, uint8_t **wire, size_t *wire_len) {
+  assert(req && wire && wire_len);
+
+  if (!hsk_dns_wire_empty(req, HSK_DNS_TC, HSK_DNS_NOERROR, wire, wire_len))
+    return false;
+
+  // A client with cookies can come back with
+  // ours and skip the limit.
+  if (!hsk_dns_wire_cookie(req, wire, wire_len)) {
+    hsk_free(*wire);
+    *wire = NULL;
+    *wire_len = 0;
+    return false;
+  }
+
+  return true;
+}
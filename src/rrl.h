@@ -0,0 +1,81 @@
+#ifndef _HSK_RRL_H
+#define _HSK_RRL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "req.h"
+
+/*
+ * Defs
+ */
+
+// Sources are limited by prefix: spoofed floods
+// rarely come from a single address.
+#define HSK_RRL_IPV4_PREFIX 24
+#define HSK_RRL_IPV6_PREFIX 56
+
+// Buckets per table, in sets of HSK_RRL_WAYS.
+// A source hashing onto a full set takes over
+// the least recently used bucket in it.
+#define HSK_RRL_SIZE 4096
+#define HSK_RRL_WAYS 4
+#define HSK_RRL_SETS (HSK_RRL_SIZE / HSK_RRL_WAYS)
+
+// Every Nth limited query gets an empty TC=1
+// reply (so real clients retry over TCP); the
+// rest are dropped.
+#define HSK_RRL_SLIP 2
+
+#define HSK_RRL_PASS 0
+#define HSK_RRL_DROP 1
+#define HSK_RRL_TRUNCATE 2
+
+/*
+ * Types
+ */
+
+typedef struct hsk_rrl_bucket_s {
+  uint8_t prefix[16];
+  bool used;
+  uint64_t tokens;
+  uint64_t time;
+  uint32_t limited;
+} hsk_rrl_bucket_t;
+
+// A token bucket per source prefix, refilled
+// at `rate` queries per second and holding at
+// most a second's worth. Not thread safe: each
+// loop keeps a table of its own. Prefixes are
+// hashed with a random key, so which ones
+// share a set cannot be worked out offline.
+typedef struct hsk_rrl_s {
+  uint32_t rate;
+  uint8_t key[16];
+  hsk_rrl_bucket_t *buckets;
+} hsk_rrl_t;
+
+/*
+ * RRL
+ */
+
+void
+hsk_rrl_init(hsk_rrl_t *rrl);
+
+void
+hsk_rrl_uninit(hsk_rrl_t *rrl);
+
+bool
+hsk_rrl_set_rate(hsk_rrl_t *rrl, uint32_t rate);
+
+uint32_t
+hsk_rrl_share(uint32_t rate, int loops);
+
+int
+hsk_rrl_check(hsk_rrl_t *rrl, const struct sockaddr *addr, uint64_t now);
+
+bool
+hsk_rrl_truncated(const hsk_dns_req_t *req, uint8_t **wire, size_t *wire_len);
+#endif
@@ -10,18 +10,26 @@
 #include <time.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <unbound.h>
 
 #include "addr.h"
+#include "bio.h"
 #include "constants.h"
 #include "dns.h"
 #include "dnssec.h"
+#include "doq.h"
 #include "ec.h"
 #include "error.h"
-#include "resource.h"
+#include "log.h"
+#include "map.h"
+#include "mem.h"
+#include "prof.h"
 #include "req.h"
 #include "rs.h"
+#include "udp.h"
 #include "utils.h"
 #include "uv.h"
 
@@ -29,19 +37,65 @@
  * Types
  */
 
-typedef struct {
+typedef struct hsk_rs_waiter_s {
+  hsk_dns_req_t *req;
+  struct hsk_rs_waiter_s *next;
+} hsk_rs_waiter_t;
+
+// A DNS over TCP client, as on the root
+// nameserver: pipelined, length-prefixed
+// queries, each answered when ready. Pending
+// queries hold a reference.
+typedef struct hsk_rs_conn_s {
+  hsk_rs_t *ns;
+  uv_tcp_t socket;
+  uv_timer_t timer;
+  struct sockaddr_storage addr;
+  uint8_t buf[2 + HSK_DNS_MAX_TCP];
+  size_t buf_len;
+  int refs;
+  int handles;
+  bool closing;
+  bool reading;
+  struct hsk_rs_write_s *batch;
+  struct hsk_rs_conn_s *prev;
+  struct hsk_rs_conn_s *next;
+} hsk_rs_conn_t;
+
+// Each reply is a length prefix and its data.
+typedef struct hsk_rs_write_s {
+  uv_write_t req;
+  hsk_rs_conn_t *conn;
+  int count;
+  uint8_t prefixes[HSK_RS_TCP_BATCH][2];
+  uv_buf_t bufs[HSK_RS_TCP_BATCH * 2];
+} hsk_rs_write_t;
+
+// One resolution shared by identical queries.
+typedef struct hsk_rs_pending_s {
+  char key[HSK_DNS_MAX_NAME + 12];
   hsk_rs_t *ns;
-  void *data;
-  bool should_free;
-} hsk_send_data_t;
+  hsk_rs_waiter_t *head;
+  hsk_rs_waiter_t *tail;
+} hsk_rs_pending_t;
 
 /*
  * Prototypes
  */
 
+static void
+hsk_rs_pending_free(hsk_rs_pending_t *p);
+
 static void
 hsk_rs_log(hsk_rs_t *ns, const char *fmt, ...);
 
+// Per-query lines, compiled out
+// with --disable-debug-log.
+#define hsk_rs_debug(ns, ...) do {    \
+  if (hsk_log_enabled(HSK_LOG_DEBUG)) \
+    hsk_rs_log((ns), __VA_ARGS__);    \
+} while (0)
+
 static int
 hsk_rs_send(
   hsk_rs_t *ns,
@@ -52,18 +106,20 @@ hsk_rs_send(
 );
 
 static void
-alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf);
-
-static void
-after_send(uv_udp_send_t *req, int status);
+after_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+);
 
 static void
-after_recv(
-  uv_udp_t *socket,
-  ssize_t nread,
-  const uv_buf_t *buf,
-  const struct sockaddr *addr,
-  unsigned flags
+after_doq(
+  void *arg,
+  hsk_doq_stream_t *stream,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
 );
 
 static void
@@ -75,6 +131,56 @@ after_resolve(void *data, int status, struct ub_result *result);
 static void
 after_close(uv_handle_t *handle);
 
+static void
+after_connection(uv_stream_t *server, int status);
+
+static void
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf);
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void
+after_conn_write(uv_write_t *req, int status);
+
+static void
+after_conn_timeout(uv_timer_t *timer);
+
+static void
+after_conn_close(uv_handle_t *handle);
+
+static void
+hsk_rs_conn_close(hsk_rs_conn_t *conn);
+
+static void
+hsk_rs_conn_unref(hsk_rs_conn_t *conn);
+
+static void
+hsk_rs_reply(
+  hsk_rs_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t *wire,
+  size_t wire_len
+);
+
+static void
+hsk_rs_req_free(hsk_dns_req_t *req);
+
+static void
+after_stop(uv_async_t *handle);
+
+static int
+hsk_rs_start_workers(hsk_rs_t *ns, const struct sockaddr *addr);
+
+static void
+hsk_rs_stop_workers(hsk_rs_t *ns);
+
+static bool
+hsk_rs_init_shards(hsk_rs_t *ns, int count);
+
+static void
+hsk_rs_free_shards(hsk_rs_t *ns);
+
 /*
  * Recursive NS
  */
@@ -96,14 +202,18 @@ hsk_rs_init(hsk_rs_t *ns, const uv_loop_t *loop, const struct sockaddr *stub) {
   if (ub_ctx_async(ub, 1) != 0)
     goto fail;
 
-  ec = hsk_ec_alloc();
+  ec = hsk_ec_shared();
 
   if (!ec)
     goto fail;
 
   ns->loop = (uv_loop_t *)loop;
   ns->ub = ub;
-  ns->socket.data = (void *)ns;
+  hsk_udp_init(&ns->udp, ns->loop, after_recv, (void *)ns);
+  ns->tcp.data = (void *)ns;
+  ns->conns = NULL;
+  ns->conn_count = 0;
+  ns->listening = false;
   ns->poll.data = (void *)ns;
   ns->ec = ec;
   memset(ns->config_, 0x00, sizeof(ns->config_));
@@ -113,10 +223,25 @@ hsk_rs_init(hsk_rs_t *ns, const uv_loop_t *loop, const struct sockaddr *stub) {
   memset(ns->key_, 0x00, sizeof(ns->key_));
   ns->key = NULL;
   memset(ns->pubkey, 0x00, sizeof(ns->pubkey));
-  memset(ns->read_buffer, 0x00, sizeof(ns->read_buffer));
+  ns->unsigned_errors = false;
   ns->bound = false;
-  ns->receiving = false;
   ns->polling = false;
+  ns->parent = NULL;
+  ns->workers = NULL;
+  ns->worker_count = 0;
+  ns->shards = NULL;
+  ns->shard_count = 0;
+  ns->async.data = (void *)ns;
+  ns->running = false;
+  ns->capture = NULL;
+  ns->handoff = NULL;
+  ns->affinity = NULL;
+  ns->affinity_first = 0;
+  ns->cpu = -1;
+  ns->doq = NULL;
+  ns->doq_addr = NULL;
+  memset(ns->doq_cert, 0x00, sizeof(ns->doq_cert));
+  memset(ns->doq_key, 0x00, sizeof(ns->doq_key));
 
   if (stub) {
     err = HSK_EFAILURE;
@@ -128,15 +253,27 @@ hsk_rs_init(hsk_rs_t *ns, const uv_loop_t *loop, const struct sockaddr *stub) {
       goto fail;
   }
 
+  if (uv_mutex_init(&ns->lock) != 0) {
+    err = HSK_EFAILURE;
+    goto fail;
+  }
+
+  if (!hsk_rs_init_shards(ns, 1)) {
+    uv_mutex_destroy(&ns->lock);
+    err = HSK_ENOMEM;
+    goto fail;
+  }
+
+  hsk_rrl_init(&ns->rrl);
+  hsk_slab_init(&ns->reqs, sizeof(hsk_dns_req_t), HSK_DNS_REQ_SLAB);
+  hsk_map_init_str_map(&ns->pending, (hsk_map_free_func)hsk_rs_pending_free);
+
   return HSK_SUCCESS;
 
 fail:
   if (ub)
     ub_ctx_delete(ub);
 
-  if (ec)
-    hsk_ec_free(ec);
-
   return err;
 }
 
@@ -145,18 +282,38 @@ hsk_rs_uninit(hsk_rs_t *ns) {
   if (!ns)
     return;
 
-  ns->socket.data = NULL;
+  hsk_udp_uninit(&ns->udp);
   ns->poll.data = NULL;
 
-  if (ns->ec) {
-    hsk_ec_free(ns->ec);
-    ns->ec = NULL;
-  }
+  hsk_doq_free(ns->doq);
+  ns->doq = NULL;
+
+  ns->ec = NULL;
 
   if (ns->ub) {
     ub_ctx_delete(ns->ub);
     ns->ub = NULL;
   }
+
+  for (int i = 0; i < ns->worker_count; i++)
+    hsk_rs_free(ns->workers[i]);
+
+  hsk_free(ns->workers);
+  ns->workers = NULL;
+  ns->worker_count = 0;
+
+  // Workers borrow the parent's shards.
+  if (!ns->parent)
+    hsk_rs_free_shards(ns);
+
+  hsk_rrl_uninit(&ns->rrl);
+
+  // Whatever unbound never answered.
+  hsk_map_uninit(&ns->pending);
+
+  hsk_slab_uninit(&ns->reqs);
+
+  uv_mutex_destroy(&ns->lock);
 }
 
 bool
@@ -180,6 +337,25 @@ hsk_rs_set_config(hsk_rs_t *ns, const char *config) {
   return true;
 }
 
+// Whether unbound accepts a config file, on a
+// context of its own (one is only configured
+// before it first resolves).
+bool
+hsk_rs_check_config(const char *config) {
+  assert(config);
+
+  struct ub_ctx *ub = ub_ctx_create();
+
+  if (!ub)
+    return false;
+
+  bool ret = ub_ctx_config(ub, config) == 0;
+
+  ub_ctx_delete(ub);
+
+  return ret;
+}
+
 bool
 hsk_rs_set_key(hsk_rs_t *ns, const uint8_t *key) {
   assert(ns);
@@ -200,6 +376,152 @@ hsk_rs_set_key(hsk_rs_t *ns, const uint8_t *key) {
   return true;
 }
 
+// Must be called before opening.
+bool
+hsk_rs_set_stub(hsk_rs_t *ns, const struct sockaddr *stub) {
+  assert(ns && stub);
+
+  if (ns->bound)
+    return false;
+
+  if (!hsk_sa_copy(ns->stub, stub))
+    return false;
+
+  return hsk_sa_localize(ns->stub);
+}
+
+// Each worker resolves with a context (and
+// cache) of its own, built from the same
+// config file and options.
+bool
+hsk_rs_set_workers(hsk_rs_t *ns, int count) {
+  assert(ns);
+
+  if (count < 0 || count > HSK_RS_WORKERS_MAX)
+    return false;
+
+  if (ns->bound || ns->parent)
+    return false;
+
+  hsk_rs_free_shards(ns);
+
+  if (!hsk_rs_init_shards(ns, count > 0 ? HSK_RS_SHARDS : 1))
+    return false;
+
+  ns->worker_count = count;
+
+  return true;
+}
+
+// Queries per second from each source prefix
+// (0 for no limit), split evenly between
+// this loop and its workers.
+bool
+hsk_rs_set_rate_limit(hsk_rs_t *ns, uint32_t rate) {
+  assert(ns);
+
+  if (ns->bound)
+    return false;
+
+  return hsk_rrl_set_rate(&ns->rrl, rate);
+}
+
+// As with hsk_ns_set_unsigned_errors (NOTIMP
+// too).
+bool
+hsk_rs_set_unsigned_errors(hsk_rs_t *ns, bool unsigned_errors) {
+  assert(ns);
+
+  if (ns->bound)
+    return false;
+
+  ns->unsigned_errors = unsigned_errors;
+
+  return true;
+}
+
+// As with hsk_ns_set_udp_buffers.
+bool
+hsk_rs_set_udp_buffers(hsk_rs_t *ns, int rcvbuf, int sndbuf) {
+  assert(ns);
+
+  if (ns->bound)
+    return false;
+
+  return hsk_udp_set_buffers(&ns->udp, rcvbuf, sndbuf);
+}
+
+// Record every query into `capture`, which
+// outlives the server. Workers share it.
+bool
+hsk_rs_set_capture(hsk_rs_t *ns, hsk_capture_t *capture) {
+  assert(ns);
+
+  if (ns->bound || ns->parent)
+    return false;
+
+  ns->capture = capture;
+
+  return true;
+}
+
+// As with hsk_ns_set_handoff.
+bool
+hsk_rs_set_handoff(hsk_rs_t *ns, hsk_handoff_t *handoff) {
+  assert(ns);
+
+  if (ns->bound || ns->parent)
+    return false;
+
+  ns->handoff = handoff;
+
+  return true;
+}
+
+// As with hsk_ns_set_affinity.
+bool
+hsk_rs_set_affinity(hsk_rs_t *ns, const hsk_affinity_t *aff, int first) {
+  assert(ns);
+
+  if (ns->bound || ns->parent || first < 0)
+    return false;
+
+  ns->affinity = aff;
+  ns->affinity_first = first;
+
+  return true;
+}
+
+// Read when opened: the certificate chain and
+// key (PEM) are loaded again on every reload.
+bool
+hsk_rs_set_doq(
+  hsk_rs_t *ns,
+  const struct sockaddr *addr,
+  const char *cert,
+  const char *key
+) {
+  assert(ns && addr && cert && key);
+
+  if (ns->bound || ns->parent || !hsk_doq_supported())
+    return false;
+
+  if (strlen(cert) > 255 || strlen(key) > 255)
+    return false;
+
+  ns->doq_addr = (struct sockaddr *)&ns->doq_addr_;
+
+  if (!hsk_sa_copy(ns->doq_addr, addr)) {
+    ns->doq_addr = NULL;
+    return false;
+  }
+
+  strcpy(ns->doq_cert, cert);
+  strcpy(ns->doq_key, key);
+
+  return true;
+}
+
 static bool
 hsk_rs_inject_options(hsk_rs_t *ns) {
   if (ns->config) {
@@ -215,7 +537,13 @@ hsk_rs_inject_options(hsk_rs_t *ns) {
 
   ub_ctx_set_option(ns->ub, "trust-anchor-signaling:", "no");
 
-  if (ub_ctx_set_option(ns->ub, "edns-buffer-size:", "4096") != 0)
+  // The same UDP size we answer with, which is
+  // what the root nameserver will send back.
+  char size[16];
+
+  sprintf(size, "%zu", hsk_dns_req_udp_size());
+
+  if (ub_ctx_set_option(ns->ub, "edns-buffer-size:", size) != 0)
     return false;
 
   if (ub_ctx_set_option(ns->ub, "max-udp-size:", "4096") != 0)
@@ -223,10 +551,32 @@ hsk_rs_inject_options(hsk_rs_t *ns) {
 
   ub_ctx_set_option(ns->ub, "qname-minimisation:", "yes");
 
+  // Our NX proofs cover the whole TLD: queries
+  // under a missing one are then denied from
+  // unbound's cache (RFC 8198), never reaching
+  // the root nameserver or the pool.
+  ub_ctx_set_option(ns->ub, "aggressive-nsec:", "yes");
+
+  // Unbound's caches are not accounted for:
+  // under a memory budget, they get a sixteenth
+  // of it each, instead of 4MiB.
+  size_t budget = hsk_mem_get_budget();
+
+  if (budget > 0) {
+    char cache[32];
+
+    sprintf(cache, "%zu", budget / 16);
+
+    ub_ctx_set_option(ns->ub, "msg-cache-size:", cache);
+    ub_ctx_set_option(ns->ub, "rrset-cache-size:", cache);
+  }
+
   if (ub_ctx_set_option(ns->ub, "root-hints:", "") != 0)
     return false;
 
-  if (ub_ctx_set_option(ns->ub, "do-tcp:", "no") != 0)
+  // Retry truncated answers from the root
+  // nameserver over TCP.
+  if (ub_ctx_set_option(ns->ub, "do-tcp:", "yes") != 0)
     return false;
 
   char stub[HSK_MAX_HOST];
@@ -258,38 +608,81 @@ hsk_rs_open(hsk_rs_t *ns, const struct sockaddr *addr) {
   if (!hsk_rs_inject_options(ns))
     return HSK_EFAILURE;
 
-  if (uv_udp_init(ns->loop, &ns->socket) != 0)
-    return HSK_EFAILURE;
-
-  ns->socket.data = (void *)ns;
+  bool reuseport = ns->parent || ns->worker_count > 0;
+  int fd = hsk_handoff_take(ns->handoff, addr, SOCK_DGRAM);
 
-  if (uv_udp_bind(&ns->socket, addr, 0) != 0)
-    return HSK_EFAILURE;
+  if (fd != -1) {
+    if (hsk_udp_open_fd(&ns->udp, fd) != HSK_SUCCESS)
+      return HSK_EFAILURE;
+  } else {
+    if (hsk_udp_open(&ns->udp, addr, reuseport) != HSK_SUCCESS)
+      return HSK_EFAILURE;
+  }
 
   ns->bound = true;
 
-  int value = sizeof(ns->read_buffer);
+  if (!ns->parent)
+    ns->cpu = hsk_affinity_current();
 
-  if (uv_send_buffer_size((uv_handle_t *)&ns->socket, &value) != 0)
-    return HSK_EFAILURE;
+  if (reuseport)
+    hsk_udp_set_cpu(&ns->udp, ns->cpu);
 
-  if (uv_recv_buffer_size((uv_handle_t *)&ns->socket, &value) != 0)
+  if (uv_poll_init(ns->loop, &ns->poll, ub_fd(ns->ub)) != 0)
     return HSK_EFAILURE;
 
-  if (uv_udp_recv_start(&ns->socket, alloc_buffer, after_recv) != 0)
+  ns->polling = true;
+  ns->poll.data = (void *)ns;
+
+  if (uv_poll_start(&ns->poll, UV_READABLE, after_poll) != 0)
     return HSK_EFAILURE;
 
-  ns->receiving = true;
+  if (ns->parent)
+    return HSK_SUCCESS;
 
-  if (uv_poll_init(ns->loop, &ns->poll, ub_fd(ns->ub)) != 0)
+  // TCP stays on the parent's loop.
+  if (uv_tcp_init(ns->loop, &ns->tcp) != 0)
     return HSK_EFAILURE;
 
-  ns->polling = true;
-  ns->poll.data = (void *)ns;
+  ns->tcp.data = (void *)ns;
+  ns->listening = true;
 
-  if (uv_poll_start(&ns->poll, UV_READABLE, after_poll) != 0)
+  fd = hsk_handoff_take(ns->handoff, addr, SOCK_STREAM);
+
+  if (fd != -1) {
+    if (uv_tcp_open(&ns->tcp, fd) != 0) {
+      close(fd);
+      return HSK_EFAILURE;
+    }
+  } else {
+    if (uv_tcp_bind(&ns->tcp, addr, 0) != 0)
+      return HSK_EFAILURE;
+  }
+
+  if (uv_listen((uv_stream_t *)&ns->tcp, 128, after_connection) != 0)
     return HSK_EFAILURE;
 
+  if (ns->doq_addr) {
+    ns->doq = hsk_doq_alloc(ns->loop, after_doq, (void *)ns);
+
+    if (!ns->doq)
+      return HSK_ENOMEM;
+
+    fd = hsk_handoff_take(ns->handoff, ns->doq_addr, SOCK_DGRAM);
+
+    int rc = hsk_doq_open(ns->doq, ns->doq_addr, ns->doq_cert,
+                          ns->doq_key, fd);
+
+    if (rc != HSK_SUCCESS)
+      return rc;
+  }
+
+  if (ns->worker_count > 0) {
+    int rc = hsk_rs_start_workers(ns, addr);
+
+    if (rc != HSK_SUCCESS)
+      return rc;
+  }
+
   char host[HSK_MAX_HOST];
   assert(hsk_sa_to_string(addr, host, HSK_MAX_HOST, HSK_NS_PORT));
 
@@ -298,29 +691,74 @@ hsk_rs_open(hsk_rs_t *ns, const struct sockaddr *addr) {
   return HSK_SUCCESS;
 }
 
+// As with hsk_ns_get_fds.
+int
+hsk_rs_get_fds(const hsk_rs_t *ns, int *fds, int max) {
+  assert(ns && fds);
+
+  int count = 0;
+  uv_os_fd_t fd;
+  int i;
+
+  if (ns->bound && count < max)
+    fds[count++] = ns->udp.fd;
+
+  if (ns->listening && count < max) {
+    if (uv_fileno((uv_handle_t *)&ns->tcp, &fd) == 0)
+      fds[count++] = fd;
+  }
+
+  if (ns->doq && count < max) {
+    int doq_fd = hsk_doq_get_fd(ns->doq);
+
+    if (doq_fd != -1)
+      fds[count++] = doq_fd;
+  }
+
+  for (i = 0; i < ns->worker_count && count < max; i++) {
+    const hsk_rs_t *w = ns->workers[i];
+
+    if (w && w->bound)
+      fds[count++] = w->udp.fd;
+  }
+
+  return count;
+}
+
 int
 hsk_rs_close(hsk_rs_t *ns) {
   if (!ns)
     return HSK_EBADARGS;
 
-  if (ns->receiving) {
-    if (uv_udp_recv_stop(&ns->socket) != 0)
-      return HSK_EFAILURE;
-    ns->receiving = false;
-  }
+  if (!ns->parent)
+    hsk_rs_stop_workers(ns);
 
   if (ns->bound) {
-    uv_close((uv_handle_t *)&ns->socket, after_close);
+    hsk_udp_close(&ns->udp);
     ns->bound = false;
   }
 
+  if (ns->listening) {
+    while (ns->conns)
+      hsk_rs_conn_close((hsk_rs_conn_t *)ns->conns);
+
+    uv_close((uv_handle_t *)&ns->tcp, after_close);
+    ns->listening = false;
+  }
+
+  if (ns->doq)
+    hsk_doq_close(ns->doq);
+
   if (ns->polling) {
     if (uv_poll_stop(&ns->poll) != 0)
       return HSK_EFAILURE;
+    uv_close((uv_handle_t *)&ns->poll, after_close);
     ns->polling = false;
   }
 
-  ns->socket.data = NULL;
+  if (ns->parent)
+    uv_close((uv_handle_t *)&ns->async, after_close);
+
   ns->poll.data = NULL;
 
   if (ns->ub) {
@@ -333,13 +771,13 @@ hsk_rs_close(hsk_rs_t *ns) {
 
 hsk_rs_t *
 hsk_rs_alloc(const uv_loop_t *loop, const struct sockaddr *stub) {
-  hsk_rs_t *ns = malloc(sizeof(hsk_rs_t));
+  hsk_rs_t *ns = hsk_malloc(sizeof(hsk_rs_t));
 
   if (!ns)
     return NULL;
 
   if (hsk_rs_init(ns, loop, stub) != HSK_SUCCESS) {
-    free(ns);
+    hsk_free(ns);
     return NULL;
   }
 
@@ -352,7 +790,7 @@ hsk_rs_free(hsk_rs_t *ns) {
     return;
 
   hsk_rs_uninit(ns);
-  free(ns);
+  hsk_free(ns);
 }
 
 int
@@ -370,51 +808,428 @@ hsk_rs_destroy(hsk_rs_t *ns) {
   return HSK_SUCCESS;
 }
 
+/*
+ * Workers
+ */
+
 static void
-hsk_rs_log(hsk_rs_t *ns, const char *fmt, ...) {
-  printf("rs: ");
+hsk_rs_run(void *arg) {
+  hsk_rs_t *ns = (hsk_rs_t *)arg;
 
-  va_list args;
-  va_start(args, fmt);
-  vprintf(fmt, args);
-  va_end(args);
+  // Before the first read touches the buffers.
+  if (hsk_affinity_pin(ns->cpu) != HSK_SUCCESS)
+    hsk_rs_log(ns, "could not pin worker to cpu %d\n", ns->cpu);
+
+  uv_run(ns->loop, UV_RUN_DEFAULT);
 }
 
-static void
-hsk_rs_onrecv(
-  hsk_rs_t *ns,
-  const uint8_t *data,
-  size_t data_len,
-  const struct sockaddr *addr,
-  uint32_t flags
-) {
-  hsk_dns_req_t *req = hsk_dns_req_create(data, data_len, addr);
+static int
+hsk_rs_start_workers(hsk_rs_t *ns, const struct sockaddr *addr) {
+  int count = ns->worker_count;
+  uint32_t rate = hsk_rrl_share(ns->rrl.rate, count + 1);
 
-  int rc;
-  uint8_t *wire = NULL;
-  size_t wire_len = 0;
-  hsk_dns_msg_t *msg = NULL;
+  ns->worker_count = 0;
+  ns->workers = hsk_calloc(count, sizeof(hsk_rs_t *));
 
-  if (!req) {
-    hsk_rs_log(ns, "failed processing dns request\n");
-    return;
-  }
+  if (!ns->workers)
+    return HSK_ENOMEM;
 
-  hsk_dns_req_print(req, "rs: ");
+  for (int i = 0; i < count; i++) {
+    hsk_rs_t *w = hsk_malloc(sizeof(hsk_rs_t));
 
-  req->ns = (void *)ns;
+    if (!w)
+      return HSK_ENOMEM;
 
-  if (req->type == HSK_DNS_ANY) {
-    msg = hsk_resource_to_notimp();
-    goto fail;
-  }
+    if (uv_loop_init(&w->loop_) != 0) {
+      hsk_free(w);
+      return HSK_EFAILURE;
+    }
 
-  rc = ub_resolve_async(
+    if (hsk_rs_init(w, &w->loop_, NULL) != HSK_SUCCESS) {
+      uv_loop_close(&w->loop_);
+      hsk_free(w);
+      return HSK_EFAILURE;
+    }
+
+    ns->workers[ns->worker_count++] = w;
+
+    hsk_rs_free_shards(w);
+
+    w->parent = ns;
+    w->shards = ns->shards;
+    w->shard_count = ns->shard_count;
+    w->capture = ns->capture;
+    w->handoff = ns->handoff;
+    w->cpu = hsk_affinity_get(ns->affinity, ns->affinity_first + i);
+    w->unsigned_errors = ns->unsigned_errors;
+
+    if (!hsk_sa_copy(w->stub, ns->stub))
+      return HSK_EFAILURE;
+
+    if (!hsk_rs_set_config(w, ns->config))
+      return HSK_EFAILURE;
+
+    if (!hsk_rs_set_key(w, ns->key))
+      return HSK_EFAILURE;
+
+    if (!hsk_rs_set_rate_limit(w, rate))
+      return HSK_ENOMEM;
+
+    if (!hsk_rs_set_udp_buffers(w, ns->udp.rcvbuf, ns->udp.sndbuf))
+      return HSK_EFAILURE;
+
+    if (uv_async_init(w->loop, &w->async, after_stop) != 0)
+      return HSK_EFAILURE;
+
+    w->async.data = (void *)w;
+    w->running = true;
+
+    int rc = hsk_rs_open(w, addr);
+
+    if (rc != HSK_SUCCESS)
+      return rc;
+
+    if (uv_thread_create(&w->thread, hsk_rs_run, (void *)w) != 0) {
+      w->running = false;
+      return HSK_EFAILURE;
+    }
+  }
+
+  // The parent reads the same port.
+  if (!hsk_rrl_set_rate(&ns->rrl, rate))
+    return HSK_ENOMEM;
+
+  hsk_rs_log(ns, "started %d worker threads\n", count);
+
+  return HSK_SUCCESS;
+}
+
+static void
+hsk_rs_stop_workers(hsk_rs_t *ns) {
+  for (int i = 0; i < ns->worker_count; i++) {
+    hsk_rs_t *w = ns->workers[i];
+
+    uv_mutex_lock(&w->lock);
+
+    if (!w->running) {
+      uv_mutex_unlock(&w->lock);
+      continue;
+    }
+
+    w->running = false;
+    uv_async_send(&w->async);
+    uv_mutex_unlock(&w->lock);
+
+    uv_thread_join(&w->thread);
+    uv_loop_close(&w->loop_);
+  }
+}
+
+/*
+ * Cache
+ */
+
+static bool
+hsk_rs_init_shards(hsk_rs_t *ns, int count) {
+  ns->shards = hsk_malloc(count * sizeof(hsk_rs_shard_t));
+
+  if (!ns->shards)
+    return false;
+
+  size_t shard_size = HSK_CACHE_SIZE / count;
+
+  for (int i = 0; i < count; i++) {
+    hsk_rs_shard_t *shard = &ns->shards[i];
+
+    if (uv_mutex_init(&shard->lock) != 0) {
+      ns->shard_count = i;
+      hsk_rs_free_shards(ns);
+      return false;
+    }
+
+    hsk_cache_init(&shard->cache);
+    hsk_cache_set_size(&shard->cache, shard_size);
+  }
+
+  ns->shard_count = count;
+
+  return true;
+}
+
+static void
+hsk_rs_free_shards(hsk_rs_t *ns) {
+  for (int i = 0; i < ns->shard_count; i++) {
+    hsk_rs_shard_t *shard = &ns->shards[i];
+    hsk_cache_uninit(&shard->cache);
+    uv_mutex_destroy(&shard->lock);
+  }
+
+  hsk_free(ns->shards);
+
+  ns->shards = NULL;
+  ns->shard_count = 0;
+}
+
+// By TLD, as the NS does.
+static hsk_rs_shard_t *
+hsk_rs_shard(const hsk_rs_t *ns, const hsk_dns_req_t *req) {
+  if (ns->shard_count == 1)
+    return &ns->shards[0];
+
+  const char *tld = req->tld;
+  uint32_t hash = hsk_map_murmur3((const uint8_t *)tld, strlen(tld), 0);
+
+  return &ns->shards[hash % ns->shard_count];
+}
+
+static bool
+hsk_rs_cache_get_wire(
+  const hsk_rs_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  hsk_rs_shard_t *shard = hsk_rs_shard(ns, req);
+  uv_mutex_lock(&shard->lock);
+  bool ret = hsk_cache_get_wire(&shard->cache, req, wire, wire_len);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static bool
+hsk_rs_cache_insert_reply(
+  const hsk_rs_t *ns,
+  const hsk_dns_req_t *req,
+  const uint8_t *wire,
+  size_t wire_len
+) {
+  hsk_rs_shard_t *shard = hsk_rs_shard(ns, req);
+  uv_mutex_lock(&shard->lock);
+  bool ret = hsk_cache_insert_reply(&shard->cache, req, wire, wire_len);
+  uv_mutex_unlock(&shard->lock);
+  return ret;
+}
+
+static void
+hsk_rs_log(hsk_rs_t *ns, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("rs: ", fmt, args);
+  va_end(args);
+}
+
+/*
+ * Pending Queries
+ */
+
+static void
+hsk_rs_pending_free(hsk_rs_pending_t *p) {
+  hsk_rs_waiter_t *w, *next;
+
+  for (w = p->head; w; w = next) {
+    next = w->next;
+    if (w->req)
+      hsk_rs_req_free(w->req);
+    hsk_free(w);
+  }
+
+  hsk_free(p);
+}
+
+// The answer does not depend on the flags of
+// a query, only how it is shaped for each one.
+static void
+hsk_rs_pending_key(const hsk_dns_req_t *req, char *key) {
+  int len = sprintf(key, "%u:%u:", req->type, req->class);
+
+  strcpy(&key[len], req->name);
+  hsk_to_lower(&key[len]);
+}
+
+static bool
+hsk_rs_pending_push(hsk_rs_pending_t *p, hsk_dns_req_t *req) {
+  hsk_rs_waiter_t *w = hsk_malloc(sizeof(hsk_rs_waiter_t));
+
+  if (!w)
+    return false;
+
+  w->req = req;
+  w->next = NULL;
+
+  if (p->tail)
+    p->tail->next = w;
+  else
+    p->head = w;
+
+  p->tail = w;
+
+  return true;
+}
+
+// An error written straight to wire, with no
+// message built (see hsk_dns_wire_empty).
+static bool
+hsk_rs_error(
+  hsk_rs_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t code,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  if (!hsk_dns_wire_empty(req, 0, code, wire, wire_len))
+    return false;
+
+  if (!hsk_dns_wire_cookie(req, wire, wire_len))
+    goto fail;
+
+  if (ns->key && !ns->unsigned_errors
+      && !hsk_dns_wire_sign(ns->ec, ns->key, wire, wire_len)) {
+    goto fail;
+  }
+
+  return true;
+
+fail:
+  hsk_free(*wire);
+  *wire = NULL;
+  *wire_len = 0;
+  return false;
+}
+
+static void
+hsk_rs_onrecv(
+  hsk_rs_t *ns,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr,
+  hsk_rs_conn_t *conn,
+  hsk_doq_stream_t *stream
+) {
+  if (ns->capture) {
+    uint8_t flags = HSK_CAPTURE_RS;
+
+    // Streams, either way.
+    if (conn || stream)
+      flags |= HSK_CAPTURE_TCP;
+
+    hsk_capture_push(ns->capture, flags, addr, data, data_len);
+  }
+
+  hsk_dns_req_t *req = hsk_dns_req_create(&ns->reqs, data, data_len, addr);
+
+  int rc;
+  uint8_t *wire = NULL;
+  size_t wire_len = 0;
+  uint8_t code = HSK_DNS_SERVFAIL;
+
+  if (!req) {
+    hsk_rs_log(ns, "failed processing dns request\n");
+    return;
+  }
+
+  // No need to truncate over TCP.
+  if (conn) {
+    req->conn = (void *)conn;
+    req->max_size = HSK_DNS_MAX_TCP;
+    conn->refs += 1;
+  }
+
+  if (stream) {
+    req->stream = (void *)stream;
+    req->max_size = HSK_DNS_MAX_TCP;
+    hsk_doq_stream_ref(stream);
+  }
+
+  if (hsk_log_enabled(HSK_LOG_DEBUG))
+    hsk_dns_req_print(req, "rs: ");
+
+  req->ns = (void *)ns;
+
+  // Only sources that could be spoofed (a
+  // valid server cookie proves it is not).
+  if (!conn && !stream && ns->rrl.rate != 0 && !hsk_dns_req_cookie_ok(req)) {
+    switch (hsk_rrl_check(&ns->rrl, addr, uv_now(ns->loop))) {
+      case HSK_RRL_DROP: {
+        hsk_rs_debug(ns, "rate limited (%u)\n", req->id);
+        goto done;
+      }
+      case HSK_RRL_TRUNCATE: {
+        if (hsk_rrl_truncated(req, &wire, &wire_len))
+          hsk_rs_reply(ns, req, wire, wire_len);
+        hsk_rs_debug(ns, "rate limited, truncating (%u)\n", req->id);
+        goto done;
+      }
+    }
+  }
+
+  // Only the ID, TTLs and signature change
+  // between hits.
+  if (hsk_rs_cache_get_wire(ns, req, &wire, &wire_len)) {
+    if (!hsk_dns_wire_cookie(req, &wire, &wire_len)) {
+      hsk_rs_log(ns, "could not add cookie\n");
+      hsk_free(wire);
+      goto done;
+    }
+
+    if (ns->key && !hsk_dns_wire_sign(ns->ec, ns->key, &wire, &wire_len)) {
+      hsk_rs_log(ns, "could not sign cached answer\n");
+      hsk_free(wire);
+      goto done;
+    }
+
+    hsk_rs_debug(ns, "sending cached answer (%u): %u\n", req->id, wire_len);
+    hsk_rs_reply(ns, req, wire, wire_len);
+    goto done;
+  }
+
+  if (req->type == HSK_DNS_ANY) {
+    code = HSK_DNS_NOTIMP;
+    goto fail;
+  }
+
+  char key[HSK_DNS_MAX_NAME + 12];
+  hsk_rs_pending_key(req, key);
+
+  hsk_rs_pending_t *p = hsk_map_get(&ns->pending, key);
+
+  // Already being resolved: wait for it.
+  if (p) {
+    if (!hsk_rs_pending_push(p, req)) {
+      goto fail;
+    }
+
+    hsk_rs_debug(ns, "joining pending query (%u): %s\n", req->id, req->name);
+    return;
+  }
+
+  p = hsk_malloc(sizeof(hsk_rs_pending_t));
+
+  if (!p) {
+    goto fail;
+  }
+
+  strcpy(p->key, key);
+  p->ns = ns;
+  p->head = NULL;
+  p->tail = NULL;
+
+  if (!hsk_rs_pending_push(p, req)) {
+    hsk_free(p);
+    goto fail;
+  }
+
+  if (!hsk_map_set(&ns->pending, p->key, (void *)p)) {
+    p->head->req = NULL;
+    hsk_rs_pending_free(p);
+    goto fail;
+  }
+
+  rc = ub_resolve_async(
     ns->ub,
     req->name,
     req->type,
     req->class,
-    (void *)req,
+    (void *)p,
     after_resolve,
     NULL
   );
@@ -422,25 +1237,23 @@ hsk_rs_onrecv(
   if (rc == 0)
     return;
 
-  hsk_rs_log(ns, "unbound error: %s\n", ub_strerror(rc));
+  // The request is still ours.
+  hsk_map_del(&ns->pending, p->key);
+  p->head->req = NULL;
+  hsk_rs_pending_free(p);
 
-  msg = hsk_resource_to_servfail();
+  hsk_rs_log(ns, "unbound error: %s\n", ub_strerror(rc));
 
 fail:
-  if (!msg) {
-    hsk_rs_log(ns, "could not create servfail\n");
-    goto done;
-  }
-
-  if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
-    hsk_rs_log(ns, "could not finalize msg\n");
+  if (!hsk_rs_error(ns, req, code, &wire, &wire_len)) {
+    hsk_rs_log(ns, "could not create error reply\n");
     goto done;
   }
 
-  hsk_rs_send(ns, wire, wire_len, addr, true);
+  hsk_rs_reply(ns, req, wire, wire_len);
 
 done:
-  hsk_dns_req_free(req);
+  hsk_rs_req_free(req);
 }
 
 static void
@@ -459,17 +1272,28 @@ hsk_rs_respond(
     goto fail;
   }
 
-  hsk_rs_log(ns, "received answer for: %s\n", req->name);
-  hsk_rs_log(ns, "  canonname: %s\n", result->canonname);
-  hsk_rs_log(ns, "  rcode: %u\n", result->rcode);
-  hsk_rs_log(ns, "  havedata: %d\n", result->havedata);
-  hsk_rs_log(ns, "  nxdomain: %d\n", result->nxdomain);
-  hsk_rs_log(ns, "  secure: %d\n", result->secure);
-  hsk_rs_log(ns, "  bogus: %d\n", result->bogus);
-  hsk_rs_log(ns, "  why_bogus: %s\n", result->why_bogus);
+  hsk_rs_debug(ns, "received answer for: %s\n", req->name);
+  hsk_rs_debug(ns, "  canonname: %s\n", result->canonname);
+  hsk_rs_debug(ns, "  rcode: %u\n", result->rcode);
+  hsk_rs_debug(ns, "  havedata: %d\n", result->havedata);
+  hsk_rs_debug(ns, "  nxdomain: %d\n", result->nxdomain);
+  hsk_rs_debug(ns, "  secure: %d\n", result->secure);
+  hsk_rs_debug(ns, "  bogus: %d\n", result->bogus);
+  hsk_rs_debug(ns, "  why_bogus: %s\n", result->why_bogus);
 
   uint8_t *data = result->answer_packet;
   size_t data_len = result->answer_len;
+  uint16_t flags = HSK_DNS_RA;
+
+  if (result->secure && !result->bogus && (req->dnssec || req->ad))
+    flags |= HSK_DNS_AD;
+
+  // Usually done in place on the wire; the
+  // decoder handles whatever that cannot.
+  if (hsk_dns_wire_reply(data, data_len, req, flags, result->rcode,
+                         ns->key != NULL, &wire, &wire_len)) {
+    goto prepared;
+  }
 
   // Deserialize to do some preprocessing.
   if (!hsk_dns_msg_decode(data, data_len, &msg)) {
@@ -478,13 +1302,9 @@ hsk_rs_respond(
   }
 
   // "Clean" the packet.
-  msg->flags = 0;
+  msg->flags = flags;
   msg->opcode = HSK_DNS_QUERY;
   msg->code = result->rcode;
-  msg->flags |= HSK_DNS_RA;
-
-  if (result->secure && !result->bogus)
-    msg->flags |= HSK_DNS_AD;
 
   // Strip out non-answer sections.
   if (msg->an.size > 0) {
@@ -499,34 +1319,41 @@ hsk_rs_respond(
     }
   }
 
-  if (!req->dnssec && !req->ad)
-    msg->flags &= ~HSK_DNS_AD;
-
-  // Finalize and sign if key is available.
-  if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
+  if (!hsk_dns_msg_prepare(&msg, req, ns->key != NULL, &wire, &wire_len)) {
     hsk_rs_log(ns, "could not finalize msg\n");
     goto fail;
   }
 
+prepared:
+  hsk_rs_cache_insert_reply(ns, req, wire, wire_len);
+
+  if (!hsk_dns_wire_cookie(req, &wire, &wire_len)) {
+    hsk_rs_log(ns, "could not add cookie\n");
+    hsk_free(wire);
+    wire = NULL;
+    goto fail;
+  }
+
+  // Sign if key is available.
+  if (ns->key && !hsk_dns_wire_sign(ns->ec, ns->key, &wire, &wire_len)) {
+    hsk_rs_log(ns, "could not sign msg\n");
+    hsk_free(wire);
+    wire = NULL;
+    goto fail;
+  }
+
   goto done;
 
 fail:
   assert(!msg);
 
-  msg = hsk_resource_to_servfail();
-
-  if (!msg) {
+  if (!hsk_rs_error(ns, req, HSK_DNS_SERVFAIL, &wire, &wire_len)) {
     hsk_rs_log(ns, "could not create servfail\n");
     return;
   }
 
-  if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
-    hsk_rs_log(ns, "could not finalize msg\n");
-    return;
-  }
-
 done:
-  hsk_rs_send(ns, wire, wire_len, req->addr, true);
+  hsk_rs_reply(ns, req, wire, wire_len);
 }
 
 static int
@@ -537,55 +1364,166 @@ hsk_rs_send(
   const struct sockaddr *addr,
   bool should_free
 ) {
-  int rc = HSK_SUCCESS;
-  hsk_send_data_t *sd = NULL;
-  uv_udp_send_t *req = NULL;
+  int rc = hsk_udp_send(&ns->udp, data, data_len, addr, should_free);
 
-  sd = (hsk_send_data_t *)malloc(sizeof(hsk_send_data_t));
+  if (rc != HSK_SUCCESS)
+    hsk_rs_log(ns, "failed sending: %s\n", hsk_strerror(rc));
 
-  if (!sd) {
-    rc = HSK_ENOMEM;
-    goto fail;
+  return rc;
+}
+
+static int
+hsk_rs_conn_send(hsk_rs_conn_t *conn, uint8_t *data, size_t data_len);
+
+// Over the transport the query came in on.
+static void
+hsk_rs_reply(
+  hsk_rs_t *ns,
+  const hsk_dns_req_t *req,
+  uint8_t *wire,
+  size_t wire_len
+) {
+  if (req->conn)
+    hsk_rs_conn_send((hsk_rs_conn_t *)req->conn, wire, wire_len);
+  else if (req->stream)
+    hsk_doq_send((hsk_doq_stream_t *)req->stream, wire, wire_len);
+  else
+    hsk_rs_send(ns, wire, wire_len, req->addr, true);
+}
+
+static void
+hsk_rs_req_free(hsk_dns_req_t *req) {
+  hsk_rs_t *ns = (hsk_rs_t *)req->ns;
+
+  if (req->conn)
+    hsk_rs_conn_unref((hsk_rs_conn_t *)req->conn);
+
+  if (req->stream)
+    hsk_doq_stream_unref((hsk_doq_stream_t *)req->stream);
+
+  hsk_dns_req_give(ns ? &ns->reqs : NULL, req);
+}
+
+/*
+ * TCP
+ */
+
+static void
+hsk_rs_write_free(hsk_rs_write_t *wr) {
+  for (int i = 0; i < wr->count; i++)
+    hsk_free(wr->bufs[i * 2 + 1].base);
+
+  hsk_free(wr);
+}
+
+static void
+hsk_rs_conn_unref(hsk_rs_conn_t *conn) {
+  assert(conn->refs > 0);
+
+  conn->refs -= 1;
+
+  if (conn->refs == 0)
+    hsk_free(conn);
+}
+
+static void
+hsk_rs_conn_close(hsk_rs_conn_t *conn) {
+  hsk_rs_t *ns = conn->ns;
+
+  if (conn->closing)
+    return;
+
+  conn->closing = true;
+
+  if (conn->batch) {
+    hsk_rs_write_free(conn->batch);
+    conn->batch = NULL;
   }
 
-  req = (uv_udp_send_t *)malloc(sizeof(uv_udp_send_t));
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    ns->conns = (void *)conn->next;
 
-  if (!req) {
-    rc = HSK_ENOMEM;
-    goto fail;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  conn->prev = NULL;
+  conn->next = NULL;
+  ns->conn_count -= 1;
+
+  uv_close((uv_handle_t *)&conn->socket, after_conn_close);
+  uv_close((uv_handle_t *)&conn->timer, after_conn_close);
+}
+
+static int
+hsk_rs_conn_flush(hsk_rs_conn_t *conn) {
+  hsk_rs_write_t *wr = conn->batch;
+
+  if (!wr)
+    return HSK_SUCCESS;
+
+  conn->batch = NULL;
+
+  uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+  int rc = uv_write(&wr->req, stream, wr->bufs, wr->count * 2,
+                    after_conn_write);
+
+  if (rc != 0) {
+    hsk_rs_log(conn->ns, "tcp write error: %s\n", uv_strerror(rc));
+    hsk_rs_write_free(wr);
+    hsk_rs_conn_close(conn);
+    return HSK_EFAILURE;
   }
 
-  sd->ns = ns;
-  sd->data = (void *)data;
-  sd->should_free = should_free;
+  conn->refs += 1;
 
-  req->data = (void *)sd;
+  return HSK_SUCCESS;
+}
 
-  uv_buf_t bufs[] = {
-    { .base = (char *)data, .len = data_len }
-  };
+// Held back while the connection's read is
+// being answered (see after_conn_read).
+static int
+hsk_rs_conn_send(hsk_rs_conn_t *conn, uint8_t *data, size_t data_len) {
+  if (conn->closing || data_len > HSK_DNS_MAX_TCP) {
+    hsk_free(data);
+    return HSK_EFAILURE;
+  }
 
-  int status = uv_udp_send(req, &ns->socket, bufs, 1, addr, after_send);
+  hsk_rs_write_t *wr = conn->batch;
 
-  if (status != 0) {
-    hsk_rs_log(ns, "failed sending: %s\n", uv_strerror(status));
-    rc = HSK_EFAILURE;
-    goto fail;
+  if (!wr) {
+    wr = hsk_malloc(sizeof(hsk_rs_write_t));
+
+    if (!wr) {
+      hsk_free(data);
+      return HSK_ENOMEM;
+    }
+
+    wr->req.data = (void *)wr;
+    wr->conn = conn;
+    wr->count = 0;
+
+    conn->batch = wr;
   }
 
-  return rc;
+  uint8_t *prefix = wr->prefixes[wr->count];
+  uv_buf_t *bufs = &wr->bufs[wr->count * 2];
 
-fail:
-  if (sd)
-    free(sd);
+  set_u16be(prefix, (uint16_t)data_len);
 
-  if (req)
-    free(req);
+  bufs[0] = uv_buf_init((char *)prefix, 2);
+  bufs[1] = uv_buf_init((char *)data, data_len);
 
-  if (data && should_free)
-    free(data);
+  wr->count += 1;
 
-  return rc;
+  // Busy connections are not idle.
+  uv_timer_again(&conn->timer);
+
+  if (conn->reading && wr->count < HSK_RS_TCP_BATCH)
+    return HSK_SUCCESS;
+
+  return hsk_rs_conn_flush(conn);
 }
 
 /*
@@ -593,73 +1531,203 @@ fail:
  */
 
 static void
-alloc_buffer(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
-  hsk_rs_t *ns = (hsk_rs_t *)handle->data;
+after_recv(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  hsk_rs_t *ns = (hsk_rs_t *)arg;
+  uint64_t start = hsk_prof_start();
 
-  if (!ns) {
-    buf->base = NULL;
-    buf->len = 0;
-    return;
-  }
+  hsk_rs_onrecv(ns, data, data_len, addr, NULL, NULL);
 
-  buf->base = (char *)ns->read_buffer;
-  buf->len = sizeof(ns->read_buffer);
+  hsk_prof_end(HSK_PROF_RS_RECV, start);
 }
 
 static void
-after_send(uv_udp_send_t *req, int status) {
-  hsk_send_data_t *sd = (hsk_send_data_t *)req->data;
-  hsk_rs_t *ns = sd->ns;
+after_doq(
+  void *arg,
+  hsk_doq_stream_t *stream,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  hsk_rs_t *ns = (hsk_rs_t *)arg;
 
-  if (sd->data && sd->should_free)
-    free(sd->data);
+  hsk_rs_onrecv(ns, data, data_len, addr, NULL, stream);
+}
 
-  free(sd);
-  free(req);
+static void
+after_connection(uv_stream_t *server, int status) {
+  hsk_rs_t *ns = (hsk_rs_t *)server->data;
 
-  if (!ns)
+  if (status < 0) {
+    hsk_rs_log(ns, "tcp connection error: %s\n", uv_strerror(status));
     return;
+  }
 
-  if (status != 0) {
-    hsk_rs_log(ns, "send error: %s\n", uv_strerror(status));
+  hsk_rs_conn_t *conn = hsk_malloc(sizeof(hsk_rs_conn_t));
+
+  if (!conn) {
+    hsk_rs_log(ns, "could not allocate tcp connection\n");
+    return;
+  }
+
+  conn->ns = ns;
+  conn->buf_len = 0;
+  conn->refs = 1;
+  conn->handles = 0;
+  conn->closing = false;
+  conn->reading = false;
+  conn->batch = NULL;
+  conn->prev = NULL;
+  conn->next = (hsk_rs_conn_t *)ns->conns;
+  memset(&conn->addr, 0, sizeof(conn->addr));
+
+  if (uv_tcp_init(ns->loop, &conn->socket) != 0) {
+    hsk_free(conn);
     return;
   }
+
+  conn->socket.data = (void *)conn;
+  conn->handles += 1;
+
+  if (uv_timer_init(ns->loop, &conn->timer) != 0) {
+    uv_close((uv_handle_t *)&conn->socket, after_conn_close);
+    return;
+  }
+
+  conn->timer.data = (void *)conn;
+  conn->handles += 1;
+
+  if (conn->next)
+    conn->next->prev = conn;
+
+  ns->conns = (void *)conn;
+  ns->conn_count += 1;
+
+  if (uv_accept(server, (uv_stream_t *)&conn->socket) != 0) {
+    hsk_rs_conn_close(conn);
+    return;
+  }
+
+  if (ns->conn_count > HSK_RS_TCP_MAX) {
+    hsk_rs_log(ns, "too many tcp connections\n");
+    hsk_rs_conn_close(conn);
+    return;
+  }
+
+  int addr_len = sizeof(conn->addr);
+  struct sockaddr *addr = (struct sockaddr *)&conn->addr;
+
+  if (uv_tcp_getpeername(&conn->socket, addr, &addr_len) != 0) {
+    hsk_rs_conn_close(conn);
+    return;
+  }
+
+  uv_tcp_nodelay(&conn->socket, 1);
+
+  uint64_t timeout = HSK_RS_TCP_TIMEOUT;
+  uv_stream_t *stream = (uv_stream_t *)&conn->socket;
+
+  uv_timer_start(&conn->timer, after_conn_timeout, timeout, timeout);
+
+  if (uv_read_start(stream, alloc_conn, after_conn_read) != 0)
+    hsk_rs_conn_close(conn);
 }
 
 static void
-after_recv(
-  uv_udp_t *socket,
-  ssize_t nread,
-  const uv_buf_t *buf,
-  const struct sockaddr *addr,
-  unsigned flags
-) {
-  hsk_rs_t *ns = (hsk_rs_t *)socket->data;
+alloc_conn(uv_handle_t *handle, size_t size, uv_buf_t *buf) {
+  hsk_rs_conn_t *conn = (hsk_rs_conn_t *)handle->data;
 
-  if (!ns)
-    return;
+  buf->base = (char *)&conn->buf[conn->buf_len];
+  buf->len = sizeof(conn->buf) - conn->buf_len;
+}
+
+static void
+after_conn_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  hsk_rs_conn_t *conn = (hsk_rs_conn_t *)stream->data;
+  hsk_rs_t *ns = conn->ns;
 
   if (nread < 0) {
-    hsk_rs_log(ns, "udp read error: %s\n", uv_strerror(nread));
+    hsk_rs_conn_close(conn);
     return;
   }
 
-  // No more data to read.
-  // Happens after every msg?
-  if (nread == 0 && addr == NULL)
+  if (nread == 0)
     return;
 
-  // Never seems to happen on its own.
-  if (addr == NULL)
-    return;
+  conn->buf_len += nread;
 
-  hsk_rs_onrecv(
-    ns,
-    (uint8_t *)buf->base,
-    (size_t)nread,
-    (struct sockaddr *)addr,
-    (uint32_t)flags
-  );
+  uv_timer_again(&conn->timer);
+
+  const struct sockaddr *addr = (struct sockaddr *)&conn->addr;
+  size_t pos = 0;
+
+  conn->reading = true;
+
+  while (conn->buf_len - pos >= 2) {
+    size_t size = get_u16be(&conn->buf[pos]);
+
+    if (size == 0) {
+      hsk_rs_conn_close(conn);
+      return;
+    }
+
+    if (conn->buf_len - pos < 2 + size)
+      break;
+
+    uint64_t start = hsk_prof_start();
+
+    hsk_rs_onrecv(ns, &conn->buf[pos + 2], size, addr, conn, NULL);
+
+    hsk_prof_end(HSK_PROF_RS_TCP, start);
+
+    if (conn->closing)
+      return;
+
+    pos += 2 + size;
+  }
+
+  if (pos > 0) {
+    memmove(&conn->buf[0], &conn->buf[pos], conn->buf_len - pos);
+    conn->buf_len -= pos;
+  }
+
+  conn->reading = false;
+
+  hsk_rs_conn_flush(conn);
+}
+
+static void
+after_conn_write(uv_write_t *req, int status) {
+  hsk_rs_write_t *wr = (hsk_rs_write_t *)req->data;
+  hsk_rs_conn_t *conn = wr->conn;
+
+  hsk_rs_write_free(wr);
+
+  if (status != 0 && !conn->closing) {
+    hsk_rs_log(conn->ns, "tcp write error: %s\n", uv_strerror(status));
+    hsk_rs_conn_close(conn);
+  }
+
+  hsk_rs_conn_unref(conn);
+}
+
+static void
+after_conn_timeout(uv_timer_t *timer) {
+  hsk_rs_conn_close((hsk_rs_conn_t *)timer->data);
+}
+
+static void
+after_conn_close(uv_handle_t *handle) {
+  hsk_rs_conn_t *conn = (hsk_rs_conn_t *)handle->data;
+
+  conn->handles -= 1;
+
+  if (conn->handles == 0)
+    hsk_rs_conn_unref(conn);
 }
 
 static void
@@ -669,21 +1737,44 @@ after_poll(uv_poll_t *handle, int status, int events) {
   if (!ns)
     return;
 
-  if (status == 0 && (events & UV_READABLE))
+  if (status == 0 && (events & UV_READABLE)) {
+    uint64_t start = hsk_prof_start();
     ub_process(ns->ub);
+    hsk_prof_end(HSK_PROF_RS_POLL, start);
+  }
 }
 
+// Fans the answer out to every request that
+// joined the query.
 static void
 after_resolve(void *data, int status, struct ub_result *result) {
-  hsk_dns_req_t *req = (hsk_dns_req_t *)data;
-  hsk_rs_t *ns = (hsk_rs_t *)req->ns;
+  hsk_rs_pending_t *p = (hsk_rs_pending_t *)data;
+  hsk_rs_t *ns = p->ns;
+  hsk_rs_waiter_t *w;
 
   assert(ns);
 
-  hsk_rs_respond(ns, req, status, result);
-  hsk_dns_req_free(req);
+  hsk_map_del(&ns->pending, p->key);
+
+  for (w = p->head; w; w = w->next)
+    hsk_rs_respond(ns, w->req, status, result);
+
+  hsk_rs_pending_free(p);
   ub_resolve_free(result);
 }
 
 static void
 after_close(uv_handle_t *handle) {}
+
+// Runs on a worker's loop.
+static void
+after_stop(uv_async_t *handle) {
+  hsk_rs_t *ns = (hsk_rs_t *)handle->data;
+
+  uv_mutex_lock(&ns->lock);
+  bool running = ns->running;
+  uv_mutex_unlock(&ns->lock);
+
+  if (!running)
+    hsk_rs_close(ns);
+}
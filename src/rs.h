@@ -7,19 +7,68 @@
 
 #include <unbound.h>
 
+#include "affinity.h"
+#include "cache.h"
+#include "doq.h"
 #include "ec.h"
+#include "handoff.h"
+#include "map.h"
+#include "rrl.h"
+#include "trace.h"
+#include "udp.h"
 #include "uv.h"
 
+/*
+ * Defs
+ */
+
+// Extra threads answering recursive queries,
+// each with its own unbound context, loop and
+// SO_REUSEPORT socket. The answer cache is
+// split into shards (by TLD) shared by all of
+// them, with the default budget divided between
+// the shards.
+#define HSK_RS_WORKERS_MAX 64
+#define HSK_RS_SHARDS 16
+
+// DNS over TCP (RFC 7766): open connections,
+// and how long (ms) an idle one is kept.
+#define HSK_RS_TCP_MAX 256
+#define HSK_RS_TCP_TIMEOUT 10000
+
+// Replies to the queries in one read are
+// written together, this many at most.
+#define HSK_RS_TCP_BATCH 16
+
 /*
  * Types
  */
 
-typedef struct {
+typedef struct hsk_rs_shard_s {
+  uv_mutex_t lock;
+  hsk_cache_t cache;
+} hsk_rs_shard_t;
+
+typedef struct hsk_rs_s {
   uv_loop_t *loop;
   struct ub_ctx *ub;
-  uv_udp_t socket;
+  hsk_udp_t udp;
+  uv_tcp_t tcp;
+  void *conns;
+  int conn_count;
+  bool listening;
   uv_poll_t poll;
   hsk_ec_t *ec;
+  // Finalized answers (before SIG(0)), so that
+  // repeated queries skip unbound.
+  hsk_rs_shard_t *shards;
+  int shard_count;
+  // Outstanding resolutions by name, type and
+  // class, with every request waiting on each.
+  hsk_map_t pending;
+  hsk_rrl_t rrl;
+  // Freed requests, for the next query.
+  hsk_slab_t reqs;
   char config_[256];
   char *config;
   struct sockaddr_storage stub_;
@@ -27,10 +76,32 @@ typedef struct {
   uint8_t key_[32];
   uint8_t *key;
   uint8_t pubkey[33];
-  uint8_t read_buffer[4096];
+  bool unsigned_errors;
   bool bound;
-  bool receiving;
   bool polling;
+  struct hsk_rs_s *parent;
+  struct hsk_rs_s **workers;
+  int worker_count;
+  uv_loop_t loop_;
+  uv_thread_t thread;
+  uv_async_t async;
+  uv_mutex_t lock;
+  bool running;
+  // Every query as it arrived (shared).
+  hsk_capture_t *capture;
+  // Sockets to open on, if bound already.
+  hsk_handoff_t *handoff;
+  // Workers' CPUs, from `affinity_first` on,
+  // and this one's (-1 for unpinned).
+  const hsk_affinity_t *affinity;
+  int affinity_first;
+  int cpu;
+  // DNS over QUIC, on the parent's loop.
+  hsk_doq_t *doq;
+  struct sockaddr_storage doq_addr_;
+  struct sockaddr *doq_addr;
+  char doq_cert[256];
+  char doq_key[256];
 } hsk_rs_t;
 
 /*
@@ -46,12 +117,50 @@ hsk_rs_uninit(hsk_rs_t *ns);
 bool
 hsk_rs_set_config(hsk_rs_t *ns, const char *config);
 
+bool
+hsk_rs_check_config(const char *config);
+
 bool
 hsk_rs_set_key(hsk_rs_t *ns, const uint8_t *key);
 
+bool
+hsk_rs_set_stub(hsk_rs_t *ns, const struct sockaddr *stub);
+
+bool
+hsk_rs_set_workers(hsk_rs_t *ns, int count);
+
+bool
+hsk_rs_set_unsigned_errors(hsk_rs_t *ns, bool unsigned_errors);
+
+bool
+hsk_rs_set_rate_limit(hsk_rs_t *ns, uint32_t rate);
+
+bool
+hsk_rs_set_udp_buffers(hsk_rs_t *ns, int rcvbuf, int sndbuf);
+
+bool
+hsk_rs_set_capture(hsk_rs_t *ns, hsk_capture_t *capture);
+
+bool
+hsk_rs_set_handoff(hsk_rs_t *ns, hsk_handoff_t *handoff);
+
+bool
+hsk_rs_set_affinity(hsk_rs_t *ns, const hsk_affinity_t *aff, int first);
+
+bool
+hsk_rs_set_doq(
+  hsk_rs_t *ns,
+  const struct sockaddr *addr,
+  const char *cert,
+  const char *key
+);
+
 int
 hsk_rs_open(hsk_rs_t *ns, const struct sockaddr *addr);
 
+int
+hsk_rs_get_fds(const hsk_rs_t *ns, int *fds, int max);
+
 int
 hsk_rs_close(hsk_rs_t *ns);
 
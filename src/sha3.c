@@ -164,108 +164,86 @@ hsk_sha3_512_init(hsk_sha3_ctx *ctx) {
   hsk_keccak_init(ctx, 512);
 }
 
+// Theta, rho and pi fused, then chi, with the
+// state held in locals for the whole run.
 static void
-hsk_keccak_theta(uint64_t *A) {
-  unsigned int x;
-  uint64_t C[5], D[5];
-
-  for (x = 0; x < 5; x++)
-    C[x] = A[x] ^ A[x + 5] ^ A[x + 10] ^ A[x + 15] ^ A[x + 20];
-
-  D[0] = ROTL64(C[1], 1) ^ C[4];
-  D[1] = ROTL64(C[2], 1) ^ C[0];
-  D[2] = ROTL64(C[3], 1) ^ C[1];
-  D[3] = ROTL64(C[4], 1) ^ C[2];
-  D[4] = ROTL64(C[0], 1) ^ C[3];
-
-  for (x = 0; x < 5; x++) {
-    A[x] ^= D[x];
-    A[x + 5] ^= D[x];
-    A[x + 10] ^= D[x];
-    A[x + 15] ^= D[x];
-    A[x + 20] ^= D[x];
-  }
-}
-
-static void
-hsk_keccak_pi(uint64_t *A) {
-  uint64_t A1;
-  A1 = A[1];
-  A[1] = A[6];
-  A[6] = A[9];
-  A[9] = A[22];
-  A[22] = A[14];
-  A[14] = A[20];
-  A[20] = A[2];
-  A[2] = A[12];
-  A[12] = A[13];
-  A[13] = A[19];
-  A[19] = A[23];
-  A[23] = A[15];
-  A[15] = A[4];
-  A[4] = A[24];
-  A[24] = A[21];
-  A[21] = A[8];
-  A[8] = A[16];
-  A[16] = A[5];
-  A[5] = A[3];
-  A[3] = A[18];
-  A[18] = A[17];
-  A[17] = A[11];
-  A[11] = A[7];
-  A[7] = A[10];
-  A[10] = A1;
-}
+hsk_sha3_permutation(uint64_t *state) {
+  uint64_t A[25], B[25], C[5], D[5];
+  int round, i;
 
-static void
-hsk_keccak_chi(uint64_t *A) {
-  int i;
-  for (i = 0; i < 25; i += 5) {
-    uint64_t A0 = A[0 + i], A1 = A[1 + i];
-    A[0 + i] ^= ~A1 & A[2 + i];
-    A[1 + i] ^= ~A[2 + i] & A[3 + i];
-    A[2 + i] ^= ~A[3 + i] & A[4 + i];
-    A[3 + i] ^= ~A[4 + i] & A0;
-    A[4 + i] ^= ~A0 & A1;
-  }
-}
+  for (i = 0; i < 25; i++)
+    A[i] = state[i];
 
-static void
-hsk_sha3_permutation(uint64_t *state) {
-  int round;
   for (round = 0; round < HSK_SHA3_ROUNDS; round++) {
-    hsk_keccak_theta(state);
-
-    state[1] = ROTL64(state[1], 1);
-    state[2] = ROTL64(state[2], 62);
-    state[3] = ROTL64(state[3], 28);
-    state[4] = ROTL64(state[4], 27);
-    state[5] = ROTL64(state[5], 36);
-    state[6] = ROTL64(state[6], 44);
-    state[7] = ROTL64(state[7], 6);
-    state[8] = ROTL64(state[8], 55);
-    state[9] = ROTL64(state[9], 20);
-    state[10] = ROTL64(state[10], 3);
-    state[11] = ROTL64(state[11], 10);
-    state[12] = ROTL64(state[12], 43);
-    state[13] = ROTL64(state[13], 25);
-    state[14] = ROTL64(state[14], 39);
-    state[15] = ROTL64(state[15], 41);
-    state[16] = ROTL64(state[16], 45);
-    state[17] = ROTL64(state[17], 15);
-    state[18] = ROTL64(state[18], 21);
-    state[19] = ROTL64(state[19], 8);
-    state[20] = ROTL64(state[20], 18);
-    state[21] = ROTL64(state[21], 2);
-    state[22] = ROTL64(state[22], 61);
-    state[23] = ROTL64(state[23], 56);
-    state[24] = ROTL64(state[24], 14);
-
-    hsk_keccak_pi(state);
-    hsk_keccak_chi(state);
-
-    *state ^= hsk_keccak_round_constants[round];
+    C[0] = A[0] ^ A[5] ^ A[10] ^ A[15] ^ A[20];
+    C[1] = A[1] ^ A[6] ^ A[11] ^ A[16] ^ A[21];
+    C[2] = A[2] ^ A[7] ^ A[12] ^ A[17] ^ A[22];
+    C[3] = A[3] ^ A[8] ^ A[13] ^ A[18] ^ A[23];
+    C[4] = A[4] ^ A[9] ^ A[14] ^ A[19] ^ A[24];
+
+    D[0] = C[4] ^ ROTL64(C[1], 1);
+    D[1] = C[0] ^ ROTL64(C[2], 1);
+    D[2] = C[1] ^ ROTL64(C[3], 1);
+    D[3] = C[2] ^ ROTL64(C[4], 1);
+    D[4] = C[3] ^ ROTL64(C[0], 1);
+
+    B[0] = A[0] ^ D[0];
+    B[1] = ROTL64(A[6] ^ D[1], 44);
+    B[2] = ROTL64(A[12] ^ D[2], 43);
+    B[3] = ROTL64(A[18] ^ D[3], 21);
+    B[4] = ROTL64(A[24] ^ D[4], 14);
+    B[5] = ROTL64(A[3] ^ D[3], 28);
+    B[6] = ROTL64(A[9] ^ D[4], 20);
+    B[7] = ROTL64(A[10] ^ D[0], 3);
+    B[8] = ROTL64(A[16] ^ D[1], 45);
+    B[9] = ROTL64(A[22] ^ D[2], 61);
+    B[10] = ROTL64(A[1] ^ D[1], 1);
+    B[11] = ROTL64(A[7] ^ D[2], 6);
+    B[12] = ROTL64(A[13] ^ D[3], 25);
+    B[13] = ROTL64(A[19] ^ D[4], 8);
+    B[14] = ROTL64(A[20] ^ D[0], 18);
+    B[15] = ROTL64(A[4] ^ D[4], 27);
+    B[16] = ROTL64(A[5] ^ D[0], 36);
+    B[17] = ROTL64(A[11] ^ D[1], 10);
+    B[18] = ROTL64(A[17] ^ D[2], 15);
+    B[19] = ROTL64(A[23] ^ D[3], 56);
+    B[20] = ROTL64(A[2] ^ D[2], 62);
+    B[21] = ROTL64(A[8] ^ D[3], 55);
+    B[22] = ROTL64(A[14] ^ D[4], 39);
+    B[23] = ROTL64(A[15] ^ D[0], 41);
+    B[24] = ROTL64(A[21] ^ D[1], 2);
+
+    A[0] = B[0] ^ (~B[1] & B[2]);
+    A[1] = B[1] ^ (~B[2] & B[3]);
+    A[2] = B[2] ^ (~B[3] & B[4]);
+    A[3] = B[3] ^ (~B[4] & B[0]);
+    A[4] = B[4] ^ (~B[0] & B[1]);
+    A[5] = B[5] ^ (~B[6] & B[7]);
+    A[6] = B[6] ^ (~B[7] & B[8]);
+    A[7] = B[7] ^ (~B[8] & B[9]);
+    A[8] = B[8] ^ (~B[9] & B[5]);
+    A[9] = B[9] ^ (~B[5] & B[6]);
+    A[10] = B[10] ^ (~B[11] & B[12]);
+    A[11] = B[11] ^ (~B[12] & B[13]);
+    A[12] = B[12] ^ (~B[13] & B[14]);
+    A[13] = B[13] ^ (~B[14] & B[10]);
+    A[14] = B[14] ^ (~B[10] & B[11]);
+    A[15] = B[15] ^ (~B[16] & B[17]);
+    A[16] = B[16] ^ (~B[17] & B[18]);
+    A[17] = B[17] ^ (~B[18] & B[19]);
+    A[18] = B[18] ^ (~B[19] & B[15]);
+    A[19] = B[19] ^ (~B[15] & B[16]);
+    A[20] = B[20] ^ (~B[21] & B[22]);
+    A[21] = B[21] ^ (~B[22] & B[23]);
+    A[22] = B[22] ^ (~B[23] & B[24]);
+    A[23] = B[23] ^ (~B[24] & B[20]);
+    A[24] = B[24] ^ (~B[20] & B[21]);
+
+    A[0] ^= hsk_keccak_round_constants[round];
   }
+
+  for (i = 0; i < 25; i++)
+    state[i] = A[i];
 }
 
 static void
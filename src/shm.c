@@ -0,0 +1,549 @@
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "error.h"
+#include "shm.h"
+#include "utils.h"
+
+/*
+ * Helpers
+ */
+
+static inline void
+hsk_shm_count(uint64_t *counter) {
+  __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static hsk_shm_slot_t *
+hsk_shm_slot(const hsk_shm_t *shm, uint32_t hash, int way) {
+  uint64_t bucket = hash % shm->buckets;
+  size_t pos = sizeof(hsk_shm_header_t)
+             + (bucket * HSK_SHM_WAYS + way) * HSK_SHM_SLOT;
+
+  return (hsk_shm_slot_t *)&shm->base[pos];
+}
+
+static bool
+hsk_shm_key(
+  hsk_cache_key_t *ck,
+  uint8_t *kind,
+  const char *name,
+  uint16_t type
+) {
+  if (!hsk_cache_key_set(ck, name, type))
+    return false;
+
+  *kind = ck->ref ? HSK_SHM_REF : HSK_SHM_MSG;
+
+  // Referrals are one entry for every type.
+  if (ck->ref)
+    ck->type = 0;
+
+  return true;
+}
+
+static bool
+hsk_shm_resource_key(hsk_cache_key_t *ck, uint8_t *kind, const char *tld) {
+  char name[HSK_DNS_MAX_LABEL + 2];
+  size_t len = strlen(tld);
+
+  if (len == 0 || len > HSK_DNS_MAX_LABEL)
+    return false;
+
+  memcpy(name, tld, len);
+  name[len] = '.';
+  name[len + 1] = '\0';
+
+  if (!hsk_cache_key_set(ck, name, 0))
+    return false;
+
+  *kind = HSK_SHM_RESOURCE;
+
+  return true;
+}
+
+static bool
+hsk_shm_match(
+  const hsk_shm_slot_t *slot,
+  const hsk_cache_key_t *ck,
+  uint8_t kind,
+  const uint8_t *root
+) {
+  return slot->hash == ck->hash
+      && slot->type == ck->type
+      && slot->kind == kind
+      && slot->name_len == ck->name_len
+      && memcmp(slot->name, ck->name, ck->name_len) == 0
+      && (!root || memcmp(slot->root, root, 32) == 0);
+}
+
+// An odd slot whose writer will not finish:
+// its process is gone, or it has been at it
+// for too long. A slot just claimed and not
+// yet stamped is stamped here, so one whose
+// writer died in between still ages out.
+static bool
+hsk_shm_stale(hsk_shm_slot_t *slot, int64_t now) {
+  int64_t claimed = __atomic_load_n(&slot->claimed, __ATOMIC_ACQUIRE);
+
+  if (claimed == 0) {
+    __atomic_compare_exchange_n(&slot->claimed, &claimed, now, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  if (now - claimed >= HSK_SHM_STALE)
+    return true;
+
+  int32_t pid = __atomic_load_n(&slot->pid, __ATOMIC_RELAXED);
+
+  return pid > 0 && kill((pid_t)pid, 0) != 0 && errno == ESRCH;
+}
+
+// Makes the slot's sequence odd for us, from
+// even, or from odd if that write is stale.
+static bool
+hsk_shm_claim(hsk_shm_slot_t *slot, int64_t now, uint32_t *seq) {
+  uint32_t cur = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+  uint32_t next = cur + 1;
+
+  if (cur & 1) {
+    if (!hsk_shm_stale(slot, now))
+      return false;
+    next = cur + 2;
+  }
+
+  if (!__atomic_compare_exchange_n(&slot->seq, &cur, next, false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return false;
+  }
+
+  __atomic_store_n(&slot->pid, (int32_t)getpid(), __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->claimed, now, __ATOMIC_RELEASE);
+
+  *seq = next;
+
+  return true;
+}
+
+// Fails if the slot was taken over from us.
+static bool
+hsk_shm_release(hsk_shm_slot_t *slot, uint32_t seq) {
+  __atomic_store_n(&slot->pid, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->claimed, 0, __ATOMIC_RELAXED);
+
+  return __atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// Empties slots left mid-write by processes
+// that are gone. Run on open, under the lock.
+static void
+hsk_shm_sweep(hsk_shm_t *shm) {
+  int64_t now = hsk_now();
+  uint64_t count = shm->buckets * HSK_SHM_WAYS;
+  uint64_t i;
+
+  for (i = 0; i < count; i++) {
+    size_t pos = sizeof(hsk_shm_header_t) + i * HSK_SHM_SLOT;
+    hsk_shm_slot_t *slot = (hsk_shm_slot_t *)&shm->base[pos];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+    if (!(seq & 1) || !hsk_shm_claim(slot, now, &seq))
+      continue;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->hash = 0;
+    slot->expires = 0;
+    slot->data_len = 0;
+    slot->name_len = 0;
+
+    hsk_shm_release(slot, seq);
+  }
+}
+
+// Checked under the lock, before mapping the
+// rest.
+static bool
+hsk_shm_check(const hsk_shm_header_t *hdr, size_t size) {
+  if (hdr->magic != HSK_SHM_MAGIC
+      || hdr->version != HSK_SHM_VERSION
+      || hdr->slot_size != HSK_SHM_SLOT
+      || hdr->ways != HSK_SHM_WAYS
+      || hdr->buckets == 0) {
+    return false;
+  }
+
+  uint64_t need = hdr->buckets * HSK_SHM_WAYS * HSK_SHM_SLOT;
+
+  return need <= size - sizeof(hsk_shm_header_t);
+}
+
+/*
+ * Shared Cache
+ */
+
+void
+hsk_shm_init(hsk_shm_t *shm) {
+  assert(shm);
+  shm->base = NULL;
+  shm->size = 0;
+  shm->buckets = 0;
+  shm->hits = 0;
+  shm->misses = 0;
+  shm->stores = 0;
+  shm->busy = 0;
+}
+
+// Created at `size` by the first process,
+// attached to as it is by the rest.
+int
+hsk_shm_open(hsk_shm_t *shm, const char *path, size_t size) {
+  if (!shm || !path)
+    return HSK_EBADARGS;
+
+  size_t min = sizeof(hsk_shm_header_t) + HSK_SHM_WAYS * HSK_SHM_SLOT;
+
+  if (shm->base || size < min)
+    return HSK_EBADARGS;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+  if (fd < 0)
+    return HSK_EFAILURE;
+
+  int rc = HSK_EFAILURE;
+  uint8_t *base = MAP_FAILED;
+  struct stat st;
+
+  if (flock(fd, LOCK_EX) != 0)
+    goto done;
+
+  if (fstat(fd, &st) != 0)
+    goto done;
+
+  bool fresh = st.st_size == 0;
+
+  if (fresh) {
+    if (ftruncate(fd, (off_t)size) != 0)
+      goto done;
+  } else {
+    if ((uint64_t)st.st_size < min)
+      goto done;
+
+    size = (size_t)st.st_size;
+  }
+
+  base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (base == MAP_FAILED)
+    goto done;
+
+  hsk_shm_header_t *hdr = (hsk_shm_header_t *)base;
+
+  // Zeroed by ftruncate: every slot is empty.
+  if (fresh) {
+    hdr->version = HSK_SHM_VERSION;
+    hdr->slot_size = HSK_SHM_SLOT;
+    hdr->ways = HSK_SHM_WAYS;
+    hdr->buckets = (size - sizeof(hsk_shm_header_t))
+                 / (HSK_SHM_WAYS * HSK_SHM_SLOT);
+    __atomic_store_n(&hdr->magic, HSK_SHM_MAGIC, __ATOMIC_RELEASE);
+  }
+
+  if (!hsk_shm_check(hdr, size)) {
+    munmap(base, size);
+    goto done;
+  }
+
+  shm->base = base;
+  shm->size = size;
+  shm->buckets = hdr->buckets;
+
+  if (!fresh)
+    hsk_shm_sweep(shm);
+
+  rc = HSK_SUCCESS;
+
+done:
+  // The mapping outlives the descriptor.
+  flock(fd, LOCK_UN);
+  close(fd);
+  return rc;
+}
+
+void
+hsk_shm_close(hsk_shm_t *shm) {
+  assert(shm);
+
+  if (!shm->base)
+    return;
+
+  munmap(shm->base, shm->size);
+
+  shm->base = NULL;
+  shm->size = 0;
+  shm->buckets = 0;
+}
+
+static bool
+hsk_shm_lookup(
+  hsk_shm_t *shm,
+  const hsk_cache_key_t *ck,
+  uint8_t kind,
+  const uint8_t *root,
+  uint8_t *data,
+  size_t *data_len,
+  int64_t *time,
+  int64_t *expires
+) {
+  int64_t now = hsk_now();
+  int way;
+
+  for (way = 0; way < HSK_SHM_WAYS; way++) {
+    hsk_shm_slot_t *slot = hsk_shm_slot(shm, ck->hash, way);
+    int tries;
+
+    for (tries = 0; tries < HSK_SHM_RETRIES; tries++) {
+      uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+      if (seq & 1)
+        continue;
+
+      bool match = hsk_shm_match(slot, ck, kind, root);
+      size_t len = slot->data_len;
+      int64_t t = slot->time;
+      int64_t e = slot->expires;
+
+      if (match && len <= HSK_SHM_DATA)
+        memcpy(data, slot->data, len);
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+      if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+        continue;
+
+      if (!match || len > HSK_SHM_DATA || now >= e)
+        break;
+
+      *data_len = len;
+      *time = t;
+      *expires = e;
+
+      hsk_shm_count(&shm->hits);
+
+      return true;
+    }
+  }
+
+  hsk_shm_count(&shm->misses);
+
+  return false;
+}
+
+// Replaces the same key (under any root), or
+// else the bucket's entry closest to expiry.
+// Slots being written are passed over, unless
+// the write was abandoned.
+static bool
+hsk_shm_store(
+  hsk_shm_t *shm,
+  const hsk_cache_key_t *ck,
+  uint8_t kind,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  int64_t time,
+  int64_t expires
+) {
+  int64_t now = hsk_now();
+  hsk_shm_slot_t *victim = NULL;
+  int64_t oldest = 0;
+  int way;
+
+  // Racy, and only a hint: the slot is checked
+  // again once claimed.
+  for (way = 0; way < HSK_SHM_WAYS; way++) {
+    hsk_shm_slot_t *slot = hsk_shm_slot(shm, ck->hash, way);
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    bool busy = (seq & 1) && !hsk_shm_stale(slot, now);
+    int64_t e = (seq & 1) ? INT64_MIN : slot->expires;
+
+    // The same key: leave it to whoever is
+    // writing it.
+    if (hsk_shm_match(slot, ck, kind, NULL)) {
+      victim = busy ? NULL : slot;
+      break;
+    }
+
+    if (busy)
+      continue;
+
+    if (!victim || e < oldest) {
+      victim = slot;
+      oldest = e;
+    }
+  }
+
+  uint32_t seq;
+
+  if (!victim || !hsk_shm_claim(victim, now, &seq)) {
+    hsk_shm_count(&shm->busy);
+    return false;
+  }
+
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  victim->hash = ck->hash;
+  victim->time = time;
+  victim->expires = expires;
+  victim->type = ck->type;
+  victim->data_len = (uint16_t)data_len;
+  victim->name_len = ck->name_len;
+  victim->kind = kind;
+  memcpy(victim->root, root, 32);
+  memcpy(victim->name, ck->name, ck->name_len);
+
+  if (data_len > 0)
+    memcpy(victim->data, data, data_len);
+
+  if (!hsk_shm_release(victim, seq)) {
+    hsk_shm_count(&shm->busy);
+    return false;
+  }
+
+  hsk_shm_count(&shm->stores);
+
+  return true;
+}
+
+// Copies out a fresh message for the name and
+// type proven under `root`. `data` holds
+// HSK_SHM_DATA bytes.
+bool
+hsk_shm_get(
+  hsk_shm_t *shm,
+  const char *name,
+  uint16_t type,
+  const uint8_t *root,
+  uint8_t *data,
+  size_t *data_len,
+  int64_t *time,
+  int64_t *expires
+) {
+  assert(shm && name && root && data && data_len && time && expires);
+
+  if (!shm->base)
+    return false;
+
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+  uint8_t kind;
+
+  if (!hsk_shm_key(&ck, &kind, name, type))
+    return false;
+
+  return hsk_shm_lookup(shm, &ck, kind, root, data, data_len, time, expires);
+}
+
+bool
+hsk_shm_put(
+  hsk_shm_t *shm,
+  const char *name,
+  uint16_t type,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  int64_t time,
+  int64_t expires
+) {
+  assert(shm && name && root && data);
+
+  if (!shm->base || data_len > HSK_SHM_DATA)
+    return false;
+
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+  uint8_t kind;
+
+  if (!hsk_shm_key(&ck, &kind, name, type))
+    return false;
+
+  return hsk_shm_store(shm, &ck, kind, root, data, data_len, time, expires);
+}
+
+// The TLD's resource as proven under `root`
+// (empty for an ICANN TLD). `data` holds
+// HSK_SHM_DATA bytes.
+bool
+hsk_shm_get_resource(
+  hsk_shm_t *shm,
+  const char *tld,
+  const uint8_t *root,
+  uint8_t *data,
+  size_t *data_len,
+  int64_t *expires
+) {
+  assert(shm && tld && root && data && data_len && expires);
+
+  if (!shm->base)
+    return false;
+
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+  uint8_t kind;
+  int64_t time;
+
+  if (!hsk_shm_resource_key(&ck, &kind, tld))
+    return false;
+
+  return hsk_shm_lookup(shm, &ck, kind, root, data, data_len, &time, expires);
+}
+
+bool
+hsk_shm_put_resource(
+  hsk_shm_t *shm,
+  const char *tld,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  int64_t expires
+) {
+  assert(shm && tld && root);
+  assert(data || data_len == 0);
+
+  if (!shm->base || data_len > HSK_SHM_DATA)
+    return false;
+
+  uint8_t buf[HSK_DNS_MAX_NAME + 1];
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  ck.name = buf;
+  uint8_t kind;
+
+  if (!hsk_shm_resource_key(&ck, &kind, tld))
+    return false;
+
+  return hsk_shm_store(shm, &ck, kind, root, data, data_len,
+                       hsk_now(), expires);
+}
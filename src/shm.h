@@ -0,0 +1,155 @@
+#ifndef _HSK_SHM_H
+#define _HSK_SHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cache.h"
+
+// A cache of messages shared by every hnsd on
+// a host that maps the same file: a fixed
+// table of slots, HSK_SHM_WAYS to a bucket,
+// keyed as hsk_cache_t keys its messages (by
+// hsk_cache_key_set) and tagged with the tree
+// root they were proven under. Only lookups
+// under the same root hit.
+//
+// Each slot is a seqlock. Readers never wait:
+// they copy the slot out and retry if its
+// sequence moved meanwhile. A writer claims a
+// slot by making its sequence odd, and gives
+// up if another got there first. It stamps the
+// slot with its pid and the time, so a write
+// left unfinished (its process gone, or older
+// than HSK_SHM_STALE) can be taken over.
+//
+// Besides messages, slots hold the resources
+// of TLDs as proven (HSK_SHM_RESOURCE), which
+// answer every name below them. A file larger
+// than the in-memory caches, on disk, is then
+// a warm tier for the long tail: a hit costs a
+// page read rather than a proof.
+//
+// The file is trusted as the prefix is: only
+// its owner may open it.
+#define HSK_SHM_MAGIC 0x6d687368
+#define HSK_SHM_VERSION 2
+#define HSK_SHM_SIZE (64 << 20)
+#define HSK_SHM_SLOT 2048
+#define HSK_SHM_WAYS 4
+
+// Tries per slot before a lookup gives up.
+#define HSK_SHM_RETRIES 3
+
+// Seconds after which a write still going is
+// taken to have been abandoned.
+#define HSK_SHM_STALE 10
+
+// What a slot holds.
+#define HSK_SHM_MSG 0
+#define HSK_SHM_REF 1
+#define HSK_SHM_RESOURCE 2
+
+/*
+ * Types
+ */
+
+typedef struct hsk_shm_header_s {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_size;
+  uint32_t ways;
+  uint64_t buckets;
+  uint8_t padding[40];
+} hsk_shm_header_t;
+
+typedef struct hsk_shm_slot_s {
+  uint32_t seq;
+  uint32_t hash;
+  int64_t time;
+  int64_t expires;
+  // Who is writing the slot, and since when
+  // (zero when no one is).
+  int64_t claimed;
+  int32_t pid;
+  uint16_t type;
+  uint16_t data_len;
+  uint8_t name_len;
+  uint8_t kind;
+  uint8_t padding[2];
+  uint8_t root[32];
+  uint8_t name[HSK_DNS_MAX_NAME + 1];
+  uint8_t data[];
+} hsk_shm_slot_t;
+
+#define HSK_SHM_DATA (HSK_SHM_SLOT - sizeof(hsk_shm_slot_t))
+
+typedef struct hsk_shm_s {
+  uint8_t *base;
+  size_t size;
+  uint64_t buckets;
+  // This process's, updated atomically.
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+  uint64_t busy;
+} hsk_shm_t;
+
+/*
+ * Shared Cache
+ */
+
+void
+hsk_shm_init(hsk_shm_t *shm);
+
+int
+hsk_shm_open(hsk_shm_t *shm, const char *path, size_t size);
+
+void
+hsk_shm_close(hsk_shm_t *shm);
+
+bool
+hsk_shm_get(
+  hsk_shm_t *shm,
+  const char *name,
+  uint16_t type,
+  const uint8_t *root,
+  uint8_t *data,
+  size_t *data_len,
+  int64_t *time,
+  int64_t *expires
+);
+
+bool
+hsk_shm_put(
+  hsk_shm_t *shm,
+  const char *name,
+  uint16_t type,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  int64_t time,
+  int64_t expires
+);
+
+bool
+hsk_shm_get_resource(
+  hsk_shm_t *shm,
+  const char *tld,
+  const uint8_t *root,
+  uint8_t *data,
+  size_t *data_len,
+  int64_t *expires
+);
+
+bool
+hsk_shm_put_resource(
+  hsk_shm_t *shm,
+  const char *tld,
+  const uint8_t *root,
+  const uint8_t *data,
+  size_t data_len,
+  int64_t expires
+);
+#endif
@@ -10,6 +10,7 @@
 #include "blake2b.h"
 #include "dns.h"
 #include "ec.h"
+#include "mem.h"
 #include "sig0.h"
 #include "utils.h"
 
@@ -118,15 +119,16 @@ hsk_sig0_get_sig(
   return true;
 }
 
-bool
-hsk_sig0_sighash(const uint8_t *wire, size_t wire_len, uint8_t *hash) {
-  if (!hsk_sig0_has_sig(wire, wire_len))
-    return false;
-
-  uint16_t arcount = get_u16be(&wire[10]);
-  const uint8_t *rr = &wire[wire_len - HSK_SIG0_RR_SIZE];
-  const uint8_t *rd = &rr[11];
-
+// The SIG rdata without its signature, then
+// the message as it was before the record.
+static void
+hsk_sig0_hash(
+  const uint8_t *rd,
+  const uint8_t *wire,
+  size_t body_len,
+  uint16_t arcount,
+  uint8_t *hash
+) {
   // Decrement arcount.
   uint8_t count[2];
   set_u16be(&count[0], arcount - 1);
@@ -142,76 +144,77 @@ hsk_sig0_sighash(const uint8_t *wire, size_t wire_len, uint8_t *hash) {
   hsk_blake2b_update(&ctx, &count[0], 2);
 
   // Message body, stopping just before SIG record.
-  hsk_blake2b_update(&ctx, &wire[12], wire_len - 12 - HSK_SIG0_RR_SIZE);
+  hsk_blake2b_update(&ctx, &wire[12], body_len - 12);
 
   assert(hsk_blake2b_final(&ctx, hash, 32) == 0);
+}
+
+bool
+hsk_sig0_sighash(const uint8_t *wire, size_t wire_len, uint8_t *hash) {
+  if (!hsk_sig0_has_sig(wire, wire_len))
+    return false;
+
+  uint16_t arcount = get_u16be(&wire[10]);
+  const uint8_t *rr = &wire[wire_len - HSK_SIG0_RR_SIZE];
+  const uint8_t *rd = &rr[11];
+
+  hsk_sig0_hash(rd, wire, wire_len - HSK_SIG0_RR_SIZE, arcount, hash);
 
   return true;
 }
 
+// Everything in the record but the validity
+// window and the signature is fixed: the key
+// tag is zero and the signer is the root, so
+// one template serves every key.
+static const uint8_t hsk_sig0_rr[19] = {
+  // name = .
+  0x00,
+  // rr_type = SIG, rr_class = ANY
+  0x00, HSK_SIG0_TYPE, 0x00, HSK_SIG0_CLASS,
+  // rr_ttl = 0
+  0x00, 0x00, 0x00, 0x00,
+  // rd_len = 83
+  0x00, HSK_SIG0_RD_SIZE,
+  // type_covered = 0, algorithm = PRIVATEDNS
+  0x00, HSK_SIG0_ZERO, HSK_SIG0_ALG,
+  // labels = 0
+  0x00,
+  // orig_ttl = 0
+  0x00, 0x00, 0x00, 0x00
+};
+
+// Signs in place: the buffer holds wire_len
+// bytes of message and has room for size. A
+// signature already at the end is replaced;
+// otherwise one is appended, which needs
+// HSK_SIG0_RR_SIZE bytes of room.
 bool
-hsk_sig0_sign(
+hsk_sig0_sign_into(
   const hsk_ec_t *ec,
   const uint8_t *key,
-  const uint8_t *wire,
+  uint8_t *wire,
   size_t wire_len,
-  uint8_t **out,
+  size_t size,
   size_t *out_len
 ) {
   if (wire_len < 12)
     return false;
 
   uint16_t arcount = get_u16be(&wire[10]);
-  arcount += 1;
 
-  size_t o_len = wire_len + HSK_SIG0_RR_SIZE;
-
-  // Overwrite sigs. Do not append.
-  if (hsk_sig0_has_sig(wire, wire_len)) {
-    o_len -= HSK_SIG0_RR_SIZE;
+  if (hsk_sig0_has_sig(wire, wire_len))
     wire_len -= HSK_SIG0_RR_SIZE;
-    arcount -= 1;
-  }
+  else
+    arcount += 1;
 
-  uint8_t *o = malloc(o_len);
-
-  if (!o)
+  if (size < wire_len + HSK_SIG0_RR_SIZE)
     return false;
 
-  memcpy(o, wire, wire_len);
-
-  // arcount + 1
-  set_u16be(&o[10], arcount);
-
-  uint8_t *rr = &o[wire_len];
+  uint8_t *rr = &wire[wire_len];
   uint8_t *rd = &rr[11];
 
-  // name = .
-  set_u8(&rr[0], 0);
-
-  // rr_type = SIG
-  set_u16be(&rr[1], HSK_SIG0_TYPE);
-
-  // rr_class = ANY
-  set_u16be(&rr[3], HSK_SIG0_CLASS);
-
-  // rr_ttl = 0
-  set_u32be(&rr[5], 0);
-
-  // rd_len = 83
-  set_u16be(&rr[9], HSK_SIG0_RD_SIZE);
-
-  // type_covered = 0
-  set_u16be(&rd[0], HSK_SIG0_ZERO);
-
-  // algorithm = PRIVATEDNS
-  set_u8(&rd[2], HSK_SIG0_ALG);
-
-  // labels = 0
-  set_u8(&rd[3], 0);
-
-  // orig_ttl = 0
-  set_u32be(&rd[4], 0);
+  memcpy(rr, hsk_sig0_rr, sizeof(hsk_sig0_rr));
 
   uint32_t now = (uint32_t)hsk_now();
 
@@ -221,27 +224,53 @@ hsk_sig0_sign(
   // inception
   set_u32be(&rd[12], now - 6 * 60 * 60);
 
-  // key_tag
+  // key_tag = 0
   set_u16be(&rd[16], 0);
 
   // signer_name = .
   set_u8(&rd[18], 0);
 
-  // signature
-  memset(&rd[19], 0, 64);
-
   uint8_t hash[32];
 
-  if (!hsk_sig0_sighash(o, o_len, hash)) {
-    free(o);
-    return false;
-  }
+  hsk_sig0_hash(rd, wire, wire_len, arcount, hash);
 
   uint8_t *sig = &rd[19];
   int rec;
 
-  if (!hsk_ec_sign_msg(ec, key, hash, sig, &rec)) {
-    free(o);
+  if (!hsk_ec_sign_msg(ec, key, hash, sig, &rec))
+    return false;
+
+  // arcount + 1, last: a failure leaves the
+  // message as it was.
+  set_u16be(&wire[10], arcount);
+
+  *out_len = wire_len + HSK_SIG0_RR_SIZE;
+
+  return true;
+}
+
+bool
+hsk_sig0_sign(
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  const uint8_t *wire,
+  size_t wire_len,
+  uint8_t **out,
+  size_t *out_len
+) {
+  if (wire_len < 12)
+    return false;
+
+  size_t o_len = wire_len + HSK_SIG0_RR_SIZE;
+  uint8_t *o = hsk_malloc(o_len);
+
+  if (!o)
+    return false;
+
+  memcpy(o, wire, wire_len);
+
+  if (!hsk_sig0_sign_into(ec, key, o, wire_len, o_len, &o_len)) {
+    hsk_free(o);
     return false;
   }
 
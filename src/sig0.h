@@ -29,6 +29,16 @@ hsk_sig0_get_sig(
 bool
 hsk_sig0_sighash(const uint8_t *wire, size_t wire_len, uint8_t *hash);
 
+bool
+hsk_sig0_sign_into(
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  uint8_t *wire,
+  size_t wire_len,
+  size_t size,
+  size_t *out_len
+);
+
 bool
 hsk_sig0_sign(
   const hsk_ec_t *ec,
@@ -6,6 +6,11 @@
 
 #include "siphash.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HSK_SIPHASH_AVX2
+#include <immintrin.h>
+#endif
+
 #define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
 
 #define SIPROUND do { \
@@ -188,3 +193,80 @@ uint64_t
 hsk_siphash64k256(uint64_t num, const uint8_t *key) {
   return _siphash64k256(num, key);
 }
+
+#ifdef HSK_SIPHASH_AVX2
+
+// Four numbers at once, one per 64-bit lane.
+#define VROTL(x, b) \
+  _mm256_or_si256(_mm256_slli_epi64((x), (b)), _mm256_srli_epi64((x), 64 - (b)))
+
+#define VROTL32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+
+#define VSIPROUND do { \
+  v0 = _mm256_add_epi64(v0, v1); v1 = VROTL(v1, 13); \
+  v1 = _mm256_xor_si256(v1, v0); v0 = VROTL32(v0); \
+  v2 = _mm256_add_epi64(v2, v3); v3 = VROTL(v3, 16); \
+  v3 = _mm256_xor_si256(v3, v2); \
+  v0 = _mm256_add_epi64(v0, v3); v3 = VROTL(v3, 21); \
+  v3 = _mm256_xor_si256(v3, v0); \
+  v2 = _mm256_add_epi64(v2, v1); v1 = VROTL(v1, 17); \
+  v1 = _mm256_xor_si256(v1, v2); v2 = VROTL32(v2); \
+} while (0)
+
+__attribute__((target("avx2")))
+static void
+_siphash32k256_x4(const uint32_t *nums, const uint8_t *key, uint32_t *out) {
+  const __m256i f0 = _mm256_cvtepu32_epi64(
+    _mm_loadu_si128((const __m128i *)nums));
+  const __m256i f1 = _mm256_set1_epi64x(0xff);
+
+  __m256i v0 = _mm256_set1_epi64x(read64(key));
+  __m256i v1 = _mm256_set1_epi64x(read64(key + 8));
+  __m256i v2 = _mm256_set1_epi64x(read64(key + 16));
+  __m256i v3 = _mm256_set1_epi64x(read64(key + 24));
+
+  v3 = _mm256_xor_si256(v3, f0);
+  VSIPROUND;
+  VSIPROUND;
+  v0 = _mm256_xor_si256(v0, f0);
+  v2 = _mm256_xor_si256(v2, f1);
+  VSIPROUND;
+  VSIPROUND;
+  VSIPROUND;
+  VSIPROUND;
+  v0 = _mm256_xor_si256(v0, v1);
+  v0 = _mm256_xor_si256(v0, v2);
+  v0 = _mm256_xor_si256(v0, v3);
+
+  // Low halves of each lane.
+  __m256i lo = _mm256_permutevar8x32_epi32(
+    v0, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+
+  _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(lo));
+}
+
+#undef VROTL
+#undef VROTL32
+#undef VSIPROUND
+
+#endif // HSK_SIPHASH_AVX2
+
+void
+hsk_siphash32k256_many(
+  const uint32_t *nums,
+  size_t len,
+  const uint8_t *key,
+  uint32_t *out
+) {
+  size_t i = 0;
+
+#ifdef HSK_SIPHASH_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    for (; i + 4 <= len; i += 4)
+      _siphash32k256_x4(&nums[i], key, &out[i]);
+  }
+#endif
+
+  for (; i < len; i++)
+    out[i] = _siphash64k256((uint64_t)nums[i], key);
+}
@@ -19,4 +19,12 @@ hsk_siphash32k256(uint32_t num, const uint8_t *key);
 uint64_t
 hsk_siphash64k256(uint64_t num, const uint8_t *key);
 
+void
+hsk_siphash32k256_many(
+  const uint32_t *nums,
+  size_t len,
+  const uint8_t *key,
+  uint32_t *out
+);
+
 #endif
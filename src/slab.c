@@ -0,0 +1,80 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "mem.h"
+#include "slab.h"
+
+// Free objects store the link in their first
+// bytes, so every object must fit a pointer.
+typedef struct hsk_slab_link_s {
+  struct hsk_slab_link_s *next;
+} hsk_slab_link_t;
+
+void
+hsk_slab_init(hsk_slab_t *slab, size_t size, size_t max) {
+  assert(slab);
+
+  if (size < sizeof(hsk_slab_link_t))
+    size = sizeof(hsk_slab_link_t);
+
+  slab->size = size;
+  slab->max = max;
+  slab->head = NULL;
+  slab->count = 0;
+  slab->allocs = 0;
+  slab->reused = 0;
+}
+
+void
+hsk_slab_uninit(hsk_slab_t *slab) {
+  if (!slab)
+    return;
+
+  hsk_slab_link_t *link, *next;
+
+  for (link = slab->head; link; link = next) {
+    next = link->next;
+    hsk_free(link);
+  }
+
+  slab->head = NULL;
+  slab->count = 0;
+}
+
+void *
+hsk_slab_alloc(hsk_slab_t *slab) {
+  hsk_slab_link_t *link = (hsk_slab_link_t *)slab->head;
+
+  slab->allocs += 1;
+
+  if (!link)
+    return hsk_malloc(slab->size);
+
+  slab->head = (void *)link->next;
+  slab->count -= 1;
+  slab->reused += 1;
+
+  return (void *)link;
+}
+
+void
+hsk_slab_free(hsk_slab_t *slab, void *ptr) {
+  if (!ptr)
+    return;
+
+  if (slab->count >= slab->max) {
+    hsk_free(ptr);
+    return;
+  }
+
+  hsk_slab_link_t *link = (hsk_slab_link_t *)ptr;
+
+  link->next = (hsk_slab_link_t *)slab->head;
+
+  slab->head = (void *)link;
+  slab->count += 1;
+}
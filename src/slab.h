@@ -0,0 +1,31 @@
+#ifndef _HSK_SLAB_H
+#define _HSK_SLAB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// A free list of fixed size objects. Freed
+// objects are kept (up to `max`) and handed
+// back out before falling back to malloc.
+typedef struct hsk_slab_s {
+  size_t size;
+  size_t max;
+  void *head;
+  size_t count;
+  uint64_t allocs;
+  uint64_t reused;
+} hsk_slab_t;
+
+void
+hsk_slab_init(hsk_slab_t *slab, size_t size, size_t max);
+
+void
+hsk_slab_uninit(hsk_slab_t *slab);
+
+void *
+hsk_slab_alloc(hsk_slab_t *slab);
+
+void
+hsk_slab_free(hsk_slab_t *slab, void *ptr);
+#endif
@@ -0,0 +1,264 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "bio.h"
+#include "constants.h"
+#include "entry.h"
+#include "error.h"
+#include "mem.h"
+#include "store.h"
+
+/*
+ * Helpers
+ */
+
+static bool
+hsk_store_pread(int fd, uint8_t *data, size_t size, off_t pos) {
+  while (size > 0) {
+    ssize_t n = pread(fd, data, size, pos);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    data += n;
+    size -= n;
+    pos += n;
+  }
+
+  return true;
+}
+
+static bool
+hsk_store_pwrite(int fd, const uint8_t *data, size_t size, off_t pos) {
+  while (size > 0) {
+    ssize_t n = pwrite(fd, data, size, pos);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    data += n;
+    size -= n;
+    pos += n;
+  }
+
+  return true;
+}
+
+static off_t
+hsk_store_offset(uint32_t height) {
+  return (off_t)HSK_STORE_HDR_SIZE + (off_t)height * HSK_STORE_REC_SIZE;
+}
+
+/*
+ * Store
+ */
+
+static int
+hsk_store_reset(hsk_store_t *store, int fd);
+
+void
+hsk_store_init(hsk_store_t *store) {
+  assert(store);
+  store->fd = -1;
+  store->height = 0;
+  memset(store->tip, 0, 32);
+}
+
+void
+hsk_store_uninit(hsk_store_t *store) {
+  assert(store);
+  hsk_store_close(store);
+}
+
+hsk_store_t *
+hsk_store_alloc(void) {
+  hsk_store_t *store = hsk_malloc(sizeof(hsk_store_t));
+  if (store)
+    hsk_store_init(store);
+  return store;
+}
+
+void
+hsk_store_free(hsk_store_t *store) {
+  if (!store)
+    return;
+
+  hsk_store_uninit(store);
+  hsk_free(store);
+}
+
+int
+hsk_store_open(hsk_store_t *store, const char *prefix) {
+  if (!store || !prefix)
+    return HSK_EBADARGS;
+
+  assert(store->fd == -1);
+
+  char path[1024];
+
+  if (strlen(prefix) + sizeof(HSK_STORE_FILE) + 1 > sizeof(path))
+    return HSK_EBADARGS;
+
+  if (mkdir(prefix, 0755) != 0 && errno != EEXIST)
+    return HSK_EFAILURE;
+
+  sprintf(path, "%s/%s", prefix, HSK_STORE_FILE);
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+  if (fd == -1)
+    return HSK_EFAILURE;
+
+  uint8_t raw[HSK_STORE_HDR_SIZE];
+
+  if (!hsk_store_pread(fd, raw, sizeof(raw), 0))
+    return hsk_store_reset(store, fd);
+
+  uint8_t *data = raw;
+  size_t data_len = sizeof(raw);
+  uint32_t magic, version, network;
+
+  read_u32(&data, &data_len, &magic);
+  read_u32(&data, &data_len, &version);
+  read_u32(&data, &data_len, &network);
+
+  if (magic != HSK_STORE_MAGIC || network != HSK_MAGIC) {
+    close(fd);
+    return HSK_EENCODING;
+  }
+
+  // Older record layout: resync.
+  if (version != HSK_STORE_VERSION)
+    return hsk_store_reset(store, fd);
+
+  store->fd = fd;
+
+  read_u32(&data, &data_len, &store->height);
+  read_bytes(&data, &data_len, store->tip, 32);
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_store_close(hsk_store_t *store) {
+  assert(store);
+
+  if (store->fd == -1)
+    return;
+
+  fsync(store->fd);
+  close(store->fd);
+
+  store->fd = -1;
+}
+
+bool
+hsk_store_read(
+  const hsk_store_t *store,
+  uint32_t height,
+  hsk_entry_t *entry
+) {
+  assert(store && entry);
+
+  if (store->fd == -1)
+    return false;
+
+  uint8_t raw[HSK_STORE_REC_SIZE];
+
+  if (!hsk_store_pread(store->fd, raw, sizeof(raw), hsk_store_offset(height)))
+    return false;
+
+  hsk_entry_init(entry);
+
+  if (!hsk_entry_decode(raw, sizeof(raw), entry))
+    return false;
+
+  entry->height = height;
+
+  return true;
+}
+
+bool
+hsk_store_write(hsk_store_t *store, const hsk_entry_t *entry) {
+  assert(store && entry);
+
+  if (store->fd == -1)
+    return false;
+
+  uint8_t raw[HSK_STORE_REC_SIZE];
+  uint8_t *data = raw;
+
+  memset(raw, 0, sizeof(raw));
+
+  assert(HSK_ENTRY_SIZE <= HSK_STORE_REC_SIZE);
+
+  hsk_entry_write(entry, &data);
+
+  return hsk_store_pwrite(store->fd, raw, sizeof(raw),
+                          hsk_store_offset(entry->height));
+}
+
+bool
+hsk_store_set_tip(hsk_store_t *store, uint32_t height, const uint8_t *hash) {
+  assert(store && hash);
+
+  if (store->fd == -1)
+    return false;
+
+  uint8_t raw[HSK_STORE_HDR_SIZE];
+  uint8_t *data = raw;
+
+  memset(raw, 0, sizeof(raw));
+
+  write_u32(&data, HSK_STORE_MAGIC);
+  write_u32(&data, HSK_STORE_VERSION);
+  write_u32(&data, HSK_MAGIC);
+  write_u32(&data, height);
+  write_bytes(&data, hash, 32);
+
+  if (!hsk_store_pwrite(store->fd, raw, sizeof(raw), 0))
+    return false;
+
+  store->height = height;
+  memcpy(store->tip, hash, 32);
+
+  return true;
+}
+
+static int
+hsk_store_reset(hsk_store_t *store, int fd) {
+  // Fresh file (or a torn header write).
+  // Start over with an empty store.
+  if (ftruncate(fd, 0) != 0) {
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  store->fd = fd;
+  store->height = 0;
+  memset(store->tip, 0, 32);
+
+  if (!hsk_store_set_tip(store, 0, HSK_ZERO_HASH)) {
+    hsk_store_close(store);
+    return HSK_EFAILURE;
+  }
+
+  return HSK_SUCCESS;
+}
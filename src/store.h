@@ -0,0 +1,71 @@
+#ifndef _HSK_STORE_H
+#define _HSK_STORE_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "entry.h"
+
+/*
+ * Defs
+ */
+
+#define HSK_STORE_MAGIC 0x6b736868
+#define HSK_STORE_VERSION 2
+#define HSK_STORE_FILE "headers.dat"
+
+// File header: magic, version, network magic,
+// tip height and tip hash, padded to 64 bytes.
+#define HSK_STORE_HDR_SIZE 64
+
+// Serialized entry (108 bytes) rounded up.
+// Records are fixed-size and indexed by height,
+// so the file can be read or mapped directly.
+#define HSK_STORE_REC_SIZE 112
+
+/*
+ * Types
+ */
+
+typedef struct hsk_store_s {
+  int fd;
+  uint32_t height;
+  uint8_t tip[32];
+} hsk_store_t;
+
+/*
+ * Store
+ */
+
+void
+hsk_store_init(hsk_store_t *store);
+
+void
+hsk_store_uninit(hsk_store_t *store);
+
+hsk_store_t *
+hsk_store_alloc(void);
+
+void
+hsk_store_free(hsk_store_t *store);
+
+int
+hsk_store_open(hsk_store_t *store, const char *prefix);
+
+void
+hsk_store_close(hsk_store_t *store);
+
+bool
+hsk_store_read(
+  const hsk_store_t *store,
+  uint32_t height,
+  hsk_entry_t *entry
+);
+
+bool
+hsk_store_write(hsk_store_t *store, const hsk_entry_t *entry);
+
+bool
+hsk_store_set_tip(hsk_store_t *store, uint32_t height, const uint8_t *hash);
+#endif
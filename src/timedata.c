@@ -8,7 +8,9 @@
 
 #include "addr.h"
 #include "error.h"
+#include "log.h"
 #include "map.h"
+#include "mem.h"
 #include "timedata.h"
 #include "utils.h"
 
@@ -19,7 +21,7 @@ hsk_timedata_init(hsk_timedata_t *td) {
 
   td->sample_len = 0;
   memset(td->samples, 0, sizeof(int64_t) * HSK_TIMEDATA_LIMIT);
-  hsk_map_init_map(&td->known, hsk_addr_hash, hsk_addr_equal, free);
+  hsk_map_init_map(&td->known, hsk_addr_hash, hsk_addr_equal, hsk_free);
   td->offset = 0;
   td->checked = false;
 
@@ -36,7 +38,7 @@ hsk_timedata_uninit(hsk_timedata_t *td) {
 
 hsk_timedata_t *
 hsk_timedata_alloc(void) {
-  hsk_timedata_t *td = malloc(sizeof(hsk_timedata_t));
+  hsk_timedata_t *td = hsk_malloc(sizeof(hsk_timedata_t));
   hsk_timedata_init(td);
   return td;
 }
@@ -47,19 +49,19 @@ hsk_timedata_free(hsk_timedata_t *td) {
     return;
 
   hsk_timedata_uninit(td);
-  free(td);
+  hsk_free(td);
 }
 
 static void
 hsk_timedata_log(hsk_timedata_t *td, const char *fmt, ...) {
-  printf("timedata: ");
-
   va_list args;
   va_start(args, fmt);
-  vprintf(fmt, args);
+  hsk_log_vprintf("timedata: ", fmt, args);
   va_end(args);
 }
 
+// Samples are kept sorted, so the median is
+// read straight off the middle.
 static void
 hsk_timedata_insert(hsk_timedata_t *td, int64_t sample) {
   int start = 0;
@@ -86,9 +88,8 @@ hsk_timedata_insert(hsk_timedata_t *td, int64_t sample) {
 
   assert(td->sample_len + 1 <= HSK_TIMEDATA_LIMIT);
 
-  int j;
-  for (j = i + 1; j < td->sample_len + 1; j++)
-    td->samples[j] = td->samples[j - 1];
+  memmove(&td->samples[i + 1], &td->samples[i],
+          (td->sample_len - i) * sizeof(int64_t));
 
   td->samples[i] = sample;
   td->sample_len += 1;
@@ -108,7 +109,7 @@ hsk_timedata_add(hsk_timedata_t *td, const hsk_addr_t *addr, int64_t time) {
     return HSK_ENOMEM;
 
   if (!hsk_map_set(&td->known, (void *)id, (void *)id)) {
-    free(id);
+    hsk_free(id);
     return HSK_ENOMEM;
   }
 
@@ -141,7 +142,7 @@ hsk_timedata_add(hsk_timedata_t *td, const hsk_addr_t *addr, int64_t time) {
 
         if (!match) {
           td->checked = true;
-          hsk_timedata_log(td, "WARNING: timing mismatch!");
+          hsk_timedata_log(td, "WARNING: timing mismatch!\n");
         }
       }
 
@@ -151,8 +152,9 @@ hsk_timedata_add(hsk_timedata_t *td, const hsk_addr_t *addr, int64_t time) {
     td->offset = median;
 
     hsk_timedata_log(td, "added new time sample\n");
-    hsk_timedata_log(td, "  new adjusted time: %d\n", hsk_timedata_now(td));
-    hsk_timedata_log(td, "  offset: %d\n", td->offset);
+    hsk_timedata_log(td, "  new adjusted time: %lld\n",
+                     (long long)hsk_timedata_now(td));
+    hsk_timedata_log(td, "  offset: %lld\n", (long long)td->offset);
   }
 
   return HSK_SUCCESS;
@@ -0,0 +1,344 @@
+#include "config.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "map.h"
+#include "mem.h"
+#include "top.h"
+#include "uv.h"
+
+/*
+ * Helpers
+ */
+
+static void
+hsk_top_swap(hsk_top_t *top, int a, int b) {
+  int x = top->heap[a];
+  int y = top->heap[b];
+
+  top->heap[a] = y;
+  top->heap[b] = x;
+  top->entries[y].pos = a;
+  top->entries[x].pos = b;
+}
+
+static uint64_t
+hsk_top_at(const hsk_top_t *top, int pos) {
+  return top->entries[top->heap[pos]].count;
+}
+
+static void
+hsk_top_up(hsk_top_t *top, int pos) {
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+
+    if (hsk_top_at(top, parent) <= hsk_top_at(top, pos))
+      break;
+
+    hsk_top_swap(top, parent, pos);
+    pos = parent;
+  }
+}
+
+// Counts only grow: an entry only moves down.
+static void
+hsk_top_down(hsk_top_t *top, int pos) {
+  for (;;) {
+    int left = pos * 2 + 1;
+    int right = left + 1;
+    int min = pos;
+
+    if (left < top->count && hsk_top_at(top, left) < hsk_top_at(top, min))
+      min = left;
+
+    if (right < top->count && hsk_top_at(top, right) < hsk_top_at(top, min))
+      min = right;
+
+    if (min == pos)
+      break;
+
+    hsk_top_swap(top, pos, min);
+    pos = min;
+  }
+}
+
+static int
+hsk_top_find(const hsk_top_t *top, const char *key, uint32_t hash) {
+  int i = top->buckets[hash & top->bucket_mask];
+
+  while (i != -1) {
+    const hsk_top_entry_t *e = &top->entries[i];
+
+    if (e->hash == hash && strcmp(e->key, key) == 0)
+      return i;
+
+    i = e->next;
+  }
+
+  return -1;
+}
+
+static void
+hsk_top_link(hsk_top_t *top, int i) {
+  int *head = &top->buckets[top->entries[i].hash & top->bucket_mask];
+
+  top->entries[i].next = *head;
+  *head = i;
+}
+
+static void
+hsk_top_unlink(hsk_top_t *top, int i) {
+  int *link = &top->buckets[top->entries[i].hash & top->bucket_mask];
+
+  while (*link != i) {
+    assert(*link != -1);
+    link = &top->entries[*link].next;
+  }
+
+  *link = top->entries[i].next;
+}
+
+// The heap's order holds.
+static void
+hsk_top_halve(hsk_top_t *top) {
+  for (int i = 0; i < top->count; i++) {
+    top->entries[i].count /= 2;
+    top->entries[i].error /= 2;
+  }
+
+  top->total /= 2;
+}
+
+static int
+hsk_top_cmp_count(const void *a, const void *b) {
+  const hsk_top_item_t *x = (const hsk_top_item_t *)a;
+  const hsk_top_item_t *y = (const hsk_top_item_t *)b;
+
+  if (x->count != y->count)
+    return x->count > y->count ? -1 : 1;
+
+  return strcmp(x->key, y->key);
+}
+
+static int
+hsk_top_cmp_key(const void *a, const void *b) {
+  const hsk_top_item_t *x = (const hsk_top_item_t *)a;
+  const hsk_top_item_t *y = (const hsk_top_item_t *)b;
+
+  return strcmp(x->key, y->key);
+}
+
+/*
+ * Heavy Hitters
+ */
+
+int
+hsk_top_init(hsk_top_t *top, int size, uint64_t window) {
+  if (!top || size <= 0)
+    return HSK_EBADARGS;
+
+  int buckets = 1;
+
+  // About two buckets an entry.
+  while (buckets < size * 2)
+    buckets <<= 1;
+
+  top->entries = hsk_calloc(size, sizeof(hsk_top_entry_t));
+  top->heap = hsk_calloc(size, sizeof(int));
+  top->buckets = hsk_malloc(buckets * sizeof(int));
+  top->bucket_mask = buckets - 1;
+  top->size = size;
+  top->count = 0;
+  top->total = 0;
+  top->window = window;
+  top->added = 0;
+
+  if (!top->entries || !top->heap || !top->buckets)
+    goto fail;
+
+  if (uv_mutex_init(&top->lock) != 0)
+    goto fail;
+
+  for (int i = 0; i < buckets; i++)
+    top->buckets[i] = -1;
+
+  return HSK_SUCCESS;
+
+fail:
+  hsk_free(top->entries);
+  hsk_free(top->heap);
+  hsk_free(top->buckets);
+  top->entries = NULL;
+  top->heap = NULL;
+  top->buckets = NULL;
+  return HSK_ENOMEM;
+}
+
+void
+hsk_top_uninit(hsk_top_t *top) {
+  if (!top || !top->entries)
+    return;
+
+  uv_mutex_destroy(&top->lock);
+
+  hsk_free(top->entries);
+  hsk_free(top->heap);
+  hsk_free(top->buckets);
+
+  top->entries = NULL;
+  top->heap = NULL;
+  top->buckets = NULL;
+  top->count = 0;
+}
+
+void
+hsk_top_add(hsk_top_t *top, const char *key) {
+  char lower[HSK_TOP_KEY];
+  size_t len = strlen(key);
+
+  if (len == 0 || len >= sizeof(lower))
+    return;
+
+  for (size_t k = 0; k <= len; k++)
+    lower[k] = tolower((unsigned char)key[k]);
+
+  uint32_t hash = hsk_map_murmur3((uint8_t *)lower, len, 0xfba4c795);
+
+  uv_mutex_lock(&top->lock);
+
+  top->total += 1;
+  top->added += 1;
+
+  if (top->window > 0 && top->added >= top->window) {
+    hsk_top_halve(top);
+    top->added = 0;
+  }
+
+  int i = hsk_top_find(top, lower, hash);
+
+  if (i != -1) {
+    top->entries[i].count += 1;
+    hsk_top_down(top, top->entries[i].pos);
+    uv_mutex_unlock(&top->lock);
+    return;
+  }
+
+  bool fresh = top->count < top->size;
+  hsk_top_entry_t *e;
+
+  if (fresh) {
+    i = top->count;
+    e = &top->entries[i];
+    e->count = 1;
+    e->error = 0;
+    e->pos = top->count;
+    top->heap[top->count] = i;
+    top->count += 1;
+  } else {
+    // Takes over the least counted.
+    i = top->heap[0];
+    e = &top->entries[i];
+    hsk_top_unlink(top, i);
+    e->error = e->count;
+    e->count += 1;
+  }
+
+  e->hash = hash;
+  memcpy(e->key, lower, len + 1);
+
+  hsk_top_link(top, i);
+
+  if (fresh)
+    hsk_top_up(top, e->pos);
+  else
+    hsk_top_down(top, e->pos);
+
+  uv_mutex_unlock(&top->lock);
+}
+
+// Halves every count (and error).
+void
+hsk_top_decay(hsk_top_t *top) {
+  uv_mutex_lock(&top->lock);
+  hsk_top_halve(top);
+  uv_mutex_unlock(&top->lock);
+}
+
+uint64_t
+hsk_top_total(hsk_top_t *top) {
+  uv_mutex_lock(&top->lock);
+  uint64_t total = top->total;
+  uv_mutex_unlock(&top->lock);
+  return total;
+}
+
+// Most counted first, up to max (decayed to
+// nothing are left out).
+int
+hsk_top_list(hsk_top_t *top, hsk_top_item_t *items, int max) {
+  hsk_top_item_t *all = hsk_malloc(top->size * sizeof(hsk_top_item_t));
+  int count = 0;
+
+  if (!all)
+    return 0;
+
+  uv_mutex_lock(&top->lock);
+
+  for (int i = 0; i < top->count; i++) {
+    const hsk_top_entry_t *e = &top->entries[i];
+
+    if (e->count == 0)
+      continue;
+
+    strcpy(all[count].key, e->key);
+    all[count].count = e->count;
+    all[count].error = e->error;
+    count += 1;
+  }
+
+  uv_mutex_unlock(&top->lock);
+
+  qsort(all, count, sizeof(hsk_top_item_t), hsk_top_cmp_count);
+
+  if (count > max)
+    count = max;
+
+  memcpy(items, all, count * sizeof(hsk_top_item_t));
+
+  hsk_free(all);
+
+  return count;
+}
+
+// Lists from several trackers, concatenated,
+// become one: counts (and errors) of the same
+// key are summed, most counted first.
+int
+hsk_top_merge(hsk_top_item_t *items, int count) {
+  int out = 0;
+
+  qsort(items, count, sizeof(hsk_top_item_t), hsk_top_cmp_key);
+
+  for (int i = 0; i < count; i++) {
+    if (out > 0 && strcmp(items[out - 1].key, items[i].key) == 0) {
+      items[out - 1].count += items[i].count;
+      items[out - 1].error += items[i].error;
+      continue;
+    }
+
+    if (out != i)
+      items[out] = items[i];
+
+    out += 1;
+  }
+
+  qsort(items, out, sizeof(hsk_top_item_t), hsk_top_cmp_count);
+
+  return out;
+}
@@ -0,0 +1,86 @@
+#ifndef _HSK_TOP_H
+#define _HSK_TOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "uv.h"
+
+// The most frequent keys of a stream, in fixed
+// space (Space-Saving, Metwally et al.). Each
+// of `size` counters holds a key, its count
+// and an error: how much of the count may
+// belong to the key it replaced. A new key
+// takes the least counted one and its count,
+// plus one. Any key seen more than total/size
+// times is sure to be held, and its count is
+// off by no more than its error.
+//
+// Keys are names, compared without case.
+// Given a window, counts are halved each time
+// that many keys have been added, so that the
+// ranking follows recent traffic. Locked, so
+// that any thread may read while one adds.
+#define HSK_TOP_KEY 256
+
+/*
+ * Types
+ */
+
+typedef struct hsk_top_entry_s {
+  uint64_t count;
+  uint64_t error;
+  uint32_t hash;
+  // Position in the heap, and the next entry
+  // in the bucket (or -1).
+  int pos;
+  int next;
+  char key[HSK_TOP_KEY];
+} hsk_top_entry_t;
+
+typedef struct hsk_top_s {
+  uv_mutex_t lock;
+  hsk_top_entry_t *entries;
+  // Least counted first.
+  int *heap;
+  int *buckets;
+  int bucket_mask;
+  int size;
+  int count;
+  uint64_t total;
+  uint64_t window;
+  uint64_t added;
+} hsk_top_t;
+
+typedef struct hsk_top_item_s {
+  char key[HSK_TOP_KEY];
+  uint64_t count;
+  uint64_t error;
+} hsk_top_item_t;
+
+/*
+ * Heavy Hitters
+ */
+
+int
+hsk_top_init(hsk_top_t *top, int size, uint64_t window);
+
+void
+hsk_top_uninit(hsk_top_t *top);
+
+void
+hsk_top_add(hsk_top_t *top, const char *key);
+
+void
+hsk_top_decay(hsk_top_t *top);
+
+uint64_t
+hsk_top_total(hsk_top_t *top);
+
+int
+hsk_top_list(hsk_top_t *top, hsk_top_item_t *items, int max);
+
+int
+hsk_top_merge(hsk_top_item_t *items, int count);
+#endif
@@ -0,0 +1,329 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "addr.h"
+#include "bio.h"
+#include "error.h"
+#include "mem.h"
+#include "trace.h"
+#include "uv.h"
+
+/*
+ * Tracer
+ */
+
+int
+hsk_tracer_init(hsk_tracer_t *t) {
+  assert(t);
+
+  t->ring = NULL;
+  t->pos = 0;
+  t->count = 0;
+  t->rate = 0;
+  t->seen = 0;
+
+  if (uv_mutex_init(&t->lock) != 0)
+    return HSK_EFAILURE;
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_tracer_uninit(hsk_tracer_t *t) {
+  assert(t);
+
+  hsk_free(t->ring);
+  t->ring = NULL;
+
+  uv_mutex_destroy(&t->lock);
+}
+
+// One in every `rate` queries is traced (none
+// for 0). Set before any thread is answering.
+bool
+hsk_tracer_set_rate(hsk_tracer_t *t, uint32_t rate) {
+  assert(t);
+
+  if (rate > 0 && !t->ring) {
+    t->ring = hsk_malloc(HSK_TRACE_SIZE * sizeof(hsk_trace_t));
+
+    if (!t->ring)
+      return false;
+  }
+
+  t->rate = rate;
+
+  return true;
+}
+
+hsk_trace_t *
+hsk_tracer_sample(hsk_tracer_t *t) {
+  if (t->rate == 0)
+    return NULL;
+
+  uint64_t n = __atomic_fetch_add(&t->seen, 1, __ATOMIC_RELAXED);
+
+  if (n % t->rate != 0)
+    return NULL;
+
+  return hsk_calloc(1, sizeof(hsk_trace_t));
+}
+
+void
+hsk_tracer_push(hsk_tracer_t *t, const hsk_trace_t *trace) {
+  assert(t && trace);
+
+  if (!t->ring)
+    return;
+
+  uv_mutex_lock(&t->lock);
+
+  memcpy(&t->ring[t->pos], trace, sizeof(hsk_trace_t));
+
+  t->pos = (t->pos + 1) % HSK_TRACE_SIZE;
+
+  if (t->count < HSK_TRACE_SIZE)
+    t->count += 1;
+
+  uv_mutex_unlock(&t->lock);
+}
+
+// Appends what has been recorded to a file,
+// oldest first, and starts over.
+int
+hsk_tracer_dump(hsk_tracer_t *t, const char *path) {
+  assert(t && path);
+
+  if (!t->ring)
+    return HSK_EBADARGS;
+
+  uv_mutex_lock(&t->lock);
+
+  size_t start = (t->pos + HSK_TRACE_SIZE - t->count) % HSK_TRACE_SIZE;
+  size_t count = t->count;
+  size_t size = 9;
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    size += hsk_trace_size(&t->ring[(start + i) % HSK_TRACE_SIZE]);
+
+  uint8_t *raw = hsk_malloc(size);
+
+  if (!raw) {
+    uv_mutex_unlock(&t->lock);
+    return HSK_ENOMEM;
+  }
+
+  uint8_t *data = raw;
+
+  write_u32(&data, HSK_TRACE_MAGIC);
+  write_u8(&data, HSK_TRACE_VERSION);
+  write_u32(&data, (uint32_t)count);
+
+  for (i = 0; i < count; i++)
+    hsk_trace_write(&t->ring[(start + i) % HSK_TRACE_SIZE], &data);
+
+  t->count = 0;
+
+  uv_mutex_unlock(&t->lock);
+
+  assert((size_t)(data - raw) == size);
+
+  int rc = HSK_EFAILURE;
+  FILE *file = fopen(path, "ab");
+
+  if (!file)
+    goto done;
+
+  if (fwrite(raw, 1, size, file) != size) {
+    fclose(file);
+    goto done;
+  }
+
+  if (fclose(file) != 0)
+    goto done;
+
+  rc = HSK_SUCCESS;
+
+done:
+  hsk_free(raw);
+  return rc;
+}
+
+/*
+ * Capture
+ */
+
+int
+hsk_capture_init(hsk_capture_t *c) {
+  assert(c);
+
+  c->file = NULL;
+  c->start = 0;
+  c->size = 0;
+  c->max = HSK_CAPTURE_MAX;
+  c->count = 0;
+  c->dropped = 0;
+
+  if (uv_mutex_init(&c->lock) != 0)
+    return HSK_EFAILURE;
+
+  return HSK_SUCCESS;
+}
+
+void
+hsk_capture_uninit(hsk_capture_t *c) {
+  assert(c);
+
+  if (c->file) {
+    fclose(c->file);
+    c->file = NULL;
+  }
+
+  uv_mutex_destroy(&c->lock);
+}
+
+// Truncates the file. Before any thread is
+// answering.
+int
+hsk_capture_open(hsk_capture_t *c, const char *path) {
+  assert(c && path);
+
+  if (c->file)
+    return HSK_EBADARGS;
+
+  FILE *file = fopen(path, "wb");
+
+  if (!file)
+    return HSK_EFAILURE;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  uint8_t hdr[HSK_CAPTURE_HDR_SIZE];
+  uint8_t *data = hdr;
+
+  write_u32(&data, HSK_CAPTURE_MAGIC);
+  write_u8(&data, HSK_CAPTURE_VERSION);
+  write_i64(&data, (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+
+  if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr)) {
+    fclose(file);
+    return HSK_EFAILURE;
+  }
+
+  c->file = file;
+  c->start = uv_hrtime();
+  c->size = sizeof(hdr);
+
+  return HSK_SUCCESS;
+}
+
+static uint8_t
+hsk_capture_class(const struct sockaddr *addr) {
+  hsk_addr_t a;
+
+  if (!addr || !hsk_addr_from_sa(&a, addr))
+    return 0;
+
+  uint8_t flags = hsk_addr_is_ip6(&a) ? HSK_CAPTURE_IP6 : 0;
+
+  if (hsk_addr_is_local(&a))
+    return flags | HSK_CAPTURE_LOOPBACK;
+
+  if (hsk_addr_is_rfc1918(&a)
+      || hsk_addr_is_rfc4193(&a)
+      || hsk_addr_is_rfc6598(&a)) {
+    return flags | HSK_CAPTURE_PRIVATE;
+  }
+
+  return flags;
+}
+
+// Buffered: records reach the file a few kB
+// at a time and on close.
+void
+hsk_capture_push(
+  hsk_capture_t *c,
+  uint8_t flags,
+  const struct sockaddr *addr,
+  const uint8_t *data,
+  size_t data_len
+) {
+  if (!c || data_len > 0xffff)
+    return;
+
+  uint64_t us = (uv_hrtime() - c->start) / 1000;
+  uint8_t rec[HSK_CAPTURE_REC_SIZE];
+  uint8_t *p = rec;
+
+  write_u64(&p, us);
+  write_u8(&p, flags | hsk_capture_class(addr));
+  write_u16(&p, (uint16_t)data_len);
+
+  uv_mutex_lock(&c->lock);
+
+  if (c->file && c->size + sizeof(rec) + data_len <= c->max) {
+    if (fwrite(rec, 1, sizeof(rec), c->file) == sizeof(rec)
+        && fwrite(data, 1, data_len, c->file) == data_len) {
+      c->size += sizeof(rec) + data_len;
+      c->count += 1;
+    } else {
+      // The rest would not line up: stop here.
+      fclose(c->file);
+      c->file = NULL;
+      c->dropped += 1;
+    }
+  } else {
+    c->dropped += 1;
+  }
+
+  uv_mutex_unlock(&c->lock);
+}
+
+/*
+ * Trace
+ */
+
+void
+hsk_trace_free(hsk_trace_t *trace) {
+  hsk_free(trace);
+}
+
+size_t
+hsk_trace_size(const hsk_trace_t *trace) {
+  return 52 + strlen(trace->name);
+}
+
+size_t
+hsk_trace_write(const hsk_trace_t *trace, uint8_t **data) {
+  size_t name_len = strlen(trace->name);
+  size_t s = 0;
+
+  s += write_i64(data, trace->time);
+  s += write_u64(data, trace->peer);
+  s += write_u32(data, trace->cache);
+  s += write_u32(data, trace->proof);
+  s += write_u32(data, trace->verify);
+  s += write_u32(data, trace->answer);
+  s += write_u32(data, trace->sign);
+  s += write_u32(data, trace->total);
+  s += write_u16(data, trace->id);
+  s += write_u16(data, trace->type);
+  s += write_u16(data, trace->size);
+  s += write_u16(data, trace->sent);
+  s += write_u8(data, trace->rcode);
+  s += write_u8(data, trace->retries);
+  s += write_u8(data, trace->flags);
+  s += write_u8(data, (uint8_t)name_len);
+  s += write_bytes(data, (const uint8_t *)trace->name, name_len);
+
+  return s;
+}
@@ -0,0 +1,167 @@
+#ifndef _HSK_TRACE_H
+#define _HSK_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+#include "uv.h"
+
+// Records kept for a dump. Older ones are
+// overwritten.
+#define HSK_TRACE_SIZE 4096
+
+// One query in this many is traced by default.
+#define HSK_TRACE_RATE 100
+
+// Dumps start with the magic ("hnst"), a
+// version byte and a record count, all little
+// endian like the records themselves.
+#define HSK_TRACE_MAGIC 0x74736e68
+#define HSK_TRACE_VERSION 1
+
+#define HSK_TRACE_CACHED (1 << 0)
+#define HSK_TRACE_LOOKUP (1 << 1)
+#define HSK_TRACE_PROOF_CACHED (1 << 2)
+#define HSK_TRACE_HEDGED (1 << 3)
+#define HSK_TRACE_STALE (1 << 4)
+#define HSK_TRACE_TRUNCATED (1 << 5)
+#define HSK_TRACE_TCP (1 << 6)
+
+// Captures hold every query as it arrived, for
+// replaying (see hnsd-replay): the magic
+// ("hnsq"), a version byte and the wall clock
+// at the start (microseconds), then per query
+// the microseconds since the start, flags, the
+// length and the raw message. Little endian.
+// Writing stops once the file reaches the
+// limit.
+#define HSK_CAPTURE_MAGIC 0x71736e68
+#define HSK_CAPTURE_VERSION 1
+#define HSK_CAPTURE_HDR_SIZE 13
+#define HSK_CAPTURE_REC_SIZE 11
+#define HSK_CAPTURE_MAX ((uint64_t)1 << 30)
+
+// Which server, how, and from where (only the
+// class of the source address is kept).
+#define HSK_CAPTURE_RS (1 << 0)
+#define HSK_CAPTURE_TCP (1 << 1)
+#define HSK_CAPTURE_LOCAL (1 << 2)
+#define HSK_CAPTURE_IP6 (1 << 3)
+#define HSK_CAPTURE_LOOPBACK (1 << 4)
+#define HSK_CAPTURE_PRIVATE (1 << 5)
+
+/*
+ * Types
+ */
+
+// One sampled query, end to end. Times are in
+// microseconds; stages a query skipped are 0.
+//   cache: receipt until a hit or a lookup
+//   proof: lookup until the pool answers
+//   verify: checking the proof that answered
+//   answer: conversion, encoding and signing
+//   sign: SIG(0) alone
+//   total: receipt until the reply is sent
+// The size is the encoded reply before it was
+// cut to fit (0 when a finalized one was hit).
+typedef struct hsk_trace_s {
+  int64_t time;
+  uint64_t peer;
+  uint32_t cache;
+  uint32_t proof;
+  uint32_t verify;
+  uint32_t answer;
+  uint32_t sign;
+  uint32_t total;
+  uint16_t id;
+  uint16_t type;
+  uint16_t size;
+  uint16_t sent;
+  uint8_t rcode;
+  uint8_t retries;
+  uint8_t flags;
+  char name[HSK_DNS_MAX_NAME + 1];
+} hsk_trace_t;
+
+// Shared by every thread answering queries.
+typedef struct hsk_tracer_s {
+  uv_mutex_t lock;
+  hsk_trace_t *ring;
+  size_t pos;
+  size_t count;
+  uint32_t rate;
+  uint64_t seen;
+} hsk_tracer_t;
+
+// Shared by both servers and every thread.
+typedef struct hsk_capture_s {
+  uv_mutex_t lock;
+  FILE *file;
+  uint64_t start;
+  uint64_t size;
+  uint64_t max;
+  uint64_t count;
+  uint64_t dropped;
+} hsk_capture_t;
+
+/*
+ * Tracer
+ */
+
+int
+hsk_tracer_init(hsk_tracer_t *t);
+
+void
+hsk_tracer_uninit(hsk_tracer_t *t);
+
+bool
+hsk_tracer_set_rate(hsk_tracer_t *t, uint32_t rate);
+
+hsk_trace_t *
+hsk_tracer_sample(hsk_tracer_t *t);
+
+void
+hsk_tracer_push(hsk_tracer_t *t, const hsk_trace_t *trace);
+
+int
+hsk_tracer_dump(hsk_tracer_t *t, const char *path);
+
+/*
+ * Capture
+ */
+
+int
+hsk_capture_init(hsk_capture_t *c);
+
+void
+hsk_capture_uninit(hsk_capture_t *c);
+
+int
+hsk_capture_open(hsk_capture_t *c, const char *path);
+
+void
+hsk_capture_push(
+  hsk_capture_t *c,
+  uint8_t flags,
+  const struct sockaddr *addr,
+  const uint8_t *data,
+  size_t data_len
+);
+
+/*
+ * Trace
+ */
+
+void
+hsk_trace_free(hsk_trace_t *trace);
+
+size_t
+hsk_trace_size(const hsk_trace_t *trace);
+
+size_t
+hsk_trace_write(const hsk_trace_t *trace, uint8_t **data);
+#endif
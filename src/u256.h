@@ -0,0 +1,231 @@
+#ifndef _HSK_U256_H
+#define _HSK_U256_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Fixed 256-bit unsigned integers for targets
+// and chainwork: four 64-bit limbs, least
+// significant first. Only what the header and
+// chain code needs; 32-byte big-endian arrays
+// are kept at the edges.
+typedef struct hsk_u256_s {
+  uint64_t limbs[4];
+} hsk_u256_t;
+
+static inline void
+hsk_u256_from_int(hsk_u256_t *r, uint64_t n) {
+  r->limbs[0] = n;
+  r->limbs[1] = 0;
+  r->limbs[2] = 0;
+  r->limbs[3] = 0;
+}
+
+static inline void
+hsk_u256_from_array(hsk_u256_t *r, const uint8_t *data) {
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    const uint8_t *p = &data[(3 - i) * 8];
+    uint64_t limb = 0;
+
+    for (j = 0; j < 8; j++)
+      limb = (limb << 8) | p[j];
+
+    r->limbs[i] = limb;
+  }
+}
+
+static inline void
+hsk_u256_to_array(const hsk_u256_t *a, uint8_t *data) {
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    uint8_t *p = &data[(3 - i) * 8];
+    uint64_t limb = a->limbs[i];
+
+    for (j = 7; j >= 0; j--) {
+      p[j] = (uint8_t)limb;
+      limb >>= 8;
+    }
+  }
+}
+
+static inline int
+hsk_u256_cmp(const hsk_u256_t *a, const hsk_u256_t *b) {
+  int i;
+
+  for (i = 3; i >= 0; i--) {
+    if (a->limbs[i] != b->limbs[i])
+      return a->limbs[i] < b->limbs[i] ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static inline bool
+hsk_u256_is_zero(const hsk_u256_t *a) {
+  return (a->limbs[0] | a->limbs[1] | a->limbs[2] | a->limbs[3]) == 0;
+}
+
+// r = a + b, returning the carry out.
+static inline uint64_t
+hsk_u256_add(hsk_u256_t *r, const hsk_u256_t *a, const hsk_u256_t *b) {
+  uint64_t carry = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    uint64_t x = a->limbs[i];
+    uint64_t sum = x + b->limbs[i];
+    uint64_t c = sum < x;
+
+    sum += carry;
+    c |= sum < carry;
+
+    r->limbs[i] = sum;
+    carry = c;
+  }
+
+  return carry;
+}
+
+// r = a - b, returning the borrow out.
+static inline uint64_t
+hsk_u256_sub(hsk_u256_t *r, const hsk_u256_t *a, const hsk_u256_t *b) {
+  uint64_t borrow = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    uint64_t x = a->limbs[i];
+    uint64_t y = b->limbs[i];
+    uint64_t diff = x - y;
+    uint64_t c = x < y;
+
+    c |= diff < borrow;
+    diff -= borrow;
+
+    r->limbs[i] = diff;
+    borrow = c;
+  }
+
+  return borrow;
+}
+
+// r = a * n, returning what overflows.
+static inline uint64_t
+hsk_u256_mul_u32(hsk_u256_t *r, const hsk_u256_t *a, uint32_t n) {
+  uint64_t carry = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    uint64_t limb = a->limbs[i];
+    uint64_t lo = (limb & 0xffffffff) * n + carry;
+    uint64_t hi = (limb >> 32) * n + (lo >> 32);
+
+    r->limbs[i] = (hi << 32) | (lo & 0xffffffff);
+    carry = hi >> 32;
+  }
+
+  return carry;
+}
+
+// r = (top * 2^256 + a) / n. The quotient must
+// fit (top < n).
+static inline void
+hsk_u256_div_u32(
+  hsk_u256_t *r,
+  const hsk_u256_t *a,
+  uint64_t top,
+  uint32_t n
+) {
+  uint64_t rem = top;
+  int i;
+
+  assert(n != 0 && top < n);
+
+  for (i = 3; i >= 0; i--) {
+    uint64_t limb = a->limbs[i];
+    uint64_t cur = (rem << 32) | (limb >> 32);
+    uint64_t hi = cur / n;
+
+    rem = cur % n;
+    cur = (rem << 32) | (limb & 0xffffffff);
+
+    r->limbs[i] = (hi << 32) | (cur / n);
+    rem = cur % n;
+  }
+}
+
+static inline int
+hsk_u256_bits(const hsk_u256_t *a) {
+  int i;
+
+  for (i = 3; i >= 0; i--) {
+    if (a->limbs[i])
+      return i * 64 + 64 - __builtin_clzll(a->limbs[i]);
+  }
+
+  return 0;
+}
+
+static inline void
+hsk_u256_shl(hsk_u256_t *r, const hsk_u256_t *a, int bits) {
+  int limbs = bits / 64;
+  int shift = bits % 64;
+  int i;
+
+  for (i = 3; i >= 0; i--) {
+    uint64_t limb = 0;
+
+    if (i - limbs >= 0) {
+      limb = a->limbs[i - limbs] << shift;
+
+      if (shift && i - limbs - 1 >= 0)
+        limb |= a->limbs[i - limbs - 1] >> (64 - shift);
+    }
+
+    r->limbs[i] = limb;
+  }
+}
+
+static inline void
+hsk_u256_shr1(hsk_u256_t *a) {
+  int i;
+
+  for (i = 0; i < 3; i++)
+    a->limbs[i] = (a->limbs[i] >> 1) | (a->limbs[i + 1] << 63);
+
+  a->limbs[3] >>= 1;
+}
+
+// r = a / b. Shift and subtract, over only as
+// many bits as the quotient can have.
+static inline void
+hsk_u256_div(hsk_u256_t *r, const hsk_u256_t *a, const hsk_u256_t *b) {
+  hsk_u256_t rem = *a;
+  hsk_u256_t div;
+  hsk_u256_t q;
+  int shift = hsk_u256_bits(a) - hsk_u256_bits(b);
+
+  assert(!hsk_u256_is_zero(b));
+
+  hsk_u256_from_int(&q, 0);
+
+  if (shift >= 0) {
+    hsk_u256_shl(&div, b, shift);
+
+    for (; shift >= 0; shift--) {
+      if (hsk_u256_cmp(&rem, &div) >= 0) {
+        hsk_u256_sub(&rem, &rem, &div);
+        q.limbs[shift / 64] |= (uint64_t)1 << (shift % 64);
+      }
+
+      hsk_u256_shr1(&div);
+    }
+  }
+
+  *r = q;
+}
+#endif
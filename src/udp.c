@@ -0,0 +1,645 @@
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "error.h"
+#include "mem.h"
+#include "udp.h"
+#include "uv.h"
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HSK_UDP_MMSG
+#if defined(UDP_SEGMENT) && defined(SOL_UDP)
+#define HSK_UDP_GSO
+#endif
+#ifdef SO_RXQ_OVFL
+#define HSK_UDP_OVFL
+#endif
+#endif
+
+// Past the system's maximum buffer size, with
+// CAP_NET_ADMIN.
+#ifndef SO_RCVBUFFORCE
+#define SO_RCVBUFFORCE -1
+#define SO_SNDBUFFORCE -1
+#endif
+
+/*
+ * Prototypes
+ */
+
+static void
+after_poll(uv_poll_t *handle, int status, int events);
+
+static void
+after_idle(uv_idle_t *handle);
+
+/*
+ * UDP
+ */
+
+static socklen_t
+hsk_udp_addr_len(const struct sockaddr *addr) {
+  if (addr->sa_family == AF_INET6)
+    return sizeof(struct sockaddr_in6);
+  return sizeof(struct sockaddr_in);
+}
+
+static void
+hsk_udp_drop(hsk_udp_t *udp) {
+  hsk_udp_msg_t *msg = &udp->queue[udp->queue_head];
+
+  if (msg->data && msg->should_free)
+    hsk_free(msg->data);
+
+  msg->data = NULL;
+  msg->data_len = 0;
+
+  udp->queue_head = (udp->queue_head + 1) % HSK_UDP_QUEUE;
+  udp->queue_size -= 1;
+}
+
+void
+hsk_udp_init(
+  hsk_udp_t *udp,
+  uv_loop_t *loop,
+  hsk_udp_recv_cb callback,
+  void *arg
+) {
+  assert(udp && loop && callback);
+
+  udp->loop = loop;
+  udp->poll.data = (void *)udp;
+  udp->idle.data = (void *)udp;
+  udp->fd = -1;
+  udp->callback = callback;
+  udp->arg = arg;
+  udp->queue_head = 0;
+  udp->queue_size = 0;
+  udp->events = 0;
+  udp->polling = false;
+  udp->idling = false;
+  udp->gso = false;
+  udp->rcvbuf = HSK_UDP_SOCKET_BUFFER;
+  udp->sndbuf = HSK_UDP_SOCKET_BUFFER;
+  udp->drops = 0;
+}
+
+void
+hsk_udp_uninit(hsk_udp_t *udp) {
+  assert(udp);
+
+  while (udp->queue_size > 0)
+    hsk_udp_drop(udp);
+}
+
+// Best effort: the kernel clamps the size to
+// its maximum, unless we may go past it (the
+// `force` option, or -1).
+static void
+hsk_udp_set_buffer(int fd, int opt, int force, int size) {
+  if (size == 0)
+    return;
+
+  if (force != -1
+      && setsockopt(fd, SOL_SOCKET, force, &size, sizeof(size)) == 0) {
+    return;
+  }
+
+  setsockopt(fd, SOL_SOCKET, opt, &size, sizeof(size));
+}
+
+// Takes ownership of `fd`, a bound socket,
+// even on failure.
+static int
+hsk_udp_attach(hsk_udp_t *udp, int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    goto fail;
+
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+    goto fail;
+
+  hsk_udp_set_buffer(fd, SO_RCVBUF, SO_RCVBUFFORCE, udp->rcvbuf);
+  hsk_udp_set_buffer(fd, SO_SNDBUF, SO_SNDBUFFORCE, udp->sndbuf);
+
+#ifdef HSK_UDP_OVFL
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+#endif
+
+#ifdef HSK_UDP_GSO
+  // Kernels before 4.18 do not know the option.
+  int segment = 0;
+  socklen_t segment_len = sizeof(segment);
+
+  udp->gso = getsockopt(fd, SOL_UDP, UDP_SEGMENT,
+                        &segment, &segment_len) == 0;
+#endif
+
+  if (uv_poll_init(udp->loop, &udp->poll, fd) != 0)
+    goto fail;
+
+  udp->poll.data = (void *)udp;
+
+  if (uv_idle_init(udp->loop, &udp->idle) != 0)
+    goto fail_poll;
+
+  udp->idle.data = (void *)udp;
+  udp->fd = fd;
+  udp->events = UV_READABLE;
+
+  if (uv_poll_start(&udp->poll, udp->events, after_poll) != 0)
+    goto fail_idle;
+
+  udp->polling = true;
+
+  return HSK_SUCCESS;
+
+  // Handles are closed in reverse order, then
+  // the socket.
+fail_idle:
+  uv_close((uv_handle_t *)&udp->idle, NULL);
+  udp->fd = -1;
+  udp->events = 0;
+fail_poll:
+  uv_close((uv_handle_t *)&udp->poll, NULL);
+fail:
+  close(fd);
+  return HSK_EFAILURE;
+}
+
+int
+hsk_udp_open(hsk_udp_t *udp, const struct sockaddr *addr, bool reuseport) {
+  assert(udp && addr);
+
+  if (udp->polling)
+    return HSK_EFAILURE;
+
+  int fd = socket(addr->sa_family, SOCK_DGRAM, 0);
+
+  if (fd < 0)
+    return HSK_EFAILURE;
+
+  if (reuseport) {
+#ifdef SO_REUSEPORT
+    int on = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+      goto fail;
+#else
+    goto fail;
+#endif
+  }
+
+  if (bind(fd, addr, hsk_udp_addr_len(addr)) != 0)
+    goto fail;
+
+  return hsk_udp_attach(udp, fd);
+
+fail:
+  close(fd);
+  return HSK_EFAILURE;
+}
+
+// A socket bound elsewhere: another process's,
+// or systemd's.
+int
+hsk_udp_open_fd(hsk_udp_t *udp, int fd) {
+  assert(udp && fd >= 0);
+
+  if (udp->polling) {
+    close(fd);
+    return HSK_EFAILURE;
+  }
+
+  return hsk_udp_attach(udp, fd);
+}
+
+// Within a SO_REUSEPORT group, queries whose
+// interrupts land on `cpu` go to this socket
+// first (SO_INCOMING_CPU). Best effort.
+bool
+hsk_udp_set_cpu(hsk_udp_t *udp, int cpu) {
+  assert(udp);
+
+  if (!udp->polling || cpu < 0)
+    return false;
+
+#ifdef SO_INCOMING_CPU
+  return setsockopt(udp->fd, SOL_SOCKET, SO_INCOMING_CPU,
+                    &cpu, sizeof(cpu)) == 0;
+#else
+  return false;
+#endif
+}
+
+// Kernel buffer sizes in bytes (0 for the
+// system's defaults), before opening.
+bool
+hsk_udp_set_buffers(hsk_udp_t *udp, int rcvbuf, int sndbuf) {
+  assert(udp);
+
+  if (udp->polling || rcvbuf < 0 || sndbuf < 0)
+    return false;
+
+  udp->rcvbuf = rcvbuf;
+  udp->sndbuf = sndbuf;
+
+  return true;
+}
+
+// Since the socket was created (it may have
+// been handed over). Any thread may ask.
+uint32_t
+hsk_udp_drops(const hsk_udp_t *udp) {
+  assert(udp);
+  return __atomic_load_n(&udp->drops, __ATOMIC_RELAXED);
+}
+
+int
+hsk_udp_close(hsk_udp_t *udp) {
+  assert(udp);
+
+  if (!udp->polling)
+    return HSK_SUCCESS;
+
+  // Last chance for queued replies.
+  hsk_udp_flush(udp);
+
+  uv_poll_stop(&udp->poll);
+  uv_close((uv_handle_t *)&udp->poll, NULL);
+  uv_close((uv_handle_t *)&udp->idle, NULL);
+
+  close(udp->fd);
+
+  udp->fd = -1;
+  udp->events = 0;
+  udp->polling = false;
+  udp->idling = false;
+
+  while (udp->queue_size > 0)
+    hsk_udp_drop(udp);
+
+  return HSK_SUCCESS;
+}
+
+int
+hsk_udp_send(
+  hsk_udp_t *udp,
+  uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr,
+  bool should_free
+) {
+  assert(udp && data && addr);
+
+  if (!udp->polling) {
+    if (should_free)
+      hsk_free(data);
+    return HSK_EFAILURE;
+  }
+
+  if (udp->queue_size == HSK_UDP_QUEUE)
+    hsk_udp_flush(udp);
+
+  if (udp->queue_size == HSK_UDP_QUEUE) {
+    if (should_free)
+      hsk_free(data);
+    return HSK_EBUSY;
+  }
+
+  size_t index = (udp->queue_head + udp->queue_size) % HSK_UDP_QUEUE;
+  hsk_udp_msg_t *msg = &udp->queue[index];
+
+  msg->data = data;
+  msg->data_len = data_len;
+  msg->should_free = should_free;
+  memcpy(&msg->addr, addr, hsk_udp_addr_len(addr));
+
+  udp->queue_size += 1;
+
+  if (!udp->idling) {
+    uv_idle_start(&udp->idle, after_idle);
+    udp->idling = true;
+  }
+
+  return HSK_SUCCESS;
+}
+
+#ifdef HSK_UDP_MMSG
+#ifdef HSK_UDP_GSO
+// How many queued replies from `start` can
+// ride along with it as GSO segments.
+static size_t
+hsk_udp_segments(const hsk_udp_t *udp, size_t start, size_t count) {
+  const hsk_udp_msg_t *first = &udp->queue[start % HSK_UDP_QUEUE];
+  const struct sockaddr *addr = (const struct sockaddr *)&first->addr;
+  socklen_t addr_len = hsk_udp_addr_len(addr);
+  size_t total = first->data_len;
+  size_t n = 1;
+
+  if (!udp->gso)
+    return 1;
+
+  while (n < count && n < HSK_UDP_GSO_SEGMENTS) {
+    const hsk_udp_msg_t *msg = &udp->queue[(start + n) % HSK_UDP_QUEUE];
+
+    if (msg->data_len > first->data_len || msg->data_len == 0)
+      break;
+
+    if (total + msg->data_len > HSK_UDP_GSO_BYTES)
+      break;
+
+    if (memcmp(&msg->addr, addr, addr_len) != 0)
+      break;
+
+    total += msg->data_len;
+    n += 1;
+
+    // Only the last segment may be short.
+    if (msg->data_len < first->data_len)
+      break;
+  }
+
+  return n;
+}
+#endif
+
+// Returns the number of messages written
+// (or dropped), or -1 if the socket is full.
+static int
+hsk_udp_write(hsk_udp_t *udp) {
+  struct mmsghdr msgs[HSK_UDP_BATCH];
+  struct iovec iovs[HSK_UDP_BATCH];
+  size_t spans[HSK_UDP_BATCH];
+  size_t count = udp->queue_size;
+#ifdef HSK_UDP_GSO
+  union {
+    char buf[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr align;
+  } controls[HSK_UDP_BATCH];
+#endif
+  int n = 0;
+
+  if (count > HSK_UDP_BATCH)
+    count = HSK_UDP_BATCH;
+
+  memset(msgs, 0, sizeof(msgs));
+
+  for (size_t i = 0; i < count; i += spans[n++]) {
+    size_t index = (udp->queue_head + i) % HSK_UDP_QUEUE;
+    hsk_udp_msg_t *msg = &udp->queue[index];
+    struct sockaddr *addr = (struct sockaddr *)&msg->addr;
+
+    spans[n] = 1;
+
+#ifdef HSK_UDP_GSO
+    spans[n] = hsk_udp_segments(udp, udp->queue_head + i, count - i);
+#endif
+
+    for (size_t j = 0; j < spans[n]; j++) {
+      hsk_udp_msg_t *seg = &udp->queue[(index + j) % HSK_UDP_QUEUE];
+
+      iovs[i + j].iov_base = seg->data;
+      iovs[i + j].iov_len = seg->data_len;
+    }
+
+    msgs[n].msg_hdr.msg_name = addr;
+    msgs[n].msg_hdr.msg_namelen = hsk_udp_addr_len(addr);
+    msgs[n].msg_hdr.msg_iov = &iovs[i];
+    msgs[n].msg_hdr.msg_iovlen = spans[n];
+
+#ifdef HSK_UDP_GSO
+    if (spans[n] > 1) {
+      struct msghdr *hdr = &msgs[n].msg_hdr;
+      uint16_t size = (uint16_t)msg->data_len;
+
+      memset(&controls[n], 0, sizeof(controls[n]));
+
+      hdr->msg_control = controls[n].buf;
+      hdr->msg_controllen = sizeof(controls[n].buf);
+
+      struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+      memcpy(CMSG_DATA(cm), &size, sizeof(uint16_t));
+    }
+#endif
+  }
+
+  int sent = sendmmsg(udp->fd, msgs, n, 0);
+
+  if (sent < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+      return -1;
+
+#ifdef HSK_UDP_GSO
+    // No checksum offload on the way out (EIO):
+    // send them one by one from now on.
+    if (spans[0] > 1 && errno == EIO) {
+      udp->gso = false;
+      return 0;
+    }
+#endif
+
+    // The error is for the first message:
+    // drop it and carry on with the rest.
+    sent = 1;
+  }
+
+  int written = 0;
+
+  for (int i = 0; i < sent; i++)
+    written += spans[i];
+
+  return written;
+}
+
+static void
+hsk_udp_read(hsk_udp_t *udp) {
+  struct mmsghdr msgs[HSK_UDP_BATCH];
+  struct iovec iovs[HSK_UDP_BATCH];
+  struct sockaddr_storage addrs[HSK_UDP_BATCH];
+#ifdef HSK_UDP_OVFL
+  union {
+    char buf[CMSG_SPACE(sizeof(uint32_t))];
+    struct cmsghdr align;
+  } ctrls[HSK_UDP_BATCH];
+#endif
+
+  memset(msgs, 0, sizeof(msgs));
+
+  for (size_t i = 0; i < HSK_UDP_BATCH; i++) {
+    iovs[i].iov_base = udp->read_buffer[i];
+    iovs[i].iov_len = HSK_UDP_BUFFER;
+
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef HSK_UDP_OVFL
+    msgs[i].msg_hdr.msg_control = ctrls[i].buf;
+    msgs[i].msg_hdr.msg_controllen = sizeof(ctrls[i].buf);
+#endif
+  }
+
+  int count = recvmmsg(udp->fd, msgs, HSK_UDP_BATCH, MSG_DONTWAIT, NULL);
+
+#ifdef HSK_UDP_OVFL
+  // The kernel's running count comes with each
+  // datagram (once there has been a drop): the
+  // last one read has the latest.
+  if (count > 0) {
+    struct msghdr *hdr = &msgs[count - 1].msg_hdr;
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(hdr); cm; cm = CMSG_NXTHDR(hdr, cm)) {
+      if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+        uint32_t drops;
+        memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+        __atomic_store_n(&udp->drops, drops, __ATOMIC_RELAXED);
+      }
+    }
+  }
+#endif
+
+  for (int i = 0; i < count; i++) {
+    // The callback may close the socket.
+    if (!udp->polling)
+      break;
+
+    udp->callback(
+      udp->arg,
+      udp->read_buffer[i],
+      (size_t)msgs[i].msg_len,
+      (struct sockaddr *)&addrs[i]
+    );
+  }
+}
+#else
+static int
+hsk_udp_write(hsk_udp_t *udp) {
+  hsk_udp_msg_t *msg = &udp->queue[udp->queue_head];
+  struct sockaddr *addr = (struct sockaddr *)&msg->addr;
+
+  ssize_t w = sendto(
+    udp->fd,
+    msg->data,
+    msg->data_len,
+    0,
+    addr,
+    hsk_udp_addr_len(addr)
+  );
+
+  if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS))
+    return -1;
+
+  return 1;
+}
+
+static void
+hsk_udp_read(hsk_udp_t *udp) {
+  for (size_t i = 0; i < HSK_UDP_BATCH && udp->polling; i++) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+
+    ssize_t r = recvfrom(
+      udp->fd,
+      udp->read_buffer[0],
+      HSK_UDP_BUFFER,
+      0,
+      (struct sockaddr *)&addr,
+      &addr_len
+    );
+
+    if (r < 0)
+      break;
+
+    udp->callback(
+      udp->arg,
+      udp->read_buffer[0],
+      (size_t)r,
+      (struct sockaddr *)&addr
+    );
+  }
+}
+#endif
+
+void
+hsk_udp_flush(hsk_udp_t *udp) {
+  assert(udp);
+
+  if (!udp->polling)
+    return;
+
+  while (udp->queue_size > 0) {
+    int sent = hsk_udp_write(udp);
+
+    if (sent < 0)
+      break;
+
+    for (int i = 0; i < sent; i++)
+      hsk_udp_drop(udp);
+  }
+
+  // Wait for room in the socket buffer
+  // instead of spinning.
+  int events = UV_READABLE;
+
+  if (udp->queue_size > 0)
+    events |= UV_WRITABLE;
+
+  if (events != udp->events) {
+    udp->events = events;
+    uv_poll_start(&udp->poll, events, after_poll);
+  }
+
+  if (udp->idling) {
+    uv_idle_stop(&udp->idle);
+    udp->idling = false;
+  }
+}
+
+/*
+ * UV behavior
+ */
+
+static void
+after_poll(uv_poll_t *handle, int status, int events) {
+  hsk_udp_t *udp = (hsk_udp_t *)handle->data;
+
+  if (!udp || status < 0)
+    return;
+
+  if (events & UV_READABLE)
+    hsk_udp_read(udp);
+
+  if ((events & UV_WRITABLE) && udp->polling)
+    hsk_udp_flush(udp);
+}
+
+static void
+after_idle(uv_idle_t *handle) {
+  hsk_udp_t *udp = (hsk_udp_t *)handle->data;
+  hsk_udp_flush(udp);
+}
@@ -0,0 +1,126 @@
+#ifndef _HSK_UDP_H
+#define _HSK_UDP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include "uv.h"
+
+/*
+ * Defs
+ */
+
+#define HSK_UDP_BUFFER 4096
+
+// Datagrams read per wakeup, and written per
+// syscall (recvmmsg/sendmmsg where available).
+#define HSK_UDP_BATCH 32
+
+// Consecutive replies to one address, all the
+// same size but the last, go out as one
+// datagram the kernel splits (UDP GSO), up to
+// this many (and 64k) at a time.
+#define HSK_UDP_GSO_SEGMENTS 16
+#define HSK_UDP_GSO_BYTES 65000
+
+// Replies waiting to be written. Past this,
+// new ones are dropped.
+#define HSK_UDP_QUEUE 1024
+
+// Kernel socket buffers (SO_RCVBUF/SO_SNDBUF)
+// unless set otherwise. A burst the receive
+// buffer cannot hold is dropped before it is
+// read: see hsk_udp_drops.
+#define HSK_UDP_SOCKET_BUFFER (1 << 20)
+
+/*
+ * Types
+ */
+
+typedef void (*hsk_udp_recv_cb)(
+  void *arg,
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+);
+
+typedef struct hsk_udp_msg_s {
+  uint8_t *data;
+  size_t data_len;
+  bool should_free;
+  struct sockaddr_storage addr;
+} hsk_udp_msg_t;
+
+// A UDP socket driven by a uv_poll_t rather
+// than uv_udp_t, so that a burst of queries is
+// read and its replies written in one syscall
+// each. Replies are queued and flushed from an
+// idle handle (before the loop blocks again).
+typedef struct hsk_udp_s {
+  uv_loop_t *loop;
+  uv_poll_t poll;
+  uv_idle_t idle;
+  int fd;
+  hsk_udp_recv_cb callback;
+  void *arg;
+  hsk_udp_msg_t queue[HSK_UDP_QUEUE];
+  size_t queue_head;
+  size_t queue_size;
+  int events;
+  bool polling;
+  bool idling;
+  bool gso;
+  int rcvbuf;
+  int sndbuf;
+  // Datagrams the kernel dropped for want of
+  // room, as of the last read (SO_RXQ_OVFL).
+  uint32_t drops;
+  uint8_t read_buffer[HSK_UDP_BATCH][HSK_UDP_BUFFER];
+} hsk_udp_t;
+
+/*
+ * UDP
+ */
+
+void
+hsk_udp_init(
+  hsk_udp_t *udp,
+  uv_loop_t *loop,
+  hsk_udp_recv_cb callback,
+  void *arg
+);
+
+void
+hsk_udp_uninit(hsk_udp_t *udp);
+
+int
+hsk_udp_open(hsk_udp_t *udp, const struct sockaddr *addr, bool reuseport);
+
+int
+hsk_udp_open_fd(hsk_udp_t *udp, int fd);
+
+bool
+hsk_udp_set_cpu(hsk_udp_t *udp, int cpu);
+
+bool
+hsk_udp_set_buffers(hsk_udp_t *udp, int rcvbuf, int sndbuf);
+
+uint32_t
+hsk_udp_drops(const hsk_udp_t *udp);
+
+int
+hsk_udp_close(hsk_udp_t *udp);
+
+int
+hsk_udp_send(
+  hsk_udp_t *udp,
+  uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr,
+  bool should_free
+);
+
+void
+hsk_udp_flush(hsk_udp_t *udp);
+#endif
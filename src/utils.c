@@ -8,6 +8,11 @@
 #include <stdlib.h>
 #include <time.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HSK_UTILS_SSE2
+#endif
+
 // Taken from:
 // https://github.com/wahern/dns/blob/master/src/dns.c
 #ifndef _HSK_RANDOM
@@ -218,6 +223,21 @@ hsk_to_lower(char *name) {
 
   char *s = name;
 
+#ifdef HSK_UTILS_SSE2
+  size_t len = strlen(name);
+  char *end = name + len;
+
+  for (; end - s >= 16; s += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+    __m128i up = _mm_and_si128(
+      _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+      _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1))
+    );
+    v = _mm_or_si128(v, _mm_and_si128(up, _mm_set1_epi8(0x20)));
+    _mm_storeu_si128((__m128i *)s, v);
+  }
+#endif
+
   while (*s) {
     if (*s >= 'A' && *s <= 'Z')
       *s += ' ';
@@ -0,0 +1,481 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "bio.h"
+#include "constants.h"
+#include "error.h"
+#include "hash.h"
+#include "log.h"
+#include "map.h"
+#include "mem.h"
+#include "utils.h"
+#include "watch.h"
+
+/*
+ * Helpers
+ */
+
+static void
+hsk_watch_log(const hsk_watch_t *watch, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  hsk_log_vprintf("watch: ", fmt, args);
+  va_end(args);
+}
+
+static void
+hsk_watch_name_free(hsk_watch_name_t *item) {
+  if (item) {
+    hsk_free(item->data);
+    hsk_free(item);
+  }
+}
+
+// Replaces what was known about the name.
+static bool
+hsk_watch_name_set(
+  hsk_watch_name_t *item,
+  const uint8_t *root,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  uint8_t *copy = NULL;
+
+  if (data_len > 0) {
+    copy = hsk_malloc(data_len);
+
+    if (!copy)
+      return false;
+
+    memcpy(copy, data, data_len);
+  }
+
+  hsk_free(item->data);
+
+  memcpy(item->root, root, 32);
+  item->verified = true;
+  item->exists = exists;
+  item->data = copy;
+  item->data_len = data_len;
+
+  return true;
+}
+
+/*
+ * Watchlist
+ */
+
+void
+hsk_watch_init(hsk_watch_t *watch) {
+  assert(watch);
+
+  hsk_map_init_hash_map(&watch->map, NULL);
+  watch->names = NULL;
+  watch->count = 0;
+  watch->dirty = false;
+  watch->hits = 0;
+  memset(watch->path, 0, sizeof(watch->path));
+}
+
+void
+hsk_watch_uninit(hsk_watch_t *watch) {
+  assert(watch);
+
+  for (int i = 0; i < watch->count; i++)
+    hsk_watch_name_free(watch->names[i]);
+
+  hsk_free(watch->names);
+
+  watch->names = NULL;
+  watch->count = 0;
+
+  hsk_map_uninit(&watch->map);
+}
+
+// A TLD, in any case. Already watched is fine.
+int
+hsk_watch_add(hsk_watch_t *watch, const char *name) {
+  assert(watch && name);
+
+  size_t len = strlen(name);
+
+  if (len > 0 && name[len - 1] == '.')
+    len -= 1;
+
+  if (len == 0 || len > 63 || memchr(name, '.', len))
+    return HSK_EBADARGS;
+
+  hsk_watch_name_t *item = hsk_malloc(sizeof(hsk_watch_name_t));
+
+  if (!item)
+    return HSK_ENOMEM;
+
+  memcpy(item->name, name, len);
+  item->name[len] = '\0';
+  hsk_to_lower(item->name);
+  hsk_hash_name(item->name, item->hash);
+  memset(item->root, 0, sizeof(item->root));
+  item->verified = false;
+  item->exists = false;
+  item->data = NULL;
+  item->data_len = 0;
+
+  if (hsk_map_has(&watch->map, item->hash)) {
+    hsk_free(item);
+    return HSK_SUCCESS;
+  }
+
+  if (watch->count == HSK_WATCH_MAX) {
+    hsk_free(item);
+    return HSK_EFAILURE;
+  }
+
+  int count = watch->count + 1;
+  hsk_watch_name_t **names = hsk_realloc(watch->names, count * sizeof(item));
+
+  if (!names) {
+    hsk_free(item);
+    return HSK_ENOMEM;
+  }
+
+  watch->names = names;
+
+  if (!hsk_map_set(&watch->map, item->hash, (void *)item)) {
+    hsk_free(item);
+    return HSK_ENOMEM;
+  }
+
+  watch->names[watch->count] = item;
+  watch->count = count;
+
+  return HSK_SUCCESS;
+}
+
+// One name per line (a trailing dot is fine),
+// `#` starting a comment.
+int
+hsk_watch_read_list(hsk_watch_t *watch, const char *path, int *count) {
+  assert(watch && path && count);
+
+  FILE *file = fopen(path, "r");
+
+  if (!file)
+    return HSK_EFAILURE;
+
+  char line[1024];
+  int num = 0;
+
+  *count = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    char *comment = strchr(line, '#');
+
+    num += 1;
+
+    if (comment)
+      *comment = '\0';
+
+    char *name = strtok(line, " \t\r\n");
+
+    if (!name)
+      continue;
+
+    int rc = HSK_EBADARGS;
+
+    if (!strtok(NULL, " \t\r\n"))
+      rc = hsk_watch_add(watch, name);
+
+    if (rc == HSK_ENOMEM) {
+      fclose(file);
+      return rc;
+    }
+
+    if (rc != HSK_SUCCESS) {
+      hsk_watch_log(watch, "%s:%d: invalid watchlist entry\n", path, num);
+      continue;
+    }
+
+    *count += 1;
+  }
+
+  fclose(file);
+
+  return HSK_SUCCESS;
+}
+
+/*
+ * Persistence
+ */
+
+static bool
+hsk_watch_read_name(
+  hsk_watch_t *watch,
+  uint8_t **data,
+  size_t *data_len
+) {
+  uint8_t name_len, exists;
+  char name[64];
+  uint8_t root[32];
+  uint16_t res_len;
+
+  if (!read_u8(data, data_len, &name_len) || name_len > 63)
+    return false;
+
+  if (!read_bytes(data, data_len, (uint8_t *)name, name_len))
+    return false;
+
+  name[name_len] = '\0';
+
+  if (!read_bytes(data, data_len, root, 32))
+    return false;
+
+  if (!read_u8(data, data_len, &exists))
+    return false;
+
+  if (!read_u16(data, data_len, &res_len) || *data_len < res_len)
+    return false;
+
+  const uint8_t *res = *data;
+
+  *data += res_len;
+  *data_len -= res_len;
+
+  // Dropped from the list since.
+  uint8_t hash[32];
+  hsk_hash_name(name, hash);
+
+  hsk_watch_name_t *item = hsk_map_get(&watch->map, hash);
+
+  if (!item)
+    return true;
+
+  return hsk_watch_name_set(item, root, exists != 0, res, res_len);
+}
+
+// Names are added first: only what is known
+// about those is loaded.
+int
+hsk_watch_open(hsk_watch_t *watch, const char *prefix) {
+  if (!watch || !prefix)
+    return HSK_EBADARGS;
+
+  if (strlen(prefix) + sizeof(HSK_WATCH_FILE) + 5 > sizeof(watch->path))
+    return HSK_EBADARGS;
+
+  if (mkdir(prefix, 0755) != 0 && errno != EEXIST)
+    return HSK_EFAILURE;
+
+  sprintf(watch->path, "%s/%s", prefix, HSK_WATCH_FILE);
+
+  FILE *file = fopen(watch->path, "rb");
+
+  // Nothing saved yet.
+  if (!file)
+    return HSK_SUCCESS;
+
+  int rc = HSK_EENCODING;
+  uint8_t *raw = NULL;
+
+  if (fseek(file, 0, SEEK_END) != 0)
+    goto done;
+
+  long size = ftell(file);
+
+  if (size < HSK_WATCH_HDR_SIZE || fseek(file, 0, SEEK_SET) != 0)
+    goto done;
+
+  raw = hsk_malloc((size_t)size);
+
+  if (!raw) {
+    rc = HSK_ENOMEM;
+    goto done;
+  }
+
+  if (fread(raw, 1, (size_t)size, file) != (size_t)size)
+    goto done;
+
+  uint8_t *data = raw;
+  size_t data_len = (size_t)size;
+  uint32_t magic, version, network, count;
+
+  read_u32(&data, &data_len, &magic);
+  read_u32(&data, &data_len, &version);
+  read_u32(&data, &data_len, &network);
+  read_u32(&data, &data_len, &count);
+
+  if (magic != HSK_WATCH_MAGIC
+      || version != HSK_WATCH_VERSION
+      || network != HSK_MAGIC) {
+    goto done;
+  }
+
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    if (!hsk_watch_read_name(watch, &data, &data_len))
+      goto done;
+  }
+
+  if (data_len != 0)
+    goto done;
+
+  hsk_watch_log(watch, "loaded %u names from %s\n", count, watch->path);
+
+  rc = HSK_SUCCESS;
+
+done:
+  if (raw)
+    hsk_free(raw);
+
+  fclose(file);
+
+  return rc;
+}
+
+int
+hsk_watch_flush(hsk_watch_t *watch) {
+  if (!watch)
+    return HSK_EBADARGS;
+
+  // Opened without a prefix: memory only.
+  if (watch->path[0] == '\0') {
+    watch->dirty = false;
+    return HSK_SUCCESS;
+  }
+
+  uint32_t count = 0;
+  size_t size = HSK_WATCH_HDR_SIZE;
+  int i;
+
+  for (i = 0; i < watch->count; i++) {
+    const hsk_watch_name_t *item = watch->names[i];
+
+    if (!item->verified)
+      continue;
+
+    count += 1;
+    size += 1 + strlen(item->name) + 32 + 1 + 2 + item->data_len;
+  }
+
+  uint8_t *raw = hsk_malloc(size);
+
+  if (!raw)
+    return HSK_ENOMEM;
+
+  uint8_t *data = raw;
+
+  write_u32(&data, HSK_WATCH_MAGIC);
+  write_u32(&data, HSK_WATCH_VERSION);
+  write_u32(&data, HSK_MAGIC);
+  write_u32(&data, count);
+
+  for (i = 0; i < watch->count; i++) {
+    const hsk_watch_name_t *item = watch->names[i];
+    size_t name_len = strlen(item->name);
+
+    if (!item->verified)
+      continue;
+
+    write_u8(&data, (uint8_t)name_len);
+    write_bytes(&data, (const uint8_t *)item->name, name_len);
+    write_bytes(&data, item->root, 32);
+    write_u8(&data, item->exists ? 1 : 0);
+    write_u16(&data, (uint16_t)item->data_len);
+    write_bytes(&data, item->data, item->data_len);
+  }
+
+  assert((size_t)(data - raw) == size);
+
+  char tmp[sizeof(watch->path) + 4];
+  sprintf(tmp, "%s.tmp", watch->path);
+
+  int rc = HSK_EFAILURE;
+  FILE *file = fopen(tmp, "wb");
+
+  if (!file)
+    goto done;
+
+  if (fwrite(raw, 1, size, file) != size) {
+    fclose(file);
+    remove(tmp);
+    goto done;
+  }
+
+  if (fflush(file) != 0 || fclose(file) != 0) {
+    remove(tmp);
+    goto done;
+  }
+
+  if (rename(tmp, watch->path) != 0) {
+    remove(tmp);
+    goto done;
+  }
+
+  watch->dirty = false;
+  rc = HSK_SUCCESS;
+
+done:
+  hsk_free(raw);
+  return rc;
+}
+
+/*
+ * Lookups
+ */
+
+// Only what was verified against this root.
+const hsk_watch_name_t *
+hsk_watch_lookup(hsk_watch_t *watch, const uint8_t *hash, const uint8_t *root) {
+  assert(watch && hash && root);
+
+  const hsk_watch_name_t *item = hsk_map_get(&watch->map, hash);
+
+  if (!item || !item->verified || memcmp(item->root, root, 32) != 0)
+    return NULL;
+
+  watch->hits += 1;
+
+  return item;
+}
+
+// A verified proof for any name: kept if the
+// name is watched. Returns whether it was.
+bool
+hsk_watch_update(
+  hsk_watch_t *watch,
+  const uint8_t *hash,
+  const uint8_t *root,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  assert(watch && hash && root);
+
+  hsk_watch_name_t *item = hsk_map_get(&watch->map, hash);
+
+  if (!item)
+    return false;
+
+  if (item->verified && memcmp(item->root, root, 32) == 0)
+    return true;
+
+  if (data_len > 0xffff)
+    return false;
+
+  if (!hsk_watch_name_set(item, root, exists, data, data_len))
+    return false;
+
+  watch->dirty = true;
+
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef _HSK_WATCH_H
+#define _HSK_WATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "map.h"
+
+// Names on the watchlist have their proofs
+// fetched every time the safe root moves, and
+// the verified results kept in a store of their
+// own (saved under the prefix) that lookups try
+// before asking a peer.
+#define HSK_WATCH_MAGIC 0x68637477
+#define HSK_WATCH_VERSION 1
+#define HSK_WATCH_FILE "watch.dat"
+#define HSK_WATCH_MAX 4096
+
+// File header: magic, version, network magic
+// and a count. Each record is the name (length
+// prefixed), the root its proof was verified
+// against, whether it exists and the resource
+// (length prefixed).
+#define HSK_WATCH_HDR_SIZE 16
+
+typedef struct hsk_watch_name_s {
+  char name[64];
+  uint8_t hash[32];
+  uint8_t root[32];
+  bool verified;
+  bool exists;
+  uint8_t *data;
+  size_t data_len;
+} hsk_watch_name_t;
+
+typedef struct hsk_watch_s {
+  hsk_map_t map;
+  hsk_watch_name_t **names;
+  int count;
+  bool dirty;
+  uint64_t hits;
+  char path[1024];
+} hsk_watch_t;
+
+void
+hsk_watch_init(hsk_watch_t *watch);
+
+void
+hsk_watch_uninit(hsk_watch_t *watch);
+
+int
+hsk_watch_add(hsk_watch_t *watch, const char *name);
+
+int
+hsk_watch_read_list(hsk_watch_t *watch, const char *path, int *count);
+
+int
+hsk_watch_open(hsk_watch_t *watch, const char *prefix);
+
+int
+hsk_watch_flush(hsk_watch_t *watch);
+
+const hsk_watch_name_t *
+hsk_watch_lookup(hsk_watch_t *watch, const uint8_t *hash, const uint8_t *root);
+
+bool
+hsk_watch_update(
+  hsk_watch_t *watch,
+  const uint8_t *hash,
+  const uint8_t *root,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+);
+#endif
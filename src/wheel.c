@@ -0,0 +1,127 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "slab.h"
+#include "wheel.h"
+
+// Keep a few free entries per slot around.
+#define HSK_WHEEL_FREE (HSK_WHEEL_SLOTS * 4)
+
+static size_t
+hsk_wheel_slot(int64_t time) {
+  return (size_t)((uint64_t)time % HSK_WHEEL_SLOTS);
+}
+
+void
+hsk_wheel_init(hsk_wheel_t *wheel, int64_t now) {
+  assert(wheel);
+
+  memset(wheel->slots, 0, sizeof(wheel->slots));
+  wheel->time = now;
+  wheel->size = 0;
+  hsk_slab_init(&wheel->entries, sizeof(hsk_wheel_entry_t), HSK_WHEEL_FREE);
+}
+
+void
+hsk_wheel_uninit(hsk_wheel_t *wheel) {
+  if (!wheel)
+    return;
+
+  size_t i;
+
+  for (i = 0; i < HSK_WHEEL_SLOTS; i++) {
+    hsk_wheel_entry_t *entry, *next;
+
+    for (entry = wheel->slots[i]; entry; entry = next) {
+      next = entry->next;
+      hsk_free(entry);
+    }
+
+    wheel->slots[i] = NULL;
+  }
+
+  wheel->size = 0;
+
+  hsk_slab_uninit(&wheel->entries);
+}
+
+bool
+hsk_wheel_add(hsk_wheel_t *wheel, int64_t deadline, const uint8_t *key) {
+  hsk_wheel_entry_t *entry = hsk_slab_alloc(&wheel->entries);
+
+  if (!entry)
+    return false;
+
+  // Anything already due fires on the next advance.
+  if (deadline <= wheel->time)
+    deadline = wheel->time + 1;
+
+  size_t slot = hsk_wheel_slot(deadline);
+
+  entry->deadline = deadline;
+  memcpy(entry->key, key, 32);
+  entry->next = wheel->slots[slot];
+
+  wheel->slots[slot] = entry;
+  wheel->size += 1;
+
+  return true;
+}
+
+void
+hsk_wheel_advance(
+  hsk_wheel_t *wheel,
+  int64_t now,
+  hsk_wheel_cb callback,
+  void *arg
+) {
+  if (now <= wheel->time)
+    return;
+
+  int64_t time = wheel->time;
+  int64_t end = now;
+
+  // Every slot is visited at most once.
+  if (end - time > HSK_WHEEL_SLOTS)
+    time = end - HSK_WHEEL_SLOTS;
+
+  // Detach the due entries first: callbacks may
+  // add new deadlines to the wheel.
+  hsk_wheel_entry_t *due = NULL;
+
+  for (time += 1; time <= end; time++) {
+    hsk_wheel_entry_t **link = &wheel->slots[hsk_wheel_slot(time)];
+
+    while (*link) {
+      hsk_wheel_entry_t *entry = *link;
+
+      if (entry->deadline > now) {
+        link = &entry->next;
+        continue;
+      }
+
+      *link = entry->next;
+
+      entry->next = due;
+      due = entry;
+
+      wheel->size -= 1;
+    }
+  }
+
+  wheel->time = now;
+
+  hsk_wheel_entry_t *next;
+
+  for (; due; due = next) {
+    next = due->next;
+    callback(arg, due->key, due->deadline);
+    hsk_slab_free(&wheel->entries, due);
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef _HSK_WHEEL_H
+#define _HSK_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+/*
+ * Defs
+ */
+
+// One slot per second. Deadlines further out
+// than this wrap around and are skipped until
+// their lap comes up.
+#define HSK_WHEEL_SLOTS 64
+
+/*
+ * Types
+ */
+
+typedef struct hsk_wheel_entry_s {
+  int64_t deadline;
+  uint8_t key[32];
+  struct hsk_wheel_entry_s *next;
+} hsk_wheel_entry_t;
+
+typedef void (*hsk_wheel_cb)(
+  void *arg,
+  const uint8_t *key,
+  int64_t deadline
+);
+
+// Deadlines (in seconds) keyed by a hash. On
+// each advance only the slots for the seconds
+// that passed are visited.
+typedef struct hsk_wheel_s {
+  hsk_wheel_entry_t *slots[HSK_WHEEL_SLOTS];
+  int64_t time;
+  size_t size;
+  hsk_slab_t entries;
+} hsk_wheel_t;
+
+/*
+ * Wheel
+ */
+
+void
+hsk_wheel_init(hsk_wheel_t *wheel, int64_t now);
+
+void
+hsk_wheel_uninit(hsk_wheel_t *wheel);
+
+bool
+hsk_wheel_add(hsk_wheel_t *wheel, int64_t deadline, const uint8_t *key);
+
+void
+hsk_wheel_advance(
+  hsk_wheel_t *wheel,
+  int64_t now,
+  hsk_wheel_cb callback,
+  void *arg
+);
+#endif
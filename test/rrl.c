@@ -0,0 +1,117 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "rrl.h"
+#include "siphash.h"
+
+// Prefixes that share a set must not be able to
+// refill each other's buckets by taking turns.
+
+#define RATE 10
+#define QUERIES 1000
+
+static void
+addr_init(struct sockaddr_in *sa, const char *ip) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sin_family = AF_INET;
+  assert(inet_pton(AF_INET, ip, &sa->sin_addr) == 1);
+}
+
+static uint64_t
+addr_set(const hsk_rrl_t *rrl, const struct sockaddr_in *sa) {
+  uint8_t prefix[16];
+
+  memset(prefix, 0, 16);
+  prefix[10] = 0xff;
+  prefix[11] = 0xff;
+  memcpy(&prefix[12], &sa->sin_addr, HSK_RRL_IPV4_PREFIX / 8);
+
+  return hsk_siphash(prefix, 16, rrl->key) % HSK_RRL_SETS;
+}
+
+// `count` /24s (after the first) in the same
+// set as `sas[0]`.
+static void
+find_colliding(const hsk_rrl_t *rrl, struct sockaddr_in *sas, int count) {
+  uint64_t set = addr_set(rrl, &sas[0]);
+  uint32_t n = 0;
+  int i;
+
+  for (i = 1; i <= count; i++) {
+    for (;;) {
+      char ip[32];
+
+      n += 1;
+      sprintf(ip, "%u.%u.%u.0", (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff);
+      addr_init(&sas[i], ip);
+
+      if (addr_set(rrl, &sas[i]) == set)
+        break;
+    }
+  }
+}
+
+// Sends QUERIES queries in turn from each of
+// `count` sources, all in the same millisecond.
+// Returns how many from `sas[0]` passed.
+static int
+interleave(int count, int *total) {
+  hsk_rrl_t rrl;
+  struct sockaddr_in sas[HSK_RRL_WAYS + 2];
+  int passed = 0;
+  int i;
+
+  hsk_rrl_init(&rrl);
+  assert(hsk_rrl_set_rate(&rrl, RATE));
+
+  addr_init(&sas[0], "198.51.100.7");
+  find_colliding(&rrl, sas, count - 1);
+
+  *total = 0;
+
+  for (i = 0; i < QUERIES * count; i++) {
+    const struct sockaddr *sa = (const struct sockaddr *)&sas[i % count];
+
+    if (hsk_rrl_check(&rrl, sa, 1000) == HSK_RRL_PASS) {
+      *total += 1;
+      if (i % count == 0)
+        passed += 1;
+    }
+  }
+
+  hsk_rrl_uninit(&rrl);
+
+  return passed;
+}
+
+int
+main(void) {
+  int total;
+
+  // One source: a burst of a second's worth.
+  assert(interleave(1, &total) == RATE);
+
+  // Two sources sharing a set: each keeps its
+  // own bucket.
+  assert(interleave(2, &total) == RATE);
+  assert(total == 2 * RATE);
+
+  // More sources than ways: every query takes
+  // a bucket over, and gets what was left in it.
+  for (int count = HSK_RRL_WAYS + 1; count <= HSK_RRL_WAYS + 2; count++) {
+    assert(interleave(count, &total) <= RATE);
+    assert(total <= HSK_RRL_WAYS * RATE);
+  }
+
+  printf("rrl: ok\n");
+
+  return 0;
+}